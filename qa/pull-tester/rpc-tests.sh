@@ -68,6 +68,7 @@ testScripts=(
     'zkey_import_export.py'
     'reorg_limit.py'
     'getblocktemplate.py'
+    'stratum.py'
     'bip65-cltv-p2p.py'
     'bipdersig-p2p.py'
     'p2p_nu_peer_management.py'
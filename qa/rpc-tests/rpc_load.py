@@ -0,0 +1,255 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 The Zero developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+#
+# Load-test the RPC server with the traffic of block explorers and exchanges
+#
+# Many clients, each on its own connection, call a weighted mix of methods
+# against one regtest node for a fixed time, while the main thread mines a
+# block every few seconds. At the end the throughput, error count and
+# latency percentiles of each method are printed.
+#
+# This is a measurement tool rather than a regression test, and is not part
+# of rpc-tests.sh. Compare runs made with the same options on the same
+# machine, e.g.
+#
+#   qa/rpc-tests/rpc_load.py --clients=32 --duration=60 \
+#       --mix=getblock=50,getaddressdeltas=30,z_getbalance=20
+
+import sys; assert sys.version_info < (3,), ur"This script does not run under Python 3. Please use Python 2.7.x."
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import AuthServiceProxy, JSONRPCException
+from test_framework.util import (
+    initialize_chain_clean,
+    start_nodes,
+)
+
+from decimal import Decimal
+import math
+import random
+import threading
+import time
+
+DEFAULT_MIX = ("getblock=35,getaddressdeltas=20,z_getbalance=15,"
+               "getblocktemplate=10,sendrawtransaction=15,z_sendmany=5")
+
+class RPCLoadTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--clients", dest="clients", default=16, type="int",
+                          help="Number of concurrent RPC clients (default: %default)")
+        parser.add_option("--duration", dest="duration", default=30, type="float",
+                          help="Seconds to run the load for (default: %default)")
+        parser.add_option("--mix", dest="mix", default=DEFAULT_MIX,
+                          help="Comma-separated method=weight pairs (default: %default)")
+        parser.add_option("--blocks", dest="blocks", default=200, type="int",
+                          help="Length of the chain to query (default: %default)")
+        parser.add_option("--rawtxs", dest="rawtxs", default=500, type="int",
+                          help="Signed transactions to prepare for sendrawtransaction (default: %default)")
+        parser.add_option("--blockinterval", dest="blockinterval", default=5, type="float",
+                          help="Seconds between blocks mined during the load, 0 for none (default: %default)")
+        parser.add_option("--rpcthreads", dest="rpcthreads", default=0, type="int",
+                          help="-rpcthreads of the node, 0 for its default (default: %default)")
+        parser.add_option("--rpcworkqueue", dest="rpcworkqueue", default=0, type="int",
+                          help="-rpcworkqueue of the node, 0 for its default (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        args = ['-txindex', '-experimentalfeatures', '-insightexplorer']
+        if self.options.rpcthreads > 0:
+            args.append('-rpcthreads=%d' % self.options.rpcthreads)
+        if self.options.rpcworkqueue > 0:
+            args.append('-rpcworkqueue=%d' % self.options.rpcworkqueue)
+        self.nodes = start_nodes(1, self.options.tmpdir, [args])
+        self.is_network_split = False
+
+    def parse_mix(self):
+        mix = []
+        for item in self.options.mix.split(','):
+            method, weight = item.split('=')
+            method = method.strip()
+            if method not in self.calls:
+                raise ValueError("Unknown method in --mix: " + method)
+            if float(weight) > 0:
+                mix.append((method, float(weight)))
+        if not mix:
+            raise ValueError("--mix selects no method")
+        return mix
+
+    def prepare(self):
+        node = self.nodes[0]
+        print("Mining %d blocks..." % self.options.blocks)
+        node.generate(max(self.options.blocks, 101))
+        self.blockhashes = [node.getblockhash(h) for h in range(node.getblockcount() + 1)]
+
+        # Addresses with a history for getaddressdeltas and z_getbalance
+        self.taddrs = [node.getnewaddress() for i in range(10)]
+        for taddr in self.taddrs:
+            node.sendtoaddress(taddr, Decimal('1.0'))
+
+        # The source of z_sendmany, split so that concurrent operations
+        # can find unspent coins
+        self.zsource = node.getnewaddress()
+        for i in range(50):
+            node.sendtoaddress(self.zsource, Decimal('0.5'))
+        self.zaddr = node.z_getnewaddress('sapling')
+        node.generate(1)
+
+        # Notes for z_getbalance to add up
+        opids = [node.z_sendmany(self.taddrs[i], [{'address': self.zaddr, 'amount': Decimal('0.2')}])
+                 for i in range(5)]
+        self.wait_operations(opids)
+        node.generate(1)
+
+        # One coin per transaction for sendrawtransaction, signed up front so
+        # that the load measures relaying alone
+        print("Signing %d transactions..." % self.options.rawtxs)
+        amount = Decimal('0.1')
+        fee = Decimal('0.0001')
+        remaining = self.options.rawtxs
+        while remaining > 0:
+            n = min(remaining, 100)
+            node.sendmany("", dict((node.getnewaddress(), amount) for i in range(n)))
+            remaining -= n
+        node.generate(1)
+        self.rawtxs = []
+        for utxo in node.listunspent(1, 1):
+            if len(self.rawtxs) == self.options.rawtxs:
+                break
+            if utxo['amount'] != amount:
+                continue
+            raw = node.createrawtransaction([{'txid': utxo['txid'], 'vout': utxo['vout']}],
+                                            {node.getnewaddress(): amount - fee})
+            self.rawtxs.append(node.signrawtransaction(raw)['hex'])
+        self.rawtx_lock = threading.Lock()
+        self.opids = []
+        self.opid_lock = threading.Lock()
+
+    def wait_operations(self, opids, timeout=300):
+        node = self.nodes[0]
+        results = []
+        deadline = time.time() + timeout
+        pending = list(opids)
+        while pending and time.time() < deadline:
+            for result in node.z_getoperationresult(pending[:100]):
+                results.append(result)
+                pending.remove(result['id'])
+            time.sleep(0.5)
+        return results
+
+    # The calls, each taking the client's connection and returning False if
+    # it could not be made
+    def call_getblock(self, rpc):
+        rpc.getblock(random.choice(self.blockhashes))
+        return True
+
+    def call_getaddressdeltas(self, rpc):
+        rpc.getaddressdeltas({'addresses': [random.choice(self.taddrs)]})
+        return True
+
+    def call_z_getbalance(self, rpc):
+        rpc.z_getbalance(random.choice([self.zaddr, random.choice(self.taddrs)]))
+        return True
+
+    def call_getblocktemplate(self, rpc):
+        rpc.getblocktemplate()
+        return True
+
+    def call_sendrawtransaction(self, rpc):
+        with self.rawtx_lock:
+            if not self.rawtxs:
+                return False
+            rawtx = self.rawtxs.pop()
+        rpc.sendrawtransaction(rawtx)
+        return True
+
+    def call_z_sendmany(self, rpc):
+        # Only the submission is timed; the operations are checked at the end
+        opid = rpc.z_sendmany(self.zsource, [{'address': self.zaddr, 'amount': Decimal('0.01')}])
+        with self.opid_lock:
+            self.opids.append(opid)
+        return True
+
+    def client(self, mix, deadline, latencies, errors):
+        rpc = AuthServiceProxy(self.nodes[0].url, timeout=600)
+        mix = list(mix)
+        while mix and time.time() < deadline:
+            pick = random.random() * sum(weight for method, weight in mix)
+            for method, weight in mix:
+                pick -= weight
+                if pick < 0:
+                    break
+            start = time.time()
+            try:
+                if not self.calls[method](rpc):
+                    mix = [m for m in mix if m[0] != method]
+                    continue
+            except (JSONRPCException, IOError) as e:
+                errors[method] = errors.get(method, 0) + 1
+                if errors[method] == 1:
+                    print("%s failed: %s" % (method, e))
+                # A failed request can leave the connection unusable
+                rpc = AuthServiceProxy(self.nodes[0].url, timeout=600)
+                continue
+            latencies.setdefault(method, []).append(time.time() - start)
+
+    def run_test(self):
+        self.calls = {
+            'getblock': self.call_getblock,
+            'getaddressdeltas': self.call_getaddressdeltas,
+            'z_getbalance': self.call_z_getbalance,
+            'getblocktemplate': self.call_getblocktemplate,
+            'sendrawtransaction': self.call_sendrawtransaction,
+            'z_sendmany': self.call_z_sendmany,
+        }
+        mix = self.parse_mix()
+        self.prepare()
+
+        print("Running %d clients for %gs..." % (self.options.clients, self.options.duration))
+        # Per-client results, merged afterwards so that clients share no locks
+        latencies = [{} for i in range(self.options.clients)]
+        errors = [{} for i in range(self.options.clients)]
+        start = time.time()
+        deadline = start + self.options.duration
+        threads = [threading.Thread(target=self.client, args=(mix, deadline, latencies[i], errors[i]))
+                   for i in range(self.options.clients)]
+        for t in threads:
+            t.daemon = True
+            t.start()
+        while time.time() < deadline:
+            time.sleep(min(self.options.blockinterval or self.options.duration, max(deadline - time.time(), 0)))
+            if self.options.blockinterval > 0 and time.time() < deadline:
+                self.nodes[0].generate(1)
+        for t in threads:
+            t.join()
+        elapsed = time.time() - start
+
+        print("")
+        print("%-20s %8s %7s %9s %9s %9s %9s %9s" %
+              ("method", "calls", "errors", "calls/s", "mean ms", "p50 ms", "p99 ms", "max ms"))
+        for method, weight in mix:
+            times = sorted(sum((l.get(method, []) for l in latencies), []))
+            nerrors = sum(e.get(method, 0) for e in errors)
+            if not times:
+                print("%-20s %8d %7d" % (method, 0, nerrors))
+                continue
+            def percentile(p):
+                return times[max(int(math.ceil(p * len(times))) - 1, 0)] * 1000
+            print("%-20s %8d %7d %9.1f %9.2f %9.2f %9.2f %9.2f" %
+                  (method, len(times), nerrors, len(times) / elapsed,
+                   sum(times) / len(times) * 1000, percentile(0.5), percentile(0.99), times[-1] * 1000))
+
+        if self.opids:
+            results = self.wait_operations(self.opids)
+            failed = [r for r in results if r['status'] != 'success']
+            print("")
+            print("z_sendmany operations: %d succeeded, %d failed, %d unfinished" %
+                  (len(results) - len(failed), len(failed), len(self.opids) - len(results)))
+
+if __name__ == '__main__':
+    RPCLoadTest().main()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 The Zero developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+#
+# Test the Stratum server (-stratum)
+
+import sys; assert sys.version_info < (3,), ur"This script does not run under Python 3. Please use Python 2.7.x."
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    initialize_chain_clean,
+    start_nodes,
+)
+
+from binascii import hexlify, unhexlify
+import json
+import os
+import socket
+
+def stratum_port():
+    return 13000 + os.getpid()%999
+
+def internal_hex(display_hex):
+    # Hashes are shown byte-reversed, and sent to miners as serialized
+    return hexlify(unhexlify(display_hex)[::-1])
+
+class StratumClient(object):
+
+    def __init__(self, port):
+        self.sock = socket.create_connection(('127.0.0.1', port), timeout=60)
+        self.buf = ''
+        self.next_id = 0
+        self.notifications = []
+
+    def read(self):
+        while '\n' not in self.buf:
+            data = self.sock.recv(4096)
+            assert data, "connection closed"
+            self.buf += data
+        line, self.buf = self.buf.split('\n', 1)
+        return json.loads(line)
+
+    def request(self, method, params):
+        self.next_id += 1
+        msg = {'id': self.next_id, 'method': method, 'params': params}
+        self.sock.sendall(json.dumps(msg) + '\n')
+        while True:
+            reply = self.read()
+            if reply.get('method') is not None:
+                self.notifications.append(reply)
+            elif reply['id'] == self.next_id:
+                return reply
+
+    def notification(self, method):
+        while True:
+            for msg in self.notifications:
+                if msg['method'] == method:
+                    self.notifications.remove(msg)
+                    return msg['params']
+            self.notifications.append(self.read())
+
+class StratumTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        args = ['-stratum', '-stratumport=%d' % stratum_port(), '-debug=stratum']
+        self.nodes = start_nodes(1, self.options.tmpdir, [args])
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(1) # Leave initial block download
+
+        miner = StratumClient(stratum_port())
+        reply = miner.request('mining.subscribe', ['127.0.0.1', stratum_port(), 'test', None])
+        assert_equal(reply['error'], None)
+        nonce1 = reply['result'][1]
+        assert_equal(len(nonce1), 8)
+        reply = miner.request('mining.authorize', ['worker', 'x'])
+        assert_equal(reply['result'], True)
+
+        target = miner.notification('mining.set_target')
+        assert_equal(len(target[0]), 64)
+        job = miner.notification('mining.notify')
+        assert_equal(job[2], internal_hex(node.getbestblockhash()))
+        assert_equal(job[7], True)
+
+        # Submissions that do not check out
+        nonce2 = '00' * (32 - len(nonce1) // 2)
+        solution = '24' + '00' * 36
+        reply = miner.request('mining.submit', ['worker', 'nosuchjob', job[5], nonce2, solution])
+        assert_equal(reply['error'][0], 21)
+        reply = miner.request('mining.submit', ['worker', job[0], job[5], nonce2[2:], solution])
+        assert_equal(reply['error'][0], 20)
+        reply = miner.request('mining.submit', ['worker', job[0], job[5], nonce2, solution])
+        assert(reply['error'][0] in (20, 23))
+
+        # A new tip is pushed at once, and ends the earlier jobs
+        node.generate(1)
+        tip = internal_hex(node.getbestblockhash())
+        job2 = miner.notification('mining.notify')
+        while job2[2] != tip:
+            job2 = miner.notification('mining.notify')
+        assert_equal(job2[7], True)
+        reply = miner.request('mining.submit', ['worker', job[0], job[5], nonce2, solution])
+        assert_equal(reply['error'][0], 21)
+
+        # Miners must subscribe before submitting
+        other = StratumClient(stratum_port())
+        reply = other.request('mining.submit', ['worker', job2[0], job2[5], nonce2, solution])
+        assert_equal(reply['error'][0], 25)
+
+if __name__ == '__main__':
+    StratumTest().main()
@@ -206,6 +206,9 @@ case "$1" in
             verifyequihash)
                 zcash_rpc zcbenchmark verifyequihash 1000
                 ;;
+            verifyinvalidequihash)
+                zcash_rpc zcbenchmark verifyinvalidequihash 1000
+                ;;
             validatelargetx)
                 zcash_rpc zcbenchmark validatelargetx 10 "${@:3}"
                 ;;
@@ -268,6 +271,9 @@ case "$1" in
             verifyequihash)
                 zcash_rpc zcbenchmark verifyequihash 1
                 ;;
+            verifyinvalidequihash)
+                zcash_rpc zcbenchmark verifyinvalidequihash 1
+                ;;
             validatelargetx)
                 zcash_rpc zcbenchmark validatelargetx 1
                 ;;
@@ -331,6 +337,9 @@ case "$1" in
             verifyequihash)
                 zcash_rpc zcbenchmark verifyequihash 1
                 ;;
+            verifyinvalidequihash)
+                zcash_rpc zcbenchmark verifyinvalidequihash 1
+                ;;
             trydecryptnotes)
                 zcash_rpc zcbenchmark trydecryptnotes 1 "${@:3}"
                 ;;
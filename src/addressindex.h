@@ -88,6 +88,29 @@ struct CAddressUnspentValue {
     }
 };
 
+/** Running totals of an address, kept next to its address index entries */
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+    }
+};
+
 struct CAddressIndexKey {
     unsigned int type;
     uint160 hashBytes;
@@ -360,8 +360,9 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
                     MilliSleep(kRetrySleepInterval);
             }
             int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
+            std::map<int, CAddrInfo>::const_iterator it = mapInfo.find(nId);
+            assert(it != mapInfo.end());
+            const CAddrInfo& info = it->second;
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
@@ -382,8 +383,9 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
                     MilliSleep(kRetrySleepInterval);
             }
             int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
+            std::map<int, CAddrInfo>::const_iterator it = mapInfo.find(nId);
+            assert(it != mapInfo.end());
+            const CAddrInfo& info = it->second;
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
@@ -477,16 +479,19 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
     if (nNodes > ADDRMAN_GETADDR_MAX)
         nNodes = ADDRMAN_GETADDR_MAX;
 
-    // gather a list of random nodes, skipping those of low quality
-    for (unsigned int n = 0; n < vRandom.size(); n++) {
+    // gather a list of random nodes, skipping those of low quality. This
+    // runs under a shared lock, so it shuffles a copy of vRandom.
+    std::vector<int> vIds(vRandom);
+    for (unsigned int n = 0; n < vIds.size(); n++) {
         if (vAddr.size() >= nNodes)
             break;
 
-        int nRndPos = RandomInt(vRandom.size() - n) + n;
-        SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+        int nRndPos = RandomInt(vIds.size() - n) + n;
+        std::swap(vIds[n], vIds[nRndPos]);
+        std::map<int, CAddrInfo>::const_iterator it = mapInfo.find(vIds[n]);
+        assert(it != mapInfo.end());
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
+        const CAddrInfo& ai = it->second;
         if (!ai.IsTerrible())
             vAddr.push_back(ai);
     }
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "memusage.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -17,6 +18,9 @@
 #include <stdint.h>
 #include <vector>
 
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
 /**
  * Extended statistics about a CAddress
  */
@@ -172,8 +176,9 @@ public:
 class CAddrMan
 {
 private:
-    //! critical section to protect the inner data structures
-    mutable CCriticalSection cs;
+    //! protects the inner data structures. Select, GetAddr and serialization
+    //! only read them and share it; everything else takes it exclusively.
+    mutable boost::shared_mutex cs;
 
     //! last used nId
     int nIdCount;
@@ -251,7 +256,7 @@ protected:
 public:
     /**
      * serialized format:
-     * * version byte (currently 1)
+     * * version byte (currently 2)
      * * 0x20 + nKey (serialized as if it were a vector, for backward compatibility)
      * * nNew
      * * nTried
@@ -261,6 +266,9 @@ public:
      * * for each bucket:
      *   * number of elements
      *   * for each element: index
+     * * (version 2) number of "tried" buckets, and bucket size
+     * * (version 2) for each tried addrinfo: bucket * bucket size + position
+     * * (version 2) for each element of each "new" bucket: position in the bucket
      *
      * 2**30 is xorred with the number of buckets to make addrman deserializer v0 detect it
      * as incompatible. This is necessary because it did not check the version number on
@@ -272,6 +280,10 @@ public:
      * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't change,
      * otherwise it is reconstructed as well.
      *
+     * Version 2 appends the bucket positions of every entry, so that a file written with
+     * the same bucket geometry loads without hashing each address again. Version 1
+     * readers stop before the appended data and recompute positions as before.
+     *
      * This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
      * changes to the ADDRMAN_ parameters without breaking the on-disk structure.
      *
@@ -281,9 +293,9 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const
     {
-        LOCK(cs);
+        boost::shared_lock<boost::shared_mutex> lock(cs);
 
-        unsigned char nVersion = 1;
+        unsigned char nVersion = 2;
         s << nVersion;
         s << ((unsigned char)32);
         s << nKey;
@@ -304,14 +316,26 @@ public:
             }
         }
         nIds = 0;
+        std::vector<int> vTriedPos;
+        vTriedPos.reserve(nTried);
+        std::map<int, int> mapTriedPos;
+        for (int bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                if (vvTried[bucket][i] != -1)
+                    mapTriedPos[vvTried[bucket][i]] = bucket * ADDRMAN_BUCKET_SIZE + i;
+            }
+        }
         for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             const CAddrInfo &info = (*it).second;
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
                 s << info;
+                vTriedPos.push_back(mapTriedPos[(*it).first]);
                 nIds++;
             }
         }
+        std::vector<int> vNewPos;
+        vNewPos.reserve(nNew);
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             int nSize = 0;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
@@ -323,15 +347,22 @@ public:
                 if (vvNew[bucket][i] != -1) {
                     int nIndex = mapUnkIds[vvNew[bucket][i]];
                     s << nIndex;
+                    vNewPos.push_back(i);
                 }
             }
         }
+        s << (int)ADDRMAN_TRIED_BUCKET_COUNT;
+        s << (int)ADDRMAN_BUCKET_SIZE;
+        for (size_t n = 0; n < vTriedPos.size(); n++)
+            s << vTriedPos[n];
+        for (size_t n = 0; n < vNewPos.size(); n++)
+            s << vNewPos[n];
     }
 
     template<typename Stream>
     void Unserialize(Stream& s)
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
 
         Clear();
 
@@ -357,6 +388,9 @@ public:
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        // Whether the new table positions in the file can be used as they are
+        bool fNewBuckets = nVersion >= 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT;
+
         // Deserialize entries from the new table.
         for (int n = 0; n < nNew; n++) {
             CAddrInfo &info = mapInfo[n];
@@ -364,7 +398,7 @@ public:
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
-            if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
+            if (!fNewBuckets) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
                 int nUBucket = info.GetNewBucket(nKey);
@@ -377,13 +411,54 @@ public:
         }
         nIdCount = nNew;
 
-        // Deserialize entries from the tried table.
+        // Deserialize entries from the tried table; they are placed once the
+        // positions stored after the new table are known.
+        std::vector<CAddrInfo> vTried(nTried);
+        for (int n = 0; n < nTried; n++)
+            s >> vTried[n];
+
+        // Deserialize the new table bucket lists.
+        std::vector<std::pair<int, int> > vNewRefs;
+        for (int bucket = 0; bucket < nUBuckets; bucket++) {
+            int nSize = 0;
+            s >> nSize;
+            for (int n = 0; n < nSize; n++) {
+                int nIndex = 0;
+                s >> nIndex;
+                vNewRefs.push_back(std::make_pair(bucket, nIndex));
+            }
+        }
+
+        // Deserialize the stored bucket positions (if present).
+        std::vector<int> vTriedPos, vNewPos;
+        if (nVersion >= 2) {
+            int nKBuckets = 0, nBucketSize = 0;
+            s >> nKBuckets;
+            s >> nBucketSize;
+            vTriedPos.resize(nTried);
+            for (int n = 0; n < nTried; n++)
+                s >> vTriedPos[n];
+            vNewPos.resize(vNewRefs.size());
+            for (size_t n = 0; n < vNewRefs.size(); n++)
+                s >> vNewPos[n];
+            if (nKBuckets != ADDRMAN_TRIED_BUCKET_COUNT || nBucketSize != ADDRMAN_BUCKET_SIZE) {
+                vTriedPos.clear();
+                vNewPos.clear();
+            }
+        }
+
+        // Place the tried entries.
         int nLost = 0;
         for (int n = 0; n < nTried; n++) {
-            CAddrInfo info;
-            s >> info;
-            int nKBucket = info.GetTriedBucket(nKey);
-            int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            CAddrInfo &info = vTried[n];
+            int nKBucket, nKBucketPos;
+            if (!vTriedPos.empty() && vTriedPos[n] >= 0 && vTriedPos[n] < ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE) {
+                nKBucket = vTriedPos[n] / ADDRMAN_BUCKET_SIZE;
+                nKBucketPos = vTriedPos[n] % ADDRMAN_BUCKET_SIZE;
+            } else {
+                nKBucket = info.GetTriedBucket(nKey);
+                nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            }
             if (vvTried[nKBucket][nKBucketPos] == -1) {
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
@@ -398,20 +473,20 @@ public:
         }
         nTried -= nLost;
 
-        // Deserialize positions in the new table (if possible).
-        for (int bucket = 0; bucket < nUBuckets; bucket++) {
-            int nSize = 0;
-            s >> nSize;
-            for (int n = 0; n < nSize; n++) {
-                int nIndex = 0;
-                s >> nIndex;
-                if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
-                    int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
-                    if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
-                        info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
-                    }
+        // Place the new table entries at their positions (if possible).
+        for (size_t n = 0; fNewBuckets && n < vNewRefs.size(); n++) {
+            int bucket = vNewRefs[n].first;
+            int nIndex = vNewRefs[n].second;
+            if (nIndex >= 0 && nIndex < nNew) {
+                CAddrInfo &info = mapInfo[nIndex];
+                int nUBucketPos;
+                if (!vNewPos.empty() && vNewPos[n] >= 0 && vNewPos[n] < ADDRMAN_BUCKET_SIZE)
+                    nUBucketPos = vNewPos[n];
+                else
+                    nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
+                if (vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
+                    info.nRefCount++;
+                    vvNew[bucket][nUBucketPos] = nIndex;
                 }
             }
         }
@@ -470,16 +545,20 @@ public:
         return vRandom.size();
     }
 
-    //! Consistency check
+    //! Estimated heap usage of the address tables; the buckets are part of the object.
+    size_t DynamicMemoryUsage() const
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        return memusage::DynamicUsage(mapInfo) + memusage::DynamicUsage(mapAddr) + memusage::DynamicUsage(vRandom);
+    }
+
+    //! Consistency check; the caller holds cs
     void Check()
     {
 #ifdef DEBUG_ADDRMAN
-        {
-            LOCK(cs);
-            int err;
-            if ((err=Check_()))
-                LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
-        }
+        int err;
+        if ((err=Check_()))
+            LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
 #endif
     }
 
@@ -488,7 +567,7 @@ public:
     {
         bool fRet = false;
         {
-            LOCK(cs);
+            boost::unique_lock<boost::shared_mutex> lock(cs);
             Check();
             fRet |= Add_(addr, source, nTimePenalty);
             Check();
@@ -503,7 +582,7 @@ public:
     {
         int nAdd = 0;
         {
-            LOCK(cs);
+            boost::unique_lock<boost::shared_mutex> lock(cs);
             Check();
             for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
                 nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
@@ -518,7 +597,7 @@ public:
     void Good(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
         {
-            LOCK(cs);
+            boost::unique_lock<boost::shared_mutex> lock(cs);
             Check();
             Good_(addr, nTime);
             Check();
@@ -529,7 +608,7 @@ public:
     void Attempt(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
         {
-            LOCK(cs);
+            boost::unique_lock<boost::shared_mutex> lock(cs);
             Check();
             Attempt_(addr, nTime);
             Check();
@@ -543,7 +622,7 @@ public:
     {
         CAddrInfo addrRet;
         {
-            LOCK(cs);
+            boost::shared_lock<boost::shared_mutex> lock(cs);
             Check();
             addrRet = Select_(newOnly);
             Check();
@@ -554,13 +633,13 @@ public:
     //! Return a bunch of addresses, selected at random.
     std::vector<CAddress> GetAddr()
     {
-        Check();
         std::vector<CAddress> vAddr;
         {
-            LOCK(cs);
+            boost::shared_lock<boost::shared_mutex> lock(cs);
+            Check();
             GetAddr_(vAddr);
+            Check();
         }
-        Check();
         return vAddr;
     }
 
@@ -568,7 +647,7 @@ public:
     void Connected(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
         {
-            LOCK(cs);
+            boost::unique_lock<boost::shared_mutex> lock(cs);
             Check();
             Connected_(addr, nTime);
             Check();
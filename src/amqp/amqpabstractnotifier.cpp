@@ -19,3 +19,12 @@ bool AMQPAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+void AMQPAbstractNotifier::NotifyTransactionsDropped(unsigned int /*nCount*/)
+{
+}
+
+bool AMQPAbstractNotifier::NotifyWalletNote(const std::string &/*strEvent*/)
+{
+    return true;
+}
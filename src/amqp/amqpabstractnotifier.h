@@ -6,6 +6,7 @@
 #define ZCASH_AMQP_AMQPABSTRACTNOTIFIER_H
 
 #include "amqpconfig.h"
+#include "notificationpublisher.h"
 
 class CBlockIndex;
 class AMQPAbstractNotifier;
@@ -15,7 +16,7 @@ typedef AMQPAbstractNotifier* (*AMQPNotifierFactory)();
 class AMQPAbstractNotifier
 {
 public:
-    AMQPAbstractNotifier() { }
+    AMQPAbstractNotifier() : highWaterMark_(DEFAULT_NOTIFICATION_HWM) { }
     virtual ~AMQPAbstractNotifier();
 
     template <typename T>
@@ -28,16 +29,22 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    void SetHighWaterMark(size_t n) { highWaterMark_ = n; }
 
     virtual bool Initialize() = 0;
     virtual void Shutdown() = 0;
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    // nCount transaction notifications were dropped over the high-water mark
+    virtual void NotifyTransactionsDropped(unsigned int nCount);
+    // strEvent is a wallet note event as JSON
+    virtual bool NotifyWalletNote(const std::string &strEvent);
 
 protected:
     std::string type;
     std::string address;
+    size_t highWaterMark_;
 };
 
 #endif // ZCASH_AMQP_AMQPABSTRACTNOTIFIER_H
@@ -9,24 +9,25 @@
 #include "main.h"
 #include "streams.h"
 #include "util.h"
+#include "utilstrencodings.h"
+
+#include <memory>
 
 // AMQP 1.0 Support
 //
 // The boost::signals2 signals and slot system is thread safe, so CValidationInterface listeners
 // can be invoked from any thread.
 //
-// Currently signals are fired from main.cpp so the callbacks should be invoked on the same thread.
-// It should be safe to share objects responsible for sending, as they should not be run concurrently
-// across different threads.
-//
-// Developers should be mindful of where notifications are fired to avoid potential race conditions.
-// For example, different signals targeting the same address could be fired from different threads
-// in different parts of the system around the same time.
+// The callbacks only queue messages on the publisher of the interface, and the notifiers are
+// only used from its thread, so objects responsible for sending are never run concurrently.
+// Transactions entering the mempool are dropped while more than -notificationhwm messages are
+// queued, and the transaction notifiers leave a gap in their sequence numbers for them.
 //
 // Like the ZMQ notification interface, if a notifier fails to send a message, the notifier is shut down.
 //
 
-AMQPNotificationInterface::AMQPNotificationInterface()
+AMQPNotificationInterface::AMQPNotificationInterface() :
+    publisher("amqp"), highWaterMark_(DEFAULT_NOTIFICATION_HWM), fTransactions(false), fWalletNotes(false)
 {
 }
 
@@ -44,11 +45,20 @@ AMQPNotificationInterface* AMQPNotificationInterface::CreateWithArguments(const
     AMQPNotificationInterface* notificationInterface = nullptr;
     std::map<std::string, AMQPNotifierFactory> factories;
     std::list<AMQPAbstractNotifier*> notifiers;
+    size_t highWaterMark = DEFAULT_NOTIFICATION_HWM;
+    bool fTransactions = false;
+    bool fWalletNotes = false;
+
+    std::map<std::string, std::string>::const_iterator hwm = args.find("-notificationhwm");
+    if (hwm != args.end()) {
+        highWaterMark = std::max<int64_t>(1, atoi64(hwm->second));
+    }
 
     factories["pubhashblock"] = AMQPAbstractNotifier::Create<AMQPPublishHashBlockNotifier>;
     factories["pubhashtx"] = AMQPAbstractNotifier::Create<AMQPPublishHashTransactionNotifier>;
     factories["pubrawblock"] = AMQPAbstractNotifier::Create<AMQPPublishRawBlockNotifier>;
     factories["pubrawtx"] = AMQPAbstractNotifier::Create<AMQPPublishRawTransactionNotifier>;
+    factories["pubwalletnote"] = AMQPAbstractNotifier::Create<AMQPPublishWalletNoteNotifier>;
 
     for (std::map<std::string, AMQPNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i) {
         std::map<std::string, std::string>::const_iterator j = args.find("-amqp" + i->first);
@@ -58,13 +68,24 @@ AMQPNotificationInterface* AMQPNotificationInterface::CreateWithArguments(const
             AMQPAbstractNotifier *notifier = factory();
             notifier->SetType(i->first);
             notifier->SetAddress(address);
+            notifier->SetHighWaterMark(highWaterMark);
             notifiers.push_back(notifier);
+
+            if (i->first == "pubhashtx" || i->first == "pubrawtx") {
+                fTransactions = true;
+            }
+            if (i->first == "pubwalletnote") {
+                fWalletNotes = true;
+            }
         }
     }
 
     if (!notifiers.empty()) {
         notificationInterface = new AMQPNotificationInterface();
         notificationInterface->notifiers = notifiers;
+        notificationInterface->highWaterMark_ = highWaterMark;
+        notificationInterface->fTransactions = fTransactions;
+        notificationInterface->fWalletNotes = fWalletNotes;
 
         if (!notificationInterface->Initialize()) {
             delete notificationInterface;
@@ -95,6 +116,7 @@ bool AMQPNotificationInterface::Initialize()
         return false;
     }
 
+    publisher.Start(highWaterMark_);
     return true;
 }
 
@@ -102,6 +124,7 @@ bool AMQPNotificationInterface::Initialize()
 void AMQPNotificationInterface::Shutdown()
 {
     LogPrint("amqp", "amqp: Shutdown notification interface\n");
+    publisher.Stop();
 
     for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ++i) {
         AMQPAbstractNotifier *notifier = *i;
@@ -109,11 +132,12 @@ void AMQPNotificationInterface::Shutdown()
     }
 }
 
-void AMQPNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+template <typename F>
+void AMQPNotificationInterface::ForEachNotifier(F f)
 {
     for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ) {
         AMQPAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex)) {
+        if (f(notifier)) {
             i++;
         } else {
             notifier->Shutdown();
@@ -122,15 +146,42 @@ void AMQPNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
     }
 }
 
+void AMQPNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    publisher.Push([this, pindex](unsigned int) {
+        ForEachNotifier([pindex](AMQPAbstractNotifier *notifier) {
+            return notifier->NotifyBlock(pindex);
+        });
+    }, false);
+}
+
 void AMQPNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
 {
-    for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ) {
-        AMQPAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx)) {
-            i++;
-        } else {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
+    if (!fTransactions) {
+        return;
     }
+
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    bool fInBlock = pblock != nullptr;
+    publisher.Push([this, ptx](unsigned int nDropped) {
+        ForEachNotifier([&ptx, nDropped](AMQPAbstractNotifier *notifier) {
+            if (nDropped) {
+                notifier->NotifyTransactionsDropped(nDropped);
+            }
+            return notifier->NotifyTransaction(*ptx);
+        });
+    }, !fInBlock);
+}
+
+void AMQPNotificationInterface::NotifyWalletNote(const std::string &strEvent)
+{
+    if (!fWalletNotes) {
+        return;
+    }
+
+    publisher.Push([this, strEvent](unsigned int) {
+        ForEachNotifier([&strEvent](AMQPAbstractNotifier *notifier) {
+            return notifier->NotifyWalletNote(strEvent);
+        });
+    }, false);
 }
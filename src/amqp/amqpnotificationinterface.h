@@ -6,6 +6,7 @@
 #define ZCASH_AMQP_AMQPNOTIFICATIONINTERFACE_H
 
 #include "validationinterface.h"
+#include "notificationpublisher.h"
 #include <string>
 #include <map>
 
@@ -19,6 +20,11 @@ public:
 
     static AMQPNotificationInterface* CreateWithArguments(const std::map<std::string, std::string> &args);
 
+    // Whether NotifyWalletNote publishes anything
+    bool WantsWalletNotes() const { return fWalletNotes; }
+    // Publish a wallet note event, as JSON; never dropped
+    void NotifyWalletNote(const std::string &strEvent);
+
 protected:
     bool Initialize();
     void Shutdown();
@@ -30,7 +36,16 @@ protected:
 private:
     AMQPNotificationInterface();
 
+    // Call f for every notifier, and shut down the ones it fails for
+    template <typename F>
+    void ForEachNotifier(F f);
+
+    // Only used from the publisher thread once it is started
     std::list<AMQPAbstractNotifier*> notifiers;
+    CNotificationPublisher publisher;
+    size_t highWaterMark_;
+    bool fTransactions;
+    bool fWalletNotes;
 };
 
 #endif // ZCASH_AMQP_AMQPNOTIFICATIONINTERFACE_H
@@ -3,7 +3,6 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "amqppublishnotifier.h"
-#include "chainparams.h"
 #include "main.h"
 #include "util.h"
 
@@ -18,6 +17,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_WALLETNOTE = "walletnote";
 
 // Invoke this method from a new thread to run the proton container event loop.
 void AMQPAbstractPublishNotifier::SpawnProtonContainer()
@@ -46,7 +46,7 @@ bool AMQPAbstractPublishNotifier::Initialize()
 
     if (i == mapPublishNotifiers.end()) {
         try {
-            handler_ = std::make_shared<AMQPSender>(address);
+            handler_ = std::make_shared<AMQPSender>(address, highWaterMark_);
             thread_ = std::make_shared<std::thread>(&AMQPAbstractPublishNotifier::SpawnProtonContainer, this);
         }
         catch (std::exception &e) {
@@ -153,27 +153,25 @@ bool AMQPPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("amqp", "amqp: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams)) {
-            LogPrint("amqp", "amqp: Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+    CNotificationPayload payload = GetBlockPayload(pindex);
+    if (!payload) {
+        LogPrint("amqp", "amqp: Can't read block from disk\n");
+        return false;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, payload->data(), payload->size());
 }
 
 bool AMQPPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("amqp", "amqp: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    CNotificationPayload payload = GetTransactionPayload(transaction);
+    return SendMessage(MSG_RAWTX, payload->data(), payload->size());
+}
+
+bool AMQPPublishWalletNoteNotifier::NotifyWalletNote(const std::string &strEvent)
+{
+    LogPrint("amqp", "amqp: Publish walletnote %s\n", strEvent);
+    return SendMessage(MSG_WALLETNOTE, strEvent.data(), strEvent.size());
 }
@@ -23,7 +23,11 @@ private:
     std::shared_ptr<AMQPSender> handler_;      // proton container message handler, may be shared between notifiers
 
 public:
+    AMQPAbstractPublishNotifier() : sequence_(0) { }
+
     bool SendMessage(const char *command, const void* data, size_t size);
+    // Leave a gap in the sequence numbers for messages that were not sent
+    void SkipSequence(unsigned int count) { sequence_ += count; }
     bool Initialize();
     void Shutdown();
     void SpawnProtonContainer();
@@ -39,6 +43,7 @@ class AMQPPublishHashTransactionNotifier : public AMQPAbstractPublishNotifier
 {
 public:
     bool NotifyTransaction(const CTransaction &transaction);
+    void NotifyTransactionsDropped(unsigned int nCount) { SkipSequence(nCount); }
 };
 
 class AMQPPublishRawBlockNotifier : public AMQPAbstractPublishNotifier
@@ -51,6 +56,13 @@ class AMQPPublishRawTransactionNotifier : public AMQPAbstractPublishNotifier
 {
 public:
     bool NotifyTransaction(const CTransaction &transaction);
+    void NotifyTransactionsDropped(unsigned int nCount) { SkipSequence(nCount); }
+};
+
+class AMQPPublishWalletNoteNotifier : public AMQPAbstractPublishNotifier
+{
+public:
+    bool NotifyWalletNote(const std::string &strEvent);
 };
 
 #endif // ZCASH_AMQP_AMQPPUBLISHNOTIFIER_H
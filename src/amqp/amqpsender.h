@@ -6,6 +6,7 @@
 #define ZCASH_AMQP_AMQPSENDER_H
 
 #include "amqpconfig.h"
+#include "util.h"
 
 #include <deque>
 #include <memory>
@@ -15,6 +16,8 @@
 class AMQPSender : public proton::messaging_handler {
   private:
     std::deque<proton::message> messages_; 
+    size_t max_queued_;                 // oldest messages are dropped past this while the broker gives no credit
+    uint64_t dropped_ = 0;
     proton::url url_;
     proton::connection conn_;
     proton::sender sender_;
@@ -23,7 +26,7 @@ class AMQPSender : public proton::messaging_handler {
 
   public:
 
-    AMQPSender(const std::string& url) : url_(url) {}
+    AMQPSender(const std::string& url, size_t max_queued) : max_queued_(max_queued), url_(url) {}
 
     // Callback to initialize the container when run() is invoked
     void on_container_start(proton::container& c) override {
@@ -48,6 +51,12 @@ class AMQPSender : public proton::messaging_handler {
     void add_message(const proton::message &m) {
         std::lock_guard<std::mutex> guard(lock_);
         messages_.push_back(m);
+        if (messages_.size() > max_queued_) {
+            messages_.pop_front();
+            if (dropped_++ % 1000 == 0) {
+                LogPrint("amqp", "amqp: broker is not taking messages, dropped %d\n", dropped_);
+            }
+        }
     }
 
     // Send messages in queue
@@ -29,6 +29,13 @@ using namespace std;
 
 typedef std::string AsyncRPCOperationId;
 
+/**
+ * Lanes of the AsyncRPCQueue. Each lane has its own workers, so long running
+ * operations on the bulk lane don't hold up payments queued behind them.
+ */
+static const char* const ASYNC_RPC_LANE_DEFAULT = "default";
+static const char* const ASYNC_RPC_LANE_BULK = "bulk";
+
 typedef enum class operationStateEnum {
     READY = 0,
     EXECUTING,
@@ -65,6 +72,11 @@ public:
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
+    // Override this method to run the operation on a lane other than the default one.
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_DEFAULT;
+    }
+
     UniValue getError() const;
     
     UniValue getResult() const;
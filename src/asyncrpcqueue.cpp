@@ -23,41 +23,47 @@ AsyncRPCQueue::~AsyncRPCQueue() {
 }
 
 /**
- * A worker will execute this method on a new thread
+ * A worker will execute this method on a new thread, taking operations from its lane
  */
-void AsyncRPCQueue::run(size_t workerId) {
+void AsyncRPCQueue::run(size_t workerId, std::string lane) {
 
     while (true) {
         AsyncRPCOperationId key;
         std::shared_ptr<AsyncRPCOperation> operation;
+        std::chrono::time_point<std::chrono::system_clock> queued_time;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
+            std::queue<AsyncRPCQueueEntry>& operation_id_queue = lane_queues_[lane];
+            while (operation_id_queue.empty() && !isClosed() && !isFinishing()) {
                 this->condition_.wait(guard);
             }
 
             // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
+            if (isFinishing() && operation_id_queue.empty()) {
                 break;
             }
 
             // Exit if the queue is closing.
             if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
+                while (!operation_id_queue.empty()) {
+                    operation_id_queue.pop();
                 }
                 break;
             }
 
             // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+            key = operation_id_queue.front().first;
+            queued_time = operation_id_queue.front().second;
+            operation_id_queue.pop();
 
             // Search operation map
             AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
             if (iter != operation_map_.end()) {
                 operation = iter->second;
             }
+            if (operation && !operation->isCancelled()) {
+                lane_stats_[lane].executing++;
+            }
         }
 
         if (!operation) {
@@ -65,7 +71,16 @@ void AsyncRPCQueue::run(size_t workerId) {
         } else if (operation->isCancelled()) {
             // skip cancelled operation
         } else {
+            auto start_time = std::chrono::system_clock::now();
             operation->main();
+            auto end_time = std::chrono::system_clock::now();
+
+            std::lock_guard<std::mutex> guard(lock_);
+            AsyncRPCLaneStats& stats = lane_stats_[lane];
+            stats.executing--;
+            stats.completed++;
+            stats.total_wait_secs += std::chrono::duration<double>(start_time - queued_time).count();
+            stats.total_execution_secs += std::chrono::duration<double>(end_time - start_time).count();
         }
     }
 }
@@ -80,6 +95,9 @@ void AsyncRPCQueue::run(size_t workerId) {
  * std::shared_ptr<AsyncRPCOperation> ptr(new MyCustomAsyncRPCOperation(params));
  *
  * Don't use std::make_shared<AsyncRPCOperation>().
+ *
+ * The operation is queued on the lane it asks for, or on the default lane if
+ * no worker serves that lane.
  */
 void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation) {
     std::lock_guard<std::mutex> guard(lock_);
@@ -89,10 +107,18 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
         return;
     }
 
+    std::string lane = ptrOperation->getLane();
+    auto it = lane_stats_.find(lane);
+    if (it == lane_stats_.end() || it->second.workers == 0) {
+        lane = ASYNC_RPC_LANE_DEFAULT;
+    }
+
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
-    this->condition_.notify_one();
+    operation_lanes_[id] = lane;
+    lane_queues_[lane].push(AsyncRPCQueueEntry(id, std::chrono::system_clock::now()));
+    // Workers of every lane wait on the same condition
+    this->condition_.notify_all();
 }
 
 /**
@@ -119,6 +145,7 @@ std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::popOperationForId(AsyncRPCOper
         // Note: if the id still exists in the operationIdQueue, when it gets processed by a worker
         // there will no operation in the map to execute, so nothing will happen.
         operation_map_.erase(id);
+        operation_lanes_.erase(id);
     }
     return ptr;
 }
@@ -164,19 +191,24 @@ void AsyncRPCQueue::cancelAllOperations() {
 }
 
 /**
- * Return the number of operations in the queue
+ * Return the number of operations in the queue, across all lanes
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    size_t count = 0;
+    for (const auto& entry : lane_queues_) {
+        count += entry.second.size();
+    }
+    return count;
 }
 
 /**
- * Spawn a worker thread
+ * Spawn a worker thread serving the given lane
  */
-void AsyncRPCQueue::addWorker() {
+void AsyncRPCQueue::addWorker(const std::string& lane) {
     std::lock_guard<std::mutex> guard(lock_);
-    workers_.emplace_back( std::thread(&AsyncRPCQueue::run, this, ++workerCounter) );
+    lane_stats_[lane].workers++;
+    workers_.emplace_back( std::thread(&AsyncRPCQueue::run, this, ++workerCounter, lane) );
 }
 
 /**
@@ -199,6 +231,35 @@ std::vector<AsyncRPCOperationId> AsyncRPCQueue::getAllOperationIds() const {
     return v;
 }
 
+/**
+ * Return the lane an operation was queued on, or an empty string if the id is unknown.
+ */
+std::string AsyncRPCQueue::getLaneForId(AsyncRPCOperationId id) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = operation_lanes_.find(id);
+    if (it == operation_lanes_.end()) {
+        return "";
+    }
+    return it->second;
+}
+
+/**
+ * Return the workers, queue depth and latency of a lane.
+ */
+AsyncRPCLaneStats AsyncRPCQueue::getLaneStats(const std::string& lane) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    AsyncRPCLaneStats stats;
+    auto it = lane_stats_.find(lane);
+    if (it != lane_stats_.end()) {
+        stats = it->second;
+    }
+    auto qit = lane_queues_.find(lane);
+    if (qit != lane_queues_.end()) {
+        stats.queued = qit->second.size();
+    }
+    return stats;
+}
+
 /**
  * Calling thread will close and wait for worker threads to join.
  */
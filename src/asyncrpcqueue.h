@@ -10,6 +10,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <map>
 #include <queue>
 #include <unordered_map>
 #include <vector>
@@ -21,6 +22,18 @@
 
 typedef std::unordered_map<AsyncRPCOperationId, std::shared_ptr<AsyncRPCOperation> > AsyncRPCOperationMap; 
 
+typedef std::pair<AsyncRPCOperationId, std::chrono::time_point<std::chrono::system_clock> > AsyncRPCQueueEntry;
+
+/** Queue depth and latency of a lane */
+struct AsyncRPCLaneStats {
+    size_t workers = 0;
+    size_t queued = 0;
+    size_t executing = 0;
+    uint64_t completed = 0;
+    double total_wait_secs = 0;         // time spent queued by completed operations
+    double total_execution_secs = 0;    // time spent executing by completed operations
+};
+
 
 class AsyncRPCQueue {
 public:
@@ -35,7 +48,7 @@ public:
     AsyncRPCQueue& operator=(AsyncRPCQueue const&) = delete;  // Copy assign
     AsyncRPCQueue& operator=(AsyncRPCQueue &&) = delete;      // Move assign
 
-    void addWorker();
+    void addWorker(const std::string& lane = ASYNC_RPC_LANE_DEFAULT);
     size_t getNumberOfWorkers() const;
     bool isClosed() const;
     bool isFinishing() const;
@@ -49,10 +62,12 @@ public:
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
+    std::string getLaneForId(AsyncRPCOperationId) const;
+    AsyncRPCLaneStats getLaneStats(const std::string& lane) const;
 
 private:
     // addWorker() will spawn a new thread on run())
-    void run(size_t workerId);
+    void run(size_t workerId, std::string lane);
     void wait_for_worker_threads();
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
@@ -61,7 +76,9 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    std::map<std::string, std::queue<AsyncRPCQueueEntry> > lane_queues_;
+    std::map<std::string, AsyncRPCLaneStats> lane_stats_;
+    std::unordered_map<AsyncRPCOperationId, std::string> operation_lanes_;
     std::vector<std::thread> workers_;
 };
 
@@ -0,0 +1,209 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "tinyformat.h"
+#include "util.h"
+
+#include "librustzcash.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <regex>
+
+#include <boost/filesystem.hpp>
+#include <univalue.h>
+
+namespace benchmark {
+
+double Result::Min() const
+{
+    return *std::min_element(vSamples.begin(), vSamples.end());
+}
+
+double Result::Max() const
+{
+    return *std::max_element(vSamples.begin(), vSamples.end());
+}
+
+double Result::Mean() const
+{
+    return std::accumulate(vSamples.begin(), vSamples.end(), 0.0) / vSamples.size();
+}
+
+double Result::Percentile(double p) const
+{
+    std::vector<double> vSorted(vSamples);
+    std::sort(vSorted.begin(), vSorted.end());
+    double pos = p / 100 * (vSorted.size() - 1);
+    size_t i = (size_t)pos;
+    if (i + 1 >= vSorted.size())
+        return vSorted.back();
+    return vSorted[i] + (pos - i) * (vSorted[i + 1] - vSorted[i]);
+}
+
+State::State(uint64_t nIterationsIn, uint64_t nEvalsIn, uint64_t nWarmupIn, Result& resultIn) :
+    nIterations(nIterationsIn), nEvals(nEvalsIn), nWarmup(nWarmupIn), nEval(0), nIteration(0), result(resultIn)
+{
+}
+
+bool State::KeepRunning()
+{
+    if (nIteration == 0) {
+        if (nEval == nWarmup + nEvals || !result.strSkipped.empty())
+            return false;
+        start = clock::now();
+    }
+    if (nIteration < nIterations) {
+        nIteration++;
+        return true;
+    }
+
+    // One evaluation is done
+    time_point end = clock::now();
+    if (nEval >= nWarmup)
+        result.vSamples.push_back(std::chrono::duration<double>(end - start).count() / nIterations);
+    nEval++;
+    nIteration = 0;
+    return KeepRunning();
+}
+
+void State::Skip(const std::string& strReason)
+{
+    result.strSkipped = strReason;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func, uint64_t nIterations)
+{
+    Bench bench;
+    bench.func = func;
+    bench.nIterations = nIterations;
+    benchmarks().insert(std::make_pair(name, bench));
+}
+
+static UniValue ResultToJSON(const Result& result)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("name", result.name));
+    if (!result.strSkipped.empty()) {
+        obj.push_back(Pair("skipped", result.strSkipped));
+        return obj;
+    }
+    obj.push_back(Pair("iterations", result.nIterations));
+    obj.push_back(Pair("evals", (uint64_t)result.vSamples.size()));
+    obj.push_back(Pair("min", result.Min()));
+    obj.push_back(Pair("max", result.Max()));
+    obj.push_back(Pair("mean", result.Mean()));
+    obj.push_back(Pair("p5", result.Percentile(5)));
+    obj.push_back(Pair("median", result.Percentile(50)));
+    obj.push_back(Pair("p95", result.Percentile(95)));
+    return obj;
+}
+
+bool BenchRunner::RunAll(const Options& options)
+{
+    std::regex reFilter(options.strFilter);
+    std::vector<Result> vResults;
+    bool fOk = true;
+
+    if (!options.fList)
+        std::cout << strprintf("%-32s %12s %12s %12s %12s %12s", "# Benchmark", "iterations", "min(s)", "median(s)", "p95(s)", "max(s)") << std::endl;
+
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (!std::regex_match(it->first, reFilter))
+            continue;
+        if (options.fList) {
+            std::cout << it->first << std::endl;
+            continue;
+        }
+
+        Result result;
+        result.name = it->first;
+        result.nIterations = std::max<uint64_t>(1, (uint64_t)(it->second.nIterations * options.dScaling));
+        State state(result.nIterations, options.nEvals, options.nWarmup, result);
+        try {
+            it->second.func(state);
+        } catch (const std::exception& e) {
+            result.strSkipped = strprintf("failed: %s", e.what());
+            result.vSamples.clear();
+            fOk = false;
+        }
+        if (result.vSamples.empty() && result.strSkipped.empty())
+            result.strSkipped = "no samples";
+
+        if (!result.strSkipped.empty()) {
+            std::cout << strprintf("%-32s %s", result.name, result.strSkipped) << std::endl;
+        } else {
+            std::cout << strprintf("%-32s %12d %12.9f %12.9f %12.9f %12.9f", result.name, result.nIterations,
+                                   result.Min(), result.Percentile(50), result.Percentile(95), result.Max()) << std::endl;
+        }
+        vResults.push_back(result);
+    }
+
+    if (!options.strJSONFile.empty()) {
+        UniValue benchmarks(UniValue::VARR);
+        for (size_t i = 0; i < vResults.size(); i++)
+            benchmarks.push_back(ResultToJSON(vResults[i]));
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("evals", options.nEvals));
+        obj.push_back(Pair("warmup", options.nWarmup));
+        obj.push_back(Pair("scaling", options.dScaling));
+        obj.push_back(Pair("benchmarks", benchmarks));
+
+        std::ofstream file(options.strJSONFile.c_str());
+        file << obj.write(1) << std::endl;
+        if (!file) {
+            std::cerr << "Could not write " << options.strJSONFile << std::endl;
+            fOk = false;
+        }
+    }
+    return fOk;
+}
+
+bool LoadSaplingParams()
+{
+    static bool fLoaded = false;
+    if (fLoaded)
+        return true;
+
+    boost::filesystem::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
+    boost::filesystem::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
+    boost::filesystem::path sprout_groth16 = ZC_GetParamsDir() / "sprout-groth16.params";
+    if (!boost::filesystem::exists(sapling_spend) ||
+        !boost::filesystem::exists(sapling_output) ||
+        !boost::filesystem::exists(sprout_groth16))
+        return false;
+
+    static_assert(
+        sizeof(boost::filesystem::path::value_type) == sizeof(codeunit),
+        "librustzcash not configured correctly");
+    auto sapling_spend_str = sapling_spend.native();
+    auto sapling_output_str = sapling_output.native();
+    auto sprout_groth16_str = sprout_groth16.native();
+
+    librustzcash_init_zksnark_params(
+        reinterpret_cast<const codeunit*>(sapling_spend_str.c_str()),
+        sapling_spend_str.length(),
+        "8270785a1a0d0bc77196f000ee6d221c9c9894f55307bd9357c3f0105d31ca63991ab91324160d8f53e2bbd3c2633a6eb8bdf5205d822e7f3f73edac51b2b70c",
+        reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
+        sapling_output_str.length(),
+        "657e3d38dbb5cb5e7dd2970e8b03d69b4787dd907285b5a7f0790dcc8072f60bf593b32cc2d1c030e00ff5ae64bf84c5c3beb84ddc841d48264b4a171744d028",
+        reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
+        sprout_groth16_str.length(),
+        "e9b238411bd6c0ec4791e9d04245ec350c9c5744f5610dfcce4365d5ca49dfefd5054e371842b3f88fa1b9d7e8e075249b3ebabd167fa8b0f3161292d36c180a");
+    fLoaded = true;
+    return true;
+}
+
+} // namespace benchmark
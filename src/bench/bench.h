@@ -0,0 +1,127 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmarking framework; API mostly matches a subset of the Google Benchmark
+// framework (see https://github.com/google/benchmark)
+// Why not use the Google Benchmark framework? Because adding Yet Another Dependency
+// (that uses cmake as its build system and has lots of features we don't need) isn't
+// worth it.
+
+/*
+ * Usage:
+
+static void CODE_TO_TIME(benchmark::State& state)
+{
+    ... do any setup needed...
+    while (state.KeepRunning()) {
+       ... do stuff you want to time...
+    }
+    ... do any cleanup needed...
+}
+
+// default to running benchmark for 5000 iterations
+BENCHMARK(CODE_TO_TIME, 5000);
+
+ */
+
+namespace benchmark {
+
+typedef std::chrono::steady_clock clock;
+typedef clock::time_point time_point;
+
+/** Timings of one benchmark, in seconds per iteration */
+struct Result {
+    std::string name;
+    uint64_t nIterations;
+    std::vector<double> vSamples;
+    std::string strSkipped;
+
+    double Min() const;
+    double Max() const;
+    double Mean() const;
+    //! p between 0 and 100, interpolating between the sorted samples
+    double Percentile(double p) const;
+};
+
+/**
+ * Drives the loop of a benchmark. The first nWarmup evaluations are run
+ * and thrown away, so that caches and lazily initialized state are warm;
+ * then every one of nEvals evaluations times nIterations passes through
+ * the loop and yields one sample.
+ */
+class State
+{
+private:
+    uint64_t nIterations;
+    uint64_t nEvals;
+    uint64_t nWarmup;
+    uint64_t nEval;
+    uint64_t nIteration;
+    time_point start;
+    Result& result;
+
+public:
+    State(uint64_t nIterationsIn, uint64_t nEvalsIn, uint64_t nWarmupIn, Result& resultIn);
+
+    bool KeepRunning();
+
+    /** Give up on the benchmark, for instance when data it needs is not available */
+    void Skip(const std::string& strReason);
+};
+
+typedef std::function<void(State&)> BenchFunction;
+
+struct Options {
+    std::string strFilter;
+    uint64_t nEvals;
+    uint64_t nWarmup;
+    double dScaling;
+    std::string strJSONFile;
+    bool fList;
+
+    Options() : nEvals(5), nWarmup(1), dScaling(1.0), fList(false) {}
+};
+
+class BenchRunner
+{
+    struct Bench {
+        BenchFunction func;
+        uint64_t nIterations;
+    };
+    typedef std::map<std::string, Bench> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func, uint64_t nIterations);
+
+    /** Run the benchmarks whose names match the filter; returns false if any failed */
+    static bool RunAll(const Options& options);
+};
+
+/** Load the Sapling parameters on first use; returns false if they are not installed */
+bool LoadSaplingParams();
+
+} // namespace benchmark
+
+// BENCHMARK(foo, num_iters_for_one_second) expands to:  benchmark::BenchRunner bench_11foo("foo", foo, num_iterations);
+// Choose a num_iters_for_one_second that takes roughly 1 second. The goal is that all benchmarks should take approximately
+// the same time, and scaling factor can be used that the total time is appropriate for your system.
+#define BENCHMARK(n, num_iters_for_one_second) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n, (num_iters_for_one_second));
+
+#endif // BITCOIN_BENCH_BENCH_H
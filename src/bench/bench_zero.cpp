@@ -0,0 +1,65 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "util.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+
+static const int64_t DEFAULT_BENCH_EVALUATIONS = 5;
+static const int64_t DEFAULT_BENCH_WARMUP = 1;
+static const char* DEFAULT_BENCH_FILTER = ".*";
+static const char* DEFAULT_BENCH_SCALING = "1.0";
+
+static std::string HelpMessage()
+{
+    std::string strUsage = "Usage: bench_zero [options]\n\n";
+    strUsage += HelpMessageGroup("Options:");
+    strUsage += HelpMessageOpt("-?", "Print this help message and exit");
+    strUsage += HelpMessageOpt("-list", "List the benchmarks matching -filter without running them");
+    strUsage += HelpMessageOpt("-filter=<regex>", strprintf("Run the benchmarks whose names match the regular expression (default: %s)", DEFAULT_BENCH_FILTER));
+    strUsage += HelpMessageOpt("-evals=<n>", strprintf("Number of measured evaluations of each benchmark (default: %d)", DEFAULT_BENCH_EVALUATIONS));
+    strUsage += HelpMessageOpt("-warmup=<n>", strprintf("Number of evaluations run before measuring (default: %d)", DEFAULT_BENCH_WARMUP));
+    strUsage += HelpMessageOpt("-scaling=<n>", strprintf("Factor applied to the iterations of every evaluation (default: %s)", DEFAULT_BENCH_SCALING));
+    strUsage += HelpMessageOpt("-json=<file>", "Also write the results, with their percentiles, to <file> as JSON");
+    return strUsage;
+}
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    ParseParameters(argc, argv);
+
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << HelpMessage();
+        return EXIT_SUCCESS;
+    }
+
+    benchmark::Options options;
+    options.fList = GetBoolArg("-list", false);
+    options.strFilter = GetArg("-filter", DEFAULT_BENCH_FILTER);
+    options.nEvals = std::max<int64_t>(1, GetArg("-evals", DEFAULT_BENCH_EVALUATIONS));
+    options.nWarmup = std::max<int64_t>(0, GetArg("-warmup", DEFAULT_BENCH_WARMUP));
+    options.dScaling = std::stod(GetArg("-scaling", DEFAULT_BENCH_SCALING));
+    options.strJSONFile = GetArg("-json", "");
+
+    assert(init_and_check_sodium() != -1);
+    SHA256AutoDetect();
+    ECC_Start();
+    SelectParams(CBaseChainParams::MAIN);
+
+    bool fOk = benchmark::BenchRunner::RunAll(options);
+
+    ECC_Stop();
+    return fOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
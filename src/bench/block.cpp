@@ -0,0 +1,74 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+// A block of 1000 transactions spending two pay-to-pubkey-hash outputs
+// to two others, serialized as on disk
+static CDataStream SerializedBlock()
+{
+    CBlock block;
+    for (int i = 0; i < 1000; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(2);
+        for (size_t j = 0; j < mtx.vin.size(); j++) {
+            mtx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            mtx.vin[j].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, j);
+        }
+        mtx.vout.resize(2);
+        for (size_t j = 0; j < mtx.vout.size(); j++) {
+            mtx.vout[j].nValue = 1000 + i;
+            mtx.vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(mtx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    return ss;
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream ss = SerializedBlock();
+    while (state.KeepRunning()) {
+        CDataStream stream(ss);
+        CBlock block;
+        stream >> block;
+    }
+}
+
+static void DeserializeBlockReusing(benchmark::State& state)
+{
+    // As ReadBlockFromDisk does for rescans
+    CDataStream ss = SerializedBlock();
+    CBlock block;
+    while (state.KeepRunning()) {
+        CDataStream stream(ss);
+        block.UnserializeReusing(stream);
+    }
+}
+
+static void SerializeBlockSize(benchmark::State& state)
+{
+    CDataStream ss = SerializedBlock();
+    CBlock block;
+    ss >> block;
+    while (state.KeepRunning())
+        assert(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) > 0);
+}
+
+BENCHMARK(DeserializeBlock, 400);
+BENCHMARK(DeserializeBlockReusing, 400);
+BENCHMARK(SerializeBlockSize, 2000);
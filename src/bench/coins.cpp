@@ -0,0 +1,65 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "coins.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+
+#include <vector>
+
+static const size_t COINS_TXS = 1000;
+
+// A cache holding COINS_TXS transactions of two outputs each, standing in for the chain tip
+class CoinsSetup
+{
+public:
+    CCoinsView dummy;
+    CCoinsViewCache tip;
+    std::vector<uint256> vTxid;
+
+    CoinsSetup() : tip(&dummy)
+    {
+        for (size_t i = 0; i < COINS_TXS; i++) {
+            CMutableTransaction mtx;
+            mtx.vin.resize(1);
+            mtx.vin[0].prevout.n = i;
+            mtx.vout.resize(2);
+            mtx.vout[0].nValue = 1000;
+            mtx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+            mtx.vout[1] = mtx.vout[0];
+            CTransaction tx(mtx);
+            tip.ModifyNewCoins(tx.GetHash())->FromTx(tx, 1);
+            vTxid.push_back(tx.GetHash());
+        }
+    }
+};
+
+static void CoinsViewCacheFetch(benchmark::State& state)
+{
+    CoinsSetup setup;
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&setup.tip);
+        for (size_t i = 0; i < setup.vTxid.size(); i++)
+            assert(view.AccessCoins(setup.vTxid[i]));
+    }
+}
+
+static void CoinsViewCacheFlush(benchmark::State& state)
+{
+    CoinsSetup setup;
+    while (state.KeepRunning()) {
+        // Spend one output of every transaction and write the change back
+        CCoinsViewCache view(&setup.tip);
+        for (size_t i = 0; i < setup.vTxid.size(); i++) {
+            CCoinsModifier coins = view.ModifyCoins(setup.vTxid[i]);
+            coins->vout[0].nValue++;
+        }
+        view.Flush();
+    }
+}
+
+BENCHMARK(CoinsViewCacheFetch, 1500);
+BENCHMARK(CoinsViewCacheFlush, 500);
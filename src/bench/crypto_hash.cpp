@@ -0,0 +1,65 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include "sodium.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000 * 1000;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(in.data());
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+static void BLAKE2b(benchmark::State& state)
+{
+    uint8_t hash[crypto_generichash_blake2b_BYTES];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        crypto_generichash_blake2b(hash, sizeof(hash), in.data(), in.size(), NULL, 0);
+}
+
+static void BLAKE2b_Personal_32b(benchmark::State& state)
+{
+    // As used for the hSig, PRFs and sighashes
+    static const unsigned char personal[crypto_generichash_blake2b_PERSONALBYTES] = {'Z', 'c', 'a', 's', 'h', 'B', 'e', 'n', 'c', 'h', 'm', 'a', 'r', 'k', '0', '0'};
+    uint256 hash;
+    while (state.KeepRunning()) {
+        CBLAKE2bWriter ss(SER_GETHASH, 0, personal);
+        ss << hash;
+        hash = ss.GetHash();
+    }
+}
+
+BENCHMARK(SHA256, 340);
+BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(SHA256D64_1024, 7400);
+BENCHMARK(BLAKE2b, 600);
+BENCHMARK(BLAKE2b_Personal_32b, 3000 * 1000);
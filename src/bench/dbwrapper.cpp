@@ -0,0 +1,44 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "dbwrapper.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+static const size_t DB_ENTRIES = 100 * 1000;
+
+static void LevelDBRead(benchmark::State& state)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_zero_%%%%-%%%%");
+    {
+        CDBWrapper db(path, 8 << 20, false, true);
+
+        // Keys shaped like the coins database, values like small coins records
+        std::vector<uint256> vKeys;
+        CDBBatch batch(db);
+        std::vector<unsigned char> value(60, 0x5a);
+        for (size_t i = 0; i < DB_ENTRIES; i++) {
+            vKeys.push_back(GetRandHash());
+            batch.Write(std::make_pair('c', vKeys.back()), value);
+        }
+        db.WriteBatch(batch, true);
+
+        size_t i = 0;
+        while (state.KeepRunning()) {
+            std::vector<unsigned char> read;
+            assert(db.Read(std::make_pair('c', vKeys[i]), read));
+            i = (i + 7919) % vKeys.size();
+        }
+    }
+    boost::filesystem::remove_all(path);
+}
+
+BENCHMARK(LevelDBRead, 200 * 1000);
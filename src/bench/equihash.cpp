@@ -0,0 +1,30 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "pow.h"
+#include "primitives/block.h"
+
+static void EquihashVerify(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    while (state.KeepRunning())
+        assert(CheckEquihashSolution(&header, params.GetConsensus()));
+}
+
+static void EquihashVerifyInvalid(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    // Corrupt the first index, as a peer sending bad headers would
+    header.nSolution[0] ^= 0x80;
+    while (state.KeepRunning())
+        assert(!CheckEquihashSolution(&header, params.GetConsensus()));
+}
+
+BENCHMARK(EquihashVerify, 60);
+BENCHMARK(EquihashVerifyInvalid, 60);
@@ -0,0 +1,47 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "amount.h"
+#include "consensus/upgrades.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "txmempool.h"
+
+#include <list>
+#include <vector>
+
+static const size_t MEMPOOL_TXS = 500;
+
+// Admits transactions that each spend the previous one, then mines them all,
+// which walks the ancestor and descendant bookkeeping in full
+static void MempoolAddRemove(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx;
+    uint256 prevHash;
+    for (size_t i = 0; i < MEMPOOL_TXS; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(prevHash, 0);
+        mtx.vin[0].scriptSig = CScript() << OP_1;
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 10 * COIN - i * 1000;
+        mtx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        vtx.push_back(mtx);
+        prevHash = vtx.back().GetHash();
+    }
+
+    CTxMemPool pool(CFeeRate(1000));
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vtx.size(); i++) {
+            CTxMemPoolEntry entry(vtx[i], 1000, 0, 0.0, 1, i == 0, false, SPROUT_BRANCH_ID);
+            pool.addUnchecked(vtx[i].GetHash(), entry);
+        }
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(vtx, 2, conflicts);
+    }
+}
+
+BENCHMARK(MempoolAddRemove, 40);
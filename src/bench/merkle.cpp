@@ -0,0 +1,77 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "primitives/block.h"
+#include "uint256.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include <string.h>
+
+// Commitments with only low bytes set are valid encodings for both trees
+static uint256 Commitment(uint64_t n)
+{
+    uint256 cm;
+    memcpy(cm.begin(), &n, sizeof(n));
+    return cm;
+}
+
+static void SproutMerkleTreeAppend(benchmark::State& state)
+{
+    SproutMerkleTree tree;
+    uint64_t n = 0;
+    while (state.KeepRunning())
+        tree.append(Commitment(n++));
+}
+
+static void SaplingMerkleTreeAppend(benchmark::State& state)
+{
+    SaplingMerkleTree tree;
+    uint64_t n = 0;
+    while (state.KeepRunning())
+        tree.append(Commitment(n++));
+}
+
+static void SaplingWitnessIncrement(benchmark::State& state)
+{
+    SaplingMerkleTree tree;
+    tree.append(Commitment(0));
+    SaplingWitness witness = tree.witness();
+    uint64_t n = 1;
+    while (state.KeepRunning())
+        witness.append(Commitment(n++));
+}
+
+static void SaplingWitnessIncrementRoot(benchmark::State& state)
+{
+    // As wallets do for every note in every block
+    SaplingMerkleTree tree;
+    tree.append(Commitment(0));
+    SaplingWitness witness = tree.witness();
+    uint64_t n = 1;
+    while (state.KeepRunning()) {
+        witness.append(Commitment(n++));
+        witness.root();
+    }
+}
+
+static void BlockMerkleRoot(benchmark::State& state)
+{
+    CBlock block;
+    block.vtx.reserve(1000);
+    for (uint32_t i = 0; i < 1000; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        block.vtx.push_back(mtx);
+    }
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+BENCHMARK(SproutMerkleTreeAppend, 80 * 1000);
+BENCHMARK(SaplingMerkleTreeAppend, 2000);
+BENCHMARK(SaplingWitnessIncrement, 2000);
+BENCHMARK(SaplingWitnessIncrementRoot, 50);
+BENCHMARK(BlockMerkleRoot, 800);
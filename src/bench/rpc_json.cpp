@@ -0,0 +1,78 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench/bench.h"
+
+#include "core_io.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "rpc/jsonstream.h"
+#include "script/script.h"
+#include "uint256.h"
+
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+// The transactions of a getblock call at verbosity 2, for 500 transactions
+static std::vector<CTransaction> Transactions()
+{
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < 500; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(2);
+        for (size_t j = 0; j < mtx.vin.size(); j++) {
+            mtx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            mtx.vin[j].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, j);
+        }
+        mtx.vout.resize(2);
+        for (size_t j = 0; j < mtx.vout.size(); j++) {
+            mtx.vout[j].nValue = 1000 + i;
+            mtx.vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        vtx.push_back(mtx);
+    }
+    return vtx;
+}
+
+static UniValue TransactionsToJSON(const std::vector<CTransaction>& vtx)
+{
+    UniValue txs(UniValue::VARR);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        UniValue objTx(UniValue::VOBJ);
+        TxToUniv(vtx[i], uint256(), objTx);
+        txs.push_back(objTx);
+    }
+    return txs;
+}
+
+static void RPCTxToJSON(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx = Transactions();
+    while (state.KeepRunning())
+        TransactionsToJSON(vtx);
+}
+
+static void RPCJSONWrite(benchmark::State& state)
+{
+    UniValue txs = TransactionsToJSON(Transactions());
+    while (state.KeepRunning())
+        txs.write();
+}
+
+static void RPCJSONStreamWrite(benchmark::State& state)
+{
+    UniValue txs = TransactionsToJSON(Transactions());
+    size_t nWritten = 0;
+    while (state.KeepRunning()) {
+        CJSONStreamWriter writer([&nWritten](const std::string& str) { nWritten += str.size(); return true; });
+        writer.Value(txs);
+        writer.Flush();
+    }
+}
+
+BENCHMARK(RPCTxToJSON, 20);
+BENCHMARK(RPCJSONWrite, 60);
+BENCHMARK(RPCJSONStreamWrite, 60);
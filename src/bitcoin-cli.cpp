@@ -5,6 +5,7 @@
 
 #include "chainparamsbase.h"
 #include "clientversion.h"
+#include "rpc/cbor.h"
 #include "rpc/client.h"
 #include "rpc/protocol.h"
 #include "util.h"
@@ -37,6 +38,7 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcwait", _("Wait for RPC server to start"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
+    strUsage += HelpMessageOpt("-rpccbor", _("Exchange requests and replies with the server in the compact CBOR encoding instead of JSON text"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout in seconds during HTTP requests, or 0 for no timeout. (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
     strUsage += HelpMessageOpt("-stdin", _("Read extra arguments from standard input, one per line until EOF/Ctrl-D (recommended for sensitive information such as passphrases)"));
 
@@ -128,6 +130,7 @@ struct HTTPReply
     int status;
     int error;
     std::string body;
+    std::string contentType;
 };
 
 const char *http_errorstring(int code)
@@ -166,6 +169,10 @@ static void http_request_done(struct evhttp_request *req, void *ctx)
 
     reply->status = evhttp_request_get_response_code(req);
 
+    const char* contentType = evhttp_find_header(evhttp_request_get_input_headers(req), "Content-Type");
+    if (contentType)
+        reply->contentType = contentType;
+
     struct evbuffer *buf = evhttp_request_get_input_buffer(req);
     if (buf)
     {
@@ -227,7 +234,15 @@ UniValue CallRPC(const std::string& strMethod, const UniValue& params)
     evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
 
     // Attach request data
-    std::string strRequest = JSONRPCRequest(strMethod, params, 1);
+    const bool fCBOR = GetBoolArg("-rpccbor", false);
+    std::string strRequest;
+    if (fCBOR) {
+        evhttp_add_header(output_headers, "Content-Type", CBOR_CONTENT_TYPE);
+        evhttp_add_header(output_headers, "Accept", CBOR_CONTENT_TYPE);
+        strRequest = EncodeCBOR(JSONRPCRequestObj(strMethod, params, 1));
+    } else {
+        strRequest = JSONRPCRequest(strMethod, params, 1);
+    }
     struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
     assert(output_buffer);
     evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
@@ -251,7 +266,10 @@ UniValue CallRPC(const std::string& strMethod, const UniValue& params)
 
     // Parse reply
     UniValue valReply(UniValue::VSTR);
-    if (!valReply.read(response.body))
+    if (response.contentType.find(CBOR_CONTENT_TYPE) == 0) {
+        if (!DecodeCBOR(response.body, valReply))
+            throw std::runtime_error("couldn't parse reply from server");
+    } else if (!valReply.read(response.body))
         throw std::runtime_error("couldn't parse reply from server");
     const UniValue& reply = valReply.get_obj();
     if (reply.empty())
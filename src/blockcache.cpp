@@ -0,0 +1,249 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+#include "streams.h"
+#include "version.h"
+
+CRecentBlockCache recentBlocks;
+CHeaderCache recentHeaders;
+CTransactionCache recentTransactions;
+
+CRecentBlock::CRecentBlock(const std::shared_ptr<const CBlock>& pblockIn) : pblock(pblockIn), fFilterData(false)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *pblock;
+    vchBlock.assign(ss.begin(), ss.end());
+}
+
+size_t CRecentBlock::DynamicMemoryUsage() const
+{
+    // A deserialized block takes about as much memory as its serialization
+    return sizeof(*this) + sizeof(CBlock) + 2 * vchBlock.capacity();
+}
+
+void CRecentBlock::BuildFilterData() const
+{
+    LOCK(csFilterData);
+    if (fFilterData)
+        return;
+    vFilterElements.reserve(pblock->vtx.size());
+    for (const CTransaction& tx : pblock->vtx)
+        vFilterElements.emplace_back(tx);
+    // The transactions are serialized last
+    size_t nOffset = vchBlock.size();
+    vTxOffsets.resize(pblock->vtx.size() + 1);
+    vTxOffsets.back() = nOffset;
+    for (size_t i = pblock->vtx.size(); i-- > 0; ) {
+        nOffset -= ::GetSerializeSize(pblock->vtx[i], SER_NETWORK, PROTOCOL_VERSION);
+        vTxOffsets[i] = nOffset;
+    }
+    fFilterData = true;
+}
+
+const std::vector<CTxFilterElements>& CRecentBlock::GetFilterElements() const
+{
+    BuildFilterData();
+    return vFilterElements;
+}
+
+const std::vector<uint32_t>& CRecentBlock::GetTxOffsets() const
+{
+    BuildFilterData();
+    return vTxOffsets;
+}
+
+void CRecentBlockCache::Trim()
+{
+    while (nSize > nMaxSize && !queueBlocks.empty()) {
+        std::map<uint256, std::shared_ptr<const CRecentBlock> >::iterator it = mapBlocks.find(queueBlocks.front());
+        nSize -= it->second->DynamicMemoryUsage();
+        mapBlocks.erase(it);
+        queueBlocks.pop_front();
+    }
+}
+
+void CRecentBlockCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    Trim();
+}
+
+bool CRecentBlockCache::IsEnabled() const
+{
+    LOCK(cs);
+    return nMaxSize > 0;
+}
+
+void CRecentBlockCache::Add(const std::shared_ptr<const CBlock>& pblock)
+{
+    uint256 hash = pblock->GetHash();
+    {
+        LOCK(cs);
+        if (nMaxSize == 0 || mapBlocks.count(hash))
+            return;
+    }
+    // Serialize outside the lock
+    std::shared_ptr<const CRecentBlock> pentry = std::make_shared<const CRecentBlock>(pblock);
+
+    LOCK(cs);
+    if (!mapBlocks.emplace(hash, pentry).second)
+        return;
+    queueBlocks.push_back(hash);
+    nSize += pentry->DynamicMemoryUsage();
+    Trim();
+}
+
+std::shared_ptr<const CRecentBlock> CRecentBlockCache::Get(const uint256& hash) const
+{
+    LOCK(cs);
+    std::map<uint256, std::shared_ptr<const CRecentBlock> >::const_iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return nullptr;
+    return it->second;
+}
+
+size_t CRecentBlockCache::Count() const
+{
+    LOCK(cs);
+    return mapBlocks.size();
+}
+
+size_t CRecentBlockCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nSize;
+}
+
+void CHeaderCache::SetMaxEntries(size_t nMaxEntries)
+{
+    LOCK(cs);
+    std::vector<Entry>().swap(vEntries);
+    vEntries.resize(nMaxEntries);
+}
+
+void CHeaderCache::Add(int nHeight, const uint256& hash, const CBlockHeader& header)
+{
+    {
+        LOCK(cs);
+        if (vEntries.empty() || nHeight < 0)
+            return;
+    }
+    // Serialize outside the lock
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    WriteCompactSize(ss, 0);
+
+    LOCK(cs);
+    if (vEntries.empty())
+        return;
+    Entry& entry = vEntries[nHeight % vEntries.size()];
+    entry.hash = hash;
+    entry.vchHeader.assign(ss.begin(), ss.end());
+}
+
+bool CHeaderCache::Append(int nHeight, const uint256& hash, std::vector<char>& vch) const
+{
+    LOCK(cs);
+    if (vEntries.empty() || nHeight < 0)
+        return false;
+    const Entry& entry = vEntries[nHeight % vEntries.size()];
+    if (entry.hash != hash || entry.vchHeader.empty())
+        return false;
+    vch.insert(vch.end(), entry.vchHeader.begin(), entry.vchHeader.end());
+    return true;
+}
+
+size_t CHeaderCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    size_t nUsage = memusage::DynamicUsage(vEntries);
+    for (const Entry& entry : vEntries)
+        nUsage += memusage::DynamicUsage(entry.vchHeader);
+    return nUsage;
+}
+
+void CTransactionCache::Trim()
+{
+    while (listEntries.size() > nMaxEntries) {
+        nSize -= listEntries.back().nUsage;
+        mapEntries.erase(listEntries.back().txid);
+        listEntries.pop_back();
+    }
+}
+
+void CTransactionCache::SetMaxEntries(size_t nMaxEntriesIn)
+{
+    LOCK(cs);
+    nMaxEntries = nMaxEntriesIn;
+    Trim();
+}
+
+void CTransactionCache::Add(const CTransaction& tx, const uint256& hashBlock)
+{
+    {
+        LOCK(cs);
+        if (nMaxEntries == 0)
+            return;
+    }
+    // Copy outside the lock
+    Entry entry;
+    entry.txid = tx.GetHash();
+    entry.ptx = std::make_shared<const CTransaction>(tx);
+    entry.hashBlock = hashBlock;
+    // The transaction, its list node and its map node
+    entry.nUsage = memusage::MallocUsage(sizeof(CTransaction)) + RecursiveDynamicUsage(tx) +
+                   memusage::MallocUsage(sizeof(Entry) + 2 * sizeof(void*)) +
+                   memusage::MallocUsage(sizeof(uint256) + sizeof(std::list<Entry>::iterator) + 4 * sizeof(void*));
+
+    LOCK(cs);
+    std::map<uint256, std::list<Entry>::iterator>::iterator it = mapEntries.find(entry.txid);
+    if (it != mapEntries.end()) {
+        nSize -= it->second->nUsage;
+        listEntries.erase(it->second);
+        mapEntries.erase(it);
+    }
+    nSize += entry.nUsage;
+    listEntries.push_front(entry);
+    mapEntries.emplace(entry.txid, listEntries.begin());
+    Trim();
+}
+
+std::shared_ptr<const CTransaction> CTransactionCache::Get(const uint256& txid, uint256& hashBlock) const
+{
+    LOCK(cs);
+    std::map<uint256, std::list<Entry>::iterator>::const_iterator it = mapEntries.find(txid);
+    if (it == mapEntries.end())
+        return nullptr;
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    hashBlock = it->second->hashBlock;
+    return it->second->ptx;
+}
+
+void CTransactionCache::Erase(const uint256& txid)
+{
+    LOCK(cs);
+    std::map<uint256, std::list<Entry>::iterator>::iterator it = mapEntries.find(txid);
+    if (it == mapEntries.end())
+        return;
+    nSize -= it->second->nUsage;
+    listEntries.erase(it->second);
+    mapEntries.erase(it);
+}
+
+size_t CTransactionCache::Count() const
+{
+    LOCK(cs);
+    return listEntries.size();
+}
+
+size_t CTransactionCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nSize;
+}
@@ -0,0 +1,166 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "bloom.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+/** -recentblockcache default, in MiB */
+static const unsigned int DEFAULT_RECENT_BLOCK_CACHE_SIZE = 16;
+/** -headercache default, in blocks */
+static const unsigned int DEFAULT_HEADER_CACHE_SIZE = 10000;
+/** -txcache default, in transactions */
+static const unsigned int DEFAULT_TX_CACHE_SIZE = 5000;
+
+/** A recently connected block and its serialization. */
+struct CRecentBlock
+{
+    std::shared_ptr<const CBlock> pblock;
+    //! Serialized block, as sent in a "block" message or by the raw block notifiers
+    std::vector<char> vchBlock;
+
+    explicit CRecentBlock(const std::shared_ptr<const CBlock>& pblockIn);
+
+    //! Approximate memory used by the entry
+    size_t DynamicMemoryUsage() const;
+
+    //! Filter elements of each transaction, for the filtered block requests of SPV peers
+    const std::vector<CTxFilterElements>& GetFilterElements() const;
+    //! Offset of each transaction in vchBlock, followed by the size of the block
+    const std::vector<uint32_t>& GetTxOffsets() const;
+
+private:
+    // Only built on the first filtered block request, and not counted in
+    // DynamicMemoryUsage: the elements take less than the serialized block
+    mutable CCriticalSection csFilterData;
+    mutable bool fFilterData;
+    mutable std::vector<CTxFilterElements> vFilterElements;
+    mutable std::vector<uint32_t> vTxOffsets;
+
+    void BuildFilterData() const;
+};
+
+/**
+ * Blocks connected to the tip most recently, so that the wallet, the RPC
+ * interface, peers and notifiers asking for them do not read them back
+ * from disk. The oldest blocks are dropped when the cache goes over its
+ * size limit.
+ */
+class CRecentBlockCache
+{
+private:
+    mutable CCriticalSection cs;
+    size_t nMaxSize;
+    size_t nSize;
+    std::map<uint256, std::shared_ptr<const CRecentBlock> > mapBlocks;
+    //! Hashes in the order they were added
+    std::deque<uint256> queueBlocks;
+
+    void Trim();
+
+public:
+    CRecentBlockCache() : nMaxSize(0), nSize(0) {}
+
+    /** Set the size limit in bytes; 0 disables the cache. */
+    void SetMaxSize(size_t nMaxSizeIn);
+    bool IsEnabled() const;
+
+    void Add(const std::shared_ptr<const CBlock>& pblock);
+    /** Return the block with the given hash, or NULL if it is not cached. */
+    std::shared_ptr<const CRecentBlock> Get(const uint256& hash) const;
+
+    size_t Count() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+/**
+ * Serialized headers of the last blocks connected to the tip, in a ring
+ * indexed by height, in the form they take in a "headers" message (each
+ * followed by a zero transaction count). getheaders requests are answered
+ * by copying them, instead of reading every Equihash solution back from
+ * the block index database. An entry is only used for the block hash it
+ * was stored with, so entries left by disconnected blocks do no harm.
+ */
+class CHeaderCache
+{
+private:
+    struct Entry
+    {
+        uint256 hash;
+        std::vector<char> vchHeader;
+    };
+
+    mutable CCriticalSection cs;
+    std::vector<Entry> vEntries;
+
+public:
+    /** Set the number of headers kept; 0 disables the cache. */
+    void SetMaxEntries(size_t nMaxEntries);
+
+    void Add(int nHeight, const uint256& hash, const CBlockHeader& header);
+    /** Append the header of the block hash at nHeight to vch; false if it is not cached. */
+    bool Append(int nHeight, const uint256& hash, std::vector<char>& vch) const;
+
+    size_t DynamicMemoryUsage() const;
+};
+
+/**
+ * Transactions GetTransaction read from the block files, with the hash of
+ * the block they were found in, so that explorers and wallets asking for
+ * the same transactions over and over do not look them up in the
+ * transaction index and read them back each time. The least recently used
+ * entries are dropped when the cache is full. Entries are not removed when
+ * their block is disconnected: callers check the block is still active.
+ */
+class CTransactionCache
+{
+private:
+    struct Entry
+    {
+        uint256 txid;
+        std::shared_ptr<const CTransaction> ptx;
+        uint256 hashBlock;
+        size_t nUsage;
+    };
+
+    mutable CCriticalSection cs;
+    size_t nMaxEntries;
+    size_t nSize;
+    //! Most recently used first
+    mutable std::list<Entry> listEntries;
+    std::map<uint256, std::list<Entry>::iterator> mapEntries;
+
+    void Trim();
+
+public:
+    CTransactionCache() : nMaxEntries(0), nSize(0) {}
+
+    /** Set the number of transactions kept; 0 disables the cache. */
+    void SetMaxEntries(size_t nMaxEntriesIn);
+
+    void Add(const CTransaction& tx, const uint256& hashBlock);
+    /** Return the transaction with the given txid, or NULL if it is not cached. */
+    std::shared_ptr<const CTransaction> Get(const uint256& txid, uint256& hashBlock) const;
+    void Erase(const uint256& txid);
+
+    size_t Count() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+extern CRecentBlockCache recentBlocks;
+extern CHeaderCache recentHeaders;
+extern CTransactionCache recentTransactions;
+
+#endif // BITCOIN_BLOCKCACHE_H
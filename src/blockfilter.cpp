@@ -0,0 +1,349 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <assert.h>
+
+/// SerType used to serialize parameters in GCS filter encoding.
+static const int GCS_SER_TYPE = SER_NETWORK;
+
+/// Protocol version used to serialize parameters in GCS filter encoding.
+static const int GCS_SER_VERSION = 0;
+
+/** Parameters of the basic filter type (BIP 158) */
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+namespace {
+
+/** Writes bits, most significant first, to a byte vector. */
+class BitStreamWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    uint8_t buffer;
+    int offset;
+
+public:
+    BitStreamWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), buffer(0), offset(0) {}
+
+    ~BitStreamWriter() { Flush(); }
+
+    /** Write the nbits least significant bits of data, 0 <= nbits <= 64. */
+    void Write(uint64_t data, int nbits)
+    {
+        while (nbits > 0) {
+            int bits = std::min(8 - offset, nbits);
+            buffer |= (data << (64 - nbits)) >> (64 - 8 + offset);
+            offset += bits;
+            nbits -= bits;
+
+            if (offset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out any partial byte, padded with zero bits. */
+    void Flush()
+    {
+        if (offset == 0)
+            return;
+        vch.push_back(buffer);
+        buffer = 0;
+        offset = 0;
+    }
+};
+
+/** Reads bits, most significant first, from a byte vector. */
+class BitStreamReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    uint8_t buffer;
+    int offset;
+
+public:
+    BitStreamReader(const std::vector<unsigned char>& vchIn, size_t nPosIn) : vch(vchIn), nPos(nPosIn), buffer(0), offset(8) {}
+
+    /** Read nbits from the stream, 0 <= nbits <= 64. Throws at the end of the data. */
+    uint64_t Read(int nbits)
+    {
+        uint64_t data = 0;
+        while (nbits > 0) {
+            if (offset == 8) {
+                if (nPos >= vch.size())
+                    throw std::ios_base::failure("end of data");
+                buffer = vch[nPos++];
+                offset = 0;
+            }
+
+            int bits = std::min(8 - offset, nbits);
+            data <<= bits;
+            data |= static_cast<uint8_t>(buffer << offset) >> (8 - bits);
+            offset += bits;
+            nbits -= bits;
+        }
+        return data;
+    }
+};
+
+void GolombRiceEncode(BitStreamWriter& bitwriter, uint8_t P, uint64_t x)
+{
+    // Write quotient as unary-encoded: q 1's followed by one 0.
+    uint64_t q = x >> P;
+    while (q > 0) {
+        int nbits = q <= 64 ? static_cast<int>(q) : 64;
+        bitwriter.Write(~0ULL, nbits);
+        q -= nbits;
+    }
+    bitwriter.Write(0, 1);
+
+    // Write the remainder in P bits. Since the remainder is just the bottom
+    // P bits of x, there is no need to mask first.
+    bitwriter.Write(x, P);
+}
+
+uint64_t GolombRiceDecode(BitStreamReader& bitreader, uint8_t P)
+{
+    // Read unary-encoded quotient: q 1's followed by one 0.
+    uint64_t q = 0;
+    while (bitreader.Read(1) == 1)
+        ++q;
+
+    uint64_t r = bitreader.Read(P);
+
+    return (q << P) + r;
+}
+
+/** Map a value x that is uniformly distributed in the range [0, 2^64) to a
+ *  value uniformly distributed in [0, n) by returning the upper 64 bits of
+ *  x * n. */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64;
+#else
+    uint64_t x_hi = x >> 32;
+    uint64_t x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32;
+    uint64_t n_lo = n & 0xFFFFFFFF;
+
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    uint64_t upper64 = ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+    return upper64;
+#endif
+}
+
+} // anon namespace
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(params.siphash_k0, params.siphash_k1)
+        .Write(element.data(), element.size())
+        .Finalize();
+    return MapIntoRange(hash, F);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> hashed_elements;
+    hashed_elements.reserve(elements.size());
+    for (ElementSet::const_iterator it = elements.begin(); it != elements.end(); ++it)
+        hashed_elements.push_back(HashToRange(*it));
+    std::sort(hashed_elements.begin(), hashed_elements.end());
+    return hashed_elements;
+}
+
+GCSFilter::GCSFilter(const Params& params)
+    : params(params), N(0), F(0), encoded(1, 0)
+{}
+
+GCSFilter::GCSFilter(const Params& params, const std::vector<unsigned char>& encoded_filter)
+    : params(params), encoded(encoded_filter)
+{
+    CDataStream stream(encoded, GCS_SER_TYPE, GCS_SER_VERSION);
+
+    uint64_t N_64 = ReadCompactSize(stream);
+    N = static_cast<uint32_t>(N_64);
+    if (N != N_64)
+        throw std::ios_base::failure("N must be <2^32");
+    F = static_cast<uint64_t>(N) * static_cast<uint64_t>(params.M);
+
+    // Verify that the encoded filter contains exactly N elements. If it has too much or too little
+    // data, a std::ios_base::failure exception will be raised.
+    BitStreamReader bitreader(encoded, encoded.size() - stream.size());
+    for (uint64_t i = 0; i < N; ++i)
+        GolombRiceDecode(bitreader, params.P);
+}
+
+GCSFilter::GCSFilter(const Params& params, const ElementSet& elements)
+    : params(params)
+{
+    size_t N_64 = elements.size();
+    if (N_64 >= 0x100000000ULL)
+        throw std::invalid_argument("N must be <2^32");
+    N = static_cast<uint32_t>(N_64);
+    F = static_cast<uint64_t>(N) * static_cast<uint64_t>(params.M);
+
+    CDataStream stream(GCS_SER_TYPE, GCS_SER_VERSION);
+    WriteCompactSize(stream, N);
+    encoded.assign(stream.begin(), stream.end());
+
+    if (elements.empty())
+        return;
+
+    BitStreamWriter bitwriter(encoded);
+
+    uint64_t last_value = 0;
+    std::vector<uint64_t> hashed_elements = BuildHashedSet(elements);
+    for (size_t i = 0; i < hashed_elements.size(); i++) {
+        uint64_t delta = hashed_elements[i] - last_value;
+        GolombRiceEncode(bitwriter, params.P, delta);
+        last_value = hashed_elements[i];
+    }
+
+    bitwriter.Flush();
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* element_hashes, size_t size) const
+{
+    CDataStream stream(encoded, GCS_SER_TYPE, GCS_SER_VERSION);
+
+    // Seek forward by size of N
+    uint64_t N_64 = ReadCompactSize(stream);
+    assert(N_64 == N);
+
+    BitStreamReader bitreader(encoded, encoded.size() - stream.size());
+
+    uint64_t value = 0;
+    size_t hashes_index = 0;
+    for (uint32_t i = 0; i < N; ++i) {
+        uint64_t delta = GolombRiceDecode(bitreader, params.P);
+        value += delta;
+
+        while (true) {
+            if (hashes_index == size) {
+                return false;
+            } else if (element_hashes[hashes_index] == value) {
+                return true;
+            } else if (element_hashes[hashes_index] > value) {
+                break;
+            }
+
+            hashes_index++;
+        }
+    }
+
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t query = HashToRange(element);
+    return MatchInternal(&query, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    const std::vector<uint64_t> queries = BuildHashedSet(elements);
+    return MatchInternal(queries.data(), queries.size());
+}
+
+std::string BlockFilterTypeName(BlockFilterType filter_type)
+{
+    switch (filter_type) {
+    case BLOCK_FILTER_BASIC: return "basic";
+    }
+    return "";
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& block_undo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CScript& script = tx.vout[j].scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    for (size_t i = 0; i < block_undo.vtxundo.size(); i++) {
+        const CTxUndo& tx_undo = block_undo.vtxundo[i];
+        for (size_t j = 0; j < tx_undo.vprevout.size(); j++) {
+            const CScript& script = tx_undo.vprevout[j].txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    return elements;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_type, const uint256& block_hash,
+                         const std::vector<unsigned char>& filter)
+    : filter_type(filter_type), block_hash(block_hash)
+{
+    GCSFilter::Params params;
+    if (!BuildParams(params))
+        throw std::invalid_argument("unknown filter_type");
+    this->filter = GCSFilter(params, filter);
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo)
+    : filter_type(filter_type), block_hash(block.GetHash())
+{
+    GCSFilter::Params params;
+    if (!BuildParams(params))
+        throw std::invalid_argument("unknown filter_type");
+    filter = GCSFilter(params, BasicFilterElements(block, block_undo));
+}
+
+bool BlockFilter::BuildParams(GCSFilter::Params& params) const
+{
+    switch (filter_type) {
+    case BLOCK_FILTER_BASIC:
+        params.siphash_k0 = ReadLE64(block_hash.begin());
+        params.siphash_k1 = ReadLE64(block_hash.begin() + 8);
+        params.P = BASIC_FILTER_P;
+        params.M = BASIC_FILTER_M;
+        return true;
+    }
+
+    return false;
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& data = GetEncodedFilter();
+    return Hash(data.begin(), data.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prev_header) const
+{
+    const uint256& filter_hash = GetHash();
+    return Hash(filter_hash.begin(), filter_hash.end(),
+                prev_header.begin(), prev_header.end());
+}
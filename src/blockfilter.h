@@ -0,0 +1,162 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Default for -peerblockfilters */
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Maximum number of filters returned for one "getcfilters" request */
+static const int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes returned for one "getcfheaders" request */
+static const int MAX_GETCFHEADERS_SIZE = 2000;
+/** Spacing of the filter headers returned for a "getcfcheckpt" request */
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/**
+ * A Golomb-coded set (BIP 158): a compact probabilistic set of byte strings.
+ * Elements are hashed with SipHash into [0, N * M), sorted, and the
+ * differences Golomb-Rice coded with parameter P. A query for an element
+ * that was not added matches with probability about 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    struct Params
+    {
+        uint64_t siphash_k0;
+        uint64_t siphash_k1;
+        uint8_t P;  //!< Golomb-Rice coding parameter
+        uint32_t M; //!< Inverse false positive rate
+
+        Params(uint64_t siphash_k0 = 0, uint64_t siphash_k1 = 0, uint8_t P = 0, uint32_t M = 1)
+            : siphash_k0(siphash_k0), siphash_k1(siphash_k1), P(P), M(M)
+        {}
+    };
+
+private:
+    Params params;
+    uint32_t N; //!< Number of elements in the filter
+    uint64_t F; //!< Range of element hashes, F = N * M
+    std::vector<unsigned char> encoded;
+
+    /** Hash a data element to an integer in the range [0, N * M). */
+    uint64_t HashToRange(const Element& element) const;
+
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+
+    /** Helper method used to implement Match and MatchAny */
+    bool MatchInternal(const uint64_t* element_hashes, size_t size) const;
+
+public:
+    /** Constructs an empty filter. */
+    explicit GCSFilter(const Params& params = Params());
+
+    /** Reconstructs an already-created filter from an encoding; throws std::ios_base::failure if it is malformed. */
+    GCSFilter(const Params& params, const std::vector<unsigned char>& encoded_filter);
+
+    /** Builds a new filter from the params and set of elements. */
+    GCSFilter(const Params& params, const ElementSet& elements);
+
+    uint32_t GetN() const { return N; }
+    const Params& GetParams() const { return params; }
+    const std::vector<unsigned char>& GetEncoded() const { return encoded; }
+
+    /** Checks if the element may be in the set. False positives are possible with probability 1/M. */
+    bool Match(const Element& element) const;
+
+    /** Checks if any of the given elements may be in the set, faster than calling Match on each. */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/** Filter types, as used in the BIP 157 messages. */
+enum BlockFilterType : uint8_t
+{
+    BLOCK_FILTER_BASIC = 0,
+};
+
+/** Name of a filter type, as used by the RPC interface */
+std::string BlockFilterTypeName(BlockFilterType filter_type);
+
+/**
+ * The compact filter of a block. The basic filter holds every transparent
+ * output script of the block, except OP_RETURN outputs, and every script
+ * spent by its inputs, so that a light client can tell which blocks touch
+ * its transparent addresses. Shielded wallets scan the compact Sapling
+ * blocks (see compactblocks.h) instead.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType filter_type;
+    uint256 block_hash;
+    GCSFilter filter;
+
+    bool BuildParams(GCSFilter::Params& params) const;
+
+public:
+    BlockFilter() : filter_type(BLOCK_FILTER_BASIC) {}
+
+    /** Reconstruct a BlockFilter from parts; throws std::invalid_argument on an unknown type. */
+    BlockFilter(BlockFilterType filter_type, const uint256& block_hash,
+                const std::vector<unsigned char>& filter);
+
+    /** Construct a new BlockFilter of the specified type from a block and its undo data. */
+    BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo);
+
+    BlockFilterType GetFilterType() const { return filter_type; }
+    const uint256& GetBlockHash() const { return block_hash; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    /** Compute the filter hash. */
+    uint256 GetHash() const;
+
+    /** Compute the filter header given the previous one, committing the filter to the chain. */
+    uint256 ComputeHeader(const uint256& prev_header) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << (uint8_t)filter_type;
+        s << block_hash;
+        s << filter.GetEncoded();
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        std::vector<unsigned char> encoded_filter;
+        uint8_t filter_type_in;
+
+        s >> filter_type_in;
+        s >> block_hash;
+        s >> encoded_filter;
+
+        filter_type = static_cast<BlockFilterType>(filter_type_in);
+
+        GCSFilter::Params params;
+        if (!BuildParams(params))
+            throw std::ios_base::failure("unknown filter_type");
+        filter = GCSFilter(params, encoded_filter);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
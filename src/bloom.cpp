@@ -5,14 +5,16 @@
 #include "bloom.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
-#include "streams.h"
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 
@@ -21,6 +23,61 @@
 
 using namespace std;
 
+// The serialization of an outpoint, as it is inserted into filters
+static void SerializeOutPoint(const COutPoint& outpoint, unsigned char* pch)
+{
+    memcpy(pch, outpoint.hash.begin(), 32);
+    WriteLE32(pch + 32, outpoint.n);
+}
+
+static const size_t OUTPOINT_SIZE = 36;
+
+CTxFilterElements::CTxFilterElements(const CTransaction& tx) : nOutputs(tx.vout.size())
+{
+    vGroupEnd.reserve(tx.vout.size() + tx.vin.size());
+    vector<unsigned char> data;
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+    {
+        CScript::const_iterator pc = txout.scriptPubKey.begin();
+        while (pc < txout.scriptPubKey.end())
+        {
+            opcodetype opcode;
+            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
+                break;
+            if (data.size() != 0)
+                AddElement(data.data(), data.size());
+        }
+        vGroupEnd.push_back(vElementEnd.size());
+    }
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        unsigned char pchOutPoint[OUTPOINT_SIZE];
+        SerializeOutPoint(txin.prevout, pchOutPoint);
+        AddElement(pchOutPoint, OUTPOINT_SIZE);
+        CScript::const_iterator pc = txin.scriptSig.begin();
+        while (pc < txin.scriptSig.end())
+        {
+            opcodetype opcode;
+            if (!txin.scriptSig.GetOp(pc, opcode, data))
+                break;
+            if (data.size() != 0)
+                AddElement(data.data(), data.size());
+        }
+        vGroupEnd.push_back(vElementEnd.size());
+    }
+}
+
+void CTxFilterElements::AddElement(const unsigned char* pData, size_t nLen)
+{
+    vchData.insert(vchData.end(), pData, pData + nLen);
+    vElementEnd.push_back(vchData.size());
+}
+
+size_t CTxFilterElements::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vchData) + memusage::DynamicUsage(vElementEnd) + memusage::DynamicUsage(vGroupEnd);
+}
+
 CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn, unsigned char nFlagsIn) :
     /**
      * The ideal size for a bloom filter with a given number of elements and false positive rate is:
@@ -52,40 +109,43 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const unsigned char* pData, size_t nLen) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pData, nLen) % (vData.size() * 8);
 }
 
-void CBloomFilter::insert(const vector<unsigned char>& vKey)
+void CBloomFilter::insert(const unsigned char* pData, size_t nLen)
 {
     if (isFull)
         return;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pData, nLen);
         // Sets bit nIndex of vData
         vData[nIndex >> 3] |= (1 << (7 & nIndex));
     }
     isEmpty = false;
 }
 
+void CBloomFilter::insert(const vector<unsigned char>& vKey)
+{
+    insert(vKey.data(), vKey.size());
+}
+
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    insert(data);
+    unsigned char pchOutPoint[OUTPOINT_SIZE];
+    SerializeOutPoint(outpoint, pchOutPoint);
+    insert(pchOutPoint, OUTPOINT_SIZE);
 }
 
 void CBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
-bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+bool CBloomFilter::contains(const unsigned char* pData, size_t nLen) const
 {
     if (isFull)
         return true;
@@ -93,7 +153,7 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
         return false;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pData, nLen);
         // Checks bit nIndex of vData
         if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
             return false;
@@ -101,18 +161,48 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
     return true;
 }
 
+bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    return contains(vKey.data(), vKey.size());
+}
+
 bool CBloomFilter::contains(const COutPoint& outpoint) const
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    return contains(data);
+    unsigned char pchOutPoint[OUTPOINT_SIZE];
+    SerializeOutPoint(outpoint, pchOutPoint);
+    return contains(pchOutPoint, OUTPOINT_SIZE);
 }
 
 bool CBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
+}
+
+void CBloomFilter::insertDoubleHashed(uint64_t nHash)
+{
+    uint32_t nHash1 = nHash;
+    uint32_t nHash2 = (nHash >> 32) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++)
+    {
+        unsigned int nIndex = (nHash1 + i * nHash2) % (vData.size() * 8);
+        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+    }
+    isEmpty = false;
+}
+
+bool CBloomFilter::containsDoubleHashed(uint64_t nHash) const
+{
+    if (isEmpty)
+        return false;
+    uint32_t nHash1 = nHash;
+    uint32_t nHash2 = (nHash >> 32) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++)
+    {
+        unsigned int nIndex = (nHash1 + i * nHash2) % (vData.size() * 8);
+        if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
+            return false;
+    }
+    return true;
 }
 
 void CBloomFilter::clear()
@@ -134,6 +224,15 @@ bool CBloomFilter::IsWithinSizeConstraints() const
 }
 
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    return IsRelevantAndUpdate(tx, CTxFilterElements(tx));
+}
+
+bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx, const CTxFilterElements& elements)
 {
     bool fFound = false;
     // Match if the filter contains the hash of tx
@@ -146,21 +245,18 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     if (contains(hash))
         fFound = true;
 
-    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    const unsigned char* pchData = elements.vchData.data();
+    unsigned int nElement = 0;
+    for (unsigned int i = 0; i < elements.nOutputs; i++)
     {
-        const CTxOut& txout = tx.vout[i];
         // Match if the filter contains any arbitrary script data element in any scriptPubKey in tx
         // If this matches, also add the specific output that was matched.
         // This means clients don't have to update the filter themselves when a new relevant tx 
         // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
-        CScript::const_iterator pc = txout.scriptPubKey.begin();
-        vector<unsigned char> data;
-        while (pc < txout.scriptPubKey.end())
+        for (; nElement < elements.vGroupEnd[i]; nElement++)
         {
-            opcodetype opcode;
-            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            uint32_t nBegin = nElement ? elements.vElementEnd[nElement - 1] : 0;
+            if (contains(pchData + nBegin, elements.vElementEnd[nElement] - nBegin))
             {
                 fFound = true;
                 if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
@@ -169,35 +265,26 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
                 {
                     txnouttype type;
                     vector<vector<unsigned char> > vSolutions;
-                    if (Solver(txout.scriptPubKey, type, vSolutions) &&
+                    if (Solver(tx.vout[i].scriptPubKey, type, vSolutions) &&
                             (type == TX_PUBKEY || type == TX_MULTISIG))
                         insert(COutPoint(hash, i));
                 }
                 break;
             }
         }
+        nElement = elements.vGroupEnd[i];
     }
 
     if (fFound)
         return true;
 
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    // Match if the filter contains an outpoint tx spends, or any arbitrary
+    // script data element in any scriptSig in tx
+    for (; nElement < elements.vElementEnd.size(); nElement++)
     {
-        // Match if the filter contains an outpoint tx spends
-        if (contains(txin.prevout))
+        uint32_t nBegin = nElement ? elements.vElementEnd[nElement - 1] : 0;
+        if (contains(pchData + nBegin, elements.vElementEnd[nElement] - nBegin))
             return true;
-
-        // Match if the filter contains any arbitrary script data element in any scriptSig in tx
-        CScript::const_iterator pc = txin.scriptSig.begin();
-        vector<unsigned char> data;
-        while (pc < txin.scriptSig.end())
-        {
-            opcodetype opcode;
-            if (!txin.scriptSig.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
-                return true;
-        }
     }
 
     return false;
@@ -229,38 +316,52 @@ CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
     reset();
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+uint64_t CRollingBloomFilter::Hash(const unsigned char* pData, size_t nLen) const
+{
+    // b1 and b2 share their tweak, so one hash serves both
+    return CSipHasher(b1.nTweak, 0).Write(pData, nLen).Finalize();
+}
+
+void CRollingBloomFilter::insert(uint64_t nHash)
 {
     if (nInsertions == 0) {
         b1.clear();
     } else if (nInsertions == nBloomSize / 2) {
         b2.clear();
     }
-    b1.insert(vKey);
-    b2.insert(vKey);
+    b1.insertDoubleHashed(nHash);
+    b2.insertDoubleHashed(nHash);
     if (++nInsertions == nBloomSize) {
         nInsertions = 0;
     }
 }
 
+bool CRollingBloomFilter::contains(uint64_t nHash) const
+{
+    if (nInsertions < nBloomSize / 2) {
+        return b2.containsDoubleHashed(nHash);
+    }
+    return b1.containsDoubleHashed(nHash);
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(Hash(vKey.data(), vKey.size()));
+}
+
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(SipHashUint256(b1.nTweak, 0, hash));
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
-    if (nInsertions < nBloomSize / 2) {
-        return b2.contains(vKey);
-    }
-    return b1.contains(vKey);
+    return contains(Hash(vKey.data(), vKey.size()));
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(SipHashUint256(b1.nTweak, 0, hash));
 }
 
 void CRollingBloomFilter::reset()
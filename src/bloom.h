@@ -7,6 +7,7 @@
 
 #include "serialize.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
@@ -30,6 +31,33 @@ enum bloomflags
     BLOOM_UPDATE_MASK = 3,
 };
 
+/**
+ * The data elements of a transaction that a bloom filter is matched against:
+ * the data pushed by each scriptPubKey, then the serialized prevout and the
+ * data pushed by the scriptSig of each input. Parsing them once lets the
+ * transaction be matched against the filters of many peers.
+ */
+class CTxFilterElements
+{
+private:
+    friend class CBloomFilter;
+
+    //! The elements, back to back
+    std::vector<unsigned char> vchData;
+    //! End offset in vchData of each element
+    std::vector<uint32_t> vElementEnd;
+    //! One past the index in vElementEnd of the last element of each output, then of each input
+    std::vector<uint32_t> vGroupEnd;
+    unsigned int nOutputs;
+
+    void AddElement(const unsigned char* pData, size_t nLen);
+
+public:
+    explicit CTxFilterElements(const CTransaction& tx);
+
+    size_t DynamicMemoryUsage() const;
+};
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -51,12 +79,21 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    unsigned int Hash(unsigned int nHashNum, const unsigned char* pData, size_t nLen) const;
+
+    void insert(const unsigned char* pData, size_t nLen);
+    bool contains(const unsigned char* pData, size_t nLen) const;
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
     friend class CRollingBloomFilter;
 
+    // CRollingBloomFilter is never sent to peers, so it derives all the bit
+    // indexes of an element from one 64-bit hash (Kirsch-Mitzenmacher)
+    // instead of hashing it once per hash function
+    void insertDoubleHashed(uint64_t nHash);
+    bool containsDoubleHashed(uint64_t nHash) const;
+
 public:
     /**
      * Creates a new bloom filter which will provide the given fp rate when filled with the given number of elements
@@ -97,6 +134,8 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    //! Same as above, with the elements of tx already parsed
+    bool IsRelevantAndUpdate(const CTransaction& tx, const CTxFilterElements& elements);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
@@ -132,6 +171,10 @@ private:
     unsigned int nBloomSize;
     unsigned int nInsertions;
     CBloomFilter b1, b2;
+
+    uint64_t Hash(const unsigned char* pData, size_t nLen) const;
+    void insert(uint64_t nHash);
+    bool contains(uint64_t nHash) const;
 };
 
 
@@ -5,6 +5,12 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+#include "support/hugepages.h"
+
+#include <algorithm>
+#include <assert.h>
+
 using namespace std;
 
 /**
@@ -22,6 +28,134 @@ void CChain::SetTip(CBlockIndex *pindex) {
     }
 }
 
+CChainSnapshot::CChainSnapshot(const CChain& chain, const CChainSnapshot* prev) : nHeight(chain.Height()) {
+    int nChunks = (nHeight + CHUNK_SIZE) / CHUNK_SIZE;
+    vChunks.reserve(nChunks);
+    for (int i = 0; i < nChunks; i++) {
+        int nBegin = i * CHUNK_SIZE;
+        int nEnd = std::min(nBegin + CHUNK_SIZE, nHeight + 1);
+        // A full chunk whose last block is still in the chain holds the
+        // same ancestors as before
+        if (prev && nEnd - nBegin == CHUNK_SIZE && prev->Height() >= nEnd - 1 &&
+            (*prev)[nEnd - 1] == chain[nEnd - 1]) {
+            vChunks.push_back(prev->vChunks[i]);
+            continue;
+        }
+        std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+        chunk->reserve(nEnd - nBegin);
+        for (int nHeightIn = nBegin; nHeightIn < nEnd; nHeightIn++)
+            chunk->push_back(chain[nHeightIn]);
+        vChunks.push_back(chunk);
+    }
+}
+
+/**
+ * CBlockIndexArena implementation
+ */
+size_t CBlockIndexArena::SlotOf(const CBlockIndex* pindex) const {
+    const Slot* pslot = reinterpret_cast<const Slot*>(pindex);
+    std::map<const Slot*, size_t>::const_iterator it = mapChunks.upper_bound(pslot);
+    if (it == mapChunks.begin())
+        return nSlots;
+    --it;
+    if (pslot >= it->first + CHUNK_SIZE)
+        return nSlots;
+    return it->second * CHUNK_SIZE + (pslot - it->first);
+}
+
+void* CBlockIndexArena::Allocate() {
+    size_t nSlot;
+    if (!vFree.empty()) {
+        nSlot = vFree.back();
+        vFree.pop_back();
+    } else {
+        if (nSlots == vChunks.size() * CHUNK_SIZE) {
+            if (vChunks.empty())
+                fHugePages = GetHugePageMode() != HUGEPAGES_OFF;
+            Slot* pchunk = fHugePages ? static_cast<Slot*>(AllocateHugePages(CHUNK_SIZE * sizeof(Slot))) : new Slot[CHUNK_SIZE];
+            mapChunks.insert(std::make_pair(pchunk, vChunks.size()));
+            vChunks.push_back(pchunk);
+        }
+        nSlot = nSlots++;
+        vLive.push_back(false);
+    }
+    vLive[nSlot] = true;
+    return At(nSlot);
+}
+
+void CBlockIndexArena::Delete(CBlockIndex* pindex) {
+    size_t nSlot = SlotOf(pindex);
+    assert(nSlot < nSlots && vLive[nSlot]);
+    pindex->~CBlockIndex();
+    vLive[nSlot] = false;
+    vFree.push_back(nSlot);
+}
+
+void CBlockIndexArena::Clear() {
+    for (size_t i = 0; i < nSlots; i++) {
+        if (vLive[i])
+            At(i)->~CBlockIndex();
+    }
+    for (Slot* pchunk : vChunks) {
+        if (fHugePages)
+            FreeHugePages(pchunk);
+        else
+            delete[] pchunk;
+    }
+    vChunks.clear();
+    mapChunks.clear();
+    vLive.clear();
+    vFree.clear();
+    nSlots = 0;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const {
+    size_t nChunkUsage = fHugePages ? (CHUNK_SIZE * sizeof(Slot) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE
+                                    : memusage::MallocUsage(CHUNK_SIZE * sizeof(Slot));
+    return nChunkUsage * vChunks.size() +
+           memusage::DynamicUsage(vChunks) + memusage::DynamicUsage(mapChunks) +
+           memusage::MallocUsage(vLive.capacity() / 8) + memusage::DynamicUsage(vFree);
+}
+
+bool CBlockIndexArena::Reorder(const std::vector<CBlockIndex*>& vOrder) {
+    if (vOrder.size() != nSlots || !vFree.empty())
+        return false;
+
+    // The slot each entry moves to
+    std::vector<size_t> vDest(nSlots, nSlots);
+    for (size_t i = 0; i < nSlots; i++) {
+        size_t nSlot = SlotOf(vOrder[i]);
+        if (nSlot >= nSlots || vDest[nSlot] != nSlots)
+            return false;
+        vDest[nSlot] = i;
+    }
+    for (size_t i = 0; i < nSlots; i++) {
+        const CBlockIndex* pindex = At(i);
+        if ((pindex->pprev && SlotOf(pindex->pprev) >= nSlots) || (pindex->pskip && SlotOf(pindex->pskip) >= nSlots))
+            return false;
+    }
+
+    // Point the links at where their targets are going, while the slot of
+    // every target can still be found
+    for (size_t i = 0; i < nSlots; i++) {
+        CBlockIndex* pindex = At(i);
+        if (pindex->pprev)
+            pindex->pprev = At(vDest[SlotOf(pindex->pprev)]);
+        if (pindex->pskip)
+            pindex->pskip = At(vDest[SlotOf(pindex->pskip)]);
+    }
+
+    // Apply the permutation one cycle at a time
+    for (size_t i = 0; i < nSlots; i++) {
+        while (vDest[i] != i) {
+            size_t nDest = vDest[i];
+            std::swap(*At(i), *At(nDest));
+            std::swap(vDest[i], vDest[nDest]);
+        }
+    }
+    return true;
+}
+
 CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
     int nStep = 1;
     std::vector<uint256> vHave;
@@ -12,6 +12,9 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <map>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 extern bool fZindex;
@@ -332,7 +335,9 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
-    std::vector<unsigned char> nSolution;
+    //! The Equihash solution is not kept in memory: it is looked up in the
+    //! block tree database, or among the headers not yet written to it (see
+    //! GetSolution)
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
@@ -392,7 +397,6 @@ public:
         nTime          = 0;
         nBits          = 0;
         nNonce         = uint256();
-        nSolution.clear();
     }
 
     CBlockIndex()
@@ -410,7 +414,6 @@ public:
         nTime          = block.nTime;
         nBits          = block.nBits;
         nNonce         = block.nNonce;
-        nSolution      = block.nSolution;
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -431,7 +434,11 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    //! The header, with the solution read from the block tree database (thread safe, may throw)
+    CBlockHeader GetBlockHeader() const;
+    std::vector<unsigned char> GetSolution() const;
+
+    CBlockHeader GetBlockHeader(const std::vector<unsigned char>& nSolution) const
     {
         CBlockHeader block;
         block.nVersion       = nVersion;
@@ -516,12 +523,14 @@ class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
+    std::vector<unsigned char> nSolution;
 
     CDiskBlockIndex() {
         hashPrev = uint256();
     }
 
-    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
+    CDiskBlockIndex(const CBlockIndex* pindex, const std::vector<unsigned char>& nSolutionIn) :
+        CBlockIndex(*pindex), nSolution(nSolutionIn) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
     }
 
@@ -624,6 +633,67 @@ public:
     }
 };
 
+/**
+ * Storage for block index entries, in chunks of contiguous entries instead
+ * of one heap allocation each. Entries never move except in Reorder, which
+ * lays them out in a given order, so that walking a chain back through
+ * pprev and pskip touches neighbouring memory. Not thread safe; the arena
+ * of mapBlockIndex is guarded by cs_main.
+ */
+class CBlockIndexArena
+{
+public:
+    static const size_t CHUNK_SIZE = 4096;
+
+private:
+    typedef std::aligned_storage<sizeof(CBlockIndex), alignof(CBlockIndex)>::type Slot;
+    std::vector<Slot*> vChunks;
+    //! First slot of every chunk, by address, to find the slot of an entry
+    std::map<const Slot*, size_t> mapChunks;
+    std::vector<bool> vLive;
+    std::vector<size_t> vFree;
+    size_t nSlots;
+    //! Whether the chunks are mapped with AllocateHugePages (-hugepages), decided at the first
+    bool fHugePages;
+
+    CBlockIndex* At(size_t nSlot) const {
+        return reinterpret_cast<CBlockIndex*>(&vChunks[nSlot / CHUNK_SIZE][nSlot % CHUNK_SIZE]);
+    }
+    size_t SlotOf(const CBlockIndex* pindex) const;
+    void* Allocate();
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+
+public:
+    CBlockIndexArena() : nSlots(0), fHugePages(false) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    template <typename... Args>
+    CBlockIndex* New(Args&&... args) {
+        return new (Allocate()) CBlockIndex(std::forward<Args>(args)...);
+    }
+    /** Destroy an entry allocated by this arena; its slot is reused */
+    void Delete(CBlockIndex* pindex);
+    /** Destroy every entry and release the chunks */
+    void Clear();
+
+    size_t size() const { return nSlots - vFree.size(); }
+    size_t DynamicMemoryUsage() const;
+
+    /**
+     * Move the entries so that they are stored in the order of vOrder,
+     * which must hold every entry of the arena once, and point pprev and
+     * pskip at the moved entries. Afterwards the entry that was vOrder[i]
+     * is (*this)[i]; any other pointer to the entries is left dangling.
+     * False, and nothing moved, if vOrder is not such a list.
+     */
+    bool Reorder(const std::vector<CBlockIndex*>& vOrder);
+
+    //! The entry in slot i, for an arena with no free slots
+    CBlockIndex* operator[](size_t i) const { return At(i); }
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
@@ -681,4 +751,55 @@ public:
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
 
+/**
+ * An immutable copy of a CChain, for readers that do not hold the lock
+ * protecting the chain. Entries are kept in fixed-size chunks shared with
+ * the snapshot it was made from, so a snapshot of a chain that moved by a
+ * few blocks copies only the chunks that changed.
+ */
+class CChainSnapshot {
+public:
+    static const int CHUNK_SIZE = 4096;
+
+private:
+    typedef std::vector<CBlockIndex*> Chunk;
+    std::vector<std::shared_ptr<const Chunk> > vChunks;
+    int nHeight;
+
+public:
+    CChainSnapshot() : nHeight(-1) {}
+
+    /** Copy chain, reusing the chunks of prev (if any) that are still part of it. */
+    CChainSnapshot(const CChain& chain, const CChainSnapshot* prev);
+
+    CBlockIndex *Genesis() const {
+        return (*this)[0];
+    }
+
+    CBlockIndex *Tip() const {
+        return (*this)[nHeight];
+    }
+
+    CBlockIndex *operator[](int nHeightIn) const {
+        if (nHeightIn < 0 || nHeightIn > nHeight)
+            return NULL;
+        return (*vChunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE];
+    }
+
+    bool Contains(const CBlockIndex *pindex) const {
+        return (*this)[pindex->nHeight] == pindex;
+    }
+
+    CBlockIndex *Next(const CBlockIndex *pindex) const {
+        if (Contains(pindex))
+            return (*this)[pindex->nHeight + 1];
+        else
+            return NULL;
+    }
+
+    int Height() const {
+        return nHeight;
+    }
+};
+
 #endif // BITCOIN_CHAIN_H
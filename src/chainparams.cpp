@@ -128,6 +128,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x0000000000000000000000000000000000000000000000000000023297bef3cd");
 
+        // By default assume that the proofs and signatures up to the last checkpoint are valid
+        consensus.defaultAssumeValid = uint256S("0x000001bee8c5bc29fb8d6c3642662ecb479ec85df648e851edaaa0e090b2c797"); // 700000
+
         /**
          * The message start string should be awesome!
          */
@@ -301,6 +304,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // By default assume that the proofs and signatures up to this block are valid
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0x5B; // Z+1
         pchMessageStart[1] = 0x46; // E+1
         pchMessageStart[2] = 0x53; // R+1
@@ -454,6 +460,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // By default assume that the proofs and signatures up to this block are valid
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0x5C; // Z+2
         pchMessageStart[1] = 0x47; // E+2
         pchMessageStart[2] = 0x54; // R+2
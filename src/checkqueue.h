@@ -6,9 +6,13 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <utility>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -16,21 +20,60 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** What the checks added since the last Wait came to */
+struct CCheckQueueResult
+{
+    //! Whether all the checks passed
+    bool fAllOk;
+    //! The checks run, and those skipped once one had failed
+    uint64_t nChecked;
+    uint64_t nSkipped;
+    //! The position, in the order they were added, of the first check
+    //! found to fail (of those run, the lowest), or -1
+    int64_t nFailed;
+
+    CCheckQueueResult() : fAllOk(true), nChecked(0), nSkipped(0), nFailed(-1) {}
+};
+
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Every thread has a deque of its own, the master's being the first. Add
+ * spreads the checks over the deques, each under its own lock, and only
+ * takes the shared lock to wake workers that are asleep. A thread takes
+ * batches from the back of its own deque and, when that is empty, steals
+ * from the front of the others'. Once a check fails, the remaining ones
+ * are dequeued without being run.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Deques beyond this are shared between threads
+    static const size_t MAX_SLOTS = 64;
+
+    struct Slot {
+        boost::mutex mutex;
+        //! The checks with their positions in the order they were added
+        std::deque<std::pair<uint64_t, T> > checks;
+    };
+
+    std::vector<std::unique_ptr<Slot> > vSlots;
+
+    //! The number of deques in use: the master's and one per worker
+    std::atomic<size_t> nSlots;
+
+    //! The number of worker threads started
+    size_t nWorkers;
+
+    //! Mutex to sleep and wake up on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,122 +82,180 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers that are asleep
+    std::atomic<int> nIdle;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The number of checks in the deques. It is updated after a deque
+    //! changes, so it may be briefly behind.
+    std::atomic<int64_t> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<int64_t> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+    std::atomic<uint64_t> nChecked;
+    std::atomic<uint64_t> nSkipped;
+    std::atomic<uint64_t> nFailed;
+
+    //! Position of the next check added (master only)
+    uint64_t nNextIndex;
+
+    //! The deque the next Add starts at (master only)
+    size_t nNextSlot;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /** Move a batch from the back of our own deque, or else from the front of another's */
+    bool Take(size_t nSlot, std::vector<std::pair<uint64_t, T> >& vBatch)
+    {
+        size_t nSlotsNow = nSlots;
+        for (size_t i = 0; i < nSlotsNow; i++) {
+            Slot& slot = *vSlots[(nSlot + i) % nSlotsNow];
+            boost::unique_lock<boost::mutex> lock(slot.mutex);
+            if (slot.checks.empty())
+                continue;
+            // Leave half for the threads that may come stealing
+            size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, slot.checks.size() / 2));
+            vBatch.resize(nNow);
+            for (size_t j = 0; j < nNow; j++) {
+                std::pair<uint64_t, T>& check = i == 0 ? slot.checks.back() : slot.checks.front();
+                vBatch[j].first = check.first;
+                vBatch[j].second.swap(check.second);
+                if (i == 0)
+                    slot.checks.pop_back();
+                else
+                    slot.checks.pop_front();
+            }
+            nQueued -= nNow;
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    void Loop(size_t nSlot, bool fMaster, CCheckQueueResult* pResult = NULL)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+        std::vector<std::pair<uint64_t, T> > vBatch;
+        vBatch.reserve(nBatchSize);
+        while (true) {
+            if (Take(nSlot, vBatch)) {
+                for (std::pair<uint64_t, T>& check : vBatch) {
+                    if (!fAllOk) {
+                        nSkipped++;
+                        continue;
+                    }
+                    nChecked++;
+                    if (!check.second()) {
+                        fAllOk = false;
+                        uint64_t nPrev = nFailed;
+                        while (check.first < nPrev && !nFailed.compare_exchange_weak(nPrev, check.first)) {}
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                int64_t nNow = vBatch.size();
+                vBatch.clear();
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                if (nTodo == 0) {
+                    if (pResult) {
+                        pResult->fAllOk = fAllOk;
+                        pResult->nChecked = nChecked;
+                        pResult->nSkipped = nSkipped;
+                        pResult->nFailed = fAllOk ? -1 : (int64_t)nFailed;
+                    }
+                    // reset the status for new work later
+                    fAllOk = true;
+                    nChecked = 0;
+                    nSkipped = 0;
+                    nFailed = UINT64_MAX;
+                    nNextIndex = 0;
+                    return;
+                }
+                // The rest are in the workers' batches
+                if (nQueued <= 0)
+                    condMaster.wait(lock);
+            } else {
+                nIdle++;
+                while (nQueued <= 0)
+                    condWorker.wait(lock); // wait
+                nIdle--;
+            }
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) :
+        nSlots(1), nWorkers(0), nIdle(0), nQueued(0), nTodo(0), fAllOk(true), nChecked(0), nSkipped(0),
+        nFailed(UINT64_MAX), nNextIndex(0), nNextSlot(0), nBatchSize(nBatchSizeIn)
+    {
+        for (size_t i = 0; i < MAX_SLOTS; i++)
+            vSlots.emplace_back(new Slot());
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        size_t nSlot;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSlot = 1 + nWorkers++ % (MAX_SLOTS - 1);
+            if (nSlot >= nSlots)
+                nSlots = nSlot + 1;
+        }
+        Loop(nSlot, false);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
-    bool Wait()
+    bool Wait(CCheckQueueResult* pResult = NULL)
     {
-        return Loop(true);
+        CCheckQueueResult result;
+        Loop(0, true, &result);
+        if (pResult)
+            *pResult = result;
+        return result.fAllOk;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        // Spread the checks over the deques in runs, each taking one lock
+        size_t nSlotsNow = nSlots;
+        size_t nPerSlot = (vChecks.size() + nSlotsNow - 1) / nSlotsNow;
+        for (size_t nStart = 0; nStart < vChecks.size(); nStart += nPerSlot) {
+            Slot& slot = *vSlots[nNextSlot++ % nSlotsNow];
+            size_t nEnd = std::min(vChecks.size(), nStart + nPerSlot);
+            boost::unique_lock<boost::mutex> lock(slot.mutex);
+            for (size_t i = nStart; i < nEnd; i++) {
+                slot.checks.emplace_back();
+                slot.checks.back().first = nNextIndex++;
+                slot.checks.back().second.swap(vChecks[i]);
+            }
+        }
+        nQueued += vChecks.size();
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
@@ -163,13 +264,12 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo == 0 && nQueued == 0 && fAllOk;
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -190,11 +290,11 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(CCheckQueueResult* pResult = NULL)
     {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pResult);
         fDone = true;
         return fRet;
     }
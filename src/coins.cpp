@@ -10,6 +10,7 @@
 #include "policy/fees.h"
 
 #include <assert.h>
+#include <set>
 
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
@@ -87,7 +88,7 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0), pCounters(NULL) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -105,8 +106,13 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        if (pCounters)
+            pCounters->nHits.fetch_add(1, std::memory_order_relaxed);
         return it;
+    }
+    if (pCounters)
+        pCounters->nMisses.fetch_add(1, std::memory_order_relaxed);
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
@@ -216,6 +222,7 @@ void CCoinsViewCache::AbstractPushAnchor(
 
         ret->second.entered = true;
         ret->second.tree = tree;
+        ret->second.hashParent = currentRoot;
         ret->second.flags = CacheEntry::DIRTY;
 
         if (insertRet.second) {
@@ -458,6 +465,7 @@ void BatchWriteAnchors(
                 MapEntry& entry = cacheAnchors[child_it->first];
                 entry.entered = child_it->second.entered;
                 entry.tree = child_it->second.tree;
+                entry.hashParent = child_it->second.hashParent;
                 entry.flags = MapEntry::DIRTY;
 
                 cachedCoinsUsage += entry.tree.DynamicMemoryUsage();
@@ -467,6 +475,12 @@ void BatchWriteAnchors(
                     parent_it->second.entered = child_it->second.entered;
                     parent_it->second.flags |= MapEntry::DIRTY;
                 }
+                if (child_it->second.entered && !child_it->second.hashParent.IsNull() &&
+                    parent_it->second.hashParent != child_it->second.hashParent) {
+                    // The same tree was reached from a different anchor
+                    parent_it->second.hashParent = child_it->second.hashParent;
+                    parent_it->second.flags |= MapEntry::DIRTY;
+                }
             }
         }
 
@@ -508,6 +522,15 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    if (!(itUs->second.flags & CCoinsCacheEntry::FRESH)) {
+                        // Carry over which outputs differ from the grandparent.
+                        // A FRESH child replaced a pruned entry, so all of
+                        // its outputs are new.
+                        for (unsigned int i = 0; i < it->second.coins.vout.size() || i < it->second.vModified.size(); i++) {
+                            if (it->second.IsModified(i))
+                                itUs->second.MarkModified(i);
+                        }
+                    }
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
@@ -533,15 +556,99 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers);
-    cacheCoins.clear();
-    cacheSproutAnchors.clear();
-    cacheSaplingAnchors.clear();
-    cacheSproutNullifiers.clear();
-    cacheSaplingNullifiers.clear();
+    // Replace the maps rather than clearing them, which hands the pooled
+    // memory back in bulk
+    CCoinsMap().swap(cacheCoins);
+    CAnchorsSproutMap().swap(cacheSproutAnchors);
+    CAnchorsSaplingMap().swap(cacheSaplingAnchors);
+    CNullifiersMap().swap(cacheSproutNullifiers);
+    CNullifiersMap().swap(cacheSaplingNullifiers);
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+void CCoinsViewCache::Prefetch(const std::vector<uint256>& vTxid,
+                               const std::vector<std::pair<uint256, ShieldedType> >& vNullifiers,
+                               const std::function<void(std::vector<std::function<bool()> >&)>& fRun)
+{
+    // Reads per check, so that each check amortizes its scheduling
+    static const size_t BATCH_SIZE = 16;
+
+    struct CoinsRead {
+        uint256 txid;
+        CCoins coins;
+        bool fFound;
+    };
+    struct NullifierRead {
+        uint256 nf;
+        ShieldedType type;
+        bool fSpent;
+    };
+    std::vector<CoinsRead> vCoinsReads;
+    std::vector<NullifierRead> vNullifierReads;
+    std::set<uint256> setSeen;
+    for (const uint256& txid : vTxid) {
+        if (!cacheCoins.count(txid) && setSeen.insert(txid).second) {
+            vCoinsReads.push_back(CoinsRead());
+            vCoinsReads.back().txid = txid;
+        }
+    }
+    for (const std::pair<uint256, ShieldedType>& nf : vNullifiers) {
+        const CNullifiersMap& cacheToUse = nf.second == SPROUT ? cacheSproutNullifiers : cacheSaplingNullifiers;
+        if (!cacheToUse.count(nf.first)) {
+            NullifierRead read;
+            read.nf = nf.first;
+            read.type = nf.second;
+            vNullifierReads.push_back(read);
+        }
+    }
+    if (vCoinsReads.empty() && vNullifierReads.empty())
+        return;
+
+    // The reads only touch their own slots, which stay in place until all are done
+    std::vector<std::function<bool()> > vReads;
+    const CCoinsView* view = base;
+    for (size_t i = 0; i < vCoinsReads.size(); i += BATCH_SIZE) {
+        CoinsRead* pbegin = &vCoinsReads[i];
+        CoinsRead* pend = pbegin + std::min(BATCH_SIZE, vCoinsReads.size() - i);
+        vReads.push_back([view, pbegin, pend]() {
+            for (CoinsRead* p = pbegin; p != pend; p++)
+                p->fFound = view->GetCoins(p->txid, p->coins);
+            return true;
+        });
+    }
+    for (size_t i = 0; i < vNullifierReads.size(); i += BATCH_SIZE) {
+        NullifierRead* pbegin = &vNullifierReads[i];
+        NullifierRead* pend = pbegin + std::min(BATCH_SIZE, vNullifierReads.size() - i);
+        vReads.push_back([view, pbegin, pend]() {
+            for (NullifierRead* p = pbegin; p != pend; p++)
+                p->fSpent = view->GetNullifier(p->nf, p->type);
+            return true;
+        });
+    }
+    fRun(vReads);
+    if (pCounters)
+        pCounters->nMisses.fetch_add(vCoinsReads.size(), std::memory_order_relaxed);
+
+    // Add the results as FetchCoins and GetNullifier would have
+    for (CoinsRead& read : vCoinsReads) {
+        if (!read.fFound)
+            continue;
+        std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(read.txid, CCoinsCacheEntry()));
+        if (!ret.second)
+            continue;
+        read.coins.swap(ret.first->second.coins);
+        if (ret.first->second.coins.IsPruned())
+            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+    }
+    for (const NullifierRead& read : vNullifierReads) {
+        CNullifiersCacheEntry entry;
+        entry.entered = read.fSpent;
+        (read.type == SPROUT ? cacheSproutNullifiers : cacheSaplingNullifiers).insert(std::make_pair(read.nf, entry));
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -657,6 +764,17 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
 CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+    const CCoins& coins = it->second.coins;
+    nHeightOld = coins.nHeight;
+    nVersionOld = coins.nVersion;
+    fCoinBaseOld = coins.fCoinBase;
+    if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+        // A spent output has a value of -1, so comparing the values catches
+        // both spends and restores
+        vValueOld.reserve(coins.vout.size());
+        BOOST_FOREACH(const CTxOut& out, coins.vout)
+            vValueOld.push_back(out.nValue);
+    }
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -664,6 +782,17 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+        const CCoins& coins = it->second.coins;
+        bool fMetadataChanged = coins.nHeight != nHeightOld || coins.nVersion != nVersionOld || coins.fCoinBase != fCoinBaseOld;
+        size_t nSize = std::max(vValueOld.size(), coins.vout.size());
+        for (size_t i = 0; i < nSize; i++) {
+            CAmount nValueOld = i < vValueOld.size() ? vValueOld[i] : -1;
+            CAmount nValue = i < coins.vout.size() ? coins.vout[i].nValue : -1;
+            if (fMetadataChanged || nValue != nValueOld)
+                it->second.MarkModified(i);
+        }
+    }
     cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
@@ -10,9 +10,12 @@
 #include "core_memusage.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
+#include <atomic>
+#include <functional>
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
@@ -89,7 +92,7 @@ public:
 
     void FromTx(const CTransaction &tx, int nHeightIn) {
         fCoinBase = tx.IsCoinBase();
-        vout = tx.vout;
+        vout.assign(tx.vout.begin(), tx.vout.end());
         nHeight = nHeightIn;
         nVersion = tx.nVersion;
         ClearUnspendable();
@@ -264,6 +267,10 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    //! Outputs that are potentially different from the parent view. Only
+    //! tracked for entries that are not FRESH, so that flushing a partly
+    //! spent transaction only touches the outputs that changed.
+    std::vector<bool> vModified;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -271,12 +278,23 @@ struct CCoinsCacheEntry
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    void MarkModified(unsigned int nPos) {
+        if (vModified.size() <= nPos)
+            vModified.resize(nPos + 1, false);
+        vModified[nPos] = true;
+    }
+
+    bool IsModified(unsigned int nPos) const {
+        return (flags & FRESH) || (nPos < vModified.size() && vModified[nPos]);
+    }
 };
 
 struct CAnchorsSproutCacheEntry
 {
     bool entered; // This will be false if the anchor is removed from the cache
     SproutMerkleTree tree; // The tree itself
+    uint256 hashParent; // The anchor this tree was appended to, if known
     unsigned char flags;
 
     enum Flags {
@@ -290,6 +308,7 @@ struct CAnchorsSaplingCacheEntry
 {
     bool entered; // This will be false if the anchor is removed from the cache
     SaplingMerkleTree tree; // The tree itself
+    uint256 hashParent; // The anchor this tree was appended to, if known
     unsigned char flags;
 
     enum Flags {
@@ -317,22 +336,45 @@ enum ShieldedType
     SAPLING,
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
-typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, CCoinsKeyHasher> CAnchorsSproutMap;
-typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, CCoinsKeyHasher> CAnchorsSaplingMap;
-typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
+// The cache maps draw their nodes from a pool per map, which is released in
+// one go when the map is replaced after a flush.
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             CPoolAllocator<std::pair<const uint256, CCoinsCacheEntry> > > CCoinsMap;
+typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             CPoolAllocator<std::pair<const uint256, CAnchorsSproutCacheEntry> > > CAnchorsSproutMap;
+typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             CPoolAllocator<std::pair<const uint256, CAnchorsSaplingCacheEntry> > > CAnchorsSaplingMap;
+typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             CPoolAllocator<std::pair<const uint256, CNullifiersCacheEntry> > > CNullifiersMap;
+
+/** What the statistics of the coins commit to */
+enum CoinStatsHashType
+{
+    //! hashSerialized: the serialized outputs in key order, read on one thread
+    COINSTATS_HASH_SERIALIZED,
+    //! hashCommitment: the sum of the hashes of the outputs, read on several threads
+    COINSTATS_HASH_COMMITMENT,
+    //! Only the counts and amount, read on several threads
+    COINSTATS_HASH_NONE,
+};
 
 struct CCoinsStats
 {
+    //! Set by the caller
+    CoinStatsHashType hashType;
+
     int nHeight;
     uint256 hashBlock;
     uint64_t nTransactions;
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
     uint256 hashSerialized;
+    //! Sum modulo 2^256 of the hash of every unspent output with its txid
+    //! and index, which does not depend on the order the outputs are read in
+    uint256 hashCommitment;
     CAmount nTotalAmount;
 
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+    CCoinsStats() : hashType(COINSTATS_HASH_SERIALIZED), nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
 
@@ -411,6 +453,15 @@ public:
 
 class CCoinsViewCache;
 
+/** Coins lookups of a cache that were served from it or had to go to its base; readable from any thread */
+struct CCoinsCacheCounters
+{
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    CCoinsCacheCounters() : nHits(0), nMisses(0) {}
+};
+
 /** 
  * A reference to a mutable cache entry. Encapsulating it allows us to run
  *  cleanup code after the modification is finished, and keeping track of
@@ -422,6 +473,12 @@ private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
     size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    // State of the CCoins object before modification, used to mark the
+    // outputs that changed (not kept for FRESH entries)
+    std::vector<CAmount> vValueOld;
+    int nHeightOld;
+    int nVersionOld;
+    bool fCoinBaseOld;
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
@@ -455,6 +512,9 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Where lookups are counted, if anywhere */
+    CCoinsCacheCounters* pCounters;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -522,6 +582,20 @@ public:
      */
     bool Flush();
 
+    /**
+     * Read the coins of the given transactions and the given nullifiers that
+     * are not cached yet from the base view, in parallel, and add them to
+     * the cache. fRun runs the reads, for instance on the script check
+     * threads, and returns once all are done. The base view must allow
+     * concurrent reads, and this cache must not be used meanwhile.
+     */
+    void Prefetch(const std::vector<uint256>& vTxid,
+                  const std::vector<std::pair<uint256, ShieldedType> >& vNullifiers,
+                  const std::function<void(std::vector<std::function<bool()> >&)>& fRun);
+
+    //! Count the coins lookups in the given counters from now on
+    void SetCounters(CCoinsCacheCounters* pCountersIn) { pCounters = pCountersIn; }
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
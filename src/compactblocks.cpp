@@ -0,0 +1,261 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "compactblocks.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "util.h"
+#include "zcash/Zcash.h"
+
+#include <boost/filesystem.hpp>
+
+CCompactBlockStore* pcompactblocks = NULL;
+
+static_assert(COMPACT_NOTE_SIZE == ZC_SAPLING_COMPACT_PLAINTEXT_SIZE, "compact outputs must hold the whole note");
+
+CCompactTx::CCompactTx(const CTransaction& tx, uint64_t nIndex) : nIndex(nIndex), hash(tx.GetHash())
+{
+    vNullifiers.reserve(tx.vShieldedSpend.size());
+    for (const SpendDescription& spend : tx.vShieldedSpend) {
+        vNullifiers.push_back(spend.nullifier);
+    }
+    vOutputs.resize(tx.vShieldedOutput.size());
+    for (size_t i = 0; i < tx.vShieldedOutput.size(); i++) {
+        const OutputDescription& output = tx.vShieldedOutput[i];
+        vOutputs[i].cmu = output.cm;
+        vOutputs[i].epk = output.ephemeralKey;
+        std::copy(output.encCiphertext.begin(), output.encCiphertext.begin() + COMPACT_NOTE_SIZE,
+                  vOutputs[i].ciphertext.begin());
+    }
+}
+
+CCompactBlock::CCompactBlock(const CBlock& block, int nHeight) :
+    nHeight(nHeight),
+    hash(block.GetHash()),
+    hashPrevBlock(block.hashPrevBlock),
+    hashFinalSaplingRoot(block.hashFinalSaplingRoot),
+    nTime(block.nTime)
+{
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            vtx.push_back(CCompactTx(tx, i));
+        }
+    }
+}
+
+CCompactBlockStore::CCompactBlockStore(const boost::filesystem::path& pathDirIn, bool fWipe) :
+    pathDir(pathDirIn), fileBlocks(NULL), fileOffsets(NULL)
+{
+    TryCreateDirectory(pathDir);
+    if (fWipe) {
+        LogPrintf("Wiping compact block store in %s\n", pathDir.string());
+        boost::filesystem::remove(pathDir / "blocks.dat");
+        boost::filesystem::remove(pathDir / "offsets.dat");
+    }
+    if (!Reopen()) {
+        LogPrintf("%s: unable to open compact block store in %s\n", __func__, pathDir.string());
+    }
+}
+
+CCompactBlockStore::~CCompactBlockStore()
+{
+    if (fileBlocks)
+        fclose(fileBlocks);
+    if (fileOffsets)
+        fclose(fileOffsets);
+}
+
+static FILE* OpenStoreFile(const boost::filesystem::path& path)
+{
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    if (!file)
+        file = fopen(path.string().c_str(), "wb+");
+    return file;
+}
+
+bool CCompactBlockStore::Reopen()
+{
+    if (fileBlocks)
+        fclose(fileBlocks);
+    if (fileOffsets)
+        fclose(fileOffsets);
+    vOffsets.clear();
+
+    fileBlocks = OpenStoreFile(pathDir / "blocks.dat");
+    fileOffsets = OpenStoreFile(pathDir / "offsets.dat");
+    if (!fileBlocks || !fileOffsets)
+        return false;
+
+    uint64_t nBlocksSize = boost::filesystem::file_size(pathDir / "blocks.dat");
+    uint64_t nOffsetsSize = boost::filesystem::file_size(pathDir / "offsets.dat");
+
+    // Load the end offset of every record, stopping at the first one that
+    // was not completely written
+    unsigned char buf[8];
+    uint64_t nPrev = 0;
+    for (uint64_t i = 0; i < nOffsetsSize / 8; i++) {
+        if (fread(buf, 1, 8, fileOffsets) != 8)
+            break;
+        uint64_t nEnd = ReadLE64(buf);
+        if (nEnd < nPrev || nEnd > nBlocksSize)
+            break;
+        vOffsets.push_back(nEnd);
+        nPrev = nEnd;
+    }
+
+    // Drop anything past the last complete record, e.g. after a crash
+    // between writing a record and its offset
+    uint64_t nEnd = vOffsets.empty() ? 0 : vOffsets.back();
+    if (nBlocksSize != nEnd || nOffsetsSize != vOffsets.size() * 8) {
+        fclose(fileBlocks);
+        fclose(fileOffsets);
+        boost::filesystem::resize_file(pathDir / "blocks.dat", nEnd);
+        boost::filesystem::resize_file(pathDir / "offsets.dat", vOffsets.size() * 8);
+        fileBlocks = OpenStoreFile(pathDir / "blocks.dat");
+        fileOffsets = OpenStoreFile(pathDir / "offsets.dat");
+        if (!fileBlocks || !fileOffsets)
+            return false;
+    }
+    return true;
+}
+
+bool CCompactBlockStore::IsOpen() const
+{
+    LOCK(cs);
+    return fileBlocks && fileOffsets;
+}
+
+int CCompactBlockStore::Height() const
+{
+    LOCK(cs);
+    return (int)vOffsets.size() - 1;
+}
+
+bool CCompactBlockStore::Append(const CCompactBlock& block)
+{
+    LOCK(cs);
+    if (!fileBlocks || !fileOffsets)
+        return false;
+    if (block.nHeight != (int)vOffsets.size())
+        return error("%s: block at height %d does not follow %d", __func__, block.nHeight, (int)vOffsets.size() - 1);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+
+    // Write the record before its offset, so that a partial append is
+    // discarded on the next open
+    uint64_t nStart = vOffsets.empty() ? 0 : vOffsets.back();
+    uint64_t nEnd = nStart + ss.size();
+    unsigned char buf[8];
+    WriteLE64(buf, nEnd);
+    if (fseek(fileBlocks, 0, SEEK_END) != 0 || fwrite(&ss[0], 1, ss.size(), fileBlocks) != ss.size() || fflush(fileBlocks) != 0)
+        return error("%s: failed to write compact block %d", __func__, block.nHeight);
+    if (fseek(fileOffsets, 0, SEEK_END) != 0 || fwrite(buf, 1, 8, fileOffsets) != 8 || fflush(fileOffsets) != 0)
+        return error("%s: failed to write compact block offset %d", __func__, block.nHeight);
+
+    vOffsets.push_back(nEnd);
+    return true;
+}
+
+bool CCompactBlockStore::Truncate(int nHeight)
+{
+    LOCK(cs);
+    if (nHeight + 1 >= (int)vOffsets.size())
+        return true;
+
+    vOffsets.resize(std::max(nHeight + 1, 0));
+    uint64_t nEnd = vOffsets.empty() ? 0 : vOffsets.back();
+
+    fclose(fileBlocks);
+    fclose(fileOffsets);
+    fileBlocks = fileOffsets = NULL;
+    try {
+        boost::filesystem::resize_file(pathDir / "offsets.dat", vOffsets.size() * 8);
+        boost::filesystem::resize_file(pathDir / "blocks.dat", nEnd);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    return Reopen() && (int)vOffsets.size() == nHeight + 1;
+}
+
+bool CCompactBlockStore::ReadRaw(int nHeight, std::vector<unsigned char>& data) const
+{
+    LOCK(cs);
+    if (!fileBlocks || nHeight < 0 || nHeight >= (int)vOffsets.size())
+        return false;
+
+    uint64_t nStart = nHeight == 0 ? 0 : vOffsets[nHeight - 1];
+    data.resize(vOffsets[nHeight] - nStart);
+    if (data.empty())
+        return true;
+    if (fseek(fileBlocks, nStart, SEEK_SET) != 0 || fread(&data[0], 1, data.size(), fileBlocks) != data.size())
+        return error("%s: failed to read compact block %d", __func__, nHeight);
+    return true;
+}
+
+bool CCompactBlockStore::Read(int nHeight, CCompactBlock& block) const
+{
+    std::vector<unsigned char> data;
+    if (!ReadRaw(nHeight, data))
+        return false;
+    try {
+        CDataStream ss(data, SER_DISK, CLIENT_VERSION);
+        ss >> block;
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool ReadCompactBlock(CCompactBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        CBlock full;
+        if (!ReadBlockFromDisk(full, pindex, consensusParams))
+            return false;
+        block = CCompactBlock(full, pindex->nHeight);
+        return true;
+    }
+    if (!pcompactblocks || !pcompactblocks->Read(pindex->nHeight, block))
+        return error("%s: block %s is pruned and not in the compact block store", __func__, pindex->GetBlockHash().ToString());
+    if (block.hash != pindex->GetBlockHash())
+        return error("%s: compact block at height %d does not match %s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    return true;
+}
+
+bool SyncCompactBlockStore(CCompactBlockStore& store, const CChain& chain, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    // Rewind past any records from blocks that are no longer in the chain
+    int nHeight = std::min(store.Height(), chain.Height());
+    while (nHeight >= 0) {
+        CCompactBlock block;
+        if (store.Read(nHeight, block) && block.hash == chain[nHeight]->GetBlockHash())
+            break;
+        nHeight--;
+    }
+    if (!store.Truncate(nHeight))
+        return error("%s: failed to truncate compact block store to height %d", __func__, nHeight);
+
+    if (nHeight < chain.Height())
+        LogPrintf("Building compact blocks from height %d to %d\n", nHeight + 1, chain.Height());
+
+    for (nHeight++; nHeight <= chain.Height(); nHeight++) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, chain[nHeight], consensusParams))
+            return error("%s: failed to read block at height %d", __func__, nHeight);
+        if (!store.Append(CCompactBlock(block, nHeight)))
+            return false;
+        if (nHeight % 10000 == 0)
+            LogPrintf("Built compact blocks up to height %d\n", nHeight);
+    }
+    return true;
+}
@@ -0,0 +1,167 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COMPACTBLOCKS_H
+#define BITCOIN_COMPACTBLOCKS_H
+
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <array>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+class CBlock;
+class CBlockIndex;
+class CChain;
+class CTransaction;
+
+namespace Consensus { struct Params; };
+
+/** Default for -compactblockindex */
+static const bool DEFAULT_COMPACTBLOCKINDEX = false;
+
+/**
+ * Number of leading bytes of a Sapling note ciphertext kept in a compact
+ * output: the lead byte, diversifier, value and rcm (see ZIP 307).
+ */
+static const size_t COMPACT_NOTE_SIZE = 52;
+
+/** The parts of a Sapling output needed to detect and witness a note. */
+class CCompactSaplingOutput
+{
+public:
+    uint256 cmu;
+    uint256 epk;
+    std::array<unsigned char, COMPACT_NOTE_SIZE> ciphertext;
+
+    CCompactSaplingOutput() : ciphertext() {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(epk);
+        READWRITE(ciphertext);
+    }
+};
+
+/** The Sapling nullifiers and outputs of a single transaction. */
+class CCompactTx
+{
+public:
+    uint64_t nIndex;
+    uint256 hash;
+    std::vector<uint256> vNullifiers;
+    std::vector<CCompactSaplingOutput> vOutputs;
+
+    CCompactTx() : nIndex(0) {}
+    CCompactTx(const CTransaction& tx, uint64_t nIndex);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nIndex));
+        READWRITE(hash);
+        READWRITE(vNullifiers);
+        READWRITE(vOutputs);
+    }
+};
+
+/**
+ * A block reduced to what a shielded wallet needs in order to scan it. Only
+ * transactions with Sapling spends or outputs are kept.
+ */
+class CCompactBlock
+{
+public:
+    int nHeight;
+    uint256 hash;
+    uint256 hashPrevBlock;
+    uint256 hashFinalSaplingRoot;
+    uint32_t nTime;
+    std::vector<CCompactTx> vtx;
+
+    CCompactBlock() : nHeight(-1), nTime(0) {}
+    CCompactBlock(const CBlock& block, int nHeight);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(hash);
+        READWRITE(hashPrevBlock);
+        READWRITE(hashFinalSaplingRoot);
+        READWRITE(nTime);
+        READWRITE(vtx);
+    }
+};
+
+/**
+ * Append-only flat file of serialized compact blocks for the active chain
+ * (compactblocks/). blocks.dat holds the records back to back and
+ * offsets.dat holds the 8-byte offset of each record, indexed by height, so
+ * a record can be returned without touching the block files or
+ * deserializing anything. Reorgs truncate both files.
+ */
+class CCompactBlockStore
+{
+private:
+    mutable CCriticalSection cs;
+    boost::filesystem::path pathDir;
+    FILE* fileBlocks;
+    FILE* fileOffsets;
+    //! Offset of the record for each height, plus the end of the last record
+    std::vector<uint64_t> vOffsets;
+
+    CCompactBlockStore(const CCompactBlockStore&);
+    void operator=(const CCompactBlockStore&);
+
+    bool Reopen();
+
+public:
+    CCompactBlockStore(const boost::filesystem::path& pathDir, bool fWipe = false);
+    ~CCompactBlockStore();
+
+    bool IsOpen() const;
+
+    //! Height of the last stored block, or -1 if the store is empty
+    int Height() const;
+
+    //! Append the compact form of the block at the next height
+    bool Append(const CCompactBlock& block);
+
+    //! Drop every record above nHeight
+    bool Truncate(int nHeight);
+
+    //! Read the serialized record for nHeight
+    bool ReadRaw(int nHeight, std::vector<unsigned char>& data) const;
+
+    bool Read(int nHeight, CCompactBlock& block) const;
+};
+
+/** Global compact block store, NULL unless -compactblockindex is set */
+extern CCompactBlockStore* pcompactblocks;
+
+/**
+ * Read the compact form of a block of the active chain: built from the block
+ * itself while it is on disk, or read from the compact block store once it
+ * has been pruned.
+ */
+bool ReadCompactBlock(CCompactBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+
+/**
+ * Bring the compact block store in line with the given chain: drop records
+ * from blocks no longer in it, then append the missing ones. (cs_main must
+ * be held)
+ */
+bool SyncCompactBlockStore(CCompactBlockStore& store, const CChain& chain, const Consensus::Params& consensusParams);
+
+#endif // BITCOIN_COMPACTBLOCKS_H
@@ -43,7 +43,15 @@
 #include <ifaddrs.h>
 #include <limits.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
+
+// Wait on sockets with poll(), or epoll on Linux, instead of select(), so
+// that descriptors past FD_SETSIZE can be used
+#define USE_POLL
+#ifdef __linux__
+#define USE_EPOLL
+#endif
 #endif
 
 #ifdef WIN32
@@ -94,7 +102,7 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -144,6 +144,8 @@ struct Params {
     int64_t MaxActualTimespan(int nHeight) const;
 
     uint256 nMinimumChainWork;
+    /** Default for -assumevalid: proofs and signatures of its ancestors are not verified */
+    uint256 defaultAssumeValid;
 };
 } // namespace Consensus
 
@@ -18,6 +18,7 @@
 
 #include "compat/endian.h"
 #include "crypto/equihash.h"
+#include "support/allocators/hugepage.h"
 #include "util.h"
 #ifndef __linux__
 #include "compat/endian.h"
@@ -25,12 +26,90 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 
 #include <boost/optional.hpp>
 
 static EhSolverCancelledException solver_cancelled;
 
+/**
+ * Scratch space for SortRows, kept between the rounds of a solve so the
+ * buffers are only allocated once. Like the list sorted, they are as long
+ * as the list and go on huge pages when -hugepages allows.
+ */
+struct RowSortBuffers
+{
+    std::vector<uint64_t, CHugePageAllocator<uint64_t> > keys, keysTmp;
+    std::vector<uint32_t, CHugePageAllocator<uint32_t> > order, orderTmp;
+};
+
+/**
+ * Sort rows by their first len bytes, as std::sort with CompareSR(len)
+ * would. Keys of up to eight bytes are radix sorted, one counting pass per
+ * byte, and the rows are then moved into place along the cycles of the
+ * permutation, so no second copy of the rows is needed.
+ */
+template<typename Row, typename Alloc>
+static void SortRows(std::vector<Row, Alloc>& rows, size_t len, RowSortBuffers& buf)
+{
+    const size_t n = rows.size();
+    if (len > sizeof(uint64_t) || n > std::numeric_limits<uint32_t>::max()) {
+        std::sort(rows.begin(), rows.end(), CompareSR(len));
+        return;
+    }
+    if (n < 2)
+        return;
+
+    buf.keys.resize(n);
+    buf.keysTmp.resize(n);
+    buf.order.resize(n);
+    buf.orderTmp.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = 0;
+        for (size_t b = 0; b < len; b++)
+            key = (key << 8) | rows[i].GetHashByte(b);
+        buf.keys[i] = key;
+        buf.order[i] = i;
+    }
+
+    // Least significant byte first; each pass is stable
+    for (size_t pass = 0; pass < len; pass++) {
+        const unsigned int shift = 8 * pass;
+        size_t counts[257] = {0};
+        for (size_t i = 0; i < n; i++)
+            counts[((buf.keys[i] >> shift) & 0xff) + 1]++;
+        for (size_t d = 0; d < 256; d++)
+            counts[d + 1] += counts[d];
+        for (size_t i = 0; i < n; i++) {
+            size_t pos = counts[(buf.keys[i] >> shift) & 0xff]++;
+            buf.keysTmp[pos] = buf.keys[i];
+            buf.orderTmp[pos] = buf.order[i];
+        }
+        buf.keys.swap(buf.keysTmp);
+        buf.order.swap(buf.orderTmp);
+    }
+
+    // Position j takes the row at order[j]; a placed position is marked by
+    // pointing at itself
+    for (size_t i = 0; i < n; i++) {
+        if (buf.order[i] == i)
+            continue;
+        Row tmp(rows[i]);
+        size_t j = i;
+        while (true) {
+            size_t k = buf.order[j];
+            buf.order[j] = j;
+            if (k == i) {
+                rows[j] = tmp;
+                break;
+            }
+            rows[j] = rows[k];
+            j = k;
+        }
+    }
+}
+
 template<unsigned int N, unsigned int K>
 int Equihash<N,K>::InitialiseState(eh_HashState& base_state)
 {
@@ -518,8 +597,9 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         LogPrint("pow", "Generating first list\n");
         size_t hashLen = HashLength;
         size_t lenIndices = sizeof(eh_trunc);
-        std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
+        std::vector<TruncatedStepRow<TruncatedWidth>, CHugePageAllocator<TruncatedStepRow<TruncatedWidth>>> Xt;
         Xt.reserve(init_size);
+        RowSortBuffers sortBuffers;
         unsigned char tmpHash[HashOutput];
         for (eh_index g = 0; Xt.size() < init_size; g++) {
             GenerateHash(base_state, g, tmpHash, HashOutput);
@@ -535,7 +615,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             LogPrint("pow", "Round %d:\n", r);
             // 2a) Sort the list
             LogPrint("pow", "- Sorting list\n");
-            std::sort(Xt.begin(), Xt.end(), CompareSR(CollisionByteLength));
+            SortRows(Xt, CollisionByteLength, sortBuffers);
             if (cancelled(ListSorting)) throw solver_cancelled;
 
             LogPrint("pow", "- Finding collisions\n");
@@ -600,7 +680,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         LogPrint("pow", "Final round:\n");
         if (Xt.size() > 1) {
             LogPrint("pow", "- Sorting list\n");
-            std::sort(Xt.begin(), Xt.end(), CompareSR(hashLen));
+            SortRows(Xt, hashLen, sortBuffers);
             if (cancelled(FinalSorting)) throw solver_cancelled;
             LogPrint("pow", "- Finding collisions\n");
             int i = 0;
@@ -731,43 +811,58 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
+    std::vector<eh_index> indices = GetIndicesFromMinimal(soln, CollisionBitLength);
+
+    // Every merge needs its two subtrees to have no index in common, which
+    // holds exactly when all 2^K indices are distinct, so check that once.
+    std::vector<eh_index> sorted(indices);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        LogPrint("pow", "Invalid solution: duplicate indices\n");
+        return false;
     }
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
+    // Walk the tree depth-first: rows[l] holds the pending left subtree of
+    // height l, whose first l*CollisionByteLength bytes have already
+    // collided. Each new leaf is merged upwards for as long as it completes
+    // a subtree, so only K+1 rows are live and an invalid solution is
+    // rejected at the first bad pair, without hashing the remaining indices.
+    unsigned char rows[K+1][HashLength];
+    unsigned char row[HashLength];
+    unsigned char tmpHash[HashOutput];
+    for (size_t pos = 0; pos < indices.size(); pos++) {
+        eh_index i = indices[pos];
+        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
+        ExpandArray(tmpHash+((i % IndicesPerHashOutput) * N/8), N/8,
+                    row, HashLength, CollisionBitLength);
+
+        size_t level = 0;
+        for (size_t p = pos; p & 1; p >>= 1, level++) {
+            const unsigned char* left = rows[level];
+            size_t offset = level * CollisionByteLength;
+            if (memcmp(left + offset, row + offset, CollisionByteLength) != 0) {
                 LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
-                LogPrint("pow", "X[i]   = %s\n", X[i].GetHex(hashLen));
-                LogPrint("pow", "X[i+1] = %s\n", X[i+1].GetHex(hashLen));
+                LogPrint("pow", "X[i]   = %s\n", HexStr(left + offset, left + HashLength));
+                LogPrint("pow", "X[i+1] = %s\n", HexStr(row + offset, row + HashLength));
                 return false;
             }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
+            // The subtrees are distinct, so their first indices decide the order
+            size_t width = (size_t)1 << level;
+            if (indices[pos + 1 - width] < indices[pos + 1 - 2*width]) {
                 LogPrint("pow", "Invalid solution: Index tree incorrectly ordered\n");
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-                LogPrint("pow", "Invalid solution: duplicate indices\n");
-                return false;
-            }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
+            for (size_t j = offset + CollisionByteLength; j < HashLength; j++)
+                row[j] ^= left[j];
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
+        memcpy(rows[level], row, HashLength);
     }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+    for (size_t j = K * CollisionByteLength; j < HashLength; j++) {
+        if (rows[K][j] != 0)
+            return false;
+    }
+    return true;
 }
 
 // Explicit instantiations for Equihash<96,3>
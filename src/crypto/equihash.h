@@ -59,6 +59,7 @@ public:
 
     bool IsZero(size_t len);
     std::string GetHex(size_t len) { return HexStr(hash, hash+len); }
+    unsigned char GetHashByte(size_t i) const { return hash[i]; }
 
     template<size_t W>
     friend bool HasCollision(StepRow<W>& a, StepRow<W>& b, int l);
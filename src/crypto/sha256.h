@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -29,4 +30,18 @@ private:
     void FinalizeNoPadding(unsigned char hash[OUTPUT_SIZE], bool enforce_compression);
 };
 
+/**
+ * Pick the fastest SHA-256 implementation the CPU supports, falling back to
+ * the portable one, and return a description of the choice. Call it once at
+ * startup, before any other thread hashes.
+ */
+std::string SHA256AutoDetect();
+
+/**
+ * Compute the double SHA-256 of blocks 64-byte inputs at once, writing
+ * 32 bytes per input to out. Several inputs are hashed in parallel where
+ * the CPU allows it; merkle trees are the main user.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
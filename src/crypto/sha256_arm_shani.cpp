@@ -0,0 +1,64 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 compression with the ARMv8 cryptography extensions, one block at a time.
+// Built with -march=armv8-a+crypto; only called once SHA256AutoDetect() found the CPU support.
+
+#ifdef ENABLE_ARM_SHANI
+
+#include <stdint.h>
+#include <stddef.h>
+#include <arm_acle.h>
+#include <arm_neon.h>
+
+namespace {
+
+const uint32_t RoundK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+}
+
+namespace sha256_arm_shani {
+
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(s);
+    uint32x4_t state1 = vld1q_u32(s + 4);
+
+    while (blocks--) {
+        uint32x4_t save0 = state0, save1 = state1;
+        uint32x4_t m[4];
+        for (int i = 0; i < 4; i++)
+            m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(chunk + 16 * i)));
+
+        for (int g = 0; g < 16; g++) {
+            uint32x4_t msg = vaddq_u32(m[g & 3], vld1q_u32(RoundK + 4 * g));
+            uint32x4_t prev0 = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, prev0, msg);
+            if (g < 12) {
+                // Message words of group g + 4 replace those of group g
+                m[g & 3] = vsha256su1q_u32(vsha256su0q_u32(m[g & 3], m[(g + 1) & 3]), m[(g + 2) & 3], m[(g + 3) & 3]);
+            }
+        }
+
+        state0 = vaddq_u32(state0, save0);
+        state1 = vaddq_u32(state1, save1);
+        chunk += 64;
+    }
+
+    vst1q_u32(s, state0);
+    vst1q_u32(s + 4, state1);
+}
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoofilter.h"
+
+#include "prevector.h" // needed by memusage.h
+#include "memusage.h"
+#include "random.h"
+#include "utilstrencodings.h"
+
+#include <boost/foreach.hpp>
+
+CCuckooFilter::CCuckooFilter(size_t nCapacity) : salt(GetRandHash()), nBucketMask(0), nElements(0), nKick(0)
+{
+    Reset(nCapacity);
+}
+
+void CCuckooFilter::Reset(size_t nCapacity)
+{
+    LOCK(cs);
+    // Start at most half full, so that the filter can grow past nCapacity
+    // before it has to be rebuilt
+    size_t nBuckets = 1;
+    while (nBuckets * BUCKET_SIZE < nCapacity * 2 || nBuckets < 1024)
+        nBuckets <<= 1;
+    std::vector<uint16_t>(nBuckets * BUCKET_SIZE, 0).swap(vTable);
+    nBucketMask = nBuckets - 1;
+    nElements = 0;
+    vVictims.clear();
+}
+
+void CCuckooFilter::Swap(CCuckooFilter& other)
+{
+    LOCK2(cs, other.cs);
+    std::swap(salt, other.salt);
+    vTable.swap(other.vTable);
+    std::swap(nBucketMask, other.nBucketMask);
+    std::swap(nElements, other.nElements);
+    std::swap(nKick, other.nKick);
+    vVictims.swap(other.vVictims);
+}
+
+void CCuckooFilter::Hash(const uint256& hash, size_t& nBucket, uint16_t& nFingerprint) const
+{
+    uint64_t h = hash.GetHash(salt);
+    nBucket = h & nBucketMask;
+    // 0 marks an empty slot
+    nFingerprint = (h >> 48) ? (h >> 48) : 1;
+}
+
+size_t CCuckooFilter::AltBucket(size_t nBucket, uint16_t nFingerprint) const
+{
+    return (nBucket ^ ((size_t)nFingerprint * 0x5bd1e995)) & nBucketMask;
+}
+
+bool CCuckooFilter::InsertInto(size_t nBucket, uint16_t nFingerprint)
+{
+    uint16_t* pbucket = &vTable[nBucket * BUCKET_SIZE];
+    for (unsigned int i = 0; i < BUCKET_SIZE; i++) {
+        if (pbucket[i] == 0) {
+            pbucket[i] = nFingerprint;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CCuckooFilter::RemoveFrom(size_t nBucket, uint16_t nFingerprint)
+{
+    uint16_t* pbucket = &vTable[nBucket * BUCKET_SIZE];
+    for (unsigned int i = 0; i < BUCKET_SIZE; i++) {
+        if (pbucket[i] == nFingerprint) {
+            pbucket[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CCuckooFilter::Insert(const uint256& hash)
+{
+    LOCK(cs);
+    size_t nBucket;
+    uint16_t nFingerprint;
+    Hash(hash, nBucket, nFingerprint);
+    nElements++;
+    if (InsertInto(nBucket, nFingerprint) || InsertInto(AltBucket(nBucket, nFingerprint), nFingerprint))
+        return;
+
+    // Move fingerprints to their other bucket until one finds a free slot
+    size_t nBucketKick = (nKick & 1) ? nBucket : AltBucket(nBucket, nFingerprint);
+    uint16_t nFingerprintKick = nFingerprint;
+    for (unsigned int n = 0; n < MAX_KICKS; n++) {
+        uint16_t& slot = vTable[nBucketKick * BUCKET_SIZE + (nKick++ % BUCKET_SIZE)];
+        std::swap(slot, nFingerprintKick);
+        nBucketKick = AltBucket(nBucketKick, nFingerprintKick);
+        if (InsertInto(nBucketKick, nFingerprintKick))
+            return;
+    }
+
+    // The fingerprint left over may belong to any element, so keep it aside
+    vVictims.push_back(std::make_pair(nBucketKick, nFingerprintKick));
+}
+
+void CCuckooFilter::Remove(const uint256& hash)
+{
+    LOCK(cs);
+    size_t nBucket;
+    uint16_t nFingerprint;
+    Hash(hash, nBucket, nFingerprint);
+    size_t nAltBucket = AltBucket(nBucket, nFingerprint);
+    if (RemoveFrom(nBucket, nFingerprint) || RemoveFrom(nAltBucket, nFingerprint)) {
+        nElements--;
+        return;
+    }
+    for (std::vector<std::pair<size_t, uint16_t> >::iterator it = vVictims.begin(); it != vVictims.end(); it++) {
+        if (it->second == nFingerprint && (it->first == nBucket || it->first == nAltBucket)) {
+            vVictims.erase(it);
+            nElements--;
+            return;
+        }
+    }
+}
+
+bool CCuckooFilter::Contains(const uint256& hash) const
+{
+    LOCK(cs);
+    size_t nBucket;
+    uint16_t nFingerprint;
+    Hash(hash, nBucket, nFingerprint);
+    size_t nAltBucket = AltBucket(nBucket, nFingerprint);
+    const uint16_t* pbucket1 = &vTable[nBucket * BUCKET_SIZE];
+    const uint16_t* pbucket2 = &vTable[nAltBucket * BUCKET_SIZE];
+    for (unsigned int i = 0; i < BUCKET_SIZE; i++) {
+        if (pbucket1[i] == nFingerprint || pbucket2[i] == nFingerprint)
+            return true;
+    }
+    BOOST_FOREACH(const PAIRTYPE(size_t, uint16_t)& victim, vVictims) {
+        if (victim.second == nFingerprint && (victim.first == nBucket || victim.first == nAltBucket))
+            return true;
+    }
+    return false;
+}
+
+size_t CCuckooFilter::Size() const
+{
+    LOCK(cs);
+    return nElements;
+}
+
+bool CCuckooFilter::NeedsResize() const
+{
+    LOCK(cs);
+    return nElements * 10 > vTable.size() * 9 || !vVictims.empty();
+}
+
+size_t CCuckooFilter::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return memusage::DynamicUsage(vTable) + memusage::DynamicUsage(vVictims);
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOFILTER_H
+#define BITCOIN_CUCKOOFILTER_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <utility>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Cuckoo filter over 256-bit hashes with 16-bit fingerprints, 4 per bucket
+ * (false positive rate around 0.01%). Unlike a bloom filter, elements can be
+ * removed again, which is needed to follow a set such as the nullifiers
+ * through reorgs.
+ *
+ * Contains() never returns false for an element that was inserted and not
+ * removed. Remove() must therefore only be called for elements that are
+ * known to have been inserted, otherwise it may drop the fingerprint of
+ * another element. Fingerprints that cannot be placed are kept in a
+ * small overflow list, and NeedsResize() tells the owner to rebuild a
+ * larger filter.
+ */
+class CCuckooFilter
+{
+private:
+    static const unsigned int BUCKET_SIZE = 4;
+    static const unsigned int MAX_KICKS = 500;
+
+    mutable CCriticalSection cs;
+    uint256 salt;
+    std::vector<uint16_t> vTable;
+    size_t nBucketMask;
+    size_t nElements;
+    uint32_t nKick;
+    //! Fingerprints that could not be placed, with one of their buckets
+    std::vector<std::pair<size_t, uint16_t> > vVictims;
+
+    void Hash(const uint256& hash, size_t& nBucket, uint16_t& nFingerprint) const;
+    size_t AltBucket(size_t nBucket, uint16_t nFingerprint) const;
+    bool InsertInto(size_t nBucket, uint16_t nFingerprint);
+    bool RemoveFrom(size_t nBucket, uint16_t nFingerprint);
+
+public:
+    //! An empty filter with room for about nCapacity elements
+    CCuckooFilter(size_t nCapacity = 0);
+
+    //! Empty the filter and size it for about nCapacity elements
+    void Reset(size_t nCapacity);
+    //! Exchange the contents with another filter
+    void Swap(CCuckooFilter& other);
+
+    void Insert(const uint256& hash);
+    void Remove(const uint256& hash);
+    bool Contains(const uint256& hash) const;
+
+    size_t Size() const;
+
+    //! True once the filter is too full to keep a low false positive rate
+    bool NeedsResize() const;
+
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_CUCKOOFILTER_H
@@ -5,8 +5,10 @@
 #include "dbwrapper.h"
 
 #include "util.h"
+#include "utilstrencodings.h"
 
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -14,14 +16,57 @@
 #include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+CDBOptions CDBOptions::FromArgs(const std::string& strName, size_t nCacheSize)
+{
+    CDBOptions opts;
+    opts.nBlockCacheSize = nCacheSize / 2;
+    opts.nWriteBufferSize = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    opts.nMaxOpenFiles = 64;
+    opts.nBloomBits = 10;
+    opts.fCompression = false;
+
+    BOOST_FOREACH(const std::string& strTune, mapMultiArgs["-dbtune"]) {
+        size_t nDot = strTune.find('.');
+        size_t nEquals = strTune.find('=');
+        if (nDot == std::string::npos || nEquals == std::string::npos || nEquals < nDot) {
+            LogPrintf("Ignoring invalid -dbtune=%s\n", strTune);
+            continue;
+        }
+        if (strTune.substr(0, nDot) != strName)
+            continue;
+        std::string strOption = strTune.substr(nDot + 1, nEquals - nDot - 1);
+        int64_t nValue = std::max(atoi64(strTune.substr(nEquals + 1)), (int64_t)0);
+        if (strOption == "blockcache")
+            opts.nBlockCacheSize = nValue << 20;
+        else if (strOption == "writebuffer")
+            opts.nWriteBufferSize = std::max(nValue << 20, (int64_t)1 << 20);
+        else if (strOption == "maxopenfiles")
+            opts.nMaxOpenFiles = std::max(std::min(nValue, (int64_t)65536), (int64_t)16);
+        else if (strOption == "bloombits")
+            opts.nBloomBits = std::min(nValue, (int64_t)32);
+        else if (strOption == "compression")
+            opts.fCompression = nValue != 0;
+        else
+            LogPrintf("Ignoring unknown -dbtune option %s\n", strTune);
+    }
+    return opts;
+}
+
+std::string CDBOptions::ToString() const
+{
+    return strprintf("block cache %.1fMiB, write buffer %.1fMiB, max open files %d, bloom filter %d bits, %s",
+                     nBlockCacheSize * (1.0 / 1024 / 1024), nWriteBufferSize * (1.0 / 1024 / 1024), nMaxOpenFiles,
+                     nBloomBits, fCompression ? "snappy compression" : "no compression");
+}
+
+static leveldb::Options GetOptions(const CDBOptions& opts)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = leveldb::NewLRUCache(opts.nBlockCacheSize);
+    options.write_buffer_size = opts.nWriteBufferSize;
+    options.filter_policy = opts.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(opts.nBloomBits) : NULL;
+    options.compression = opts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = opts.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -30,14 +75,16 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const std::string& strNameIn)
 {
     penv = NULL;
+    strName = strNameIn.empty() ? path.filename().string() : strNameIn;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    CDBOptions opts = CDBOptions::FromArgs(strName, nCacheSize);
+    options = GetOptions(opts);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -49,11 +96,44 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
             dbwrapper_private::HandleError(result);
         }
         TryCreateDirectory(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("Opening LevelDB in %s (%s: %s)\n", path.string(), strName, opts.ToString());
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    LogStats(path, fMemory);
+}
+
+void CDBWrapper::LogStats(const boost::filesystem::path& path, bool fMemory) const
+{
+    if (fMemory)
+        return;
+
+    std::string strLevels;
+    for (int nLevel = 0; nLevel < 7; nLevel++) {
+        std::string strFiles;
+        if (!pdb->GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), &strFiles))
+            break;
+        strLevels += strprintf("%s%s", nLevel ? "/" : "", strFiles);
+    }
+
+    uint64_t nFiles = 0, nSize = 0;
+    try {
+        for (boost::filesystem::directory_iterator it(path); it != boost::filesystem::directory_iterator(); it++) {
+            if (boost::filesystem::is_regular_file(it->status())) {
+                nFiles++;
+                nSize += boost::filesystem::file_size(it->path());
+            }
+        }
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    LogPrintf("LevelDB %s: %.1fMiB in %u files, tables per level %s\n", strName, nSize * (1.0 / 1024 / 1024),
+              (unsigned int)nFiles, strLevels);
+
+    std::string strStats;
+    if (pdb->GetProperty("leveldb.stats", &strStats))
+        LogPrint("leveldb", "LevelDB %s stats:\n%s", strName, strStats);
 }
 
 CDBWrapper::~CDBWrapper()
@@ -82,6 +162,15 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+CDBSnapshot::CDBSnapshot(const CDBWrapper& parentIn) : parent(parentIn), psnapshot(parentIn.pdb->GetSnapshot())
+{
+}
+
+CDBSnapshot::~CDBSnapshot()
+{
+    parent.pdb->ReleaseSnapshot(psnapshot);
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
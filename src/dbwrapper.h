@@ -27,6 +27,26 @@ public:
 
 class CDBWrapper;
 
+/** LevelDB tuning of a single database */
+struct CDBOptions
+{
+    size_t nBlockCacheSize;
+    size_t nWriteBufferSize;
+    int nMaxOpenFiles;
+    //! Bits per key of the bloom filter, 0 for none
+    int nBloomBits;
+    //! Snappy compression of the table blocks
+    bool fCompression;
+
+    /**
+     * The default profile for a database with nCacheSize bytes of cache,
+     * with any -dbtune=<strName>.<option>=<value> settings applied.
+     */
+    static CDBOptions FromArgs(const std::string& strName, size_t nCacheSize);
+
+    std::string ToString() const;
+};
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -78,6 +98,11 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
 class CDBIterator
@@ -142,8 +167,31 @@ public:
 
 };
 
+/**
+ * The state of a database at the time the snapshot was made, which reads
+ * and iterators given the snapshot see whatever is written afterwards.
+ * The database must outlive it.
+ */
+class CDBSnapshot
+{
+    friend class CDBWrapper;
+
+private:
+    const CDBWrapper& parent;
+    const leveldb::Snapshot* psnapshot;
+
+    CDBSnapshot(const CDBSnapshot&);
+    CDBSnapshot& operator=(const CDBSnapshot&);
+
+public:
+    explicit CDBSnapshot(const CDBWrapper& parentIn);
+    ~CDBSnapshot();
+};
+
 class CDBWrapper
 {
+    friend class CDBSnapshot;
+
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -166,18 +214,13 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
-public:
-    /**
-     * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
-     * @param[in] fWipe       If true, remove all existing data.
-     */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
-    ~CDBWrapper();
+    //! name of the -dbtune profile of this database
+    std::string strName;
+
+    void LogStats(const boost::filesystem::path& path, bool fMemory) const;
 
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool ReadWithOptions(const K& key, V& value, const leveldb::ReadOptions& options) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
@@ -185,7 +228,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -201,6 +244,32 @@ public:
         return true;
     }
 
+public:
+    /**
+     * @param[in] path        Location in the filesystem where leveldb data will be stored.
+     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] fMemory     If true, use leveldb's memory environment.
+     * @param[in] fWipe       If true, remove all existing data.
+     * @param[in] strName     Name for -dbtune, the directory name if empty.
+     */
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& strName = "");
+    ~CDBWrapper();
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return ReadWithOptions(key, value, readoptions);
+    }
+
+    /** Read the value key had when snapshot was made */
+    template <typename K, typename V>
+    bool Read(const K& key, V& value, const CDBSnapshot& snapshot) const
+    {
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = snapshot.psnapshot;
+        return ReadWithOptions(key, value, options);
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -255,6 +324,14 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /** An iterator over the database as it was when snapshot was made */
+    CDBIterator *NewIterator(const CDBSnapshot& snapshot) const
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot.psnapshot;
+        return new CDBIterator(*this, pdb->NewIterator(options));
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
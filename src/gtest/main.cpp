@@ -1,7 +1,10 @@
 #include "gmock/gmock.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "key.h"
+#include "proofcache.h"
 #include "pubkey.h"
+#include "script/sigcache.h"
 #include "zcash/JoinSplit.hpp"
 #include "util.h"
 
@@ -18,7 +21,10 @@ ZCJoinSplit* params;
 
 int main(int argc, char **argv) {
   assert(init_and_check_sodium() != -1);
+  SHA256AutoDetect();
   ECC_Start();
+  InitSignatureCache();
+  InitProofCache();
 
   params = ZCJoinSplit::Prepared();
 
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include "compactblocks.h"
+#include "primitives/block.h"
+#include "random.h"
+
+#include <boost/filesystem.hpp>
+
+static CBlock MakeBlock(const uint256& hashPrevBlock, size_t nOutputs)
+{
+    CBlock block;
+    block.hashPrevBlock = hashPrevBlock;
+    block.hashFinalSaplingRoot = GetRandHash();
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.vShieldedOutput.resize(nOutputs);
+    for (OutputDescription& output : mtx.vShieldedOutput) {
+        output.cm = GetRandHash();
+        output.ephemeralKey = GetRandHash();
+        GetRandBytes(output.encCiphertext.data(), output.encCiphertext.size());
+    }
+    SpendDescription spend;
+    spend.nullifier = GetRandHash();
+    mtx.vShieldedSpend.push_back(spend);
+    block.vtx.push_back(mtx);
+    return block;
+}
+
+TEST(CompactBlocks, FromBlock) {
+    CBlock block = MakeBlock(GetRandHash(), 2);
+    CCompactBlock compact(block, 7);
+
+    EXPECT_EQ(7, compact.nHeight);
+    EXPECT_EQ(block.GetHash(), compact.hash);
+    EXPECT_EQ(block.hashFinalSaplingRoot, compact.hashFinalSaplingRoot);
+
+    // The coinbase has no Sapling data and is left out
+    ASSERT_EQ(1, compact.vtx.size());
+    const CCompactTx& ctx = compact.vtx[0];
+    const CTransaction& tx = block.vtx[1];
+    EXPECT_EQ(1, ctx.nIndex);
+    EXPECT_EQ(tx.GetHash(), ctx.hash);
+    ASSERT_EQ(1, ctx.vNullifiers.size());
+    EXPECT_EQ(tx.vShieldedSpend[0].nullifier, ctx.vNullifiers[0]);
+    ASSERT_EQ(2, ctx.vOutputs.size());
+    for (size_t i = 0; i < 2; i++) {
+        EXPECT_EQ(tx.vShieldedOutput[i].cm, ctx.vOutputs[i].cmu);
+        EXPECT_EQ(tx.vShieldedOutput[i].ephemeralKey, ctx.vOutputs[i].epk);
+        EXPECT_TRUE(std::equal(ctx.vOutputs[i].ciphertext.begin(), ctx.vOutputs[i].ciphertext.end(),
+                               tx.vShieldedOutput[i].encCiphertext.begin()));
+    }
+}
+
+TEST(CompactBlocks, AppendTruncateReopen) {
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+
+    std::vector<CCompactBlock> blocks;
+    uint256 hashPrev;
+    for (int i = 0; i < 5; i++) {
+        CBlock block = MakeBlock(hashPrev, i);
+        blocks.push_back(CCompactBlock(block, i));
+        hashPrev = block.GetHash();
+    }
+
+    {
+        CCompactBlockStore store(pathTemp);
+        ASSERT_TRUE(store.IsOpen());
+        EXPECT_EQ(-1, store.Height());
+
+        // Heights must be contiguous
+        EXPECT_FALSE(store.Append(blocks[1]));
+        for (const CCompactBlock& block : blocks) {
+            EXPECT_TRUE(store.Append(block));
+        }
+        EXPECT_EQ(4, store.Height());
+
+        CCompactBlock read;
+        ASSERT_TRUE(store.Read(3, read));
+        EXPECT_EQ(blocks[3].hash, read.hash);
+        EXPECT_EQ(3, read.vtx[0].vOutputs.size());
+        EXPECT_FALSE(store.Read(5, read));
+
+        EXPECT_TRUE(store.Truncate(2));
+        EXPECT_EQ(2, store.Height());
+        EXPECT_FALSE(store.Read(3, read));
+    }
+
+    // The store survives a restart, and appending resumes after the last record
+    {
+        CCompactBlockStore store(pathTemp);
+        EXPECT_EQ(2, store.Height());
+        EXPECT_TRUE(store.Append(blocks[3]));
+
+        CCompactBlock read;
+        ASSERT_TRUE(store.Read(3, read));
+        EXPECT_EQ(blocks[3].hash, read.hash);
+        ASSERT_TRUE(store.Read(2, read));
+        EXPECT_EQ(blocks[2].hash, read.hash);
+    }
+
+    // Wiping discards everything
+    {
+        CCompactBlockStore store(pathTemp, true);
+        EXPECT_EQ(-1, store.Height());
+    }
+
+    boost::filesystem::remove_all(pathTemp);
+}
@@ -4,6 +4,7 @@
 
 #include "keystore.h"
 #include "random.h"
+#include "taskpool.h"
 #ifdef ENABLE_WALLET
 #include "wallet/crypter.h"
 #endif
@@ -369,4 +370,40 @@ TEST(keystore_tests, store_and_retrieve_spending_key_in_encrypted_store) {
     ASSERT_EQ(1, addrs.count(addr));
     ASSERT_EQ(1, addrs.count(addr2));
 }
+
+TEST(keystore_tests, UnlockChecksKeysInParallel) {
+    TestCCryptoKeyStore keyStore;
+    uint256 r {GetRandHash()};
+    CKeyingMaterial vMasterKey (r.begin(), r.end());
+
+    // Enough keys for several batches of checks
+    std::vector<CKey> vKeys;
+    for (size_t i = 0; i < 3 * UNLOCK_CHECK_BATCH_SIZE; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        ASSERT_TRUE(keyStore.AddKeyPubKey(key, key.GetPubKey()));
+        vKeys.push_back(key);
+    }
+    ASSERT_TRUE(keyStore.AddSproutSpendingKey(libzcash::SproutSpendingKey::random()));
+    ASSERT_TRUE(keyStore.EncryptKeys(vMasterKey));
+
+    GetTaskPool().Start(4);
+
+    CKeyingMaterial vModifiedKey (r.begin(), r.end());
+    vModifiedKey[0] += 1;
+    EXPECT_FALSE(keyStore.Unlock(vModifiedKey));
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+
+    // Later unlocks check a sample; every key still decrypts on use
+    ASSERT_TRUE(keyStore.Lock());
+    EXPECT_FALSE(keyStore.Unlock(vModifiedKey));
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+    for (const CKey& key : vKeys) {
+        CKey keyOut;
+        ASSERT_TRUE(keyStore.GetKey(key.GetPubKey().GetID(), keyOut));
+        EXPECT_TRUE(key == keyOut);
+    }
+
+    GetTaskPool().Stop();
+}
 #endif
@@ -110,6 +110,55 @@ TEST(MempoolLimitTests, WeightedTxTreeCheckSizeAfterDropping)
     std::cerr << "All 3 scenarios tested in " << trialNum << " trials" << std::endl;
 }
 
+TEST(MempoolLimitTests, RecentlyEvictedManyPerSecond)
+{
+    SetMockTime(1);
+    RecentlyEvictedList recentlyEvicted(1000, 1);
+    for (int i = 0; i < 1500; i++) {
+        recentlyEvicted.add(ArithToUint256(i));
+    }
+    // The oldest entries make way once the list is full, even within a second
+    EXPECT_FALSE(recentlyEvicted.contains(ArithToUint256(499)));
+    EXPECT_TRUE(recentlyEvicted.contains(ArithToUint256(500)));
+    EXPECT_TRUE(recentlyEvicted.contains(ArithToUint256(1499)));
+    SetMockTime(2);
+    recentlyEvicted.add(ArithToUint256(1500));
+    SetMockTime(3);
+    EXPECT_FALSE(recentlyEvicted.contains(ArithToUint256(1499)));
+    EXPECT_TRUE(recentlyEvicted.contains(ArithToUint256(1500)));
+    SetMockTime(0);
+}
+
+TEST(MempoolLimitTests, WeightedTxTreeManyEntries)
+{
+    const int count = 1000;
+    WeightedTxTree tree(MIN_TX_COST * count / 2);
+    for (int i = 0; i < count; i++) {
+        int64_t cost = MIN_TX_COST + i;
+        tree.add(WeightedTxInfo(ArithToUint256(i), TxWeight(cost, i % 2 ? cost : cost + LOW_FEE_PENALTY)));
+    }
+    int64_t totalCost = MIN_TX_COST * count + count * (count - 1) / 2;
+    EXPECT_EQ(totalCost, tree.getTotalWeight().cost);
+    EXPECT_EQ(totalCost + LOW_FEE_PENALTY * count / 2, tree.getTotalWeight().evictionWeight);
+
+    // Removing from the middle keeps the totals right
+    for (int i = 0; i < count; i += 3) {
+        tree.remove(ArithToUint256(i));
+        totalCost -= MIN_TX_COST + i;
+    }
+    tree.remove(ArithToUint256(0));
+    EXPECT_EQ(totalCost, tree.getTotalWeight().cost);
+
+    // Dropping stops once the collection is back under its capacity
+    std::set<uint256> dropped;
+    while (boost::optional<uint256> drop = tree.maybeDropRandom()) {
+        EXPECT_TRUE(dropped.insert(drop.get()).second);
+        EXPECT_NE(0, UintToArith256(drop.get()).GetLow64() % 3);
+    }
+    EXPECT_LE(tree.getTotalWeight().cost, MIN_TX_COST * count / 2);
+    EXPECT_GT(tree.getTotalWeight().cost + MIN_TX_COST + count, MIN_TX_COST * count / 2);
+}
+
 TEST(MempoolLimitTests, WeightedTxInfoFromTx)
 {
     // The transaction creation is based on the test:
@@ -16,6 +16,7 @@
 
 #include <stdexcept>
 
+#include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "version.h"
 #include "serialize.h"
@@ -286,3 +287,87 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+TEST(merkletree, CompactWitnessListRoundTrip) {
+    SaplingMerkleTree tree;
+    tree.append(uint256());
+    tree.append(uint256());
+    SaplingWitness witness = tree.witness();
+
+    // Newest witness first, as in the wallet's witness cache
+    std::list<SaplingWitness> witnesses;
+    witnesses.push_front(witness);
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j <= i % 3; j++) {
+            witness.append(uint256());
+        }
+        witnesses.push_front(witness);
+    }
+
+    CDataStream ssFull(SER_DISK, PROTOCOL_VERSION);
+    ssFull << witnesses;
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << REF(libzcash::CompactWitnessList<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash>(witnesses));
+    EXPECT_LT(ss.size(), ssFull.size());
+
+    std::list<SaplingWitness> decoded;
+    ss >> REF(libzcash::CompactWitnessList<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash>(decoded));
+    ASSERT_EQ(witnesses.size(), decoded.size());
+    auto it = decoded.begin();
+    for (const SaplingWitness& w : witnesses) {
+        EXPECT_TRUE(w == *it);
+        EXPECT_EQ(w.root(), it->root());
+        ++it;
+    }
+}
+
+TEST(merkletree, AppendManyAndCachedRoot) {
+    // Every split of the 16 leaves of a testing tree into leaves before the
+    // witnessed one, leaves after it and a batch
+    for (size_t nBefore = 1; nBefore <= 16; nBefore++) {
+        for (size_t nAfter = 0; nBefore + nAfter <= 16; nAfter++) {
+            SproutTestingMerkleTree tree;
+            for (size_t i = 0; i < nBefore; i++) {
+                tree.append(uint256S(strprintf("%x", i + 1)));
+            }
+            SproutTestingWitness witness = tree.witness();
+            for (size_t i = 0; i < nAfter; i++) {
+                witness.append(uint256S(strprintf("%x", i + 100)));
+            }
+            ASSERT_EQ(witness.next_position(), nBefore + nAfter);
+
+            std::vector<uint256> leaves;
+            for (size_t i = nBefore + nAfter; i < 16; i++) {
+                leaves.push_back(uint256S(strprintf("%x", i + 1000)));
+            }
+            SproutTestingWitness::AppendBatch batch(nBefore + nAfter, leaves);
+
+            // The copies start with a cached root and path, which appending
+            // must drop
+            witness.root();
+            witness.path();
+            SproutTestingWitness expected = witness;
+            for (const uint256& leaf : leaves) {
+                expected.append(leaf);
+            }
+            SproutTestingWitness batched = witness;
+            batched.append_many(batch);
+            EXPECT_TRUE(batched == expected);
+            EXPECT_EQ(batched.root(), expected.root());
+
+            CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+            ss << expected;
+            SproutTestingWitness fresh;
+            ss >> fresh;
+            EXPECT_EQ(fresh.root(), expected.root());
+
+            // A batch for another position is appended leaf by leaf
+            if (!leaves.empty()) {
+                SproutTestingWitness::AppendBatch other(nBefore + nAfter + 1, leaves);
+                SproutTestingWitness fallback = witness;
+                fallback.append_many(other);
+                EXPECT_TRUE(fallback == expected);
+            }
+        }
+    }
+}
@@ -107,3 +107,25 @@ TEST(Metrics, EstimateNetHeight) {
     }
     RegtestDeactivateBlossom();
 }
+
+TEST(Metrics, MessageBytes) {
+    std::map<std::string, std::pair<uint64_t, uint64_t> > before, after;
+    GetMessageBytes(before);
+    EXPECT_EQ(1, before.count("tx"));
+    EXPECT_EQ(1, before.count("znb"));
+    EXPECT_EQ(1, before.count("other"));
+
+    RecordMessageBytes("tx", 300, false);
+    RecordMessageBytes("tx", 200, true);
+    RecordMessageBytes("addr", 55, false);
+    RecordMessageBytes("nosuchcmd", 40, false);
+    RecordMessageBytes("", 24, true);
+    GetMessageBytes(after);
+    EXPECT_EQ(before.size(), after.size());
+    EXPECT_EQ(before["tx"].first + 300, after["tx"].first);
+    EXPECT_EQ(before["tx"].second + 200, after["tx"].second);
+    EXPECT_EQ(before["addr"].first + 55, after["addr"].first);
+    EXPECT_EQ(before["addr"].second, after["addr"].second);
+    EXPECT_EQ(before["other"].first + 40, after["other"].first);
+    EXPECT_EQ(before["other"].second + 24, after["other"].second);
+}
@@ -158,6 +158,40 @@ TEST(noteencryption, NotePlaintext)
     ASSERT_TRUE(bar.rcm == pt.rcm);
 }
 
+TEST(noteencryption, CompactNotePlaintext)
+{
+    using namespace libzcash;
+    auto xsk = SaplingSpendingKey(uint256()).expanded_spending_key();
+    auto ivk = xsk.full_viewing_key().in_viewing_key();
+    SaplingPaymentAddress addr = *ivk.address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    memo.fill(0xf6);
+
+    SaplingNote note(addr, 39393);
+    uint256 cmu = note.cm().get();
+    SaplingNotePlaintext pt(note, memo);
+
+    auto enc = pt.encrypt(addr.pk_d).get();
+    auto epk = enc.second.get_epk();
+    SaplingCompactCiphertext ct;
+    std::copy(enc.first.begin(), enc.first.begin() + ct.size(), ct.begin());
+
+    // The compact ciphertext is only accepted with the right commitment and key
+    ASSERT_FALSE(SaplingNotePlaintext::decrypt_compact(ct, ivk, epk, uint256()));
+    auto other = SaplingSpendingKey(uint256S("1")).expanded_spending_key().full_viewing_key().in_viewing_key();
+    ASSERT_FALSE(SaplingNotePlaintext::decrypt_compact(ct, other, epk, cmu));
+
+    auto foo = SaplingNotePlaintext::decrypt_compact(ct, ivk, epk, cmu);
+    if (!foo) {
+        FAIL();
+    }
+
+    ASSERT_TRUE(foo->value() == pt.value());
+    ASSERT_TRUE(foo->d == pt.d);
+    ASSERT_TRUE(foo->rcm == pt.rcm);
+}
+
 TEST(noteencryption, SaplingApi)
 {
     using namespace libzcash;
@@ -341,6 +375,112 @@ TEST(noteencryption, SaplingApi)
     ));
 }
 
+TEST(noteencryption, TrialDecryptSaplingNotes)
+{
+    using namespace libzcash;
+
+    // Enough keys to span several chunks, so that the work is split between threads
+    std::vector<SaplingIncomingViewingKey> ivks;
+    std::vector<SaplingPaymentAddress> addrs;
+    for (size_t i = 0; i < 150; i++) {
+        auto ivk = SaplingSpendingKey::random().expanded_spending_key().full_viewing_key().in_viewing_key();
+        ivks.push_back(ivk);
+        addrs.push_back(*ivk.address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}));
+    }
+    // A repeated key must never be reported in place of the earlier copy
+    ivks.push_back(ivks[140]);
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    memo.fill(0);
+
+    // Notes 0, 2 and 3 belong to keys 5, 140 and 0; note 1 belongs to no key in the set
+    auto stranger = SaplingSpendingKey::random().default_address();
+    std::vector<SaplingPaymentAddress> recipients {addrs[5], stranger, addrs[140], addrs[0]};
+    std::vector<SaplingEncryptedNote> notes;
+    for (size_t i = 0; i < recipients.size(); i++) {
+        SaplingNote note(recipients[i], 1000 + i);
+        SaplingNotePlaintext pt(note, memo);
+        auto enc = pt.encrypt(recipients[i].pk_d);
+        ASSERT_TRUE(enc);
+        notes.emplace_back(enc->first, enc->second.get_epk(), *note.cm());
+    }
+
+    for (size_t nThreads : {1, 4}) {
+        auto results = TrialDecryptSaplingNotes(notes, ivks, nThreads);
+        ASSERT_EQ(3, results.size());
+        EXPECT_EQ(0, results[0].note);
+        EXPECT_EQ(5, results[0].key);
+        EXPECT_EQ(1000, results[0].plaintext.value());
+        EXPECT_EQ(2, results[1].note);
+        EXPECT_EQ(140, results[1].key);
+        EXPECT_EQ(1002, results[1].plaintext.value());
+        EXPECT_EQ(3, results[2].note);
+        EXPECT_EQ(0, results[2].key);
+        EXPECT_EQ(1003, results[2].plaintext.value());
+    }
+
+    // Nothing to decrypt against
+    EXPECT_TRUE(TrialDecryptSaplingNotes(notes, {}, 4).empty());
+    EXPECT_TRUE(TrialDecryptSaplingNotes({}, ivks, 4).empty());
+}
+
+TEST(noteencryption, TrialDecryptSproutNotes)
+{
+    using namespace libzcash;
+
+    std::vector<uint256> pk_encs;
+    std::vector<ZCNoteDecryption> decryptors;
+    for (size_t i = 0; i < 150; i++) {
+        uint256 sk_enc = ZCNoteEncryption::generate_privkey(random_uint252());
+        pk_encs.push_back(ZCNoteEncryption::generate_pubkey(sk_enc));
+        decryptors.emplace_back(sk_enc);
+    }
+    decryptors.push_back(decryptors[140]);
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    memo.fill(0);
+
+    // Two JoinSplits of two outputs each: the first pays keys 5 and 140, the
+    // second a stranger and key 0, so both ciphertexts under one ephemeral
+    // key are found from the same DH secret.
+    uint256 stranger = ZCNoteEncryption::generate_pubkey(ZCNoteEncryption::generate_privkey(random_uint252()));
+    std::vector<uint256> recipients {pk_encs[5], pk_encs[140], stranger, pk_encs[0]};
+    std::vector<SproutEncryptedNote> notes;
+    for (size_t js = 0; js < 2; js++) {
+        uint256 h_sig = random_uint256();
+        ZCNoteEncryption encryptor(h_sig);
+        for (unsigned char j = 0; j < 2; j++) {
+            SproutNote note(random_uint256(), 1000 + 2 * js + j, random_uint256(), random_uint256());
+            auto ct = SproutNotePlaintext(note, memo).encrypt(encryptor, recipients[2 * js + j]);
+            notes.emplace_back(ct, encryptor.get_epk(), h_sig, j);
+        }
+    }
+
+    for (size_t nThreads : {1, 4}) {
+        auto results = TrialDecryptSproutNotes(notes, decryptors, nThreads);
+        ASSERT_EQ(3, results.size());
+        EXPECT_EQ(0, results[0].note);
+        EXPECT_EQ(5, results[0].key);
+        EXPECT_EQ(1000, results[0].plaintext.value());
+        EXPECT_EQ(1, results[1].note);
+        EXPECT_EQ(140, results[1].key);
+        EXPECT_EQ(1001, results[1].plaintext.value());
+        EXPECT_EQ(3, results[2].note);
+        EXPECT_EQ(0, results[2].key);
+        EXPECT_EQ(1003, results[2].plaintext.value());
+    }
+
+    // Decrypting with a precomputed DH secret agrees with decrypt
+    uint256 dhsecret = decryptors[5].dh_secret(notes[0].ephemeralKey);
+    EXPECT_TRUE(decryptors[5].decrypt_with_dh_secret(notes[0].ciphertext, dhsecret, notes[0].ephemeralKey, notes[0].h_sig, 0) ==
+                decryptors[5].decrypt(notes[0].ciphertext, notes[0].ephemeralKey, notes[0].h_sig, 0));
+    EXPECT_THROW(decryptors[5].decrypt_with_dh_secret(notes[0].ciphertext, random_uint256(), notes[0].ephemeralKey, notes[0].h_sig, 0),
+                 note_decryption_failed);
+
+    EXPECT_TRUE(TrialDecryptSproutNotes(notes, {}, 4).empty());
+    EXPECT_TRUE(TrialDecryptSproutNotes({}, decryptors, 4).empty());
+}
+
 TEST(noteencryption, api)
 {
     uint256 sk_enc = ZCNoteEncryption::generate_privkey(uint252(uint256S("21035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a07")));
@@ -0,0 +1,235 @@
+#include <gtest/gtest.h>
+
+#include "chainparams.h"
+#include "coins.h"
+#include "compat/endian.h"
+#include "crypto/equihash.h"
+#include "main.h"
+#include "pow.h"
+#include "random.h"
+#include "txmempool.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/NoteEncryption.hpp"
+
+#include "sodium.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <vector>
+
+// Each test times a hot path against a reference operation run in the same
+// process: a primitive the path is built on, or the same path at a smaller
+// size. The ratios hold across machines and build types, so a test only
+// fails when the path gets slower relative to its reference, e.g. when a
+// change makes it do more work per item or scale worse with its size. The
+// limits leave several times the expected ratio as headroom.
+//
+// These tests are built as zero-gtest-performance, outside "make check",
+// and are best run on an otherwise idle machine.
+
+namespace {
+
+const int TIMING_RUNS = 5;
+
+// The best of TIMING_RUNS timings of func, in seconds. setup runs before
+// each timing and is not counted.
+double BestTime(const std::function<void()>& func, const std::function<void()>& setup = []() {})
+{
+    double best = 0;
+    for (int i = 0; i < TIMING_RUNS; i++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best)
+            best = elapsed.count();
+    }
+    return best;
+}
+
+void ExpectRatioBelow(const char* what, double time, double reference, double limit)
+{
+    ASSERT_GT(reference, 0);
+    double ratio = time / reference;
+    std::cout << what << ": " << ratio << " (limit " << limit << ")" << std::endl;
+    EXPECT_LT(ratio, limit) << what;
+}
+
+}
+
+TEST(PerformanceRegression, MerkleTreeAppend) {
+    const size_t nLeaves = 1 << 16;
+    std::vector<libzcash::SHA256Compress> leaves;
+    for (size_t i = 0; i < nLeaves; i++)
+        leaves.push_back(libzcash::SHA256Compress(GetRandHash()));
+
+    // Appending hashes about two nodes per leaf on average
+    double tAppend = BestTime([&]() {
+        SproutMerkleTree tree;
+        for (const libzcash::SHA256Compress& leaf : leaves)
+            tree.append(leaf);
+    });
+    double tCombine = BestTime([&]() {
+        libzcash::SHA256Compress node = leaves[0];
+        for (size_t i = 0; i < nLeaves; i++)
+            node = libzcash::SHA256Compress::combine(node, leaves[i], 0);
+        EXPECT_FALSE(node.IsNull());
+    });
+    ExpectRatioBelow("append / combine", tAppend, tCombine, 8);
+}
+
+TEST(PerformanceRegression, WitnessPath) {
+    // Updating a witness and computing its path should cost the same in a
+    // tree of a thousand leaves as in one of a hundred thousand
+    const size_t nUpdates = 1000;
+    auto timeUpdates = [&](size_t nLeaves) {
+        SproutMerkleTree tree;
+        for (size_t i = 0; i < nLeaves; i++)
+            tree.append(libzcash::SHA256Compress(GetRandHash()));
+        SproutWitness witnessStart = tree.witness();
+        std::vector<libzcash::SHA256Compress> leaves;
+        for (size_t i = 0; i < nUpdates; i++)
+            leaves.push_back(libzcash::SHA256Compress(GetRandHash()));
+
+        SproutWitness witness;
+        return BestTime([&]() {
+            for (const libzcash::SHA256Compress& leaf : leaves) {
+                witness.append(leaf);
+                EXPECT_EQ(witness.path().index.size(), INCREMENTAL_MERKLE_TREE_DEPTH);
+            }
+        }, [&]() { witness = witnessStart; });
+    };
+    double tSmall = timeUpdates(1000);
+    double tLarge = timeUpdates(100000);
+    ExpectRatioBelow("witness path at 100k / at 1k leaves", tLarge, tSmall, 3);
+}
+
+TEST(PerformanceRegression, MempoolAddRemove) {
+    SelectParams(CBaseChainParams::REGTEST);
+
+    // Time per transaction to add n transactions to the mempool and remove them
+    auto timePerTx = [](size_t n) {
+        std::vector<CTransaction> vtx;
+        vtx.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+            mtx.vout.push_back(CTxOut(1000, CScript() << OP_TRUE));
+            vtx.push_back(CTransaction(mtx));
+        }
+        CTxMemPool pool(::minRelayTxFee);
+        double t = BestTime([&]() {
+            for (const CTransaction& tx : vtx)
+                pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1, true, false, 0));
+            std::list<CTransaction> removed;
+            for (const CTransaction& tx : vtx)
+                pool.remove(tx, removed, false);
+            EXPECT_EQ(removed.size(), vtx.size());
+        });
+        EXPECT_EQ(pool.size(), 0U);
+        return t / n;
+    };
+    double tSmall = timePerTx(10000);
+    double tLarge = timePerTx(100000);
+    ExpectRatioBelow("mempool add/remove per tx at 100k / at 10k", tLarge, tSmall, 4);
+}
+
+TEST(PerformanceRegression, CoinsViewCacheFlush) {
+    // Flushing moves each entry into the parent cache, which should cost
+    // about as much as creating it in the child did
+    const size_t nCoins = 100000;
+    std::vector<uint256> txids;
+    for (size_t i = 0; i < nCoins; i++)
+        txids.push_back(GetRandHash());
+
+    CCoinsView base;
+    std::unique_ptr<CCoinsViewCache> parent, child;
+    auto setup = [&]() {
+        child.reset();
+        parent.reset(new CCoinsViewCache(&base));
+        child.reset(new CCoinsViewCache(parent.get()));
+    };
+    auto modify = [&]() {
+        for (const uint256& txid : txids) {
+            CCoinsModifier coins = child->ModifyCoins(txid);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 1000;
+        }
+    };
+    double tModify = BestTime(modify, setup);
+    double tFlush = BestTime([&]() {
+        EXPECT_TRUE(child->Flush());
+    }, [&]() { setup(); modify(); });
+    EXPECT_EQ(parent->GetCacheSize(), nCoins);
+    ExpectRatioBelow("flush / modify", tFlush, tModify, 3);
+}
+
+TEST(PerformanceRegression, EquihashValidation) {
+    // A valid solution is dominated by hashing each of its 2^k indices
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    const Consensus::Params& consensus = params.GetConsensus();
+    unsigned int n = consensus.nEquihashN;
+    unsigned int k = consensus.nEquihashK;
+
+    double tValidate = BestTime([&]() {
+        for (int i = 0; i < 10; i++)
+            EXPECT_TRUE(CheckEquihashSolution(&header, consensus));
+    });
+
+    crypto_generichash_blake2b_state state;
+    EhInitialiseState(n, k, state);
+    std::vector<unsigned char> hash((512 / n) * n / 8);
+    double tHashes = BestTime([&]() {
+        for (int i = 0; i < 10; i++) {
+            for (uint32_t g = 0; g < (1u << k); g++) {
+                crypto_generichash_blake2b_state s = state;
+                uint32_t le = htole32(g);
+                crypto_generichash_blake2b_update(&s, (const unsigned char*)&le, sizeof(le));
+                crypto_generichash_blake2b_final(&s, hash.data(), hash.size());
+            }
+        }
+    });
+    ExpectRatioBelow("equihash validation / index hashes", tValidate, tHashes, 4);
+}
+
+TEST(PerformanceRegression, NoteDecryption) {
+    // A trial decryption is dominated by its Diffie-Hellman exchange
+    uint256 sk_enc = ZCNoteEncryption::generate_privkey(libzcash::random_uint252());
+    uint256 pk_enc = ZCNoteEncryption::generate_pubkey(sk_enc);
+    uint256 hSig = GetRandHash();
+    ZCNoteEncryption encryptor(hSig);
+    ZCNoteEncryption::Plaintext message;
+    message.fill(0x42);
+    ZCNoteEncryption::Ciphertext ciphertext = encryptor.encrypt(pk_enc, message);
+    ZCNoteDecryption decryptor(sk_enc);
+    ZCNoteDecryption decryptorOther(ZCNoteEncryption::generate_privkey(libzcash::random_uint252()));
+    const int nTrials = 1000;
+
+    double tDecrypt = BestTime([&]() {
+        for (int i = 0; i < nTrials; i++) {
+            try {
+                decryptorOther.decrypt(ciphertext, encryptor.get_epk(), hSig, 0);
+                ADD_FAILURE() << "decrypted with the wrong key";
+            } catch (const libzcash::note_decryption_failed&) {
+            }
+        }
+    });
+    double tDH = BestTime([&]() {
+        for (int i = 0; i < nTrials; i++)
+            decryptorOther.dh_secret(encryptor.get_epk());
+    });
+    ExpectRatioBelow("trial decryption / DH exchange", tDecrypt, tDH, 3);
+
+    // The ciphertexts of a JoinSplit share the exchange
+    uint256 dhsecret = decryptor.dh_secret(encryptor.get_epk());
+    double tShared = BestTime([&]() {
+        for (int i = 0; i < nTrials; i++)
+            decryptor.decrypt_with_dh_secret(ciphertext, dhsecret, encryptor.get_epk(), hSig, 0);
+    });
+    ExpectRatioBelow("decryption with shared DH secret / DH exchange", tShared, tDH, 0.5);
+}
@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+
+#include "proofcache.h"
+#include "random.h"
+
+TEST(ProofCache, KeyedByTxidAndBranch) {
+    uint256 txid = GetRandHash();
+    uint256 other = GetRandHash();
+    uint32_t branchId = 0x76b809bb;
+
+    EXPECT_FALSE(IsShieldedTxVerified(txid, branchId));
+
+    SetShieldedTxVerified(txid, branchId);
+    EXPECT_TRUE(IsShieldedTxVerified(txid, branchId));
+
+    // The signature hash depends on the branch, so another branch misses
+    EXPECT_FALSE(IsShieldedTxVerified(txid, branchId + 1));
+    EXPECT_FALSE(IsShieldedTxVerified(other, branchId));
+}
+
+TEST(ProofCache, EquihashSolutions) {
+    uint256 hash = GetRandHash();
+
+    EXPECT_FALSE(IsEquihashSolutionVerified(hash));
+    SetEquihashSolutionVerified(hash);
+    EXPECT_TRUE(IsEquihashSolutionVerified(hash));
+
+    // Block hashes and txids are kept apart
+    EXPECT_FALSE(IsShieldedTxVerified(hash, 0));
+
+    SetProofCacheBypass(true);
+    EXPECT_FALSE(IsEquihashSolutionVerified(hash));
+    SetProofCacheBypass(false);
+}
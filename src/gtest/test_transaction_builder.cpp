@@ -5,6 +5,7 @@
 #include "main.h"
 #include "pubkey.h"
 #include "rpc/protocol.h"
+#include "script/interpreter.h"
 #include "transaction_builder.h"
 #include "utiltest.h"
 #include "zcash/Address.hpp"
@@ -146,6 +147,28 @@ TEST(TransactionBuilder, SaplingToSapling) {
     EXPECT_TRUE(ContextualCheckTransaction(tx, state, Params(), 3, 0));
     EXPECT_EQ(state.GetRejectReason(), "");
 
+    // The Sapling checks can be deferred, as ContextualCheckBlock does
+    std::vector<CValidationCheck> vChecks;
+    EXPECT_TRUE(ContextualCheckTransaction(tx, state, Params(), 3, 0, IsInitialBlockDownload, &vChecks));
+    ASSERT_EQ(vChecks.size(), 1);
+    EXPECT_TRUE(vChecks[0]());
+
+    // The signature hash can reuse the hashes computed for the script checks
+    PrecomputedTransactionData txdata(tx);
+    EXPECT_TRUE(ContextualCheckTransaction(tx, state, Params(), 3, 0, IsInitialBlockDownload, NULL, &txdata));
+
+    // Changing the value balance changes the signature hash, so the spend
+    // authorization signature no longer verifies
+    CMutableTransaction mtx(tx);
+    mtx.valueBalance += 1;
+    CTransaction txBad(mtx);
+    vChecks.clear();
+    EXPECT_TRUE(ContextualCheckTransaction(txBad, state, Params(), 3, 0, IsInitialBlockDownload, &vChecks));
+    ASSERT_EQ(vChecks.size(), 1);
+    EXPECT_FALSE(vChecks[0]());
+    EXPECT_FALSE(ContextualCheckTransaction(txBad, state, Params(), 3, 0));
+    EXPECT_EQ(state.GetRejectReason(), "bad-txns-sapling-spend-description-invalid");
+
     // Revert to default
     RegtestDeactivateSapling();
 }
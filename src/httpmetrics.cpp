@@ -0,0 +1,198 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "httprpc.h"
+
+#include "httpserver.h"
+#include "main.h"
+#include "metrics.h"
+#include "net.h"
+#include "notificationpublisher.h"
+#include "perfstats.h"
+#include "rpc/server.h"
+#include "txmempool.h"
+#include "zeronode/zeronode-sync.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+
+#include <string>
+
+/**
+ * Writes metrics in the Prometheus text exposition format (version 0.0.4),
+ * which OpenMetrics scrapers accept as well.
+ */
+class MetricsWriter
+{
+public:
+    std::string strOut;
+
+    void Family(const std::string& strName, const char* pszType, const char* pszHelp)
+    {
+        strOut += "# HELP " + strName + " " + pszHelp + "\n";
+        strOut += "# TYPE " + strName + " " + pszType + "\n";
+    }
+
+    void Sample(const std::string& strName, const std::string& strLabels, uint64_t nValue)
+    {
+        strOut += strName + Braced(strLabels) + strprintf(" %d\n", nValue);
+    }
+
+    void Sample(const std::string& strName, const std::string& strLabels, double dValue)
+    {
+        strOut += strName + Braced(strLabels) + strprintf(" %.17g\n", dValue);
+    }
+
+    /** A histogram of microseconds, exported in seconds */
+    void Histogram(const std::string& strName, const std::string& strLabels, const CTimingHistogram& histogram)
+    {
+        uint64_t vCounts[CTimingHistogram::NUM_BUCKETS];
+        int nLast = -1;
+        for (int i = 0; i < CTimingHistogram::NUM_BUCKETS; i++) {
+            vCounts[i] = histogram.GetBucketCount(i);
+            if (vCounts[i])
+                nLast = i;
+        }
+        std::string strPrefix = strLabels.empty() ? "" : strLabels + ",";
+        uint64_t nCumulative = 0;
+        // Empty buckets past the last used one add nothing
+        for (int i = 0; i <= nLast && i < CTimingHistogram::NUM_BUCKETS - 1; i++) {
+            nCumulative += vCounts[i];
+            double dUpper = (double)((int64_t)1 << (i + 1)) * 0.000001;
+            strOut += strName + "_bucket{" + strPrefix + strprintf("le=\"%g\"} %d\n", dUpper, nCumulative);
+        }
+        if (nLast == CTimingHistogram::NUM_BUCKETS - 1)
+            nCumulative += vCounts[nLast];
+        strOut += strName + "_bucket{" + strPrefix + strprintf("le=\"+Inf\"} %d\n", nCumulative);
+        Sample(strName + "_sum", strLabels, histogram.GetSummary().nSum * 0.000001);
+        Sample(strName + "_count", strLabels, nCumulative);
+    }
+
+private:
+    static std::string Braced(const std::string& strLabels)
+    {
+        return strLabels.empty() ? "" : "{" + strLabels + "}";
+    }
+};
+
+static std::string Label(const std::string& strName, const std::string& strValue)
+{
+    // Only names made here and known RPC and message names get in, but keep the output well-formed anyway
+    std::string strEscaped;
+    for (char c : strValue) {
+        if (c == '\\' || c == '"')
+            strEscaped += '\\';
+        if (c == '\n') {
+            strEscaped += "\\n";
+            continue;
+        }
+        strEscaped += c;
+    }
+    return strName + "=\"" + strEscaped + "\"";
+}
+
+static std::string WriteMetrics()
+{
+    MetricsWriter w;
+
+    w.Family("zero_transactions_validated_total", "counter", "Non-coinbase transactions checked");
+    w.Sample("zero_transactions_validated_total", "", (uint64_t)transactionsValidated.value.load());
+    w.Family("zero_equihash_solver_runs_total", "counter", "Equihash solver runs of the miner");
+    w.Sample("zero_equihash_solver_runs_total", "", (uint64_t)ehSolverRuns.value.load());
+    w.Family("zero_solution_target_checks_total", "counter", "Equihash solutions checked against the target");
+    w.Sample("zero_solution_target_checks_total", "", (uint64_t)solutionTargetChecks.value.load());
+
+    w.Family("zero_mempool_transactions", "gauge", "Transactions in the memory pool");
+    w.Sample("zero_mempool_transactions", "", (uint64_t)mempool.size());
+    w.Family("zero_mempool_bytes", "gauge", "Serialized size of the transactions in the memory pool");
+    w.Sample("zero_mempool_bytes", "", (uint64_t)mempool.GetTotalTxSize());
+    w.Family("zero_mempool_usage_bytes", "gauge", "Memory used by the memory pool");
+    w.Sample("zero_mempool_usage_bytes", "", (uint64_t)mempool.DynamicMemoryUsage());
+
+    uint64_t nInbound = 0, nOutbound = 0;
+    {
+        LOCK(cs_vNodes);
+        for (const CNode* pnode : vNodes)
+            (pnode->fInbound ? nInbound : nOutbound)++;
+    }
+    w.Family("zero_peers", "gauge", "Connected peers");
+    w.Sample("zero_peers", Label("direction", "inbound"), nInbound);
+    w.Sample("zero_peers", Label("direction", "outbound"), nOutbound);
+
+    std::map<std::string, std::pair<uint64_t, uint64_t> > mapBytes;
+    GetMessageBytes(mapBytes);
+    w.Family("zero_p2p_message_bytes_total", "counter", "Bytes of P2P messages, headers included, per command");
+    for (const auto& entry : mapBytes) {
+        w.Sample("zero_p2p_message_bytes_total", Label("command", entry.first) + "," + Label("direction", "recv"), entry.second.first);
+        w.Sample("zero_p2p_message_bytes_total", Label("command", entry.first) + "," + Label("direction", "sent"), entry.second.second);
+    }
+
+    w.Family("zero_coins_cache_hits_total", "counter", "Coins lookups served by the coins cache");
+    w.Sample("zero_coins_cache_hits_total", "", (uint64_t)coinsTipCounters.nHits.load(std::memory_order_relaxed));
+    w.Family("zero_coins_cache_misses_total", "counter", "Coins lookups that went to the chainstate database");
+    w.Sample("zero_coins_cache_misses_total", "", (uint64_t)coinsTipCounters.nMisses.load(std::memory_order_relaxed));
+
+    w.Family("zero_notifications_dropped_total", "counter", "ZMQ and AMQP transaction notifications dropped over -notificationhwm");
+    w.Sample("zero_notifications_dropped_total", "", GetNotificationsDropped());
+
+    w.Family("zero_validation_duration_seconds", "histogram", "Time spent validating, per stage (see getperfstats)");
+    for (int i = 0; i < PERF_STAT_COUNT; i++)
+        w.Histogram("zero_validation_duration_seconds", Label("stage", GetPerfStatName((PerfStat)i)), GetPerfStat((PerfStat)i));
+
+    w.Family("zero_rpc_duration_seconds", "histogram", "Time spent executing RPC calls, per method called since startup");
+    for (const auto& entry : tableRPC.GetLatencies()) {
+        if (entry.second.GetSummary().nCount == 0)
+            continue;
+        w.Histogram("zero_rpc_duration_seconds", Label("method", entry.first), entry.second);
+    }
+
+#ifdef ENABLE_WALLET
+    int nProgress = nRescanProgress;
+    w.Family("zero_wallet_rescanning", "gauge", "Whether the wallet is rescanning the block chain");
+    w.Sample("zero_wallet_rescanning", "", (uint64_t)(nProgress >= 0));
+    w.Family("zero_wallet_rescan_progress", "gauge", "Fraction of the current rescan done, or 1 when not rescanning");
+    w.Sample("zero_wallet_rescan_progress", "", nProgress >= 0 ? nProgress / 100.0 : 1.0);
+#endif
+
+    int nAsset = zeronodeSync.RequestedZeronodeAssets;
+    w.Family("zero_zeronode_sync_asset", "gauge", "Zeronode sync stage (999 when finished, 998 when failed)");
+    w.Sample("zero_zeronode_sync_asset", "", (double)nAsset);
+    w.Family("zero_zeronode_synced", "gauge", "Whether the zeronode data is synced");
+    w.Sample("zero_zeronode_synced", "", (uint64_t)(nAsset == ZERONODE_SYNC_FINISHED));
+
+    return w.strOut;
+}
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests are supported\r\n");
+        return false;
+    }
+    std::string strMetrics = WriteMetrics();
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    req->WriteReply(HTTP_OK, strMetrics);
+    return true;
+}
+
+/** Scrapes are cheap and should not wait behind slow RPC calls */
+static HTTPWorkClass ClassifyMetrics(HTTPRequest*, const std::string&)
+{
+    return HTTPWorkClass(HTTP_PRIORITY_HIGH, "metrics");
+}
+
+bool StartHTTPMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics, ClassifyMetrics);
+    return true;
+}
+
+void InterruptHTTPMetrics()
+{
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
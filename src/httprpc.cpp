@@ -3,7 +3,10 @@
 #include "chainparams.h"
 #include "httpserver.h"
 #include "key_io.h"
+#include "rpc/cbor.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
+#include "rpc/resultcache.h"
 #include "rpc/server.h"
 #include "random.h"
 #include "sync.h"
@@ -12,10 +15,28 @@
 #include "ui_interface.h"
 
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
 
+/** Largest request body that is parsed to find the method before the request is queued */
+static const size_t MAX_CLASSIFY_BODY_SIZE = 64 * 1024;
+
+/** Calls that must not wait behind others: block production and relay, and starting zeronodes */
+static const char* const HIGH_PRIORITY_METHODS[] = {
+    "getblocktemplate", "submitblock", "sendrawtransaction", "startalias", "startzeronode",
+};
+/** Address and spent index queries, which can take long */
+static const char* const LOW_PRIORITY_METHODS[] = {
+    "getaddressdeltas", "getaddressutxos", "getaddresstxids", "getaddressbalance", "getaddressmempool",
+    "getblockdeltas", "getspentinfo",
+};
+
+//! Work queue priority and concurrency limit of each method; set up before the server starts
+static std::map<std::string, HTTPWorkPriority> mapMethodPriority;
+static std::map<std::string, int> mapMethodLimit;
+
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wallet.
  */
@@ -58,7 +79,32 @@ static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
 
-static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
+/** Whether the client asked for replies in CBOR instead of JSON text */
+static bool AcceptsCBOR(HTTPRequest* req)
+{
+    std::pair<bool, std::string> accept = req->GetHeader("accept");
+    return accept.first && accept.second.find(CBOR_CONTENT_TYPE) != std::string::npos;
+}
+
+static void WriteRPCReply(HTTPRequest* req, int nStatus, const UniValue& reply, bool fCBOR)
+{
+    if (fCBOR) {
+        req->WriteHeader("Content-Type", CBOR_CONTENT_TYPE);
+        req->WriteReply(nStatus, EncodeCBOR(reply));
+    } else {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(nStatus, reply.write() + "\n");
+    }
+}
+
+/** Reply to a single call with a result that is already serialized */
+static void WriteJSONResultReply(HTTPRequest* req, const std::string& strResult, const UniValue& id)
+{
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, "{\"result\":" + strResult + ",\"error\":null,\"id\":" + id.write() + "}\n");
+}
+
+static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id, bool fCBOR)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
@@ -69,10 +115,7 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     else if (code == RPC_METHOD_NOT_FOUND)
         nStatus = HTTP_NOT_FOUND;
 
-    std::string strReply = JSONRPCReply(NullUniValue, objError, id);
-
-    req->WriteHeader("Content-Type", "application/json");
-    req->WriteReply(nStatus, strReply);
+    WriteRPCReply(req, nStatus, JSONRPCReplyObj(NullUniValue, objError, id), fCBOR);
 }
 
 static bool RPCAuthorized(const std::string& strAuth)
@@ -116,40 +159,143 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     }
 
     JSONRequest jreq;
+    // Replies are CBOR if the client accepts it, and requests may be CBOR too
+    bool fCBOR = AcceptsCBOR(req);
     try {
         // Parse request
         UniValue valRequest;
-        if (!valRequest.read(req->ReadBody()))
+        std::pair<bool, std::string> contentType = req->GetHeader("content-type");
+        if (contentType.first && contentType.second.find(CBOR_CONTENT_TYPE) == 0) {
+            if (!DecodeCBOR(req->ReadBody(), valRequest))
+                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+        } else if (!valRequest.read(req->ReadBody()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-        std::string strReply;
+        UniValue reply;
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // Results that only depend on the tip are shared between clients
+            RPCCacheKey cacheKey;
+            std::string strResult;
+            if (!fCBOR && RPCResultCacheLookup(jreq.strMethod, jreq.params, cacheKey, strResult)) {
+                WriteJSONResultReply(req, strResult, jreq.id);
+                return true;
+            }
+
+            RPCStreamScope streamScope(!fCBOR);
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+            RPCResultWriter writer = streamScope.GetWriter();
+
+            // Calls with large results stream them instead of building the text in full
+            if (writer) {
+                req->WriteHeader("Content-Type", "application/json");
+                req->StartChunkedReply(HTTP_OK);
+                CJSONStreamWriter json(boost::bind(&HTTPRequest::WriteReplyChunk, req, _1));
+                json.BeginObject();
+                json.Key("result");
+                writer(json);
+                json.Key("error");
+                json.Value(NullUniValue);
+                json.Key("id");
+                json.Value(jreq.id);
+                json.EndObject();
+                json.Raw("\n");
+                if (!json.Flush())
+                    LogPrint("rpc", "%s: client went away during the reply to %s\n", __func__, SanitizeString(jreq.strMethod));
+                req->EndChunkedReply();
+                return true;
+            }
+
+            if (cacheKey.policy != RPC_CACHE_NONE) {
+                strResult = result.write();
+                RPCResultCacheStore(cacheKey, strResult);
+                WriteJSONResultReply(req, strResult, jreq.id);
+                return true;
+            }
 
             // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            reply = JSONRPCReplyObj(result, NullUniValue, jreq.id);
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            reply = JSONRPCExecBatchReply(valRequest.get_array());
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
+        WriteRPCReply(req, HTTP_OK, reply, fCBOR);
     } catch (const UniValue& objError) {
-        JSONErrorReply(req, objError, jreq.id);
+        JSONErrorReply(req, objError, jreq.id, fCBOR);
         return false;
     } catch (const std::exception& e) {
-        JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, fCBOR);
         return false;
     }
     return true;
 }
 
+/** Queue single calls by the priority of their method; batches and unparsed requests are normal work */
+static HTTPWorkClass ClassifyJSONRPC(HTTPRequest* req, const std::string &)
+{
+    std::string strBody;
+    UniValue valRequest;
+    if (!req->PeekBody(strBody, MAX_CLASSIFY_BODY_SIZE) || !valRequest.read(strBody) || !valRequest.isObject())
+        return HTTPWorkClass();
+    const UniValue& method = find_value(valRequest, "method");
+    if (!method.isStr())
+        return HTTPWorkClass();
+
+    const std::string& strMethod = method.get_str();
+    HTTPWorkPriority priority = HTTP_PRIORITY_NORMAL;
+    int nLimit = 0;
+    std::map<std::string, HTTPWorkPriority>::const_iterator itPriority = mapMethodPriority.find(strMethod);
+    if (itPriority != mapMethodPriority.end())
+        priority = itPriority->second;
+    std::map<std::string, int>::const_iterator itLimit = mapMethodLimit.find(strMethod);
+    if (itLimit != mapMethodLimit.end())
+        nLimit = itLimit->second;
+    // Only known methods get their own statistics, so that clients cannot grow them without bound
+    if (!tableRPC[strMethod])
+        return HTTPWorkClass(priority);
+    return HTTPWorkClass(priority, strMethod, nLimit);
+}
+
+/** Set up the queue priorities and concurrency limits of the methods from the defaults and options */
+static bool InitRPCWorkClasses()
+{
+    mapMethodPriority.clear();
+    mapMethodLimit.clear();
+    for (size_t i = 0; i < ARRAYLEN(HIGH_PRIORITY_METHODS); i++)
+        mapMethodPriority[HIGH_PRIORITY_METHODS[i]] = HTTP_PRIORITY_HIGH;
+    for (size_t i = 0; i < ARRAYLEN(LOW_PRIORITY_METHODS); i++)
+        mapMethodPriority[LOW_PRIORITY_METHODS[i]] = HTTP_PRIORITY_LOW;
+
+    for (const std::string& strEntry : mapMultiArgs["-rpcpriority"]) {
+        size_t nSep = strEntry.find(':');
+        HTTPWorkPriority priority;
+        if (nSep == std::string::npos || !ParseHTTPWorkPriority(strEntry.substr(nSep + 1), priority)) {
+            uiInterface.ThreadSafeMessageBox(
+                strprintf("Invalid -rpcpriority specification: %s. Use <method>:<high|normal|low>.", strEntry),
+                "", CClientUIInterface::MSG_ERROR);
+            return false;
+        }
+        mapMethodPriority[strEntry.substr(0, nSep)] = priority;
+    }
+    for (const std::string& strEntry : mapMultiArgs["-rpcmethodlimit"]) {
+        size_t nSep = strEntry.find(':');
+        int32_t nLimit;
+        if (nSep == std::string::npos || !ParseInt32(strEntry.substr(nSep + 1), &nLimit) || nLimit < 0) {
+            uiInterface.ThreadSafeMessageBox(
+                strprintf("Invalid -rpcmethodlimit specification: %s. Use <method>:<n>.", strEntry),
+                "", CClientUIInterface::MSG_ERROR);
+            return false;
+        }
+        mapMethodLimit[strEntry.substr(0, nSep)] = nLimit;
+    }
+    return true;
+}
+
 static bool InitRPCAuthentication()
 {
     if (mapArgs["-rpcpassword"] == "")
@@ -172,12 +318,16 @@ bool StartHTTPRPC()
     LogPrint("rpc", "Starting HTTP RPC server\n");
     if (!InitRPCAuthentication())
         return false;
+    if (!InitRPCWorkClasses())
+        return false;
+    RPCResultCacheInit((size_t)std::max<int64_t>(0, GetArg("-rpccachesize", DEFAULT_RPC_CACHE_SIZE)) << 20);
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, ClassifyJSONRPC);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
     RPCRegisterTimerInterface(httpRPCTimerInterface);
+    RPCSetWorkerDispatcher(HTTPRunOnWorker);
     return true;
 }
 
@@ -190,6 +340,7 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    RPCSetWorkerDispatcher(RPCWorkerDispatcher());
     if (httpRPCTimerInterface) {
         RPCUnregisterTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
@@ -34,4 +34,16 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Start the Prometheus metrics endpoint at /metrics.
+ * Precondition; HTTP and RPC has been started.
+ */
+bool StartHTTPMetrics();
+/** Interrupt the metrics endpoint.
+ */
+void InterruptHTTPMetrics();
+/** Stop the metrics endpoint.
+ * Precondition; HTTP and RPC has been stopped.
+ */
+void StopHTTPMetrics();
+
 #endif
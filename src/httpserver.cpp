@@ -24,6 +24,7 @@
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -36,43 +37,69 @@
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/foreach.hpp>
-#include <boost/scoped_ptr.hpp>
 
-/** HTTP request work item */
+/** HTTP request work item. It holds the request itself, so that a request
+ * costs a single allocation from arrival to reply.
+ */
 class HTTPWorkItem : public HTTPClosure
 {
 public:
-    HTTPWorkItem(HTTPRequest* req, const std::string &path, const HTTPRequestHandler& func):
-        req(req), path(path), func(func)
+    HTTPWorkItem(struct evhttp_request* req): req(req)
     {
     }
     void operator()()
     {
-        func(req.get(), path);
+        func(&req, path);
     }
 
-    boost::scoped_ptr<HTTPRequest> req;
-
-private:
+    HTTPRequest req;
     std::string path;
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
+/** Work item running a task queued by HTTPRunOnWorker */
+class HTTPTaskItem : public HTTPClosure
+{
+public:
+    HTTPTaskItem(const boost::function<void(void)>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
+/** Work queue for distributing work over multiple threads.
+ * Work items are simply callable objects, queued per priority class (see
+ * HTTPWorkPriority), each class holding up to maxDepth items.
  */
 template <typename WorkItem>
 class WorkQueue
 {
 private:
+    struct Entry
+    {
+        WorkItem* item;
+        HTTPWorkClass cls;
+        int64_t nTimeQueued;
+    };
+
     /** Mutex protects entire object */
     CWaitableCriticalSection cs;
     CConditionVariable cond;
     /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
-    std::deque<WorkItem*> queue;
+    std::deque<Entry> queue[HTTP_PRIORITY_COUNT];
     bool running;
     size_t maxDepth;
     int numThreads;
+    //! Most threads each priority class may occupy
+    int maxRunning[HTTP_PRIORITY_COUNT];
+    HTTPWorkStats classStats[HTTP_PRIORITY_COUNT];
+    std::map<std::string, HTTPWorkStats> nameStats;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -92,31 +119,65 @@ private:
         }
     };
 
+    /** Take the next item that may start now off the queue; requires cs */
+    bool Pop(Entry& entry)
+    {
+        for (int p = 0; p < HTTP_PRIORITY_COUNT; p++) {
+            if (classStats[p].nRunning >= maxRunning[p])
+                continue;
+            for (typename std::deque<Entry>::iterator it = queue[p].begin(); it != queue[p].end(); ++it) {
+                if (it->cls.nMaxConcurrent > 0 && !it->cls.name.empty() &&
+                    nameStats[it->cls.name].nRunning >= it->cls.nMaxConcurrent)
+                    continue;
+                entry = *it;
+                queue[p].erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
 public:
-    WorkQueue(size_t maxDepth) : running(true),
-                                 maxDepth(maxDepth),
-                                 numThreads(0)
+    WorkQueue(size_t maxDepth, int nThreads) : running(true),
+                                               maxDepth(maxDepth),
+                                               numThreads(0)
     {
+        maxRunning[HTTP_PRIORITY_HIGH] = nThreads;
+        maxRunning[HTTP_PRIORITY_NORMAL] = std::max(nThreads - 1, 1);
+        maxRunning[HTTP_PRIORITY_LOW] = std::max(nThreads / 2, 1);
     }
     /*( Precondition: worker threads have all stopped
      * (call WaitExit)
      */
     ~WorkQueue()
     {
-        while (!queue.empty()) {
-            delete queue.front();
-            queue.pop_front();
+        for (int p = 0; p < HTTP_PRIORITY_COUNT; p++) {
+            while (!queue[p].empty()) {
+                delete queue[p].front().item;
+                queue[p].pop_front();
+            }
         }
     }
     /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    bool Enqueue(WorkItem* item, const HTTPWorkClass& cls = HTTPWorkClass())
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
+        if (queue[cls.priority].size() >= maxDepth) {
+            classStats[cls.priority].nRejected++;
+            if (!cls.name.empty())
+                nameStats[cls.name].nRejected++;
             return false;
         }
-        queue.push_back(item);
-        cond.notify_one();
+        Entry entry;
+        entry.item = item;
+        entry.cls = cls;
+        entry.nTimeQueued = GetTimeMicros();
+        queue[cls.priority].push_back(entry);
+        classStats[cls.priority].nQueued++;
+        if (!cls.name.empty())
+            nameStats[cls.name].nQueued++;
+        // Not every waiting thread may be allowed to take this item
+        cond.notify_all();
         return true;
     }
     /** Thread function */
@@ -124,18 +185,42 @@ public:
     {
         ThreadCounter count(*this);
         while (running) {
-            WorkItem* i = 0;
+            Entry entry;
+            int64_t nTimeStart;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
-                while (running && queue.empty())
+                while (running && !Pop(entry))
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = queue.front();
-                queue.pop_front();
+                nTimeStart = GetTimeMicros();
+                int64_t nWait = nTimeStart - entry.nTimeQueued;
+                HTTPWorkStats* pstats[2] = {&classStats[entry.cls.priority], entry.cls.name.empty() ? NULL : &nameStats[entry.cls.name]};
+                for (int k = 0; k < 2; k++) {
+                    if (!pstats[k])
+                        continue;
+                    pstats[k]->nQueued--;
+                    pstats[k]->nRunning++;
+                    pstats[k]->nWaitTime += nWait;
+                    pstats[k]->nMaxWaitTime = std::max(pstats[k]->nMaxWaitTime, nWait);
+                }
+            }
+            (*entry.item)();
+            delete entry.item;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                int64_t nRun = GetTimeMicros() - nTimeStart;
+                HTTPWorkStats* pstats[2] = {&classStats[entry.cls.priority], entry.cls.name.empty() ? NULL : &nameStats[entry.cls.name]};
+                for (int k = 0; k < 2; k++) {
+                    if (!pstats[k])
+                        continue;
+                    pstats[k]->nRunning--;
+                    pstats[k]->nDone++;
+                    pstats[k]->nRunTime += nRun;
+                }
+                // Items held back by a concurrency limit may start now
+                cond.notify_all();
             }
-            (*i)();
-            delete i;
         }
     }
     /** Interrupt and exit loops */
@@ -157,20 +242,31 @@ public:
     size_t Depth()
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        return queue.size();
+        size_t depth = 0;
+        for (int p = 0; p < HTTP_PRIORITY_COUNT; p++)
+            depth += queue[p].size();
+        return depth;
+    }
+
+    void GetStats(std::vector<HTTPWorkStats>& vClassStats, std::map<std::string, HTTPWorkStats>& mapNameStats)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        vClassStats.assign(classStats, classStats + HTTP_PRIORITY_COUNT);
+        mapNameStats = nameStats;
     }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPRequestClassifier classifier):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), classifier(classifier)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPRequestClassifier classifier;
 };
 
 /** HTTP module state */
@@ -181,6 +277,10 @@ static struct event_base* eventBase = 0;
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
+//! Whether each peer address seen recently passed ClientAllowed (event loop thread only)
+static std::map<std::string, bool> mapPeerAllowed;
+//! Addresses kept in mapPeerAllowed before it is cleared
+static const size_t MAX_PEER_ALLOWED_CACHE = 1024;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
 //! Handlers for (sub)paths
@@ -203,6 +303,7 @@ static bool ClientAllowed(const CNetAddr& netaddr)
 static bool InitHTTPAllowList()
 {
     rpc_allow_subnets.clear();
+    mapPeerAllowed.clear();
     rpc_allow_subnets.push_back(CSubNet("127.0.0.0/8")); // always allow IPv4 local subnet
     rpc_allow_subnets.push_back(CSubNet("::1"));         // always allow IPv6 localhost
     if (mapMultiArgs.count("-rpcallowip")) {
@@ -246,16 +347,44 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
+/** Check if the peer of a request may access the HTTP server. Clients
+ * making many short requests come from few addresses, so the outcome is
+ * remembered per address instead of parsing it every time.
+ */
+static bool RequestAllowed(struct evhttp_request* req)
+{
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    if (!con)
+        return false;
+    // evhttp retains ownership over returned address string
+    char* address = NULL;
+    uint16_t port = 0;
+    evhttp_connection_get_peer(con, &address, &port);
+    std::string strAddress(address ? address : "");
+
+    std::map<std::string, bool>::const_iterator it = mapPeerAllowed.find(strAddress);
+    if (it != mapPeerAllowed.end())
+        return it->second;
+    if (mapPeerAllowed.size() >= MAX_PEER_ALLOWED_CACHE)
+        mapPeerAllowed.clear();
+    bool fAllowed = ClientAllowed(CService(strAddress, port));
+    mapPeerAllowed[strAddress] = fAllowed;
+    return fAllowed;
+}
+
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
-    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+    std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(req));
+    HTTPRequest* hreq = &item->req;
 
-    LogPrint("http", "Received a %s request for %s from %s\n",
-             RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
+    if (LogAcceptCategory("http")) {
+        LogPrint("http", "Received a %s request for %s from %s\n",
+                 RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
+    }
 
     // Early address-based allow check
-    if (!ClientAllowed(hreq->GetPeer())) {
+    if (!RequestAllowed(req)) {
         hreq->WriteReply(HTTP_FORBIDDEN);
         return;
     }
@@ -267,8 +396,8 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
     }
 
     // Find registered handler for prefix
-    std::string strURI = hreq->GetURI();
-    std::string path;
+    const char* uri = evhttp_request_get_uri(req);
+    std::string strURI(uri ? uri : "");
     std::vector<HTTPPathHandler>::const_iterator i = pathHandlers.begin();
     std::vector<HTTPPathHandler>::const_iterator iend = pathHandlers.end();
     for (; i != iend; ++i) {
@@ -276,21 +405,24 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
         if (i->exactMatch)
             match = (strURI == i->prefix);
         else
-            match = (strURI.substr(0, i->prefix.size()) == i->prefix);
+            match = (strURI.compare(0, i->prefix.size(), i->prefix) == 0);
         if (match) {
-            path = strURI.substr(i->prefix.size());
+            item->path.assign(strURI, i->prefix.size(), std::string::npos);
             break;
         }
     }
 
     // Dispatch to worker thread
     if (i != iend) {
-        std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
+        HTTPWorkClass cls;
+        if (i->classifier)
+            cls = i->classifier(hreq, item->path);
+        item->func = i->handler;
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(item.get(), cls))
             item.release(); /* if true, queue took ownership */
         else
-            item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+            hreq->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
     } else {
         hreq->WriteReply(HTTP_NOTFOUND);
     }
@@ -430,9 +562,10 @@ bool InitHTTPServer()
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    LogPrintf("HTTP: creating work queue of depth %d per priority class\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth, rpcThreads);
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -541,7 +674,10 @@ HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (stream && req) {
+        // A chunked reply that was cut short
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -560,23 +696,36 @@ std::pair<bool, std::string> HTTPRequest::GetHeader(const std::string& hdr)
         return std::make_pair(false, "");
 }
 
+bool HTTPRequest::PeekBody(std::string& strBody, size_t nMaxSize)
+{
+    strBody.clear();
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return true;
+    size_t size = evbuffer_get_length(buf);
+    if (size > nMaxSize)
+        return false;
+    strBody.resize(size);
+    if (size > 0 && evbuffer_copyout(buf, &strBody[0], size) != (ev_ssize_t)size)
+        return false;
+    return true;
+}
+
 std::string HTTPRequest::ReadBody()
 {
     struct evbuffer* buf = evhttp_request_get_input_buffer(req);
     if (!buf)
         return "";
     size_t size = evbuffer_get_length(buf);
-    /** Trivial implementation: if this is ever a performance bottleneck,
-     * internal copying can be avoided in multi-segment buffers by using
-     * evbuffer_peek and an awkward loop. Though in that case, it'd be even
-     * better to not copy into an intermediate string but use a stream
-     * abstraction to consume the evbuffer on the fly in the parsing algorithm.
-     */
-    const char* data = (const char*)evbuffer_pullup(buf, size);
-    if (!data) // returns NULL in case of empty buffer
+    if (size == 0)
+        return "";
+    // Copy straight out of the buffer's segments, without first moving
+    // them into one contiguous block as evbuffer_pullup would
+    std::string rv(size, '\0');
+    int nRead = evbuffer_remove(buf, &rv[0], size);
+    if (nRead < 0)
         return "";
-    std::string rv(data, size);
-    evbuffer_drain(buf, size);
+    rv.resize(nRead);
     return rv;
 }
 
@@ -606,6 +755,139 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/**
+ * A chunked reply in progress. The worker thread producing the reply and
+ * the event loop thread sending it communicate through this; everything
+ * touching the request or its connection runs on the event loop thread.
+ */
+struct HTTPReplyStream
+{
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Events queued for the event loop thread that have not run yet
+    int nQueued;
+    //! Bytes in the connection's output buffer, as of the last event
+    size_t nBacklog;
+    //! The connection closed, which frees the request (event loop thread only)
+    bool fClosed;
+    //! Keeps the stream alive for the connection close callback until the reply ends
+    std::shared_ptr<HTTPReplyStream>* pself;
+
+    HTTPReplyStream() : nQueued(0), nBacklog(0), fClosed(false), pself(NULL) {}
+};
+
+static void http_reply_stream_close_cb(struct evhttp_connection*, void* arg)
+{
+    std::shared_ptr<HTTPReplyStream>* pstream = (std::shared_ptr<HTTPReplyStream>*)arg;
+    std::shared_ptr<HTTPReplyStream> stream = *pstream;
+    stream->fClosed = true;
+    stream->pself = NULL;
+    delete pstream;
+    boost::lock_guard<boost::mutex> lock(stream->cs);
+    stream->cond.notify_all();
+}
+
+/** Event loop side of the chunked reply: nStep 0 starts it, 1 sends a chunk (or only measures the backlog if evb is NULL), 2 ends it */
+static void HTTPReplyStreamStep(std::shared_ptr<HTTPReplyStream> stream, struct evhttp_request* req, int nStep, int nStatus, struct evbuffer* evb)
+{
+    size_t nBacklog = 0;
+    if (!stream->fClosed) {
+        struct evhttp_connection* conn = evhttp_request_get_connection(req);
+        if (nStep == 0) {
+            evhttp_send_reply_start(req, nStatus, NULL);
+            if (conn) {
+                stream->pself = new std::shared_ptr<HTTPReplyStream>(stream);
+                evhttp_connection_set_closecb(conn, http_reply_stream_close_cb, stream->pself);
+            }
+        } else if (nStep == 1) {
+            if (evb)
+                evhttp_send_reply_chunk(req, evb);
+        } else {
+            if (conn && stream->pself) {
+                evhttp_connection_set_closecb(conn, NULL, NULL);
+                delete stream->pself;
+                stream->pself = NULL;
+            }
+            evhttp_send_reply_end(req);
+        }
+        if (conn && nStep != 2) {
+            struct bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev)
+                nBacklog = evbuffer_get_length(bufferevent_get_output(bev));
+        }
+    }
+    if (evb)
+        evbuffer_free(evb);
+
+    boost::lock_guard<boost::mutex> lock(stream->cs);
+    stream->nQueued--;
+    stream->nBacklog = nBacklog;
+    stream->cond.notify_all();
+}
+
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && req && !stream);
+    stream = std::make_shared<HTTPReplyStream>();
+    stream->nQueued = 1;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(HTTPReplyStreamStep, stream, req, 0, nStatus, (struct evbuffer *)NULL));
+    ev->trigger(0);
+    replySent = true;
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(stream && req);
+    int64_t nTimeout = GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+    int64_t nStalledSince = GetTime();
+    {
+        // Keep at most one chunk in flight, and none while the client lags
+        boost::unique_lock<boost::mutex> lock(stream->cs);
+        while (stream->nQueued > 0 || stream->nBacklog > MAX_HTTP_REPLY_BACKLOG) {
+            if (stream->fClosed)
+                return false;
+            if (GetTime() - nStalledSince > nTimeout) {
+                LogPrint("http", "%s: client stopped reading a chunked reply\n", __func__);
+                return false;
+            }
+            if (stream->nQueued == 0) {
+                // Look at the backlog again in a moment
+                stream->nQueued++;
+                struct timeval tv = {0, 50 * 1000};
+                HTTPEvent* ev = new HTTPEvent(eventBase, true,
+                    boost::bind(HTTPReplyStreamStep, stream, req, 1, 0, (struct evbuffer *)NULL));
+                ev->trigger(&tv);
+            }
+            stream->cond.timed_wait(lock, boost::posix_time::seconds(1));
+        }
+        if (stream->fClosed)
+            return false;
+        stream->nQueued++;
+    }
+
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(HTTPReplyStreamStep, stream, req, 1, 0, evb));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(stream && req);
+    {
+        boost::lock_guard<boost::mutex> lock(stream->cs);
+        stream->nQueued++;
+    }
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(HTTPReplyStreamStep, stream, req, 2, 0, (struct evbuffer *)NULL));
+    ev->trigger(0);
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -646,10 +928,51 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, classifier));
+}
+
+bool HTTPRunOnWorker(const boost::function<void(void)>& func)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* if true, queue took ownership */
+    return true;
+}
+
+bool HTTPGetWorkStats(std::vector<HTTPWorkStats>& vClassStats, std::map<std::string, HTTPWorkStats>& mapNameStats)
+{
+    if (!workQueue)
+        return false;
+    workQueue->GetStats(vClassStats, mapNameStats);
+    return true;
+}
+
+std::string HTTPWorkPriorityName(HTTPWorkPriority priority)
+{
+    switch (priority) {
+    case HTTP_PRIORITY_HIGH: return "high";
+    case HTTP_PRIORITY_NORMAL: return "normal";
+    case HTTP_PRIORITY_LOW: return "low";
+    default: return "";
+    }
+}
+
+bool ParseHTTPWorkPriority(const std::string& strName, HTTPWorkPriority& priority)
+{
+    for (int p = 0; p < HTTP_PRIORITY_COUNT; p++) {
+        if (strName == HTTPWorkPriorityName((HTTPWorkPriority)p)) {
+            priority = (HTTPWorkPriority)p;
+            return true;
+        }
+    }
+    return false;
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -5,7 +5,10 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -14,11 +17,14 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Bytes of a chunked reply that may wait in a connection's output buffer before the writer is held back */
+static const size_t MAX_HTTP_REPLY_BACKLOG = 1024 * 1024;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyStream;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -34,13 +40,48 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Priority classes of the work queue. Queued work of a higher class is
+ * always started first; work of the normal class may occupy all worker
+ * threads but one, and low priority work at most half of them, so a flood
+ * of slow calls cannot hold up urgent ones.
+ */
+enum HTTPWorkPriority
+{
+    HTTP_PRIORITY_HIGH = 0,
+    HTTP_PRIORITY_NORMAL,
+    HTTP_PRIORITY_LOW,
+    HTTP_PRIORITY_COUNT
+};
+
+/** Name of a priority class, as used by the options and RPC interface */
+std::string HTTPWorkPriorityName(HTTPWorkPriority priority);
+/** Parse a priority class name; returns false if it is unknown */
+bool ParseHTTPWorkPriority(const std::string& strName, HTTPWorkPriority& priority);
+
+/** How a request is scheduled on the work queue */
+struct HTTPWorkClass
+{
+    HTTPWorkPriority priority;
+    //! What the work is counted as in the statistics and against nMaxConcurrent (e.g. the RPC method)
+    std::string name;
+    //! Most work items of this name that may run at once, or 0 for no limit
+    int nMaxConcurrent;
+
+    HTTPWorkClass(HTTPWorkPriority priorityIn = HTTP_PRIORITY_NORMAL, const std::string& nameIn = "", int nMaxConcurrentIn = 0) :
+        priority(priorityIn), name(nameIn), nMaxConcurrent(nMaxConcurrentIn) {}
+};
+
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** Decides how a request is scheduled. Runs on the event loop thread, so it must be quick. */
+typedef boost::function<HTTPWorkClass(HTTPRequest* req, const std::string &)> HTTPRequestClassifier;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. Requests are queued as normal priority work, unless a
+ * classifier is given.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier = HTTPRequestClassifier());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
@@ -56,6 +97,8 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Progress of a chunked reply, once started
+    std::shared_ptr<HTTPReplyStream> stream;
 
     // For test access
 protected:
@@ -91,6 +134,12 @@ public:
      */
     virtual std::pair<bool, std::string> GetHeader(const std::string& hdr);
 
+    /**
+     * Get the request body without consuming it, if it is at most nMaxSize
+     * bytes; returns false if it is larger.
+     */
+    bool PeekBody(std::string& strBody, size_t nMaxSize);
+
     /**
      * Read request body.
      *
@@ -115,8 +164,55 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body follows in pieces, sent with chunked transfer
+     * encoding (or until the connection closes, for HTTP/1.0 clients).
+     * Headers must have been written. Finish with EndChunkedReply.
+     */
+    void StartChunkedReply(int nStatus);
+
+    /**
+     * Send the next piece of a chunked reply. Waits while the client has
+     * more than MAX_HTTP_REPLY_BACKLOG bytes left to read, so memory stays
+     * bounded however large the reply. Returns false if the client went
+     * away or stopped reading for the server timeout; the caller should
+     * stop producing the reply then.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /** Finish a chunked reply. */
+    void EndChunkedReply();
 };
 
+/** Run func on one of the HTTP worker threads.
+ * Returns false if the work queue is full or the server is not running.
+ */
+bool HTTPRunOnWorker(const boost::function<void(void)>& func);
+
+/** Statistics of the work queue, for a priority class or a name */
+struct HTTPWorkStats
+{
+    //! Items waiting in the queue
+    size_t nQueued;
+    //! Items running now
+    int nRunning;
+    //! Items finished
+    uint64_t nDone;
+    //! Items rejected because the queue was full
+    uint64_t nRejected;
+    //! Total and longest time finished items waited in the queue, in microseconds
+    int64_t nWaitTime;
+    int64_t nMaxWaitTime;
+    //! Total time finished items ran, in microseconds
+    int64_t nRunTime;
+
+    HTTPWorkStats() : nQueued(0), nRunning(0), nDone(0), nRejected(0), nWaitTime(0), nMaxWaitTime(0), nRunTime(0) {}
+};
+
+/** Get the statistics of the work queue per priority class (indexed by HTTPWorkPriority) and per name */
+bool HTTPGetWorkStats(std::vector<HTTPWorkStats>& vClassStats, std::map<std::string, HTTPWorkStats>& mapNameStats);
+
 /** Event handler closure.
  */
 class HTTPClosure
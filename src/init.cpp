@@ -9,10 +9,14 @@
 
 #include "init.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "zeronode/activezeronode.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
+#include "blockfilter.h"
 #include "checkpoints.h"
+#include "compactblocks.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
@@ -26,19 +30,26 @@
 #include "mempool_limit.h"
 #include "zeronode/budget.h"
 #include "zeronode/payments.h"
+#include "zeronode/zeronode-sync.h"
 #include "zeronode/zeronodeconfig.h"
 #include "zeronode/zeronodeman.h"
 #include "metrics.h"
 #include "miner.h"
 #include "net.h"
+#include "netcompress.h"
+#include "proofcache.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
+#include "rpc/resultcache.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "zeronode/spork.h"
 #include "zeronode/sporkdb.h"
 #include "scheduler.h"
+#include "support/hugepages.h"
+#include "taskpool.h"
 #include "txdb.h"
+#include "stratum.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -49,6 +60,7 @@
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #include "wallet/asyncrpcoperation_saplingconsolidation.h"
+#include "wallet/asyncrpcoperation_saplingnotepool.h"
 #endif
 #include <stdint.h>
 #include <stdio.h>
@@ -88,6 +100,8 @@ ZCJoinSplit* pzcashParams = NULL;
 CWallet* pwalletMain = NULL;
 #endif
 bool fFeeEstimatesInitialized = false;
+//! Only dump the mempool once it has been loaded, so a failed start does not wipe mempool.dat
+static bool fDumpMempoolLater = false;
 
 #if ENABLE_ZMQ
 static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
@@ -97,6 +111,12 @@ static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
 static AMQPNotificationInterface* pAMQPNotificationInterface = NULL;
 #endif
 
+#ifdef ENABLE_WALLET
+//! Wallet note events of -zmqpubwalletnote and -amqppubwalletnote
+static boost::signals2::connection connWalletNoteZMQ;
+static boost::signals2::connection connWalletNoteAMQP;
+#endif
+
 #ifdef WIN32
 // Win32 LevelDB doesn't use file descriptors, and the ones used for
 // accessing block files don't count towards the fd_set size limit
@@ -115,6 +135,8 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** Seconds between the logs of the flushes still running at shutdown */
+static const int SHUTDOWN_PROGRESS_INTERVAL = 5;
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -174,7 +196,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -184,10 +205,100 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptHTTPRPC();
     InterruptRPC();
     InterruptREST();
+    InterruptHTTPMetrics();
     InterruptTorControl();
+    InterruptStratum();
     threadGroup.interrupt_all();
 }
 
+/**
+ * Flush tasks that do not depend on each other, run side by side at
+ * shutdown so that the slowest of them, rather than their sum, bounds the
+ * time taken. Each is logged as it finishes, and those still running are
+ * logged every few seconds.
+ */
+class CShutdownFlushes
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::set<std::string> setRunning;
+    boost::thread_group threads;
+    int64_t nStart;
+
+    void Run(const std::string& strName, const boost::function<void()>& func)
+    {
+        int64_t nTaskStart = GetTimeMillis();
+        try {
+            func();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, strName.c_str());
+        } catch (...) {
+            PrintExceptionContinue(NULL, strName.c_str());
+        }
+        LogPrintf("Shutdown: flushed %s in %dms\n", strName, GetTimeMillis() - nTaskStart);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        setRunning.erase(strName);
+        cond.notify_all();
+    }
+
+public:
+    CShutdownFlushes() : nStart(GetTimeMillis()) {}
+
+    void Add(const std::string& strName, const boost::function<void()>& func)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            setRunning.insert(strName);
+        }
+        threads.create_thread(boost::bind(&CShutdownFlushes::Run, this, strName, func));
+    }
+
+    void Wait()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!setRunning.empty()) {
+                if (!cond.timed_wait(lock, boost::posix_time::seconds(SHUTDOWN_PROGRESS_INTERVAL))) {
+                    std::string strRunning;
+                    BOOST_FOREACH(const std::string& strName, setRunning)
+                        strRunning += (strRunning.empty() ? "" : ", ") + strName;
+                    LogPrintf("Shutdown: still flushing %s after %ds\n", strRunning, (GetTimeMillis() - nStart) / 1000);
+                }
+            }
+        }
+        threads.join_all();
+        LogPrintf("Shutdown: flushes done in %dms\n", GetTimeMillis() - nStart);
+    }
+};
+
+static void WriteFeeEstimates()
+{
+    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (!est_fileout.IsNull())
+        mempool.WriteFeeEstimates(est_fileout);
+    else
+        LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+}
+
+static void FlushChainState()
+{
+    LOCK(cs_main);
+    if (pcoinsTip != NULL)
+        FlushStateToDisk();
+}
+
+/** Write the zeronode, budget and payment caches, so that an unclean stop loses little of them */
+static void DumpZeronodeCaches()
+{
+    if (!zeronodeSync.IsBlockchainSynced())
+        return;
+    DumpZeronodes();
+    DumpBudgets();
+    DumpZeronodePayments();
+}
+
 void Shutdown()
 {
     LogPrintf("%s: In progress...\n", __func__);
@@ -205,8 +316,10 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
     StopRPC();
     StopHTTPServer();
+    StopStratum();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
@@ -216,43 +329,65 @@ void Shutdown()
 #endif
     StopNode();
     StopTorControl();
-    DumpZeronodes();
-    DumpBudgets();
-    DumpZeronodePayments();
     UnregisterNodeSignals(GetNodeSignals());
+    // Deliver the outstanding notifications while the chain state is still there
+    GetValidationQueue().Stop();
+    // Parallel loops run on their calling threads from here on
+    GetTaskPool().Stop();
 
-    if (fFeeEstimatesInitialized)
+    // The files below are written independently of each other and of the
+    // chain state, so they are flushed at the same time
     {
-        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            mempool.WriteFeeEstimates(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+        CShutdownFlushes flushes;
+        flushes.Add("chainstate", &FlushChainState);
+        flushes.Add("zeronodes", &DumpZeronodes);
+        flushes.Add("budgets", &DumpBudgets);
+        flushes.Add("zeronode payments", &DumpZeronodePayments);
+        if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+            flushes.Add("mempool", &DumpMempool);
+        if (fFeeEstimatesInitialized)
+            flushes.Add("fee estimates", &WriteFeeEstimates);
+        flushes.Wait();
         fFeeEstimatesInitialized = false;
     }
 
     {
         LOCK(cs_main);
-        if (pcoinsTip != NULL) {
-            FlushStateToDisk();
-        }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsflusher;
+        pcoinsflusher = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete ptxindexdb;
+        ptxindexdb = NULL;
+        delete pexplorerdb;
+        pexplorerdb = NULL;
         delete pSporkDB;
         pSporkDB = NULL;
+        delete pSaplingFrontierDB;
+        pSaplingFrontierDB = NULL;
+        delete pcompactblocks;
+        pcompactblocks = NULL;
+        delete pblockfilterdb;
+        pblockfilterdb = NULL;
+        delete pchainstatsdb;
+        pchainstatsdb = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
 #endif
 
+#ifdef ENABLE_WALLET
+    connWalletNoteZMQ.disconnect();
+    connWalletNoteAMQP.disconnect();
+#endif
+
 #if ENABLE_ZMQ
     if (pzmqNotificationInterface) {
         UnregisterValidationInterface(pzmqNotificationInterface);
@@ -351,9 +486,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors have valid zk-SNARK proofs and signatures, and skip verifying them (0 to verify all, default: %s, testnet: %s)"),
+        Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-blockindexhashcheck=<n>", strprintf(_("Recompute at startup the hash of one in <n> fully validated block index entries; the hashes of entries not yet fully validated are always checked (0 = none, 1 = all, default: %u)"), DEFAULT_BLOCK_INDEX_HASH_CHECK));
+    strUsage += HelpMessageOpt("-blockmmapfiles=<n>", strprintf(_("Number of block files kept memory mapped for serving stored blocks and transactions (0 to read through stdio, default: %d)"), DEFAULT_BLOCK_MMAP_FILES));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
+    strUsage += HelpMessageOpt("-deferblockchecks", strprintf(_("Check the coin database against the blocks of -checklevel 3 and 4 after the RPC server is up, instead of before (default: %u)"), DEFAULT_DEFER_BLOCK_CHECKS));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "zero.conf"));
     if (mode == HMM_BITCOIND)
     {
@@ -364,27 +504,52 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbtune=<db>.<option>=<n>", _("Tune the LevelDB database <db> (blockindex, chainstate, saplingfrontiers, txindex or explorerindex). "
+        "<option> is blockcache or writebuffer (in megabytes, replacing their share of -dbcache), maxopenfiles, bloombits or compression (0 or 1). Can be specified multiple times"));
+    strUsage += HelpMessageOpt("-hugepages=<mode>", _("Back the coins cache, the block index and the Equihash solver with huge pages: off, transparent (ask the kernel for transparent huge pages) "
+        "or reserved (take pages set aside with vm.nr_hugepages, else as transparent) (default: off)"));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphanmemory=<n>", strprintf(_("Keep at most <n> kilobytes of unconnectable transactions in memory, and 1/%u of that from one peer (default: %u)"), ORPHAN_MEMORY_PEER_SHARE, DEFAULT_MAX_ORPHAN_MEMORY));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
+    strUsage += HelpMessageOpt("-blockprecheckthreads=<n>", strprintf(_("Set the number of threads verifying the proofs of blocks received ahead of the tip during initial block download (0 to %d, default: %d)"),
+        MAX_BLOCK_PRECHECK_THREADS, DEFAULT_BLOCK_PRECHECK_THREADS));
+    strUsage += HelpMessageOpt("-txprecheckthreads=<n>", strprintf(_("Set the number of threads verifying the proofs of shielded transactions relayed to the mempool (0 to %d, default: %d)"),
+        MAX_TX_PRECHECK_THREADS, DEFAULT_TX_PRECHECK_THREADS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Fill an empty chainstate from a snapshot written by dumptxoutset instead of connecting every block. "
+            "The block files and index of the snapshot block and its ancestors must already be present"));
+    strUsage += HelpMessageOpt("-fastsync=<file>", _("On a new node, download only headers until the block of a snapshot written by dumptxoutset, then load the snapshot and "
+            "download the blocks after it. The blocks before are never downloaded, so this implies -prune"));
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "zerod.pid"));
 #endif
-    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support unless -compactblockindex is set, and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-compactblockindex", strprintf(_("Maintain a flat file of compact Sapling blocks, used by the getcompactsaplingblocks rpc call and to rescan the wallet for Sapling notes in pruned blocks (default: %u)"), DEFAULT_COMPACTBLOCKINDEX));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of compact block filters (BIP 157), used by the getblockfilter rpc call and to serve light clients with -peerblockfilters (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-chainstatsindex", strprintf(_("Maintain cumulative fee, supply, shielded and zeronode payout statistics for every block, used by the getchainstats rpc call (default: %u)"), DEFAULT_CHAINSTATSINDEX));
+    strUsage += HelpMessageOpt("-headercache=<n>", strprintf(_("Keep the serialized headers of the last <n> connected blocks for answering getheaders requests (0 = disable, default: %u)"), DEFAULT_HEADER_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-recentblockcache=<n>", strprintf(_("Keep the most recently connected blocks in <n> MiB of memory for the wallet, RPC and peers (0 = disable, default: %u)"), DEFAULT_RECENT_BLOCK_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-txcache=<n>", strprintf(_("Keep the last <n> transactions read from the block files by getrawtransaction and the like (0 = disable, default: %u)"), DEFAULT_TX_CACHE_SIZE));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
+    strUsage += HelpMessageOpt("-reindexreaders=<n>", strprintf(_("Number of block files read ahead on separate threads during -reindex (1 to %d, default: %d)"),
+        MAX_REINDEX_READERS, DEFAULT_REINDEX_READERS));
+    strUsage += HelpMessageOpt("-saplingfrontierinterval=<n>", strprintf(_("Checkpoint the Sapling commitment tree every <n> blocks, used to rebuild wallet witnesses (0 = disable, default: %d)"),
+        DEFAULT_SAPLING_FRONTIER_INTERVAL));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-undocache=<n>", strprintf(_("Keep the undo data of the last <n> connected blocks in memory to speed up reorgs (default: %d)"), DEFAULT_UNDO_CACHE_BLOCKS));
 
     // strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
     // strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
     // strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
-    strUsage += HelpMessageOpt("-insightexplorer", strprintf(_("Maintain a full address, spent & timestamp indexes, used by insight explorer (default: %u)"), DEFAULT_SPENTINDEX));
+    strUsage += HelpMessageOpt("-insightexplorer", strprintf(_("Maintain a full address, spent & timestamp indexes, used by insight explorer. Enabling it on an existing node builds them in the background (default: %u)"), DEFAULT_SPENTINDEX));
     strUsage += HelpMessageOpt("-zindex", strprintf(_("Maintain extra statistics about shielded transactions and payments (default: %u)"), 0));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -402,13 +567,19 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
-    strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes, including buffers kept for reuse (default: %u)"), 1000));
     strUsage += HelpMessageOpt("-mempoolevictionmemoryminutes=<n>", strprintf(_("The number of minutes before allowing rejected transactions to re-enter the mempool. (default: %u)"), DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES));
     strUsage += HelpMessageOpt("-mempooltxcostlimit=<n>",strprintf(_("An upper bound on the maximum size in bytes of all transactions in the mempool. (default: %s)"), DEFAULT_MEMPOOL_TOTAL_COST_LIMIT));
+    strUsage += HelpMessageOpt("-taskpoolthreads=<n>", strprintf(_("Number of threads shared by parallel rescans, index reads and wallet loading (0 = one per core, up to %d, default: %d)"), MAX_TASK_POOL_THREADS, DEFAULT_TASK_POOL_THREADS));
+    strUsage += HelpMessageOpt("-taskpoolquota=<subsystem>:<n>", _("Let a subsystem use at most <n> of the shared task pool threads at once (validation, index, wallet, rpc or network; can be specified multiple times)"));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Number of threads running background tasks; with more than one, long maintenance tasks do not delay the periodic ones (1 to %d, default: %d)"), MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads to spread the handling of peers' messages over (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
+    strUsage += HelpMessageOpt("-p2pcompression", strprintf(_("Compress messages to and from whitelisted peers that also enable this (default: %u)"), DEFAULT_P2P_COMPRESSION));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with Bloom filters (default: %u)"), 1));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers (requires -blockfilterindex, default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     if (showDebug)
         strUsage += HelpMessageOpt("-enforcenodebloom", strprintf("Enforce minimum protocol version to limit use of Bloom filters (default: %u)", 0));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 8233, 18233));
@@ -424,6 +595,7 @@ std::string HelpMessage(HelpMessageMode mode)
 
 #ifdef ENABLE_WALLET
     strUsage += HelpMessageGroup(_("Wallet options:"));
+    strUsage += HelpMessageOpt("-asyncwallet", strprintf(_("Update the wallet from the notification queue instead of while blocks are connected; wallet RPC calls wait for the queue first (default: %u)"), DEFAULT_ASYNC_WALLET));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), 100));
     strUsage += HelpMessageOpt("-migration", _("Enable the Sprout to Sapling migration"));
@@ -431,6 +603,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-consolidation", _("Enable auto Sapling note consolidation"));
     strUsage += HelpMessageOpt("-consolidatesaplingaddress=<zaddr>", _("Specify Sapling Address to Consolidate. (default: all)"));
     strUsage += HelpMessageOpt("-consolidationtxfee", strprintf(_("Fee amount in Satoshis used send consolidation transactions. (default %i)"), DEFAULT_CONSOLIDATION_FEE));
+    strUsage += HelpMessageOpt("-consolidationthreads=<n>", strprintf(_("Set the number of threads generating consolidation proofs (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        1, MAX_CONSOLIDATION_THREADS, DEFAULT_CONSOLIDATION_THREADS));
+    strUsage += HelpMessageOpt("-consolidationmaxproofs=<n>", strprintf(_("Maximum number of proofs generated by each consolidation round (default: %u)"), DEFAULT_CONSOLIDATION_MAX_PROOFS));
+    strUsage += HelpMessageOpt("-notepool=<n>", strprintf(_("Keep <n> unspent Sapling notes of -notepoolvalue at -notepooladdress, ready for fast withdrawals (default: %u)"), DEFAULT_NOTE_POOL_SIZE));
+    strUsage += HelpMessageOpt("-notepooladdress=<zaddr>", _("Sapling address whose notes are split into the note pool"));
+    strUsage += HelpMessageOpt("-notepoolvalue=<amt>", strprintf(_("Value of each note in the note pool, in %s"), CURRENCY_UNIT));
     strUsage += HelpMessageOpt("-deletetx", _("Enable Old Transaction Deletion"));
     strUsage += HelpMessageOpt("-deleteinterval", strprintf(_("Delete transaction every <n> blocks during inital block download (default: %i)"), DEFAULT_TX_DELETE_INTERVAL));
     strUsage += HelpMessageOpt("-keeptxnum", strprintf(_("Keep the last <n> transactions (default: %i)"), DEFAULT_TX_RETENTION_LASTTX));
@@ -438,11 +616,20 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)",
             CURRENCY_UNIT, FormatMoney(CWallet::minTxFee.GetFeePerK())));
+    strUsage += HelpMessageOpt("-notedecryptthreads=<n>", strprintf(_("Set the number of threads used to trial decrypt shielded notes of new transactions (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        1, MAX_NOTE_DECRYPTION_THREADS, DEFAULT_NOTE_DECRYPTION_THREADS));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
         CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
+    strUsage += HelpMessageOpt("-provingthreads=<n>", strprintf(_("Set the number of transactions whose proofs are generated concurrently when the wallet creates several at once (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        1, MAX_PROVING_THREADS, DEFAULT_PROVING_THREADS));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-rescancheckpoint=<n>", strprintf(_("Record rescan progress in the wallet every <n> blocks, so an interrupted rescan resumes where it stopped (0 to disable, default: %u)"), DEFAULT_RESCAN_CHECKPOINT_INTERVAL));
+    strUsage += HelpMessageOpt("-rescanthreads=<n>", strprintf(_("Set the number of threads reading and decrypting blocks during a rescan (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        1, MAX_RESCAN_THREADS, DEFAULT_RESCAN_THREADS));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet.dat") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-saplingkeypool=<n>", strprintf(_("Keep <n> Sapling keys derived ahead in memory while the wallet is unlocked, for fast z_getnewaddress calls (default: %u)"), DEFAULT_SAPLING_KEYPOOL_SIZE));
     strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-shieldedonlyscan", strprintf(_("Only track shielded notes, skipping transparent script matching when scanning blocks (default: %u)"), DEFAULT_SHIELDED_ONLY_SCAN));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), 1));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-txexpirydelta", strprintf(_("Set the number of blocks after which a transaction that has not been mined will become invalid (min: %u, default: %u (pre-Blossom) or %u (post-Blossom))"), TX_EXPIRING_SOON_THRESHOLD + 1, DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA, DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA));
@@ -451,6 +638,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.zero"));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), true));
+    strUsage += HelpMessageOpt("-walletloadthreads=<n>", strprintf(_("Set the number of threads decoding wallet transactions on startup (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        1, MAX_WALLET_LOAD_THREADS, DEFAULT_WALLET_LOAD_THREADS));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
         " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -462,6 +651,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawtxbatch=<address>", _("Enable publish batches of raw transactions entering the mempool in <address>"));
+#ifdef ENABLE_WALLET
+    strUsage += HelpMessageOpt("-zmqpubwalletnote=<address>", _("Enable publish shielded notes of the wallet received, confirmed and spent in <address>"));
+#endif
 #endif
 
 #if ENABLE_PROTON
@@ -470,6 +663,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-amqppubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+#ifdef ENABLE_WALLET
+    strUsage += HelpMessageOpt("-amqppubwalletnote=<address>", _("Enable publish shielded notes of the wallet received, confirmed and spent in <address>"));
+#endif
+#endif
+
+#if ENABLE_ZMQ || ENABLE_PROTON
+    strUsage += HelpMessageOpt("-notificationhwm=<n>", strprintf(_("Drop notifications of transactions entering the mempool while more than <n> messages wait to be sent (default: %u)"), DEFAULT_NOTIFICATION_HWM));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -485,20 +685,27 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", 0));
         strUsage += HelpMessageOpt("-nuparams=hexBranchId:activationHeight", "Use given activation height for specified network upgrade (regtest-only)");
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, deletetx, estimatefee, http, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
-                             "rand, reindex, rpc, selectcoins, tor, zindex, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
+    string debugCategories = "addrman, alert, bench, coindb, db, deletetx, estimatefee, http, leveldb, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
+                             "rand, reindex, rpc, selectcoins, stratum, tor, zindex, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ".");
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-lockstats", strprintf(_("Count the acquisitions of every lock site and the time spent waiting for and holding the lock, for getlockstats (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
+        strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
+        strUsage += HelpMessageOpt("-maxproofcachesize=<n>", strprintf("Limit size of shielded proof cache to <n> MiB (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
+        strUsage += HelpMessageOpt("-maxnotifyqueue=<n>", strprintf("Let block validation run ahead of ZMQ, AMQP and -asyncwallet notifications by at most <n> callbacks (default: %u)", DEFAULT_MAX_NOTIFY_QUEUE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
         CURRENCY_UNIT, FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -528,6 +735,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockminsize=<n>", strprintf(_("Set minimum block size in bytes (default: %u)"), 0));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
+    strUsage += HelpMessageOpt("-fastblocktemplate", strprintf(_("Answer the first getblocktemplate on a new tip with a coinbase-only block, and fill in transactions on the next call (default: %u)"), DEFAULT_FAST_BLOCK_TEMPLATE));
     if (GetBoolArg("-help-debug", false))
         strUsage += HelpMessageOpt("-blockversion=<n>", strprintf("Override block version to test forking scenarios (default: %d)", (int)CBlock::CURRENT_VERSION));
 
@@ -536,6 +744,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-gen", strprintf(_("Generate coins (default: %u)"), 0));
     strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads for coin generation if enabled (-1 = all cores, default: %d)"), 1));
     strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolverthreads=<n>", strprintf(_("Number of threads sharing each solve of the \"tromp\" solver (default: %d)"), DEFAULT_EQUIHASH_SOLVER_THREADS));
     strUsage += HelpMessageOpt("-mineraddress=<addr>", _("Send mined coins to a specific single address"));
     strUsage += HelpMessageOpt("-minetolocalwallet", strprintf(
             _("Require that mined blocks use a coinbase address in the local wallet (default: %u)"),
@@ -547,17 +756,29 @@ std::string HelpMessage(HelpMessageMode mode)
             ));
 #endif
 
+    strUsage += HelpMessageGroup(_("Stratum server options:"));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Serve mining jobs to Equihash miners over Stratum (default: %u)"), DEFAULT_STRATUM));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", _("Bind the Stratum server to the given address, which has no authentication (default: 127.0.0.1)"));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Share difficulty, as a multiple of the minimum difficulty of the network (default: %d)"), DEFAULT_STRATUM_DIFFICULTY));
+
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-metricsendpoint", strprintf(_("Serve node metrics in the Prometheus text format at /metrics on the RPC port, without authentication (default: %u)"), 0));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 23811, 23812));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcbatchconcurrency=<n>", strprintf(_("Run up to <n> read-only calls of a JSON-RPC batch at the same time on the RPC threads (1 = one after another, default: %d)"), DEFAULT_RPC_BATCH_CONCURRENCY));
+    strUsage += HelpMessageOpt("-rpccachesize=<n>", strprintf(_("Keep up to <n> MiB of results of calls that only depend on the chain tip, such as getblockchaininfo and getblockhash, to answer repeated calls (0 = off, default: %d)"), DEFAULT_RPC_CACHE_SIZE));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcpriority=<method>:<class>", _("Queue calls of <method> as high, normal or low priority work. Low priority calls use at most half of the RPC threads, normal ones all but one. "
+        "This option can be specified multiple times (default: high for block production and relay calls, low for address and spent index queries)"));
+    strUsage += HelpMessageOpt("-rpcmethodlimit=<method>:<n>", _("Run at most <n> calls of <method> at the same time (0 = no limit). This option can be specified multiple times"));
     if (showDebug) {
-        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue of each priority class to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -604,6 +825,17 @@ struct CImportingNow
 // rev files since they'll be rewritten by the reindex anyway.  This ensures that vinfoBlockFile
 // is in sync with what's actually on disk by the time we start downloading, so that pruning
 // works correctly.
+/** Revalidate the entries of the zeronode and budget caches, which were loaded unchecked. */
+static void CheckZeronodeCaches()
+{
+    int64_t nStart = GetTimeMillis();
+    znodeman.CheckAndRemove(true);
+    budget.CheckAndRemove();
+    LogPrint("zeronode", "Checked the loaded zeronode and budget caches  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("zeronode", "  %s\n", znodeman.ToString());
+    LogPrint("zeronode", "  %s\n", budget.ToString());
+}
+
 void CleanupBlockRevFiles()
 {
     using namespace boost::filesystem;
@@ -647,18 +879,8 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     // -reindex
     if (fReindex) {
         CImportingNow imp;
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        int nReaders = std::max(1, std::min((int)GetArg("-reindexreaders", DEFAULT_REINDEX_READERS), MAX_REINDEX_READERS));
+        ReindexBlockFiles(chainparams, nReaders);
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -697,6 +919,11 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+    }
+    fDumpMempoolLater = !ShutdownRequested();
 }
 
 void ThreadNotifyRecentlyAdded()
@@ -715,6 +942,17 @@ void ThreadNotifyRecentlyAdded()
     }
 }
 
+/** Levels 3 and 4 of the startup verification, run once RPC is up with -deferblockchecks */
+void ThreadVerifyCoins()
+{
+    // The coins of blocks connected since startup may not have been flushed yet
+    if (!CVerifyDB().VerifyCoins(Params(), pcoinsTip, GetArg("-checklevel", 3), GetArg("-checkblocks", 288)) && !ShutdownRequested()) {
+        uiInterface.ThreadSafeMessageBox(_("Corrupted block database detected") + ".\n" + _("Please restart with -reindex to recover."),
+                                         "", CClientUIInterface::MSG_ERROR);
+        StartShutdown();
+    }
+}
+
 /** Sanity checks
  *  Ensure that Bitcoin is running in a usable environment with all
  *  necessary library support.
@@ -732,10 +970,9 @@ bool InitSanityCheck(void)
 }
 
 
-static void ZC_LoadParams(
-    const CChainParams& chainparams
-)
+static void ZC_LoadSaplingParams()
 {
+    RenameThread("zcash-loadparams");
     struct timeval tv_start, tv_end;
     float elapsed;
 
@@ -743,23 +980,6 @@ static void ZC_LoadParams(
     boost::filesystem::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
     boost::filesystem::path sprout_groth16 = ZC_GetParamsDir() / "sprout-groth16.params";
 
-    if (!(
-        boost::filesystem::exists(sapling_spend) &&
-        boost::filesystem::exists(sapling_output) &&
-        boost::filesystem::exists(sprout_groth16)
-    )) {
-        uiInterface.ThreadSafeMessageBox(strprintf(
-            _("Cannot find the Zero network parameters in the following directory:\n"
-              "%s\n"
-              "Please run 'zero-fetch-params' or './zcutil/fetch-params.sh' and then restart."),
-                ZC_GetParamsDir()),
-            "", CClientUIInterface::MSG_ERROR);
-        StartShutdown();
-        return;
-    }
-
-    pzcashParams = ZCJoinSplit::Prepared();
-
     static_assert(
         sizeof(boost::filesystem::path::value_type) == sizeof(codeunit),
         "librustzcash not configured correctly");
@@ -787,6 +1007,43 @@ static void ZC_LoadParams(
     gettimeofday(&tv_end, 0);
     elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
     LogPrintf("Loaded Sapling parameters in %fs seconds.\n", elapsed);
+    ZC_SetParamsLoaded();
+}
+
+/**
+ * Check that the parameter files exist and start loading them. Reading and
+ * hashing them takes a while, so it runs alongside the rest of startup
+ * (mostly loading the block index), and the first proof created or verified
+ * waits for it.
+ */
+static void ZC_LoadParams(
+    const CChainParams& chainparams,
+    boost::thread_group& threadGroup
+)
+{
+    boost::filesystem::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
+    boost::filesystem::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
+    boost::filesystem::path sprout_groth16 = ZC_GetParamsDir() / "sprout-groth16.params";
+
+    if (!(
+        boost::filesystem::exists(sapling_spend) &&
+        boost::filesystem::exists(sapling_output) &&
+        boost::filesystem::exists(sprout_groth16)
+    )) {
+        uiInterface.ThreadSafeMessageBox(strprintf(
+            _("Cannot find the Zero network parameters in the following directory:\n"
+              "%s\n"
+              "Please run 'zero-fetch-params' or './zcutil/fetch-params.sh' and then restart."),
+                ZC_GetParamsDir()),
+            "", CClientUIInterface::MSG_ERROR);
+        StartShutdown();
+        return;
+    }
+
+    pzcashParams = ZCJoinSplit::Prepared();
+
+    ZC_SetParamsLoading();
+    threadGroup.create_thread(&ZC_LoadSaplingParams);
 }
 
 bool AppInitServers(boost::thread_group& threadGroup)
@@ -801,6 +1058,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", false) && !StartREST())
         return false;
+    if (GetBoolArg("-metricsendpoint", false) && !StartHTTPMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -894,6 +1153,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
     fLogTimestamps = GetBoolArg("-logtimestamps", true);
     fLogIPs = GetBoolArg("-logips", false);
+    fLockStats = GetBoolArg("-lockstats", false);
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Zero version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
@@ -955,20 +1215,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
+#ifndef USE_POLL
+    // select() cannot wait on descriptors past FD_SETSIZE
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#endif
+    nMaxConnections = std::max(nMaxConnections, 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
     if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
         nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
 
+    // a fast sync never downloads the blocks up to its snapshot, so it runs pruned
+    if (mapArgs.count("-fastsync")) {
+        if (mapArgs.count("-loadsnapshot"))
+            return InitError(_("-fastsync and -loadsnapshot cannot be used together."));
+        if (SoftSetArg("-prune", itostr(MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024)))
+            LogPrintf("%s : parameter interaction: -fastsync -> setting -prune=%d\n", __func__, MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024);
+        else if (!GetArg("-prune", 0))
+            return InitError(_("-fastsync requires -prune."));
+    }
+
     // if using block pruning, then disable txindex
-    // also disable the wallet (for now, until SPV support is implemented in wallet)
+    // also disable the wallet, unless the compact block store is kept for rescanning pruned blocks
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", false))
             return InitError(_("Prune mode is incompatible with -txindex."));
 #ifdef ENABLE_WALLET
-        if (!GetBoolArg("-disablewallet", false)) {
+        if (!GetBoolArg("-disablewallet", false) && !GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX)) {
             if (SoftSetBoolArg("-disablewallet", true))
                 LogPrintf("%s : parameter interaction: -prune -> setting -disablewallet=1\n", __func__);
             else
@@ -1021,6 +1295,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
 
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid proofs and signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating proofs and signatures in all blocks (-assumevalid=0).\n");
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -1030,6 +1310,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nBlockPrecheckThreads = std::max(0, std::min((int)GetArg("-blockprecheckthreads", DEFAULT_BLOCK_PRECHECK_THREADS), MAX_BLOCK_PRECHECK_THREADS));
+    nTxPrecheckThreads = std::max(0, std::min((int)GetArg("-txprecheckthreads", DEFAULT_TX_PRECHECK_THREADS), MAX_TX_PRECHECK_THREADS));
+
+    BOOST_FOREACH(const std::string& strQuota, mapMultiArgs["-taskpoolquota"]) {
+        size_t nColon = strQuota.find(':');
+        TaskPoolClient client = TaskPoolClientFromName(strQuota.substr(0, nColon));
+        if (nColon == std::string::npos || client == TASKPOOL_CLIENT_COUNT)
+            return InitError(strprintf(_("Invalid -taskpoolquota=<subsystem>:<n>: '%s'"), strQuota));
+        GetTaskPool().SetQuota(client, atoi(strQuota.substr(nColon + 1)));
+    }
+
+    HugePageMode hugePageMode;
+    if (!ParseHugePageMode(GetArg("-hugepages", "off"), hugePageMode))
+        return InitError(strprintf(_("Invalid -hugepages mode: '%s'"), GetArg("-hugepages", "")));
+    SetHugePageMode(hugePageMode);
+    if (hugePageMode != HUGEPAGES_OFF)
+        LogPrintf("Using %s huge pages for the coins cache, the block index and the Equihash solver\n", HugePageModeName(hugePageMode));
+
+    SetMappedBlockFiles(GetArg("-blockmmapfiles", DEFAULT_BLOCK_MMAP_FILES));
+    SetUndoCacheBlocks(GetArg("-undocache", DEFAULT_UNDO_CACHE_BLOCKS));
+    recentBlocks.SetMaxSize(std::max((int64_t)0, GetArg("-recentblockcache", DEFAULT_RECENT_BLOCK_CACHE_SIZE)) * ((size_t)1 << 20));
+    recentHeaders.SetMaxEntries(std::max((int64_t)0, GetArg("-headercache", DEFAULT_HEADER_CACHE_SIZE)));
+    recentTransactions.SetMaxEntries(std::max((int64_t)0, GetArg("-txcache", DEFAULT_TX_CACHE_SIZE)));
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MB) to allot for block & undo files
@@ -1143,6 +1447,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-peerbloomfilters", true))
         nLocalServices |= NODE_BLOOM;
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("-peerblockfilters requires -blockfilterindex."));
+        nLocalServices |= NODE_COMPACT_FILTERS;
+    }
+
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
 #ifdef ENABLE_MINING
@@ -1206,10 +1516,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    // Pick the SHA-256 implementation before any thread hashes
+    std::string strSHA256Impl = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
+    // Size the verification caches before any script or proof is checked
+    InitSignatureCache();
+    InitProofCache();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Zero is shutting down."));
@@ -1243,6 +1560,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         OpenDebugLog();
 
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using SHA256 implementation %s\n", strSHA256Impl);
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -1254,15 +1572,40 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    // The parallel loops of rescans, index reads and wallet loading share these threads
+    int nTaskPoolThreads = GetArg("-taskpoolthreads", DEFAULT_TASK_POOL_THREADS);
+    if (nTaskPoolThreads <= 0)
+        nTaskPoolThreads = GetNumCores();
+    nTaskPoolThreads = std::min(nTaskPoolThreads, MAX_TASK_POOL_THREADS);
+    LogPrintf("Using %u threads for the shared task pool\n", nTaskPoolThreads);
+    GetTaskPool().Start(nTaskPoolThreads);
+
+    LogPrintf("Using %u threads for script and proof verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
-    // Start the lightweight task scheduler thread
+    if (nBlockPrecheckThreads) {
+        LogPrintf("Using %u threads to pre-check blocks received ahead of the tip\n", nBlockPrecheckThreads);
+        for (int i=0; i<nBlockPrecheckThreads; i++)
+            threadGroup.create_thread(&ThreadBlockPrecheck);
+    }
+
+    if (nTxPrecheckThreads) {
+        LogPrintf("Using %u threads to pre-check relayed shielded transactions\n", nTxPrecheckThreads);
+        for (int i=0; i<nTxPrecheckThreads; i++)
+            threadGroup.create_thread(&ThreadTxPrecheck);
+    }
+
+    // Start the lightweight task scheduler threads
+    int nSchedulerThreads = std::max(1, std::min((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), MAX_SCHEDULER_THREADS));
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+
+    // Start the thread delivering validation notifications to background listeners
+    GetValidationQueue().Start(std::max<int64_t>(1, GetArg("-maxnotifyqueue", DEFAULT_MAX_NOTIFY_QUEUE)));
 
     // Count uptime
     MarkStartTime();
@@ -1289,7 +1632,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     uiInterface.InitMessage(_("Initializing..."));
 
     // Initialize Zcash circuit parameters
-    ZC_LoadParams(chainparams);
+    ZC_LoadParams(chainparams, threadGroup);
 
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
@@ -1442,7 +1785,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     pzmqNotificationInterface = CZMQNotificationInterface::CreateWithArguments(mapArgs);
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        RegisterValidationInterface(pzmqNotificationInterface, true);
     }
 #endif
 
@@ -1457,7 +1800,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("AMQP support requires -experimentalfeatures."));
         }
 
-        RegisterValidationInterface(pAMQPNotificationInterface);
+        RegisterValidationInterface(pAMQPNotificationInterface, true);
     }
 #endif
 
@@ -1465,6 +1808,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fReindex = GetBoolArg("-reindex", false);
 
+    nSaplingFrontierInterval = GetArg("-saplingfrontierinterval", DEFAULT_SAPLING_FRONTIER_INTERVAL);
+    if (nSaplingFrontierInterval < 0)
+        return InitError(_("-saplingfrontierinterval must be 0 or greater"));
+
     // Upgrading to 0.8; hard-link the old blknnnn.dat files into /blocks/
     boost::filesystem::path blocksDir = GetDataDir() / "blocks";
     if (!boost::filesystem::exists(blocksDir))
@@ -1496,24 +1843,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
-    int64_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, (int64_t)1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    // Each index has a cache of its own
+    int64_t nTxIndexDBCache = 0;
+    if (GetBoolArg("-txindex", false))
+        nTxIndexDBCache = nTotalCache / 8;
+    int64_t nExplorerDBCache = 0;
 
     // https://github.com/bitpay/bitcoin/commit/c91d78b578a8700a45be936cb5bb0931df8f4b87#diff-c865a8939105e6350a50af02766291b7R1233
     if (GetBoolArg("-insightexplorer", false)) {
         if (!GetBoolArg("-txindex", false)) {
             return InitError(_("-insightexplorer requires -txindex."));
         }
-        // increase cache if additional indices are needed
-        nBlockTreeDBCache = nTotalCache * 3 / 4;
+        nExplorerDBCache = nTotalCache * 5 / 8;
     }
-    nTotalCache -= nBlockTreeDBCache;
+    nTotalCache -= nBlockTreeDBCache + nTxIndexDBCache + nExplorerDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nTxIndexDBCache)
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexDBCache * (1.0 / 1024 / 1024));
+    if (nExplorerDBCache)
+        LogPrintf("* Using %.1fMiB for explorer index database\n", nExplorerDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
@@ -1531,16 +1884,51 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsflusher;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete ptxindexdb;
+                ptxindexdb = NULL;
+                delete pexplorerdb;
+                pexplorerdb = NULL;
                 delete pSporkDB;
+                delete pSaplingFrontierDB;
+                delete pcompactblocks;
+                pcompactblocks = NULL;
+                delete pblockfilterdb;
+                pblockfilterdb = NULL;
+                delete pchainstatsdb;
+                pchainstatsdb = NULL;
 
                 pSporkDB = new CSporkDB(0, false, false);
+                pSaplingFrontierDB = new CSaplingFrontierDB(0, false, fReindex);
+                if (GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX)) {
+                    pcompactblocks = new CCompactBlockStore(GetDataDir() / "compactblocks", fReindex);
+                    if (!pcompactblocks->IsOpen()) {
+                        strLoadError = _("Error opening compact block store");
+                        break;
+                    }
+                }
+                if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+                    pblockfilterdb = new CBlockFilterDB(0, false, fReindex);
+                if (GetBoolArg("-chainstatsindex", DEFAULT_CHAINSTATSINDEX))
+                    pchainstatsdb = new CChainStatsDB(0, false, fReindex);
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                if (nTxIndexDBCache)
+                    ptxindexdb = new CTxIndexDB(nTxIndexDBCache, false, fReindex);
+                if (nExplorerDBCache)
+                    pexplorerdb = new CExplorerIndexDB(nExplorerDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsflusher = new CCoinsViewFlusher(pcoinscatcher, pcoinsdbview);
+                pcoinsTip = new CCoinsViewCache(pcoinsflusher);
+                pcoinsTip->SetCounters(&coinsTipCounters);
+
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1558,6 +1946,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (mapArgs.count("-loadsnapshot") && !fReindex && pcoinsdbview->GetBestBlock().IsNull()) {
+                    uiInterface.InitMessage(_("Loading chainstate snapshot..."));
+                    if (!LoadChainstateSnapshot(GetArg("-loadsnapshot", ""), *pcoinsdbview, strLoadError))
+                        break;
+                    // Load the block index again so the tip is set from the snapshot
+                    UnloadBlockIndex();
+                    delete pcoinsTip;
+                    pcoinsTip = new CCoinsViewCache(pcoinsflusher);
+                    pcoinsTip->SetCounters(&coinsTipCounters);
+                    if (!LoadBlockIndex()) {
+                        strLoadError = _("Error loading block database");
+                        break;
+                    }
+                }
+
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
@@ -1569,6 +1972,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // A fast sync that was stopped before its snapshot was activated starts again
+                if (mapArgs.count("-fastsync") && chainActive.Height() == 0) {
+                    LOCK(cs_main);
+                    if (!SetFastSyncSnapshot(GetArg("-fastsync", ""), strLoadError))
+                        break;
+                    if (!ActivateFastSyncSnapshot(chainparams)) {
+                        strLoadError = _("Error loading chainstate snapshot");
+                        break;
+                    }
+                }
+
                 // Check for changed -txindex state
                 if (fTxIndex != GetBoolArg("-txindex", false)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
@@ -1576,6 +1990,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 }
 
                 // Check for changed -insightexplorer state
+                // Turning on -insightexplorer builds the indexes in the background
+                if (!fInsightExplorer && GetBoolArg("-insightexplorer", false) && !fHavePruned) {
+                    LOCK(cs_main);
+                    if (!StartExplorerIndexBuild()) {
+                        strLoadError = _("Error enabling the explorer indexes");
+                        break;
+                    }
+                }
                 if (fInsightExplorer != GetBoolArg("-insightexplorer", false)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -insightexplorer");
                     break;
@@ -1606,7 +2028,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
                         MIN_BLOCKS_TO_KEEP, GetArg("-checkblocks", 288));
                 }
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", 3),
+                int nCheckLevel = GetArg("-checklevel", 3);
+                if (GetBoolArg("-deferblockchecks", DEFAULT_DEFER_BLOCK_CHECKS))
+                    nCheckLevel = std::min(nCheckLevel, 2);
+                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, nCheckLevel,
                               GetArg("-checkblocks", 288))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
@@ -1649,6 +2074,38 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
+    if (GetHugePageMode() != HUGEPAGES_OFF) {
+        CHugePageUsage hugePageUsage = GetHugePageUsage();
+        LogPrintf("Huge pages: %u MiB mapped, %u MiB reserved, %u MiB transparent, %u reserved mappings refused\n",
+            hugePageUsage.nMapped >> 20, hugePageUsage.nReserved >> 20, hugePageUsage.nTransparent >> 20, hugePageUsage.nReservedFailures);
+    }
+
+    if (pcompactblocks) {
+        uiInterface.InitMessage(_("Building compact blocks..."));
+        LOCK(cs_main);
+        if (!SyncCompactBlockStore(*pcompactblocks, chainActive, chainparams.GetConsensus()))
+            return InitError(fHavePruned ? _("Error building compact block store: blocks have already been pruned, you need to rebuild the database using -reindex")
+                                         : _("Error building compact block store"));
+    }
+
+    if (pblockfilterdb) {
+        uiInterface.InitMessage(_("Building block filters..."));
+        LOCK(cs_main);
+        if (!SyncBlockFilterIndex(chainActive, chainparams.GetConsensus()))
+            return InitError(fHavePruned ? _("Error building block filter index: blocks have already been pruned, you need to rebuild the database using -reindex")
+                                         : _("Error building block filter index"));
+    }
+
+    if (pchainstatsdb) {
+        uiInterface.InitMessage(_("Building chain statistics..."));
+        LOCK(cs_main);
+        if (!SyncChainStatsIndex(chainActive, chainparams.GetConsensus()))
+            return InitError(fHavePruned ? _("Error building chain statistics index: blocks have already been pruned, you need to rebuild the database using -reindex")
+                                         : _("Error building chain statistics index"));
+    }
+
+    if (fExplorerIndexBuilding)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "explorerindex", &ThreadBuildExplorerIndex));
 
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
@@ -1684,6 +2141,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
         uiInterface.InitMessage(_("Loading wallet..."));
 
+        fShieldedOnlyScan = GetBoolArg("-shieldedonlyscan", DEFAULT_SHIELDED_ONLY_SCAN);
+
+        // -walletloadthreads=0 means autodetect
+        nWalletLoadThreads = GetArg("-walletloadthreads", DEFAULT_WALLET_LOAD_THREADS);
+        if (nWalletLoadThreads <= 0)
+            nWalletLoadThreads += GetNumCores();
+        if (nWalletLoadThreads < 1)
+            nWalletLoadThreads = 1;
+        else if (nWalletLoadThreads > MAX_WALLET_LOAD_THREADS)
+            nWalletLoadThreads = MAX_WALLET_LOAD_THREADS;
+
         nStart = GetTimeMillis();
         bool fFirstRun = true;
         pwalletMain = new CWallet(strWalletFile);
@@ -1745,6 +2213,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         fConsolidationTxFee  = GetArg("-consolidationtxfee", DEFAULT_CONSOLIDATION_FEE);
         fConsolidationMapUsed = !mapMultiArgs["-consolidatesaplingaddress"].empty();
 
+        // -consolidationthreads=0 means autodetect
+        nConsolidationThreads = GetArg("-consolidationthreads", DEFAULT_CONSOLIDATION_THREADS);
+        if (nConsolidationThreads <= 0)
+            nConsolidationThreads += GetNumCores();
+        if (nConsolidationThreads < 1)
+            nConsolidationThreads = 1;
+        else if (nConsolidationThreads > MAX_CONSOLIDATION_THREADS)
+            nConsolidationThreads = MAX_CONSOLIDATION_THREADS;
+
+        nConsolidationMaxProofs = GetArg("-consolidationmaxproofs", DEFAULT_CONSOLIDATION_MAX_PROOFS);
+        if (nConsolidationMaxProofs < 3)
+            return InitError(_("-consolidationmaxproofs must be at least 3"));
+
         //Validate Sapling Addresses
         vector<string>& vaddresses = mapMultiArgs["-consolidatesaplingaddress"];
         for (int i = 0; i < vaddresses.size(); i++) {
@@ -1755,6 +2236,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             }
         }
 
+        //Set the withdrawal note pool
+        nSaplingNotePoolSize = GetArg("-notepool", DEFAULT_NOTE_POOL_SIZE);
+        if (nSaplingNotePoolSize > 0) {
+            auto zAddress = DecodePaymentAddress(GetArg("-notepooladdress", ""));
+            if (boost::get<libzcash::SaplingPaymentAddress>(&zAddress) == nullptr) {
+                return InitError(_("-notepool requires -notepooladdress to be a Sapling address"));
+            }
+            saplingNotePoolAddress = boost::get<libzcash::SaplingPaymentAddress>(zAddress);
+            if (!ParseMoney(GetArg("-notepoolvalue", ""), nSaplingNotePoolValue) || nSaplingNotePoolValue <= 0 || !MoneyRange(nSaplingNotePoolValue)) {
+                return InitError(strprintf(_("Invalid amount for -notepoolvalue=<amount>: '%s'"), GetArg("-notepoolvalue", "")));
+            }
+            LogPrintf("Keeping %d notes of %s in the note pool\n", nSaplingNotePoolSize, FormatMoney(nSaplingNotePoolValue));
+        }
+
         //Set Transaction Deletion Options
         fTxDeleteEnabled = GetBoolArg("-deletetx", false);
         fTxConflictDeleteEnabled = GetBoolArg("-deleteconflicttx", true);
@@ -1767,6 +2262,35 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (fKeepLastNTransactions < 1)
           return InitError("keeptxnum must be greater than 0");
 
+        // -rescanthreads=0 means autodetect
+        nRescanThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+        if (nRescanThreads <= 0)
+            nRescanThreads += GetNumCores();
+        if (nRescanThreads < 1)
+            nRescanThreads = 1;
+        else if (nRescanThreads > MAX_RESCAN_THREADS)
+            nRescanThreads = MAX_RESCAN_THREADS;
+
+        nRescanCheckpointInterval = std::max(0, (int)GetArg("-rescancheckpoint", DEFAULT_RESCAN_CHECKPOINT_INTERVAL));
+
+        // -notedecryptthreads=0 means autodetect
+        nNoteDecryptionThreads = GetArg("-notedecryptthreads", DEFAULT_NOTE_DECRYPTION_THREADS);
+        if (nNoteDecryptionThreads <= 0)
+            nNoteDecryptionThreads += GetNumCores();
+        if (nNoteDecryptionThreads < 1)
+            nNoteDecryptionThreads = 1;
+        else if (nNoteDecryptionThreads > MAX_NOTE_DECRYPTION_THREADS)
+            nNoteDecryptionThreads = MAX_NOTE_DECRYPTION_THREADS;
+
+        // -provingthreads=0 means autodetect
+        nProvingThreads = GetArg("-provingthreads", DEFAULT_PROVING_THREADS);
+        if (nProvingThreads <= 0)
+            nProvingThreads += GetNumCores();
+        if (nProvingThreads < 1)
+            nProvingThreads = 1;
+        else if (nProvingThreads > MAX_PROVING_THREADS)
+            nProvingThreads = MAX_PROVING_THREADS;
+
         fDeleteTransactionsAfterNBlocks = GetArg("-keeptxfornblocks", DEFAULT_TX_RETENTION_BLOCKS);
         if (fDeleteTransactionsAfterNBlocks < 1)
           return InitError("keeptxfornblocks must be greater than 0");
@@ -1792,10 +2316,36 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf("%s", strErrors.str());
         LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
-        RegisterValidationInterface(pwalletMain);
+        RegisterValidationInterface(pwalletMain, GetBoolArg("-asyncwallet", DEFAULT_ASYNC_WALLET));
+
+#if ENABLE_ZMQ
+        if (pzmqNotificationInterface && pzmqNotificationInterface->WantsWalletNotes()) {
+            connWalletNoteZMQ = pwalletMain->NotifyNoteChanged.connect([](CWallet*, const CWalletNoteEvent& event) {
+                pzmqNotificationInterface->NotifyWalletNote(event.ToJSON());
+            });
+        }
+#endif
+#if ENABLE_PROTON
+        if (pAMQPNotificationInterface && pAMQPNotificationInterface->WantsWalletNotes()) {
+            connWalletNoteAMQP = pwalletMain->NotifyNoteChanged.connect([](CWallet*, const CWalletNoteEvent& event) {
+                pAMQPNotificationInterface->NotifyWalletNote(event.ToJSON());
+            });
+        }
+#endif
 
         CBlockIndex *pindexRescan = chainActive.Tip();
-        if (clearWitnessCaches || GetBoolArg("-rescan", false))
+        // Where an interrupted rescan got to; its transactions and witnesses
+        // were written along with it
+        CBlockIndex *pindexResume = NULL;
+        {
+            CWalletDB walletdb(strWalletFile);
+            CBlockLocator locator;
+            if (clearWitnessCaches)
+                walletdb.EraseRescanProgress();
+            else if (walletdb.ReadRescanProgress(locator))
+                pindexResume = FindForkInGlobalIndex(chainActive, locator);
+        }
+        if (clearWitnessCaches || (GetBoolArg("-rescan", false) && !pindexResume))
         {
             pwalletMain->ClearNoteWitnessCache();
             pindexRescan = chainActive.Genesis();
@@ -1808,8 +2358,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pindexRescan = FindForkInGlobalIndex(chainActive, locator);
             else
                 pindexRescan = chainActive.Genesis();
+            if (pindexResume && (GetBoolArg("-rescan", false) || !pindexRescan || pindexResume->nHeight < pindexRescan->nHeight)) {
+                LogPrintf("Resuming the interrupted rescan from block %i\n", pindexResume->nHeight);
+                pindexRescan = pindexResume;
+            }
         }
-        if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
+        // A resumed rescan runs even from the tip, to finish the witness caches
+        if (chainActive.Tip() && (chainActive.Tip() != pindexRescan || pindexRescan == pindexResume))
         {
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
@@ -1935,8 +2490,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
 	uiInterface.InitMessage(_("Loading zeronode cache..."));
 
+    // The entries are used as saved and checked in the background once the node runs
+    // (see CheckZeronodeCaches), as checking every collateral holds up the start
     CZeronodeDB zndb;
-    CZeronodeDB::ReadResult readResult = zndb.Read(znodeman);
+    CZeronodeDB::ReadResult readResult = zndb.Read(znodeman, true);
     if (readResult == CZeronodeDB::FileError)
         LogPrintf("Missing zeronode cache file - zncache.dat, will try to recreate\n");
     else if (readResult != CZeronodeDB::Ok) {
@@ -1950,7 +2507,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     uiInterface.InitMessage(_("Loading budget cache..."));
 
     CBudgetDB budgetdb;
-    CBudgetDB::ReadResult readResult2 = budgetdb.Read(budget);
+    CBudgetDB::ReadResult readResult2 = budgetdb.Read(budget, true);
 
     if (readResult2 == CBudgetDB::FileError)
         LogPrintf("Missing budget cache - budget.dat, will try to recreate\n");
@@ -2070,6 +2627,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     */
 
     threadGroup.create_thread(boost::bind(&ThreadCheckObfuScationPool));
+    RegisterValidationInterface(&znodeman);
+    scheduler.scheduleFromNow(&CheckZeronodeCaches, 0, CScheduler::PRIORITY_NORMAL, "zeronodecaches");
 
     // ********************************************************* Step 11: start node
 
@@ -2088,6 +2647,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("mapAddressBook.size() = %u\n",  pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
 #endif
 
+#ifdef ENABLE_WALLET
+    // Balance queries are served from this snapshot until the wallet changes
+    if (pwalletMain && !IsInitialBlockDownload(chainparams))
+        pwalletMain->UpdateBalanceSnapshot();
+#endif
+
     // Start the thread that notifies listeners of transactions that have been
     // recently added to the mempool.
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "txnotify", &ThreadNotifyRecentlyAdded));
@@ -2095,12 +2660,29 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
+    if (GetBoolArg("-stratum", DEFAULT_STRATUM) && !StartStratum())
+        return InitError(_("Unable to start the Stratum server. See debug log for details."));
+
     StartNode(threadGroup, scheduler);
 
     // Monitor the chain every minute, and alert if we get blocks much quicker or slower than expected.
     CScheduler::Function f = boost::bind(&PartitionCheck, &IsInitialBlockDownload,
                                          boost::ref(cs_main), boost::cref(pindexBestHeader));
-    scheduler.scheduleEvery(f, 60);
+    scheduler.scheduleEvery(f, 60, CScheduler::PRIORITY_HIGH, "partitioncheck");
+
+    // Keep the zeronode caches on disk fresh, rather than only writing them at shutdown
+    scheduler.scheduleEvery(&DumpZeronodeCaches, ZERONODES_DUMP_SECONDS, CScheduler::PRIORITY_LOW, "dumpzeronodes");
+
+#ifdef ENABLE_WALLET
+    // Prune old wallet transactions in bounded chunks off the block connection path
+    if (pwalletMain && fTxDeleteEnabled)
+        scheduler.scheduleEvery(boost::bind(&CWallet::RunPendingTransactionDeletion, pwalletMain), 1,
+                                CScheduler::PRIORITY_LOW, "txdeletion");
+    // Derive Sapling keys ahead of z_getnewaddress
+    if (pwalletMain && GetArg("-saplingkeypool", DEFAULT_SAPLING_KEYPOOL_SIZE) > 0)
+        scheduler.scheduleEvery(boost::bind(&CWallet::TopUpSaplingKeyPool, pwalletMain, 0), 1,
+                                CScheduler::PRIORITY_LOW, "saplingkeypool");
+#endif
 
 #ifdef ENABLE_MINING
     // Generate coins in the background
@@ -2112,6 +2694,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
+    if (GetBoolArg("-deferblockchecks", DEFAULT_DEFER_BLOCK_CHECKS) && GetArg("-checklevel", 3) >= 3)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "verifydb", &ThreadVerifyCoins));
+
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
         // Add wallet transactions that aren't already in a block to mapTransactions
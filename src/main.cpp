@@ -10,25 +10,36 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
+#include "blockfilter.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "compactblocks.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
+#include "crypto/common.h"
 #include "deprecation.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "zeronode/budget.h"
 #include "zeronode/payments.h"
 #include "zeronode/zeronodeman.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
+#include "netcompress.h"
 #include "zeronode/obfuscation.h"
+#include "perfstats.h"
 #include "pow.h"
+#include "proofcache.h"
 #include "zeronode/spork.h"
 #include "zeronode/sporkdb.h"
 #include "zeronode/swifttx.h"
 #include "txdb.h"
+#include "trace.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "undo.h"
@@ -40,6 +51,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -64,26 +76,43 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+uint64_t nBlockIndexGeneration = 0;
+std::set<CBlockIndex*> setChainTips;
+/** Storage of the mapBlockIndex entries */
+static CBlockIndexArena blockIndexArena;
+/** Taken exclusively, with cs_main held, to add or remove mapBlockIndex entries; shared by LookupBlockIndex */
+static boost::shared_mutex cs_mapBlockIndex;
 CChain chainActive;
+/** Replaced under cs_main whenever chainActive changes */
+static std::shared_ptr<const CChainSnapshot> pchainSnapshot = std::make_shared<const CChainSnapshot>();
+static CCriticalSection cs_chainSnapshot;
 CBlockIndex *pindexBestHeader = NULL;
 static int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nBlockPrecheckThreads = 0;
+int nTxPrecheckThreads = 0;
 bool fExperimentalMode = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+int nSaplingFrontierInterval = DEFAULT_SAPLING_FRONTIER_INTERVAL;
 bool fZindex = false;
 bool fInsightExplorer = false;  // insightexplorer
 bool fAddressIndex = false;     // insightexplorer
 bool fSpentIndex = false;       // insightexplorer
 bool fTimestampIndex = false;   // insightexplorer
+bool fNoteIndex = false;        // insightexplorer
+bool fExplorerIndexBuilding = false;
+//! While the explorer indexes are built in the background, the last block they cover
+static const CBlockIndex* pindexExplorerBest = NULL;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
+uint256 hashAssumeValid;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -102,9 +131,25 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    //! Approximate memory used by the orphan, counted against the limits
+    size_t nUsage;
+    //! Position in vOrphanList
+    size_t nListPos;
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
+/** Salted hash of an outpoint: peers choose the outpoints orphans spend */
+struct COrphanOutPointHasher
+{
+    CCoinsKeyHasher hasher;
+    size_t operator()(const COutPoint& out) const { return hasher(out.hash) + out.n; }
+};
+boost::unordered_map<uint256, COrphanTx, CCoinsKeyHasher> mapOrphanTransactions GUARDED_BY(cs_main);
+//! The orphans spending each outpoint
+boost::unordered_map<COutPoint, std::vector<uint256>, COrphanOutPointHasher> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+//! The orphans in no particular order, to evict a random one in constant time
+std::vector<uint256> vOrphanList GUARDED_BY(cs_main);
+//! Memory used by the orphans of each peer that has any
+std::map<NodeId, size_t> mapOrphanPeerUsage GUARDED_BY(cs_main);
+size_t nOrphanUsage GUARDED_BY(cs_main) = 0;
 map<uint256, int64_t> mapRejectedBlocks  GUARDED_BY(cs_main);;
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -180,6 +225,8 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Finalized block files whose fsync waits for the next flush of the block index */
+    std::set<int> setUnsyncedBlockFiles;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -231,18 +278,30 @@ namespace {
         int64_t nTime;           //!< Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //!< Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //!< The timeout for this block request (for disconnecting a slow peer)
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock; //!< Set while the block is rebuilt from a "cmpctblock"
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
+    /** Peers we asked to announce new blocks with "cmpctblock", oldest first. Protected by cs_main. */
+    std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
+    /**
+     * Equihash solutions of the entries added since the block index was last
+     * written; the others are read back from pblocktree when a header is
+     * needed. Headers are built without cs_main, hence a lock of its own.
+     */
+    CCriticalSection cs_blockSolutions;
+    std::map<const CBlockIndex*, std::vector<unsigned char> > mapBlockSolutions;
+
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
 } // anon namespace
@@ -294,6 +353,25 @@ struct CNodeState {
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer wants new blocks announced with "cmpctblock" instead of "inv".
+    bool fPreferHeaderAndIDs;
+    //! Whether this peer can send and reconstruct compact blocks (it sent a "sendcmpct" we understand).
+    bool fProvidesHeaderAndIDs;
+    //! How many blocks may be in flight from this peer, sized from its measured throughput.
+    int nBlocksInFlightLimit;
+    //! Blocks and bytes received from this peer that we had asked it for.
+    uint64_t nBlocksDownloaded;
+    uint64_t nBlockBytesDownloaded;
+    //! Blocks taken away from this peer because they held up the download window.
+    uint64_t nBlocksReassigned;
+    //! When the last block we asked this peer for arrived (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+    //! Moving averages, in microseconds, of the time from request to receipt
+    //! and of the time the peer spent on each block once it was next in line.
+    double dAvgBlockLatency;
+    double dAvgBlockServiceTime;
+    //! Moving average of the bytes per second the peer delivered blocks at.
+    double dAvgDownloadRate;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -307,6 +385,16 @@ struct CNodeState {
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
+        fPreferHeaderAndIDs = false;
+        fProvidesHeaderAndIDs = false;
+        nBlocksInFlightLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlocksDownloaded = 0;
+        nBlockBytesDownloaded = 0;
+        nBlocksReassigned = 0;
+        nLastBlockReceived = 0;
+        dAvgBlockLatency = 0;
+        dAvgBlockServiceTime = 0;
+        dAvgDownloadRate = 0;
     }
 };
 
@@ -365,16 +453,60 @@ void FinalizeNode(NodeId nodeid) {
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
 
+/** Fold a block delivered by the peer it was requested from into the peer's download statistics. */
+void UpdateBlockDownloadStats(CNodeState* state, const QueuedBlock& entry, size_t nBlockBytes)
+{
+    static const double dAlpha = 0.2;
+    int64_t nNow = GetTimeMicros();
+    double dLatency = std::max<int64_t>(nNow - entry.nTime, 0);
+    // With several blocks queued, the peer only started on this one once
+    // the previous one arrived
+    double dServiceTime = std::max<int64_t>(nNow - std::max(entry.nTime, state->nLastBlockReceived), 1000);
+    double dRate = nBlockBytes * 1000000.0 / dServiceTime;
+    if (state->nBlocksDownloaded == 0) {
+        state->dAvgBlockLatency = dLatency;
+        state->dAvgBlockServiceTime = dServiceTime;
+        state->dAvgDownloadRate = dRate;
+    } else {
+        state->dAvgBlockLatency += dAlpha * (dLatency - state->dAvgBlockLatency);
+        state->dAvgBlockServiceTime += dAlpha * (dServiceTime - state->dAvgBlockServiceTime);
+        state->dAvgDownloadRate += dAlpha * (dRate - state->dAvgDownloadRate);
+    }
+    state->nLastBlockReceived = nNow;
+    state->nBlocksDownloaded++;
+    state->nBlockBytesDownloaded += nBlockBytes;
+}
+
+/**
+ * Size a peer's download window so it covers its round trip plus
+ * BLOCK_DOWNLOAD_BUFFER_SECONDS of blocks at the rate it has been
+ * delivering them. Until a few blocks have arrived the fixed
+ * MAX_BLOCKS_IN_TRANSIT_PER_PEER is used.
+ */
+int GetBlocksInFlightLimit(const CNodeState* state, int64_t nPingUsecTime)
+{
+    if (state->nBlocksDownloaded < (uint64_t)MIN_BLOCKS_IN_TRANSIT_PER_PEER)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    double dHorizon = std::max<int64_t>(nPingUsecTime, 0) + BLOCK_DOWNLOAD_BUFFER_SECONDS * 1000000.0;
+    double dLimit = std::ceil(dHorizon / std::max(state->dAvgBlockServiceTime, 1.0));
+    return (int)std::max<double>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<double>(MAX_BLOCKS_IN_TRANSIT_PER_PEER_ADAPTIVE, dLimit));
+}
+
 // Requires cs_main.
-// Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// Returns a bool indicating whether we requested this block. When the
+// block arrived from nodeFrom and that is who we asked, its size and
+// timing go into the peer's download statistics.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1, size_t nBlockBytes = 0) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nodeFrom != -1 && nodeFrom == itInFlight->second.first)
+            UpdateBlockDownloadStats(state, *itInFlight->second.second, nBlockBytes);
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -387,7 +519,8 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// Returns the new entry in the peer's list of blocks in flight.
+list<QueuedBlock>::iterator MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
@@ -402,6 +535,40 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    return it;
+}
+
+/**
+ * Ask a peer that just gave us a new block to announce the next ones with
+ * "cmpctblock" (BIP152 high-bandwidth mode). Only the last
+ * MAX_CMPCTBLOCK_HB_PEERS such peers are kept; the oldest is told to go back
+ * to announcing with "inv". Requires cs_main.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom)
+{
+    CNodeState* nodestate = State(pfrom->GetId());
+    if (!nodestate || !nodestate->fProvidesHeaderAndIDs)
+        return;
+    for (std::list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
+        if (*it == pfrom->GetId()) {
+            lNodesAnnouncingHeaderAndIDs.erase(it);
+            lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+            return;
+        }
+    }
+    if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_CMPCTBLOCK_HB_PEERS) {
+        NodeId nodeStop = lNodesAnnouncingHeaderAndIDs.front();
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            if (pnode->GetId() == nodeStop) {
+                pnode->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+                break;
+            }
+        }
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+    }
+    pfrom->PushMessage("sendcmpct", true, CMPCTBLOCKS_VERSION);
+    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
 }
 
 /** Check whether the last unknown block a peer advertized is not yet known. */
@@ -457,8 +624,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If the window cannot move, nodeStaller is set to the peer holding it up
+ *  and *ppindexStalled to the block it has not delivered yet. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex** ppindexStalled = NULL) {
     if (count == 0)
         return;
 
@@ -494,6 +662,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -525,6 +694,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        if (ppindexStalled)
+                            *ppindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -535,11 +706,43 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
 }
 
+/**
+ * Move the block holding up the download window from the peer it was asked
+ * from to nodeid, which has room for more, once it has been outstanding for
+ * BLOCK_STALLING_REASSIGN_MS and twice the staller's usual latency, unless
+ * nodeid is known to be slower. The staller's stall timer is cleared, so it
+ * is only disconnected if no other peer can take the block either.
+ */
+bool ReassignStalledBlock(NodeId nodeid, NodeId nodeStaller, CBlockIndex* pindex, int64_t nNow, const Consensus::Params& consensusParams)
+{
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(pindex->GetBlockHash());
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeStaller)
+        return false;
+    const QueuedBlock& entry = *itInFlight->second.second;
+    if (entry.partialBlock)
+        return false;
+
+    CNodeState* state = State(nodeid);
+    CNodeState* stateStaller = State(nodeStaller);
+    int64_t nWait = std::max<int64_t>(BLOCK_STALLING_REASSIGN_MS * 1000, 2 * stateStaller->dAvgBlockLatency);
+    if (nNow - entry.nTime < nWait)
+        return false;
+    if (state->nBlocksDownloaded > 0 && stateStaller->nBlocksDownloaded > 0 &&
+        state->dAvgBlockServiceTime >= stateStaller->dAvgBlockServiceTime)
+        return false;
+
+    stateStaller->nBlocksReassigned++;
+    MarkBlockAsReceived(pindex->GetBlockHash());
+    MarkBlockAsInFlight(nodeid, pindex->GetBlockHash(), consensusParams, pindex);
+    return true;
+}
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
@@ -554,6 +757,12 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightLimit = state->nBlocksInFlightLimit;
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
+    stats.nBlockBytesDownloaded = state->nBlockBytesDownloaded;
+    stats.nBlocksReassigned = state->nBlocksReassigned;
+    stats.dBlockLatency = state->dAvgBlockLatency / 1e6;
+    stats.dBlockDownloadRate = state->dAvgDownloadRate;
     return true;
 }
 
@@ -575,6 +784,27 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
     nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
 }
 
+namespace {
+/** The last locator built by GetCachedLocator, and the block it starts at */
+uint256 hashCachedLocator;
+CBlockLocator cachedLocator;
+}
+
+CBlockLocator GetCachedLocator(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (!pindex)
+        pindex = chainActive.Tip();
+    if (!pindex)
+        return CBlockLocator();
+    // A locator depends only on the block it starts at
+    if (hashCachedLocator != pindex->GetBlockHash()) {
+        cachedLocator = chainActive.GetLocator(pindex);
+        hashCachedLocator = pindex->GetBlockHash();
+    }
+    return cachedLocator;
+}
+
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
 {
     // Find the first block the caller has in the main chain
@@ -593,16 +823,59 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    {
+        LOCK(cs_blockSolutions);
+        std::map<const CBlockIndex*, std::vector<unsigned char> >::const_iterator it = mapBlockSolutions.find(this);
+        if (it != mapBlockSolutions.end())
+            return it->second;
+    }
+    // Entries leave mapBlockSolutions only once they are written
+    CDiskBlockIndex diskindex;
+    if (!pblocktree || !pblocktree->ReadDiskBlockIndex(GetBlockHash(), diskindex))
+        throw std::runtime_error(strprintf("%s: failed to read the block index entry of %s", __func__, GetBlockHash().ToString()));
+    return diskindex.nSolution;
+}
+
+CBlockHeader CBlockIndex::GetBlockHeader() const
+{
+    return GetBlockHeader(GetSolution());
+}
+
+size_t GetBlockIndexMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    size_t nUsage = memusage::DynamicUsage(mapBlockIndex) + blockIndexArena.DynamicMemoryUsage();
+    {
+        LOCK(cs_blockSolutions);
+        nUsage += memusage::DynamicUsage(mapBlockSolutions);
+        for (std::map<const CBlockIndex*, std::vector<unsigned char> >::const_iterator it = mapBlockSolutions.begin(); it != mapBlockSolutions.end(); it++)
+            nUsage += memusage::DynamicUsage(it->second);
+    }
+    nUsage += memusage::DynamicUsage(setBlockIndexCandidates) + memusage::DynamicUsage(mapBlocksUnlinked) +
+              memusage::MallocUsage((chainActive.Height() + 1) * sizeof(CBlockIndex*));
+    return nUsage;
+}
+
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsCacheCounters coinsTipCounters;
+CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewFlusher *pcoinsflusher = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CTxIndexDB *ptxindexdb = NULL;
+CExplorerIndexDB *pexplorerdb = NULL;
 CSporkDB* pSporkDB = NULL;
+CSaplingFrontierDB *pSaplingFrontierDB = NULL;
+CBlockFilterDB *pblockfilterdb = NULL;
+CChainStatsDB *pchainstatsdb = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+bool AddOrphanTx(const CTransaction& tx, NodeId peer, size_t nMaxPeerUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
@@ -622,61 +895,93 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // The orphan, its list entry and its entries in the index by outpoint
+    size_t nUsage = memusage::MallocUsage(sizeof(std::pair<const uint256, COrphanTx>) + 2 * sizeof(void*)) +
+                    RecursiveDynamicUsage(tx) + sizeof(uint256) + tx.vin.size() * 2 * sizeof(uint256);
+    std::map<NodeId, size_t>::iterator itPeer = mapOrphanPeerUsage.find(peer);
+    size_t nPeerUsage = itPeer == mapOrphanPeerUsage.end() ? 0 : itPeer->second;
+    if (nPeerUsage + nUsage > nMaxPeerUsage)
+    {
+        LogPrint("mempool", "ignoring orphan tx %s from peer=%d over its quota (%u bytes)\n", hash.ToString(), peer, nPeerUsage);
+        return false;
+    }
+
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nUsage = nUsage;
+    orphan.nListPos = vOrphanList.size();
+    vOrphanList.push_back(hash);
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].push_back(hash);
+    mapOrphanPeerUsage[peer] = nPeerUsage + nUsage;
+    nOrphanUsage += nUsage;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u usage %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanUsage);
     return true;
 }
 
 void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
+    boost::unordered_map<uint256, COrphanTx, CCoinsKeyHasher>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
+    const COrphanTx& orphan = it->second;
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        boost::unordered_map<COutPoint, std::vector<uint256>, COrphanOutPointHasher>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
-        itPrev->second.erase(hash);
-        if (itPrev->second.empty())
+        std::vector<uint256>& vSpenders = itPrev->second;
+        std::vector<uint256>::iterator itSpender = std::find(vSpenders.begin(), vSpenders.end(), hash);
+        if (itSpender != vSpenders.end()) {
+            *itSpender = vSpenders.back();
+            vSpenders.pop_back();
+        }
+        if (vSpenders.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    // Move the last orphan of the list into the place of this one
+    const uint256& hashLast = vOrphanList.back();
+    mapOrphanTransactions[hashLast].nListPos = orphan.nListPos;
+    vOrphanList[orphan.nListPos] = hashLast;
+    vOrphanList.pop_back();
+
+    std::map<NodeId, size_t>::iterator itPeer = mapOrphanPeerUsage.find(orphan.fromPeer);
+    if (itPeer != mapOrphanPeerUsage.end()) {
+        itPeer->second -= std::min(itPeer->second, orphan.nUsage);
+        if (itPeer->second == 0)
+            mapOrphanPeerUsage.erase(itPeer);
+    }
+    nOrphanUsage -= orphan.nUsage;
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
+    if (!mapOrphanPeerUsage.count(peer))
+        return;
+    std::vector<uint256> vErase;
+    BOOST_FOREACH(const uint256& hash, vOrphanList)
     {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
+        if (mapOrphanTransactions[hash].fromPeer == peer)
+            vErase.push_back(hash);
     }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    BOOST_FOREACH(const uint256& hash, vErase)
+        EraseOrphanTx(hash);
+    if (!vErase.empty()) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", vErase.size(), peer);
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    while (!vOrphanList.empty() && (vOrphanList.size() > nMaxOrphans || nOrphanUsage > nMaxUsage))
     {
         // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        EraseOrphanTx(vOrphanList[GetRand(vOrphanList.size())]);
         ++nEvicted;
     }
     return nEvicted;
@@ -976,7 +1281,9 @@ bool ContextualCheckTransaction(
         const CChainParams& chainparams,
         const int nHeight,
         const int dosLevel,
-        bool (*isInitBlockDownload)(const CChainParams&))
+        bool (*isInitBlockDownload)(const CChainParams&),
+        std::vector<CValidationCheck> *pvChecks,
+        const PrecomputedTransactionData *txdata)
 {
     bool overwinterActive = chainparams.GetConsensus().NetworkUpgradeActive(nHeight, Consensus::UPGRADE_OVERWINTER);
     bool saplingActive = chainparams.GetConsensus().NetworkUpgradeActive(nHeight, Consensus::UPGRADE_SAPLING);
@@ -1070,29 +1377,43 @@ bool ContextualCheckTransaction(
     }
 
     uint256 dataToBeSigned;
+    // Set if the signatures and proofs were already verified under this
+    // branch, e.g. when the transaction entered the mempool
+    bool fProofsVerified = false;
 
     if (!tx.vJoinSplit.empty() ||
         !tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
         auto consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
-        // Empty output script.
-        CScript scriptCode;
-        try {
-            dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
-        } catch (std::logic_error ex) {
-            return state.DoS(100, error("CheckTransaction(): error computing signature hash"),
-                                REJECT_INVALID, "error-computing-signature-hash");
+        fProofsVerified = IsShieldedTxVerified(tx.GetHash(), consensusBranchId);
+        // The signature hash is only needed to verify the signatures
+        if (!fProofsVerified) {
+            // Empty output script.
+            CScript scriptCode;
+            try {
+                dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, txdata);
+            } catch (std::logic_error ex) {
+                return state.DoS(100, error("CheckTransaction(): error computing signature hash"),
+                                    REJECT_INVALID, "error-computing-signature-hash");
+            }
         }
     }
 
-    if (!tx.vJoinSplit.empty())
+    if (!tx.vJoinSplit.empty() && !fProofsVerified)
     {
         BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
 
         // We rely on libsodium to check that the signature is canonical.
         // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
-        if (crypto_sign_verify_detached(&tx.joinSplitSig[0],
+        if (pvChecks) {
+            const CTransaction* ptx = &tx;
+            pvChecks->push_back(CValidationCheck([ptx, dataToBeSigned]() {
+                return crypto_sign_verify_detached(&ptx->joinSplitSig[0],
+                                                   dataToBeSigned.begin(), 32,
+                                                   ptx->joinSplitPubKey.begin()) == 0;
+            }));
+        } else if (crypto_sign_verify_detached(&tx.joinSplitSig[0],
                                         dataToBeSigned.begin(), 32,
                                         tx.joinSplitPubKey.begin()
                                         ) != 0) {
@@ -1102,64 +1423,92 @@ bool ContextualCheckTransaction(
         }
     }
 
-    if (!tx.vShieldedSpend.empty() ||
-        !tx.vShieldedOutput.empty())
+    if ((!tx.vShieldedSpend.empty() ||
+         !tx.vShieldedOutput.empty()) && !fProofsVerified)
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
+        CSaplingCheck check(tx, dataToBeSigned);
+        if (pvChecks) {
+            pvChecks->push_back(CValidationCheck::From(check));
+        } else if (!check()) {
+            return state.DoS(100, error("ContextualCheckTransaction(): %s", check.GetError()),
+                                  REJECT_INVALID, check.GetRejectReason());
         }
+    }
+    return true;
+}
 
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cm.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
+bool CSaplingCheck::operator()() {
+    const CTransaction& tx = *ptx;
+    CPerfStatTimer perfTimer(PERF_SAPLING_PROOFS);
+    ZC_WaitForParams();
+    auto ctx = librustzcash_sapling_verification_ctx_init();
 
-        if (!librustzcash_sapling_final_check(
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
             ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
+            spend.cv.begin(),
+            spend.anchor.begin(),
+            spend.nullifier.begin(),
+            spend.rk.begin(),
+            spend.zkproof.begin(),
+            spend.spendAuthSig.begin(),
             dataToBeSigned.begin()
         ))
         {
             librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                                  REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+            strError = "Sapling spend description invalid";
+            strRejectReason = "bad-txns-sapling-spend-description-invalid";
+            return false;
+        }
+    }
+
+    for (const OutputDescription &output : tx.vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+            ctx,
+            output.cv.begin(),
+            output.cm.begin(),
+            output.ephemeralKey.begin(),
+            output.zkproof.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            strError = "Sapling output description invalid";
+            strRejectReason = "bad-txns-sapling-output-description-invalid";
+            return false;
         }
+    }
 
+    if (!librustzcash_sapling_final_check(
+        ctx,
+        tx.valueBalance,
+        tx.bindingSig.begin(),
+        dataToBeSigned.begin()
+    ))
+    {
         librustzcash_sapling_verification_ctx_free(ctx);
+        strError = "Sapling binding signature invalid";
+        strRejectReason = "bad-txns-sapling-binding-signature-invalid";
+        return false;
     }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
     return true;
 }
 
 
+/** Verify a JoinSplit proof, timing it unless verification is disabled */
+static bool VerifyJoinSplit(const JSDescription& joinsplit, libzcash::ProofVerifier& verifier, const uint256& joinSplitPubKey)
+{
+    ZC_WaitForParams();
+    if (!verifier.Enabled())
+        return joinsplit.Verify(*pzcashParams, verifier, joinSplitPubKey);
+    CPerfStatTimer perfTimer(PERF_SPROUT_PROOF);
+    return joinsplit.Verify(*pzcashParams, verifier, joinSplitPubKey);
+}
+
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      libzcash::ProofVerifier& verifier)
+                      libzcash::ProofVerifier& verifier,
+                      std::vector<CValidationCheck> *pvChecks)
 {
     // Don't count coinbase transactions because mining skews the count
     if (!tx.IsCoinBase()) {
@@ -1171,7 +1520,16 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     } else {
         // Ensure that zk-SNARKs verify
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vJoinSplit) {
-            if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
+            if (pvChecks) {
+                const JSDescription* pjoinsplit = &joinsplit;
+                const uint256* pjoinSplitPubKey = &tx.joinSplitPubKey;
+                libzcash::ProofVerifier* pverifier = &verifier;
+                pvChecks->push_back(CValidationCheck([pjoinsplit, pjoinSplitPubKey, pverifier]() {
+                    return VerifyJoinSplit(*pjoinsplit, *pverifier, *pjoinSplitPubKey);
+                }));
+                continue;
+            }
+            if (!VerifyJoinSplit(joinsplit, verifier, tx.joinSplitPubKey)) {
                 return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
                                     REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
             }
@@ -1445,10 +1803,30 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                     bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee);
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    bool fAccepted = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fRejectAbsurdFee);
+    TRACE5(mempool, accept, tx.GetHash().begin(), fAccepted, state.GetRejectCode(), pfMissingInputs && *pfMissingInputs,
+           GetTimeMicros() - nTimeStart);
+    return fAccepted;
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectAbsurdFee);
+}
+
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                     bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee)
 {
     AssertLockHeld(cs_main);
+    CPerfStatTimer perfTimer(PERF_MEMPOOL_ACCEPT);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -1474,16 +1852,27 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         return false;
     }
 
+    bool fShielded = !tx.vJoinSplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty();
+    bool fProofsVerified = fShielded && IsShieldedTxVerified(tx.GetHash(), consensusBranchId);
     auto verifier = libzcash::ProofVerifier::Strict();
-    if (!CheckTransaction(tx, state, verifier))
+    if (!(fProofsVerified ? CheckTransactionWithoutProofVerification(tx, state) : CheckTransaction(tx, state, verifier)))
         return error("AcceptToMemoryPool: CheckTransaction failed");
 
+    // Hashes of the transaction shared by the shielded signature hash and
+    // the script checks below
+    PrecomputedTransactionData txdata(tx);
+
     // DoS level set to 10 to be more forgiving.
     // Check transaction contextually against the set of consensus rules which apply in the next block to be mined.
-    if (!ContextualCheckTransaction(tx, state, Params(), nextBlockHeight, 10)) {
+    if (!ContextualCheckTransaction(tx, state, Params(), nextBlockHeight, 10, IsInitialBlockDownload, NULL, &txdata)) {
         return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
     }
 
+    // The proofs and signatures passed, so ConnectBlock can skip them
+    if (fShielded && !fProofsVerified) {
+        SetShieldedTxVerified(tx.GetHash(), consensusBranchId);
+    }
+
     // DoS mitigation: reject transactions expiring soon
     // Note that if a valid transaction belonging to the wallet is in the mempool and the node is shutdown,
     // upon restart, CWalletTx::AcceptToMemoryPool() will be invoked which might result in rejection.
@@ -1621,9 +2010,25 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // it has passed ContextualCheckInputs and therefore this is correct.
         auto consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, Params().GetConsensus());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
 
+        // Keep unconfirmed chains short enough that ancestor and descendant
+        // bookkeeping stays cheap
+        {
+            LOCK(pool.cs);
+            CTxMemPool::setEntries setAncestors;
+            size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+            size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+            size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+            size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+            std::string errString;
+            if (!pool.CalculateMemPoolAncestors(tx, nSize, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+                return state.DoS(0, error("%s: %s: %s", __func__, hash.ToString(), errString),
+                                 REJECT_NONSTANDARD, "too-long-mempool-chain");
+            }
+        }
+
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
         if (tx.vJoinSplit.size() > 0 && nFees >= ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
             // In future we will we have more accurate and dynamic computation of fees for tx with joinsplits.
@@ -1675,7 +2080,6 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
         if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
         {
             return error("AcceptToMemoryPool: ConnectInputs failed %s", hash.ToString());
@@ -1725,12 +2129,34 @@ bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
 
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes))
+    if (!pexplorerdb->ReadTimestampIndex(high, low, fActiveOnly, hashes))
         return error("Unable to get hashes for timestamps");
 
     return true;
 }
 
+bool GetNullifierIndex(const CNoteIndexKey &key, CNullifierIndexValue &value)
+{
+    if (!fNoteIndex)
+        return error("Nullifier index not enabled");
+
+    if (!pexplorerdb->ReadNullifierIndex(key, value))
+        return error("Unable to get nullifier index information");
+
+    return true;
+}
+
+bool GetCommitmentIndex(const CNoteIndexKey &key, CCommitmentIndexValue &value)
+{
+    if (!fNoteIndex)
+        return error("Note commitment index not enabled");
+
+    if (!pexplorerdb->ReadCommitmentIndex(key, value))
+        return error("Unable to get note commitment index information");
+
+    return true;
+}
+
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
     AssertLockHeld(cs_main);
@@ -1740,7 +2166,7 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (mempool.getSpentIndex(key, value))
         return true;
 
-    if (!pblocktree->ReadSpentIndex(key, value))
+    if (!pexplorerdb->ReadSpentIndex(key, value))
         return error("Unable to get spent index information");
 
     return true;
@@ -1753,19 +2179,55 @@ bool GetAddressIndex(const uint160& addressHash, int type,
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pexplorerdb->ReadAddressIndex(addressHash, type, addressIndex, start, end))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressIndex(const std::vector<std::pair<uint160, int> >& addresses,
+                     std::vector<CAddressIndexDbEntry>& addressIndex,
+                     int start, int end)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pexplorerdb->ReadAddressIndex(addresses, addressIndex, start, end))
+        return error("unable to get txids for addresses");
+
+    return true;
+}
+
+bool GetAddressUnspent(const std::vector<std::pair<uint160, int> >& addresses,
+                       std::vector<CAddressUnspentDbEntry>& unspentOutputs)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pexplorerdb->ReadAddressUnspentIndex(addresses, unspentOutputs))
+        return error("unable to get unspent outputs for addresses");
+
+    return true;
+}
+
+bool GetAddressBalance(const uint160& addressHash, int type, CAddressBalanceValue& value)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pexplorerdb->ReadAddressBalance(addressHash, type, value))
+        return error("unable to get balance for address");
+
+    return true;
+}
+
 bool GetAddressUnspent(const uint160& addressHash, int type,
                        std::vector<CAddressUnspentDbEntry>& unspentOutputs)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!pexplorerdb->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
 
     return true;
@@ -1913,6 +2375,22 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
         CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
 
+        // Keep unconfirmed chains short enough that ancestor and descendant
+        // bookkeeping stays cheap
+        {
+            LOCK(pool.cs);
+            CTxMemPool::setEntries setAncestors;
+            size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+            size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+            size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+            size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+            std::string errString;
+            if (!pool.CalculateMemPoolAncestors(tx, nSize, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+                return state.DoS(0, error("%s: %s: %s", __func__, hash.ToString(), errString),
+                                 REJECT_NONSTANDARD, "too-long-mempool-chain");
+            }
+        }
+
         // Don't accept it if it can't get into a block
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
           if (tx.vJoinSplit.size() > 0 && nFees >= ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
@@ -1972,6 +2450,121 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
 }
 
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+namespace {
+
+CMappedFileCache mappedBlockFiles;
+
+/**
+ * Blocks written during initial block download that are not in their block
+ * file yet. They go to the file in one write once BLOCKFILE_WRITE_BUFFER_SIZE
+ * is reached, when the block file is flushed, or when a block in the same
+ * file is read. The block index is only written after the block file is
+ * flushed, so it never points at blocks that are only held here.
+ */
+class CBlockWriteBuffer
+{
+private:
+    boost::mutex mutex;
+    //! The file the blocks belong to, or -1 when there are none; readers
+    //! check it without the lock
+    std::atomic<int> nFile;
+    //! The position in the file of the first byte held
+    unsigned int nStart;
+    CDataStream ss;
+
+    bool WriteLocked()
+    {
+        if (nFile < 0)
+            return true;
+        FILE* file = OpenBlockFile(CDiskBlockPos(nFile, nStart));
+        if (!file)
+            return error("%s: OpenBlockFile failed", __func__);
+        bool fOk = fwrite(&ss[0], 1, ss.size(), file) == ss.size();
+        fOk &= fclose(file) == 0;
+        if (!fOk)
+            return error("%s: failed to write %u bytes at %u of blk%05u.dat", __func__, ss.size(), nStart, nFile);
+        ss.clear();
+        nFile = -1;
+        return true;
+    }
+
+public:
+    CBlockWriteBuffer() : nFile(-1), nStart(0), ss(SER_DISK, CLIENT_VERSION) {}
+
+    /** Hold block, whose index header goes at pos, and set pos to the block itself */
+    bool Append(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Only blocks that follow on are held together
+        if (nFile >= 0 && (nFile != pos.nFile || nStart + ss.size() != pos.nPos) && !WriteLocked())
+            return false;
+        if (nFile < 0) {
+            nStart = pos.nPos;
+            ss.reserve(BLOCKFILE_WRITE_BUFFER_SIZE + MAX_BLOCK_SIZE);
+        }
+        unsigned int nSize = GetSerializeSize(ss, block);
+        ss << FLATDATA(messageStart) << nSize;
+        pos.nPos = nStart + ss.size();
+        ss << block;
+        nFile = pos.nFile;
+        if (ss.size() >= BLOCKFILE_WRITE_BUFFER_SIZE)
+            return WriteLocked();
+        return true;
+    }
+
+    /** Write the blocks held to their file */
+    bool Write()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return WriteLocked();
+    }
+
+    /** Make sure the file holds the block at pos before it is read */
+    bool WriteBefore(const CDiskBlockPos& pos)
+    {
+        if (nFile != pos.nFile)
+            return true;
+        return Write();
+    }
+};
+
+CBlockWriteBuffer blockWriteBuffer;
+
+/**
+ * Deserialize the block stored at pos straight from a mapping of its block
+ * file. Returns false if the file cannot be mapped, in which case the caller
+ * reads it through stdio instead. Deserialization errors are thrown.
+ */
+template<typename F>
+bool ReadMappedBlock(const CDiskBlockPos& pos, F fRead)
+{
+    // Each block is preceded by the network magic and its size
+    if (pos.nPos < 4 || !blockWriteBuffer.WriteBefore(pos))
+        return false;
+    boost::filesystem::path path = GetBlockPosFilename(pos, "blk");
+    std::shared_ptr<const CMappedFile> pfile = mappedBlockFiles.Get(pos.nFile, path, pos.nPos);
+    if (!pfile)
+        return false;
+    uint32_t nSize = ReadLE32((const unsigned char*)pfile->begin() + pos.nPos - 4);
+    if (nSize > MAX_BLOCK_SIZE)
+        return false;
+    if ((uint64_t)pos.nPos + nSize > pfile->size()) {
+        pfile = mappedBlockFiles.Get(pos.nFile, path, (uint64_t)pos.nPos + nSize);
+        if (!pfile)
+            return false;
+    }
+    CMemoryReader reader(pfile->begin() + pos.nPos, pfile->begin() + pos.nPos + nSize, SER_DISK, CLIENT_VERSION);
+    fRead(reader);
+    return true;
+}
+
+}
+
+void SetMappedBlockFiles(int nFiles)
+{
+    mappedBlockFiles.SetMaxFiles(std::max(nFiles, 0));
+}
+
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
     CBlockIndex *pindexSlow = NULL;
@@ -1983,23 +2576,44 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
         return true;
     }
 
+    // A cached transaction is only used while its block is still active
+    uint256 hashCached;
+    std::shared_ptr<const CTransaction> ptxCached = recentTransactions.Get(hash, hashCached);
+    if (ptxCached) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashCached);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+            txOut = *ptxCached;
+            hashBlock = hashCached;
+            return true;
+        }
+        recentTransactions.Erase(hash);
+    }
+
     if (fTxIndex) {
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
+        if (ptxindexdb->ReadTxIndex(hash, postx)) {
             CBlockHeader header;
             try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
+                bool fMapped = ReadMappedBlock(postx, [&](CMemoryReader& reader) {
+                    reader >> header;
+                    reader.ignore(postx.nTxOffset);
+                    reader >> txOut;
+                });
+                if (!fMapped) {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return error("%s: OpenBlockFile failed", __func__);
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                }
             } catch (const std::exception& e) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
+            recentTransactions.Add(txOut, hashBlock);
             return true;
         }
     }
@@ -2023,6 +2637,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
+                    recentTransactions.Add(txOut, hashBlock);
                     return true;
                 }
             }
@@ -2044,6 +2659,12 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
+    // During initial block download, coalesce the blocks into large writes
+    if (IsInitialBlockDownload(Params()))
+        return blockWriteBuffer.Append(block, pos, messageStart);
+    if (!blockWriteBuffer.Write())
+        return false;
+
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
@@ -2063,25 +2684,40 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/** CheckEquihashSolution, skipped for headers whose solution already verified */
+static bool CheckEquihashSolutionCached(const CBlockHeader& header, const Consensus::Params& consensusParams)
 {
-    block.SetNull();
-
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    uint256 hash = header.GetHash();
+    if (IsEquihashSolutionVerified(hash))
+        return true;
+    if (!CheckEquihashSolution(&header, consensusParams))
+        return false;
+    SetEquihashSolutionVerified(hash);
+    return true;
+}
 
-    // Read block
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    // Read block, from the mapped block file if possible. The transactions
+    // already in block are reused, so that callers reading many blocks
+    // into one CBlock avoid most allocations.
     try {
-        filein >> block;
+        if (!ReadMappedBlock(pos, [&block](CMemoryReader& reader) { block.UnserializeReusing(reader); })) {
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull()) {
+                block.SetNull();
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            }
+            block.UnserializeReusing(filein);
+        }
     }
     catch (const std::exception& e) {
+        block.SetNull();
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
     // Check the header
-    if (!(CheckEquihashSolution(&block, consensusParams) &&
+    if (!(CheckEquihashSolutionCached(block, consensusParams) &&
           CheckProofOfWork(block.GetHash(), block.nBits, consensusParams)))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
@@ -2090,6 +2726,11 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
+    std::shared_ptr<const CRecentBlock> pcached = recentBlocks.Get(pindex->GetBlockHash());
+    if (pcached) {
+        block = *pcached->pblock;
+        return true;
+    }
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
@@ -2098,6 +2739,60 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    vchBlock.clear();
+
+    // Copy the serialized block as it is stored, from the mapped block file if possible
+    try {
+        bool fMapped = ReadMappedBlock(pos, [&vchBlock](CMemoryReader& reader) {
+            vchBlock.resize(reader.size());
+            reader.read((char*)vchBlock.data(), vchBlock.size());
+        });
+        if (!fMapped) {
+            if (pos.nPos < 8)
+                return error("%s: no index header before %s", __func__, pos.ToString());
+            CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 8), true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+            CMessageHeader::MessageStartChars blkMessageStart;
+            unsigned int nSize;
+            filein >> FLATDATA(blkMessageStart) >> nSize;
+            if (memcmp(blkMessageStart, messageStart, MESSAGE_START_SIZE))
+                return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+            if (nSize > MAX_BLOCK_SIZE)
+                return error("%s: block size %u too large at %s", __func__, nSize, pos.ToString());
+            vchBlock.resize(nSize);
+            filein.read((char*)vchBlock.data(), nSize);
+        }
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (!ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), messageStart))
+        return false;
+
+    // Only the header is decoded, to make sure these are the bytes the index points at
+    CBlockHeader header;
+    try {
+        CMemoryReader reader((const char*)vchBlock.data(), (const char*)(vchBlock.data() + vchBlock.size()), SER_DISK, CLIENT_VERSION);
+        reader >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pindex->GetBlockPos().ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk(CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
   CAmount nSubsidy = 10 * COIN;
@@ -2442,6 +3137,12 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
+/**
+ * Transactions spending at least this many inputs outside of a block have
+ * their scripts verified on the script check threads.
+ */
+static const unsigned int MIN_PARALLEL_SCRIPT_CHECK_INPUTS = 16;
+
 bool ContextualCheckInputs(
     const CTransaction& tx,
     CValidationState &state,
@@ -2471,6 +3172,22 @@ bool ContextualCheckInputs(
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // A large transaction checked on its own (entering the mempool or
+            // a block template) has its signatures verified in parallel. If
+            // any fails, the loop below checks again to report which one.
+            if (!pvChecks && nScriptCheckThreads && tx.vin.size() >= MIN_PARALLEL_SCRIPT_CHECK_INPUTS) {
+                std::vector<CValidationCheck> vChecks;
+                vChecks.reserve(tx.vin.size());
+                for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                    const CCoins* coins = inputs.AccessCoins(tx.vin[i].prevout.hash);
+                    assert(coins);
+                    CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata);
+                    vChecks.push_back(CValidationCheck::From(check));
+                }
+                if (RunValidationChecks(vChecks))
+                    return true;
+            }
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
@@ -2519,8 +3236,12 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileout.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
+    // Serialize once, for the size, the file and the checksum
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+    ssUndo << blockundo;
+
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
+    unsigned int nSize = ssUndo.size();
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write undo data
@@ -2528,12 +3249,12 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    fileout.write(&ssUndo[0], ssUndo.size());
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
-    hasher << blockundo;
+    hasher.write(&ssUndo[0], ssUndo.size());
     fileout << hasher.GetHash();
 
     return true;
@@ -2566,8 +3287,62 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+/**
+ * Undo data of the most recently connected blocks, so that shallow reorgs
+ * disconnect them without reading rev?????.dat back. The undo data only
+ * depends on the block, so entries never go stale. Protected by cs_main.
+ */
+class CRecentUndoCache
+{
+private:
+    size_t nMaxBlocks;
+    std::deque<std::pair<uint256, CBlockUndo> > queueUndo;
+
+public:
+    CRecentUndoCache() : nMaxBlocks(DEFAULT_UNDO_CACHE_BLOCKS) {}
+
+    void SetMaxBlocks(size_t nMaxBlocksIn)
+    {
+        nMaxBlocks = nMaxBlocksIn;
+        while (queueUndo.size() > nMaxBlocks)
+            queueUndo.pop_front();
+    }
+
+    void Add(const uint256& hashBlock, CBlockUndo&& blockundo)
+    {
+        if (nMaxBlocks == 0)
+            return;
+        for (const std::pair<uint256, CBlockUndo>& entry : queueUndo) {
+            if (entry.first == hashBlock)
+                return;
+        }
+        if (queueUndo.size() >= nMaxBlocks)
+            queueUndo.pop_front();
+        queueUndo.emplace_back(hashBlock, std::move(blockundo));
+    }
+
+    bool Get(const uint256& hashBlock, CBlockUndo& blockundo) const
+    {
+        for (const std::pair<uint256, CBlockUndo>& entry : queueUndo) {
+            if (entry.first == hashBlock) {
+                blockundo = entry.second;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+CRecentUndoCache recentUndo;
+
 } // anon namespace
 
+void SetUndoCacheBlocks(int nBlocks)
+{
+    LOCK(cs_main);
+    recentUndo.SetMaxBlocks(std::max(nBlocks, 0));
+}
+
 /**
  * Apply the undo operation of a CTxInUndo to the given chain state.
  * @param undo The undo object.
@@ -2601,18 +3376,29 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
-enum DisconnectResult
+/**
+ * The shielded explorer index entries of a transaction: its nullifiers, and
+ * its note commitments at their positions in trees of the given sizes.
+ */
+static void GetNoteIndexEntries(const CTransaction& tx, int nHeight, uint64_t nSproutSize, uint64_t nSaplingSize,
+                                std::vector<CNullifierIndexDbEntry>& nullifierIndex,
+                                std::vector<CCommitmentIndexDbEntry>& commitmentIndex)
 {
-    DISCONNECT_OK,      // All good.
-    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
-    DISCONNECT_FAILED   // Something else went wrong.
-};
+    const uint256 hash = tx.GetHash();
+    for (size_t js = 0; js < tx.vJoinSplit.size(); js++) {
+        const JSDescription& joinsplit = tx.vJoinSplit[js];
+        for (const uint256& nf : joinsplit.nullifiers)
+            nullifierIndex.push_back(make_pair(CNoteIndexKey(SPROUT, nf), CNullifierIndexValue(hash, js, nHeight)));
+        for (const uint256& cm : joinsplit.commitments)
+            commitmentIndex.push_back(make_pair(CNoteIndexKey(SPROUT, cm), CCommitmentIndexValue(hash, js, nHeight, nSproutSize++)));
+    }
+    for (size_t k = 0; k < tx.vShieldedSpend.size(); k++)
+        nullifierIndex.push_back(make_pair(CNoteIndexKey(SAPLING, tx.vShieldedSpend[k].nullifier), CNullifierIndexValue(hash, k, nHeight)));
+    for (size_t k = 0; k < tx.vShieldedOutput.size(); k++)
+        commitmentIndex.push_back(make_pair(CNoteIndexKey(SAPLING, tx.vShieldedOutput[k].cm), CCommitmentIndexValue(hash, k, nHeight, nSaplingSize++)));
+}
 
-/** Undo the effects of this block (with given index) on the UTXO set represented by coins.
- *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
- *  The addressIndex and spentIndex will be updated if requested.
- */
-static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state,
+DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state,
     const CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
     const bool updateIndices)
 {
@@ -2621,14 +3407,16 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     bool fClean = true;
 
     CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
-        error("DisconnectBlock(): no undo data available");
-        return DISCONNECT_FAILED;
-    }
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
-        error("DisconnectBlock(): failure reading undo data");
-        return DISCONNECT_FAILED;
+    if (!recentUndo.Get(pindex->GetBlockHash(), blockUndo)) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull()) {
+            error("DisconnectBlock(): no undo data available");
+            return DISCONNECT_FAILED;
+        }
+        if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
+            error("DisconnectBlock(): failure reading undo data");
+            return DISCONNECT_FAILED;
+        }
     }
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
@@ -2638,12 +3426,17 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     std::vector<CAddressIndexDbEntry> addressIndex;
     std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
     std::vector<CSpentIndexDbEntry> spentIndex;
+    std::vector<CNullifierIndexDbEntry> nullifierIndex;
+    std::vector<CCommitmentIndexDbEntry> commitmentIndex;
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 const hash = tx.GetHash();
 
+        if (fNoteIndex && updateIndices)
+            GetNoteIndexEntries(tx, pindex->nHeight, 0, 0, nullifierIndex, commitmentIndex);
+
         // insightexplorer
         // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2236
         if (fAddressIndex && updateIndices) {
@@ -2781,37 +3574,52 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
     // insightexplorer
-    if (fAddressIndex && updateIndices) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            AbortNode(state, "Failed to delete address index");
-            return DISCONNECT_FAILED;
+    if ((fAddressIndex || fSpentIndex) && updateIndices) {
+        CExplorerIndexUpdate update;
+        update.hashBest = pindex->pprev->GetBlockHash();
+        update.fDisconnect = true;
+        if (fAddressIndex) {
+            update.addressIndex.swap(addressIndex);
+            update.addressUnspentIndex.swap(addressUnspentIndex);
         }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            AbortNode(state, "Failed to write address unspent index");
+        if (fSpentIndex)
+            update.spentIndex.swap(spentIndex);
+        if (!pexplorerdb->QueueUpdate(update)) {
+            AbortNode(state, "Failed to write address and spent indexes");
             return DISCONNECT_FAILED;
         }
     }
-    // insightexplorer
-    if (fSpentIndex && updateIndices) {
-        if (!pblocktree->UpdateSpentIndex(spentIndex)) {
-            AbortNode(state, "Failed to write transaction index");
+    if (fNoteIndex && updateIndices) {
+        if (!pexplorerdb->EraseNoteIndex(nullifierIndex, commitmentIndex)) {
+            AbortNode(state, "Failed to delete note index");
             return DISCONNECT_FAILED;
         }
     }
+    // The background explorer index build rewinds the blocks it covered by itself
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+/**
+ * Write out the blocks held for the last block file, and truncate its files
+ * to their size when it is finished with. Unless fSync is false, commit them
+ * and any finalized earlier that were not, as the block index is about to be
+ * written.
+ */
+bool static FlushBlockFile(bool fFinalize = false, bool fSync = true)
 {
     LOCK(cs_LastBlockFile);
 
+    if (!blockWriteBuffer.Write())
+        return false;
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        FileCommit(fileOld);
+        if (fSync)
+            FileCommit(fileOld);
         fclose(fileOld);
     }
 
@@ -2819,20 +3627,189 @@ void static FlushBlockFile(bool fFinalize = false)
     if (fileOld) {
         if (fFinalize)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
+        if (fSync)
+            FileCommit(fileOld);
         fclose(fileOld);
     }
+
+    if (!fSync) {
+        setUnsyncedBlockFiles.insert(nLastBlockFile);
+        return true;
+    }
+    for (int nFile : setUnsyncedBlockFiles) {
+        if (nFile == nLastBlockFile)
+            continue;
+        // Pruned files are gone, which is fine
+        CDiskBlockPos pos(nFile, 0);
+        FILE *file = OpenBlockFile(pos, true);
+        if (file) {
+            FileCommit(file);
+            fclose(file);
+        }
+        file = OpenUndoFile(pos, true);
+        if (file) {
+            FileCommit(file);
+            fclose(file);
+        }
+    }
+    setUnsyncedBlockFiles.clear();
+    return true;
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CValidationCheck> scriptcheckqueue(128);
+
+/**
+ * Only one CCheckQueueControl may use scriptcheckqueue at a time, and
+ * CheckBlock is called by ProcessNewBlock without cs_main.
+ */
+static CCriticalSection cs_scriptcheckqueue;
 
 void ThreadScriptCheck() {
     RenameThread("zcash-scriptch");
     scriptcheckqueue.Thread();
 }
 
+static boost::mutex mutexBlockPrecheck;
+static boost::condition_variable condBlockPrecheck;
+//! Blocks waiting for the pre-check threads, with their heights
+static std::deque<std::pair<std::shared_ptr<const CBlock>, int> > queueBlockPrecheck;
+
+static bool AlwaysInitialBlockDownload(const CChainParams& chainparams)
+{
+    return true;
+}
+
+/**
+ * Verify the proofs and signatures of the shielded transactions in a block
+ * that is not connected yet, without cs_main, and record the ones that pass
+ * in the proof cache. Failures are left for ConnectBlock to report.
+ */
+static void PrecheckBlockProofs(const CBlock& block, int nHeight, const CChainParams& chainparams)
+{
+    uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
+    auto verifier = libzcash::ProofVerifier::Strict();
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        boost::this_thread::interruption_point();
+        if (tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+            continue;
+        if (IsShieldedTxVerified(tx.GetHash(), consensusBranchId))
+            continue;
+        CValidationState state;
+        if (CheckTransaction(tx, state, verifier) &&
+            ContextualCheckTransaction(tx, state, chainparams, nHeight, 100, AlwaysInitialBlockDownload))
+            SetShieldedTxVerified(tx.GetHash(), consensusBranchId);
+    }
+}
+
+/** Hand a stored block to the pre-check threads, unless they are behind */
+static void QueueBlockPrecheck(const CBlock& block, int nHeight)
+{
+    bool fShielded = false;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.vJoinSplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            fShielded = true;
+            break;
+        }
+    }
+    if (!fShielded)
+        return;
+
+    boost::unique_lock<boost::mutex> lock(mutexBlockPrecheck);
+    if (queueBlockPrecheck.size() >= MAX_BLOCK_PRECHECK_QUEUE)
+        return;
+    queueBlockPrecheck.push_back(std::make_pair(std::make_shared<const CBlock>(block), nHeight));
+    condBlockPrecheck.notify_one();
+}
+
+void ThreadBlockPrecheck()
+{
+    RenameThread("zcash-precheck");
+    const CChainParams& chainparams = Params();
+    while (true) {
+        std::pair<std::shared_ptr<const CBlock>, int> item;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexBlockPrecheck);
+            while (queueBlockPrecheck.empty())
+                condBlockPrecheck.wait(lock);
+            item = queueBlockPrecheck.front();
+            queueBlockPrecheck.pop_front();
+        }
+        PrecheckBlockProofs(*item.first, item.second, chainparams);
+    }
+}
+
+/**
+ * Whether the block at nHeight with the given hash is -assumevalid or one of
+ * its ancestors, with the assumed valid block on a best header chain that has
+ * the minimum chain work.
+ */
+static bool IsAssumedValid(const uint256& hash, int nHeight, const Consensus::Params& consensusParams)
+{
+    if (hashAssumeValid.IsNull())
+        return false;
+    AssertLockHeld(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end() || pindexBestHeader == NULL)
+        return false;
+    const CBlockIndex* pindexAssumed = it->second;
+    if (pindexBestHeader->GetAncestor(pindexAssumed->nHeight) != pindexAssumed ||
+        pindexBestHeader->nChainWork < UintToArith256(consensusParams.nMinimumChainWork))
+        return false;
+    const CBlockIndex* pindexAncestor = pindexAssumed->GetAncestor(nHeight);
+    return pindexAncestor && pindexAncestor->GetBlockHash() == hash;
+}
+
+/** Run checks on the script check threads, returning whether all passed */
+bool RunValidationChecks(std::vector<CValidationCheck>& vChecks)
+{
+    LOCK(cs_scriptcheckqueue);
+    CCheckQueueControl<CValidationCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+/**
+ * Read the coins and nullifiers spent by the block into pcoinsTip on the
+ * script check threads, so that connecting it does not wait on one
+ * database read after another.
+ */
+static void PrefetchInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads == 0)
+        return;
+
+    std::set<uint256> setCreated;
+    std::vector<uint256> vTxid;
+    std::vector<std::pair<uint256, ShieldedType> > vNullifiers;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        setCreated.insert(tx.GetHash());
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                // Outputs created earlier in the block are not in the database
+                if (!setCreated.count(txin.prevout.hash))
+                    vTxid.push_back(txin.prevout.hash);
+            }
+        }
+        BOOST_FOREACH(const JSDescription& joinsplit, tx.vJoinSplit) {
+            BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers)
+                vNullifiers.push_back(std::make_pair(nf, SPROUT));
+        }
+        BOOST_FOREACH(const SpendDescription& spend, tx.vShieldedSpend)
+            vNullifiers.push_back(std::make_pair(spend.nullifier, SAPLING));
+    }
+
+    pcoinsTip->Prefetch(vTxid, vNullifiers, [](std::vector<std::function<bool()> >& vReads) {
+        std::vector<CValidationCheck> vChecks;
+        vChecks.reserve(vReads.size());
+        for (std::function<bool()>& fn : vReads)
+            vChecks.push_back(CValidationCheck(fn));
+        RunValidationChecks(vChecks);
+    });
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2910,6 +3887,411 @@ void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&),
     }
 }
 
+/** Add the basic filter of a block to the filter index, chaining its header from the parent's */
+static bool IndexBlockFilter(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    uint256 hashPrevHeader;
+    if (pindex->pprev && !pblockfilterdb->ReadFilterHeader(pindex->pprev->GetBlockHash(), hashPrevHeader))
+        return error("%s: no filter header for %s", __func__, pindex->pprev->GetBlockHash().ToString());
+
+    BlockFilter filter(BLOCK_FILTER_BASIC, block, blockundo);
+    return pblockfilterdb->WriteFilter(pindex->GetBlockHash(), filter.GetEncodedFilter(), filter.ComputeHeader(hashPrevHeader));
+}
+
+bool SyncBlockFilterIndex(const CChain& chain, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    // Filters are keyed by block hash, so after a reorg indexing resumes
+    // from the fork point and the entries of stale blocks are left in place
+    const CBlockIndex* pindexFork = NULL;
+    uint256 hashBest;
+    if (pblockfilterdb->ReadBestBlock(hashBest)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+        if (mi != mapBlockIndex.end())
+            pindexFork = chain.FindFork(mi->second);
+    }
+    int nHeight = pindexFork ? pindexFork->nHeight : -1;
+
+    if (nHeight < chain.Height())
+        LogPrintf("Building block filters from height %d to %d\n", nHeight + 1, chain.Height());
+
+    for (nHeight++; nHeight <= chain.Height(); nHeight++) {
+        const CBlockIndex* pindex = chain[nHeight];
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams))
+            return error("%s: failed to read block at height %d", __func__, nHeight);
+        CBlockUndo blockundo;
+        if (pindex->pprev && !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data at height %d", __func__, nHeight);
+        if (!IndexBlockFilter(block, blockundo, pindex))
+            return false;
+        if (nHeight % 10000 == 0)
+            LogPrintf("Built block filters up to height %d\n", nHeight);
+    }
+    return true;
+}
+
+/** Add the transactions, shielded activity, fees and issuance of a block to the totals of its parent */
+static void AddBlockToChainStats(CChainStats& stats, const CBlock& block, const CBlockUndo& blockundo, int nHeight, const Consensus::Params& consensusParams)
+{
+    stats.nHeight = nHeight;
+    CAmount nBlockFees = 0;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        stats.nTransactions++;
+
+        bool fShielded = !tx.vJoinSplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty();
+        if (fShielded) {
+            stats.nShieldedTransactions++;
+            if (tx.vin.empty() && tx.vout.empty())
+                stats.nFullyShieldedTransactions++;
+        }
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            stats.nShieldedSpends += joinsplit.nullifiers.size();
+            stats.nShieldedOutputs += joinsplit.commitments.size();
+            stats.nSproutValue += joinsplit.vpub_old - joinsplit.vpub_new;
+        }
+        stats.nShieldedSpends += tx.vShieldedSpend.size();
+        stats.nShieldedOutputs += tx.vShieldedOutput.size();
+        stats.nSaplingValue -= tx.valueBalance;
+
+        if (i > 0 && i - 1 < blockundo.vtxundo.size()) {
+            CAmount nValueIn = tx.GetShieldedValueIn();
+            for (const CTxInUndo& undo : blockundo.vtxundo[i - 1].vprevout)
+                nValueIn += undo.txout.nValue;
+            nBlockFees += nValueIn - tx.GetValueOut();
+        }
+    }
+
+    if (block.vtx.empty())
+        return;
+    const CTransaction& coinbase = block.vtx[0];
+    stats.nFees += nBlockFees;
+    stats.nSupply += coinbase.GetValueOut() - nBlockFees;
+
+    // The outputs after the miner's are the zeronode payment and, while it
+    // lasts, the founders reward
+    bool fFoundersReward = nHeight >= consensusParams.nFeeStartBlockHeight &&
+                           nHeight <= consensusParams.GetLastFoundersRewardBlockHeight(nHeight);
+    CScript scriptFounders;
+    if (fFoundersReward)
+        scriptFounders = Params().GetFoundersRewardScriptAtHeight(nHeight);
+    for (size_t i = 1; i < coinbase.vout.size(); i++) {
+        if (fFoundersReward && coinbase.vout[i].scriptPubKey == scriptFounders)
+            continue;
+        stats.nZeronodePayouts += coinbase.vout[i].nValue;
+    }
+}
+
+/** Add the statistics of a block to the chain statistics index, on top of the parent's */
+static bool IndexChainStats(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    CChainStats stats;
+    if (pindex->pprev) {
+        if (!pchainstatsdb->ReadStats(pindex->pprev->GetBlockHash(), stats))
+            return error("%s: no chain statistics for %s", __func__, pindex->pprev->GetBlockHash().ToString());
+        AddBlockToChainStats(stats, block, blockundo, pindex->nHeight, consensusParams);
+    } else {
+        // The genesis coinbase is unspendable, so it adds nothing to the supply
+        stats.nHeight = pindex->nHeight;
+        stats.nTransactions = block.vtx.size();
+    }
+    return pchainstatsdb->WriteStats(pindex->GetBlockHash(), stats);
+}
+
+bool SyncChainStatsIndex(const CChain& chain, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    // As with the filter index, a reorg resumes from the fork point
+    const CBlockIndex* pindexFork = NULL;
+    uint256 hashBest;
+    if (pchainstatsdb->ReadBestBlock(hashBest)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+        if (mi != mapBlockIndex.end())
+            pindexFork = chain.FindFork(mi->second);
+    }
+    int nHeight = pindexFork ? pindexFork->nHeight : -1;
+
+    if (nHeight < chain.Height())
+        LogPrintf("Building chain statistics from height %d to %d\n", nHeight + 1, chain.Height());
+
+    for (nHeight++; nHeight <= chain.Height(); nHeight++) {
+        const CBlockIndex* pindex = chain[nHeight];
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams))
+            return error("%s: failed to read block at height %d", __func__, nHeight);
+        CBlockUndo blockundo;
+        if (pindex->pprev && !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data at height %d", __func__, nHeight);
+        if (!IndexChainStats(block, blockundo, pindex, consensusParams))
+            return false;
+        if (nHeight % 10000 == 0)
+            LogPrintf("Built chain statistics up to height %d\n", nHeight);
+    }
+    return true;
+}
+
+/** The changes a block makes to the address, address unspent and spent indexes */
+struct CExplorerIndexEntries
+{
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+    std::vector<CSpentIndexDbEntry> spentIndex;
+};
+
+/**
+ * Collect the explorer index entries of a block from the block and its undo
+ * data, in the same order as ConnectBlock (or, with fDisconnect, as
+ * DisconnectBlock) does from the coins view.
+ */
+static void GetExplorerIndexEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fDisconnect,
+                                    CExplorerIndexEntries& entries)
+{
+    for (size_t n = 0; n < block.vtx.size(); n++) {
+        // Disconnecting undoes the transactions in reverse order, outputs first
+        const size_t i = fDisconnect ? block.vtx.size() - 1 - n : n;
+        const CTransaction& tx = block.vtx[i];
+        const uint256 hash = tx.GetHash();
+
+        for (size_t m = 0; fDisconnect && m < tx.vout.size(); m++) {
+            const size_t k = tx.vout.size() - 1 - m;
+            const CTxOut& out = tx.vout[k];
+            CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+            if (scriptType == CScript::UNKNOWN)
+                continue;
+            uint160 const addrHash = out.scriptPubKey.AddressHash();
+            entries.addressIndex.push_back(make_pair(
+                CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, k, false), out.nValue));
+            entries.addressUnspentIndex.push_back(make_pair(
+                CAddressUnspentKey(scriptType, addrHash, hash, k), CAddressUnspentValue()));
+        }
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t m = 0; m < tx.vin.size(); m++) {
+                const size_t j = fDisconnect ? tx.vin.size() - 1 - m : m;
+                const CTxIn& input = tx.vin[j];
+                const CTxInUndo& undo = txundo.vprevout[j];
+                const CTxOut& prevout = undo.txout;
+                CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
+                const uint160 addrHash = prevout.scriptPubKey.AddressHash();
+                if (scriptType != CScript::UNKNOWN) {
+                    entries.addressIndex.push_back(make_pair(
+                        CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, j, true), prevout.nValue * -1));
+                    entries.addressUnspentIndex.push_back(make_pair(
+                        CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
+                        fDisconnect ? CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight) : CAddressUnspentValue()));
+                }
+                entries.spentIndex.push_back(make_pair(
+                    CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                    fDisconnect ? CSpentIndexValue() : CSpentIndexValue(hash, j, nHeight, prevout.nValue, scriptType, addrHash)));
+            }
+        }
+
+        for (size_t k = 0; !fDisconnect && k < tx.vout.size(); k++) {
+            const CTxOut& out = tx.vout[k];
+            CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+            if (scriptType == CScript::UNKNOWN)
+                continue;
+            uint160 const addrHash = out.scriptPubKey.AddressHash();
+            entries.addressIndex.push_back(make_pair(
+                CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, k, false), out.nValue));
+            entries.addressUnspentIndex.push_back(make_pair(
+                CAddressUnspentKey(scriptType, addrHash, hash, k),
+                CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+        }
+    }
+}
+
+/** Write the timestamp index entries of a block, chaining its logical time from the parent's */
+static bool WriteTimestampIndexEntries(const CBlockIndex* pindex)
+{
+    unsigned int logicalTS = pindex->nTime;
+    unsigned int prevLogicalTS = 0;
+
+    // retrieve logical timestamp of the previous block
+    if (pindex->pprev)
+        if (!pexplorerdb->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
+            LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+
+    if (logicalTS <= prevLogicalTS) {
+        logicalTS = prevLogicalTS + 1;
+        LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
+    }
+
+    return pexplorerdb->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())) &&
+           pexplorerdb->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS));
+}
+
+bool StartExplorerIndexBuild()
+{
+    AssertLockHeld(cs_main);
+    assert(!fInsightExplorer);
+    if (!chainActive.Genesis())
+        return false;
+
+    // The genesis block has no transactions to index
+    if (!pexplorerdb->WriteExplorerIndexBest(chainActive.Genesis()->GetBlockHash()) ||
+        !pblocktree->WriteFlag("addressbalances", true) ||
+        !pblocktree->WriteFlag("insightexplorer", true))
+        return false;
+    fInsightExplorer = true;
+    fExplorerIndexBuilding = true;
+    pindexExplorerBest = chainActive.Genesis();
+    LogPrintf("%s: building the explorer indexes in the background\n", __func__);
+    return true;
+}
+
+bool GetExplorerIndexSyncHeight(int& nHeight)
+{
+    LOCK(cs_main);
+    if (!fExplorerIndexBuilding)
+        return false;
+    nHeight = pindexExplorerBest ? pindexExplorerBest->nHeight : -1;
+    return true;
+}
+
+/** A block for the background explorer index builder to read */
+struct CExplorerIndexJob
+{
+    const CBlockIndex* pindex;
+    uint256 hashBlock;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+    CDiskBlockPos undoPos;
+    CExplorerIndexEntries entries;
+    bool fOk;
+};
+
+static void ReadExplorerIndexJobs(std::vector<CExplorerIndexJob>& vJobs, size_t nStart, size_t nStep,
+                                  const Consensus::Params& consensusParams)
+{
+    for (size_t i = nStart; i < vJobs.size(); i += nStep) {
+        CExplorerIndexJob& job = vJobs[i];
+        CBlock block;
+        CBlockUndo blockundo;
+        job.fOk = ReadBlockFromDisk(block, job.pos, consensusParams) && block.GetHash() == job.hashBlock &&
+                  UndoReadFromDisk(blockundo, job.undoPos, job.hashPrev) &&
+                  blockundo.vtxundo.size() + 1 == block.vtx.size();
+        if (job.fOk)
+            GetExplorerIndexEntries(block, blockundo, job.pindex->nHeight, false, job.entries);
+    }
+}
+
+/** Take the background build back to the last block it covers that is still on the active chain (requires cs_main) */
+static bool RewindExplorerIndex(const Consensus::Params& consensusParams)
+{
+    while (!chainActive.Contains(pindexExplorerBest)) {
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindexExplorerBest, consensusParams) ||
+            !UndoReadFromDisk(blockundo, pindexExplorerBest->GetUndoPos(), pindexExplorerBest->pprev->GetBlockHash()))
+            return error("%s: failed to read block %s", __func__, pindexExplorerBest->GetBlockHash().ToString());
+        CExplorerIndexEntries entries;
+        GetExplorerIndexEntries(block, blockundo, pindexExplorerBest->nHeight, true, entries);
+        if (!pexplorerdb->EraseAddressIndex(entries.addressIndex) ||
+            !pexplorerdb->UpdateAddressUnspentIndex(entries.addressUnspentIndex) ||
+            !pexplorerdb->UpdateSpentIndex(entries.spentIndex) ||
+            !pexplorerdb->WriteExplorerIndexBest(pindexExplorerBest->pprev->GetBlockHash()))
+            return error("%s: failed to write the explorer indexes", __func__);
+        pindexExplorerBest = pindexExplorerBest->pprev;
+    }
+    return true;
+}
+
+void ThreadBuildExplorerIndex()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const int nThreads = std::max(1, std::min(GetNumCores(), EXPLORER_INDEX_MAX_THREADS));
+    int64_t nLastLog = GetTime();
+
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        std::vector<CExplorerIndexJob> vJobs;
+        {
+            LOCK(cs_main);
+            if (!RewindExplorerIndex(consensusParams)) {
+                AbortNode("Failed to rewind the explorer indexes");
+                return;
+            }
+            if (pindexExplorerBest == chainActive.Tip()) {
+                // Blocks connected from now on are indexed as they come
+                CExplorerIndexUpdate update;
+                update.hashBest = chainActive.Tip()->GetBlockHash();
+                if (!pexplorerdb->QueueUpdate(update) || !pexplorerdb->CommitQueued(true) ||
+                    !pexplorerdb->EraseExplorerIndexBest()) {
+                    AbortNode("Failed to write the explorer indexes");
+                    return;
+                }
+                fAddressIndex = true;
+                fSpentIndex = true;
+                fTimestampIndex = true;
+                fExplorerIndexBuilding = false;
+                pindexExplorerBest = NULL;
+                LogPrintf("%s: explorer indexes are complete at height %d\n", __func__, chainActive.Height());
+                return;
+            }
+            for (int nHeight = pindexExplorerBest->nHeight + 1;
+                 nHeight <= chainActive.Height() && vJobs.size() < EXPLORER_INDEX_BATCH_SIZE; nHeight++) {
+                const CBlockIndex* pindex = chainActive[nHeight];
+                CExplorerIndexJob job;
+                job.pindex = pindex;
+                job.hashBlock = pindex->GetBlockHash();
+                job.hashPrev = pindex->pprev->GetBlockHash();
+                job.pos = pindex->GetBlockPos();
+                job.undoPos = pindex->GetUndoPos();
+                job.fOk = false;
+                vJobs.push_back(job);
+            }
+        }
+
+        // Reading and decoding the blocks is most of the work, so it is
+        // spread over several threads, without holding cs_main
+        boost::thread_group readers;
+        try {
+            for (int i = 1; i < nThreads; i++)
+                readers.create_thread(boost::bind(&ReadExplorerIndexJobs, boost::ref(vJobs), i, nThreads, boost::cref(consensusParams)));
+            ReadExplorerIndexJobs(vJobs, 0, nThreads, consensusParams);
+            readers.join_all();
+        } catch (const boost::thread_interrupted&) {
+            readers.interrupt_all();
+            readers.join_all();
+            throw;
+        }
+
+        // Write the blocks in chain order, as long as they are still on the active chain
+        for (size_t i = 0; i < vJobs.size(); i++) {
+            const CExplorerIndexJob& job = vJobs[i];
+            LOCK(cs_main);
+            if (job.pindex->pprev != pindexExplorerBest || !chainActive.Contains(job.pindex))
+                break;
+            if (!job.fOk) {
+                AbortNode(strprintf("Failed to read block %s to build the explorer indexes", job.hashBlock.ToString()),
+                          _("Error reading a block to build the explorer indexes. If blocks were pruned, you need to rebuild the database using -reindex"));
+                return;
+            }
+            if (!pexplorerdb->WriteAddressIndex(job.entries.addressIndex) ||
+                !pexplorerdb->UpdateAddressUnspentIndex(job.entries.addressUnspentIndex) ||
+                !pexplorerdb->UpdateSpentIndex(job.entries.spentIndex) ||
+                !WriteTimestampIndexEntries(job.pindex) ||
+                !pexplorerdb->WriteExplorerIndexBest(job.hashBlock)) {
+                AbortNode("Failed to write the explorer indexes");
+                return;
+            }
+            pindexExplorerBest = job.pindex;
+        }
+
+        if (GetTime() - nLastLog >= 60) {
+            LOCK(cs_main);
+            LogPrintf("%s: explorer indexes built up to height %d of %d\n", __func__, pindexExplorerBest->nHeight, chainActive.Height());
+            nLastLog = GetTime();
+        }
+    }
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2917,10 +4299,21 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck,
+                  CConnectBlockTimings* pTimings)
 {
     AssertLockHeld(cs_main);
 
+    // Add the time since the previous call to the given phase, when timing
+    int64_t nTimePhase = pTimings ? GetTimeMicros() : 0;
+    auto chargeTime = [&](int64_t CConnectBlockTimings::*pPhase) {
+        if (pTimings) {
+            int64_t nNow = GetTimeMicros();
+            pTimings->*pPhase += nNow - nTimePhase;
+            nTimePhase = nNow;
+        }
+    };
+
     bool fExpensiveChecks = true;
     if (fCheckpointsEnabled) {
         CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
@@ -2929,13 +4322,24 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fExpensiveChecks = false;
         }
     }
+    if (fExpensiveChecks && IsAssumedValid(pindex->GetBlockHash(), pindex->nHeight, chainparams.GetConsensus())) {
+        // Below -assumevalid: skip script and JoinSplit proof checks, while
+        // the commitment tree, nullifier and value pool checks still apply
+        fExpensiveChecks = false;
+    }
 
     auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
 
-    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in.
+    // With script check threads the proofs are verified alongside the scripts below.
+    bool fParallelChecks = fExpensiveChecks && nScriptCheckThreads && !pTimings;
+    std::vector<CValidationCheck> vProofChecks;
+    if (!CheckBlock(block, state, chainparams, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck,
+                    fParallelChecks ? &vProofChecks : NULL))
         return false;
+    bool fProofChecks = !vProofChecks.empty();
+    chargeTime(&CConnectBlockTimings::nTimeSproutProofs);
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
@@ -2951,6 +4355,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             pindex->hashSproutAnchor = tree.root();
             // The genesis block contained no JoinSplits
             pindex->hashFinalSproutRoot = pindex->hashSproutAnchor;
+            if (pblockfilterdb && !IndexBlockFilter(block, CBlockUndo(), pindex))
+                return AbortNode(state, "Failed to write block filter index");
+            if (pchainstatsdb && !IndexChainStats(block, CBlockUndo(), pindex, chainparams.GetConsensus()))
+                return AbortNode(state, "Failed to write chain statistics index");
         }
         return true;
     }
@@ -2992,6 +4400,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
                              REJECT_INVALID, "bad-txns-BIP30");
     }
+    chargeTime(&CConnectBlockTimings::nTimeInputs);
 
     unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
 
@@ -2999,7 +4408,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    LOCK(cs_scriptcheckqueue);
+    CCheckQueueControl<CValidationCheck> control(fParallelChecks ? &scriptcheckqueue : NULL);
+    // The position of each transaction's first script check, to tell which one failed
+    uint64_t nQueuedChecks = vProofChecks.size();
+    std::vector<std::pair<uint64_t, uint256> > vCheckTxs;
+    control.Add(vProofChecks);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -3012,6 +4426,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<CAddressIndexDbEntry> addressIndex;
     std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
     std::vector<CSpentIndexDbEntry> spentIndex;
+    std::vector<CNullifierIndexDbEntry> nullifierIndex;
+    std::vector<CCommitmentIndexDbEntry> commitmentIndex;
 
     // Construct the incremental merkle tree at the current
     // block position,
@@ -3033,6 +4449,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
+    chargeTime(&CConnectBlockTimings::nTimeTrees);
 
     // Grab the consensus branch ID for the block's height
     auto consensusBranchId = CurrentEpochBranchId(pindex->nHeight, chainparams.GetConsensus());
@@ -3101,19 +4518,35 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return state.DoS(100, error("ConnectBlock(): too many sigops"),
                                  REJECT_INVALID, "bad-blk-sigops");
         }
+        chargeTime(&CConnectBlockTimings::nTimeInputs);
 
-        txdata.emplace_back(tx);
+        // Only transparent inputs whose scripts are checked use the hashes
+        if (fExpensiveChecks && !tx.IsCoinBase() && !tx.vin.empty())
+            txdata.emplace_back(tx);
+        else
+            txdata.emplace_back();
 
         if (!tx.IsCoinBase())
         {
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
+            chargeTime(&CConnectBlockTimings::nTimeInputs);
 
             std::vector<CScriptCheck> vChecks;
-            bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            bool fCacheResults = fJustCheck && !pTimings; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, txdata[i], chainparams.GetConsensus(), consensusBranchId, fParallelChecks ? &vChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            std::vector<CValidationCheck> vJobs;
+            vJobs.reserve(vChecks.size());
+            for (CScriptCheck& check : vChecks) {
+                vJobs.push_back(CValidationCheck::From(check));
+            }
+            if (!vJobs.empty()) {
+                vCheckTxs.push_back(std::make_pair(nQueuedChecks, tx.GetHash()));
+                nQueuedChecks += vJobs.size();
+            }
+            control.Add(vJobs);
         }
+        chargeTime(&CConnectBlockTimings::nTimeScripts);
 
         // insightexplorer
         // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2656
@@ -3142,6 +4575,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        chargeTime(&CConnectBlockTimings::nTimeInputs);
+
+        // Record where the nullifiers are revealed and the commitments land in the trees
+        if (fNoteIndex)
+            GetNoteIndexEntries(tx, pindex->nHeight, sprout_tree.size(), sapling_tree.size(), nullifierIndex, commitmentIndex);
+        chargeTime(&CConnectBlockTimings::nTimeIndex);
 
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vJoinSplit) {
             BOOST_FOREACH(const uint256 &note_commitment, joinsplit.commitments) {
@@ -3155,12 +4594,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             sapling_tree.append(outputDescription.cm);
         }
 
+        chargeTime(&CConnectBlockTimings::nTimeTrees);
+
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        chargeTime(&CConnectBlockTimings::nTimeIndex);
     }
 
     view.PushAnchor(sprout_tree);
     view.PushAnchor(sapling_tree);
+    chargeTime(&CConnectBlockTimings::nTimeTrees);
     if (!fJustCheck) {
         pindex->hashFinalSproutRoot = sprout_tree.root();
     }
@@ -3177,6 +4620,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
+    if (!fJustCheck)
+        RecordPerfStat(PERF_CONNECT_TRANSACTIONS, nTime1 - nTimeStart);
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
@@ -3186,13 +4631,48 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                block.vtx[0].GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
-        return state.DoS(100, false);
+    CCheckQueueResult checkResult;
+    if (!control.Wait(&checkResult)) {
+        // The proofs were queued first, so the position tells which kind failed
+        std::vector<std::pair<uint64_t, uint256> >::const_iterator it = std::upper_bound(
+            vCheckTxs.begin(), vCheckTxs.end(), std::make_pair((uint64_t)checkResult.nFailed, uint256()),
+            [](const std::pair<uint64_t, uint256>& a, const std::pair<uint64_t, uint256>& b) { return a.first < b.first; });
+        if (it == vCheckTxs.begin()) {
+            // Have CheckBlock say which JoinSplit proof failed
+            if (fProofChecks && !CheckBlock(block, state, chainparams, verifier, false, false))
+                return false;
+            return state.DoS(100, false);
+        }
+        LogPrint("bench", "    - Verify stopped after %u checks, %u skipped\n", checkResult.nChecked, checkResult.nSkipped);
+        return state.DoS(100, error("ConnectBlock(): script verification failed for transaction %s",
+                                    (it - 1)->second.ToString()),
+                         REJECT_INVALID, "mandatory-script-verify-flag-failed");
+    }
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
+    if (!fJustCheck)
+        RecordPerfStat(PERF_CONNECT_VERIFY, nTime2 - nTimeStart);
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
-    if (fJustCheck)
+    if (pTimings) {
+        pTimings->nBlocks++;
+        pTimings->nTransactions += block.vtx.size();
+        nTimePhase = GetTimeMicros();
+    }
+
+    if (fJustCheck) {
+        if (pTimings) {
+            // Nothing is written when just checking: build what would be
+            CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+            hasher << pindex->pprev->GetBlockHash() << blockundo;
+            CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+            ssUndo << blockundo << hasher.GetHash();
+            chargeTime(&CConnectBlockTimings::nTimeUndo);
+            CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+            ssIndex << vPos << addressIndex << addressUnspentIndex << spentIndex << nullifierIndex << commitmentIndex;
+            chargeTime(&CConnectBlockTimings::nTimeIndex);
+        }
         return true;
+    }
 
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
@@ -3223,51 +4703,51 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
         setDirtyBlockIndex.insert(pindex);
     }
+    chargeTime(&CConnectBlockTimings::nTimeUndo);
+
+    if (pblockfilterdb && !IndexBlockFilter(block, blockundo, pindex))
+        return AbortNode(state, "Failed to write block filter index");
+    if (pchainstatsdb && !IndexChainStats(block, blockundo, pindex, chainparams.GetConsensus()))
+        return AbortNode(state, "Failed to write chain statistics index");
+
+    // Keep the undo data around in case the block is disconnected soon
+    recentUndo.Add(pindex->GetBlockHash(), std::move(blockundo));
 
     if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+        if (!ptxindexdb->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
     // START insightexplorer
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
+    // Written with those of the following blocks at the next flush
+    if (fAddressIndex || fSpentIndex) {
+        CExplorerIndexUpdate update;
+        update.hashBest = pindex->GetBlockHash();
+        if (fAddressIndex) {
+            update.addressIndex.swap(addressIndex);
+            update.addressUnspentIndex.swap(addressUnspentIndex);
         }
+        if (fSpentIndex)
+            update.spentIndex.swap(spentIndex);
+        if (!pexplorerdb->QueueUpdate(update))
+            return AbortNode(state, "Failed to write address and spent indexes");
     }
-    if (fSpentIndex) {
-        if (!pblocktree->UpdateSpentIndex(spentIndex)) {
-            return AbortNode(state, "Failed to write spent index");
+    if (fNoteIndex) {
+        if (!pexplorerdb->WriteNoteIndex(nullifierIndex, commitmentIndex)) {
+            return AbortNode(state, "Failed to write note index");
         }
     }
     if (fTimestampIndex) {
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-
-        // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-
-        if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
-
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
+        if (!WriteTimestampIndexEntries(pindex))
             return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
     }
     // END insightexplorer
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    chargeTime(&CConnectBlockTimings::nTimeIndex);
 
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
+    RecordPerfStat(PERF_CONNECT_INDEX, nTime3 - nTime2);
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
@@ -3276,6 +4756,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
+    RecordPerfStat(PERF_CONNECT_CALLBACKS, nTime4 - nTime3);
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
 
     return true;
@@ -3342,7 +4823,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
+        if (!FlushBlockFile())
+            return AbortNode(state, "Failed to write block files");
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -3360,6 +4842,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // The solutions written are read back from the database from now on
+            LOCK(cs_blockSolutions);
+            BOOST_FOREACH(const CBlockIndex* pindex, vBlocks)
+                mapBlockSolutions.erase(pindex);
         }
         // Finally remove any pruned files
         if (fFlushForPrune)
@@ -3376,13 +4862,24 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // The database write itself usually finishes in the background.
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        if (mode == FLUSH_STATE_ALWAYS && pcoinsflusher && !pcoinsflusher->Sync())
+            return AbortNode(state, "Failed to write to coin database");
+        // The index databases are written without syncing as blocks are
+        // connected, and made durable here along with the chainstate
+        if (ptxindexdb && !ptxindexdb->Sync())
+            return AbortNode(state, "Failed to write to transaction index database");
+        if (pexplorerdb && !pexplorerdb->CommitQueued(mode == FLUSH_STATE_ALWAYS))
+            return AbortNode(state, "Failed to write to explorer index database");
+        if (pexplorerdb && !pexplorerdb->Sync())
+            return AbortNode(state, "Failed to write to explorer index database");
         nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
         // Update best block in wallet (so we can detect restored wallets).
-        GetMainSignals().SetBestChain(chainActive.GetLocator());
+        GetMainSignals().SetBestChain(GetCachedLocator(chainActive.Tip()));
         nLastSetChain = nNow;
     }
     } catch (const std::runtime_error& e) {
@@ -3402,9 +4899,31 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot()
+{
+    LOCK(cs_chainSnapshot);
+    return pchainSnapshot;
+}
+
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+    return mi == mapBlockIndex.end() ? NULL : mi->second;
+}
+
+/** Publish chainActive to readers without cs_main; called after every change to it */
+static void PublishChainSnapshot()
+{
+    std::shared_ptr<const CChainSnapshot> pnew = std::make_shared<const CChainSnapshot>(chainActive, GetChainSnapshot().get());
+    LOCK(cs_chainSnapshot);
+    pchainSnapshot = pnew;
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    PublishChainSnapshot();
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -3418,12 +4937,65 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     cvBlockChange.notify_all();
 }
 
+bool GetSaplingTreeAt(const CBlockIndex* pindex, SaplingMerkleTree& tree)
+{
+    AssertLockHeld(cs_main);
+
+    if (pcoinsTip->GetSaplingAnchorAt(pindex->hashFinalSaplingRoot, tree))
+        return true;
+
+    if (!pSaplingFrontierDB || nSaplingFrontierInterval <= 0)
+        return false;
+
+    // Start from the nearest checkpoint and replay the commitments after it
+    int nCheckpointHeight = pindex->nHeight - pindex->nHeight % nSaplingFrontierInterval;
+    const CBlockIndex* pcheckpoint = pindex->GetAncestor(nCheckpointHeight);
+    uint256 hashCheckpoint;
+    if (!pcheckpoint || !pSaplingFrontierDB->ReadFrontier(nCheckpointHeight, hashCheckpoint, tree))
+        return false;
+    if (hashCheckpoint != pcheckpoint->GetBlockHash())
+        return false;
+
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (int nHeight = nCheckpointHeight + 1; nHeight <= pindex->nHeight; nHeight++) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex->GetAncestor(nHeight), consensusParams))
+            return false;
+        for (const CTransaction& tx : block.vtx) {
+            for (const OutputDescription& output : tx.vShieldedOutput) {
+                tree.append(output.cm);
+            }
+        }
+    }
+
+    return tree.root() == pindex->hashFinalSaplingRoot;
+}
+
+/**
+ * What a run of DisconnectTip calls into one cache layer leaves for the
+ * mempool: the disconnected blocks, whose transactions go back to the
+ * mempool once the layer is flushed, and the anchors they invalidated.
+ */
+struct DisconnectedBlockTransactions
+{
+    //! Tip first
+    std::vector<CBlock> vBlocks;
+    std::set<uint256> setSproutAnchors;
+    std::set<uint256> setSaplingAnchors;
+};
+
 /**
  * Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and
  * mempool.removeWithoutBranchId after this, with cs_main held.
+ * With pviewBatch, the block is disconnected into that cache layer instead of
+ * pcoinsTip, and its transactions are left in *pdisconnected for
+ * FinishDisconnects to resurrect.
  */
-bool static DisconnectTip(CValidationState &state, const CChainParams& chainparams, bool fBare = false)
+bool static DisconnectTip(CValidationState &state, const CChainParams& chainparams, bool fBare = false,
+                          CCoinsViewCache *pviewBatch = NULL, DisconnectedBlockTransactions *pdisconnected = NULL)
 {
+    assert(!pviewBatch == !pdisconnected);
+    CCoinsViewCache *pviewTip = pviewBatch ? pviewBatch : pcoinsTip;
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
     // Read block from disk.
@@ -3431,24 +5003,32 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
     if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
         return AbortNode(state, "Failed to read block");
     // Apply the block atomically to the chain state.
-    uint256 sproutAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
-    uint256 saplingAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
+    uint256 sproutAnchorBeforeDisconnect = pviewTip->GetBestAnchor(SPROUT);
+    uint256 saplingAnchorBeforeDisconnect = pviewTip->GetBestAnchor(SAPLING);
     int64_t nStart = GetTimeMicros();
     {
-        CCoinsViewCache view(pcoinsTip);
+        CCoinsViewCache view(pviewTip);
         // insightexplorer: update indices (true)
         if (DisconnectBlock(block, state, pindexDelete, view, chainparams, true) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    uint256 sproutAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
-    uint256 saplingAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
+    uint256 sproutAnchorAfterDisconnect = pviewTip->GetBestAnchor(SPROUT);
+    uint256 saplingAnchorAfterDisconnect = pviewTip->GetBestAnchor(SAPLING);
     // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+    if (!pviewBatch && !FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
 
-    if (!fBare) {
+    if (!fBare && pdisconnected) {
+        // The anchor may not change between block disconnects,
+        // in which case we don't want to evict from the mempool yet!
+        if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect)
+            pdisconnected->setSproutAnchors.insert(sproutAnchorBeforeDisconnect);
+        if (saplingAnchorBeforeDisconnect != saplingAnchorAfterDisconnect)
+            pdisconnected->setSaplingAnchors.insert(saplingAnchorBeforeDisconnect);
+        pdisconnected->vBlocks.push_back(block);
+    } else if (!fBare) {
         // Resurrect mempool transactions from the disconnected block.
         BOOST_FOREACH(const CTransaction &tx, block.vtx) {
             // ignore validation errors in resurrected transactions
@@ -3460,22 +5040,30 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
         if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect) {
             // The anchor may not change between block disconnects,
             // in which case we don't want to evict from the mempool yet!
-            mempool.removeWithAnchor(sproutAnchorBeforeDisconnect, SPROUT);
+            mempool.removeWithAnchor(std::set<uint256>{sproutAnchorBeforeDisconnect}, SPROUT);
         }
         if (saplingAnchorBeforeDisconnect != saplingAnchorAfterDisconnect) {
             // The anchor may not change between block disconnects,
             // in which case we don't want to evict from the mempool yet!
-            mempool.removeWithAnchor(saplingAnchorBeforeDisconnect, SAPLING);
+            mempool.removeWithAnchor(std::set<uint256>{saplingAnchorBeforeDisconnect}, SAPLING);
         }
     }
 
+    // Drop the disconnected block from the compact block store
+    if (pcompactblocks && !pcompactblocks->Truncate(pindexDelete->nHeight - 1))
+        return AbortNode(state, "Failed to truncate compact block store");
+
+    // Drop the frontier checkpoint taken at the disconnected block, if any
+    if (pSaplingFrontierDB && nSaplingFrontierInterval > 0 && pindexDelete->nHeight % nSaplingFrontierInterval == 0)
+        pSaplingFrontierDB->EraseFrontier(pindexDelete->nHeight);
+
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev, chainparams);
     // Get the current commitment tree
     SproutMerkleTree newSproutTree;
     SaplingMerkleTree newSaplingTree;
-    assert(pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), newSproutTree));
-    assert(pcoinsTip->GetSaplingAnchorAt(pcoinsTip->GetBestAnchor(SAPLING), newSaplingTree));
+    assert(pviewTip->GetSproutAnchorAt(pviewTip->GetBestAnchor(SPROUT), newSproutTree));
+    assert(pviewTip->GetSaplingAnchorAt(pviewTip->GetBestAnchor(SAPLING), newSaplingTree));
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
@@ -3483,6 +5071,41 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
     }
     // Update cached incremental witnesses
     GetMainSignals().ChainTip(pindexDelete, &block, newSproutTree, newSaplingTree, false);
+    TRACE3(validation, block_disconnected, pindexDelete->phashBlock->begin(), pindexDelete->nHeight, block.vtx.size());
+    return true;
+}
+
+/**
+ * Flush the cache layer a run of DisconnectTip calls went into, then give
+ * the transactions of the disconnected blocks back to the mempool, oldest
+ * block first so that parents go in before their children, and evict the
+ * mempool transactions spending from the anchors the blocks invalidated.
+ * Transactions whose proofs were verified when their block was connected
+ * find them in the proof cache.
+ */
+static bool FinishDisconnects(CValidationState &state, CCoinsViewCache &viewBatch, DisconnectedBlockTransactions &disconnected)
+{
+    assert(viewBatch.Flush());
+    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+        return false;
+
+    int64_t nStart = GetTimeMicros();
+    size_t nResurrected = 0;
+    BOOST_REVERSE_FOREACH(const CBlock &block, disconnected.vBlocks) {
+        BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+            // ignore validation errors in resurrected transactions
+            list<CTransaction> removed;
+            CValidationState stateDummy;
+            if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+                mempool.remove(tx, removed, true);
+            else
+                nResurrected++;
+        }
+    }
+    mempool.removeWithAnchor(disconnected.setSproutAnchors, SPROUT);
+    mempool.removeWithAnchor(disconnected.setSaplingAnchors, SAPLING);
+    LogPrint("bench", "- Resurrect %u transactions of %u blocks: %.2fms\n", nResurrected, disconnected.vBlocks.size(),
+             (GetTimeMicros() - nStart) * 0.001);
     return true;
 }
 
@@ -3514,9 +5137,12 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     assert(pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), oldSproutTree));
     assert(pcoinsTip->GetSaplingAnchorAt(pcoinsTip->GetBestAnchor(SAPLING), oldSaplingTree));
     // Apply the block atomically to the chain state.
+    // Warm the cache with the block's inputs
+    PrefetchInputs(*pblock);
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    RecordPerfStat(PERF_CONNECT_READ_BLOCK, nTime2 - nTime1);
     int64_t nTime3;
-    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    LogPrint("bench", "  - Load block and inputs from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
@@ -3528,15 +5154,18 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        RecordPerfStat(PERF_CONNECT_BLOCK, nTime3 - nTime2);
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    RecordPerfStat(PERF_CONNECT_FLUSH, nTime4 - nTime3);
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
+    RecordPerfStat(PERF_CONNECT_CHAINSTATE, nTime5 - nTime4);
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
@@ -3545,6 +5174,32 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Remove transactions that expire at new block height from mempool
     mempool.removeExpired(pindexNew->nHeight);
 
+    // Checkpoint the Sapling frontier every nSaplingFrontierInterval blocks
+    if (pSaplingFrontierDB && nSaplingFrontierInterval > 0 && pindexNew->nHeight % nSaplingFrontierInterval == 0) {
+        SaplingMerkleTree newSaplingTree;
+        assert(pcoinsTip->GetSaplingAnchorAt(pcoinsTip->GetBestAnchor(SAPLING), newSaplingTree));
+        if (!pSaplingFrontierDB->WriteFrontier(pindexNew->nHeight, pindexNew->GetBlockHash(), newSaplingTree))
+            return AbortNode(state, "Failed to write Sapling frontier checkpoint");
+    }
+
+    // Append the compact form of the block, unless the store is still catching up
+    if (pcompactblocks && pcompactblocks->Height() == pindexNew->nHeight - 1) {
+        if (!pcompactblocks->Append(CCompactBlock(*pblock, pindexNew->nHeight)))
+            return AbortNode(state, "Failed to write compact block");
+    }
+
+    // Keep the block for the wallet, RPC clients and peers that read it next
+    std::shared_ptr<const CBlock> pblockShared;
+    if (recentBlocks.IsEnabled()) {
+        if (pblock == &block)
+            pblockShared = std::make_shared<const CBlock>(std::move(block));
+        else
+            pblockShared = std::make_shared<const CBlock>(*pblock);
+        recentBlocks.Add(pblockShared);
+        pblock = pblockShared.get();
+    }
+    recentHeaders.Add(pindexNew->nHeight, pindexNew->GetBlockHash(), *pblock);
+
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
     // Tell wallet about transactions that went from mempool
@@ -3562,8 +5217,11 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     EnforceNodeDeprecation(pindexNew->nHeight);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
+    RecordPerfStat(PERF_CONNECT_POSTPROCESS, nTime6 - nTime5);
+    RecordPerfStat(PERF_CONNECT_TIP, nTime6 - nTime1);
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    TRACE5(validation, block_connected, pindexNew->phashBlock->begin(), pindexNew->nHeight, pblock->vtx.size(), nTime3 - nTime2, nTime6 - nTime1);
     return true;
 }
 
@@ -3686,12 +5344,24 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         return false;
     }
 
-    // Disconnect active blocks which are no longer in the best chain.
+    // Disconnect active blocks which are no longer in the best chain, all
+    // into one cache layer over pcoinsTip, and only then resurrect their
+    // transactions.
     bool fBlocksDisconnected = false;
-    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+    if (chainActive.Tip() && chainActive.Tip() != pindexFork) {
+        CCoinsViewCache viewDisconnect(pcoinsTip);
+        DisconnectedBlockTransactions disconnected;
+        bool fDisconnected = true;
+        while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
+            if (!DisconnectTip(state, chainparams, false, &viewDisconnect, &disconnected)) {
+                fDisconnected = false;
+                break;
+            }
+            fBlocksDisconnected = true;
+        }
+        // chainActive already reflects the blocks disconnected so far
+        if (!FinishDisconnects(state, viewDisconnect, disconnected) || !fDisconnected)
             return false;
-        fBlocksDisconnected = true;
     }
 
     // Build list of new blocks to connect.
@@ -3790,10 +5460,37 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
             if (fCheckpointsEnabled)
                 nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints());
             {
-                LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                // Peers in compact block high-bandwidth mode get the block
+                // itself as a "cmpctblock", everybody else an "inv"
+                std::unique_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
+                bool fCmpctBlockRead = false;
+                int nPeers = 0;
+                LOCK2(cs_main, cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    CNodeState* nodestate = State(pnode->GetId());
+                    if (nodestate && nodestate->fPreferHeaderAndIDs && nodestate->pindexBestKnownBlock != pindexNewTip) {
+                        if (!fCmpctBlockRead) {
+                            fCmpctBlockRead = true;
+                            CBlock blockRead;
+                            if (pblock && pblock->GetHash() == hashNewTip)
+                                pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
+                            else if (ReadBlockFromDisk(blockRead, pindexNewTip, chainparams.GetConsensus()))
+                                pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(blockRead));
+                        }
+                        if (pcmpctblock) {
+                            LogPrint("cmpctblock", "%s sending header-and-ids %s to peer=%d\n", __func__, hashNewTip.ToString(), pnode->id);
+                            pnode->AddInventoryKnown(CInv(MSG_BLOCK, hashNewTip));
+                            pnode->PushMessage("cmpctblock", *pcmpctblock);
+                            nPeers++;
+                            continue;
+                        }
+                    }
+                    pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                    nPeers++;
+                }
+                TRACE3(net, relay_block, hashNewTip.begin(), pindexNewTip->nHeight, nPeers);
             }
             // Notify external listeners about the new tip.
             GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -3893,13 +5590,21 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
+    {
+        // Before the entry can be found, as headers are built without cs_main
+        LOCK(cs_blockSolutions);
+        mapBlockSolutions[pindexNew] = block.nSolution;
+    }
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    BlockMap::iterator mi;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+        mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    }
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
@@ -3907,7 +5612,9 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
+        setChainTips.erase(pindexNew->pprev);
     }
+    setChainTips.insert(pindexNew);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
@@ -4197,7 +5904,9 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nFile, vinfoBlockFile[nFile].ToString());
         }
-        FlushBlockFile(!fKnown);
+        // The file is committed with the next flush of the block index
+        if (!FlushBlockFile(!fKnown, false))
+            return state.Error("failed to write block file");
         nLastBlockFile = nFile;
     }
 
@@ -4213,11 +5922,16 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
+            // During initial block download a new file will be filled, so
+            // it is allocated whole
+            unsigned int nEnd = nNewChunks * BLOCKFILE_CHUNK_SIZE;
+            if (pos.nPos == 0 && IsInitialBlockDownload(Params()))
+                nEnd = std::max(nEnd, MAX_BLOCKFILE_SIZE);
+            if (CheckDiskSpace(nEnd - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
-                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
+                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nEnd, pos.nFile);
+                    AllocateFileRange(file, pos.nPos, nEnd - pos.nPos);
                     fclose(file);
                 }
             }
@@ -4265,7 +5979,8 @@ bool CheckBlockHeader(
     const CBlockHeader& block,
     CValidationState& state,
     const CChainParams& chainparams,
-    bool fCheckPOW)
+    bool fCheckPOW,
+    bool fCheckSolution)
 {
 
     bool cosmosActive = chainparams.GetConsensus().NetworkUpgradeActive(chainActive.Height()+1, Consensus::UPGRADE_COSMOS);
@@ -4275,8 +5990,8 @@ bool CheckBlockHeader(
         return state.DoS(100, error("CheckBlockHeader(): block version too low"),
                          REJECT_INVALID, "version-too-low");
 
-    // Check Equihash solution is valid
-    if (fCheckPOW && !CheckEquihashSolution(&block, chainparams.GetConsensus()))
+    // Check Equihash solution is valid, unless the caller already did
+    if (fCheckPOW && fCheckSolution && !CheckEquihashSolutionCached(block, chainparams.GetConsensus()))
         return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
                          REJECT_INVALID, "invalid-solution");
 
@@ -4299,7 +6014,8 @@ bool CheckBlockHeader(
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 const CChainParams& chainparams,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW, bool fCheckMerkleRoot)
+                bool fCheckPOW, bool fCheckMerkleRoot,
+                std::vector<CValidationCheck> *pvChecks)
 {
     // These are checks that are independent of context.
 
@@ -4311,7 +6027,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+        uint256 hashMerkleRoot2 = block.ComputeMerkleRoot(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
                              REJECT_INVALID, "bad-txnmrklroot", true);
@@ -4394,10 +6110,19 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
          }
      }
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+    // Check transactions, leaving JoinSplit proofs to the script check
+    // threads when there are any
+    std::vector<CValidationCheck> vChecks;
+    std::vector<CValidationCheck> *pvTxChecks = pvChecks ? pvChecks : (nScriptCheckThreads ? &vChecks : NULL);
+    // Proofs already verified in the mempool are not checked again
+    uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
+    std::vector<bool> vProofsVerified(block.vtx.size(), false);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        vProofsVerified[i] = nHeight > 0 && !tx.vJoinSplit.empty() && IsShieldedTxVerified(tx.GetHash(), consensusBranchId);
+        if (!(vProofsVerified[i] ? CheckTransactionWithoutProofVerification(tx, state) : CheckTransaction(tx, state, verifier, pvTxChecks)))
             return error("CheckBlock(): CheckTransaction failed");
+    }
 
     unsigned int nSigOps = 0;
     BOOST_FOREACH(const CTransaction& tx, block.vtx)
@@ -4408,6 +6133,15 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (!vChecks.empty() && !RunValidationChecks(vChecks)) {
+        // Check each transaction in turn to find the one that failed
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            if (!vProofsVerified[i] && !CheckTransaction(block.vtx[i], state, verifier))
+                return error("CheckBlock(): CheckTransaction failed");
+        return state.DoS(100, error("CheckBlock(): JoinSplit verification failed"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    }
+
     return true;
 }
 
@@ -4457,11 +6191,19 @@ bool ContextualCheckBlock(
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = chainparams.GetConsensus();
 
+    // With script check threads, the signatures and Sapling proofs of every
+    // transaction are collected and verified in parallel once the rest of
+    // the block has been checked. Below -assumevalid they are collected and
+    // then dropped.
+    bool fAssumeValid = IsAssumedValid(block.GetHash(), nHeight, consensusParams);
+    std::vector<CValidationCheck> vChecks;
+    std::vector<CValidationCheck> *pvChecks = (nScriptCheckThreads || fAssumeValid) ? &vChecks : NULL;
+
     // Check that all transactions are finalized
     BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, 100)) {
+        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, 100, IsInitialBlockDownload, pvChecks)) {
             return false; // Failure reason has been set in validation state object
         }
 
@@ -4509,10 +6251,21 @@ bool ContextualCheckBlock(
         }
     }
 
+    if (!fAssumeValid && !vChecks.empty() && !RunValidationChecks(vChecks)) {
+        // Check each transaction in turn to find the one that failed
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, 100)) {
+                return false;
+            }
+        }
+        return state.DoS(100, error("%s: Sapling verification failed", __func__),
+                         REJECT_INVALID, "bad-txns-sapling-verification-failed");
+    }
+
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckSolution=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4529,7 +6282,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, chainparams))
+    if (!CheckBlockHeader(block, state, chainparams, true, fCheckSolution))
         return false;
 
     // Get prev block index
@@ -4642,15 +6395,26 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp)
 {
+    uint256 hash = pblock->GetHash();
+    NodeId nodeid = pfrom ? pfrom->GetId() : -1;
+    int64_t nTimeStart = GetTimeMicros();
+    TRACE2(validation, block_received, hash.begin(), nodeid);
+
+    // Don't let validation run too far ahead of the background listeners;
+    // this is the one place that waits for them, as cs_main isn't held here
+    GetValidationQueue().Limit();
+
     // Preliminary checks
     auto verifier = libzcash::ProofVerifier::Disabled();
     bool checked = CheckBlock(*pblock, state, chainparams, verifier);
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(hash, nodeid,
+                                              pfrom ? ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION) : 0);
         fRequested |= fForceProcessing;
         if (!checked) {
+            TRACE3(validation, block_processed, hash.begin(), false, GetTimeMicros() - nTimeStart);
             return error("%s: CheckBlock FAILED", __func__);
         }
 
@@ -4661,18 +6425,32 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
             mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
         }
         CheckBlockIndex(chainparams.GetConsensus());
-        if (!ret)
+        if (!ret) {
+            TRACE3(validation, block_processed, hash.begin(), false, GetTimeMicros() - nTimeStart);
             return error("%s: AcceptBlock FAILED", __func__);
+        }
+
+        // A block stored ahead of the tip waits for its parents, so verify
+        // its proofs in the background meanwhile
+        if (nBlockPrecheckThreads && pindex && pindex->nHeight > chainActive.Height() + 1 &&
+            IsInitialBlockDownload(chainparams))
+            QueueBlockPrecheck(*pblock, pindex->nHeight);
     }
 
-    if (!ActivateBestChain(state, chainparams, pblock))
+    if (!ActivateBestChain(state, chainparams, pblock)) {
+        TRACE3(validation, block_processed, hash.begin(), false, GetTimeMicros() - nTimeStart);
         return error("%s: ActivateBestChain failed", __func__);
+    }
+    TRACE3(validation, block_processed, hash.begin(), true, GetTimeMicros() - nTimeStart);
 
     if (!fLiteMode) {
         if (zeronodeSync.RequestedZeronodeAssets > ZERONODE_SYNC_LIST) {
             zeronodePayments.ProcessBlock(GetHeight() + 10);
             budget.NewBlock();
         }
+        // Have the payee ready for the first template on the new tip
+        if (!IsInitialBlockDownload(chainparams))
+            zeronodePayments.PrecomputeBlockPayee();
     }
     return true;
 }
@@ -4754,6 +6532,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        mappedBlockFiles.Drop(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4794,6 +6573,10 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
+            // keep blocks the compact block store has not recorded yet, so that wallets can still rescan pruned ranges
+            if (pcompactblocks && (int)vinfoBlockFile[fileNumber].nHeightLast > pcompactblocks->Height())
+                continue;
+
             PruneOneBlockFile(fileNumber);
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
@@ -4843,6 +6626,8 @@ FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
 }
 
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly) {
+    if (fReadOnly && !blockWriteBuffer.WriteBefore(pos))
+        return NULL;
     return OpenDiskFile(pos, "blk", fReadOnly);
 }
 
@@ -4866,32 +6651,72 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
-    mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CBlockIndex* pindexNew = blockIndexArena.New();
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+        mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    }
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+/** Find the entries without children afresh, after entries were loaded or removed */
+static void RebuildChainTips()
+{
+    setChainTips.clear();
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        setChainTips.insert(item.second);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        setChainTips.erase(item.second->pprev);
+}
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+    int64_t nHashCheckInterval = std::max<int64_t>(0, GetArg("-blockindexhashcheck", DEFAULT_BLOCK_INDEX_HASH_CHECK));
+    int nLoadThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    int64_t nStart = GetTimeMillis();
+    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, nHashCheckInterval, nLoadThreads))
         return false;
+    LogPrint("bench", "Loaded %u block index entries on %d threads in %dms\n",
+             mapBlockIndex.size(), nLoadThreads, GetTimeMillis() - nStart);
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork, ordering the entries by height with a counting
+    // sort, as the heights are dense
+    int nMaxHeight = -1;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<size_t> vHeightStart(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (size_t i = 1; i < vHeightStart.size(); i++)
+        vHeightStart[i] += vHeightStart[i - 1];
+    vector<pair<int, CBlockIndex*> > vSortedByHeight(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
         CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        vSortedByHeight[vHeightStart[pindex->nHeight]++] = make_pair(pindex->nHeight, pindex);
+    }
+
+    // Lay the entries out in height order, so that walks back along a chain
+    // read neighbouring entries
+    vector<CBlockIndex*> vOrder;
+    vOrder.reserve(vSortedByHeight.size());
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+        vOrder.push_back(item.second);
+    if (blockIndexArena.Reorder(vOrder)) {
+        boost::unique_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+        nBlockIndexGeneration++;
+        for (size_t i = 0; i < vSortedByHeight.size(); i++) {
+            CBlockIndex* pindex = blockIndexArena[i];
+            mapBlockIndex[*pindex->phashBlock] = pindex;
+            vSortedByHeight[i].second = pindex;
+        }
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    vector<CBlockIndex*>().swap(vOrder);
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
@@ -4998,6 +6823,7 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    RebuildChainTips();
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -5055,6 +6881,51 @@ bool static LoadBlockIndexDB()
     fAddressIndex = fInsightExplorer;
     fSpentIndex = fInsightExplorer;
     fTimestampIndex = fInsightExplorer;
+    pblocktree->ReadFlag("noteindex", fNoteIndex);
+    fNoteIndex &= fInsightExplorer;
+
+    // Older versions kept the indexes in the block tree database
+    if (fTxIndex && ptxindexdb) {
+        int64_t nMoved = pblocktree->MoveRecords(CTxIndexDB::RecordTypes(), *ptxindexdb);
+        if (nMoved < 0)
+            return error("%s: failed to move the transaction index out of the block index", __func__);
+        if (nMoved > 0)
+            LogPrintf("%s: moved %d transaction index records to their own database\n", __func__, nMoved);
+    }
+    if (fInsightExplorer && pexplorerdb) {
+        int64_t nMoved = pblocktree->MoveRecords(CExplorerIndexDB::RecordTypes(), *pexplorerdb);
+        if (nMoved < 0)
+            return error("%s: failed to move the explorer indexes out of the block index", __func__);
+        if (nMoved > 0)
+            LogPrintf("%s: moved %d explorer index records to their own database\n", __func__, nMoved);
+    }
+
+    // Resume building the explorer indexes in the background; until they
+    // catch up with the tip, blocks are connected without them
+    uint256 hashExplorerBest;
+    if (fInsightExplorer && pexplorerdb && pexplorerdb->ReadExplorerIndexBest(hashExplorerBest)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashExplorerBest);
+        if (mi == mapBlockIndex.end())
+            return error("%s: explorer indexes built up to unknown block %s", __func__, hashExplorerBest.ToString());
+        fExplorerIndexBuilding = true;
+        pindexExplorerBest = mi->second;
+        fAddressIndex = false;
+        fSpentIndex = false;
+        fTimestampIndex = false;
+        LogPrintf("%s: explorer indexes built up to height %d\n", __func__, pindexExplorerBest->nHeight);
+    }
+
+    // Address balances are kept along with the address index since it was
+    // first built, or computed once for older databases
+    if (fAddressIndex && pexplorerdb) {
+        bool fAddressBalances = false;
+        pblocktree->ReadFlag("addressbalances", fAddressBalances);
+        if (!fAddressBalances) {
+            LogPrintf("%s: computing address balances from the address index\n", __func__);
+            if (!pexplorerdb->RebuildAddressBalances() || !pblocktree->WriteFlag("addressbalances", true))
+                return error("%s: failed to compute address balances", __func__);
+        }
+    }
 
     // Check whether we have a shielded index
     pblocktree->ReadFlag("zindex", fZindex);
@@ -5079,6 +6950,30 @@ bool static LoadBlockIndexDB()
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainSnapshot();
+
+    // The address and spent indexes are written behind the chainstate. If
+    // they were left behind it, or on a branch it has since left, bring them
+    // up to the tip in the background; entries written ahead of it on the
+    // same chain are written again as the blocks are connected.
+    uint256 hashExplorerSynced;
+    if (fAddressIndex && pexplorerdb && pexplorerdb->ReadIndexSynced(hashExplorerSynced)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashExplorerSynced);
+        if (mi == mapBlockIndex.end())
+            return error("%s: address index written up to unknown block %s", __func__, hashExplorerSynced.ToString());
+        CBlockIndex* pindexSynced = mi->second;
+        if (pindexSynced->GetAncestor(chainActive.Height()) != chainActive.Tip()) {
+            if (!pexplorerdb->WriteExplorerIndexBest(hashExplorerSynced))
+                return error("%s: failed to write the explorer indexes", __func__);
+            fExplorerIndexBuilding = true;
+            pindexExplorerBest = pindexSynced;
+            fAddressIndex = false;
+            fSpentIndex = false;
+            fTimestampIndex = false;
+            LogPrintf("%s: address index written up to height %d of %d, catching up in the background\n",
+                      __func__, pindexSynced->nHeight, chainActive.Height());
+        }
+    }
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
 
@@ -5105,6 +7000,16 @@ CVerifyDB::~CVerifyDB()
 }
 
 bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+{
+    LOCK(cs_main);
+    if (!VerifyBlocks(chainparams, nCheckLevel, nCheckDepth))
+        return false;
+    if (nCheckLevel >= 3 && !ShutdownRequested())
+        return VerifyCoins(chainparams, coinsview, nCheckLevel, nCheckDepth);
+    return true;
+}
+
+bool CVerifyDB::VerifyBlocks(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth)
 {
     LOCK(cs_main);
     if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
@@ -5115,51 +7020,115 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         nCheckDepth = 1000000000; // suffices until the year 19000
     if (nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
-    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
+    nCheckLevel = std::max(0, std::min(2, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+
+    // The blocks up to a fast sync snapshot were never downloaded
+    std::vector<const CBlockIndex*> vIndex;
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev && pindex->nHeight >= chainActive.Height() - nCheckDepth &&
+                                                        (pindex->nStatus & BLOCK_HAVE_DATA); pindex = pindex->pprev)
+        vIndex.push_back(pindex);
+
+    // Blocks are read, with their Equihash solutions, and their undo data
+    // checked by the reader threads a batch at a time. This thread, which
+    // holds cs_main for them, then runs CheckBlock on the batch in order.
+    const size_t nThreads = std::max(1, nScriptCheckThreads);
+    const size_t nBatchSize = nThreads * 4;
+    CValidationState state;
+    // No need to verify JoinSplits twice
+    auto verifier = libzcash::ProofVerifier::Disabled();
+    std::vector<CBlock> vBlocks(std::min(nBatchSize, vIndex.size()));
+    for (size_t nBegin = 0; nBegin < vIndex.size(); nBegin += nBatchSize) {
+        boost::this_thread::interruption_point();
+        size_t nEnd = std::min(vIndex.size(), nBegin + nBatchSize);
+        std::vector<char> vBlockOk(nEnd - nBegin, false);
+        std::vector<char> vUndoOk(nEnd - nBegin, true);
+        std::atomic<size_t> nNext(nBegin);
+        boost::thread_group readers;
+        try {
+            for (size_t n = 0; n < std::min(nThreads, nEnd - nBegin); n++) {
+                readers.create_thread([&]() {
+                    try {
+                        for (size_t i = nNext++; i < nEnd; i = nNext++) {
+                            const CBlockIndex* pindex = vIndex[i];
+                            // check level 0: read from disk
+                            vBlockOk[i - nBegin] = ReadBlockFromDisk(vBlocks[i - nBegin], pindex, chainparams.GetConsensus());
+                            // check level 2: verify undo validity
+                            CDiskBlockPos pos = pindex->GetUndoPos();
+                            if (nCheckLevel >= 2 && !pos.IsNull()) {
+                                CBlockUndo undo;
+                                vUndoOk[i - nBegin] = UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash());
+                            }
+                            boost::this_thread::interruption_point();
+                        }
+                    } catch (const std::exception& e) {
+                        PrintExceptionContinue(&e, "VerifyDB");
+                    } catch (const boost::thread_interrupted&) {
+                    }
+                });
+            }
+            readers.join_all();
+        } catch (const boost::thread_interrupted&) {
+            readers.interrupt_all();
+            readers.join_all();
+            throw;
+        }
+
+        for (size_t i = nBegin; i < nEnd; i++) {
+            const CBlockIndex* pindex = vIndex[i];
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)((double)i / (double)vIndex.size() * 100))));
+            if (!vBlockOk[i - nBegin])
+                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            // check level 1: verify block validity, the solution and proof of work were checked by ReadBlockFromDisk
+            if (nCheckLevel >= 1 && !CheckBlock(vBlocks[i - nBegin], state, chainparams, verifier, false))
+                return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            if (!vUndoOk[i - nBegin])
+                return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+        if (ShutdownRequested())
+            return true;
+    }
+    return true;
+}
+
+bool CVerifyDB::VerifyCoins(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+{
+    LOCK(cs_main);
+    if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL || nCheckLevel < 3)
+        return true;
+
+    if (nCheckDepth <= 0)
+        nCheckDepth = 1000000000; // suffices until the year 19000
+    if (nCheckDepth > chainActive.Height())
+        nCheckDepth = chainActive.Height();
+    nCheckLevel = std::min(4, nCheckLevel);
+    LogPrintf("Verifying the coin database against the last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
-    // No need to verify JoinSplits twice
-    auto verifier = libzcash::ProofVerifier::Disabled();
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+    while (pindexState->pprev && pindexState->nHeight >= chainActive.Height() - nCheckDepth && (pindexState->nStatus & BLOCK_HAVE_DATA) &&
+           coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() <= nCoinCacheUsage)
     {
         boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
-            break;
+        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindexState->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+        CBlockIndex* pindex = pindexState;
         CBlock block;
-        // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams, verifier))
-            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            // insightexplorer: do not update indices (false)
-            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams, false);
-            if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-            pindexState = pindex->pprev;
-            if (res == DISCONNECT_UNCLEAN) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else {
-                nGoodTransactions += block.vtx.size();
-            }
+        // insightexplorer: do not update indices (false)
+        DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams, false);
+        if (res == DISCONNECT_FAILED) {
+            return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+        pindexState = pindex->pprev;
+        if (res == DISCONNECT_UNCLEAN) {
+            nGoodTransactions = 0;
+            pindexFailure = pindex;
+        } else {
+            nGoodTransactions += block.vtx.size();
         }
         if (ShutdownRequested())
             return true;
@@ -5328,11 +7297,21 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
     for (auto pindex : vBlocks) {
         auto ret = mapBlockIndex.find(*pindex->phashBlock);
         if (ret != mapBlockIndex.end()) {
-            mapBlockIndex.erase(ret);
-            delete pindex;
+            {
+                boost::unique_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+                mapBlockIndex.erase(ret);
+                nBlockIndexGeneration++;
+            }
+            setDirtyBlockIndex.erase(const_cast<CBlockIndex*>(pindex));
+            {
+                LOCK(cs_blockSolutions);
+                mapBlockSolutions.erase(pindex);
+            }
+            blockIndexArena.Delete(const_cast<CBlockIndex*>(pindex));
         }
     }
 
+    RebuildChainTips();
     PruneBlockIndexCandidates();
 
     CheckBlockIndex(chainparams.GetConsensus());
@@ -5348,12 +7327,17 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
+    setChainTips.clear();
     chainActive.SetTip(NULL);
+    PublishChainSnapshot();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
+    vOrphanList.clear();
+    mapOrphanPeerUsage.clear();
+    nOrphanUsage = 0;
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -5364,22 +7348,178 @@ void UnloadBlockIndex()
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
+    {
+        LOCK(cs_blockSolutions);
+        mapBlockSolutions.clear();
+    }
     setDirtyFileInfo.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+        mapBlockIndex.clear();
+        blockIndexArena.Clear();
+        nBlockIndexGeneration++;
+    }
+    fHavePruned = false;
+}
+
+bool LoadBlockIndex()
+{
+    // Load block index from databases
+    if (!fReindex && !LoadBlockIndexDB())
+        return false;
+    return true;
+}
+
+bool LoadChainstateSnapshot(const boost::filesystem::path& path, CCoinsViewDB& coinsdb, std::string& strError)
+{
+    LOCK(cs_main);
+
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf(_("Unable to open snapshot file %s"), path.string());
+        return false;
+    }
+    CChainstateSnapshotHeader header;
+    try {
+        filein >> header;
+    } catch (const std::exception& e) {
+        strError = strprintf(_("Unable to read snapshot file %s"), path.string());
+        return false;
+    }
+
+    // The coins are only usable on top of the block they were taken at, and
+    // the block files are needed to serve and reorg past it
+    BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA) || mi->second->nChainTx == 0) {
+        strError = strprintf(_("Snapshot block %s and its ancestors are not in the block database"), header.hashBlock.GetHex());
+        return false;
+    }
+    CBlockIndex* pindex = mi->second;
+
+    LogPrintf("Loading chainstate snapshot %s at height %d (hash_serialized %s)\n",
+              path.string(), pindex->nHeight, header.hashSerialized.GetHex());
+    int64_t nStart = GetTimeMillis();
+    uint64_t nRecords;
+    uint256 hashSnapshot;
+    if (!coinsdb.LoadSnapshot(filein, header, nRecords, hashSnapshot)) {
+        strError = _("Error loading chainstate snapshot");
+        return false;
+    }
+    LogPrintf("Loaded %u snapshot records with hash %s in %dms\n", nRecords, hashSnapshot.GetHex(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/** The -fastsync snapshot waiting for its block header (protected by cs_main) */
+static boost::filesystem::path pathFastSyncSnapshot;
+static CChainstateSnapshotHeader fastSyncSnapshotHeader;
+static std::atomic<bool> fFastSyncPending(false);
+
+bool SetFastSyncSnapshot(const boost::filesystem::path& path, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf(_("Unable to open snapshot file %s"), path.string());
+        return false;
+    }
+    try {
+        filein >> fastSyncSnapshotHeader;
+    } catch (const std::exception& e) {
+        strError = strprintf(_("Unable to read snapshot file %s"), path.string());
+        return false;
+    }
+    pathFastSyncSnapshot = path;
+    fFastSyncPending = true;
+    LogPrintf("Fast sync: downloading headers up to snapshot block %s before any blocks\n", fastSyncSnapshotHeader.hashBlock.GetHex());
+    return true;
+}
+
+bool IsFastSyncPending()
+{
+    return fFastSyncPending;
+}
+
+bool ActivateFastSyncSnapshot(const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    if (!fFastSyncPending)
+        return true;
+
+    // Wait for the header chain to get there, and only follow the snapshot
+    // if it is on the chain with the most work we know of
+    BlockMap::iterator mi = mapBlockIndex.find(fastSyncSnapshotHeader.hashBlock);
+    if (mi == mapBlockIndex.end() || pindexBestHeader == NULL)
+        return true;
+    CBlockIndex* pindexSnapshot = mi->second;
+    if (pindexBestHeader->GetAncestor(pindexSnapshot->nHeight) != pindexSnapshot)
+        return true;
+    fFastSyncPending = false;
+    if (chainActive.Height() != 0)
+        return AbortNode(strprintf("Fast sync: the chainstate is at height %d, not at the genesis block", chainActive.Height()));
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    CAutoFile filein(fopen(pathFastSyncSnapshot.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return AbortNode(strprintf("Fast sync: unable to open snapshot file %s", pathFastSyncSnapshot.string()));
+    LogPrintf("Fast sync: loading chainstate snapshot %s at height %d\n", pathFastSyncSnapshot.string(), pindexSnapshot->nHeight);
+    int64_t nStart = GetTimeMillis();
+    uint64_t nRecords;
+    uint256 hashSnapshot;
+    try {
+        CChainstateSnapshotHeader header;
+        filein >> header;
+        if (header.hashBlock != fastSyncSnapshotHeader.hashBlock)
+            return AbortNode("Fast sync: the snapshot file changed");
+        if (!pcoinsdbview->LoadSnapshot(filein, header, nRecords, hashSnapshot, chainparams.GetConsensus().hashGenesisBlock))
+            return AbortNode("Fast sync: error loading chainstate snapshot", _("Error loading chainstate snapshot"));
+    } catch (const std::exception& e) {
+        return AbortNode(strprintf("Fast sync: unable to read snapshot file %s", pathFastSyncSnapshot.string()));
+    }
+    LogPrintf("Fast sync: loaded %u snapshot records with hash %s in %dms\n", nRecords, hashSnapshot.GetHex(), GetTimeMillis() - nStart);
+
+    // The tip cache still has the genesis block as its best block
+    delete pcoinsTip;
+    pcoinsTip = new CCoinsViewCache(pcoinsflusher);
+    pcoinsTip->SetCounters(&coinsTipCounters);
+    mempool.clear();
+
+    // The blocks up to the snapshot are never downloaded: they are in the
+    // chain as pruned blocks, with a placeholder transaction count
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindex = pindexSnapshot; pindex->pprev; pindex = pindex->pprev)
+        vChain.push_back(pindex);
+    for (std::vector<CBlockIndex*>::reverse_iterator it = vChain.rbegin(); it != vChain.rend(); ++it) {
+        CBlockIndex* pindex = *it;
+        if (pindex->nTx == 0)
+            pindex->nTx = 1;
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->nCachedBranchId = CurrentEpochBranchId(pindex->nHeight, chainparams.GetConsensus());
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
     }
-    mapBlockIndex.clear();
-    fHavePruned = false;
-}
+    pindexSnapshot->hashFinalSproutRoot = fastSyncSnapshotHeader.hashSproutAnchor;
+    chainActive.SetTip(pindexSnapshot);
+    setBlockIndexCandidates.insert(pindexSnapshot);
+    PruneBlockIndexCandidates();
+    fHavePruned = true;
+    pblocktree->WriteFlag("prunedblockfiles", true);
 
-bool LoadBlockIndex()
-{
-    // Load block index from databases
-    if (!fReindex && !LoadBlockIndexDB())
+    // Peers start looking for blocks to download from the new tip
+    for (std::map<NodeId, CNodeState>::iterator it = mapNodeState.begin(); it != mapNodeState.end(); ++it)
+        it->second.pindexLastCommonBlock = NULL;
+
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
+    LogPrintf("Fast sync: chain tip set to snapshot block %s at height %d\n", pindexSnapshot->GetBlockHash().GetHex(), pindexSnapshot->nHeight);
+
+    // The zeronode lists could not be checked against the genesis-only chainstate
+    zeronodeSync.Reset();
     return true;
 }
 
@@ -5401,9 +7541,12 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -insightexplorer in the new database
     fInsightExplorer = GetBoolArg("-insightexplorer", false);
     pblocktree->WriteFlag("insightexplorer", fInsightExplorer);
+    pblocktree->WriteFlag("addressbalances", true);
+    pblocktree->WriteFlag("noteindex", fInsightExplorer);
     fAddressIndex = fInsightExplorer;
     fSpentIndex = fInsightExplorer;
     fTimestampIndex = fInsightExplorer;
+    fNoteIndex = fInsightExplorer;
 
     // Use the provided setting for -zindex in the new database
     fZindex = GetBoolArg("-zindex", DEFAULT_SHIELDEDINDEX);
@@ -5439,16 +7582,23 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
-{
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
 
-    int nLoaded = 0;
+/**
+ * Locate and deserialize the blocks in an external or block file, passing
+ * each one with its position to fnBlock until it returns false. The position
+ * is only set when dbp is not NULL.
+ */
+static void ReadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, const CDiskBlockPos* dbp,
+                                  const std::function<bool(const std::shared_ptr<CBlock>&, const CDiskBlockPos*, unsigned int)>& fnBlock)
+{
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        CDiskBlockPos pos;
+        if (dbp)
+            pos = *dbp;
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
@@ -5476,59 +7626,14 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
+                pos.nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
+                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                blkdat >> *pblock;
                 nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &it->second))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
-                }
+                if (!fnBlock(pblock, dbp ? &pos : NULL, nSize))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
@@ -5536,11 +7641,225 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+}
+
+/**
+ * Process a block read from an external or block file, then any blocks
+ * seen earlier that were waiting for it. Returns false on a state error.
+ */
+static bool ProcessExternalBlock(const CChainParams& chainparams, CBlock& block, const CDiskBlockPos* dbp, int& nLoaded)
+{
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        CValidationState state;
+        CDiskBlockPos pos;
+        if (dbp)
+            pos = *dbp;
+        if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp ? &pos : NULL))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                        head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &it->second))
+                {
+                    nLoaded++;
+                    queue.push_back(block.GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+        }
+    }
+    return true;
+}
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    ReadExternalBlockFile(chainparams, fileIn, dbp,
+        [&chainparams, &nLoaded](const std::shared_ptr<CBlock>& pblock, const CDiskBlockPos* pos, unsigned int nSize) {
+            return ProcessExternalBlock(chainparams, *pblock, pos, nLoaded);
+        });
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+namespace {
+
+/**
+ * Blocks parsed from one block file by a reader thread, waiting to be
+ * processed in file order. The reader blocks while more than
+ * MAX_REINDEX_QUEUE_SIZE bytes of blocks are queued.
+ */
+class CReindexQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<std::pair<std::shared_ptr<CBlock>, CDiskBlockPos> > queue;
+    std::deque<unsigned int> queueSizes;
+    size_t nQueuedSize;
+    bool fDone;
+    bool fClosed;
+
+public:
+    const int nFile;
+
+    CReindexQueue(int nFileIn) : nQueuedSize(0), fDone(false), fClosed(false), nFile(nFileIn) {}
+
+    //! Called by the reader; returns false once the queue was closed
+    bool Push(const std::shared_ptr<CBlock>& pblock, const CDiskBlockPos& pos, unsigned int nSize)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fClosed && !queue.empty() && nQueuedSize + nSize > MAX_REINDEX_QUEUE_SIZE)
+            cond.wait(lock);
+        if (fClosed)
+            return false;
+        queue.push_back(std::make_pair(pblock, pos));
+        queueSizes.push_back(nSize);
+        nQueuedSize += nSize;
+        cond.notify_all();
+        return true;
+    }
+
+    //! Called by the reader when the file is exhausted
+    void Finish()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDone = true;
+        cond.notify_all();
+    }
+
+    //! Returns false once the reader finished and everything was popped
+    bool Pop(std::shared_ptr<CBlock>& pblock, CDiskBlockPos& pos)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty() && !fDone)
+            cond.wait(lock);
+        if (queue.empty())
+            return false;
+        pblock = queue.front().first;
+        pos = queue.front().second;
+        nQueuedSize -= queueSizes.front();
+        queue.pop_front();
+        queueSizes.pop_front();
+        cond.notify_all();
+        return true;
+    }
+
+    //! Stop the reader, e.g. when processing hit an error
+    void Close()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fClosed = true;
+        cond.notify_all();
+    }
+};
+
+void ThreadReindexReader(const CChainParams& chainparams, FILE* file, std::shared_ptr<CReindexQueue> pqueue)
+{
+    CDiskBlockPos pos(pqueue->nFile, 0);
+    try {
+        ReadExternalBlockFile(chainparams, file, &pos,
+            [&pqueue](const std::shared_ptr<CBlock>& pblock, const CDiskBlockPos* ppos, unsigned int nSize) {
+                return pqueue->Push(pblock, *ppos, nSize);
+            });
+    } catch (const boost::thread_interrupted&) {
+    }
+    pqueue->Finish();
+}
+
+} // anon namespace
+
+void ReindexBlockFiles(const CChainParams& chainparams, int nReaders)
+{
+    boost::thread_group readers;
+    std::deque<std::shared_ptr<CReindexQueue> > queues;
+    int nNextFile = 0;
+    bool fFilesLeft = true;
+    try {
+        while (true) {
+            // Keep nReaders files ahead being parsed
+            while (fFilesLeft && (int)queues.size() < std::max(nReaders, 1)) {
+                CDiskBlockPos pos(nNextFile, 0);
+                FILE *file = NULL;
+                if (boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
+                    file = OpenBlockFile(pos, true); // An error is logged in OpenBlockFile
+                if (!file) {
+                    fFilesLeft = false; // No block files left to reindex
+                    break;
+                }
+                std::shared_ptr<CReindexQueue> pqueue = std::make_shared<CReindexQueue>(nNextFile);
+                readers.create_thread(boost::bind(&ThreadReindexReader, boost::cref(chainparams), file, pqueue));
+                queues.push_back(pqueue);
+                nNextFile++;
+            }
+            if (queues.empty())
+                break;
+
+            std::shared_ptr<CReindexQueue> pqueue = queues.front();
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)pqueue->nFile);
+            int64_t nStart = GetTimeMillis();
+            int nLoaded = 0;
+            bool fError = false;
+            std::shared_ptr<CBlock> pblock;
+            CDiskBlockPos pos;
+            while (pqueue->Pop(pblock, pos)) {
+                boost::this_thread::interruption_point();
+                if (!ProcessExternalBlock(chainparams, *pblock, &pos, nLoaded)) {
+                    fError = true;
+                    break;
+                }
+            }
+            pqueue->Close();
+            queues.pop_front();
+            if (nLoaded > 0)
+                LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+            if (fError)
+                break;
+        }
+    } catch (const boost::thread_interrupted&) {
+        BOOST_FOREACH(std::shared_ptr<CReindexQueue>& pqueue, queues)
+            pqueue->Close();
+        readers.interrupt_all();
+        readers.join_all();
+        throw;
+    }
+    BOOST_FOREACH(std::shared_ptr<CReindexQueue>& pqueue, queues)
+        pqueue->Close();
+    readers.join_all();
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -5675,6 +7994,8 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
                 }
             }
         }
+        // The tips are exactly the entries nothing builds on.
+        assert(setChainTips.count(pindex) == (forward.count(pindex) == 0));
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
 
@@ -5827,6 +8148,8 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                mapTxLockReqRejected.count(inv.hash);
     case MSG_TXLOCK_VOTE:
         return mapTxLockVote.count(inv.hash);
+    case MSG_TXLOCK_CERT:
+        return mapTxLockCert.count(inv.hash);
     case MSG_SPORK:
         return mapSporks.count(inv.hash);
     case MSG_ZERONODE_WINNER:
@@ -5872,7 +8195,45 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+/**
+ * Held while handling any message that may not run alongside other peers'
+ * messages. Most handlers, the zeronode ones in particular, keep state
+ * that was only ever touched from the one message handler thread.
+ * Taken before cs_main, and never waited on while cs_main is held.
+ */
+static CCriticalSection cs_serialMessages;
+
+/** Messages whose handlers touch only their own peer, or state under locks of their own */
+static bool IsConcurrentMessage(const std::string& strCommand)
+{
+    return strCommand == "ping" || strCommand == "pong" || strCommand == "addr" ||
+        strCommand == "getaddr" || strCommand == "getheaders" || strCommand == "getdata" ||
+        strCommand == "getblocktxn" || strCommand == "getcfilters" || strCommand == "getcfheaders" ||
+        strCommand == "getcfcheckpt";
+}
+
+void static ProcessGetDataLocked(CNode* pfrom, const Consensus::Params& consensusParams);
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
+{
+    // Blocks are served from chain state under cs_main alone; anything
+    // else may come from the zeronode and SwiftTX maps
+    bool fOnlyBlocks = true;
+    BOOST_FOREACH(const CInv& inv, pfrom->vRecvGetData) {
+        if (inv.type != MSG_BLOCK && inv.type != MSG_FILTERED_BLOCK && inv.type != MSG_CMPCT_BLOCK) {
+            fOnlyBlocks = false;
+            break;
+        }
+    }
+    if (fOnlyBlocks) {
+        ProcessGetDataLocked(pfrom, consensusParams);
+    } else {
+        LOCK(cs_serialMessages);
+        ProcessGetDataLocked(pfrom, consensusParams);
+    }
+}
+
+void static ProcessGetDataLocked(CNode* pfrom, const Consensus::Params& consensusParams)
 {
     int currentHeight = GetHeight();
 
@@ -5892,7 +8253,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -5917,18 +8278,43 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    // Send block from the recent block cache or from disk. A full
+                    // block is relayed as the bytes already stored, so it never
+                    // has to be deserialized and serialized again.
+                    std::shared_ptr<const CRecentBlock> pcached = recentBlocks.Get(inv.hash);
+                    // A compact block is only worth it near the tip, where
+                    // the peer's mempool still holds the transactions
+                    bool fCmpct = inv.type == MSG_CMPCT_BLOCK && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    if (fCmpct) {
+                        CBlock blockRead;
+                        if (!pcached && !ReadBlockFromDisk(blockRead, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
+                        CBlockHeaderAndShortTxIDs cmpctblock(pcached ? *pcached->pblock : blockRead);
+                        pfrom->PushMessage("cmpctblock", cmpctblock);
+                    }
+                    else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                        if (pcached) {
+                            pfrom->PushMessage("block", CFlatData((void*)pcached->vchBlock.data(), (void*)(pcached->vchBlock.data() + pcached->vchBlock.size())));
+                        } else {
+                            std::vector<unsigned char> vchBlock;
+                            if (!ReadRawBlockFromDisk(vchBlock, (*mi).second, Params().MessageStart()))
+                                assert(!"cannot load block from disk");
+                            pfrom->PushMessage("block", CFlatData((void*)vchBlock.data(), (void*)(vchBlock.data() + vchBlock.size())));
+                        }
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock blockRead;
+                        if (!pcached && !ReadBlockFromDisk(blockRead, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
+                        const CBlock& block = pcached ? *pcached->pblock : blockRead;
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                            // A cached block keeps the filter elements of its transactions
+                            // for the next peer, and the bytes of the transactions to send
+                            CMerkleBlock merkleBlock = pcached ? CMerkleBlock(block, *pfrom->pfilter, pcached->GetFilterElements()) :
+                                                                 CMerkleBlock(block, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                             // This avoids hurting performance by pointlessly requiring a round-trip
@@ -5937,9 +8323,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             // Thus, the protocol spec specified allows for us to provide duplicate txn here,
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn) {
+                                if (pfrom->filterInventoryKnown.contains(pair.second))
+                                    continue;
+                                if (pcached) {
+                                    const std::vector<uint32_t>& vTxOffsets = pcached->GetTxOffsets();
+                                    const char* pchTx = pcached->vchBlock.data();
+                                    pfrom->PushMessage("tx", CFlatData((void*)(pchTx + vTxOffsets[pair.first]), (void*)(pchTx + vTxOffsets[pair.first + 1])));
+                                } else {
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
+                                }
+                            }
                         }
                         // else
                             // no response
@@ -6000,6 +8394,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         pushed = true;
                     }
                 }
+                if (!pushed && inv.type == MSG_TXLOCK_CERT) {
+                    if (mapTxLockCert.count(inv.hash)) {
+                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        ss.reserve(1000);
+                        ss << mapTxLockCert[inv.hash];
+                        pfrom->PushMessage("txlcert", ss);
+                        pushed = true;
+                    }
+                }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
                     if (mapTxLockReq.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -6095,7 +8498,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -6114,6 +8517,298 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+/**
+ * Try to add a transaction relayed by pfrom to the mempool, resolve the
+ * orphans waiting on it and report a rejection back to the peer.
+ */
+static void ProcessTxMessage(CNode* pfrom, const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    vector<COutPoint> vWorkQueue;
+    set<uint256> setEraseQueue;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
+    {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx);
+        for (unsigned int n = 0; n < tx.vout.size(); n++)
+            vWorkQueue.push_back(COutPoint(inv.hash, n));
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
+            pfrom->id, pfrom->cleanSubVer,
+            tx.GetHash().ToString(),
+            mempool.mapTx.size());
+
+        // Recursively process any orphan transactions that depended on this one
+        set<NodeId> setMisbehaving;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            boost::unordered_map<COutPoint, std::vector<uint256>, COrphanOutPointHasher>::const_iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            BOOST_FOREACH(const uint256& orphanHash, itByPrev->second)
+            {
+                // An orphan spending several outputs of a parent is only tried once
+                if (setEraseQueue.count(orphanHash))
+                    continue;
+                const COrphanTx& orphan = mapOrphanTransactions[orphanHash];
+                const CTransaction& orphanTx = orphan.tx;
+                NodeId fromPeer = orphan.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx);
+                    for (unsigned int n = 0; n < orphanTx.vout.size(); n++)
+                        vWorkQueue.push_back(COutPoint(orphanHash, n));
+                    setEraseQueue.insert(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    setEraseQueue.insert(orphanHash);
+                    assert(recentRejects);
+                    recentRejects->insert(orphanHash);
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        BOOST_FOREACH(uint256 hash, setEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
+    else if (fMissingInputs &&
+             tx.vJoinSplit.empty() &&
+             tx.vShieldedSpend.empty() &&
+             tx.vShieldedOutput.empty())
+    {
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded,
+        // nor one peer to fill it
+        unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+        size_t nMaxOrphanUsage = std::max((int64_t)0, GetArg("-maxorphanmemory", DEFAULT_MAX_ORPHAN_MEMORY)) * 1000;
+        AddOrphanTx(tx, pfrom->GetId(), nMaxOrphanUsage / ORPHAN_MEMORY_PEER_SHARE);
+
+        unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanUsage);
+        if (nEvicted > 0)
+            LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+    } else {
+        assert(recentRejects);
+        recentRejects->insert(tx.GetHash());
+
+        if (pfrom->fWhitelisted) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
+                    tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
+            }
+        }
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+            pfrom->id, pfrom->cleanSubVer,
+            state.GetRejectReason());
+        pfrom->PushMessage("reject", string("tx"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+static boost::mutex mutexTxPrecheck;
+static boost::condition_variable condTxPrecheck;
+//! Relayed transactions waiting for the pre-check threads, with the peers
+//! they came from (holding a reference)
+static std::deque<std::pair<CNode*, std::shared_ptr<const CTransaction> > > queueTxPrecheck;
+
+/**
+ * Hand a relayed shielded transaction to the pre-check threads, which verify
+ * its proofs and signatures without cs_main before it goes through
+ * ProcessTxMessage. Returns false when the caller should process it inline.
+ */
+static bool QueueTxPrecheck(CNode* pfrom, const CTransaction& tx, int nHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!nTxPrecheckThreads)
+        return false;
+    if (tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+        return false;
+    if (IsShieldedTxVerified(tx.GetHash(), CurrentEpochBranchId(nHeight, Params().GetConsensus())))
+        return false;
+
+    boost::unique_lock<boost::mutex> lock(mutexTxPrecheck);
+    if (queueTxPrecheck.size() >= MAX_TX_PRECHECK_QUEUE)
+        return false;
+    {
+        LOCK(cs_vNodes);
+        pfrom->AddRef();
+    }
+    queueTxPrecheck.push_back(std::make_pair(pfrom, std::make_shared<const CTransaction>(tx)));
+    condTxPrecheck.notify_one();
+    return true;
+}
+
+void ThreadTxPrecheck()
+{
+    RenameThread("zcash-txcheck");
+    const CChainParams& chainparams = Params();
+    while (true) {
+        std::pair<CNode*, std::shared_ptr<const CTransaction> > item;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexTxPrecheck);
+            while (queueTxPrecheck.empty())
+                condTxPrecheck.wait(lock);
+            item = queueTxPrecheck.front();
+            queueTxPrecheck.pop_front();
+        }
+        CNode* pfrom = item.first;
+        const CTransaction& tx = *item.second;
+
+        // With the proofs in the cache AcceptToMemoryPool only has the
+        // checks against the pool and the UTXO set left. If they fail here
+        // it verifies them again and reports the failure to the peer.
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = chainActive.Height() + 1;
+        }
+        uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
+        if (!IsShieldedTxVerified(tx.GetHash(), consensusBranchId)) {
+            auto verifier = libzcash::ProofVerifier::Strict();
+            CValidationState state;
+            if (CheckTransaction(tx, state, verifier) &&
+                ContextualCheckTransaction(tx, state, chainparams, nHeight, 10))
+                SetShieldedTxVerified(tx.GetHash(), consensusBranchId);
+        }
+        boost::this_thread::interruption_point();
+
+        {
+            LOCK(cs_main);
+            if (!pfrom->fDisconnect)
+                ProcessTxMessage(pfrom, tx);
+        }
+        {
+            LOCK(cs_vNodes);
+            pfrom->Release();
+        }
+    }
+}
+
+/** Fall back to asking a peer for the whole of a block it announced or sent compactly. */
+void static RequestFullBlock(CNode* pfrom, const uint256& hash)
+{
+    std::vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+    pfrom->PushMessage("getdata", vInv);
+}
+
+/**
+ * Hand a block received from a peer, whole or rebuilt from a compact block,
+ * to validation, and reject or punish it as a "block" message.
+ */
+void static ProcessBlockFromPeer(CNode* pfrom, const CBlock& block, bool fForceProcessing, const CChainParams& chainparams)
+{
+    uint256 hash = block.GetHash();
+    bool fNew;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        fNew = mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA);
+    }
+
+    CValidationState state;
+    ProcessNewBlock(state, chainparams, pfrom, &block, fForceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hash);
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    } else if (fNew) {
+        // The peer that first brought us the new tip is a good source of the next ones
+        LOCK(cs_main);
+        if (chainActive.Tip()->GetBlockHash() == hash && !IsInitialBlockDownload(chainparams))
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+    }
+}
+
+/**
+ * Check a BIP 157 filter request and find its stop block, which must be in
+ * the active chain and at most nMaxCount blocks above nStartHeight. Requests for a filter type we
+ * do not serve, or for a range that is reversed or too long, disconnect
+ * the peer; an unknown stop block is ignored.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& hashStop,
+                                      uint32_t nMaxCount, const CBlockIndex*& pindexStop)
+{
+    AssertLockHeld(cs_main);
+
+    if (nFilterType != BLOCK_FILTER_BASIC || !pblockfilterdb || !(nLocalServices & NODE_COMPACT_FILTERS)) {
+        LogPrint("net", "peer=%d requested unsupported block filter type %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+        LogPrint("net", "peer=%d requested block filters up to unknown block %s\n", pfrom->id, hashStop.ToString());
+        return false;
+    }
+    pindexStop = mi->second;
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight || nStopHeight - nStartHeight >= nMaxCount) {
+        LogPrint("net", "peer=%d requested block filters for heights %u to %u, more than %u or none\n",
+                 pfrom->id, nStartHeight, nStopHeight, nMaxCount);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
+/** The blocks from nStartHeight up to pindexStop, in height order */
+static std::vector<const CBlockIndex*> BlockFilterRequestRange(uint32_t nStartHeight, const CBlockIndex* pindexStop)
+{
+    std::vector<const CBlockIndex*> vIndex(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= (int)nStartHeight; pindex = pindex->pprev)
+        vIndex[pindex->nHeight - nStartHeight] = pindex;
+    return vIndex;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -6278,6 +8973,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Tell the peer we can serve and take compact blocks. New blocks
+            // are only asked to be announced that way once the peer has been
+            // the first to give us one (MaybeSetPeerAsAnnouncingHeaderAndIDs).
+            pfrom->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+        }
+
+        // Offer whitelisted peers, our own cluster, to compress what they send us
+        if (pfrom->fWhitelisted && GetBoolArg("-p2pcompression", DEFAULT_P2P_COMPRESSION)) {
+            pfrom->fCompressRecv = true;
+            pfrom->PushMessage("compress", NET_COMPRESSION_LZ);
+        }
     }
 
 
@@ -6307,6 +9015,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         if (vAddr.size() > 1000)
         {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message addr size() = %u", vAddr.size());
         }
@@ -6402,12 +9111,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     // time the block arrives, the header chain leading up to it is already validated. Not
                     // doing this will result in the received block being rejected as an orphan in case it is
                     // not a direct successor.
-                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                    pfrom->PushMessage("getheaders", GetCachedLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
 
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().PoWTargetSpacing(pindexBestHeader->nHeight) * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        nodestate->nBlocksInFlight < nodestate->nBlocksInFlightLimit) {
+                        // Peers that relay compact blocks are asked for a "cmpctblock"
+                        vToFetch.push_back(nodestate->fProvidesHeaderAndIDs ? CInv(MSG_CMPCT_BLOCK, inv.hash) : inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -6436,6 +9146,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ)
         {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message getdata size() = %u", vInv.size());
         }
@@ -6523,24 +9234,35 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 pindex = chainActive.Next(pindex);
         }
 
-        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
-        vector<CBlock> vHeaders;
+        // Copy the headers, each followed by the 0x00 nTx count of an empty
+        // CBlock, from the header cache, and serialize the ones it misses
+        std::vector<char> vchHeaders;
+        unsigned int nCount = 0;
         int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
         for (; pindex; pindex = chainActive.Next(pindex))
         {
-            vHeaders.push_back(pindex->GetBlockHeader());
+            if (!recentHeaders.Append(pindex->nHeight, pindex->GetBlockHash(), vchHeaders)) {
+                CBlockHeader header = pindex->GetBlockHeader();
+                recentHeaders.Add(pindex->nHeight, pindex->GetBlockHash(), header);
+                CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                ss << header;
+                WriteCompactSize(ss, 0);
+                vchHeaders.insert(vchHeaders.end(), ss.begin(), ss.end());
+            }
+            nCount++;
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
-        pfrom->PushMessage("headers", vHeaders);
+        CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+        WriteCompactSize(ssHeaders, nCount);
+        ssHeaders.write(vchHeaders.data(), vchHeaders.size());
+        pfrom->PushMessage("headers", CFlatData((void*)&ssHeaders[0], (void*)(&ssHeaders[0] + ssHeaders.size())));
     }
 
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
@@ -6549,124 +9271,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
 
-        bool fMissingInputs = false;
-        CValidationState state;
-
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
-        {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
-                pfrom->id, pfrom->cleanSubVer,
-                tx.GetHash().ToString(),
-                mempool.mapTx.size());
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
-        else if (fMissingInputs &&
-                 tx.vJoinSplit.empty() &&
-                 tx.vShieldedSpend.empty() &&
-                 tx.vShieldedOutput.empty())
-        {
-            AddOrphanTx(tx, pfrom->GetId());
-
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else {
-            assert(recentRejects);
-            recentRejects->insert(tx.GetHash());
-
-            if (pfrom->fWhitelisted) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
-                        tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
-                }
-            }
-        }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
-                pfrom->id, pfrom->cleanSubVer,
-                state.GetRejectReason());
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
+        // Leave the proof verification of new shielded transactions to the
+        // pre-check threads so it does not hold up cs_main
+        if (AlreadyHave(inv) || !QueueTxPrecheck(pfrom, tx, chainActive.Height() + 1))
+            ProcessTxMessage(pfrom, tx);
     }
 
 
@@ -6686,6 +9297,32 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Verify the Equihash solutions of the headers we don't know yet on
+        // the script check threads before taking cs_main for the rest. If
+        // any is invalid, fall back to checking them in order so the
+        // offending header is found and punished as before.
+        std::vector<const CBlockHeader*> vNewHeaders;
+        {
+            LOCK(cs_main);
+            BOOST_FOREACH(const CBlockHeader& header, headers) {
+                uint256 hash = header.GetHash();
+                if (!mapBlockIndex.count(hash) && !IsEquihashSolutionVerified(hash))
+                    vNewHeaders.push_back(&header);
+            }
+        }
+        bool fSolutionsChecked = false;
+        if (!vNewHeaders.empty()) {
+            const Consensus::Params& consensusParams = chainparams.GetConsensus();
+            std::vector<CValidationCheck> vChecks;
+            vChecks.reserve(vNewHeaders.size());
+            BOOST_FOREACH(const CBlockHeader* pheader, vNewHeaders) {
+                vChecks.push_back(CValidationCheck([pheader, &consensusParams]() {
+                    return CheckEquihashSolutionCached(*pheader, consensusParams);
+                }));
+            }
+            fSolutionsChecked = RunValidationChecks(vChecks);
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -6700,7 +9337,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, !fSolutionsChecked)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6718,9 +9355,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
             LogPrint("net", "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
-            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256());
+            pfrom->PushMessage("getheaders", GetCachedLocator(pindexLast), uint256());
         }
 
+        if (IsFastSyncPending())
+            ActivateFastSyncSnapshot(chainparams);
+
         CheckBlockIndex(chainparams.GetConsensus());
     }
 
@@ -6734,23 +9374,315 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested,
         // unless we're still syncing with the network.
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload(chainparams);
-        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+        ProcessBlockFromPeer(pfrom, block, forceProcessing, chainparams);
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            nodestate->fProvidesHeaderAndIDs = true;
+            nodestate->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "compress")
+    {
+        uint8_t nMethod = 0;
+        vRecv >> nMethod;
+        // Only compress towards peers we trust to expand it, with a method we know
+        if (pfrom->fWhitelisted && GetBoolArg("-p2pcompression", DEFAULT_P2P_COMPRESSION) && nMethod == NET_COMPRESSION_LZ) {
+            pfrom->fCompressSend = true;
+            LogPrint("net", "compressing messages to peer=%d\n", pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // It does not connect to anything we know: get the headers in between first
+                if (!IsInitialBlockDownload(chainparams))
+                    pfrom->PushMessage("getheaders", GetCachedLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex* pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+            }
+            if (pindex == NULL)
+                return true;
+
+            UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
+            bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                return true;
+
+            if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
+                pindex->nTx != 0) { // We had this block at some point, but pruned it
+                // If we asked for it anyway, the mempool will not help
+                if (fAlreadyInFlight)
+                    RequestFullBlock(pfrom, pindex->GetBlockHash());
+                return true;
+            }
+
+            if (pindex->nHeight > chainActive.Height() + 2) {
+                // Too far ahead for the mempool to hold its transactions. The
+                // header is in; the block is fetched like any other.
+                if (fAlreadyInFlight)
+                    RequestFullBlock(pfrom, pindex->GetBlockHash());
+                return true;
+            }
+
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (fAlreadyInFlight ? blockInFlightIt->second.first != pfrom->GetId() :
+                                   nodestate->nBlocksInFlight >= nodestate->nBlocksInFlightLimit)
+                return true;
+
+            list<QueuedBlock>::iterator queuedBlockIt;
+            if (fAlreadyInFlight) {
+                queuedBlockIt = blockInFlightIt->second.second;
+                if (queuedBlockIt->partialBlock) {
+                    LogPrint("cmpctblock", "peer=%d sent us a compact block we are already reconstructing\n", pfrom->id);
+                    return true;
+                }
+            } else {
+                queuedBlockIt = MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex);
+            }
+            queuedBlockIt->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            PartiallyDownloadedBlock& partialBlock = *queuedBlockIt->partialBlock;
+
+            ReadStatus status = partialBlock.InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Colliding short IDs; the block stays in flight as a full block
+                queuedBlockIt->partialBlock.reset();
+                RequestFullBlock(pfrom, pindex->GetBlockHash());
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock.IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                req.blockhash = pindex->GetBlockHash();
+                LogPrint("cmpctblock", "requesting %u transactions of block %s from peer=%d\n", req.indexes.size(), req.blockhash.ToString(), pfrom->id);
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+
+            // Every transaction was prefilled or in the mempool
+            status = partialBlock.FillBlock(block, std::vector<CTransaction>());
+            queuedBlockIt->partialBlock.reset();
+            if (status != READ_STATUS_OK) {
+                RequestFullBlock(pfrom, pindex->GetBlockHash());
+                return true;
+            }
+        }
+        ProcessBlockFromPeer(pfrom, block, false, chainparams);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("cmpctblock", "peer=%d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Only recent blocks are announced compactly; answer anything
+            // older with the block itself, under the usual getdata rules
+            LogPrint("cmpctblock", "peer=%d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, chainparams.GetConsensus());
+            return true;
+        }
+
+        std::shared_ptr<const CRecentBlock> pcached = recentBlocks.Get(req.blockhash);
+        CBlock blockRead;
+        if (!pcached && !ReadBlockFromDisk(blockRead, mi->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+        const CBlock& block = pcached ? *pcached->pblock : blockRead;
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "getcfilters")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<const CBlockIndex*> vIndex;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, pindexStop))
+                return true;
+            vIndex = BlockFilterRequestRange(nStartHeight, pindexStop);
+        }
+
+        // The filter index has its own database and needs no cs_main
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            std::vector<unsigned char> vchFilter;
+            uint256 hashHeader;
+            if (!pblockfilterdb->ReadFilter(vIndex[i]->GetBlockHash(), vchFilter, hashHeader)) {
+                LogPrintf("%s: no block filter for %s\n", __func__, vIndex[i]->GetBlockHash().ToString());
+                return true;
+            }
+            pfrom->PushMessage("cfilter", nFilterType, vIndex[i]->GetBlockHash(), vchFilter);
+        }
+    }
+
+
+    else if (strCommand == "getcfheaders")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<const CBlockIndex*> vIndex;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, pindexStop))
+                return true;
+            vIndex = BlockFilterRequestRange(nStartHeight, pindexStop);
+        }
+
+        uint256 hashPrevHeader;
+        if (vIndex[0]->pprev && !pblockfilterdb->ReadFilterHeader(vIndex[0]->pprev->GetBlockHash(), hashPrevHeader)) {
+            LogPrintf("%s: no block filter header for %s\n", __func__, vIndex[0]->pprev->GetBlockHash().ToString());
+            return true;
+        }
+
+        std::vector<uint256> vFilterHashes;
+        vFilterHashes.reserve(vIndex.size());
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            std::vector<unsigned char> vchFilter;
+            uint256 hashHeader;
+            if (!pblockfilterdb->ReadFilter(vIndex[i]->GetBlockHash(), vchFilter, hashHeader)) {
+                LogPrintf("%s: no block filter for %s\n", __func__, vIndex[i]->GetBlockHash().ToString());
+                return true;
+            }
+            vFilterHashes.push_back(Hash(vchFilter.begin(), vchFilter.end()));
+        }
+        pfrom->PushMessage("cfheaders", nFilterType, hashStop, hashPrevHeader, vFilterHashes);
+    }
+
+
+    else if (strCommand == "getcfcheckpt")
+    {
+        uint8_t nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        std::vector<const CBlockIndex*> vCheckpoints;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, hashStop, std::numeric_limits<uint32_t>::max(), pindexStop))
+                return true;
+            for (int nHeight = CFCHECKPT_INTERVAL; nHeight <= pindexStop->nHeight; nHeight += CFCHECKPT_INTERVAL)
+                vCheckpoints.push_back(pindexStop->GetAncestor(nHeight));
+        }
+
+        std::vector<uint256> vHeaders(vCheckpoints.size());
+        for (size_t i = 0; i < vCheckpoints.size(); i++) {
+            if (!pblockfilterdb->ReadFilterHeader(vCheckpoints[i]->GetBlockHash(), vHeaders[i])) {
+                LogPrintf("%s: no block filter header for %s\n", __func__, vCheckpoints[i]->GetBlockHash().ToString());
+                return true;
             }
         }
+        pfrom->PushMessage("cfcheckpt", nFilterType, hashStop, vHeaders);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                it->second.first != pfrom->GetId()) {
+                LogPrint("cmpctblock", "peer=%d sent us block transactions for a block we weren't expecting\n", pfrom->id);
+                return true;
+            }
 
+            // A partial block can only be filled once
+            ReadStatus status = it->second.second->partialBlock->FillBlock(block, resp.txn);
+            it->second.second->partialBlock.reset();
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // A short ID matched the wrong mempool transaction
+                RequestFullBlock(pfrom, resp.blockhash);
+                return true;
+            }
+        }
+        ProcessBlockFromPeer(pfrom, block, false, chainparams);
     }
 
 
@@ -6769,7 +9701,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -7099,6 +10034,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
+        RecordMessageBytes(strCommand, CMessageHeader::HEADER_SIZE + nMessageSize, false);
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
@@ -7111,11 +10047,30 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
+        // Expand a compressed payload; the checksum is over what was sent
+        if (msg.fCompressed) {
+            CSerializeData vchPayload;
+            if (vRecv.empty() || !DecompressPayload(&vRecv[0], nMessageSize, vchPayload, MAX_PROTOCOL_MESSAGE_LENGTH)) {
+                LogPrintf("%s(%s, %u bytes): MALFORMED COMPRESSED PAYLOAD peer=%d\n", __func__,
+                   SanitizeString(strCommand), nMessageSize, pfrom->id);
+                continue;
+            }
+            vRecv.swap(vchPayload);
+            nMessageSize = vRecv.size();
+        }
+
         // Process message
+        int64_t nTimeStart = GetTimeMicros();
+        TRACE5(net, inbound_message, pfrom->id, strCommand.c_str(), nMessageSize, msg.nTime, nTimeStart - msg.nTime);
         bool fRet = false;
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            if (IsConcurrentMessage(strCommand)) {
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            } else {
+                LOCK(cs_serialMessages);
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            }
             boost::this_thread::interruption_point();
         }
         catch (const std::ios_base::failure& e)
@@ -7145,6 +10100,7 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        TRACE4(net, message_processed, pfrom->id, strCommand.c_str(), fRet, GetTimeMicros() - nTimeStart);
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -7152,8 +10108,11 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator itDone = pfrom->vRecvMsg.begin(); itDone != it; ++itDone)
+            pfrom->RecycleRecvBuffer(*itDone);
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+    }
 
     return fOk;
 }
@@ -7209,8 +10168,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -7225,24 +10186,24 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (fSendTrickle)
         {
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+            }
+            // receiver rejects addr messages larger than 1000
+            for (size_t i = 0; i < vAddr.size(); i += 1000) {
+                vector<CAddress> vAddrBatch(vAddr.begin() + i, vAddr.begin() + std::min(i + 1000, vAddr.size()));
+                pto->PushMessage("addr", vAddrBatch);
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage("addr", vAddr);
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -7276,7 +10237,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 nSyncStarted++;
                 CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
                 LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256());
+                pto->PushMessage("getheaders", GetCachedLocator(pindexStart), uint256());
             }
         }
 
@@ -7291,47 +10252,41 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        // Transaction inventory is trickled: it is held back and flushed to
+        // each peer as one batch at times drawn from a Poisson process, so
+        // the order in which peers hear of a transaction does not reveal its
+        // origin. Block and other inventory goes out immediately.
         vector<CInv> vInv;
         vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
+            bool fSendTxInv = pto->fWhitelisted;
+            int64_t nNowInv = GetTimeMicros();
+            if (pto->nNextInvSend < nNowInv) {
+                fSendTxInv = true;
+                pto->nNextInvSend = PoissonNextSend(nNowInv, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            }
             vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                if (inv.type == MSG_TX && !fSendTxInv)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
+                    vInvWait.push_back(inv);
+                    continue;
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                pto->filterInventoryKnown.insert(inv.hash);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
-            pto->vInventoryToSend = vInvWait;
+            pto->vInventoryToSend.swap(vInvWait);
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
@@ -7372,16 +10327,24 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(chainParams)) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        state.nBlocksInFlightLimit = GetBlocksInFlightLimit(&state, pto->nPingUsecTime);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(chainParams)) && state.nBlocksInFlight < state.nBlocksInFlightLimit && !IsFastSyncPending()) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex* pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, &pindexStalled);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
             }
+            if (vToDownload.empty() && staller != -1 && pindexStalled &&
+                ReassignStalledBlock(pto->GetId(), staller, pindexStalled, nNow, consensusParams)) {
+                vGetData.push_back(CInv(MSG_BLOCK, pindexStalled->GetBlockHash()));
+                LogPrint("net", "Requesting stalled block %s (%d) from peer=%d instead of peer=%d\n",
+                    pindexStalled->GetBlockHash().ToString(), pindexStalled->nHeight, pto->id, staller);
+            }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
@@ -7393,7 +10356,11 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: getdata (non-blocks)
         //
-        while (!pto->fDisconnect && !pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
+        // AlreadyHave() reads state the serialised message handlers write.
+        // cs_main is held already, so only try: waiting here could deadlock
+        // with a handler that holds cs_serialMessages and wants cs_main.
+        TRY_LOCK(cs_serialMessages, lockSerial);
+        while (lockSerial && !pto->fDisconnect && !pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
             const CInv& inv = (*pto->mapAskFor.begin()).second;
             if (!AlreadyHave(inv))
@@ -7425,20 +10392,187 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
 
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/**
+ * Verify the shielded proofs and signatures of transactions read back from
+ * mempool.dat on all cores, recording them in the proof cache so that
+ * AcceptToMemoryPool can skip them.
+ */
+static void PrecheckMempoolProofs(const std::vector<CTransaction>& vtx, int nHeight, const CChainParams& chainparams)
+{
+    uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        auto verifier = libzcash::ProofVerifier::Strict();
+        size_t i;
+        while ((i = nNext++) < vtx.size() && !ShutdownRequested()) {
+            const CTransaction& tx = vtx[i];
+            if (tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+                continue;
+            if (IsShieldedTxVerified(tx.GetHash(), consensusBranchId))
+                continue;
+            CValidationState state;
+            if (CheckTransaction(tx, state, verifier) &&
+                ContextualCheckTransaction(tx, state, chainparams, nHeight, 10))
+                SetShieldedTxVerified(tx.GetHash(), consensusBranchId);
+        }
+    };
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_TX_PRECHECK_THREADS));
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(worker);
+    threads.join_all();
+}
+
+bool LoadMempool()
+{
+    const CChainParams& chainparams = Params();
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<CTransaction> vtx;
+    std::vector<int64_t> vTime;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            double dPriorityDelta;
+            CAmount nFeeDelta;
+            file >> tx;
+            file >> nTime;
+            file >> dPriorityDelta;
+            file >> nFeeDelta;
+            vtx.push_back(tx);
+            vTime.push_back(nTime);
+            if (dPriorityDelta != 0 || nFeeDelta != 0)
+                mapDeltas[tx.GetHash()] = std::make_pair(dPriorityDelta, nFeeDelta);
+        }
+        // Prioritisations of transactions that were not in the pool
+        std::map<uint256, std::pair<double, CAmount> > mapOtherDeltas;
+        file >> mapOtherDeltas;
+        mapDeltas.insert(mapOtherDeltas.begin(), mapOtherDeltas.end());
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    // The deltas go in first, so that they count for admission
+    for (const auto& delta : mapDeltas) {
+        mempool.PrioritiseTransaction(delta.first, delta.first.ToString(), delta.second.first, delta.second.second);
+    }
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height() + 1;
+    }
+    PrecheckMempoolProofs(vtx, nHeight, chainparams);
+
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    for (size_t i = 0; i < vtx.size() && !ShutdownRequested(); i++) {
+        CValidationState state;
+        LOCK(cs_main);
+        if (mempool.exists(vtx[i].GetHash())) {
+            skipped++;
+        } else if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i])) {
+            count++;
+        } else {
+            failed++;
+        }
+    }
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i already there (%.3fs)\n",
+        count, failed, skipped, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vinfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vinfo.reserve(mempool.mapTx.size());
+        for (const CTxMemPoolEntry& entry : mempool.mapTx) {
+            vinfo.push_back(std::make_pair(entry.GetTx(), entry.GetTime()));
+        }
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vinfo.size();
+        for (const auto& info : vinfo) {
+            const uint256& hash = info.first.GetHash();
+            double dPriorityDelta = 0;
+            CAmount nFeeDelta = 0;
+            std::map<uint256, std::pair<double, CAmount> >::iterator it = mapDeltas.find(hash);
+            if (it != mapDeltas.end()) {
+                dPriorityDelta = it->second.first;
+                nFeeDelta = it->second.second;
+                mapDeltas.erase(it);
+            }
+            file << info.first;
+            file << info.second;
+            file << dPriorityDelta;
+            file << nFeeDelta;
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t nLast = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nMid-nStart)*0.000001, (nLast-nMid)*0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
 static class CMainCleanup
 {
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        setChainTips.clear();
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        vOrphanList.clear();
+        mapOrphanPeerUsage.clear();
+        nOrphanUsage = 0;
     }
 } instance_of_cmaincleanup;
 
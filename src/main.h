@@ -31,10 +31,13 @@
 #include "addressindex.h"
 #include "spentindex.h"
 #include "timestampindex.h"
+#include "noteindex.h"
 
 #include <algorithm>
 #include <exception>
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -45,11 +48,20 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CTxIndexDB;
+class CExplorerIndexDB;
+class CCoinsViewDB;
+class CCoinsViewFlusher;
 class CSporkDB;
+class CSaplingFrontierDB;
+class CBlockFilterDB;
+class CChainStatsDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
+class CSaplingCheck;
 class CScriptCheck;
+class CValidationCheck;
 class CValidationInterface;
 class CValidationState;
 class PrecomputedTransactionData;
@@ -61,6 +73,8 @@ static const unsigned int DEFAULT_BLOCK_MAX_SIZE = MAX_BLOCK_SIZE;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = DEFAULT_BLOCK_MAX_SIZE / 2;
+/** Default for -fastblocktemplate, answering getblocktemplate on a new tip with a coinbase-only block **/
+static const bool DEFAULT_FAST_BLOCK_TEMPLATE = true;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** Minimum alert priority for enabling safe mode. */
@@ -73,8 +87,24 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphanmemory, maximum kilobytes of memory used by orphan transactions */
+static const unsigned int DEFAULT_MAX_ORPHAN_MEMORY = 1000;
+/** The orphans of one peer may use at most 1/ORPHAN_MEMORY_PEER_SHARE of -maxorphanmemory */
+static const unsigned int ORPHAN_MEMORY_PEER_SHARE = 4;
+/** Default for -saplingfrontierinterval, in number of blocks (0 = disabled) */
+static const int DEFAULT_SAPLING_FRONTIER_INTERVAL = 1000;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA = 20;
 static const unsigned int DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA = DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA * Consensus::BLOSSOM_POW_TARGET_SPACING_RATIO;
@@ -86,12 +116,43 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Blocks written during initial block download are held until they fill this, then written at once */
+static const unsigned int BLOCKFILE_WRITE_BUFFER_SIZE = 0x800000; // 8 MiB
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Maximum number of block pre-check threads allowed */
+static const int MAX_BLOCK_PRECHECK_THREADS = 16;
+/** -blockprecheckthreads default */
+static const int DEFAULT_BLOCK_PRECHECK_THREADS = 2;
+/** Maximum number of blocks waiting for the pre-check threads */
+static const unsigned int MAX_BLOCK_PRECHECK_QUEUE = 32;
+/** Maximum number of transaction pre-check threads allowed */
+static const int MAX_TX_PRECHECK_THREADS = 16;
+/** -txprecheckthreads default */
+static const int DEFAULT_TX_PRECHECK_THREADS = 2;
+/** Maximum number of relayed transactions waiting for the pre-check threads */
+static const unsigned int MAX_TX_PRECHECK_QUEUE = 256;
+/** -reindexreaders default (block files parsed ahead during -reindex) */
+static const int DEFAULT_REINDEX_READERS = 2;
+/** Maximum number of -reindexreaders */
+static const int MAX_REINDEX_READERS = 16;
+/** Maximum size of the blocks parsed ahead from one block file during -reindex */
+static const size_t MAX_REINDEX_QUEUE_SIZE = 16 * 1024 * 1024;
+/** -blockmmapfiles default (block files kept memory mapped for reading); off where address space is scarce */
+static const int DEFAULT_BLOCK_MMAP_FILES = sizeof(void*) >= 8 ? 16 : 0;
+/** -undocache default (blocks whose undo data is kept in memory for reorgs) */
+static const int DEFAULT_UNDO_CACHE_BLOCKS = 10;
+/** Number of blocks that can be requested at any given time from a single peer whose throughput is not known yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 32;
+/** Bounds of the per-peer download window once it is sized from the peer's measured throughput. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 4;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER_ADAPTIVE = 128;
+/** Seconds of blocks, at a peer's measured rate, kept requested from it on top of its round trip time. */
+static const unsigned int BLOCK_DOWNLOAD_BUFFER_SECONDS = 4;
+/** Minimum time in milliseconds a block holding up the download window stays with its peer before it is handed to a faster one. */
+static const unsigned int BLOCK_STALLING_REASSIGN_MS = 1000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -102,6 +163,9 @@ static const unsigned int MAX_HEADERS_RESULTS = 1000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Average delay between trickled transaction inventory flushes to an inbound peer, in seconds.
+ *  Outbound peers are flushed to twice as often. */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -112,6 +176,9 @@ static const bool DEFAULT_ADDRESSINDEX = false;
 static const bool DEFAULT_TIMESTAMPINDEX = false;
 static const bool DEFAULT_SPENTINDEX = false;
 static const bool DEFAULT_SHIELDEDINDEX = false;
+static const bool DEFAULT_CHAINSTATSINDEX = false;
+/** -deferblockchecks default: run levels 3 and 4 of -checklevel after RPC is up */
+static const bool DEFAULT_DEFER_BLOCK_CHECKS = true;
 static const bool DEFAULT_DB_COMPRESSION = true;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 
@@ -134,6 +201,10 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+/** Bumped whenever entries of mapBlockIndex are freed or moved, so that pointers kept elsewhere can be checked */
+extern uint64_t nBlockIndexGeneration;
+/** The mapBlockIndex entries no other entry builds on, kept up to date as entries are added (requires cs_main) */
+extern std::set<CBlockIndex*> setChainTips;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -143,7 +214,10 @@ extern bool fExperimentalMode;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nBlockPrecheckThreads;
+extern int nTxPrecheckThreads;
 extern bool fTxIndex;
+extern int nSaplingFrontierInterval;
 
 extern bool fZindex;
 
@@ -163,11 +237,28 @@ extern bool fSpentIndex;
 // Maintain a full timestamp index, used to query for blocks within a time range
 extern bool fTimestampIndex;
 
+// Maintain shielded nullifier and note commitment indexes, used to query the spending
+// transaction of a nullifier and the tree position of a note commitment. Only set for
+// databases built with -insightexplorer by a version that maintains them.
+extern bool fNoteIndex;
+
+// The explorer indexes were enabled on an existing database and are being built
+// in the background; fAddressIndex, fSpentIndex and fTimestampIndex are set once
+// they catch up with the tip (protected by cs_main)
+extern bool fExplorerIndexBuilding;
+
+/** Blocks the background explorer index build reads at a time */
+static const size_t EXPLORER_INDEX_BATCH_SIZE = 64;
+/** Maximum number of threads reading blocks for the background explorer index build */
+static const int EXPLORER_INDEX_MAX_THREADS = 4;
+
 // END insightexplorer
 
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Block hash whose ancestors are assumed to have valid proofs and signatures (null to verify all) */
+extern uint256 hashAssumeValid;
 
 extern bool fLargeWorkForkFound;
 extern bool fLargeWorkInvalidChainFound;
@@ -235,12 +326,38 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Reindex the blk?????.dat files in order, with nReaders files at a time
+ * being located and deserialized ahead on reader threads
+ */
+void ReindexBlockFiles(const CChainParams& chainparams, int nReaders);
+/** Set the number of block files kept memory mapped for ReadBlockFromDisk; 0 reads through stdio only */
+void SetMappedBlockFiles(int nFiles);
+/** Set the number of recently connected blocks whose undo data is kept in memory */
+void SetUndoCacheBlocks(int nBlocks);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/**
+ * Fill an empty coins database from a snapshot written by dumptxoutset. The
+ * snapshot block and its ancestors must already be in the block index.
+ */
+bool LoadChainstateSnapshot(const boost::filesystem::path& path, CCoinsViewDB& coinsdb, std::string& strError);
+/**
+ * Fast sync: a new node given a snapshot with -fastsync only syncs headers
+ * until the snapshot block is in the best header chain, then loads the
+ * snapshot over its genesis-only chainstate and downloads the blocks after
+ * it. The blocks up to the snapshot are treated as pruned.
+ */
+/** Remember the snapshot to activate once its block header arrives (requires cs_main) */
+bool SetFastSyncSnapshot(const boost::filesystem::path& path, std::string& strError);
+/** Activate the fast sync snapshot if the best header chain has reached its block; aborts the node on failure (requires cs_main) */
+bool ActivateFastSyncSnapshot(const CChainParams& chainparams);
+/** Whether block download is held back until the fast sync snapshot is activated */
+bool IsFastSyncPending();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -252,6 +369,18 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/**
+ * Run an instance of the block pre-check thread, which verifies the shielded
+ * proofs and signatures of blocks stored ahead of the tip during initial
+ * block download and records them in the proof cache.
+ */
+void ThreadBlockPrecheck();
+/**
+ * Run an instance of the transaction pre-check thread, which verifies the
+ * shielded proofs and signatures of relayed transactions without cs_main
+ * and then hands them on to AcceptToMemoryPool.
+ */
+void ThreadTxPrecheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&), CCriticalSection& cs, const CBlockIndex *const &bestHeader);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -297,6 +426,10 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Dump the mempool, with its entry times and prioritisations, to disk */
+void DumpMempool();
+/** Load the mempool from disk, verifying the shielded proofs in parallel */
+bool LoadMempool();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 /** See whether the protocol update is enforced for connected nodes */
@@ -304,6 +437,9 @@ int ActiveProtocol();
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee=false);
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false);
 int GetInputAge(CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
@@ -315,6 +451,12 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightLimit;
+    uint64_t nBlocksDownloaded;
+    uint64_t nBlockBytesDownloaded;
+    uint64_t nBlocksReassigned;
+    double dBlockLatency;      //!< Average seconds from request to receipt
+    double dBlockDownloadRate; //!< Average bytes per second while blocks were in flight
 };
 
 
@@ -367,18 +509,30 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
-/** Check a transaction contextually against a set of consensus rules */
+/**
+ * Check a transaction contextually against a set of consensus rules. If
+ * pvChecks is not NULL, the joinSplitSig and Sapling proof and signature
+ * checks are appended to it instead of being run. If txdata is not NULL, its
+ * hashes are reused for the shielded signature hash.
+ */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state,
                                 const CChainParams& chainparams, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)(const CChainParams&) = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)(const CChainParams&) = IsInitialBlockDownload,
+                                std::vector<CValidationCheck> *pvChecks = NULL,
+                                const PrecomputedTransactionData *txdata = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 
 /** Transaction validation functions */
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier);
+/**
+ * Context-independent validity checks. If pvChecks is not NULL, the JoinSplit
+ * proof checks are appended to it instead of being run; verifier must then
+ * outlive them.
+ */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier,
+                      std::vector<CValidationCheck> *pvChecks = NULL);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
 
 /** Check for standard transaction types
@@ -464,30 +618,111 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the Sapling spend and output proofs, spend
+ * authorization signatures and binding signature of one transaction, so the
+ * Sapling bundles of a block can be verified in parallel.
+ */
+class CSaplingCheck
+{
+private:
+    const CTransaction *ptx;
+    uint256 dataToBeSigned;
+    std::string strError;
+    std::string strRejectReason;
+
+public:
+    CSaplingCheck(): ptx(0) {}
+    CSaplingCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn), dataToBeSigned(dataToBeSignedIn) { }
+
+    bool operator()();
+
+    void swap(CSaplingCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+        strError.swap(check.strError);
+        strRejectReason.swap(check.strRejectReason);
+    }
+
+    const std::string& GetError() const { return strError; }
+    const std::string& GetRejectReason() const { return strRejectReason; }
+};
+
+/**
+ * A check run on the script check threads: a script, JoinSplit proof,
+ * joinSplitSig or Sapling check, so the expensive parts of validating a
+ * block share one pool. Only success or failure is reported; the failing
+ * transaction is found by checking again without deferring.
+ */
+class CValidationCheck
+{
+private:
+    std::function<bool()> fn;
+
+public:
+    CValidationCheck() {}
+    explicit CValidationCheck(std::function<bool()> fnIn) : fn(fnIn) {}
+
+    /** Take over a CScriptCheck or CSaplingCheck */
+    template <typename T>
+    static CValidationCheck From(T& check) {
+        std::shared_ptr<T> p = std::make_shared<T>();
+        p->swap(check);
+        return CValidationCheck([p]() { return (*p)(); });
+    }
+
+    bool operator()() { return !fn || fn(); }
+
+    void swap(CValidationCheck &check) {
+        fn.swap(check.fn);
+    }
+};
+
+/**
+ * Run checks on the script check threads, with the calling thread helping,
+ * and return whether all passed. Must not be called from a check.
+ */
+bool RunValidationChecks(std::vector<CValidationCheck>& vChecks);
+
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(const uint160& addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
         int start = 0, int end = 0);
+/** The balance of an address and what it received in total, without reading its address index entries */
+bool GetAddressBalance(const uint160& addressHash, int type, CAddressBalanceValue& value);
 bool GetAddressUnspent(const uint160& addressHash, int type,
         std::vector<CAddressUnspentDbEntry>& unspentOutputs);
+/** Batched forms, reading many addresses in one sweep of the index; results are grouped by address */
+bool GetAddressIndex(const std::vector<std::pair<uint160, int> >& addresses,
+        std::vector<CAddressIndexDbEntry> &addressIndex,
+        int start = 0, int end = 0);
+bool GetAddressUnspent(const std::vector<std::pair<uint160, int> >& addresses,
+        std::vector<CAddressUnspentDbEntry>& unspentOutputs);
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes);
+bool GetNullifierIndex(const CNoteIndexKey &key, CNullifierIndexValue &value);
+bool GetCommitmentIndex(const CNoteIndexKey &key, CCommitmentIndexValue &value);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block's serialized bytes as stored in its block file, without decoding the transactions */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     const CChainParams& chainparams,
-    bool fCheckPOW = true);
+    bool fCheckPOW = true, bool fCheckSolution = true);
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 const CChainParams& chainparams,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+                bool fCheckPOW = true, bool fCheckMerkleRoot = true,
+                std::vector<CValidationCheck> *pvChecks = NULL);
 
 /** Context-dependent validity checks.
  *  By "context", we mean only the previous block headers, but not the UTXO
@@ -497,11 +732,51 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state,
                           const CChainParams& chainparams, CBlockIndex *pindexPrev);
 
+/**
+ * Time spent in each phase of connecting blocks, in microseconds, summed
+ * over the blocks it was collected for (see zcbenchmark connectblockreplay).
+ * Sapling proofs are verified in ContextualCheckBlock(), so
+ * nTimeSaplingProofs is for callers of ConnectBlock() to fill in.
+ */
+struct CConnectBlockTimings
+{
+    int64_t nBlocks;
+    int64_t nTransactions;
+    int64_t nTimeSproutProofs;  //!< CheckBlock(): JoinSplit proofs and signatures, and the context-free checks
+    int64_t nTimeSaplingProofs; //!< ContextualCheckBlock()
+    int64_t nTimeInputs;        //!< fetching and spending the inputs, creating the outputs
+    int64_t nTimeScripts;
+    int64_t nTimeTrees;         //!< appending to the commitment trees
+    int64_t nTimeUndo;
+    int64_t nTimeIndex;
+
+    CConnectBlockTimings() : nBlocks(0), nTransactions(0), nTimeSproutProofs(0), nTimeSaplingProofs(0),
+        nTimeInputs(0), nTimeScripts(0), nTimeTrees(0), nTimeUndo(0), nTimeIndex(0) {}
+};
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pTimings is given, the block is checked in this thread and the time
+ *  of every phase is added to it; with fJustCheck, the undo data and index
+ *  entries are then serialized in memory rather than written, to time them. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CConnectBlockTimings* pTimings = NULL);
+
+enum DisconnectResult
+{
+    DISCONNECT_OK,      // All good.
+    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
+    DISCONNECT_FAILED   // Something else went wrong.
+};
+
+/** Undo the effects of this block (with given index) on the UTXO set represented by coins.
+ *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
+ *  The addressIndex and spentIndex will be updated if requested.
+ */
+DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state,
+    const CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
+    const bool updateIndices);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -523,11 +798,20 @@ public:
     CVerifyDB();
     ~CVerifyDB();
     bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
+    /** Levels 0 to 2: read the last nCheckDepth blocks and their undo data on several threads, and check the blocks */
+    bool VerifyBlocks(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth);
+    /** Levels 3 and 4: disconnect the last nCheckDepth blocks from coinsview in memory, and connect them again */
+    bool VerifyCoins(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
 };
 
+/** chainActive.GetLocator(pindex), reused while the same block is asked for; requires cs_main */
+CBlockLocator GetCachedLocator(const CBlockIndex* pindex);
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
+/** Estimated heap usage of mapBlockIndex and its entries, the tip candidates and the active chain (requires cs_main) */
+size_t GetBlockIndexMemoryUsage();
+
 /** Mark a block as invalid. */
 bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, CBlockIndex *pindex);
 
@@ -537,14 +821,71 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * A copy of chainActive as of its last change, for readers that do not hold
+ * cs_main. Under cs_main it always matches chainActive.
+ */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot();
+
+/**
+ * Find a block index entry without holding cs_main. Fields of the entry
+ * that change after it is added, such as nStatus, may be read slightly
+ * out of date.
+ */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The coins lookups of pcoinsTip, readable without cs_main */
+extern CCoinsCacheCounters coinsTipCounters;
+
+/** Global variable that points to the coin database under pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** Global variable that points to the layer writing flushes of pcoinsTip to pcoinsdbview in the background (protected by cs_main) */
+extern CCoinsViewFlusher *pcoinsflusher;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the transaction index, or NULL without -txindex */
+extern CTxIndexDB *ptxindexdb;
+
+/** Global variable that points to the insight explorer indexes, or NULL without -insightexplorer */
+extern CExplorerIndexDB *pexplorerdb;
+
 /** Global variable that points to the spork database (protected by cs_main) */
 extern CSporkDB* pSporkDB;
+
+/** Global variable that points to the Sapling frontier checkpoints (protected by cs_main) */
+extern CSaplingFrontierDB *pSaplingFrontierDB;
+
+/** Global variable that points to the compact block filter index, or NULL without -blockfilterindex */
+extern CBlockFilterDB *pblockfilterdb;
+
+/** Write the filters of the blocks of chain that are missing from the filter index. (requires cs_main) */
+bool SyncBlockFilterIndex(const CChain& chain, const Consensus::Params& consensusParams);
+
+/** Global variable that points to the chain statistics index, or NULL without -chainstatsindex */
+extern CChainStatsDB *pchainstatsdb;
+
+/** Write the statistics of the blocks of chain that are missing from the chain statistics index. (requires cs_main) */
+bool SyncChainStatsIndex(const CChain& chain, const Consensus::Params& consensusParams);
+
+/** Enable the explorer indexes on a database built without them, to be built by ThreadBuildExplorerIndex. (requires cs_main) */
+bool StartExplorerIndexBuild();
+/** Build the explorer indexes from the blocks on disk while the node runs */
+void ThreadBuildExplorerIndex();
+/** While the explorer indexes are being built, get the height they are built up to */
+bool GetExplorerIndexSyncHeight(int& nHeight);
+
+/**
+ * Get the Sapling commitment tree as of the end of pindex. If the coins
+ * database has no anchor for that root, rebuild it from the nearest
+ * frontier checkpoint at or below pindex. (protected by cs_main)
+ */
+bool GetSaplingTreeAt(const CBlockIndex* pindex, SaplingMerkleTree& tree);
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
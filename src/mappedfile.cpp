@@ -0,0 +1,93 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pdata), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("%s: cannot map %s\n", __func__, path.string());
+        return nullptr;
+    }
+    // Blocks are read one at a time from anywhere in the file
+    posix_madvise(p, st.st_size, POSIX_MADV_RANDOM);
+    return std::shared_ptr<const CMappedFile>(new CMappedFile((const char*)p, st.st_size));
+#else
+    return nullptr;
+#endif
+}
+
+void CMappedFileCache::SetMaxFiles(size_t nMaxFilesIn)
+{
+    LOCK(cs);
+    nMaxFiles = nMaxFilesIn;
+    while (listFiles.size() > nMaxFiles)
+        listFiles.pop_back();
+}
+
+std::shared_ptr<const CMappedFile> CMappedFileCache::Get(int nFile, const boost::filesystem::path& path, uint64_t nEnd)
+{
+    LOCK(cs);
+    if (nMaxFiles == 0)
+        return nullptr;
+
+    for (auto it = listFiles.begin(); it != listFiles.end(); ++it) {
+        if (it->first != nFile)
+            continue;
+        if (it->second->size() >= nEnd) {
+            listFiles.splice(listFiles.begin(), listFiles, it);
+            return it->second;
+        }
+        // The file has been appended to since it was mapped
+        listFiles.erase(it);
+        break;
+    }
+
+    std::shared_ptr<const CMappedFile> pfile = CMappedFile::Open(path);
+    if (!pfile || pfile->size() < nEnd)
+        return nullptr;
+    listFiles.emplace_front(nFile, pfile);
+    if (listFiles.size() > nMaxFiles)
+        listFiles.pop_back();
+    return pfile;
+}
+
+void CMappedFileCache::Drop(int nFile)
+{
+    LOCK(cs);
+    for (auto it = listFiles.begin(); it != listFiles.end(); ++it) {
+        if (it->first == nFile) {
+            listFiles.erase(it);
+            return;
+        }
+    }
+}
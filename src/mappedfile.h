@@ -0,0 +1,68 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+/** Read-only memory mapping of a whole file, as it was when it was opened. */
+class CMappedFile
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    ~CMappedFile();
+
+    /** Map a file, or return NULL if it cannot be mapped on this platform. */
+    static std::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+
+    const char* begin() const { return pdata; }
+    const char* end() const { return pdata + nSize; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Mappings of the most recently read files, identified by their number
+ * (such as the block file number). Readers keep a mapping alive through
+ * the returned pointer even after it is dropped from the cache.
+ */
+class CMappedFileCache
+{
+private:
+    mutable CCriticalSection cs;
+    size_t nMaxFiles;
+    //! Most recently used first
+    std::list<std::pair<int, std::shared_ptr<const CMappedFile> > > listFiles;
+
+public:
+    CMappedFileCache() : nMaxFiles(0) {}
+
+    /** Set the number of files kept mapped; 0 disables mapping. */
+    void SetMaxFiles(size_t nMaxFilesIn);
+
+    /**
+     * Return a mapping of file nFile covering at least the first nEnd bytes,
+     * remapping the file if it has grown, or NULL if that is not possible.
+     */
+    std::shared_ptr<const CMappedFile> Get(int nFile, const boost::filesystem::path& path, uint64_t nEnd);
+
+    /** Forget the mapping of a file, for instance because it was removed. */
+    void Drop(int nFile);
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
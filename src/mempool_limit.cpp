@@ -12,26 +12,48 @@
 const CAmount DEFAULT_FEE = 10000;
 const TxWeight ZERO_WEIGHT = TxWeight(0, 0);
 
+EvictionTxIdHasher::EvictionTxIdHasher() : salt(GetRandHash()) {}
+
+
+void RecentlyEvictedList::dropOldest()
+{
+    TimeBucket& oldest = buckets.front();
+    txIdSet.erase(oldest.txIds.front());
+    oldest.txIds.pop_front();
+    entries -= 1;
+    if (oldest.txIds.empty()) {
+        buckets.pop_front();
+    }
+}
+
 void RecentlyEvictedList::pruneList()
 {
     if (txIdSet.empty()) {
         return;
     }
     int64_t now = GetAdjustedTime();
-    while (txIdsAndTimes.size() > 0 && now - txIdsAndTimes.front().second > timeToKeep) {
-        txIdSet.erase(txIdsAndTimes.front().first);
-        txIdsAndTimes.pop_front();
+    while (buckets.size() > 0 && now - buckets.front().time > timeToKeep) {
+        for (const uint256& txId : buckets.front().txIds) {
+            txIdSet.erase(txId);
+        }
+        entries -= buckets.front().txIds.size();
+        buckets.pop_front();
     }
 }
 
 void RecentlyEvictedList::add(const uint256& txId)
 {
     pruneList();
-    if (txIdsAndTimes.size() == capacity) {
-        txIdSet.erase(txIdsAndTimes.front().first);
-        txIdsAndTimes.pop_front();
+    if (entries == capacity) {
+        dropOldest();
+    }
+    int64_t now = GetAdjustedTime();
+    if (buckets.empty() || buckets.back().time != now) {
+        buckets.push_back(TimeBucket());
+        buckets.back().time = now;
     }
-    txIdsAndTimes.push_back(std::make_pair(txId, GetAdjustedTime()));
+    buckets.back().txIds.push_back(txId);
+    entries += 1;
     txIdSet.insert(txId);
 }
 
@@ -41,39 +63,55 @@ bool RecentlyEvictedList::contains(const uint256& txId)
     return txIdSet.count(txId) > 0;
 }
 
+size_t RecentlyEvictedList::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(txIdSet) + memusage::MallocUsage(entries * sizeof(uint256)) +
+           memusage::MallocUsage(buckets.size() * sizeof(TimeBucket));
+}
+
+
+static inline size_t LowBit(size_t k)
+{
+    return k & (~k + 1);
+}
 
-TxWeight WeightedTxTree::getWeightAt(size_t index) const
+TxWeight WeightedTxTree::getPrefixWeight(size_t count) const
 {
-    return index < size ? txIdAndWeights[index].txWeight.add(childWeights[index]) : ZERO_WEIGHT;
+    TxWeight sum = ZERO_WEIGHT;
+    for (size_t k = count; k > 0; k -= LowBit(k)) {
+        sum = sum.add(partialWeights[k - 1]);
+    }
+    return sum;
 }
 
-void WeightedTxTree::backPropagate(size_t fromIndex, const TxWeight& weightDelta)
+void WeightedTxTree::updateWeightAt(size_t index, const TxWeight& weightDelta)
 {
-    while (fromIndex > 0) {
-        fromIndex = (fromIndex - 1) / 2;
-        childWeights[fromIndex] = childWeights[fromIndex].add(weightDelta);
+    for (size_t k = index + 1; k <= partialWeights.size(); k += LowBit(k)) {
+        partialWeights[k - 1] = partialWeights[k - 1].add(weightDelta);
     }
 }
 
-size_t WeightedTxTree::findByEvictionWeight(size_t fromIndex, int64_t weightToFind) const
+size_t WeightedTxTree::findByEvictionWeight(int64_t weightToFind) const
 {
-    int leftWeight = getWeightAt(fromIndex * 2 + 1).evictionWeight;
-    int rightWeight = getWeightAt(fromIndex).evictionWeight - getWeightAt(fromIndex * 2 + 2).evictionWeight;
-    // On Left
-    if (weightToFind < leftWeight) {
-        return findByEvictionWeight(fromIndex * 2 + 1, weightToFind);
+    // Walk down the implicit tree, skipping every range whose weights all
+    // lie below weightToFind
+    size_t step = 1;
+    while (step * 2 <= partialWeights.size()) {
+        step *= 2;
     }
-    // Found
-    if (weightToFind < rightWeight) {
-        return fromIndex;
+    size_t count = 0;
+    for (; step > 0; step /= 2) {
+        if (count + step <= partialWeights.size() && partialWeights[count + step - 1].evictionWeight <= weightToFind) {
+            count += step;
+            weightToFind -= partialWeights[count - 1].evictionWeight;
+        }
     }
-    // On Right
-    return findByEvictionWeight(fromIndex * 2 + 2, weightToFind - rightWeight);
+    return count;
 }
 
 TxWeight WeightedTxTree::getTotalWeight() const
 {
-    return getWeightAt(0);
+    return totalWeight;
 }
 
 
@@ -83,39 +121,43 @@ void WeightedTxTree::add(const WeightedTxInfo& weightedTxInfo)
         // This should not happen, but should be prevented nonetheless
         return;
     }
+    size_t index = txIdAndWeights.size();
     txIdAndWeights.push_back(weightedTxInfo);
-    childWeights.push_back(ZERO_WEIGHT);
-    txIdToIndexMap[weightedTxInfo.txId] = size;
-    backPropagate(size, weightedTxInfo.txWeight);
-    size += 1;
+    txIdToIndexMap[weightedTxInfo.txId] = index;
+
+    // The new node covers the transactions (k - lowbit(k), k] with k = index + 1,
+    // all but the last of which are already in the tree
+    size_t k = index + 1;
+    TxWeight covered = getPrefixWeight(index).add(getPrefixWeight(k - LowBit(k)).negate());
+    partialWeights.push_back(covered.add(weightedTxInfo.txWeight));
+    totalWeight = totalWeight.add(weightedTxInfo.txWeight);
 }
 
 void WeightedTxTree::remove(const uint256& txId)
 {
-    if (txIdToIndexMap.find(txId) == txIdToIndexMap.end()) {
+    auto it = txIdToIndexMap.find(txId);
+    if (it == txIdToIndexMap.end()) {
         // Remove may be called multiple times for a given tx, so this is necessary
         return;
     }
 
-    size_t removeIndex = txIdToIndexMap[txId];
-
-    // We reduce the size at the start of this method to avoid saying size - 1
-    // when refering to the last element of the array below
-    size -= 1;
-
-    TxWeight lastChildWeight = txIdAndWeights[size].txWeight;
-    backPropagate(size, lastChildWeight.negate());
+    size_t removeIndex = it->second;
+    size_t lastIndex = txIdAndWeights.size() - 1;
+    TxWeight removedWeight = txIdAndWeights[removeIndex].txWeight;
 
-    if (removeIndex < size) {
-        TxWeight weightDelta = lastChildWeight.add(txIdAndWeights[removeIndex].txWeight.negate());
-        txIdAndWeights[removeIndex] = txIdAndWeights[size];
+    if (removeIndex < lastIndex) {
+        TxWeight weightDelta = txIdAndWeights[lastIndex].txWeight.add(removedWeight.negate());
+        txIdAndWeights[removeIndex] = txIdAndWeights[lastIndex];
         txIdToIndexMap[txIdAndWeights[removeIndex].txId] = removeIndex;
-        backPropagate(removeIndex, weightDelta);
+        updateWeightAt(removeIndex, weightDelta);
     }
 
+    // No other node covers the last transaction, so dropping its node takes
+    // it out of the tree
     txIdToIndexMap.erase(txId);
     txIdAndWeights.pop_back();
-    childWeights.pop_back();
+    partialWeights.pop_back();
+    totalWeight = totalWeight.add(removedWeight.negate());
 }
 
 boost::optional<uint256> WeightedTxTree::maybeDropRandom()
@@ -125,8 +167,8 @@ boost::optional<uint256> WeightedTxTree::maybeDropRandom()
         return boost::none;
     }
     LogPrint("mempool", "Mempool cost limit exceeded (cost=%d, limit=%d)\n", totalTxWeight.cost, capacity);
-    int randomWeight = GetRand(totalTxWeight.evictionWeight);
-    WeightedTxInfo drop = txIdAndWeights[findByEvictionWeight(0, randomWeight)];
+    int64_t randomWeight = GetRand(totalTxWeight.evictionWeight);
+    WeightedTxInfo drop = txIdAndWeights[findByEvictionWeight(randomWeight)];
     LogPrint("mempool", "Evicting transaction (txid=%s, cost=%d, evictionWeight=%d)\n",
         drop.txId.ToString(), drop.txWeight.cost, drop.txWeight.evictionWeight);
     remove(drop.txId);
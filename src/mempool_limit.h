@@ -5,11 +5,12 @@
 #ifndef MEMPOOLLIMIT_H
 #define MEMPOOLLIMIT_H
 
-#include <map>
-#include <set>
+#include <deque>
 #include <vector>
 
 #include "boost/optional.hpp"
+#include "boost/unordered_map.hpp"
+#include "boost/unordered_set.hpp"
 #include "primitives/transaction.h"
 #include "uint256.h"
 
@@ -21,6 +22,21 @@ const uint64_t MIN_TX_COST = 4000;
 const uint64_t LOW_FEE_PENALTY = 16000;
 
 
+// Salted hasher for the txid indexes below, so that lookups stay constant time
+// whatever txids a peer sends.
+class EvictionTxIdHasher
+{
+    uint256 salt;
+
+public:
+    EvictionTxIdHasher();
+
+    size_t operator()(const uint256& txId) const {
+        return txId.GetHash(salt);
+    }
+};
+
+
 // This class keeps track of transactions which have been recently evicted from the mempool
 // in order to prevent them from being re-accepted for a given amount of time. 
 class RecentlyEvictedList
@@ -29,12 +45,18 @@ class RecentlyEvictedList
 
     const int64_t timeToKeep;
 
-    // Pairs of txid and time (seconds since epoch)
-    std::deque<std::pair<uint256, int64_t>> txIdsAndTimes;
+    // The txids evicted within one second (seconds since epoch), oldest first
+    struct TimeBucket {
+        int64_t time;
+        std::deque<uint256> txIds;
+    };
+    std::deque<TimeBucket> buckets;
+    size_t entries = 0;
 
-    std::set<uint256> txIdSet;
+    boost::unordered_set<uint256, EvictionTxIdHasher> txIdSet;
 
     void pruneList();
+    void dropOldest();
 
 public:
     RecentlyEvictedList(size_t capacity_, int64_t timeToKeep_) : capacity(capacity_), timeToKeep(timeToKeep_) 
@@ -45,6 +67,7 @@ public:
 
     void add(const uint256& txId);
     bool contains(const uint256& txId);
+    size_t DynamicMemoryUsage() const;
 };
 
 
@@ -81,34 +104,36 @@ struct WeightedTxInfo {
 // The following class is a collection of transaction ids and their costs.
 // In order to be able to remove transactions randomly weighted by their cost,
 // we keep track of the total cost of all transactions in this collection.
-// For performance reasons, the collection is represented as a complete binary
-// tree where each node knows the sum of the weights of the children. This
-// allows for addition, removal, and random selection/dropping in logarithmic time.
+// For performance reasons, the weights are kept in a flat Fenwick (binary
+// indexed) tree alongside the transactions. This allows for addition, removal,
+// and random selection/dropping in logarithmic time.
 class WeightedTxTree
 {
     const int64_t capacity;
-    size_t size = 0;
-    
-    // The following two vectors are the tree representation of this collection.
-    // We keep track of 3 data points for each node: A transaction's txid, its cost,
-    // and the sum of the weights of all children and descendant of that node.
+
+    // The transactions of the collection. A removed transaction is replaced by
+    // the last one, so the array stays dense.
     std::vector<WeightedTxInfo> txIdAndWeights;
-    std::vector<TxWeight> childWeights;
+
+    // The Fenwick tree over the weights above: element k - 1 holds the sum of
+    // the weights of transactions (k - lowbit(k), k], counting from 1.
+    std::vector<TxWeight> partialWeights;
+
+    TxWeight totalWeight = TxWeight(0, 0);
 
     // The following map is to simplify removal. When removing a tx, we do so by txid.
-    // This map allows looking up the transaction's index in the tree.
-    std::map<uint256, size_t> txIdToIndexMap;
+    // This map allows looking up the transaction's index in the array.
+    boost::unordered_map<uint256, size_t, EvictionTxIdHasher> txIdToIndexMap;
 
-    // Returns the sum of a node and all of its children's TxWeights for a given index.
-    TxWeight getWeightAt(size_t index) const;
+    // Returns the sum of the TxWeights of the first count transactions.
+    TxWeight getPrefixWeight(size_t count) const;
 
-    // When adding and removing a node we need to update its parent and all of its
-    // ancestors to reflect its cost.
-    void backPropagate(size_t fromIndex, const TxWeight& weightDelta);
+    // Adds weightDelta to the weight of the transaction at index.
+    void updateWeightAt(size_t index, const TxWeight& weightDelta);
 
-    // For a given random cost + fee penalty, this method recursively finds the
+    // For a given random cost + fee penalty, this method finds the index of the
     // correct transaction. This is used by WeightedTxTree::maybeDropRandom().
-    size_t findByEvictionWeight(size_t fromIndex, int64_t weightToFind) const;
+    size_t findByEvictionWeight(int64_t weightToFind) const;
 
 public:
     WeightedTxTree(int64_t capacity_) : capacity(capacity_) {
@@ -5,8 +5,12 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "prevector.h"
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
+#include <list>
 #include <map>
 #include <set>
 #include <vector>
@@ -82,18 +86,39 @@ static inline size_t DynamicUsage(const prevector<N, X, S, D>& v)
     return MallocUsage(v.allocated_memory());
 }
 
-template<typename X>
-static inline size_t DynamicUsage(const std::set<X>& s)
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
 {
     return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
 }
 
-template<typename X, typename Y>
-static inline size_t DynamicUsage(const std::map<X, Y>& m)
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::multimap<X, Y, Z>& m)
 {
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
+template<typename X>
+struct stl_list_node
+{
+private:
+    void* next;
+    void* prev;
+    X x;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::list<X>& l)
+{
+    return MallocUsage(sizeof(stl_list_node<X>)) * l.size();
+}
+
 // Boost data structures
 
 template<typename X>
@@ -115,6 +140,13 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+/** Maps on a pool allocator account for the chunks and buckets they really hold */
+template<typename X, typename Y, typename Z, typename E>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, E, CPoolAllocator<std::pair<const X, Y> > >& m)
+{
+    return m.get_allocator().Resource().DynamicMemoryUsage();
+}
+
 }
 
 #endif
@@ -12,6 +12,17 @@
 using namespace std;
 
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
+{
+    Filter(block, filter, NULL);
+}
+
+CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter, const std::vector<CTxFilterElements>& vElements)
+{
+    assert(vElements.size() == block.vtx.size());
+    Filter(block, filter, &vElements);
+}
+
+void CMerkleBlock::Filter(const CBlock& block, CBloomFilter& filter, const std::vector<CTxFilterElements>* pElements)
 {
     header = block.GetBlockHeader();
 
@@ -24,7 +35,9 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const uint256& hash = block.vtx[i].GetHash();
-        if (filter.IsRelevantAndUpdate(block.vtx[i]))
+        bool fRelevant = pElements ? filter.IsRelevantAndUpdate(block.vtx[i], (*pElements)[i]) :
+                                     filter.IsRelevantAndUpdate(block.vtx[i]);
+        if (fRelevant)
         {
             vMatch.push_back(true);
             vMatchedTxn.push_back(make_pair(i, hash));
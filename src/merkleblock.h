@@ -138,6 +138,8 @@ public:
      * thus the filter will likely be modified.
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
+    //! Same as above, with the filter elements of each transaction of block already parsed
+    CMerkleBlock(const CBlock& block, CBloomFilter& filter, const std::vector<CTxFilterElements>& vElements);
 
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
@@ -151,6 +153,9 @@ public:
         READWRITE(header);
         READWRITE(txn);
     }
+
+private:
+    void Filter(const CBlock& block, CBloomFilter& filter, const std::vector<CTxFilterElements>* pElements);
 };
 
 #endif // BITCOIN_MERKLEBLOCK_H
@@ -8,12 +8,14 @@
 #include "checkpoints.h"
 #include "main.h"
 #include "timedata.h"
+#include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utiltime.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
 #include <boost/thread.hpp>
 #include <boost/thread/synchronized_value.hpp>
 #include <string>
@@ -82,6 +84,46 @@ AtomicCounter solutionTargetChecks;
 static AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
 
+// Sorted, for the binary search in MessageTypeIndex()
+static const char* const vMessageTypes[] = {
+    "addr", "alert", "block", "blocktxn", "cmpctblock", "dseg", "dsegv", "fbs", "fbvote",
+    "filteradd", "filterclear", "filterload", "getaddr", "getblocks", "getblocktxn",
+    "getcfcheckpt", "getcfheaders", "getcfilters", "getdata", "getheaders", "getsporks",
+    "headers", "inv", "ix", "mempool", "merkleblock", "mvote", "notfound", "ping", "pong",
+    "reject", "sendcmpct", "spork", "ssc", "tx", "txlcert", "txlvote", "verack", "version",
+    "znb", "znget", "znlv", "znp", "znvs", "znw", "zprop",
+};
+static const size_t NUM_MESSAGE_TYPES = sizeof(vMessageTypes) / sizeof(vMessageTypes[0]);
+// The last entries count the messages of any other type
+static std::atomic<uint64_t> vMessageBytesRecv[NUM_MESSAGE_TYPES + 1];
+static std::atomic<uint64_t> vMessageBytesSent[NUM_MESSAGE_TYPES + 1];
+
+static size_t MessageTypeIndex(const std::string& strCommand)
+{
+    const char* const* pend = vMessageTypes + NUM_MESSAGE_TYPES;
+    const char* const* it = std::lower_bound(vMessageTypes, pend, strCommand,
+        [](const char* pszType, const std::string& str) { return str.compare(pszType) > 0; });
+    if (it != pend && strCommand == *it)
+        return it - vMessageTypes;
+    return NUM_MESSAGE_TYPES;
+}
+
+void RecordMessageBytes(const std::string& strCommand, uint64_t nBytes, bool fSent)
+{
+    std::atomic<uint64_t>* vBytes = fSent ? vMessageBytesSent : vMessageBytesRecv;
+    vBytes[MessageTypeIndex(strCommand)].fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+void GetMessageBytes(std::map<std::string, std::pair<uint64_t, uint64_t> >& mapBytes)
+{
+    mapBytes.clear();
+    for (size_t i = 0; i <= NUM_MESSAGE_TYPES; i++) {
+        mapBytes[i < NUM_MESSAGE_TYPES ? vMessageTypes[i] : "other"] = std::make_pair(
+            vMessageBytesRecv[i].load(std::memory_order_relaxed),
+            vMessageBytesSent[i].load(std::memory_order_relaxed));
+    }
+}
+
 static boost::synchronized_value<std::list<uint256>> trackedBlocks;
 
 static boost::synchronized_value<std::list<std::string>> messageBox;
@@ -209,7 +251,7 @@ void ConnectMetricsScreen()
 int printStats(bool mining)
 {
     // Number of lines that are always displayed
-    int lines = 4;
+    int lines = 6;
 
     int height;
     int64_t currentHeadersHeight;
@@ -225,6 +267,18 @@ int printStats(bool mining)
         netsolps = GetNetworkHashPS(120, -1);
     }
     auto localsolps = GetLocalSolPS();
+    CMemPoolStats mempoolStats = mempool.GetStats();
+    CMemPoolStatsEntry mempoolTotal;
+    std::string strClasses;
+    for (int i = 0; i < MEMPOOL_TX_CLASS_COUNT; i++) {
+        const CMemPoolStatsEntry& entry = mempoolStats.classes[i];
+        mempoolTotal.nCount += entry.nCount;
+        mempoolTotal.nBytes += entry.nBytes;
+        mempoolTotal.nCost += entry.nCost;
+        if (!strClasses.empty())
+            strClasses += ", ";
+        strClasses += strprintf("%s %d", GetMemPoolTxClassName((MemPoolTxClass)i), entry.nCount);
+    }
 
     if (IsInitialBlockDownload(Params())) {
         int netheight = currentHeadersHeight == -1 || currentHeadersTime == 0 ?
@@ -236,6 +290,9 @@ int printStats(bool mining)
     }
     std::cout << "            " << _("Connections") << " | " << connections << std::endl;
     std::cout << "  " << _("Network solution rate") << " | " << netsolps << " Sol/s" << std::endl;
+    std::cout << "                " << _("Mempool") << " | " << strprintf(_("%d txs, %d bytes, cost %d"),
+        mempoolTotal.nCount, mempoolTotal.nBytes, mempoolTotal.nCost) << std::endl;
+    std::cout << "       " << _("Mempool by class") << " | " << strClasses << std::endl;
     if (mining && miningTimer.running()) {
         std::cout << "    " << _("Local solution rate") << " | " << strprintf("%.4f Sol/s", localsolps) << std::endl;
         lines++;
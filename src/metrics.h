@@ -2,10 +2,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
 #include "uint256.h"
 #include "consensus/params.h"
 
 #include <atomic>
+#include <map>
 #include <mutex>
 #include <string>
 
@@ -60,6 +64,11 @@ extern AtomicCounter ehSolverRuns;
 extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
 
+/** Count the bytes of a P2P message, header included, against its command */
+void RecordMessageBytes(const std::string& strCommand, uint64_t nBytes, bool fSent);
+/** Bytes received and sent per command; commands the node does not know are counted as "other" */
+void GetMessageBytes(std::map<std::string, std::pair<uint64_t, uint64_t> >& mapBytes);
+
 void TrackMinedBlock(uint256 hash);
 
 void MarkStartTime();
@@ -116,5 +125,4 @@ const std::string METRICS_ART =
 "[0;33;5;43;103m%[0;1;33;93;43mt[0;34;40m                                                                            [0;1;30;90;43mt[0;33;5;43;103m%[0m\n"
 "[0;33;5;43;103m%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%[0m\n";
 
-
-
+#endif // BITCOIN_METRICS_H
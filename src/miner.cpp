@@ -53,32 +53,28 @@ using namespace std;
 // BitcoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
+/**
+ * Fees and sigops of a mempool transaction whose scripts passed
+ * ContextualCheckInputs while building a template on hashTemplateTip. Those
+ * checks hold for as long as the tip does not change, so later templates
+ * only run them for the transactions that arrived since.
+ */
+struct CTemplateTx
 {
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    CAmount nFees;
+    unsigned int nSigOps;
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
+    CTemplateTx() : nFees(0), nSigOps(0) {}
 };
 
+static uint256 hashTemplateTip GUARDED_BY(cs_main);
+static std::map<uint256, CTemplateTx> mapTemplateTxs GUARDED_BY(cs_main);
+
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
 // We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
+typedef boost::tuple<double, CFeeRate, CTxMemPool::txiter> TxPriority;
 class TxPriorityCompare
 {
     bool byFee;
@@ -113,7 +109,7 @@ void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams,
     }
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn, bool fIncludeMempool)
 {
     // Create new block
     std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
@@ -161,100 +157,30 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
         SaplingMerkleTree sapling_tree;
         assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->GetTx();
-
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                    ? nMedianTimePast
-                                    : pblock->GetBlockTime();
-
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            nTotalIn += tx.GetShieldedValueIn();
-
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
-
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
+        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                ? nMedianTimePast
+                                : pblock->GetBlockTime();
+
+        // Script checks done for an earlier template on this tip still hold
+        if (hashTemplateTip != pindexPrev->GetBlockHash()) {
+            mapTemplateTxs.clear();
+            hashTemplateTip = pindexPrev->GetBlockHash();
+        } else {
+            for (std::map<uint256, CTemplateTx>::iterator it = mapTemplateTxs.begin(); it != mapTemplateTxs.end(); ) {
+                if (mempool.mapTx.count(it->first))
+                    ++it;
+                else
+                    mapTemplateTxs.erase(it++);
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
         }
 
         // Collect transactions into block
         uint64_t nBlockSize = 1000;
         uint64_t nBlockTx = 0;
         int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        CTxMemPool::setEntries setIncluded;
 
         // We want to track the value pool, but if the miner gets
         // invoked on an old block before the hardcoded fallback
@@ -278,128 +204,195 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
             }
         }
 
-        while (!vecPriority.empty())
+        // Add a transaction together with those of its unconfirmed ancestors
+        // that are not in the block yet, in dependency order, or nothing if
+        // any of them cannot go in.
+        auto addPackage = [&](const std::vector<CTxMemPool::txiter>& vPackage, double dPriority) -> bool
         {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            // Size and legacy sigop limits need no coin lookups
+            uint64_t nPackageSize = 0;
+            unsigned int nPackageSigOps = 0;
+            for (CTxMemPool::txiter it : vPackage) {
+                nPackageSize += it->GetTxSize();
+                nPackageSigOps += GetLegacySigOpCount(it->GetTx());
             }
+            if (nBlockSize + nPackageSize >= nBlockMaxSize)
+                return false;
+            if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS)
+                return false;
+
+            CCoinsViewCache viewPackage(&view);
+            CAmount sproutValuePackage = sproutValue;
+            CAmount saplingValuePackage = saplingValue;
+            std::vector<CTemplateTx> vChecked;
+            nPackageSigOps = 0;
+            for (CTxMemPool::txiter it : vPackage) {
+                const CTransaction& tx = it->GetTx();
+                const uint256& hash = tx.GetHash();
+
+                if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
+                    return false;
+
+                if (!viewPackage.HaveInputs(tx))
+                    return false;
+
+                std::map<uint256, CTemplateTx>::const_iterator cached = mapTemplateTxs.find(hash);
+                if (cached != mapTemplateTxs.end()) {
+                    vChecked.push_back(cached->second);
+                } else {
+                    CTemplateTx checked;
+                    checked.nFees = viewPackage.GetValueIn(tx)-tx.GetValueOut();
+                    checked.nSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, viewPackage);
+
+                    // Note that flags: we don't want to set mempool/IsStandard()
+                    // policy here, but we still have to ensure that the block we
+                    // create only contains transactions that are valid in new blocks.
+                    CValidationState state;
+                    PrecomputedTransactionData txdata(tx);
+                    if (!ContextualCheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+                        return false;
 
-            if (!view.HaveInputs(tx))
-                continue;
+                    mapTemplateTxs[hash] = checked;
+                    vChecked.push_back(checked);
+                }
+                nPackageSigOps += vChecked.back().nSigOps;
+                if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS)
+                    return false;
 
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+                if (chainparams.ZIP209Enabled() && monitoring_pool_balances) {
+                    // Does this transaction lead to a turnstile violation?
+                    saplingValuePackage += -tx.valueBalance;
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+                    for (auto js : tx.vJoinSplit) {
+                        sproutValuePackage += js.vpub_old;
+                        sproutValuePackage -= js.vpub_new;
+                    }
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
-                continue;
+                    if (sproutValuePackage < 0) {
+                        LogPrintf("CreateNewBlock(): tx %s appears to violate Sprout turnstile\n", hash.ToString());
+                        return false;
+                    }
+                    if (saplingValuePackage < 0) {
+                        LogPrintf("CreateNewBlock(): tx %s appears to violate Sapling turnstile\n", hash.ToString());
+                        return false;
+                    }
+                }
 
-            if (chainparams.ZIP209Enabled() && monitoring_pool_balances) {
-                // Does this transaction lead to a turnstile violation?
+                UpdateCoins(tx, viewPackage, nHeight);
+            }
 
-                CAmount sproutValueDummy = sproutValue;
-                CAmount saplingValueDummy = saplingValue;
+            viewPackage.Flush();
+            sproutValue = sproutValuePackage;
+            saplingValue = saplingValuePackage;
 
-                saplingValueDummy += -tx.valueBalance;
+            for (size_t i = 0; i < vPackage.size(); i++) {
+                const CTransaction& tx = vPackage[i]->GetTx();
 
-                for (auto js : tx.vJoinSplit) {
-                    sproutValueDummy += js.vpub_old;
-                    sproutValueDummy -= js.vpub_new;
+                BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
+                    sapling_tree.append(outDescription.cm);
                 }
 
-                if (sproutValueDummy < 0) {
-                    LogPrintf("CreateNewBlock(): tx %s appears to violate Sprout turnstile\n", tx.GetHash().ToString());
-                    continue;
-                }
-                if (saplingValueDummy < 0) {
-                    LogPrintf("CreateNewBlock(): tx %s appears to violate Sapling turnstile\n", tx.GetHash().ToString());
-                    continue;
+                // Added
+                pblock->vtx.push_back(tx);
+                pblocktemplate->vTxFees.push_back(vChecked[i].nFees);
+                pblocktemplate->vTxSigOps.push_back(vChecked[i].nSigOps);
+                nBlockSize += vPackage[i]->GetTxSize();
+                ++nBlockTx;
+                nBlockSigOps += vChecked[i].nSigOps;
+                nFees += vChecked[i].nFees;
+                setIncluded.insert(vPackage[i]);
+
+                if (fPrintPriority)
+                {
+                    LogPrintf("priority %.1f fee %s txid %s\n",
+                        dPriority, vPackage[i]->GetFeeRate().ToString(), tx.GetHash().ToString());
                 }
-
-                sproutValue = sproutValueDummy;
-                saplingValue = saplingValueDummy;
             }
+            return true;
+        };
 
-            UpdateCoins(tx, view, nHeight);
-
-            BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
-                sapling_tree.append(outDescription.cm);
+        // High-priority transactions first, included regardless of the fees
+        // they pay. Only those with every input confirmed qualify; the rest
+        // follow their parents in below.
+        if (fIncludeMempool && nBlockPrioritySize > 0)
+        {
+            vector<TxPriority> vecPriority;
+            vecPriority.reserve(mempool.mapTx.size());
+            for (CTxMemPool::txiter mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+            {
+                if (mi->GetCountWithAncestors() > 1)
+                    continue;
+                double dPriority = mi->GetPriority(nHeight);
+                CAmount nFeeDelta = 0;
+                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, nFeeDelta);
+                vecPriority.push_back(TxPriority(dPriority, mi->GetFeeRate(), mi));
             }
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+            TxPriorityCompare comparer(false);
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-            if (fPrintPriority)
+            while (!vecPriority.empty())
             {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                // Take highest priority transaction off the priority queue:
+                double dPriority = vecPriority.front().get<0>();
+                CTxMemPool::txiter it = vecPriority.front().get<2>();
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                vecPriority.pop_back();
+
+                // Prioritise by fee once past the priority size or we run out of high-priority
+                // transactions (this one still gets its chance):
+                bool fLast = nBlockSize + it->GetTxSize() >= nBlockPrioritySize || !AllowFree(dPriority);
+
+                addPackage(std::vector<CTxMemPool::txiter>(1, it), dPriority);
+                if (fLast)
+                    break;
             }
+        }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
+        // Then by the fee rate of each transaction together with its
+        // unconfirmed ancestors, as kept in order by the mempool
+        if (fIncludeMempool) {
+            const CTxMemPool::indexed_transaction_set::nth_index<2>::type& byAncestorFee = mempool.mapTx.get<2>();
+            for (CTxMemPool::indexed_transaction_set::nth_index<2>::type::const_iterator mi = byAncestorFee.begin();
+                 mi != byAncestorFee.end(); ++mi)
             {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                if (setIncluded.count(it))
+                    continue;
+
+                CTxMemPool::setEntries setAncestors;
+                mempool.CalculateAncestors(it->GetTx(), setAncestors);
+                std::vector<CTxMemPool::txiter> vPackage;
+                uint64_t nPackageSize = it->GetTxSize();
+                CAmount nPackageFees = it->GetFee();
+                for (CTxMemPool::txiter ancestor : setAncestors) {
+                    if (!setIncluded.count(ancestor)) {
+                        vPackage.push_back(ancestor);
+                        nPackageSize += ancestor->GetTxSize();
+                        nPackageFees += ancestor->GetFee();
                     }
                 }
+                // An ancestor always has fewer ancestors of its own
+                std::sort(vPackage.begin(), vPackage.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+                    return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+                });
+                vPackage.push_back(it);
+
+                // Skip free transactions if we're past the minimum block size:
+                double dPriorityDelta = 0;
+                CAmount nFeeDelta = 0;
+                mempool.ApplyDeltas(it->GetTx().GetHash(), dPriorityDelta, nFeeDelta);
+                if ((dPriorityDelta <= 0) && (nFeeDelta <= 0) && (CFeeRate(nPackageFees, nPackageSize) < ::minRelayTxFee) && (nBlockSize + nPackageSize >= nBlockMinSize))
+                    continue;
+
+                addPackage(vPackage, it->GetPriority(nHeight) + dPriorityDelta);
             }
         }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
+        if (fIncludeMempool) {
+            nLastBlockTx = nBlockTx;
+            nLastBlockSize = nBlockSize;
+        }
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 
         // Create coinbase tx
@@ -539,6 +532,7 @@ void static BitcoinMiner(const CChainParams& chainparams)
 
     std::string solver = GetArg("-equihashsolver", "default");
     assert(solver == "tromp" || solver == "default");
+    unsigned int nSolverThreads = std::max((int64_t)1, GetArg("-equihashsolverthreads", DEFAULT_EQUIHASH_SOLVER_THREADS));
     LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
 
     std::mutex m_cs;
@@ -667,36 +661,11 @@ void static BitcoinMiner(const CChainParams& chainparams)
 
                 // TODO: factor this out into a function with the same API for each solver.
                 if (solver == "tromp") {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(&curr_state);
-
-                    // Initialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
-                    for (u32 r = 1; r < WK; r++) {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
-                    }
-                    eq.digitK(0);
+                    // If we find a valid block, we rebuild
+                    bool found = TrompSolve(curr_state, nSolverThreads, validBlock);
                     ehSolverRuns.increment();
-
-                    // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) {
-                        LogPrint("pow", "Checking solution %d\n", s+1);
-                        std::vector<eh_index> index_vector(PROOFSIZE);
-                        for (size_t i = 0; i < PROOFSIZE; i++) {
-                            index_vector[i] = eq.sols[s][i];
-                        }
-                        std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
-
-                        if (validBlock(sol_char)) {
-                            // If we find a POW solution, do not try other solutions
-                            // because they become invalid as we created a new block in blockchain.
-                            break;
-                        }
+                    if (found) {
+                        break;
                     }
                 } else {
                     try {
@@ -754,6 +723,57 @@ void static BitcoinMiner(const CChainParams& chainparams)
     c.disconnect();
 }
 
+bool TrompSolve(const crypto_generichash_blake2b_state& state, unsigned int nThreads,
+                std::function<bool(std::vector<unsigned char>)> validBlock)
+{
+    // Create solver and initialize it.
+    equi eq(nThreads);
+    eq.setstate(&state);
+
+    // Initialization done, start algo driver.
+    if (nThreads <= 1) {
+        eq.digit0(0);
+        eq.xfull = eq.bfull = eq.hfull = 0;
+        eq.showbsizes(0);
+        for (u32 r = 1; r < WK; r++) {
+            (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
+            eq.xfull = eq.bfull = eq.hfull = 0;
+            eq.showbsizes(r);
+        }
+        eq.digitK(0);
+    } else {
+        // The threads split every round's buckets between them, meeting at
+        // a barrier before the next round reads what this one wrote
+        std::vector<thread_ctx> threads(nThreads);
+        for (unsigned int t = 0; t < nThreads; t++) {
+            threads[t].id = t;
+            threads[t].eq = &eq;
+            int err = pthread_create(&threads[t].thread, NULL, worker, &threads[t]);
+            assert(err == 0);
+        }
+        for (unsigned int t = 0; t < nThreads; t++) {
+            pthread_join(threads[t].thread, NULL);
+        }
+    }
+
+    // Convert solution indices to byte array (decompress) and pass it to validBlock method.
+    for (size_t s = 0; s < eq.nsols; s++) {
+        LogPrint("pow", "Checking solution %d\n", s+1);
+        std::vector<eh_index> index_vector(PROOFSIZE);
+        for (size_t i = 0; i < PROOFSIZE; i++) {
+            index_vector[i] = eq.sols[s][i];
+        }
+        std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
+
+        if (validBlock(sol_char)) {
+            // If we find a POW solution, do not try other solutions
+            // because they become invalid as we created a new block in blockchain.
+            return true;
+        }
+    }
+    return false;
+}
+
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams)
 {
     static boost::thread_group* minerThreads = NULL;
@@ -8,8 +8,12 @@
 
 #include "primitives/block.h"
 
+#include "sodium.h"
+
 #include <boost/optional.hpp>
+#include <functional>
 #include <stdint.h>
+#include <vector>
 
 class CBlockIndex;
 class CChainParams;
@@ -23,16 +27,25 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
-/** Generate a new block, without valid proof-of-work */
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+/** Generate a new block, without valid proof-of-work, and with only the coinbase unless fIncludeMempool */
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn, bool fIncludeMempool = true);
 
 #ifdef ENABLE_MINING
+/** Default for -equihashsolverthreads, the threads sharing each tromp solve */
+static const int64_t DEFAULT_EQUIHASH_SOLVER_THREADS = 1;
+
 /** Get script for -mineraddress */
 void GetScriptForMinerAddress(boost::shared_ptr<CReserveScript> &script);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams);
+/**
+ * Run the tromp Equihash solver on the hash state, with nThreads threads
+ * sharing one solve, and pass the solutions to validBlock until it accepts one.
+ */
+bool TrompSolve(const crypto_generichash_blake2b_state& state, unsigned int nThreads,
+                std::function<bool(std::vector<unsigned char>)> validBlock);
 #endif
 
 void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -13,8 +13,12 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "memusage.h"
+#include "metrics.h"
+#include "netcompress.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "trace.h"
 #include "ui_interface.h"
 #include "crypto/common.h"
 
@@ -22,6 +26,10 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #include <boost/filesystem.hpp>
@@ -553,6 +561,8 @@ void CNode::copyStats(CNodeStats &stats)
     stats.nSendBytes = nSendBytes;
     stats.nRecvBytes = nRecvBytes;
     stats.fWhitelisted = fWhitelisted;
+    stats.fCompressSend = fCompressSend;
+    stats.fCompressRecv = fCompressRecv;
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -580,8 +590,13 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
-            vRecvMsg.back().complete())
+            vRecvMsg.back().complete()) {
             vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, nRecvVersion));
+            if (!vRecvBufferPool.empty()) {
+                vRecvMsg.back().vRecv.swap(vRecvBufferPool.back());
+                vRecvBufferPool.pop_back();
+            }
+        }
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -595,6 +610,11 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         if (handled < 0)
                 return false;
 
+        if (msg.in_data && msg.fCompressed && !fCompressRecv) {
+            LogPrint("net", "Unexpected compressed message from peer=%i, disconnecting\n", GetId());
+            return false;
+        }
+
         if (msg.in_data && msg.hdr.nMessageSize > MAX_PROTOCOL_MESSAGE_LENGTH) {
             LogPrint("net", "Oversized message from peer=%i, disconnecting\n", GetId());
             return false;
@@ -605,13 +625,27 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            messageHandlerCondition.notify_all();
         }
     }
 
     return true;
 }
 
+// requires LOCK(cs_vRecvMsg)
+void CNode::RecycleRecvBuffer(CNetMessage& msg)
+{
+    if (vRecvBufferPool.size() >= RECV_BUFFER_POOL_SIZE)
+        return;
+    CSerializeData vch;
+    msg.vRecv.swap(vch);
+    if (vch.capacity() > RECV_BUFFER_POOL_MAX_CAPACITY)
+        return;
+    vch.clear();
+    vRecvBufferPool.push_back(CSerializeData());
+    vRecvBufferPool.back().swap(vch);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -633,6 +667,10 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
         return -1;
     }
 
+    // the top bit of the size marks a compressed payload
+    fCompressed = (hdr.nMessageSize & NET_COMPRESSED_FLAG) != 0;
+    hdr.nMessageSize &= ~NET_COMPRESSED_FLAG;
+
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
             return -1;
@@ -648,12 +686,15 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    if (nDataPos == 0) {
+        // Size the buffer for the whole payload once, so it is never moved
+        // while the message arrives. ReceiveMsgBytes has already rejected
+        // oversized messages, and pages the peer has not filled yet are not
+        // committed while it waits.
+        vRecv.reserve(hdr.nMessageSize);
     }
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    vRecv.write(pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -667,26 +708,87 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+// requires LOCK(cs_vSend)
+void CNode::RecycleSendBuffer(CSerializeData& data)
+{
+    // Kept buffers count against -maxsendbuffer along with queued data, so
+    // an idle peer holds at most a quarter of its send budget
+    if (vSendBufferPool.size() >= SEND_BUFFER_POOL_SIZE ||
+        data.capacity() > SEND_BUFFER_POOL_MAX_CAPACITY ||
+        nSendBufferPoolSize + data.capacity() > SendBufferSize() / 4)
+        return;
+    data.clear();
+    nSendBufferPoolSize += data.capacity();
+    vSendBufferPool.push_back(CSerializeData());
+    vSendBufferPool.back().swap(data);
+}
+
+size_t CNode::GetBufferMemoryUsage()
+{
+    size_t nUsage = 0;
+    {
+        LOCK(cs_vSend);
+        nUsage += memusage::MallocUsage(ssSend.capacity()) + memusage::MallocUsage(nSendBufferPoolSize);
+        BOOST_FOREACH(const CSerializeData& data, vSendMsg)
+            nUsage += memusage::MallocUsage(data.capacity());
+    }
+    {
+        LOCK(cs_vRecvMsg);
+        BOOST_FOREACH(const CNetMessage& msg, vRecvMsg)
+            nUsage += memusage::MallocUsage(msg.hdrbuf.capacity()) + memusage::MallocUsage(msg.vRecv.capacity());
+        BOOST_FOREACH(const CSerializeData& data, vRecvBufferPool)
+            nUsage += memusage::MallocUsage(data.capacity());
+    }
+    return nUsage;
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert(it->size() > pnode->nSendOffset);
+        // Hand the kernel as many queued messages as one call takes
+        size_t nGathered = it->size() - pnode->nSendOffset;
+#ifdef WIN32
+        int nBytes = send(pnode->hSocket, &(*it)[pnode->nSendOffset], nGathered, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        struct iovec iov[MAX_SEND_IOVECS];
+        int nIov = 0;
+        iov[nIov].iov_base = &(*it)[pnode->nSendOffset];
+        iov[nIov++].iov_len = nGathered;
+        for (std::deque<CSerializeData>::iterator itNext = it + 1; itNext != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++itNext) {
+            iov[nIov].iov_base = &(*itNext)[0];
+            iov[nIov++].iov_len = itNext->size();
+            nGathered += itNext->size();
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Retire the messages that went out in full
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                size_t nRemaining = it->size() - pnode->nSendOffset;
+                if (nSent < nRemaining) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
+                pnode->RecycleSendBuffer(*it);
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nGathered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -971,6 +1073,263 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/** Owner recorded for a listening socket in the interest lists */
+static const NodeId LISTEN_SOCKET_OWNER = -1;
+
+/** What ThreadSocketHandler waits for on one socket */
+struct SocketInterest
+{
+    NodeId owner;  //!< the node using the socket, to tell reused descriptors apart
+    bool fRecv;
+    bool fSend;
+};
+
+/** Sockets to wait on, and the sockets found ready */
+struct SocketEvents
+{
+    std::map<SOCKET, SocketInterest> mapInterest;
+    std::set<SOCKET> setRecv;
+    std::set<SOCKET> setSend;
+    std::set<SOCKET> setError;
+};
+
+static void GenerateSocketInterest(SocketEvents& events)
+{
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        SocketInterest& interest = events.mapInterest[hListenSocket.socket];
+        interest.owner = LISTEN_SOCKET_OWNER;
+        interest.fRecv = true;
+        interest.fSend = false;
+    }
+
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes)
+    {
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        // Every socket is watched for errors, even if neither of the below
+        SocketInterest& interest = events.mapInterest[pnode->hSocket];
+        interest.owner = pnode->GetId();
+        interest.fRecv = false;
+        interest.fSend = false;
+
+        // Implement the following logic:
+        // * If there is data to send, select() for sending data. As this only
+        //   happens when optimistic write failed, we choose to first drain the
+        //   write buffer in this case before receiving more. This avoids
+        //   needlessly queueing received data, if the remote peer is not themselves
+        //   receiving data. This means properly utilizing TCP flow control signaling.
+        // * Otherwise, if there is no (complete) message in the receive buffer,
+        //   or there is space left in the buffer, select() for receiving data.
+        // * (if neither of the above applies, there is certainly one message
+        //   in the receiver buffer ready to be processed).
+        // Together, that means that at least one of the following is always possible,
+        // so we don't deadlock:
+        // * We send some data.
+        // * We wait for data to be received (and disconnect after timeout).
+        // * We process a message in the buffer (message handler thread).
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend && !pnode->vSendMsg.empty()) {
+                interest.fSend = true;
+                continue;
+            }
+        }
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv && (
+                pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                interest.fRecv = true;
+        }
+    }
+}
+
+/** Treat every socket as ready after a failed wait, so errors surface on recv() */
+static void SocketEventsFailed(SocketEvents& events, int64_t nTimeoutMillis)
+{
+    LogPrintf("socket select error %s\n", NetworkErrorString(WSAGetLastError()));
+    for (std::map<SOCKET, SocketInterest>::const_iterator it = events.mapInterest.begin(); it != events.mapInterest.end(); ++it)
+        events.setRecv.insert(it->first);
+    MilliSleep(nTimeoutMillis);
+}
+
+#ifdef USE_EPOLL
+/**
+ * The epoll set keeps what was registered, so only changes in interest cost
+ * a system call. Closing a descriptor drops it from the set, which is why
+ * the owner is kept: a new node that got an old node's descriptor number
+ * has to be registered afresh.
+ */
+static int hEpoll = -1;
+static std::map<SOCKET, SocketInterest> mapEpollRegistered;
+
+static uint32_t EpollEventMask(const SocketInterest& interest)
+{
+    return (interest.fRecv ? EPOLLIN : 0) | (interest.fSend ? EPOLLOUT : 0);
+}
+
+static bool EpollControl(int op, SOCKET hSocket, uint32_t nEvents)
+{
+    struct epoll_event event = {};
+    event.events = nEvents;
+    event.data.fd = hSocket;
+    if (epoll_ctl(hEpoll, op, hSocket, &event) == 0)
+        return true;
+    if (op == EPOLL_CTL_MOD && errno == ENOENT)
+        return epoll_ctl(hEpoll, EPOLL_CTL_ADD, hSocket, &event) == 0;
+    if (op == EPOLL_CTL_ADD && errno == EEXIST)
+        return epoll_ctl(hEpoll, EPOLL_CTL_MOD, hSocket, &event) == 0;
+    return false;
+}
+
+static bool WaitSocketEventsEpoll(SocketEvents& events, int64_t nTimeoutMillis)
+{
+    if (hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            LogPrintf("epoll_create1 failed, falling back to poll(): %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+    }
+
+    // Drop what is no longer wanted before registering anything, as a
+    // descriptor number may have moved to another node
+    for (std::map<SOCKET, SocketInterest>::iterator it = mapEpollRegistered.begin(); it != mapEpollRegistered.end(); ) {
+        if (events.mapInterest.count(it->first)) {
+            ++it;
+        } else {
+            epoll_ctl(hEpoll, EPOLL_CTL_DEL, it->first, NULL);
+            mapEpollRegistered.erase(it++);
+        }
+    }
+    for (std::map<SOCKET, SocketInterest>::const_iterator it = events.mapInterest.begin(); it != events.mapInterest.end(); ++it) {
+        std::map<SOCKET, SocketInterest>::iterator reg = mapEpollRegistered.find(it->first);
+        if (reg == mapEpollRegistered.end()) {
+            if (!EpollControl(EPOLL_CTL_ADD, it->first, EpollEventMask(it->second)))
+                continue;
+            mapEpollRegistered.insert(*it);
+        } else if (reg->second.owner != it->second.owner ||
+                   EpollEventMask(reg->second) != EpollEventMask(it->second)) {
+            if (!EpollControl(EPOLL_CTL_MOD, it->first, EpollEventMask(it->second))) {
+                mapEpollRegistered.erase(reg);
+                continue;
+            }
+            reg->second = it->second;
+        }
+    }
+
+    std::vector<struct epoll_event> vReady(std::max((size_t)1, events.mapInterest.size()));
+    int nReady = epoll_wait(hEpoll, &vReady[0], vReady.size(), nTimeoutMillis);
+    if (nReady == SOCKET_ERROR) {
+        if (WSAGetLastError() != WSAEINTR)
+            SocketEventsFailed(events, nTimeoutMillis);
+        return true;
+    }
+    for (int i = 0; i < nReady; i++) {
+        SOCKET hSocket = vReady[i].data.fd;
+        if (vReady[i].events & EPOLLIN)
+            events.setRecv.insert(hSocket);
+        if (vReady[i].events & EPOLLOUT)
+            events.setSend.insert(hSocket);
+        if (vReady[i].events & (EPOLLERR | EPOLLHUP))
+            events.setError.insert(hSocket);
+    }
+    return true;
+}
+#endif
+
+#ifdef USE_POLL
+static void WaitSocketEventsPoll(SocketEvents& events, int64_t nTimeoutMillis)
+{
+    std::vector<struct pollfd> vPollFds;
+    vPollFds.reserve(events.mapInterest.size());
+    for (std::map<SOCKET, SocketInterest>::const_iterator it = events.mapInterest.begin(); it != events.mapInterest.end(); ++it) {
+        struct pollfd pollfd = {};
+        pollfd.fd = it->first;
+        pollfd.events = (it->second.fRecv ? POLLIN : 0) | (it->second.fSend ? POLLOUT : 0);
+        vPollFds.push_back(pollfd);
+    }
+
+    if (vPollFds.empty()) {
+        MilliSleep(nTimeoutMillis);
+        return;
+    }
+    if (poll(&vPollFds[0], vPollFds.size(), nTimeoutMillis) == SOCKET_ERROR) {
+        if (WSAGetLastError() != WSAEINTR)
+            SocketEventsFailed(events, nTimeoutMillis);
+        return;
+    }
+    BOOST_FOREACH(const struct pollfd& pollfd, vPollFds) {
+        if (pollfd.revents & POLLIN)
+            events.setRecv.insert(pollfd.fd);
+        if (pollfd.revents & POLLOUT)
+            events.setSend.insert(pollfd.fd);
+        if (pollfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+            events.setError.insert(pollfd.fd);
+    }
+}
+#else
+static void WaitSocketEventsSelect(SocketEvents& events, int64_t nTimeoutMillis)
+{
+    struct timeval timeout = MillisToTimeval(nTimeoutMillis);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    for (std::map<SOCKET, SocketInterest>::const_iterator it = events.mapInterest.begin(); it != events.mapInterest.end(); ++it) {
+        if (it->second.owner != LISTEN_SOCKET_OWNER)
+            FD_SET(it->first, &fdsetError);
+        if (it->second.fRecv)
+            FD_SET(it->first, &fdsetRecv);
+        if (it->second.fSend)
+            FD_SET(it->first, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, it->first);
+    }
+
+    bool have_fds = !events.mapInterest.empty();
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+            SocketEventsFailed(events, nTimeoutMillis);
+        else
+            MilliSleep(nTimeoutMillis);
+        return;
+    }
+    for (std::map<SOCKET, SocketInterest>::const_iterator it = events.mapInterest.begin(); it != events.mapInterest.end(); ++it) {
+        if (FD_ISSET(it->first, &fdsetRecv))
+            events.setRecv.insert(it->first);
+        if (FD_ISSET(it->first, &fdsetSend))
+            events.setSend.insert(it->first);
+        if (FD_ISSET(it->first, &fdsetError))
+            events.setError.insert(it->first);
+    }
+}
+#endif
+
+/** Wait up to nTimeoutMillis for any of the sockets of interest to be ready */
+static void WaitSocketEvents(SocketEvents& events, int64_t nTimeoutMillis)
+{
+#ifdef USE_EPOLL
+    static bool fEpoll = true;
+    if (fEpoll && WaitSocketEventsEpoll(events, nTimeoutMillis))
+        return;
+    fEpoll = false;
+#endif
+#ifdef USE_POLL
+    WaitSocketEventsPoll(events, nTimeoutMillis);
+#else
+    WaitSocketEventsSelect(events, nTimeoutMillis);
+#endif
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1042,91 +1401,17 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signaling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        SocketEvents events;
+        GenerateSocketInterest(events);
+        WaitSocketEvents(events, 50); // frequency to poll pnode->vSend
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && events.setRecv.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1151,7 +1436,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (events.setRecv.count(pnode->hSocket) || events.setError.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1195,7 +1480,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (events.setSend.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -1522,7 +1807,12 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+/**
+ * Handle the messages of the nodes whose ids fall in this thread's shard, so
+ * one slow peer only holds up the others sharing its thread. Messages that
+ * must not run concurrently are serialised in ProcessMessages.
+ */
+void ThreadMessageHandler(int nShard, int nShards)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1533,8 +1823,10 @@ void ThreadMessageHandler()
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->GetId() % nShards != nShard)
+                    continue;
+                vNodesCopy.push_back(pnode);
                 pnode->AddRef();
             }
         }
@@ -1788,10 +2080,15 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMessageHandlerThreads = GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
+    nMessageHandlerThreads = std::max(1, std::min(nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand",
+            boost::function<void()>(boost::bind(&ThreadMessageHandler, i, nMessageHandlerThreads))));
+    }
 
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL, CScheduler::PRIORITY_NORMAL, "dumpaddresses");
 }
 
 bool StopNode()
@@ -1878,6 +2175,7 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
+    int nPeers = 0;
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
         if(!pnode->fRelayTxes)
@@ -1885,11 +2183,13 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         LOCK(pnode->cs_filter);
         if (pnode->pfilter)
         {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx))
-                pnode->PushInventory(inv);
-        } else
-            pnode->PushInventory(inv);
+            if (!pnode->pfilter->IsRelevantAndUpdate(tx))
+                continue;
+        }
+        pnode->PushInventory(inv);
+        nPeers++;
     }
+    TRACE3(net, relay_transaction, inv.hash.begin(), ss.size(), nPeers);
 }
 
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
@@ -2036,13 +2336,14 @@ bool CAddrDB::Read(CAddrMan& addr)
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    // read data and checksum from file straight into the stream it is parsed from
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers.resize(dataSize);
     uint256 hashIn;
 
-    // read data and checksum from file
     try {
-        filein.read((char *)&vchData[0], dataSize);
+        if (dataSize > 0)
+            filein.read((char *)&ssPeers[0], dataSize);
         filein >> hashIn;
     }
     catch (const std::exception& e) {
@@ -2050,8 +2351,6 @@ bool CAddrDB::Read(CAddrMan& addr)
     }
     filein.fclose();
 
-    CDataStream ssPeers(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
     uint256 hashTmp = Hash(ssPeers.begin(), ssPeers.end());
     if (hashIn != hashTmp)
@@ -2079,10 +2378,14 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds) {
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     addrKnown(5000, 0.001),
-    setInventoryKnown(SendBufferSize() / 1000)
+    filterInventoryKnown(50000, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2107,15 +2410,19 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendBufferPoolSize = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
     fSentAddr = false;
+    fCompressSend = false;
+    fCompressRecv = false;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
     nPingUsecTime = 0;
+    nNextInvSend = 0;
     fPingQueued = false;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
 
@@ -2216,9 +2523,25 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
+    // Compress the payload for a peer that asked for it, when that makes it smaller
     unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+    unsigned int nSizeField = nSize;
+    if (fCompressSend && nSize >= NET_COMPRESSION_MIN_SIZE) {
+        std::vector<char> vchCompressed;
+        if (CompressPayload(&ssSend[CMessageHeader::HEADER_SIZE], nSize, vchCompressed)) {
+            ssSend.resize(CMessageHeader::HEADER_SIZE);
+            ssSend.write(vchCompressed.data(), vchCompressed.size());
+            nSize = vchCompressed.size();
+            nSizeField = nSize | NET_COMPRESSED_FLAG;
+        }
+    }
+
+    // Set the size
+    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSizeField);
+
+    const char* pchCommand = &ssSend[MESSAGE_START_SIZE];
+    RecordMessageBytes(std::string(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE)), ssSend.size(), true);
+    TRACE3(net, outbound_message, id, pchCommand, nSize);
 
     // Set the checksum
     uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
@@ -2229,9 +2552,17 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
+    // Queue the serialized message by handing over ssSend's buffer rather
+    // than copying it, and serialize the next message into a kept buffer
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
+    ssSend.Compact();
+    ssSend.swap(*it);
     nSendSize += (*it).size();
+    if (!vSendBufferPool.empty()) {
+        nSendBufferPoolSize -= vSendBufferPool.back().capacity();
+        ssSend.swap(vSendBufferPool.back());
+        vSendBufferPool.pop_back();
+    }
 
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
@@ -10,7 +10,6 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -19,6 +18,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -49,6 +49,16 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1024 * 1024;
+/** Number of spent receive buffers a connection keeps for reuse by later messages */
+static const size_t RECV_BUFFER_POOL_SIZE = 4;
+/** Receive buffers with a larger capacity than this are freed instead of kept for reuse */
+static const size_t RECV_BUFFER_POOL_MAX_CAPACITY = 256 * 1024;
+/** Maximum number of queued messages handed to the kernel in one sendmsg() call */
+static const int MAX_SEND_IOVECS = 64;
+/** Number of sent message buffers a connection keeps for serializing later messages into */
+static const size_t SEND_BUFFER_POOL_SIZE = 4;
+/** Sent message buffers with a larger capacity than this are freed instead of kept for reuse */
+static const size_t SEND_BUFFER_POOL_MAX_CAPACITY = 256 * 1024;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -listen default */
@@ -59,12 +69,18 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** Default for -msghandlerthreads, the threads peers' messages are spread over */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 2;
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
 static const int NETWORK_UPGRADE_PEER_PREFERENCE_BLOCK_PERIOD = 24 * 24 * 3;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
+
 void AddOneShot(const std::string& strDest);
 void AddressCurrentlyConnected(const CService& addr);
 CNode* FindNode(const CNetAddr& ip);
@@ -186,6 +202,8 @@ public:
     uint64_t nSendBytes;
     uint64_t nRecvBytes;
     bool fWhitelisted;
+    bool fCompressSend;
+    bool fCompressRecv;
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
@@ -201,6 +219,7 @@ public:
     CDataStream hdrbuf;             // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
+    bool fCompressed;               // payload compressed, flag taken out of hdr.nMessageSize
 
     CDataStream vRecv;              // received message data
     unsigned int nDataPos;
@@ -211,6 +230,7 @@ public:
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
+        fCompressed = false;
         nDataPos = 0;
         nTime = 0;
     }
@@ -248,10 +268,15 @@ public:
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
+    //! Buffers of sent messages, reused by ssSend for the next messages
+    std::vector<CSerializeData> vSendBufferPool;
+    size_t nSendBufferPoolSize; // total capacity of all vSendBufferPool entries
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
+    //! Payload buffers of processed messages, reused by the next messages received
+    std::vector<CSerializeData> vRecvBufferPool;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
@@ -288,6 +313,10 @@ public:
     // For such cases node should be released manually (preferably right after corresponding code).
     bool fObfuScationMaster;
     bool fSentAddr;
+    //! Compress the payloads we send, once a whitelisted peer asked for it
+    std::atomic<bool> fCompressSend;
+    //! Accept compressed payloads, once we told a whitelisted peer so
+    std::atomic<bool> fCompressRecv;
     CSemaphoreGrant grantOutbound;
     CCriticalSection cs_filter;
     CBloomFilter* pfilter;
@@ -315,15 +344,20 @@ public:
     int nStartingHeight;
 
     // flood relay
+    //! Address relay is queued by other peers' handlers, so it has a lock of its own
+    CCriticalSection cs_vAddrToSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    //! Hashes of inventory this peer is known to have, keyed by inv.hash
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
+    //! When queued transaction inventory is next flushed to this peer (in microseconds)
+    int64_t nNextInvSend;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
 
@@ -376,6 +410,17 @@ public:
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    // Return the payload buffer of a processed message to the pool
+    void RecycleRecvBuffer(CNetMessage& msg);
+
+    // requires LOCK(cs_vSend)
+    // Return the buffer of a message sent in full to the pool
+    void RecycleSendBuffer(CSerializeData& data);
+
+    // Estimated heap usage of the send and receive buffers, queued or pooled
+    size_t GetBufferMemoryUsage();
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -399,11 +444,13 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -421,7 +468,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -429,7 +476,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.hash))
                 vInventoryToSend.push_back(inv);
         }
     }
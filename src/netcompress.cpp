@@ -0,0 +1,145 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "netcompress.h"
+
+#include "crypto/common.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xffff;
+const int HASH_BITS = 12;
+
+inline uint32_t HashBytes(const char* pch)
+{
+    return (ReadLE32((const unsigned char*)pch) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+void WriteLength(std::vector<char>& vch, size_t nLength)
+{
+    while (nLength >= 255) {
+        vch.push_back((char)255);
+        nLength -= 255;
+    }
+    vch.push_back((char)nLength);
+}
+
+void WriteSequence(std::vector<char>& vch, const char* pchLiterals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    size_t nMatchCode = nMatch ? nMatch - MIN_MATCH : 0;
+    vch.push_back((char)((std::min<size_t>(nLiterals, 15) << 4) | std::min<size_t>(nMatchCode, 15)));
+    if (nLiterals >= 15)
+        WriteLength(vch, nLiterals - 15);
+    vch.insert(vch.end(), pchLiterals, pchLiterals + nLiterals);
+    if (nMatch == 0)
+        return;
+    vch.push_back((char)(nOffset & 0xff));
+    vch.push_back((char)(nOffset >> 8));
+    if (nMatchCode >= 15)
+        WriteLength(vch, nMatchCode - 15);
+}
+
+/** Read a length continued in bytes of up to 255, failing past nLimit */
+bool ReadLength(const unsigned char*& p, const unsigned char* pEnd, size_t& nLength, size_t nLimit)
+{
+    unsigned char c;
+    do {
+        if (p == pEnd)
+            return false;
+        c = *p++;
+        nLength += c;
+        if (nLength > nLimit)
+            return false;
+    } while (c == 255);
+    return true;
+}
+
+} // anon namespace
+
+bool CompressPayload(const char* pch, size_t nSize, std::vector<char>& vchOut)
+{
+    vchOut.clear();
+    if (nSize > 0xffffffff)
+        return false;
+    vchOut.reserve(nSize);
+    vchOut.resize(4);
+    WriteLE32((unsigned char*)&vchOut[0], nSize);
+
+    // Positions plus one, so that zero is an empty slot
+    std::vector<uint32_t> vTable(1 << HASH_BITS, 0);
+    size_t nPos = 0, nAnchor = 0;
+    while (nPos + MIN_MATCH <= nSize) {
+        uint32_t& nSlot = vTable[HashBytes(pch + nPos)];
+        size_t nRef = nSlot;
+        nSlot = nPos + 1;
+        if (nRef == 0 || nPos - (nRef - 1) > MAX_OFFSET || memcmp(pch + nRef - 1, pch + nPos, MIN_MATCH) != 0) {
+            nPos++;
+            continue;
+        }
+        nRef--;
+        size_t nMatch = MIN_MATCH;
+        while (nPos + nMatch < nSize && pch[nRef + nMatch] == pch[nPos + nMatch])
+            nMatch++;
+        WriteSequence(vchOut, pch + nAnchor, nPos - nAnchor, nPos - nRef, nMatch);
+        nPos += nMatch;
+        nAnchor = nPos;
+        if (vchOut.size() >= nSize)
+            return false;
+    }
+    WriteSequence(vchOut, pch + nAnchor, nSize - nAnchor, 0, 0);
+    return vchOut.size() < nSize;
+}
+
+bool DecompressPayload(const char* pch, size_t nSize, CSerializeData& vchOut, size_t nMaxSize)
+{
+    vchOut.clear();
+    if (nSize < 4)
+        return false;
+    const unsigned char* p = (const unsigned char*)pch;
+    const unsigned char* pEnd = p + nSize;
+    size_t nOutSize = ReadLE32(p);
+    p += 4;
+    if (nOutSize > nMaxSize)
+        return false;
+    vchOut.resize(nOutSize);
+
+    size_t nPos = 0;
+    while (true) {
+        if (p == pEnd)
+            return false;
+        unsigned char nToken = *p++;
+        size_t nLiterals = nToken >> 4;
+        if (nLiterals == 15 && !ReadLength(p, pEnd, nLiterals, nOutSize))
+            return false;
+        if (nLiterals > (size_t)(pEnd - p) || nLiterals > nOutSize - nPos)
+            return false;
+        if (nLiterals)
+            memcpy(&vchOut[nPos], p, nLiterals);
+        p += nLiterals;
+        nPos += nLiterals;
+        if (p == pEnd)
+            break;
+
+        if (pEnd - p < 2)
+            return false;
+        size_t nOffset = p[0] | (p[1] << 8);
+        p += 2;
+        if (nOffset == 0 || nOffset > nPos)
+            return false;
+        size_t nMatch = nToken & 15;
+        if (nMatch == 15 && !ReadLength(p, pEnd, nMatch, nOutSize))
+            return false;
+        nMatch += MIN_MATCH;
+        if (nMatch > nOutSize - nPos)
+            return false;
+        // Byte by byte, as the match may overlap what it copies
+        for (size_t i = 0; i < nMatch; i++, nPos++)
+            vchOut[nPos] = vchOut[nPos - nOffset];
+    }
+    return nPos == nOutSize;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_NETCOMPRESS_H
+#define BITCOIN_NETCOMPRESS_H
+
+#include "support/allocators/zeroafterfree.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** Default for -p2pcompression, compressing messages to and from whitelisted peers */
+static const bool DEFAULT_P2P_COMPRESSION = false;
+/** The only compression method so far, announced in the "compress" message */
+static const uint8_t NET_COMPRESSION_LZ = 1;
+/** Payloads smaller than this are always sent as they are */
+static const size_t NET_COMPRESSION_MIN_SIZE = 64;
+/** Set in a message header's size field when the payload is compressed */
+static const uint32_t NET_COMPRESSED_FLAG = 0x80000000;
+
+/**
+ * Compress a message payload with a byte-oriented LZ77 scheme: the original
+ * size as 4 bytes little endian, then sequences of a token (literal count in
+ * the high nibble, match length less 4 in the low one, 15 meaning more
+ * follow in bytes of up to 255), the literals, and a 2 byte match offset.
+ * The last sequence has literals only.
+ *
+ * @return false when the result would be no smaller than the input
+ */
+bool CompressPayload(const char* pch, size_t nSize, std::vector<char>& vchOut);
+
+/**
+ * Expand a payload written by CompressPayload, checking every length and
+ * offset against the input and against nMaxSize.
+ *
+ * @return false if the payload is malformed or would expand beyond nMaxSize
+ */
+bool DecompressPayload(const char* pch, size_t nSize, CSerializeData& vchOut, size_t nMaxSize);
+
+#endif // BITCOIN_NETCOMPRESS_H
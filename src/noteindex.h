@@ -0,0 +1,119 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_NOTEINDEX_H
+#define BITCOIN_NOTEINDEX_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+/**
+ * Key of the shielded explorer indexes: a nullifier or a note commitment
+ * of one of the shielded pools (type is a ShieldedType).
+ */
+struct CNoteIndexKey {
+    unsigned int type;
+    uint256 hash;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 33;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hash.Serialize(s);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        type = ser_readdata8(s);
+        hash.Unserialize(s);
+    }
+
+    CNoteIndexKey(unsigned int shieldedType, const uint256& hashIn) {
+        type = shieldedType;
+        hash = hashIn;
+    }
+
+    CNoteIndexKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        type = 0;
+        hash.SetNull();
+    }
+};
+
+/** Where a nullifier was revealed */
+struct CNullifierIndexValue {
+    uint256 txid;
+    //! Index of the Sapling spend or Sprout JoinSplit within the transaction
+    unsigned int index;
+    int blockHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(index);
+        READWRITE(blockHeight);
+    }
+
+    CNullifierIndexValue(const uint256& t, unsigned int i, int h) {
+        txid = t;
+        index = i;
+        blockHeight = h;
+    }
+
+    CNullifierIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        index = 0;
+        blockHeight = 0;
+    }
+};
+
+/** Where a note commitment was added to its pool's tree */
+struct CCommitmentIndexValue {
+    uint256 txid;
+    //! Index of the Sapling output or Sprout JoinSplit within the transaction
+    unsigned int index;
+    int blockHeight;
+    //! Leaf position in the note commitment tree
+    uint64_t position;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(index);
+        READWRITE(blockHeight);
+        READWRITE(position);
+    }
+
+    CCommitmentIndexValue(const uint256& t, unsigned int i, int h, uint64_t p) {
+        txid = t;
+        index = i;
+        blockHeight = h;
+        position = p;
+    }
+
+    CCommitmentIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        index = 0;
+        blockHeight = 0;
+        position = 0;
+    }
+};
+
+#endif // BITCOIN_NOTEINDEX_H
@@ -0,0 +1,217 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "notificationpublisher.h"
+
+#include "blockcache.h"
+#include "chainparams.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <algorithm>
+#include <atomic>
+
+static std::atomic<uint64_t> nNotificationsDropped(0);
+
+namespace {
+
+/**
+ * The payloads published last, so that the notifiers of every interface
+ * share one serialization of a block or transaction.
+ */
+class CPayloadCache
+{
+private:
+    boost::mutex mutex;
+    size_t nMaxEntries;
+    std::deque<std::pair<uint256, CNotificationPayload> > entries;
+
+public:
+    explicit CPayloadCache(size_t nMaxEntriesIn) : nMaxEntries(nMaxEntriesIn) {}
+
+    CNotificationPayload Get(const uint256& hash)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (size_t i = entries.size(); i-- > 0; ) {
+            if (entries[i].first == hash)
+                return entries[i].second;
+        }
+        return CNotificationPayload();
+    }
+
+    void Add(const uint256& hash, const CNotificationPayload& payload)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        entries.push_back(std::make_pair(hash, payload));
+        if (entries.size() > nMaxEntries)
+            entries.pop_front();
+    }
+};
+
+CPayloadCache blockPayloads(2);
+CPayloadCache transactionPayloads(64);
+
+template <typename T>
+CNotificationPayload Serialize(const T& obj)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << obj;
+    return std::make_shared<const std::vector<char> >(ss.begin(), ss.end());
+}
+
+} // anon namespace
+
+CNotificationPayload GetBlockPayload(const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    std::shared_ptr<const CRecentBlock> pcached = recentBlocks.Get(hash);
+    if (pcached)
+        return CNotificationPayload(pcached, &pcached->vchBlock);
+
+    CNotificationPayload payload = blockPayloads.Get(hash);
+    if (payload)
+        return payload;
+
+    CBlock block;
+    {
+        LOCK(cs_main);
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+            return CNotificationPayload();
+    }
+    payload = Serialize(block);
+    blockPayloads.Add(hash, payload);
+    return payload;
+}
+
+CNotificationPayload GetBlockPayload(const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    CNotificationPayload payload = blockPayloads.Get(hash);
+    if (!payload) {
+        payload = Serialize(block);
+        blockPayloads.Add(hash, payload);
+    }
+    return payload;
+}
+
+CNotificationPayload GetTransactionPayload(const CTransaction& tx)
+{
+    CNotificationPayload payload = transactionPayloads.Get(tx.GetHash());
+    if (!payload) {
+        payload = Serialize(tx);
+        transactionPayloads.Add(tx.GetHash(), payload);
+    }
+    return payload;
+}
+
+uint64_t GetNotificationsDropped()
+{
+    return nNotificationsDropped.load();
+}
+
+CNotificationPublisher::CNotificationPublisher(const std::string& strNameIn) :
+    strName(strNameIn), nHighWaterMark(DEFAULT_NOTIFICATION_HWM), fRunning(false), fStopping(false),
+    nPendingDrops(0), nDropped(0), nLastDropLog(0)
+{
+}
+
+CNotificationPublisher::~CNotificationPublisher()
+{
+    Stop();
+}
+
+void CNotificationPublisher::Start(size_t nHighWaterMarkIn)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning)
+        return;
+    nHighWaterMark = std::max<size_t>(1, nHighWaterMarkIn);
+    fRunning = true;
+    fStopping = false;
+    thread = boost::thread(&CNotificationPublisher::ThreadMain, this);
+}
+
+void CNotificationPublisher::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStopping = true;
+    }
+    condWork.notify_all();
+    thread.join();
+}
+
+bool CNotificationPublisher::Push(const Message& func, bool fDroppable)
+{
+    unsigned int nDroppedBefore = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fRunning && fDroppable && queue.size() >= nHighWaterMark) {
+            nPendingDrops++;
+            nDropped++;
+            nNotificationsDropped++;
+            int64_t nNow = GetTime();
+            if (nNow - nLastDropLog >= 60) {
+                nLastDropLog = nNow;
+                LogPrintf("%s notifications: %u messages queued, dropping notifications (%d dropped since startup)\n",
+                          strName, queue.size(), nDropped);
+            }
+            return false;
+        }
+        if (fDroppable) {
+            nDroppedBefore = nPendingDrops;
+            nPendingDrops = 0;
+        }
+        if (fRunning) {
+            queue.push_back(std::make_pair(func, nDroppedBefore));
+            condWork.notify_one();
+            return true;
+        }
+    }
+    func(nDroppedBefore);
+    return true;
+}
+
+size_t CNotificationPublisher::Depth()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queue.size();
+}
+
+uint64_t CNotificationPublisher::GetDropped()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nDropped;
+}
+
+void CNotificationPublisher::ThreadMain()
+{
+    RenameThread(("zero-" + strName).c_str());
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (queue.empty() && !fStopping)
+            condWork.wait(lock);
+        if (queue.empty()) {
+            // Whatever is pushed from now on is sent by the pushing thread
+            fRunning = false;
+            break;
+        }
+        std::pair<Message, unsigned int> message = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        try {
+            message.first(message.second);
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "CNotificationPublisher");
+        } catch (...) {
+            PrintExceptionContinue(NULL, "CNotificationPublisher");
+        }
+        lock.lock();
+    }
+}
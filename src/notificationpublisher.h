@@ -0,0 +1,83 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_NOTIFICATIONPUBLISHER_H
+#define BITCOIN_NOTIFICATIONPUBLISHER_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CBlock;
+class CBlockIndex;
+class CTransaction;
+
+/** -notificationhwm default */
+static const unsigned int DEFAULT_NOTIFICATION_HWM = 1000;
+
+/** A serialized block or transaction, shared by every notifier publishing it */
+typedef std::shared_ptr<const std::vector<char> > CNotificationPayload;
+
+/** The block from the recent block cache, or read from disk; NULL if it cannot be read */
+CNotificationPayload GetBlockPayload(const CBlockIndex* pindex);
+CNotificationPayload GetBlockPayload(const CBlock& block);
+CNotificationPayload GetTransactionPayload(const CTransaction& tx);
+
+/**
+ * Sends the messages of a notification interface from a thread of its own,
+ * in the order they were pushed, so that a slow subscriber or broker holds
+ * up neither validation nor the other listeners.
+ *
+ * Droppable messages are thrown away while more than the high-water mark
+ * is queued. The next droppable message that is queued is told how many
+ * were dropped before it, so that notifiers can leave a gap in their
+ * sequence numbers.
+ */
+class CNotificationPublisher
+{
+public:
+    //! Called with the number of messages dropped just before this one
+    typedef std::function<void(unsigned int nDropped)> Message;
+
+    explicit CNotificationPublisher(const std::string& strNameIn);
+    ~CNotificationPublisher();
+
+    void Start(size_t nHighWaterMarkIn);
+    /** Send what is queued, then stop the thread */
+    void Stop();
+
+    /** Queue a message, or send it now if the thread is not running; false if it was dropped */
+    bool Push(const Message& func, bool fDroppable = true);
+    size_t Depth();
+    uint64_t GetDropped();
+
+private:
+    std::string strName;
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    std::deque<std::pair<Message, unsigned int> > queue;
+    boost::thread thread;
+    size_t nHighWaterMark;
+    bool fRunning;
+    bool fStopping;
+    //! Dropped since the last droppable message was queued
+    unsigned int nPendingDrops;
+    uint64_t nDropped;
+    int64_t nLastDropLog;
+
+    void ThreadMain();
+};
+
+/** Messages dropped by every publisher since startup */
+uint64_t GetNotificationsDropped();
+
+#endif // BITCOIN_NOTIFICATIONPUBLISHER_H
@@ -0,0 +1,112 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "perfstats.h"
+
+#include <algorithm>
+#include <assert.h>
+
+const int CTimingHistogram::NUM_BUCKETS;
+
+static int BucketOf(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < CTimingHistogram::NUM_BUCKETS - 1 && (nMicros >> (nBucket + 1)) > 0)
+        nBucket++;
+    return nBucket;
+}
+
+void CTimingHistogram::Add(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0; // the clock went backwards
+    vBuckets[BucketOf(nMicros)].fetch_add(1, std::memory_order_relaxed);
+    nSum.fetch_add(nMicros, std::memory_order_relaxed);
+    int64_t nPrevMax = nMax.load(std::memory_order_relaxed);
+    while (nPrevMax < nMicros && !nMax.compare_exchange_weak(nPrevMax, nMicros, std::memory_order_relaxed)) {}
+    nCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CTimingHistogram::Reset()
+{
+    nCount = 0;
+    nSum = 0;
+    nMax = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        vBuckets[i] = 0;
+}
+
+CTimingHistogram::Summary CTimingHistogram::GetSummary() const
+{
+    uint64_t vCounts[NUM_BUCKETS];
+    uint64_t nTotal = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        vCounts[i] = vBuckets[i].load(std::memory_order_relaxed);
+        nTotal += vCounts[i];
+    }
+
+    Summary summary;
+    summary.nCount = nTotal;
+    summary.nSum = nSum.load(std::memory_order_relaxed);
+    summary.nMax = nMax.load(std::memory_order_relaxed);
+
+    double* vPercentiles[] = {&summary.p50, &summary.p90, &summary.p99};
+    const double vFractions[] = {0.5, 0.9, 0.99};
+    for (int p = 0; p < 3; p++) {
+        *vPercentiles[p] = 0;
+        if (nTotal == 0)
+            continue;
+        // Interpolate linearly within the bucket holding the rank
+        double dRank = vFractions[p] * nTotal;
+        uint64_t nBelow = 0;
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            if (vCounts[i] == 0 || nBelow + vCounts[i] < dRank) {
+                nBelow += vCounts[i];
+                continue;
+            }
+            double dLow = i == 0 ? 0 : (double)((int64_t)1 << i);
+            double dHigh = (double)((int64_t)1 << (i + 1));
+            double dValue = dLow + (dHigh - dLow) * (dRank - nBelow) / vCounts[i];
+            *vPercentiles[p] = std::min(dValue, (double)summary.nMax);
+            break;
+        }
+    }
+    return summary;
+}
+
+static CTimingHistogram perfStats[PERF_STAT_COUNT];
+
+static const char* const perfStatNames[PERF_STAT_COUNT] = {
+    "connecttip",
+    "readblock",
+    "connectblock",
+    "connecttransactions",
+    "verify",
+    "index",
+    "callbacks",
+    "flush",
+    "writechainstate",
+    "postprocess",
+    "mempoolaccept",
+    "sproutproof",
+    "saplingproofs",
+};
+
+CTimingHistogram& GetPerfStat(PerfStat stat)
+{
+    assert(stat >= 0 && stat < PERF_STAT_COUNT);
+    return perfStats[stat];
+}
+
+const char* GetPerfStatName(PerfStat stat)
+{
+    assert(stat >= 0 && stat < PERF_STAT_COUNT);
+    return perfStatNames[stat];
+}
+
+void ResetPerfStats()
+{
+    for (int i = 0; i < PERF_STAT_COUNT; i++)
+        perfStats[i].Reset();
+}
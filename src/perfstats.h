@@ -0,0 +1,91 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_PERFSTATS_H
+#define BITCOIN_PERFSTATS_H
+
+#include "utiltime.h"
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Histogram of durations in microseconds, which any thread can add to
+ * without taking a lock. Bucket 0 holds durations below 2us and bucket i
+ * the ones in [2^i, 2^(i+1)), so percentiles are interpolated within a
+ * factor of two.
+ */
+class CTimingHistogram
+{
+public:
+    static const int NUM_BUCKETS = 40;
+
+    struct Summary {
+        uint64_t nCount;
+        int64_t nSum;
+        int64_t nMax;
+        double p50;
+        double p90;
+        double p99;
+    };
+
+    CTimingHistogram() { Reset(); }
+
+    void Add(int64_t nMicros);
+    void Reset();
+
+    /** Counts that are added while the summary is taken may be partly reflected */
+    Summary GetSummary() const;
+
+    /** The number of durations in bucket i, see above */
+    uint64_t GetBucketCount(int i) const { return vBuckets[i].load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> nCount;
+    std::atomic<int64_t> nSum;
+    std::atomic<int64_t> nMax;
+    std::atomic<uint64_t> vBuckets[NUM_BUCKETS];
+};
+
+/** The validation timings collected in the background, see getperfstats */
+enum PerfStat {
+    PERF_CONNECT_TIP,           //!< connecting a block to the tip, in total
+    PERF_CONNECT_READ_BLOCK,    //!< loading the block from disk
+    PERF_CONNECT_BLOCK,         //!< ConnectBlock()
+    PERF_CONNECT_TRANSACTIONS,  //!< ConnectBlock(): applying the transactions
+    PERF_CONNECT_VERIFY,        //!< ConnectBlock(): up to the script and proof checks completing
+    PERF_CONNECT_INDEX,         //!< ConnectBlock(): undo data and index writes
+    PERF_CONNECT_CALLBACKS,     //!< ConnectBlock(): validation interface callbacks
+    PERF_CONNECT_FLUSH,         //!< flushing the block's coins to the coins cache
+    PERF_CONNECT_CHAINSTATE,    //!< writing the chainstate when needed
+    PERF_CONNECT_POSTPROCESS,   //!< mempool and wallet updates after connecting
+    PERF_MEMPOOL_ACCEPT,        //!< AcceptToMemoryPool(), accepted or not
+    PERF_SPROUT_PROOF,          //!< verifying one JoinSplit proof
+    PERF_SAPLING_PROOFS,        //!< verifying the Sapling proofs and signatures of one transaction
+    PERF_STAT_COUNT
+};
+
+CTimingHistogram& GetPerfStat(PerfStat stat);
+const char* GetPerfStatName(PerfStat stat);
+void ResetPerfStats();
+
+inline void RecordPerfStat(PerfStat stat, int64_t nMicros)
+{
+    GetPerfStat(stat).Add(nMicros);
+}
+
+/** Records the time until it goes out of scope */
+class CPerfStatTimer
+{
+public:
+    explicit CPerfStatTimer(PerfStat stat) : histogram(GetPerfStat(stat)), nTimeStart(GetTimeMicros()) {}
+    explicit CPerfStatTimer(CTimingHistogram& histogramIn) : histogram(histogramIn), nTimeStart(GetTimeMicros()) {}
+    ~CPerfStatTimer() { histogram.Add(GetTimeMicros() - nTimeStart); }
+
+private:
+    CTimingHistogram& histogram;
+    int64_t nTimeStart;
+};
+
+#endif // BITCOIN_PERFSTATS_H
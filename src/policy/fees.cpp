@@ -11,11 +11,15 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+#include <cmath>
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
-                                unsigned int maxConfirms, double _decay, std::string _dataTypeString)
+                                unsigned int _maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
     dataTypeString = _dataTypeString;
+    maxConfirms = _maxConfirms;
 
     buckets.insert(buckets.end(), defaultBuckets.begin(), defaultBuckets.end());
     buckets.push_back(std::numeric_limits<double>::infinity());
@@ -24,33 +28,60 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
         bucketMap[buckets[i]] = i;
     }
 
-    confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
-    }
+    confAvg.assign(buckets.size() * maxConfirms, 0);
+    txCtAvg.assign(buckets.size(), 0);
+    avg.assign(buckets.size(), 0);
+    unconfTxs.assign(buckets.size() * maxConfirms, 0);
+    oldUnconfTxs.assign(buckets.size(), 0);
+    Resize(buckets.size());
+}
+
+// Size the data that is not saved: the current block and the decay stamps
+void TxConfirmStats::Resize(size_t numBuckets)
+{
+    curBlockConf.assign(numBuckets * maxConfirms, 0);
+    curBlockTxCt.assign(numBuckets, 0);
+    curBlockVal.assign(numBuckets, 0);
+    curBlockBuckets.clear();
+    bucketUpdates.assign(numBuckets, nUpdates);
+}
+
+double TxConfirmStats::DecayFactor(unsigned int bucket) const
+{
+    unsigned int nPending = nUpdates - bucketUpdates[bucket];
+    if (nPending == 0)
+        return 1;
+    return std::pow(decay, nPending);
+}
 
-    oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
-    txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-    avg.resize(buckets.size());
+void TxConfirmStats::DecayBucket(unsigned int bucket)
+{
+    double factor = DecayFactor(bucket);
+    bucketUpdates[bucket] = nUpdates;
+    if (factor == 1)
+        return;
+    double* conf = &confAvg[bucket * maxConfirms];
+    for (unsigned int i = 0; i < maxConfirms; i++)
+        conf[i] *= factor;
+    avg[bucket] *= factor;
+    txCtAvg[bucket] *= factor;
 }
 
 // Zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
+        oldUnconfTxs[j] += unconfTxs[j * maxConfirms + blockIndex];
+        unconfTxs[j * maxConfirms + blockIndex] = 0;
+    }
+    // Only the buckets recorded into have anything to clear
+    for (unsigned int j : curBlockBuckets) {
+        std::fill_n(curBlockConf.begin() + j * maxConfirms, maxConfirms, 0);
         curBlockTxCt[j] = 0;
         curBlockVal[j] = 0;
     }
+    curBlockBuckets.clear();
 }
 
 unsigned int TxConfirmStats::FindBucketIndex(double val)
@@ -66,20 +97,28 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = FindBucketIndex(val);
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
+    int* conf = &curBlockConf[bucketindex * maxConfirms];
+    for (size_t i = blocksToConfirm; i <= maxConfirms; i++) {
+        conf[i - 1]++;
     }
-    curBlockTxCt[bucketindex]++;
+    if (curBlockTxCt[bucketindex]++ == 0)
+        curBlockBuckets.push_back(bucketindex);
     curBlockVal[bucketindex] += val;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+    // Every bucket decays; the ones without data points this block do so
+    // when they are next read or updated
+    nUpdates++;
+    for (unsigned int j : curBlockBuckets) {
+        DecayBucket(j);
+        double* conf = &confAvg[j * maxConfirms];
+        const int* curConf = &curBlockConf[j * maxConfirms];
+        for (unsigned int i = 0; i < maxConfirms; i++)
+            conf[i] += curConf[i];
+        avg[j] += curBlockVal[j];
+        txCtAvg[j] += curBlockTxCt[j];
     }
 }
 
@@ -113,15 +152,16 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    unsigned int bins = maxConfirms;
 
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        double factor = DecayFactor(bucket);
+        nConf += confAvg[bucket * maxConfirms + confTarget - 1] * factor;
+        totalNum += txCtAvg[bucket] * factor;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+            extraNum += unconfTxs[bucket * maxConfirms + (nBlockHeight - confct)%bins];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -160,14 +200,16 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int minBucket = bestNearBucket < bestFarBucket ? bestNearBucket : bestFarBucket;
     unsigned int maxBucket = bestNearBucket > bestFarBucket ? bestNearBucket : bestFarBucket;
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
-        txSum += txCtAvg[j];
+        txSum += txCtAvg[j] * DecayFactor(j);
     }
     if (foundAnswer && txSum != 0) {
         txSum = txSum / 2;
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
-            if (txCtAvg[j] < txSum)
-                txSum -= txCtAvg[j];
+            double txCt = txCtAvg[j] * DecayFactor(j);
+            if (txCt < txSum)
+                txSum -= txCt;
             else { // we're in the right bucket
+                // Both averages decay alike
                 median = avg[j] / txCtAvg[j];
                 break;
             }
@@ -184,11 +226,21 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    for (unsigned int j = 0; j < buckets.size(); j++)
+        DecayBucket(j);
+
+    // The file keeps the confirmation averages by confirmation count first
+    std::vector<std::vector<double> > fileConfAvg(maxConfirms, std::vector<double>(buckets.size()));
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        for (unsigned int i = 0; i < maxConfirms; i++)
+            fileConfAvg[i][j] = confAvg[j * maxConfirms + i];
+    }
+
     fileout << decay;
     fileout << buckets;
     fileout << avg;
     fileout << txCtAvg;
-    fileout << confAvg;
+    fileout << fileConfAvg;
 }
 
 void TxConfirmStats::Read(CAutoFile& filein)
@@ -225,27 +277,28 @@ void TxConfirmStats::Read(CAutoFile& filein)
     }
     // Now that we've processed the entire fee estimate data file and not
     // thrown any errors, we can copy it to our data structures
+    bool fSameShape = maxConfirms == this->maxConfirms && numBuckets == buckets.size();
     decay = fileDecay;
     buckets = fileBuckets;
     avg = fileAvg;
-    confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
+    this->maxConfirms = maxConfirms;
+    confAvg.resize(numBuckets * maxConfirms);
+    for (unsigned int j = 0; j < numBuckets; j++) {
+        for (unsigned int i = 0; i < maxConfirms; i++)
+            confAvg[j * maxConfirms + i] = fileConfAvg[i][j];
+    }
     bucketMap.clear();
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
+    Resize(numBuckets);
 
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        unconfTxs[i].resize(buckets.size());
+    // The mempool counts are kept if they still fit
+    if (!fSameShape) {
+        unconfTxs.assign(numBuckets * maxConfirms, 0);
+        oldUnconfTxs.assign(numBuckets, 0);
     }
-    oldUnconfTxs.resize(buckets.size());
 
     for (unsigned int i = 0; i < buckets.size(); i++)
         bucketMap[buckets[i]] = i;
@@ -257,9 +310,8 @@ void TxConfirmStats::Read(CAutoFile& filein)
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = FindBucketIndex(val);
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
-    LogPrint("estimatefee", "adding to %s", dataTypeString);
+    unsigned int blockIndex = nBlockHeight % maxConfirms;
+    unconfTxs[bucketindex * maxConfirms + blockIndex]++;
     return bucketindex;
 }
 
@@ -274,7 +326,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size()) {
+    if (blocksAgo >= (int)maxConfirms) {
         if (oldUnconfTxs[bucketindex] > 0)
             oldUnconfTxs[bucketindex]--;
         else
@@ -282,9 +334,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
                      bucketindex);
     }
     else {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0)
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % maxConfirms;
+        if (unconfTxs[bucketindex * maxConfirms + blockIndex] > 0)
+            unconfTxs[bucketindex * maxConfirms + blockIndex]--;
         else
             LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
@@ -353,7 +405,8 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
 {
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
-    if (mapMemPoolTxs[hash].stats != NULL) {
+    TxStatsInfo& info = mapMemPoolTxs[hash];
+    if (info.stats != NULL) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s already being tracked\n",
                  hash.ToString().c_str());
 	return;
@@ -384,23 +437,24 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     // what that will be and its too hard to continue updating it
     // so use starting priority as a proxy
     double curPri = entry.GetPriority(txHeight);
-    mapMemPoolTxs[hash].blockHeight = txHeight;
+    info.blockHeight = txHeight;
 
-    LogPrint("estimatefee", "Blockpolicy mempool tx %s ", hash.ToString().substr(0,10));
     // Record this as a priority estimate
     if (entry.GetFee() == 0 || isPriDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &priStats;
-        mapMemPoolTxs[hash].bucketIndex =  priStats.NewTx(txHeight, curPri);
+        info.stats = &priStats;
+        info.bucketIndex = priStats.NewTx(txHeight, curPri);
     }
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &feeStats;
-        mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        info.stats = &feeStats;
+        info.bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
     }
-    else {
-        LogPrint("estimatefee", "not adding");
+
+    // Only format the hash when it is logged, this runs for every transaction
+    if (LogAcceptCategory("estimatefee")) {
+        LogPrint("estimatefee", "Blockpolicy mempool tx %s %s\n", hash.ToString().substr(0,10),
+                 info.stats == &priStats ? "adding to Priority" : info.stats == &feeStats ? "adding to FeeRate" : "not adding");
     }
-    LogPrint("estimatefee", "\n");
 }
 
 void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry)
@@ -452,6 +506,8 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
         return;
     }
     nBestSeenHeight = nBlockHeight;
+    mapFeeEstimates.clear();
+    mapPriEstimates.clear();
 
     // Only want to be updating estimates when our blockchain is synced,
     // otherwise we'll miscalculate how many blocks its taking to get included.
@@ -504,12 +560,33 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    std::map<int, double>::iterator it = mapFeeEstimates.find(confTarget);
+    if (it == mapFeeEstimates.end()) {
+        double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+        it = mapFeeEstimates.insert(std::make_pair(confTarget, median)).first;
+    }
 
-    if (median < 0)
+    if (it->second < 0)
         return CFeeRate(0);
 
-    return CFeeRate(median);
+    return CFeeRate(it->second);
+}
+
+CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget)
+{
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = confTarget;
+    // Return failure if trying to analyze a target we're not tracking
+    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+        return CFeeRate(0);
+
+    CFeeRate feeRate(0);
+    while (feeRate == CFeeRate(0) && (unsigned int)confTarget <= feeStats.GetMaxConfirms())
+        feeRate = estimateFee(confTarget++);
+
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = confTarget - 1;
+    return feeRate;
 }
 
 double CBlockPolicyEstimator::estimatePriority(int confTarget)
@@ -518,7 +595,29 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
 
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    std::map<int, double>::iterator it = mapPriEstimates.find(confTarget);
+    if (it == mapPriEstimates.end()) {
+        double median = priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+        it = mapPriEstimates.insert(std::make_pair(confTarget, median)).first;
+    }
+    return it->second;
+}
+
+double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget)
+{
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = confTarget;
+    // Return failure if trying to analyze a target we're not tracking
+    if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
+        return -1;
+
+    double median = -1;
+    while (median < 0 && (unsigned int)confTarget <= priStats.GetMaxConfirms())
+        median = estimatePriority(confTarget++);
+
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = confTarget - 1;
+    return median;
 }
 
 void CBlockPolicyEstimator::Write(CAutoFile& fileout)
@@ -535,4 +634,6 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    mapFeeEstimates.clear();
+    mapPriEstimates.clear();
 }
@@ -86,6 +86,11 @@ private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
     std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
     std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    unsigned int maxConfirms = 0;
+
+    // The per-confirmation arrays are flat and bucket major: the entry for
+    // bucket X and confirmation count Y is at X * maxConfirms + Y, so the data
+    // of one bucket is contiguous.
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -96,9 +101,9 @@ private:
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
+    std::vector<double> confAvg; // confAvg[X * maxConfirms + Y]
     // and calcuate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
+    std::vector<int> curBlockConf; // curBlockConf[X * maxConfirms + Y]
 
     // Sum the total priority/fee of all txs in each bucket
     // Track the historical moving average of this total over blocks
@@ -106,6 +111,15 @@ private:
     // and calculate the total for the current block to update the moving average
     std::vector<double> curBlockVal;
 
+    // The averages are decayed lazily: the averages of bucket X are stored as
+    // they were after update bucketUpdates[X], and are decayed by
+    // decay^(nUpdates - bucketUpdates[X]) when read or updated. Blocks only
+    // touch the buckets their transactions fall in.
+    std::vector<unsigned int> bucketUpdates;
+    unsigned int nUpdates = 0;
+    // Buckets with data points in the current block
+    std::vector<unsigned int> curBlockBuckets;
+
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
 
@@ -115,10 +129,16 @@ private:
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    std::vector<int> unconfTxs;  //unconfTxs[X * maxConfirms + Y]
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** The factor to apply to the stored averages of a bucket */
+    double DecayFactor(unsigned int bucket) const;
+    /** Apply the pending decay to the stored averages of a bucket */
+    void DecayBucket(unsigned int bucket);
+    void Resize(size_t numBuckets);
+
 public:
     /** Find the bucket index of a given value */
     unsigned int FindBucketIndex(double val);
@@ -172,7 +192,7 @@ public:
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight);
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() { return maxConfirms; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout);
@@ -249,9 +269,19 @@ public:
     /** Return a fee estimate */
     CFeeRate estimateFee(int confTarget);
 
+    /**
+     * Return a fee estimate for the lowest target from confTarget up for
+     * which there is one, and set *answerFoundAtTarget to that target
+     * (if non-NULL)
+     */
+    CFeeRate estimateSmartFee(int confTarget, int *answerFoundAtTarget);
+
     /** Return a priority estimate */
     double estimatePriority(int confTarget);
 
+    /** Return a priority estimate like estimateSmartFee does */
+    double estimateSmartPriority(int confTarget, int *answerFoundAtTarget);
+
     /** Write estimation data to a file */
     void Write(CAutoFile& fileout);
 
@@ -279,5 +309,12 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /**
+     * Estimates by target, computed at most once per block: the estimates
+     * only change with the averages, which move once a block, and with the
+     * mempool counts, which are taken as they are on the first request.
+     */
+    std::map<int, double> mapFeeEstimates, mapPriEstimates;
 };
 #endif /*BITCOIN_POLICYESTIMATOR_H */
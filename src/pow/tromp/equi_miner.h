@@ -19,6 +19,7 @@
 // twice the number of subtrees expected to land there.
 
 #include "pow/tromp/equi.h"
+#include "support/hugepages.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -155,8 +156,11 @@ struct htalloc {
 // 7      0 2 4 6 . G G   1 3 5 7 H H
 // 8      0 2 4 6 8 . I   1 3 5 7 H H
     assert(DIGITBITS >= 16); // ensures hashes shorten by 1 unit every 2 digits
-    heap0 = (u32 *)alloc(1, sizeof(digit0));
-    heap1 = (u32 *)alloc(1, sizeof(digit1));
+    // the heaps are most of the solver's memory, so they go on huge pages
+    // when -hugepages allows; the mappings are zeroed like calloc's
+    heap0 = (u32 *)AllocateHugePages(sizeof(digit0));
+    heap1 = (u32 *)AllocateHugePages(sizeof(digit1));
+    alloced += sizeof(digit0) + sizeof(digit1);
     for (int r=0; r<WK; r++)
       if ((r&1) == 0)
         trees0[r/2]  = (bucket0 *)(heap0 + r/2);
@@ -164,8 +168,8 @@ struct htalloc {
         trees1[r/2]  = (bucket1 *)(heap1 + r/2);
   }
   void dealloctrees() {
-    free(heap0);
-    free(heap1);
+    FreeHugePages(heap0);
+    FreeHugePages(heap1);
   }
   void *alloc(const u32 n, const u32 sz) {
     void *mem  = calloc(n, sz);
@@ -576,8 +580,7 @@ void *worker(void *vp) {
   thread_ctx *tp = (thread_ctx *)vp;
   equi *eq = tp->eq;
 
-  if (tp->id == 0)
-//    printf("Digit 0\n");
+  // Every thread has to reach every barrier, whatever gets logged
   barrier(&eq->barry);
   eq->digit0(tp->id);
   barrier(&eq->barry);
@@ -587,8 +590,6 @@ void *worker(void *vp) {
   }
   barrier(&eq->barry);
   for (u32 r = 1; r < WK; r++) {
-    if (tp->id == 0)
-//      printf("Digit %d", r);
     barrier(&eq->barry);
     r&1 ? eq->digitodd(r, tp->id) : eq->digiteven(r, tp->id);
     barrier(&eq->barry);
@@ -599,8 +600,6 @@ void *worker(void *vp) {
     }
     barrier(&eq->barry);
   }
-  if (tp->id == 0)
-//    printf("Digit %d\n", WK);
   eq->digitK(tp->id);
   barrier(&eq->barry);
   pthread_exit(NULL);
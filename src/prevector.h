@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include <iterator>
+#include <utility>
 
 #pragma pack(push, 1)
 /** Implements a drop-in replacement for std::vector<T> which stores up to N
@@ -267,6 +268,15 @@ public:
         return *this;
     }
 
+    prevector(prevector<N, T, Size, Diff>&& other) : _size(0) {
+        swap(other);
+    }
+
+    prevector& operator=(prevector<N, T, Size, Diff>&& other) {
+        swap(other);
+        return *this;
+    }
+
     size_type size() const {
         return is_direct() ? _size : _size - N - 1;
     }
@@ -399,7 +409,18 @@ public:
         _size++;
     }
 
+    template<typename... Args>
+    void emplace_back(Args&&... args) {
+        size_type new_size = size() + 1;
+        if (capacity() < new_size) {
+            change_capacity(new_size + (new_size >> 1));
+        }
+        new(item_ptr(size())) T(std::forward<Args>(args)...);
+        _size++;
+    }
+
     void pop_back() {
+        item_ptr(size() - 1)->~T();
         _size--;
     }
 
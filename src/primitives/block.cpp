@@ -9,10 +9,64 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
+
+struct CBlockHeader::HashCache
+{
+    int32_t nVersion;
+    uint256 hashPrevBlock;
+    uint256 hashMerkleRoot;
+    uint256 hashFinalSaplingRoot;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint256 nNonce;
+    std::vector<unsigned char> nSolution;
+    uint256 hash;
+
+    HashCache(const CBlockHeader& header, const uint256& hashIn) :
+        nVersion(header.nVersion), hashPrevBlock(header.hashPrevBlock),
+        hashMerkleRoot(header.hashMerkleRoot), hashFinalSaplingRoot(header.hashFinalSaplingRoot),
+        nTime(header.nTime), nBits(header.nBits), nNonce(header.nNonce),
+        nSolution(header.nSolution), hash(hashIn) {}
+
+    bool Matches(const CBlockHeader& header) const
+    {
+        return nVersion == header.nVersion && nTime == header.nTime && nBits == header.nBits &&
+               hashPrevBlock == header.hashPrevBlock && hashMerkleRoot == header.hashMerkleRoot &&
+               hashFinalSaplingRoot == header.hashFinalSaplingRoot && nNonce == header.nNonce &&
+               nSolution == header.nSolution;
+    }
+};
 
 uint256 CBlockHeader::GetHash() const
 {
-    return SerializeHash(*this);
+    // Comparing the fields costs far less than hashing them, solution and all
+    std::shared_ptr<const HashCache> cache = hashCache.Load();
+    if (cache && cache->Matches(*this))
+        return cache->hash;
+
+    uint256 hash = SerializeHash(*this);
+    hashCache.Store(std::make_shared<const HashCache>(*this, hash));
+    return hash;
+}
+
+/**
+ * Hash one level of nSize >= 2 merkle nodes into the (nSize + 1) / 2 nodes
+ * of the next level, all pairs in one batch. Returns whether the last two
+ * nodes are identical, which is how a duplicated transaction list shows.
+ */
+static bool HashMerkleLevel(const uint256* vIn, int nSize, uint256* vOut)
+{
+    static_assert(sizeof(uint256) == 32, "merkle tree nodes must be contiguous");
+    bool mutated = nSize % 2 == 0 && vIn[nSize-2] == vIn[nSize-1];
+    // Every pair of neighbours is one 64-byte input; an odd last node is
+    // paired with itself.
+    SHA256D64(vOut[0].begin(), vIn[0].begin(), nSize / 2);
+    if (nSize % 2) {
+        const uint256& last = vIn[nSize-1];
+        vOut[nSize / 2] = Hash(BEGIN(last), END(last), BEGIN(last), END(last));
+    }
+    return mutated;
 }
 
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
@@ -60,15 +114,10 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+        if (HashMerkleLevel(&vMerkleTree[j], nSize, &vMerkleTree[j+nSize])) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
         }
         j += nSize;
     }
@@ -78,6 +127,25 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     return (vMerkleTree.empty() ? uint256() : vMerkleTree.back());
 }
 
+uint256 CBlock::ComputeMerkleRoot(bool* fMutated) const
+{
+    std::vector<uint256> vLevel, vNext;
+    vLevel.reserve(vtx.size());
+    for (std::vector<CTransaction>::const_iterator it(vtx.begin()); it != vtx.end(); ++it)
+        vLevel.push_back(it->GetHash());
+    bool mutated = false;
+    while (vLevel.size() > 1) {
+        vNext.resize((vLevel.size() + 1) / 2);
+        if (HashMerkleLevel(&vLevel[0], vLevel.size(), &vNext[0]))
+            mutated = true;
+        vLevel.swap(vNext);
+    }
+    if (fMutated) {
+        *fMutated = mutated;
+    }
+    return (vLevel.empty() ? uint256() : vLevel[0]);
+}
+
 std::vector<uint256> CBlock::GetMerkleBranch(int nIndex) const
 {
     if (vMerkleTree.empty())
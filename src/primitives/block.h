@@ -10,6 +10,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -68,12 +70,43 @@ public:
         return (nBits == 0);
     }
 
+    /**
+     * The double SHA256 of the serialized header. Its hash is kept and
+     * returned again while the fields are unchanged, so headers can be hashed
+     * as often as convenient; changing a field, as the miner does, needs no
+     * invalidation.
+     */
     uint256 GetHash() const;
 
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
+
+private:
+    //! The fields as last hashed, and their hash
+    struct HashCache;
+
+    //! Holder of the HashCache, shared by copies, safe to read and replace from several threads
+    class HashCacheRef
+    {
+    private:
+        std::shared_ptr<const HashCache> ptr;
+
+    public:
+        HashCacheRef() {}
+        HashCacheRef(const HashCacheRef& other) : ptr(other.Load()) {}
+        HashCacheRef& operator=(const HashCacheRef& other)
+        {
+            Store(other.Load());
+            return *this;
+        }
+
+        std::shared_ptr<const HashCache> Load() const { return std::atomic_load(&ptr); }
+        void Store(std::shared_ptr<const HashCache> p) { std::atomic_store(&ptr, p); }
+    };
+
+    mutable HashCacheRef hashCache;
 };
 
 
@@ -110,6 +143,42 @@ public:
         READWRITE(vtx);
     }
 
+    /**
+     * Deserialize into this block, reusing the transactions it already holds
+     * for the ones read: their vectors keep their storage, so reading block
+     * after block into the same CBlock (as rescans and witness rebuilds do)
+     * allocates little beyond what a larger block needs.
+     */
+    template <typename Stream>
+    void UnserializeReusing(Stream& s)
+    {
+        static const CTransaction txEmpty;
+
+        ::Unserialize(s, *(CBlockHeader*)this);
+        uint64_t nTx = ReadCompactSize(s);
+        size_t nReused = std::min<uint64_t>(nTx, vtx.size());
+        vtx.resize(nReused);
+        for (size_t i = 0; i < nReused; i++) {
+            // Fields a transaction's format does not carry are not read, so start from scratch
+            vtx[i] = txEmpty;
+            ::Unserialize(s, vtx[i]);
+        }
+        // Grow in steps, like vector deserialization, so a bogus count cannot allocate ahead of the data
+        size_t i = nReused;
+        size_t nMid = nReused;
+        while (nMid < nTx) {
+            nMid = std::min<uint64_t>(nMid + 5000000 / sizeof(CTransaction), nTx);
+            vtx.resize(nMid);
+            for (; i < nMid; i++)
+                ::Unserialize(s, vtx[i]);
+        }
+
+        payee = CScript();
+        vMerkleTree.clear();
+        txoutFounders = CTxOut();
+        txoutZeronode = CTxOut();
+    }
+
     void SetNull()
     {
         CBlockHeader::SetNull();
@@ -140,6 +209,10 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // Compute the merkle root, and *mutated as above, without keeping the
+    // tree; cheaper when only the root is checked.
+    uint256 ComputeMerkleRoot(bool* mutated = NULL) const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
     std::string ToString() const;
@@ -490,6 +490,15 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * The inputs and outputs of a transaction. Most transactions have one or two
+ * of each, which are then kept inside the transaction instead of in separate
+ * heap allocations. The prevector is packed, so members of these types are
+ * declared alignas(CTxOut) to keep the elements aligned.
+ */
+typedef prevector<2, CTxIn, size_t, ptrdiff_t> CTxInVector;
+typedef prevector<2, CTxOut, size_t, ptrdiff_t> CTxOutVector;
+
 // Overwinter version group id
 static constexpr uint32_t OVERWINTER_VERSION_GROUP_ID = 0x03C48270;
 static_assert(OVERWINTER_VERSION_GROUP_ID != 0, "version group id must be non-zero as specified in ZIP 202");
@@ -553,8 +562,8 @@ public:
     const bool fOverwintered;
     const int32_t nVersion;
     const uint32_t nVersionGroupId;
-    const std::vector<CTxIn> vin;
-    const std::vector<CTxOut> vout;
+    alignas(CTxOut) const CTxInVector vin;
+    alignas(CTxOut) const CTxOutVector vout;
     const uint32_t nLockTime;
     const uint32_t nExpiryHeight;
     const CAmount valueBalance;
@@ -604,8 +613,8 @@ public:
             throw std::ios_base::failure("Unknown transaction format");
         }
 
-        READWRITE(*const_cast<std::vector<CTxIn>*>(&vin));
-        READWRITE(*const_cast<std::vector<CTxOut>*>(&vout));
+        READWRITE(*const_cast<CTxInVector*>(&vin));
+        READWRITE(*const_cast<CTxOutVector*>(&vout));
         READWRITE(*const_cast<uint32_t*>(&nLockTime));
         if (isOverwinterV3 || isSaplingV4) {
             READWRITE(*const_cast<uint32_t*>(&nExpiryHeight));
@@ -700,8 +709,8 @@ struct CMutableTransaction
     bool fOverwintered;
     int32_t nVersion;
     uint32_t nVersionGroupId;
-    std::vector<CTxIn> vin;
-    std::vector<CTxOut> vout;
+    alignas(CTxOut) CTxInVector vin;
+    alignas(CTxOut) CTxOutVector vout;
     uint32_t nLockTime;
     uint32_t nExpiryHeight;
     CAmount valueBalance;
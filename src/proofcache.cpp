@@ -0,0 +1,151 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "util.h"
+
+#include <atomic>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Entries already include a nonce, so no extra blinding is needed: each of
+ * the eight cuckoo hashes is a word of the entry.
+ */
+class CProofCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "CProofCacheHasher only has 8 hashes available.");
+        return ReadLE32(key.begin() + 4 * hash_select);
+    }
+};
+
+/**
+ * Transactions whose shielded proofs and signatures are known to be valid,
+ * so they are verified once when accepted into the memory pool and not
+ * again when the block containing them is checked and connected.
+ */
+class CProofCache
+{
+private:
+    //! Entries are SHA256(nonce || txid || consensus branch id)
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, CProofCacheHasher> map_type;
+    map_type setValid;
+    //! Only insert() needs it exclusively
+    boost::shared_mutex cs_proofcache;
+
+public:
+    CProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& txid, uint32_t consensusBranchId)
+    {
+        unsigned char branchId[4];
+        WriteLE32(branchId, consensusBranchId);
+        CSHA256().Write(nonce.begin(), 32).Write(txid.begin(), 32).Write(branchId, 4).Finalize(entry.begin());
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& hash)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.setup_bytes(n);
+    }
+
+    size_t DynamicMemoryUsage()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.memory_usage();
+    }
+};
+
+CProofCache proofCache;
+
+//! Block hashes whose Equihash solution is valid, each under its own nonce
+CProofCache equihashCache;
+
+std::atomic<bool> fProofCacheBypass(false);
+
+}
+
+void InitProofCache()
+{
+    int64_t nMaxSize = std::min(std::max((int64_t)0, GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE)), MAX_MAX_PROOF_CACHE_SIZE);
+    size_t nMaxCacheSize = nMaxSize * ((size_t) 1 << 20);
+    size_t nElems = proofCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for shielded proof cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+    equihashCache.setup_bytes(EQUIHASH_CACHE_SIZE * ((size_t) 1 << 20));
+}
+
+size_t GetProofCacheMemoryUsage()
+{
+    return proofCache.DynamicMemoryUsage() + equihashCache.DynamicMemoryUsage();
+}
+
+bool IsShieldedTxVerified(const uint256& txid, uint32_t consensusBranchId)
+{
+    if (fProofCacheBypass)
+        return false;
+    uint256 entry;
+    proofCache.ComputeEntry(entry, txid, consensusBranchId);
+    return proofCache.Get(entry);
+}
+
+void SetShieldedTxVerified(const uint256& txid, uint32_t consensusBranchId)
+{
+    uint256 entry;
+    proofCache.ComputeEntry(entry, txid, consensusBranchId);
+    proofCache.Set(entry);
+}
+
+bool IsEquihashSolutionVerified(const uint256& hashBlock)
+{
+    if (fProofCacheBypass)
+        return false;
+    uint256 entry;
+    equihashCache.ComputeEntry(entry, hashBlock);
+    return equihashCache.Get(entry);
+}
+
+void SetEquihashSolutionVerified(const uint256& hashBlock)
+{
+    uint256 entry;
+    equihashCache.ComputeEntry(entry, hashBlock);
+    equihashCache.Set(entry);
+}
+
+void SetProofCacheBypass(bool fBypass)
+{
+    fProofCacheBypass = fBypass;
+}
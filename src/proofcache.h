@@ -0,0 +1,55 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PROOFCACHE_H
+#define BITCOIN_PROOFCACHE_H
+
+#include "uint256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Limit the proof cache to 4MB (over 130000 entries of 32 bytes).
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 4;
+// Maximum proof cache size allowed
+static const int64_t MAX_MAX_PROOF_CACHE_SIZE = 16384;
+// The Equihash solution cache takes 1MB (over 32000 headers).
+static const unsigned int EQUIHASH_CACHE_SIZE = 1;
+
+/**
+ * Whether the JoinSplit proofs, joinSplitSig and Sapling proofs and
+ * signatures of the transaction have already been verified under the given
+ * consensus branch. The txid commits to all of them and the branch id fixes
+ * the signature hash, so they need not be verified again.
+ */
+bool IsShieldedTxVerified(const uint256& txid, uint32_t consensusBranchId);
+
+/** Record that the shielded parts of the transaction verified (see above) */
+void SetShieldedTxVerified(const uint256& txid, uint32_t consensusBranchId);
+
+/**
+ * Whether the Equihash solution of the header with this hash has already
+ * been verified. The block hash commits to the solution, so a header
+ * received again from another peer, or in a block after its headers
+ * message, need not be checked again.
+ */
+bool IsEquihashSolutionVerified(const uint256& hashBlock);
+
+/** Record that the Equihash solution of the header verified */
+void SetEquihashSolutionVerified(const uint256& hashBlock);
+
+/** Size the proof cache from -maxproofcachesize; must run before any transaction is checked */
+void InitProofCache();
+
+/** Bytes held by the proof cache and the Equihash solution cache */
+size_t GetProofCacheMemoryUsage();
+
+/**
+ * While set, IsShieldedTxVerified() and IsEquihashSolutionVerified() report
+ * everything as unverified, so that benchmarks checking the same blocks
+ * repeatedly verify all proofs.
+ */
+void SetProofCacheBypass(bool fBypass);
+
+#endif // BITCOIN_PROOFCACHE_H
@@ -29,7 +29,9 @@ static const char* ppszTypeName[] =
     "zn budget finalized vote",
     "zn quorum",
     "zn announce",
-    "zn ping"
+    "zn ping",
+    "cmpctblock",
+    "tx lock cert"
 };
 
 CMessageHeader::CMessageHeader(const MessageStartChars& pchMessageStartIn)
@@ -142,7 +144,7 @@ bool CInv::IsKnownType() const
 }
 
 bool CInv::IsZeroNodeType() const{
- 	return (type >= 6);
+ 	return (type >= 6 && type <= MSG_ZERONODE_PING);
 }
 
 const char* CInv::GetCommand() const
@@ -80,6 +80,10 @@ enum {
   	// that the node doens't want to receive master nodes messages. (the 1<<3 was not picked as constant because on bitcoin 0.14 is witness and we want that update here )
   	NODE_BLOOM_WITHOUT_MN = (1 << 4),
 
+    // NODE_COMPACT_FILTERS means the node will answer "getcfilters", "getcfheaders"
+    // and "getcfcheckpt" requests for the basic compact block filters (BIP 157).
+    NODE_COMPACT_FILTERS = (1 << 6),
+
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
     // bitcoin-development mailing list. Remember that service bits are just
@@ -170,7 +174,13 @@ enum {
     MSG_BUDGET_FINALIZED_VOTE,
     MSG_ZERONODE_QUORUM,
     MSG_ZERONODE_ANNOUNCE,
-    MSG_ZERONODE_PING
+    MSG_ZERONODE_PING,
+    // Only used in getdata, to ask for a block as a compact block ("cmpctblock").
+    // BIP152 uses 4, which is already MSG_TXLOCK_REQUEST here.
+    MSG_CMPCT_BLOCK,
+    // All the votes of a complete SwiftX lock, by transaction hash ("txlcert").
+    // Older peers take it for an unknown type and never ask for it.
+    MSG_TXLOCK_CERT
 };
 
 #endif // BITCOIN_PROTOCOL_H
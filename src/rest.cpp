@@ -8,6 +8,7 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "rpc/cbor.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -29,6 +30,7 @@ enum RetFormat {
     RF_BINARY,
     RF_HEX,
     RF_JSON,
+    RF_CBOR,
 };
 
 static const struct {
@@ -39,6 +41,7 @@ static const struct {
       {RF_BINARY, "bin"},
       {RF_HEX, "hex"},
       {RF_JSON, "json"},
+      {RF_CBOR, "cbor"},
 };
 
 struct CCoin {
@@ -71,6 +74,19 @@ static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message
     return false;
 }
 
+/** Send a JSON result as text, or in the compact CBOR encoding if rf is RF_CBOR */
+static bool RESTWriteValue(HTTPRequest* req, enum RetFormat rf, const UniValue& value)
+{
+    if (rf == RF_CBOR) {
+        req->WriteHeader("Content-Type", CBOR_CONTENT_TYPE);
+        req->WriteReply(HTTP_OK, EncodeCBOR(value));
+    } else {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, value.write() + "\n");
+    }
+    return true;
+}
+
 static enum RetFormat ParseDataFormat(vector<string>& params, const string& strReq)
 {
     boost::split(params, strReq, boost::is_any_of("."));
@@ -171,15 +187,13 @@ static bool rest_headers(HTTPRequest* req,
         req->WriteReply(HTTP_OK, strHex);
         return true;
     }
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue jsonHeaders(UniValue::VARR);
         BOOST_FOREACH(const CBlockIndex *pindex, headers) {
             jsonHeaders.push_back(blockheaderToJSON(pindex));
         }
-        string strJSON = jsonHeaders.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, jsonHeaders);
     }
     default: {
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
@@ -237,12 +251,10 @@ static bool rest_block(HTTPRequest* req,
         return true;
     }
 
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, objBlock);
     }
 
     default: {
@@ -275,16 +287,14 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     const RetFormat rf = ParseDataFormat(params, strURIPart);
 
     switch (rf) {
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue rpcParams(UniValue::VARR);
         UniValue chainInfoObject = getblockchaininfo(rpcParams, false);
-        string strJSON = chainInfoObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, chainInfoObject);
     }
     default: {
-        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json, cbor)");
     }
     }
 
@@ -300,16 +310,14 @@ static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
     const RetFormat rf = ParseDataFormat(params, strURIPart);
 
     switch (rf) {
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue mempoolInfoObject = mempoolInfoToJSON();
 
-        string strJSON = mempoolInfoObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, mempoolInfoObject);
     }
     default: {
-        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json, cbor)");
     }
     }
 
@@ -325,16 +333,14 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
     const RetFormat rf = ParseDataFormat(params, strURIPart);
 
     switch (rf) {
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue mempoolObject = mempoolToJSON(true);
 
-        string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, mempoolObject);
     }
     default: {
-        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json, cbor)");
     }
     }
 
@@ -377,13 +383,11 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
         return true;
     }
 
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue objTx(UniValue::VOBJ);
         TxToJSON(tx, hashBlock, objTx);
-        string strJSON = objTx.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, objTx);
     }
 
     default: {
@@ -475,7 +479,8 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         break;
     }
 
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         if (!fInputParsed)
             return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Error: empty request");
         break;
@@ -552,7 +557,8 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         return true;
     }
 
-    case RF_JSON: {
+    case RF_JSON:
+    case RF_CBOR: {
         UniValue objGetUTXOResponse(UniValue::VOBJ);
 
         // pack in some essentials
@@ -576,11 +582,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         }
         objGetUTXOResponse.push_back(Pair("utxos", utxos));
 
-        // return json string
-        string strJSON = objGetUTXOResponse.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTWriteValue(req, rf, objGetUTXOResponse);
     }
     default: {
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
@@ -5,6 +5,8 @@
 
 #include "amount.h"
 #include "base58.h"
+#include "blockcache.h"
+#include "blockfilter.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -12,11 +14,14 @@
 #include "init.h"
 #include "key_io.h"
 #include "main.h"
+#include "perfstats.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 #include "wallet/wallet.h"
 
@@ -24,6 +29,8 @@
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+
 #include <regex>
 
 using namespace std;
@@ -104,12 +111,13 @@ static UniValue ValuePoolDesc(
 
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain->Contains(blockindex))
+        confirmations = chain->Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", blockindex->nVersion));
@@ -117,91 +125,132 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    result.push_back(Pair("solution", HexStr(blockindex->GetSolution())));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    CBlockIndex *pnext = chain->Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
 // insightexplorer
-UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
+/**
+ * Write the members of obj, except that the value of strKey is produced by
+ * writeMember, so the large member of a result can be generated as it is sent.
+ */
+static void WriteObjectWithMember(CJSONStreamWriter& json, const UniValue& obj, const std::string& strKey, const RPCResultWriter& writeMember)
 {
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    // Only report confirmations if the block is on the main chain
-    if (!chainActive.Contains(blockindex))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block is an orphan");
-    int confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    json.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++) {
+        json.Key(keys[i]);
+        if (keys[i] == strKey)
+            writeMember(json);
+        else
+            json.Value(values[i]);
+    }
+    json.EndObject();
+}
 
-    UniValue deltas(UniValue::VARR);
+/** Look up the spent output of every input of the block; throws if the spent index lacks one */
+static void GetBlockSpentInfo(const CBlock& block, std::vector<std::vector<CSpentIndexValue> >& vSpentInfo)
+{
+    vSpentInfo.resize(block.vtx.size());
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
         const CTransaction &tx = block.vtx[i];
-        const uint256 txhash = tx.GetHash();
-
-        UniValue entry(UniValue::VOBJ);
-        entry.push_back(Pair("txid", txhash.GetHex()));
-        entry.push_back(Pair("index", (int)i));
-
-        UniValue inputs(UniValue::VARR);
-        if (!tx.IsCoinBase()) {
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                const CTxIn input = tx.vin[j];
-                UniValue delta(UniValue::VOBJ);
-                CSpentIndexValue spentInfo;
-                CSpentIndexKey spentKey(input.prevout.hash, input.prevout.n);
-
-                if (!GetSpentIndex(spentKey, spentInfo)) {
-                    throw JSONRPCError(RPC_INTERNAL_ERROR, "Spent information not available");
-                }
-                CTxDestination dest = DestFromAddressHash(spentInfo.addressType, spentInfo.addressHash);
-                if (IsValidDestination(dest)) {
-                    delta.push_back(Pair("address", EncodeDestination(dest)));
-                }
-                delta.push_back(Pair("satoshis", -1 * spentInfo.satoshis));
-                delta.push_back(Pair("index", (int)j));
-                delta.push_back(Pair("prevtxid", input.prevout.hash.GetHex()));
-                delta.push_back(Pair("prevout", (int)input.prevout.n));
-
-                inputs.push_back(delta);
+        if (tx.IsCoinBase())
+            continue;
+        vSpentInfo[i].resize(tx.vin.size());
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            CSpentIndexKey spentKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n);
+            if (!GetSpentIndex(spentKey, vSpentInfo[i][j])) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Spent information not available");
             }
         }
-        entry.push_back(Pair("inputs", inputs));
+    }
+}
+
+static UniValue txToDeltasJSON(const CTransaction& tx, unsigned int i, const std::vector<CSpentIndexValue>& vSpentInfo)
+{
+    const uint256 txhash = tx.GetHash();
 
-        UniValue outputs(UniValue::VARR);
-        for (unsigned int k = 0; k < tx.vout.size(); k++) {
-            const CTxOut &out = tx.vout[k];
+    UniValue entry(UniValue::VOBJ);
+    entry.push_back(Pair("txid", txhash.GetHex()));
+    entry.push_back(Pair("index", (int)i));
+
+    UniValue inputs(UniValue::VARR);
+    if (!tx.IsCoinBase()) {
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CTxIn input = tx.vin[j];
             UniValue delta(UniValue::VOBJ);
-            const uint160 addrhash = out.scriptPubKey.AddressHash();
-            CTxDestination dest;
+            CSpentIndexValue spentInfo = vSpentInfo[j];
 
-            if (out.scriptPubKey.IsPayToScriptHash()) {
-                dest = CScriptID(addrhash);
-            } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                dest = CKeyID(addrhash);
-            }
+            CTxDestination dest = DestFromAddressHash(spentInfo.addressType, spentInfo.addressHash);
             if (IsValidDestination(dest)) {
                 delta.push_back(Pair("address", EncodeDestination(dest)));
             }
-            delta.push_back(Pair("address", EncodeDestination(dest)));
-            delta.push_back(Pair("satoshis", out.nValue));
-            delta.push_back(Pair("index", (int)k));
+            delta.push_back(Pair("satoshis", -1 * spentInfo.satoshis));
+            delta.push_back(Pair("index", (int)j));
+            delta.push_back(Pair("prevtxid", input.prevout.hash.GetHex()));
+            delta.push_back(Pair("prevout", (int)input.prevout.n));
 
-            outputs.push_back(delta);
+            inputs.push_back(delta);
         }
-        entry.push_back(Pair("outputs", outputs));
-        deltas.push_back(entry);
+    }
+    entry.push_back(Pair("inputs", inputs));
+
+    UniValue outputs(UniValue::VARR);
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut &out = tx.vout[k];
+        UniValue delta(UniValue::VOBJ);
+        const uint160 addrhash = out.scriptPubKey.AddressHash();
+        CTxDestination dest;
+
+        if (out.scriptPubKey.IsPayToScriptHash()) {
+            dest = CScriptID(addrhash);
+        } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
+            dest = CKeyID(addrhash);
+        }
+        if (IsValidDestination(dest)) {
+            delta.push_back(Pair("address", EncodeDestination(dest)));
+        }
+        delta.push_back(Pair("address", EncodeDestination(dest)));
+        delta.push_back(Pair("satoshis", out.nValue));
+        delta.push_back(Pair("index", (int)k));
+
+        outputs.push_back(delta);
+    }
+    entry.push_back(Pair("outputs", outputs));
+    return entry;
+}
+
+/** The getblockdeltas result, with the "deltas" array left empty unless fDeltas */
+static UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex,
+                                  const std::vector<std::vector<CSpentIndexValue> >& vSpentInfo, bool fDeltas)
+{
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    // Only report confirmations if the block is on the main chain
+    if (!chain->Contains(blockindex))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block is an orphan");
+    int confirmations = chain->Height() - blockindex->nHeight + 1;
+    result.push_back(Pair("confirmations", confirmations));
+    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+    result.push_back(Pair("height", blockindex->nHeight));
+    result.push_back(Pair("version", block.nVersion));
+    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+
+    UniValue deltas(UniValue::VARR);
+    if (fDeltas) {
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            deltas.push_back(txToDeltasJSON(block.vtx[i], i, vSpentInfo[i]));
     }
     result.push_back(Pair("deltas", deltas));
     result.push_back(Pair("time", block.GetBlockTime()));
@@ -213,20 +262,28 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    CBlockIndex *pnext = chain->Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
+UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
+{
+    std::vector<std::vector<CSpentIndexValue> > vSpentInfo;
+    GetBlockSpentInfo(block, vSpentInfo);
+    return blockToDeltasJSON(block, blockindex, vSpentInfo, true);
+}
+
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
 {
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", block.GetHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain->Contains(blockindex))
+        confirmations = chain->Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
     result.push_back(Pair("height", blockindex->nHeight));
@@ -261,7 +318,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    CBlockIndex *pnext = chain->Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
@@ -280,8 +337,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainSnapshot()->Height();
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -297,8 +353,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainSnapshot()->Tip()->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -318,6 +373,40 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
     return GetNetworkDifficulty();
 }
 
+/** The verbose getrawmempool details of an entry (mempool.cs must be held) */
+static UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    UniValue info(UniValue::VOBJ);
+    info.push_back(Pair("size", (int)e.GetTxSize()));
+    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+    info.push_back(Pair("time", e.GetTime()));
+    info.push_back(Pair("height", (int)e.GetHeight()));
+    info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
+    info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+    info.push_back(Pair("descendantfees", e.GetFeesWithDescendants()));
+    info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+    info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+    info.push_back(Pair("ancestorfees", e.GetFeesWithAncestors()));
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.push_back(Pair("depends", depends));
+    return info;
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
@@ -327,29 +416,7 @@ UniValue mempoolToJSON(bool fVerbose = false)
         BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
             const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
+            o.push_back(Pair(hash.ToString(), mempoolEntryToJSON(e)));
         }
         return o;
     }
@@ -366,14 +433,48 @@ UniValue mempoolToJSON(bool fVerbose = false)
     }
 }
 
+/**
+ * The changes to the mempool since it was at nSequence, or all of it with
+ * "reset" set when they are no longer known.
+ */
+static UniValue mempoolChangesToJSON(uint64_t nSequence, bool fVerbose)
+{
+    LOCK(mempool.cs);
+    std::vector<uint256> vAdded, vRemoved;
+    uint64_t nCurrentSequence;
+    bool fReset = !mempool.GetChangesSince(nSequence, vAdded, vRemoved, nCurrentSequence);
+    if (fReset)
+        mempool.queryHashes(vAdded);
+
+    UniValue added(fVerbose ? UniValue::VOBJ : UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, vAdded)
+    {
+        if (fVerbose)
+            added.push_back(Pair(hash.ToString(), mempoolEntryToJSON(*mempool.mapTx.find(hash))));
+        else
+            added.push_back(hash.ToString());
+    }
+    UniValue removed(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, vRemoved)
+        removed.push_back(hash.ToString());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("sequence", nCurrentSequence));
+    ret.push_back(Pair("reset", fReset));
+    ret.push_back(Pair("added", added));
+    ret.push_back(Pair("removed", removed));
+    return ret;
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() > 1)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose since_sequence )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nArguments:\n"
             "1. verbose           (boolean, optional, default=false) true for a json object, false for array of transaction ids\n"
+            "2. since_sequence    (numeric, optional) only return the changes since the mempool had this sequence number\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
@@ -388,13 +489,30 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees of in-mempool descendants (including this one) with any prioritisetransaction deltas, in zatoshis\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) fees of in-mempool ancestors (including this one) with any prioritisetransaction deltas, in zatoshis\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
             "  }, ...\n"
             "}\n"
+            "\nResult: (with since_sequence):\n"
+            "{\n"
+            "  \"sequence\" : n,           (numeric) the current mempool sequence number, for the next call\n"
+            "  \"reset\" : true|false,     (boolean) whether since_sequence was too old, so that \"added\" lists the whole mempool\n"
+            "  \"added\" : ...,            (json array or object) the transactions added since, as for verbose = false or true above\n"
+            "  \"removed\" : [             (json array of string) the transactions removed since\n"
+            "    \"transactionid\"         (string) The transaction id\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
             "\nExamples\n"
             + HelpExampleCli("getrawmempool", "true")
+            + HelpExampleCli("getrawmempool", "false 1234")
             + HelpExampleRpc("getrawmempool", "true")
         );
 
@@ -404,10 +522,25 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
+    if (params.size() > 1) {
+        int64_t nSequence = params[1].get_int64();
+        if (nSequence < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative since_sequence");
+        return mempoolChangesToJSON(nSequence, fVerbose);
+    }
+
     return mempoolToJSON(fVerbose);
 }
 
 // insightexplorer
+void EnsureExplorerIndexSynced()
+{
+    int nHeight;
+    if (GetExplorerIndexSyncHeight(nHeight))
+        throw JSONRPCError(RPC_IN_WARMUP, strprintf("The explorer indexes are being built, currently up to height %d of %d",
+                                                    nHeight, GetChainSnapshot()->Height()));
+}
+
 UniValue getblockdeltas(const UniValue& params, bool fHelp)
 {
     std::string enableArg = "insightexplorer";
@@ -471,15 +604,16 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getblockdeltas is disabled. "
             "Run './zero-cli help getblockdeltas' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
@@ -487,7 +621,24 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp)
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    return blockToDeltasJSON(block, pblockindex);
+    if (!RPCCanStreamResult())
+        return blockToDeltasJSON(block, pblockindex);
+
+    // Generate the deltas of each transaction as they are sent
+    std::shared_ptr<std::vector<std::vector<CSpentIndexValue> > > pspent =
+        std::make_shared<std::vector<std::vector<CSpentIndexValue> > >();
+    GetBlockSpentInfo(block, *pspent);
+    UniValue header = blockToDeltasJSON(block, pblockindex, *pspent, false);
+    std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(block);
+    RPCStreamResult([header, pblock, pspent](CJSONStreamWriter& json) {
+        WriteObjectWithMember(json, header, "deltas", [pblock, pspent](CJSONStreamWriter& json) {
+            json.BeginArray();
+            for (unsigned int i = 0; i < pblock->vtx.size(); i++)
+                json.Value(txToDeltasJSON(pblock->vtx[i], i, (*pspent)[i]));
+            json.EndArray();
+        });
+    });
+    return NullUniValue;
 }
 
 // insightexplorer
@@ -534,6 +685,7 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getblockhashes is disabled. "
             "Run './zcash-cli help getblockhashes' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     unsigned int high = params[0].get_int();
     unsigned int low = params[1].get_int();
@@ -588,13 +740,13 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > chain->Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    CBlockIndex* pblockindex = (*chain)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -630,8 +782,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -639,11 +789,11 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    // Header fields never change once a block is indexed, so no cs_main is needed
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -655,6 +805,154 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"hash\" ( \"filtertype\" )\n"
+            "\nReturns the compact filter (BIP 158) of a block. Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"hash\"          (string, required) The block hash\n"
+            "2. \"filtertype\"    (string, optional, default=\"basic\") The type of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hex\"    (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 hash(uint256S(params[0].get_str()));
+
+    std::string strFilterType = BlockFilterTypeName(BLOCK_FILTER_BASIC);
+    if (params.size() > 1)
+        strFilterType = params[1].get_str();
+    if (strFilterType != BlockFilterTypeName(BLOCK_FILTER_BASIC))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+
+    if (!pblockfilterdb)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block filters are not indexed, restart with -blockfilterindex");
+
+    if (!LookupBlockIndex(hash))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    std::vector<unsigned char> vchFilter;
+    uint256 hashHeader;
+    if (!pblockfilterdb->ReadFilter(hash, vchFilter, hashHeader))
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found, the block has not been connected");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(vchFilter)));
+    ret.push_back(Pair("header", hashHeader.GetHex()));
+    return ret;
+}
+
+static void ChainStatsToJSON(UniValue& obj, const CChainStats& stats)
+{
+    obj.push_back(Pair("transactions", stats.nTransactions));
+    obj.push_back(Pair("shielded_transactions", stats.nShieldedTransactions));
+    obj.push_back(Pair("fully_shielded_transactions", stats.nFullyShieldedTransactions));
+    obj.push_back(Pair("shielded_spends", stats.nShieldedSpends));
+    obj.push_back(Pair("shielded_outputs", stats.nShieldedOutputs));
+    obj.push_back(Pair("fees", ValueFromAmount(stats.nFees)));
+    obj.push_back(Pair("supply", ValueFromAmount(stats.nSupply)));
+    obj.push_back(Pair("sprout_value", ValueFromAmount(stats.nSproutValue)));
+    obj.push_back(Pair("sapling_value", ValueFromAmount(stats.nSaplingValue)));
+    obj.push_back(Pair("zeronode_payouts", ValueFromAmount(stats.nZeronodePayouts)));
+}
+
+UniValue getchainstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getchainstats ( endheight startheight )\n"
+            "\nReturns the totals of the active chain up to a block and, with a start height, over the blocks\n"
+            "after it. Requires -chainstatsindex.\n"
+            "\nArguments:\n"
+            "1. endheight       (numeric, optional, default=tip) The height of the last block\n"
+            "2. startheight     (numeric, optional) Also return the totals of the blocks after this height\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,                        (numeric) the height of the last block\n"
+            "  \"hash\" : \"hash\",                   (string) the hash of the last block\n"
+            "  \"transactions\" : n,                  (numeric) transactions, including coinbases\n"
+            "  \"shielded_transactions\" : n,         (numeric) transactions with JoinSplits or Sapling spends or outputs\n"
+            "  \"fully_shielded_transactions\" : n,   (numeric) shielded transactions without transparent inputs or outputs\n"
+            "  \"shielded_spends\" : n,               (numeric) Sprout nullifiers and Sapling spends\n"
+            "  \"shielded_outputs\" : n,              (numeric) Sprout commitments and Sapling outputs\n"
+            "  \"fees\" : x.xxx,                      (numeric) fees paid\n"
+            "  \"supply\" : x.xxx,                    (numeric) coins issued\n"
+            "  \"sprout_value\" : x.xxx,              (numeric) value in the Sprout pool\n"
+            "  \"sapling_value\" : x.xxx,             (numeric) value in the Sapling pool\n"
+            "  \"zeronode_payouts\" : x.xxx,          (numeric) value paid to zeronodes\n"
+            "  \"window\" : {                         (object, with startheight) the same totals, over the blocks after startheight\n"
+            "    \"blocks\" : n,\n"
+            "    \"transactions\" : n,\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getchainstats", "")
+            + HelpExampleCli("getchainstats", "1000 0")
+            + HelpExampleRpc("getchainstats", "1000, 0")
+        );
+
+    if (!pchainstatsdb)
+        throw JSONRPCError(RPC_MISC_ERROR, "Chain statistics are not indexed, restart with -chainstatsindex");
+
+    const CBlockIndex* pindexEnd = NULL;
+    const CBlockIndex* pindexStart = NULL;
+    {
+        LOCK(cs_main);
+        int nEndHeight = chainActive.Height();
+        if (params.size() > 0 && !params[0].isNull())
+            nEndHeight = params[0].get_int();
+        if (nEndHeight < 0 || nEndHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        pindexEnd = chainActive[nEndHeight];
+        if (params.size() > 1) {
+            int nStartHeight = params[1].get_int();
+            if (nStartHeight < 0 || nStartHeight > nEndHeight)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Start height out of range");
+            pindexStart = chainActive[nStartHeight];
+        }
+    }
+
+    CChainStats statsEnd;
+    if (!pchainstatsdb->ReadStats(pindexEnd->GetBlockHash(), statsEnd))
+        throw JSONRPCError(RPC_MISC_ERROR, "Chain statistics not found, the block has not been indexed yet");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", pindexEnd->nHeight));
+    ret.push_back(Pair("hash", pindexEnd->GetBlockHash().GetHex()));
+    ChainStatsToJSON(ret, statsEnd);
+
+    if (pindexStart) {
+        CChainStats statsStart;
+        if (!pchainstatsdb->ReadStats(pindexStart->GetBlockHash(), statsStart))
+            throw JSONRPCError(RPC_MISC_ERROR, "Chain statistics not found, the block has not been indexed yet");
+        CChainStats window;
+        window.nTransactions = statsEnd.nTransactions - statsStart.nTransactions;
+        window.nShieldedTransactions = statsEnd.nShieldedTransactions - statsStart.nShieldedTransactions;
+        window.nFullyShieldedTransactions = statsEnd.nFullyShieldedTransactions - statsStart.nFullyShieldedTransactions;
+        window.nShieldedSpends = statsEnd.nShieldedSpends - statsStart.nShieldedSpends;
+        window.nShieldedOutputs = statsEnd.nShieldedOutputs - statsStart.nShieldedOutputs;
+        window.nFees = statsEnd.nFees - statsStart.nFees;
+        window.nSupply = statsEnd.nSupply - statsStart.nSupply;
+        window.nSproutValue = statsEnd.nSproutValue - statsStart.nSproutValue;
+        window.nSaplingValue = statsEnd.nSaplingValue - statsStart.nSaplingValue;
+        window.nZeronodePayouts = statsEnd.nZeronodePayouts - statsStart.nZeronodePayouts;
+
+        UniValue objWindow(UniValue::VOBJ);
+        objWindow.push_back(Pair("blocks", pindexEnd->nHeight - pindexStart->nHeight));
+        ChainStatsToJSON(objWindow, window);
+        ret.push_back(Pair("window", objWindow));
+    }
+    return ret;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -703,7 +1001,8 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "12800")
         );
 
-    LOCK(cs_main);
+    // Blocks are read from the chain snapshot and disk, without cs_main
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
 
     std::string strHash = params[0].get_str();
 
@@ -723,10 +1022,10 @@ UniValue getblock(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
         }
 
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
+        if (nHeight < 0 || nHeight > chain->Height()) {
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
         }
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
+        strHash = (*chain)[nHeight]->GetBlockHash().GetHex();
     }
 
     uint256 hash(uint256S(strHash));
@@ -744,15 +1043,22 @@ UniValue getblock(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
     }
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
+    if (verbosity == 0)
+    {
+        std::shared_ptr<const CRecentBlock> pcached = recentBlocks.Get(hash);
+        if (pcached)
+            return HexStr(pcached->vchBlock.begin(), pcached->vchBlock.end());
+    }
+
     if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -764,16 +1070,39 @@ UniValue getblock(const UniValue& params, bool fHelp)
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    if (verbosity < 2 || !RPCCanStreamResult())
+        return blockToJSON(block, pblockindex, verbosity >= 2);
+
+    // Decode each transaction as it is sent, not the whole block up front
+    UniValue header = blockToJSON(block, pblockindex, false);
+    std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(block);
+    RPCStreamResult([header, pblock](CJSONStreamWriter& json) {
+        WriteObjectWithMember(json, header, "tx", [pblock](CJSONStreamWriter& json) {
+            json.BeginArray();
+            for (size_t i = 0; i < pblock->vtx.size(); i++) {
+                UniValue objTx(UniValue::VOBJ);
+                TxToJSON(pblock->vtx[i], uint256(), objTx);
+                json.Value(objTx);
+            }
+            json.EndArray();
+        });
+    });
+    return NullUniValue;
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time. The set is read from a consistent snapshot of the\n"
+            "chainstate, while blocks keep being connected.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"hash_serialized\") What to hash the set with:\n"
+            "                   \"hash_serialized\" hashes the outputs in order, on one thread;\n"
+            "                   \"commitment\" adds up the hashes of the outputs, read on several threads;\n"
+            "                   \"none\" only counts them, on several threads\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -781,17 +1110,29 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, with \"hash_serialized\"\n"
+            "  \"commitment\": \"hash\",        (string) The order-independent commitment to the set, with \"commitment\"\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
-            + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"commitment\"")
+            + HelpExampleRpc("gettxoutsetinfo", "\"none\"")
         );
 
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
+    std::string strHashType = params.size() > 0 ? params[0].get_str() : "hash_serialized";
+    if (strHashType == "hash_serialized")
+        stats.hashType = COINSTATS_HASH_SERIALIZED;
+    else if (strHashType == "commitment")
+        stats.hashType = COINSTATS_HASH_COMMITMENT;
+    else if (strHashType == "none")
+        stats.hashType = COINSTATS_HASH_NONE;
+    else
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
@@ -799,12 +1140,75 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        if (stats.hashType == COINSTATS_HASH_SERIALIZED)
+            ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        else if (stats.hashType == COINSTATS_HASH_COMMITMENT)
+            ret.push_back(Pair("commitment", stats.hashCommitment.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrite a snapshot of the unspent transaction output set and the shielded anchors and nullifiers\n"
+            "at the current tip, which an empty node can load with -loadsnapshot.\n"
+            "Note this call may take some time and blocks the node while it runs.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The snapshot file, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,               (numeric) The height of the snapshot block\n"
+            "  \"bestblock\": \"hex\",       (string) The snapshot block hash\n"
+            "  \"records\": n,             (numeric) The number of coin, anchor and nullifier records written\n"
+            "  \"hash_serialized\": \"hash\", (string) The gettxoutsetinfo hash_serialized of the coins\n"
+            "  \"snapshot_hash\": \"hash\",   (string) The hash committing to the whole snapshot\n"
+            "  \"path\": \"path\"            (string) The file written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+
+    LOCK(cs_main);
+    FlushStateToDisk();
+
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTmp.string() + " for writing");
+
+    CChainstateSnapshotHeader header;
+    uint64_t nRecords;
+    uint256 hashSnapshot;
+    bool fWritten = pcoinsdbview->WriteSnapshot(fileout, header, nRecords, hashSnapshot);
+    if (fWritten)
+        FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!fWritten || !RenameOver(pathTmp, path)) {
+        boost::filesystem::remove(pathTmp);
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write snapshot to " + path.string());
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", mapBlockIndex[header.hashBlock]->nHeight));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("records", (int64_t)nRecords));
+    ret.push_back(Pair("hash_serialized", header.hashSerialized.GetHex()));
+    ret.push_back(Pair("snapshot_hash", hashSnapshot.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -1127,18 +1531,10 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    /* Build up a list of chain tips.  We start with the list of all
-       known blocks, and successively remove blocks that appear as pprev
-       of another block.  */
+    /* The blocks nothing builds on are kept as entries are added, so
+       this only sorts them by height.  */
     std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
-    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
-        setTips.insert(item.second);
-    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        const CBlockIndex* pprev = item.second->pprev;
-        if (pprev)
-            setTips.erase(pprev);
-    }
+    setTips.insert(setChainTips.begin(), setChainTips.end());
 
     // Always report the currently active tip.
     setTips.insert(chainActive.Tip());
@@ -1188,6 +1584,7 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("sequence", mempool.GetSequence()));
 
     if (Params().NetworkIDString() == "regtest") {
         ret.push_back(Pair("fullyNotified", mempool.IsFullyNotified()));
@@ -1207,6 +1604,7 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"sequence\": xxxxx            (numeric) Mempool sequence number, see getrawmempool since_sequence\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1216,6 +1614,67 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+static UniValue mempoolStatsEntryToJSON(const CMemPoolStatsEntry& entry)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", entry.nCount));
+    obj.push_back(Pair("bytes", entry.nBytes));
+    obj.push_back(Pair("usage", entry.nUsage));
+    obj.push_back(Pair("cost", entry.nCost));
+    obj.push_back(Pair("fees", ValueFromAmount(entry.nFees)));
+    return obj;
+}
+
+UniValue getmempoolstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmempoolstats\n"
+            "\nReturns the TX memory pool broken out by transaction class and by fee rate.\n"
+            "Each group reports the same fields:\n"
+            "  \"count\": xxxxx               (numeric) Number of transactions\n"
+            "  \"bytes\": xxxxx               (numeric) Sum of their sizes\n"
+            "  \"usage\": xxxxx               (numeric) Their memory usage in the mempool\n"
+            "  \"cost\": xxxxx                (numeric) Their cost counted against -mempooltxcostlimit\n"
+            "  \"fees\": xxxxx                (numeric) Sum of their fees in " + CURRENCY_UNIT + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"classes\": {                 (json object) one group per class: transparent, sprout, sapling,\n"
+            "                                 collateral (pays a zeronode collateral) and locked (SwiftTX lock request)\n"
+            "    \"class\": { ... }\n"
+            "  },\n"
+            "  \"feerates\": [                (json array) one group per fee rate bucket, lowest first\n"
+            "    {\n"
+            "      \"minfeerate\": xxxxx       (numeric) Lowest fee rate in the bucket, in " + CURRENCY_UNIT + "/kB\n"
+            "      ...\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolstats", "")
+            + HelpExampleRpc("getmempoolstats", "")
+        );
+
+    CMemPoolStats stats = mempool.GetStats();
+
+    UniValue classes(UniValue::VOBJ);
+    for (int i = 0; i < MEMPOOL_TX_CLASS_COUNT; i++) {
+        classes.push_back(Pair(GetMemPoolTxClassName((MemPoolTxClass)i), mempoolStatsEntryToJSON(stats.classes[i])));
+    }
+
+    UniValue feerates(UniValue::VARR);
+    for (size_t i = 0; i < stats.vFeeRates.size(); i++) {
+        UniValue bucket = mempoolStatsEntryToJSON(stats.vFeeRates[i]);
+        bucket.push_back(Pair("minfeerate", ValueFromAmount(stats.vFeeRateBounds[i])));
+        feerates.push_back(bucket);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("classes", classes));
+    ret.push_back(Pair("feerates", feerates));
+    return ret;
+}
+
 inline CBlockIndex* LookupBlockIndex(const uint256& hash)
 {
     AssertLockHeld(cs_main);
@@ -1524,6 +1983,54 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue getperfstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getperfstats ( reset )\n"
+            "\nReturns histograms of the time spent validating blocks and transactions\n"
+            "since startup or the last reset, in microseconds.\n"
+            "\nArguments:\n"
+            "1. reset          (boolean, optional, default=false) Clear the histograms after reading them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {              (string) The timing, for instance connecttip, verify, mempoolaccept or saplingproofs\n"
+            "    \"count\": n,          (numeric) The number of times recorded\n"
+            "    \"sum\": n,            (numeric) Their total\n"
+            "    \"max\": n,            (numeric) The longest\n"
+            "    \"p50\": n,            (numeric) The median, estimated within a factor of two\n"
+            "    \"p90\": n,            (numeric) The 90th percentile\n"
+            "    \"p99\": n             (numeric) The 99th percentile\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getperfstats", "")
+            + HelpExampleCli("getperfstats", "true")
+            + HelpExampleRpc("getperfstats", "")
+        );
+
+    bool fReset = params.size() > 0 && params[0].get_bool();
+
+    UniValue obj(UniValue::VOBJ);
+    for (int i = 0; i < PERF_STAT_COUNT; i++) {
+        PerfStat stat = (PerfStat)i;
+        CTimingHistogram& histogram = GetPerfStat(stat);
+        CTimingHistogram::Summary summary = histogram.GetSummary();
+        if (fReset)
+            histogram.Reset();
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("count", summary.nCount));
+        entry.push_back(Pair("sum", summary.nSum));
+        entry.push_back(Pair("max", summary.nMax));
+        entry.push_back(Pair("p50", summary.p50));
+        entry.push_back(Pair("p90", summary.p90));
+        entry.push_back(Pair("p99", summary.p99));
+        obj.push_back(Pair(GetPerfStatName(stat), entry));
+    }
+    return obj;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1532,6 +2039,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
     { "blockchain",         "getblock",               &getblock,               true  },
     { "blockchain",         "getblockdeltas",         &getblockdeltas,         true  },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true  },
+    { "blockchain",         "getchainstats",          &getchainstats,          true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
@@ -1539,9 +2048,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
+    { "blockchain",         "getmempoolstats",        &getmempoolstats,        true  },
+    { "blockchain",         "getperfstats",           &getperfstats,           true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     // insightexplorer
@@ -0,0 +1,290 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/cbor.h"
+
+#include "utilstrencodings.h"
+
+#include <limits>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <univalue.h>
+
+namespace {
+
+enum CBORMajorType
+{
+    CBOR_UINT = 0,
+    CBOR_NEGINT = 1,
+    CBOR_BYTES = 2,
+    CBOR_TEXT = 3,
+    CBOR_ARRAY = 4,
+    CBOR_MAP = 5,
+    CBOR_TAG = 6,
+    CBOR_SIMPLE = 7,
+};
+
+static const unsigned char CBOR_FALSE = 0xf4;
+static const unsigned char CBOR_TRUE = 0xf5;
+static const unsigned char CBOR_NULL = 0xf6;
+static const unsigned char CBOR_FLOAT16 = 0xf9;
+static const unsigned char CBOR_FLOAT32 = 0xfa;
+static const unsigned char CBOR_FLOAT64 = 0xfb;
+
+void WriteHead(std::string& out, int nMajor, uint64_t n)
+{
+    unsigned char major = nMajor << 5;
+    int nBytes;
+    if (n < 24) {
+        out += (char)(major | n);
+        return;
+    } else if (n <= 0xff) {
+        out += (char)(major | 24);
+        nBytes = 1;
+    } else if (n <= 0xffff) {
+        out += (char)(major | 25);
+        nBytes = 2;
+    } else if (n <= 0xffffffffULL) {
+        out += (char)(major | 26);
+        nBytes = 4;
+    } else {
+        out += (char)(major | 27);
+        nBytes = 8;
+    }
+    for (int i = nBytes - 1; i >= 0; i--)
+        out += (char)(n >> (8 * i));
+}
+
+void WriteText(std::string& out, const std::string& str)
+{
+    WriteHead(out, CBOR_TEXT, str.size());
+    out += str;
+}
+
+void WriteNumber(std::string& out, const std::string& str)
+{
+    int64_t n;
+    if (ParseInt64(str, &n)) {
+        if (n >= 0)
+            WriteHead(out, CBOR_UINT, n);
+        else
+            WriteHead(out, CBOR_NEGINT, -(n + 1));
+        return;
+    }
+    double d = 0;
+    ParseDouble(str, &d);
+    uint64_t bits;
+    static_assert(sizeof(bits) == sizeof(d), "double must be 64 bits");
+    memcpy(&bits, &d, sizeof(bits));
+    out += (char)CBOR_FLOAT64;
+    for (int i = 7; i >= 0; i--)
+        out += (char)(bits >> (8 * i));
+}
+
+void Encode(std::string& out, const UniValue& value)
+{
+    switch (value.getType()) {
+    case UniValue::VNULL:
+        out += (char)CBOR_NULL;
+        break;
+    case UniValue::VBOOL:
+        out += (char)(value.isTrue() ? CBOR_TRUE : CBOR_FALSE);
+        break;
+    case UniValue::VNUM:
+        WriteNumber(out, value.getValStr());
+        break;
+    case UniValue::VSTR:
+        WriteText(out, value.getValStr());
+        break;
+    case UniValue::VARR: {
+        const std::vector<UniValue>& values = value.getValues();
+        WriteHead(out, CBOR_ARRAY, values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            Encode(out, values[i]);
+        break;
+    }
+    case UniValue::VOBJ: {
+        const std::vector<std::string>& keys = value.getKeys();
+        const std::vector<UniValue>& values = value.getValues();
+        WriteHead(out, CBOR_MAP, keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            WriteText(out, keys[i]);
+            Encode(out, values[i]);
+        }
+        break;
+    }
+    }
+}
+
+class CBORReader
+{
+private:
+    const std::string& str;
+    size_t nPos;
+
+    bool ReadBytes(int nBytes, uint64_t& n)
+    {
+        if (str.size() - nPos < (size_t)nBytes)
+            return false;
+        n = 0;
+        for (int i = 0; i < nBytes; i++)
+            n = (n << 8) | (unsigned char)str[nPos++];
+        return true;
+    }
+
+    /** Read the head of an item: its major type and argument */
+    bool ReadHead(int& nMajor, int& nInfo, uint64_t& n)
+    {
+        if (nPos >= str.size())
+            return false;
+        unsigned char head = str[nPos++];
+        nMajor = head >> 5;
+        nInfo = head & 0x1f;
+        if (nInfo < 24) {
+            n = nInfo;
+            return true;
+        }
+        switch (nInfo) {
+        case 24: return ReadBytes(1, n);
+        case 25: return ReadBytes(2, n);
+        case 26: return ReadBytes(4, n);
+        case 27: return ReadBytes(8, n);
+        }
+        // Reserved values and indefinite lengths
+        return false;
+    }
+
+    bool ReadText(uint64_t nLen, std::string& text)
+    {
+        if (str.size() - nPos < nLen)
+            return false;
+        text.assign(str, nPos, nLen);
+        nPos += nLen;
+        return true;
+    }
+
+public:
+    CBORReader(const std::string& strIn) : str(strIn), nPos(0) {}
+
+    bool AtEnd() const { return nPos == str.size(); }
+
+    bool Read(UniValue& value, unsigned int nDepth)
+    {
+        int nMajor, nInfo;
+        uint64_t n;
+        if (!ReadHead(nMajor, nInfo, n))
+            return false;
+
+        switch (nMajor) {
+        case CBOR_UINT:
+            if (n > (uint64_t)std::numeric_limits<int64_t>::max())
+                value = UniValue(n);
+            else
+                value = UniValue((int64_t)n);
+            return true;
+        case CBOR_NEGINT:
+            if (n > (uint64_t)std::numeric_limits<int64_t>::max())
+                return false;
+            value = UniValue(-(int64_t)n - 1);
+            return true;
+        case CBOR_TEXT: {
+            std::string text;
+            if (!ReadText(n, text))
+                return false;
+            value = UniValue(text);
+            return true;
+        }
+        case CBOR_ARRAY: {
+            // Every item takes at least one byte, which bounds the size
+            if (nDepth >= MAX_CBOR_DEPTH || n > str.size() - nPos)
+                return false;
+            value = UniValue(UniValue::VARR);
+            for (uint64_t i = 0; i < n; i++) {
+                UniValue item;
+                if (!Read(item, nDepth + 1))
+                    return false;
+                value.push_back(item);
+            }
+            return true;
+        }
+        case CBOR_MAP: {
+            if (nDepth >= MAX_CBOR_DEPTH || n > (str.size() - nPos) / 2)
+                return false;
+            value = UniValue(UniValue::VOBJ);
+            for (uint64_t i = 0; i < n; i++) {
+                int nKeyMajor, nKeyInfo;
+                uint64_t nKeyLen;
+                std::string key;
+                if (!ReadHead(nKeyMajor, nKeyInfo, nKeyLen) || nKeyMajor != CBOR_TEXT || !ReadText(nKeyLen, key))
+                    return false;
+                UniValue item;
+                if (!Read(item, nDepth + 1))
+                    return false;
+                value.pushKV(key, item);
+            }
+            return true;
+        }
+        case CBOR_SIMPLE: {
+            unsigned char head = (CBOR_SIMPLE << 5) | nInfo;
+            if (head == CBOR_FALSE || head == CBOR_TRUE) {
+                value = UniValue(head == CBOR_TRUE);
+                return true;
+            } else if (head == CBOR_NULL) {
+                value = NullUniValue;
+                return true;
+            }
+            double d;
+            if (head == CBOR_FLOAT16) {
+                int nExp = (n >> 10) & 0x1f;
+                double mant = n & 0x3ff;
+                if (nExp == 0)
+                    d = ldexp(mant, -24);
+                else if (nExp != 31)
+                    d = ldexp(mant + 1024, nExp - 25);
+                else
+                    return false;
+                if (n & 0x8000)
+                    d = -d;
+            } else if (head == CBOR_FLOAT32) {
+                uint32_t bits = n;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                d = f;
+            } else if (head == CBOR_FLOAT64) {
+                memcpy(&d, &n, sizeof(d));
+            } else {
+                return false;
+            }
+            // JSON has no infinities or NaN
+            if (!isfinite(d))
+                return false;
+            value = UniValue(d);
+            return true;
+        }
+        }
+        // Byte strings and tags
+        return false;
+    }
+};
+
+} // anon namespace
+
+std::string EncodeCBOR(const UniValue& value)
+{
+    std::string out;
+    Encode(out, value);
+    return out;
+}
+
+bool DecodeCBOR(const std::string& str, UniValue& value)
+{
+    CBORReader reader(str);
+    UniValue result;
+    if (!reader.Read(result, 0) || !reader.AtEnd())
+        return false;
+    value = result;
+    return true;
+}
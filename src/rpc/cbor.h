@@ -0,0 +1,34 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_RPC_CBOR_H
+#define BITCOIN_RPC_CBOR_H
+
+#include <string>
+
+class UniValue;
+
+/** Media type of CBOR encoded RPC requests and replies */
+static const char* const CBOR_CONTENT_TYPE = "application/cbor";
+
+/** Deepest nesting of arrays and maps DecodeCBOR accepts */
+static const unsigned int MAX_CBOR_DEPTH = 64;
+
+/**
+ * Encode a JSON value as CBOR (RFC 7049), a compact binary form that is
+ * cheaper to produce and parse than JSON text. Integral numbers become
+ * CBOR integers, other numbers 64-bit floats, and objects maps with text
+ * keys, in order.
+ */
+std::string EncodeCBOR(const UniValue& value);
+
+/**
+ * Decode a CBOR item into a JSON value. Byte strings, tags, undefined and
+ * indefinite length items have no JSON counterpart and are rejected, as
+ * are maps with keys that are not text. Returns false if str is not
+ * exactly one such item.
+ */
+bool DecodeCBOR(const std::string& str, UniValue& value);
+
+#endif // BITCOIN_RPC_CBOR_H
@@ -93,12 +93,18 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "lockunspent", 1 },
     { "importprivkey", 2 },
     { "importaddress", 2 },
+    { "getperfstats", 0 },
+    { "getlockstats", 0 },
+    { "getlockstats", 1 },
     { "verifychain", 0 },
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getrawmempool", 1 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
+    { "estimatesmartfee", 0 },
+    { "estimatesmartpriority", 0 },
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
     { "setban", 2 },
@@ -119,6 +125,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
     { "getblocksubsidy", 0},
     { "z_listaddresses", 0},
     { "z_listreceivedbyaddress", 1},
@@ -142,6 +149,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_getoperationstatus", 0},
     { "z_getoperationresult", 0},
     { "z_importkey", 2 },
+    { "z_getnewaddresses", 0 },
+    { "z_importkeys", 0 },
+    { "z_importkeys", 2 },
     { "z_importviewingkey", 2 },
     { "z_getpaymentdisclosure", 1},
     { "z_getpaymentdisclosure", 2},
@@ -152,22 +162,18 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zs_listtransactions", 1},
     { "zs_listtransactions", 2},
     { "zs_listtransactions", 3},
-    { "zs_listtransactions", 4},
     { "zs_listsentbyaddress", 1},
     { "zs_listsentbyaddress", 2},
     { "zs_listsentbyaddress", 3},
     { "zs_listsentbyaddress", 4},
-    { "zs_listsentbyaddress", 5},
     { "zs_listreceivedbyaddress", 1},
     { "zs_listreceivedbyaddress", 2},
     { "zs_listreceivedbyaddress", 3},
     { "zs_listreceivedbyaddress", 4},
-    { "zs_listreceivedbyaddress", 5},
     { "zs_listspentbyaddress", 1},
     { "zs_listspentbyaddress", 2},
     { "zs_listspentbyaddress", 3},
     { "zs_listspentbyaddress", 4},
-    { "zs_listspentbyaddress", 5},
     { "getsupply", 0},
     { "getsupply", 1},
     { "getsaplingwitness", 1},
@@ -178,7 +184,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getsaplingblocks", 0},
     { "getsaplingblocks", 1},
     { "getsaplingblocks", 2},
+    { "getcompactsaplingblocks", 0},
+    { "getcompactsaplingblocks", 1},
     { "getchaintxstats", 0},
+    { "getchainstats", 0},
+    { "getchainstats", 1},
     
 };
 
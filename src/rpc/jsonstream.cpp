@@ -0,0 +1,155 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/jsonstream.h"
+
+#include "tinyformat.h"
+
+#include <assert.h>
+
+#include <univalue.h>
+
+CJSONStreamWriter::CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fAfterKey(false), fFailed(false)
+{
+    buf.reserve(nFlushSize + 1024);
+}
+
+void CJSONStreamWriter::BeginValue()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty()) {
+        if (!vFirst.back())
+            buf += ',';
+        vFirst.back() = false;
+    }
+}
+
+void CJSONStreamWriter::WriteString(const std::string& str)
+{
+    // Same escapes as UniValue::write()
+    buf += '"';
+    for (size_t i = 0; i < str.size(); i++) {
+        unsigned char ch = str[i];
+        switch (ch) {
+        case '"': buf += "\\\""; break;
+        case '\\': buf += "\\\\"; break;
+        case '\b': buf += "\\b"; break;
+        case '\t': buf += "\\t"; break;
+        case '\n': buf += "\\n"; break;
+        case '\f': buf += "\\f"; break;
+        case '\r': buf += "\\r"; break;
+        default:
+            if (ch < 0x20 || ch == 0x7f)
+                buf += strprintf("\\u%04x", ch);
+            else
+                buf += ch;
+        }
+    }
+    buf += '"';
+}
+
+void CJSONStreamWriter::MaybeFlush()
+{
+    if (buf.size() >= nFlushSize)
+        Flush();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    BeginValue();
+    buf += '{';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    buf += '}';
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    BeginValue();
+    buf += '[';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    buf += ']';
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    BeginValue();
+    WriteString(key);
+    buf += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& value)
+{
+    switch (value.getType()) {
+    case UniValue::VNULL:
+        BeginValue();
+        buf += "null";
+        break;
+    case UniValue::VOBJ: {
+        BeginObject();
+        const std::vector<std::string>& keys = value.getKeys();
+        const std::vector<UniValue>& values = value.getValues();
+        for (size_t i = 0; i < keys.size(); i++) {
+            Key(keys[i]);
+            Value(values[i]);
+        }
+        EndObject();
+        break;
+    }
+    case UniValue::VARR: {
+        BeginArray();
+        const std::vector<UniValue>& values = value.getValues();
+        for (size_t i = 0; i < values.size(); i++)
+            Value(values[i]);
+        EndArray();
+        break;
+    }
+    case UniValue::VSTR:
+        BeginValue();
+        WriteString(value.getValStr());
+        break;
+    case UniValue::VNUM:
+        BeginValue();
+        buf += value.getValStr();
+        break;
+    case UniValue::VBOOL:
+        BeginValue();
+        buf += value.isTrue() ? "true" : "false";
+        break;
+    }
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::Raw(const std::string& str)
+{
+    buf += str;
+    MaybeFlush();
+}
+
+bool CJSONStreamWriter::Flush()
+{
+    if (!fFailed && !buf.empty() && !sink(buf))
+        fFailed = true;
+    buf.clear();
+    return !fFailed;
+}
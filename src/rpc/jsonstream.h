@@ -0,0 +1,62 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_RPC_JSONSTREAM_H
+#define BITCOIN_RPC_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class UniValue;
+
+/** Bytes of JSON collected before they are handed to the sink */
+static const size_t JSON_STREAM_FLUSH_SIZE = 64 * 1024;
+
+/**
+ * Writes compact JSON, in the same form as UniValue::write(), to a sink in
+ * pieces of about JSON_STREAM_FLUSH_SIZE bytes. Large results can be
+ * written one element at a time, and even a UniValue given to Value() is
+ * serialized without building its text in full. Once the sink returns
+ * false everything written afterwards is dropped.
+ */
+class CJSONStreamWriter
+{
+public:
+    typedef std::function<bool(const std::string&)> Sink;
+
+private:
+    Sink sink;
+    size_t nFlushSize;
+    std::string buf;
+    //! For every open object or array, whether it has no members yet
+    std::vector<bool> vFirst;
+    //! A key was written and its value is next
+    bool fAfterKey;
+    bool fFailed;
+
+    void BeginValue();
+    void WriteString(const std::string& str);
+    void MaybeFlush();
+
+public:
+    CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn = JSON_STREAM_FLUSH_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Write the key of the next member of the current object */
+    void Key(const std::string& key);
+    /** Write a complete value */
+    void Value(const UniValue& value);
+    /** Append text as it is, outside of any value (for instance a trailing newline) */
+    void Raw(const std::string& str);
+
+    /** Hand everything written so far to the sink; returns false once the sink failed */
+    bool Flush();
+    bool Failed() const { return fFailed; }
+};
+
+#endif // BITCOIN_RPC_JSONSTREAM_H
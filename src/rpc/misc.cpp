@@ -3,23 +3,36 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#include "addrman.h"
+#include "blockcache.h"
 #include "clientversion.h"
+#include "httpserver.h"
 #include "init.h"
 #include "key_io.h"
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "proofcache.h"
+#include "rpc/jsonstream.h"
+#include "rpc/resultcache.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
+#include "support/hugepages.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "zeronode/budget.h"
+#include "zeronode/payments.h"
+#include "zeronode/zeronodeman.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #include "wallet/rpczerowallet.h"
 #endif
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
@@ -486,6 +499,353 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+static UniValue WorkStatsToJSON(const HTTPWorkStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("queued", (uint64_t)stats.nQueued));
+    obj.push_back(Pair("running", stats.nRunning));
+    obj.push_back(Pair("done", stats.nDone));
+    obj.push_back(Pair("rejected", stats.nRejected));
+    obj.push_back(Pair("avgwait", stats.nDone ? stats.nWaitTime / (int64_t)stats.nDone : 0));
+    obj.push_back(Pair("maxwait", stats.nMaxWaitTime));
+    obj.push_back(Pair("avgtime", stats.nDone ? stats.nRunTime / (int64_t)stats.nDone : 0));
+    return obj;
+}
+
+UniValue getrpcqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcqueueinfo\n"
+            "\nReturns statistics of the RPC work queue, per priority class and per method.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"classes\": {\n"
+            "    \"high\": {                 (json object) statistics of a priority class: high, normal or low\n"
+            "      \"queued\": n,            (numeric) calls waiting in the queue\n"
+            "      \"running\": n,           (numeric) calls running now\n"
+            "      \"done\": n,              (numeric) calls finished\n"
+            "      \"rejected\": n,          (numeric) calls rejected because the queue was full\n"
+            "      \"avgwait\": n,           (numeric) average time finished calls waited in the queue, in microseconds\n"
+            "      \"maxwait\": n,           (numeric) longest time a finished call waited in the queue, in microseconds\n"
+            "      \"avgtime\": n            (numeric) average time finished calls ran, in microseconds\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"methods\": {\n"
+            "    \"method\": {               (json object) the same statistics of each method called so far\n"
+            "      ...\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcqueueinfo", "")
+            + HelpExampleRpc("getrpcqueueinfo", "")
+        );
+
+    std::vector<HTTPWorkStats> vClassStats;
+    std::map<std::string, HTTPWorkStats> mapNameStats;
+    if (!HTTPGetWorkStats(vClassStats, mapNameStats))
+        throw JSONRPCError(RPC_MISC_ERROR, "HTTP server not running");
+
+    UniValue classes(UniValue::VOBJ);
+    for (size_t i = 0; i < vClassStats.size(); i++)
+        classes.push_back(Pair(HTTPWorkPriorityName((HTTPWorkPriority)i), WorkStatsToJSON(vClassStats[i])));
+    UniValue methods(UniValue::VOBJ);
+    for (const auto& it : mapNameStats)
+        methods.push_back(Pair(it.first, WorkStatsToJSON(it.second)));
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("classes", classes));
+    result.push_back(Pair("methods", methods));
+    return result;
+}
+
+UniValue getrpccacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpccacheinfo\n"
+            "\nReturns statistics of the cache of RPC results that only depend on the chain tip.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hits\": n,         (numeric) calls answered from the cache\n"
+            "  \"misses\": n,       (numeric) cacheable calls that were run\n"
+            "  \"evictions\": n,    (numeric) results dropped to make room for others\n"
+            "  \"entries\": n,      (numeric) results in the cache\n"
+            "  \"usage\": n,        (numeric) approximate memory used by the cache, in bytes\n"
+            "  \"maxusage\": n      (numeric) memory the cache may use (-rpccachesize), in bytes\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpccacheinfo", "")
+            + HelpExampleRpc("getrpccacheinfo", "")
+        );
+
+    RPCResultCacheStats stats = RPCResultCacheGetStats();
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("hits", stats.nHits));
+    result.push_back(Pair("misses", stats.nMisses));
+    result.push_back(Pair("evictions", stats.nEvictions));
+    result.push_back(Pair("entries", (uint64_t)stats.nEntries));
+    result.push_back(Pair("usage", (uint64_t)stats.nUsage));
+    result.push_back(Pair("maxusage", (uint64_t)stats.nMaxUsage));
+    return result;
+}
+
+static bool LockStatsByWait(const CLockSite::Stats& a, const CLockSite::Stats& b)
+{
+    if (a.nWaitMicros != b.nWaitMicros)
+        return a.nWaitMicros > b.nWaitMicros;
+    return a.nAcquisitions > b.nAcquisitions;
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getlockstats ( count reset )\n"
+            "\nReturns the lock sites that waited the longest for their locks since lock statistics\n"
+            "were enabled (-lockstats) or last reset. Times are in microseconds.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional, default=20) The number of sites to return, 0 for all\n"
+            "2. reset          (boolean, optional, default=false) Clear the statistics after reading them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,  (boolean) Whether lock statistics are being collected\n"
+            "  \"sites\": [              (array) The sites, those that waited longest first\n"
+            "    {\n"
+            "      \"lock\": \"name\",       (string) The lock, as written at the site\n"
+            "      \"site\": \"file:line\",  (string) Where it is taken\n"
+            "      \"acquisitions\": n,    (numeric) The number of times it was taken there\n"
+            "      \"contentions\": n,     (numeric) How many of those had to wait for another thread\n"
+            "      \"wait\": n,            (numeric) The total time spent waiting\n"
+            "      \"maxwait\": n,         (numeric) The longest wait\n"
+            "      \"hold\": n             (numeric) The total time the lock was held from there\n"
+            "    },\n"
+            "    ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "50 true")
+            + HelpExampleRpc("getlockstats", "")
+        );
+
+    int nCount = params.size() > 0 ? params[0].get_int() : 20;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count");
+    bool fReset = params.size() > 1 && params[1].get_bool();
+
+    std::vector<CLockSite::Stats> vStats = GetLockStats();
+    if (fReset)
+        ResetLockStats();
+    std::sort(vStats.begin(), vStats.end(), LockStatsByWait);
+    if (nCount > 0 && vStats.size() > (size_t)nCount)
+        vStats.resize(nCount);
+
+    UniValue sites(UniValue::VARR);
+    for (const CLockSite::Stats& stats : vStats) {
+        UniValue site(UniValue::VOBJ);
+        site.push_back(Pair("lock", stats.name));
+        site.push_back(Pair("site", stats.location));
+        site.push_back(Pair("acquisitions", stats.nAcquisitions));
+        site.push_back(Pair("contentions", stats.nContentions));
+        site.push_back(Pair("wait", stats.nWaitMicros));
+        site.push_back(Pair("maxwait", stats.nMaxWaitMicros));
+        site.push_back(Pair("hold", stats.nHoldMicros));
+        sites.push_back(site);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("enabled", fLockStats.load()));
+    result.push_back(Pair("sites", sites));
+    return result;
+}
+
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmemoryinfo\n"
+            "\nReturns estimates of the heap memory held by the node's data structures, in bytes.\n"
+            "They are computed from the sizes of the containers, without a heap profiler, so they\n"
+            "leave out allocator overhead and the memory of LevelDB and the RPC and network threads.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockindex\": {           (object) mapBlockIndex, the tip candidates and the active chain\n"
+            "    \"entries\": n,           (numeric) The number of block index entries\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"coins\": {\n"
+            "    \"tip\": n,               (numeric) The coins, anchors and nullifiers cache over the database\n"
+            "    \"tipentries\": n,        (numeric) The number of transactions in the tip cache\n"
+            "    \"flushing\": n,          (numeric) The entries being written in the background\n"
+            "    \"limit\": n              (numeric) The cache size the tip is flushed at (-dbcache)\n"
+            "  },\n"
+            "  \"mempool\": {\n"
+            "    \"transactions\": n,      (numeric) The entries and the transactions in them\n"
+            "    \"links\": n,             (numeric) The parents and children of every entry\n"
+            "    \"spends\": n,            (numeric) The spent outputs and nullifiers\n"
+            "    \"addressindex\": n,      (numeric) The address and spent indexes (-insightexplorer)\n"
+            "    \"other\": n,             (numeric) Priority deltas, recent additions, lock requests, changes and evictions\n"
+            "    \"total\": n\n"
+            "  },\n"
+            "  \"recentblocks\": n,        (numeric) The cache of recently connected blocks\n"
+            "  \"recentheaders\": n,       (numeric) The serialized headers served to peers (-headercache)\n"
+            "  \"recenttransactions\": n,  (numeric) The transactions read from disk most recently (-txcache)\n"
+            "  \"wallet\": {               (object) Only with the wallet enabled\n"
+            "    \"transactions\": n,      (numeric) mapWallet, with the transactions and their note data\n"
+            "    \"txcount\": n,           (numeric) The number of wallet transactions\n"
+            "    \"witnesses\": n,         (numeric) The cached note witnesses\n"
+            "    \"indexes\": n,           (numeric) Spends, nullifiers, positions, the Sapling note index and the spend caches\n"
+            "    \"total\": n\n"
+            "  },\n"
+            "  \"zeronodes\": {\n"
+            "    \"list\": n,              (numeric) The zeronode list, its indexes and the list requests\n"
+            "    \"count\": n,             (numeric) The number of zeronodes\n"
+            "    \"budgets\": n,           (numeric) Proposals, finalized budgets and their votes\n"
+            "    \"payments\": n           (numeric) Payee votes and block payees\n"
+            "  },\n"
+            "  \"addrman\": {\n"
+            "    \"addresses\": n,         (numeric) The number of known addresses\n"
+            "    \"usage\": n\n"
+            "  },\n"
+            "  \"peers\": {\n"
+            "    \"count\": n,             (numeric) The number of connected peers\n"
+            "    \"buffers\": n,           (numeric) Their send and receive buffers\n"
+            "    \"maxbuffers\": n         (numeric) The buffers of the peer holding the most\n"
+            "  },\n"
+            "  \"sigcache\": n,            (numeric) The signature cache (-maxsigcachesize)\n"
+            "  \"proofcache\": n,          (numeric) The shielded proof cache (-maxproofcachesize)\n"
+            "  \"total\": n                (numeric) The sum of the estimates above\n"
+            "  \"hugepages\": {            (object) Memory mapped for huge pages; that of the coins cache and block index is also in the estimates above\n"
+            "    \"mode\": \"xxxx\",         (string) off, transparent or reserved (-hugepages)\n"
+            "    \"mapped\": n,             (numeric) Every such mapping, including the Equihash solver's\n"
+            "    \"reserved\": n,           (numeric) Of that, on reserved huge pages\n"
+            "    \"transparent\": n,        (numeric) Of that, advised to use transparent huge pages; the kernel may still use small pages\n"
+            "    \"reservedfailures\": n    (numeric) Mappings that fell back to transparent huge pages as no reserved ones were left\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmemoryinfo", "")
+            + HelpExampleRpc("getmemoryinfo", "")
+        );
+
+    UniValue result(UniValue::VOBJ);
+    size_t nTotal = 0;
+
+    {
+        LOCK(cs_main);
+        size_t nBlockIndex = GetBlockIndexMemoryUsage();
+        UniValue blockindex(UniValue::VOBJ);
+        blockindex.push_back(Pair("entries", (uint64_t)mapBlockIndex.size()));
+        blockindex.push_back(Pair("usage", (uint64_t)nBlockIndex));
+        result.push_back(Pair("blockindex", blockindex));
+
+        size_t nCoinsTip = pcoinsTip ? pcoinsTip->DynamicMemoryUsage() : 0;
+        size_t nCoinsFlushing = pcoinsflusher ? pcoinsflusher->DynamicMemoryUsage() : 0;
+        UniValue coins(UniValue::VOBJ);
+        coins.push_back(Pair("tip", (uint64_t)nCoinsTip));
+        coins.push_back(Pair("tipentries", (uint64_t)(pcoinsTip ? pcoinsTip->GetCacheSize() : 0)));
+        coins.push_back(Pair("flushing", (uint64_t)nCoinsFlushing));
+        coins.push_back(Pair("limit", (uint64_t)nCoinCacheUsage));
+        result.push_back(Pair("coins", coins));
+        nTotal += nBlockIndex + nCoinsTip + nCoinsFlushing;
+    }
+
+    CMemPoolUsage mempoolUsage = mempool.GetMemoryUsage();
+    UniValue pool(UniValue::VOBJ);
+    pool.push_back(Pair("transactions", (uint64_t)mempoolUsage.nTransactions));
+    pool.push_back(Pair("links", (uint64_t)mempoolUsage.nLinks));
+    pool.push_back(Pair("spends", (uint64_t)mempoolUsage.nSpends));
+    pool.push_back(Pair("addressindex", (uint64_t)mempoolUsage.nAddressIndex));
+    pool.push_back(Pair("other", (uint64_t)mempoolUsage.nOther));
+    pool.push_back(Pair("total", (uint64_t)mempoolUsage.Total()));
+    result.push_back(Pair("mempool", pool));
+    nTotal += mempoolUsage.Total();
+
+    size_t nRecentBlocks = recentBlocks.DynamicMemoryUsage();
+    result.push_back(Pair("recentblocks", (uint64_t)nRecentBlocks));
+    nTotal += nRecentBlocks;
+
+    size_t nRecentHeaders = recentHeaders.DynamicMemoryUsage();
+    result.push_back(Pair("recentheaders", (uint64_t)nRecentHeaders));
+    nTotal += nRecentHeaders;
+
+    size_t nRecentTransactions = recentTransactions.DynamicMemoryUsage();
+    result.push_back(Pair("recenttransactions", (uint64_t)nRecentTransactions));
+    nTotal += nRecentTransactions;
+
+#ifdef ENABLE_WALLET
+    if (pwalletMain) {
+        CWalletMemoryUsage walletUsage = pwalletMain->GetMemoryUsage();
+        UniValue wallet(UniValue::VOBJ);
+        wallet.push_back(Pair("transactions", (uint64_t)walletUsage.nTransactions));
+        {
+            LOCK(pwalletMain->cs_wallet);
+            wallet.push_back(Pair("txcount", (uint64_t)pwalletMain->mapWallet.size()));
+        }
+        wallet.push_back(Pair("witnesses", (uint64_t)walletUsage.nWitnesses));
+        wallet.push_back(Pair("indexes", (uint64_t)walletUsage.nIndexes));
+        wallet.push_back(Pair("total", (uint64_t)walletUsage.Total()));
+        result.push_back(Pair("wallet", wallet));
+        nTotal += walletUsage.Total();
+    }
+#endif
+
+    size_t nZeronodes = znodeman.DynamicMemoryUsage();
+    size_t nBudgets = budget.DynamicMemoryUsage();
+    size_t nPayments = zeronodePayments.DynamicMemoryUsage();
+    UniValue zeronodes(UniValue::VOBJ);
+    zeronodes.push_back(Pair("list", (uint64_t)nZeronodes));
+    zeronodes.push_back(Pair("count", znodeman.size()));
+    zeronodes.push_back(Pair("budgets", (uint64_t)nBudgets));
+    zeronodes.push_back(Pair("payments", (uint64_t)nPayments));
+    result.push_back(Pair("zeronodes", zeronodes));
+    nTotal += nZeronodes + nBudgets + nPayments;
+
+    size_t nAddrMan = addrman.DynamicMemoryUsage();
+    UniValue addresses(UniValue::VOBJ);
+    addresses.push_back(Pair("addresses", (uint64_t)addrman.size()));
+    addresses.push_back(Pair("usage", (uint64_t)nAddrMan));
+    result.push_back(Pair("addrman", addresses));
+    nTotal += nAddrMan;
+
+    size_t nPeerBuffers = 0, nMaxPeerBuffers = 0, nPeers = 0;
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            size_t nBuffers = pnode->GetBufferMemoryUsage();
+            nPeerBuffers += nBuffers;
+            nMaxPeerBuffers = std::max(nMaxPeerBuffers, nBuffers);
+        }
+        nPeers = vNodes.size();
+    }
+    UniValue peers(UniValue::VOBJ);
+    peers.push_back(Pair("count", (uint64_t)nPeers));
+    peers.push_back(Pair("buffers", (uint64_t)nPeerBuffers));
+    peers.push_back(Pair("maxbuffers", (uint64_t)nMaxPeerBuffers));
+    result.push_back(Pair("peers", peers));
+    nTotal += nPeerBuffers;
+
+    size_t nSigCache = GetSignatureCacheMemoryUsage();
+    size_t nProofCache = GetProofCacheMemoryUsage();
+    result.push_back(Pair("sigcache", (uint64_t)nSigCache));
+    result.push_back(Pair("proofcache", (uint64_t)nProofCache));
+    nTotal += nSigCache + nProofCache;
+
+    result.push_back(Pair("total", (uint64_t)nTotal));
+
+    CHugePageUsage hugePageUsage = GetHugePageUsage();
+    UniValue hugepages(UniValue::VOBJ);
+    hugepages.push_back(Pair("mode", HugePageModeName(GetHugePageMode())));
+    hugepages.push_back(Pair("mapped", (uint64_t)hugePageUsage.nMapped));
+    hugepages.push_back(Pair("reserved", (uint64_t)hugePageUsage.nReserved));
+    hugepages.push_back(Pair("transparent", (uint64_t)hugePageUsage.nTransparent));
+    hugepages.push_back(Pair("reservedfailures", hugePageUsage.nReservedFailures));
+    result.push_back(Pair("hugepages", hugepages));
+    return result;
+}
+
 // insightexplorer
 static bool getAddressFromIndex(
     int type, const uint160 &hash, std::string &address)
@@ -500,6 +860,23 @@ static bool getAddressFromIndex(
     return true;
 }
 
+static UniValue addressDeltaToJSON(const std::pair<CAddressIndexKey, CAmount>& it)
+{
+    std::string address;
+    if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    UniValue delta(UniValue::VOBJ);
+    delta.push_back(Pair("address", address));
+    delta.push_back(Pair("blockindex", (int)it.first.txindex));
+    delta.push_back(Pair("height", it.first.blockHeight));
+    delta.push_back(Pair("index", (int)it.first.index));
+    delta.push_back(Pair("satoshis", it.second));
+    delta.push_back(Pair("txid", it.first.txhash.GetHex()));
+    return delta;
+}
+
 // This function accepts an address and returns in the output parameters
 // the version and raw bytes for the RIPEMD-160 hash.
 static bool getIndexKey(
@@ -698,6 +1075,7 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getaddressutxos is disabled. "
             "Run './zcash-cli help getaddressutxos' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     bool includeChainInfo = false;
     if (params[0].isObject()) {
@@ -711,12 +1089,10 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
     std::vector<CAddressUnspentDbEntry> unspentOutputs;
-    for (const auto& it : addresses) {
-        if (!GetAddressUnspent(it.first, it.second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
+    if (!GetAddressUnspent(addresses, unspentOutputs)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
     }
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(),
+    std::stable_sort(unspentOutputs.begin(), unspentOutputs.end(),
         [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
             return a.second.blockHeight < b.second.blockHeight;
         });
@@ -744,9 +1120,9 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("utxos", utxos));
 
-    LOCK(cs_main);  // for chainActive
-    result.push_back(Pair("hash", chainActive.Tip()->GetBlockHash().GetHex()));
-    result.push_back(Pair("height", (int)chainActive.Height()));
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    result.push_back(Pair("hash", chain->Tip()->GetBlockHash().GetHex()));
+    result.push_back(Pair("height", (int)chain->Height()));
     return result;
 }
 
@@ -772,8 +1148,8 @@ static void getHeightRange(const UniValue& params, int& start, int& end)
         }
     }
 
-    LOCK(cs_main);  // for chainActive
-    if (start > chainActive.Height() || end > chainActive.Height()) {
+    int nHeight = GetChainSnapshot()->Height();
+    if (start > nHeight || end > nHeight) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
     }
 }
@@ -788,14 +1164,24 @@ static void getAddressesInHeightRange(
     if (!getAddressesFromParams(params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
-    for (const auto& it : addresses) {
-        if (!GetAddressIndex(it.first, it.second, addressIndex, start, end)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
-                "No information available for address");
-        }
+    if (!GetAddressIndex(addresses, addressIndex, start, end)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+            "No information available for address");
     }
 }
 
+static void getAddressDeltasChainInfo(int start, int end, UniValue& startInfo, UniValue& endInfo)
+{
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    if (start > chain->Height() || end > chain->Height()) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
+    }
+    startInfo.push_back(Pair("hash", (*chain)[start]->GetBlockHash().GetHex()));
+    endInfo.push_back(Pair("hash", (*chain)[end]->GetBlockHash().GetHex()));
+    startInfo.push_back(Pair("height", start));
+    endInfo.push_back(Pair("height", end));
+}
+
 // insightexplorer
 UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 {
@@ -867,6 +1253,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getaddressdeltas is disabled. "
             "Run './zcash-cli help getaddressdeltas' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     int start = 0;
     int end = 0;
@@ -884,41 +1271,56 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         }
     }
 
-    UniValue deltas(UniValue::VARR);
-    for (const auto& it : addressIndex) {
-        std::string address;
-        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    bool fChainInfo = includeChainInfo && start > 0 && end > 0;
+
+    if (RPCCanStreamResult()) {
+        // Check everything that can fail first, then generate the deltas as they are sent
+        for (const auto& it : addressIndex) {
+            if (it.first.type != CScript::P2SH && it.first.type != CScript::P2PKH) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+            }
         }
+        UniValue startInfo(UniValue::VOBJ);
+        UniValue endInfo(UniValue::VOBJ);
+        if (fChainInfo)
+            getAddressDeltasChainInfo(start, end, startInfo, endInfo);
+
+        std::shared_ptr<const std::vector<std::pair<CAddressIndexKey, CAmount>>> pindex =
+            std::make_shared<const std::vector<std::pair<CAddressIndexKey, CAmount>>>(std::move(addressIndex));
+        RPCStreamResult([pindex, fChainInfo, startInfo, endInfo](CJSONStreamWriter& json) {
+            if (fChainInfo) {
+                json.BeginObject();
+                json.Key("deltas");
+            }
+            json.BeginArray();
+            for (const auto& it : *pindex)
+                json.Value(addressDeltaToJSON(it));
+            json.EndArray();
+            if (fChainInfo) {
+                json.Key("start");
+                json.Value(startInfo);
+                json.Key("end");
+                json.Value(endInfo);
+                json.EndObject();
+            }
+        });
+        return NullUniValue;
+    }
 
-        UniValue delta(UniValue::VOBJ);
-        delta.push_back(Pair("address", address));
-        delta.push_back(Pair("blockindex", (int)it.first.txindex));
-        delta.push_back(Pair("height", it.first.blockHeight));
-        delta.push_back(Pair("index", (int)it.first.index));
-        delta.push_back(Pair("satoshis", it.second));
-        delta.push_back(Pair("txid", it.first.txhash.GetHex()));
-        deltas.push_back(delta);
+    UniValue deltas(UniValue::VARR);
+    for (const auto& it : addressIndex) {
+        deltas.push_back(addressDeltaToJSON(it));
     }
 
     UniValue result(UniValue::VOBJ);
 
-    if (!(includeChainInfo && start > 0 && end > 0)) {
+    if (!fChainInfo) {
         return deltas;
     }
 
     UniValue startInfo(UniValue::VOBJ);
     UniValue endInfo(UniValue::VOBJ);
-    {
-        LOCK(cs_main);  // for chainActive
-        if (start > chainActive.Height() || end > chainActive.Height()) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
-        }
-        startInfo.push_back(Pair("hash", chainActive[start]->GetBlockHash().GetHex()));
-        endInfo.push_back(Pair("hash", chainActive[end]->GetBlockHash().GetHex()));
-    }
-    startInfo.push_back(Pair("height", start));
-    endInfo.push_back(Pair("height", end));
+    getAddressDeltasChainInfo(start, end, startInfo, endInfo);
 
     result.push_back(Pair("deltas", deltas));
     result.push_back(Pair("start", startInfo));
@@ -965,20 +1367,23 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getaddressbalance is disabled. "
             "Run './zcash-cli help getaddressbalance' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    // this method doesn't take start and end block height params, so set
-    // to zero (full range, entire blockchain)
-    getAddressesInHeightRange(params, 0, 0, addresses, addressIndex);
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
+    // The running totals of each address spare reading all of its entries
     CAmount balance = 0;
     CAmount received = 0;
-    for (const auto& it : addressIndex) {
-        if (it.second > 0) {
-            received += it.second;
+    for (const auto& it : addresses) {
+        CAddressBalanceValue value;
+        if (!GetAddressBalance(it.first, it.second, value)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it.second;
+        balance += value.balance;
+        received += value.received;
     }
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
@@ -1027,6 +1432,7 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getaddresstxids is disabled. "
             "Run './zcash-cli help getaddresstxids' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     int start = 0;
     int end = 0;
@@ -1087,6 +1493,7 @@ UniValue getspentinfo(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_MISC_ERROR, "Error: getspentinfo is disabled. "
             "Run './zcash-cli help getspentinfo' for instructions on how to enable this feature.");
     }
+    EnsureExplorerIndexSynced();
 
     UniValue txidValue = find_value(params[0].get_obj(), "txid");
     UniValue indexValue = find_value(params[0].get_obj(), "index");
@@ -1112,10 +1519,121 @@ UniValue getspentinfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+// Parse the hash and optional pool of a shielded explorer query
+static CNoteIndexKey getNoteIndexKey(const UniValue& params, const std::string& strName)
+{
+    if (!fNoteIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The shielded explorer indexes are not built, restart with -reindex");
+
+    uint256 hash = ParseHashV(params[0], strName);
+    std::string strPool = params.size() > 1 ? params[1].get_str() : "sapling";
+    if (strPool == "sapling")
+        return CNoteIndexKey(SAPLING, hash);
+    if (strPool == "sprout")
+        return CNoteIndexKey(SPROUT, hash);
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid pool, must be \"sapling\" or \"sprout\"");
+}
+
+// insightexplorer
+UniValue getnullifierinfo(const UniValue& params, bool fHelp)
+{
+    std::string enableArg = "insightexplorer";
+    bool enabled = fExperimentalMode && fInsightExplorer;
+    std::string disabledMsg = "";
+    if (!enabled) {
+        disabledMsg = experimentalDisabledHelpMsg("getnullifierinfo", enableArg);
+    }
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getnullifierinfo \"nullifier\" ( \"pool\" )\n"
+            "\nReturns the transaction that revealed a nullifier, that is the one that spent its note.\n"
+            + disabledMsg +
+            "\nArguments:\n"
+            "1. \"nullifier\"   (string, required) The nullifier, as hex\n"
+            "2. \"pool\"        (string, optional, default=\"sapling\") The shielded pool, \"sapling\" or \"sprout\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"     (string) The spending transaction id\n"
+            "  \"index\"    (number) The index of the Sapling spend or Sprout JoinSplit\n"
+            "  \"height\"   (number) The height of the block with the transaction\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnullifierinfo", "\"9e1d4b6b6d3fa2b6a7d1c3c2f1ef0c5b9bdc5ee8e2d1b4f05a3b8b6a6b7bb1a2\"")
+            + HelpExampleRpc("getnullifierinfo", "\"9e1d4b6b6d3fa2b6a7d1c3c2f1ef0c5b9bdc5ee8e2d1b4f05a3b8b6a6b7bb1a2\"")
+        );
+
+    if (!enabled) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Error: getnullifierinfo is disabled. "
+            "Run './zcash-cli help getnullifierinfo' for instructions on how to enable this feature.");
+    }
+
+    CNullifierIndexValue value;
+    if (!GetNullifierIndex(getNoteIndexKey(params, "nullifier"), value)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get nullifier info");
+    }
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txid", value.txid.GetHex()));
+    obj.push_back(Pair("index", (int)value.index));
+    obj.push_back(Pair("height", value.blockHeight));
+
+    return obj;
+}
+
+// insightexplorer
+UniValue getcommitmentinfo(const UniValue& params, bool fHelp)
+{
+    std::string enableArg = "insightexplorer";
+    bool enabled = fExperimentalMode && fInsightExplorer;
+    std::string disabledMsg = "";
+    if (!enabled) {
+        disabledMsg = experimentalDisabledHelpMsg("getcommitmentinfo", enableArg);
+    }
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getcommitmentinfo \"commitment\" ( \"pool\" )\n"
+            "\nReturns the transaction that created a note commitment and its position in the note commitment tree.\n"
+            + disabledMsg +
+            "\nArguments:\n"
+            "1. \"commitment\"  (string, required) The note commitment (cmu for Sapling), as hex\n"
+            "2. \"pool\"        (string, optional, default=\"sapling\") The shielded pool, \"sapling\" or \"sprout\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"       (string) The transaction id\n"
+            "  \"index\"      (number) The index of the Sapling output or Sprout JoinSplit\n"
+            "  \"height\"     (number) The height of the block with the transaction\n"
+            "  \"position\"   (number) The leaf position of the commitment in the tree\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcommitmentinfo", "\"3f2e99807c4ee8e2d1b4f05a3b8b6a6b7bb1a29e1d4b6b6d3fa2b6a7d1c3c2f1\"")
+            + HelpExampleRpc("getcommitmentinfo", "\"3f2e99807c4ee8e2d1b4f05a3b8b6a6b7bb1a29e1d4b6b6d3fa2b6a7d1c3c2f1\"")
+        );
+
+    if (!enabled) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Error: getcommitmentinfo is disabled. "
+            "Run './zcash-cli help getcommitmentinfo' for instructions on how to enable this feature.");
+    }
+
+    CCommitmentIndexValue value;
+    if (!GetCommitmentIndex(getNoteIndexKey(params, "commitment"), value)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get note commitment info");
+    }
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txid", value.txid.GetHex()));
+    obj.push_back(Pair("index", (int)value.index));
+    obj.push_back(Pair("height", value.blockHeight));
+    obj.push_back(Pair("position", value.position));
+
+    return obj;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
+    { "control",            "getrpcqueueinfo",        &getrpcqueueinfo,        true  },
+    { "control",            "getrpccacheinfo",        &getrpccacheinfo,        true  },
+    { "control",            "getlockstats",           &getlockstats,           true  },
+    { "control",            "getmemoryinfo",          &getmemoryinfo,          true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
@@ -1129,6 +1647,8 @@ static const CRPCCommand commands[] =
     { "addressindex",       "getaddressutxos",        &getaddressutxos,        false }, /* insight explorer */
     { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  }, /* insight explorer */
     { "blockchain",         "getspentinfo",           &getspentinfo,           false }, /* insight explorer */
+    { "blockchain",         "getnullifierinfo",       &getnullifierinfo,       false }, /* insight explorer */
+    { "blockchain",         "getcommitmentinfo",      &getcommitmentinfo,      false }, /* insight explorer */
     // END insightexplorer
 
     /* Not shown in help */
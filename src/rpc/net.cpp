@@ -106,7 +106,16 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"inflight_limit\": n,      (numeric) How many blocks may be in flight from this peer at once\n"
+            "    \"blocks_downloaded\": n,   (numeric) Blocks received from this peer that we asked it for\n"
+            "    \"block_bytes_downloaded\": n, (numeric) Total size of those blocks in bytes\n"
+            "    \"blocks_reassigned\": n,   (numeric) Blocks re-requested from other peers because this peer stalled\n"
+            "    \"block_latency\": n,       (numeric) Average time in seconds from requesting a block to receiving it\n"
+            "    \"block_download_rate\": n, (numeric) Average rate in bytes per second this peer delivers blocks at\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"compresssend\": true|false, (boolean) Whether messages to the peer are compressed (-p2pcompression)\n"
+            "    \"compressrecv\": true|false, (boolean) Whether the peer may send compressed messages\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -156,8 +165,16 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflight_limit", statestats.nBlocksInFlightLimit));
+            obj.push_back(Pair("blocks_downloaded", statestats.nBlocksDownloaded));
+            obj.push_back(Pair("block_bytes_downloaded", statestats.nBlockBytesDownloaded));
+            obj.push_back(Pair("blocks_reassigned", statestats.nBlocksReassigned));
+            obj.push_back(Pair("block_latency", statestats.dBlockLatency));
+            obj.push_back(Pair("block_download_rate", statestats.dBlockDownloadRate));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("compresssend", stats.fCompressSend));
+        obj.push_back(Pair("compressrecv", stats.fCompressRecv));
 
         ret.push_back(obj);
     }
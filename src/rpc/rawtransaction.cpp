@@ -19,6 +19,7 @@
 #include "script/script_error.h"
 #include "script/sign.h"
 #include "script/standard.h"
+#include "taskpool.h"
 #include "uint256.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -1058,32 +1059,66 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     // Use CTransaction for the constant parts of the
     // transaction to avoid rehashing.
     const CTransaction txConst(mergedTx);
-    // Sign what we can:
+    const PrecomputedTransactionData txdata(txConst);
+    // Signature hashes don't cover the scriptSigs, so every input is signed
+    // against txConst, with the midstates computed once, on the task pool;
+    // and all are verified against it once signing is done, in parallel.
+    std::vector<std::string> vInputErrors(mergedTx.vin.size());
+    std::vector<CTxOut> vSpent(mergedTx.vin.size());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
+        const CTxIn& txin = mergedTx.vin[i];
         const CCoins* coins = view.AccessCoins(txin.prevout.hash);
         if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
+            vInputErrors[i] = "Input not found or already spent";
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        vSpent[i] = coins->vout[txin.prevout.n];
+    }
+
+    // Sign what we can:
+    std::vector<SignatureData> vSigData(mergedTx.vin.size());
+    GetTaskPool().ParallelFor(TASKPOOL_RPC, mergedTx.vin.size(), GetNumCores(), [&](size_t i) {
+        if (!vInputErrors[i].empty())
+            return;
+        const CScript& prevPubKey = vSpent[i].scriptPubKey;
+        const CAmount& amount = vSpent[i].nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata, consensusBranchId);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, txdata, nHashType), prevPubKey, sigdata, consensusBranchId);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
-            sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(txv, i), consensusBranchId);
+            sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount, txdata), sigdata, DataFromTransaction(txv, i), consensusBranchId);
         }
+        vSigData[i] = sigdata;
+    });
 
-        UpdateTransaction(mergedTx, i, sigdata);
-
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), consensusBranchId, &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
+    std::vector<CValidationCheck> vChecks;
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (!vInputErrors[i].empty())
+            continue;
+        CTxIn& txin = mergedTx.vin[i];
+        const CAmount& amount = vSpent[i].nValue;
+        UpdateTransaction(mergedTx, i, vSigData[i]);
+
+        CScript scriptSig = txin.scriptSig;
+        CScript scriptPubKey = vSpent[i].scriptPubKey;
+        std::string* pstrError = &vInputErrors[i];
+        vChecks.push_back(CValidationCheck([&txConst, &txdata, scriptSig, scriptPubKey, i, amount, consensusBranchId, pstrError]() {
+            ScriptError serror = SCRIPT_ERR_OK;
+            if (!VerifyScript(scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount, txdata), consensusBranchId, &serror)) {
+                *pstrError = ScriptErrorString(serror);
+            }
+            // Keep going, so that every input gets its error
+            return true;
+        }));
+    }
+    RunValidationChecks(vChecks);
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (!vInputErrors[i].empty()) {
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, vInputErrors[i]);
         }
     }
     bool fComplete = vErrors.empty();
@@ -0,0 +1,183 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/resultcache.h"
+
+#include "chain.h"
+#include "main.h"
+#include "sync.h"
+#include "utiltime.h"
+
+#include <list>
+#include <unordered_map>
+
+#include <univalue.h>
+
+namespace {
+
+struct CacheEntry
+{
+    std::string key;
+    std::string result;
+    RPCCachePolicy policy;
+    //! Time the entry expires, or 0 if it does not
+    int64_t nExpire;
+
+    size_t Usage() const { return key.size() + result.size() + 128; }
+};
+
+CCriticalSection cs_cache;
+//! Entries, most recently used first
+std::list<CacheEntry> listEntries;
+std::unordered_map<std::string, std::list<CacheEntry>::iterator> mapEntries;
+//! The tip the entries that depend on it were computed at
+uint256 hashCacheTip;
+size_t nMaxUsage = 0;
+size_t nUsage = 0;
+uint64_t nHits = 0;
+uint64_t nMisses = 0;
+uint64_t nEvictions = 0;
+
+void Erase(std::list<CacheEntry>::iterator it)
+{
+    nUsage -= it->Usage();
+    mapEntries.erase(it->key);
+    listEntries.erase(it);
+}
+
+/** Drop the entries that depend on the tip; requires cs_cache */
+void SetTip(const uint256& tip)
+{
+    hashCacheTip = tip;
+    for (std::list<CacheEntry>::iterator it = listEntries.begin(); it != listEntries.end(); ) {
+        std::list<CacheEntry>::iterator itCur = it++;
+        if (itCur->policy == RPC_CACHE_TIP || itCur->policy == RPC_CACHE_TIP_TIMED)
+            Erase(itCur);
+    }
+}
+
+/** Whether a block is given by its hash rather than its height, as getblock accepts both */
+bool IsBlockHashParam(const UniValue& param)
+{
+    return param.isStr() && param.get_str().size() == 2 * sizeof(uint256);
+}
+
+RPCCachePolicy GetCachePolicy(const std::string& strMethod, const UniValue& params)
+{
+    if (strMethod == "getblockhash" || strMethod == "getblockheader" ||
+        strMethod == "getchaintxstats" || strMethod == "getdifficulty")
+        return RPC_CACHE_TIP;
+    // Also reports headers and verification progress, which move without the tip
+    if (strMethod == "getblockchaininfo")
+        return RPC_CACHE_TIP_TIMED;
+    // The supply at a given height follows from the consensus rules alone
+    if (strMethod == "getsupply")
+        return params.size() > 0 ? RPC_CACHE_IMMUTABLE : RPC_CACHE_TIP;
+    if (strMethod == "getblock") {
+        // The serialized block never changes; the JSON forms report confirmations
+        bool fHex = params.size() > 1 && ((params[1].isNum() && params[1].get_int() == 0) ||
+                                          (params[1].isBool() && !params[1].get_bool()));
+        if (params.size() > 0 && IsBlockHashParam(params[0]) && fHex)
+            return RPC_CACHE_IMMUTABLE;
+        return RPC_CACHE_TIP;
+    }
+    // Zeronode status follows the network, not the chain
+    if ((strMethod == "znsync" && params.size() == 1 && params[0].isStr() && params[0].get_str() == "status") ||
+        (strMethod == "zeronode" && params.size() == 1 && params[0].isStr() && params[0].get_str() == "count"))
+        return RPC_CACHE_TIMED;
+    return RPC_CACHE_NONE;
+}
+
+} // anon namespace
+
+void RPCResultCacheInit(size_t nMaxUsageIn)
+{
+    LOCK(cs_cache);
+    listEntries.clear();
+    mapEntries.clear();
+    nUsage = 0;
+    nMaxUsage = nMaxUsageIn;
+}
+
+bool RPCResultCacheLookup(const std::string& strMethod, const UniValue& params, RPCCacheKey& key, std::string& strResult)
+{
+    key = RPCCacheKey();
+    {
+        LOCK(cs_cache);
+        if (nMaxUsage == 0)
+            return false;
+    }
+    RPCCachePolicy policy = GetCachePolicy(strMethod, params);
+    if (policy == RPC_CACHE_NONE)
+        return false;
+
+    key.policy = policy;
+    key.key = strMethod;
+    key.key += '\0';
+    key.key += params.write();
+    const CBlockIndex* pindexTip = GetChainSnapshot()->Tip();
+    if (pindexTip)
+        key.tip = pindexTip->GetBlockHash();
+
+    LOCK(cs_cache);
+    if (key.tip != hashCacheTip)
+        SetTip(key.tip);
+    std::unordered_map<std::string, std::list<CacheEntry>::iterator>::iterator it = mapEntries.find(key.key);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    if (it->second->nExpire != 0 && GetTime() >= it->second->nExpire) {
+        Erase(it->second);
+        nMisses++;
+        return false;
+    }
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    strResult = it->second->result;
+    nHits++;
+    return true;
+}
+
+void RPCResultCacheStore(const RPCCacheKey& key, const std::string& strResult)
+{
+    if (key.policy == RPC_CACHE_NONE)
+        return;
+
+    CacheEntry entry;
+    entry.key = key.key;
+    entry.result = strResult;
+    entry.policy = key.policy;
+    entry.nExpire = 0;
+    if (key.policy == RPC_CACHE_TIMED || key.policy == RPC_CACHE_TIP_TIMED)
+        entry.nExpire = GetTime() + RPC_CACHE_VOLATILE_TTL;
+
+    LOCK(cs_cache);
+    // Results computed at an earlier tip are already outdated; very large
+    // results would push out many small ones
+    if (key.tip != hashCacheTip || entry.Usage() > nMaxUsage / 8)
+        return;
+    std::unordered_map<std::string, std::list<CacheEntry>::iterator>::iterator it = mapEntries.find(key.key);
+    if (it != mapEntries.end())
+        Erase(it->second);
+    while (!listEntries.empty() && nUsage + entry.Usage() > nMaxUsage) {
+        Erase(--listEntries.end());
+        nEvictions++;
+    }
+    nUsage += entry.Usage();
+    listEntries.push_front(entry);
+    mapEntries[key.key] = listEntries.begin();
+}
+
+RPCResultCacheStats RPCResultCacheGetStats()
+{
+    LOCK(cs_cache);
+    RPCResultCacheStats stats;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nEvictions = nEvictions;
+    stats.nEntries = listEntries.size();
+    stats.nUsage = nUsage;
+    stats.nMaxUsage = nMaxUsage;
+    return stats;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_RPC_RESULTCACHE_H
+#define BITCOIN_RPC_RESULTCACHE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+
+class UniValue;
+
+/** Default for -rpccachesize, in MiB */
+static const int DEFAULT_RPC_CACHE_SIZE = 16;
+/** Seconds a cached result that also depends on other state than the chain tip stays valid */
+static const int64_t RPC_CACHE_VOLATILE_TTL = 1;
+
+/** How long the result of a call stays valid */
+enum RPCCachePolicy
+{
+    RPC_CACHE_NONE,      //!< Not cached
+    RPC_CACHE_TIP,       //!< Until the tip changes
+    RPC_CACHE_TIP_TIMED, //!< Until the tip changes, for at most RPC_CACHE_VOLATILE_TTL
+    RPC_CACHE_TIMED,     //!< For RPC_CACHE_VOLATILE_TTL
+    RPC_CACHE_IMMUTABLE, //!< Until evicted
+};
+
+/** Identifies a call in the result cache; filled in by RPCResultCacheLookup */
+struct RPCCacheKey
+{
+    RPCCachePolicy policy;
+    std::string key;
+    //! The tip when the call was looked up, which its result will be filed under
+    uint256 tip;
+
+    RPCCacheKey() : policy(RPC_CACHE_NONE) {}
+};
+
+struct RPCResultCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+    size_t nEntries;
+    size_t nUsage;
+    size_t nMaxUsage;
+};
+
+/** Size the result cache; 0 disables it */
+void RPCResultCacheInit(size_t nMaxUsage);
+
+/**
+ * Look up the serialized JSON result of a call. Many explorer calls only
+ * depend on the chain tip, so polls from many clients can share one
+ * result. Returns false on a miss; if key.policy is not RPC_CACHE_NONE,
+ * the result of the call should then be handed to RPCResultCacheStore.
+ */
+bool RPCResultCacheLookup(const std::string& strMethod, const UniValue& params, RPCCacheKey& key, std::string& strResult);
+
+/** Remember the serialized JSON result of a call looked up with key */
+void RPCResultCacheStore(const RPCCacheKey& key, const std::string& strResult);
+
+RPCResultCacheStats RPCResultCacheGetStats();
+
+#endif // BITCOIN_RPC_RESULTCACHE_H
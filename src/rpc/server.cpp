@@ -12,9 +12,12 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationinterface.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
 #include <memory>
+#include <set>
 
 #include <univalue.h>
 
@@ -41,6 +44,11 @@ static std::vector<RPCTimerInterface*> timerInterfaces;
 /* Map of name to timer.
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
+/* Runs the read-only calls of a batch on other RPC worker threads */
+static RPCWorkerDispatcher batchDispatcher;
+static CCriticalSection cs_batchDispatcher;
+/* Result writer slot of the call running on this thread, if it may stream */
+static boost::thread_specific_ptr<RPCResultWriter> streamWriter;
 
 static struct CRPCSignals
 {
@@ -295,6 +303,7 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
         return false;
 
     mapCommands[name] = pcmd;
+    mapLatencies[name];
     return true;
 }
 
@@ -304,8 +313,11 @@ bool StartRPC()
     fRPCRunning = true;
     g_rpcSignals.Started();
 
-    // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
-    getAsyncRPCQueue()->addWorker();
+    // Launch one async rpc worker per lane, so that long running operations on the bulk lane
+    // don't hold up payments.  The ability to launch multiple workers per lane is not recommended
+    // at present and thus the option is disabled.
+    getAsyncRPCQueue()->addWorker(ASYNC_RPC_LANE_DEFAULT);
+    getAsyncRPCQueue()->addWorker(ASYNC_RPC_LANE_BULK);
 /*
     int n = GetArg("-rpcasyncthreads", 1);
     if (n<1) {
@@ -419,13 +431,145 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+namespace {
+
+/** Calls that only read chain state, so that the calls of a batch may run at the same time */
+const std::set<std::string> setParallelBatchMethods = {
+    "decoderawtransaction", "decodescript", "getaddressbalance", "getaddressdeltas",
+    "getaddressmempool", "getaddresstxids", "getaddressutxos", "getbestblockhash",
+    "getblock", "getblockcount", "getblockdeltas", "getblockfilter", "getblockhash",
+    "getblockhashes", "getblockheader", "getblocksubsidy", "getchainstats", "getcompactsaplingblocks",
+    "getrawtransaction", "getspentinfo", "gettxout", "gettxoutproof", "validateaddress",
+    "verifytxoutproof", "z_validateaddress",
+};
+
+bool IsParallelBatchCall(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    return valMethod.isStr() && setParallelBatchMethods.count(valMethod.get_str());
+}
+
+/**
+ * A run of consecutive read-only calls of a batch. The batch thread and the
+ * helpers it queued claim calls one at a time until none are left, so the
+ * batch completes even if no helper ever gets a worker. Helpers that start
+ * after the run is over claim nothing and leave the request untouched.
+ */
+struct CBatchRun
+{
+    const UniValue& vReq;
+    std::vector<UniValue>& vResult;
+    const size_t nEnd;
+    std::atomic<size_t> nNext;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    size_t nDone; //!< calls completed, protected by cs
+
+    CBatchRun(const UniValue& vReqIn, std::vector<UniValue>& vResultIn, size_t nBegin, size_t nEndIn) :
+        vReq(vReqIn), vResult(vResultIn), nEnd(nEndIn), nNext(nBegin), nDone(0) {}
+};
+
+void ExecBatchRun(std::shared_ptr<CBatchRun> run)
+{
+    size_t nDone = 0;
+    for (size_t i = run->nNext++; i < run->nEnd; i = run->nNext++) {
+        run->vResult[i] = JSONRPCExecOne(run->vReq[i]);
+        nDone++;
+    }
+    if (nDone > 0) {
+        boost::lock_guard<boost::mutex> lock(run->cs);
+        run->nDone += nDone;
+        run->cond.notify_all();
+    }
+}
+
+} // anon namespace
+
+void RPCSetWorkerDispatcher(const RPCWorkerDispatcher& dispatcher)
 {
+    LOCK(cs_batchDispatcher);
+    batchDispatcher = dispatcher;
+}
+
+bool RPCCanStreamResult()
+{
+    return streamWriter.get() != NULL;
+}
+
+void RPCStreamResult(const RPCResultWriter& writer)
+{
+    assert(streamWriter.get());
+    *streamWriter = writer;
+}
+
+RPCStreamScope::RPCStreamScope(bool fEnable)
+{
+    streamWriter.reset(fEnable ? new RPCResultWriter() : NULL);
+}
+
+RPCStreamScope::~RPCStreamScope()
+{
+    streamWriter.reset();
+}
+
+RPCResultWriter RPCStreamScope::GetWriter() const
+{
+    return streamWriter.get() ? *streamWriter : RPCResultWriter();
+}
+
+UniValue JSONRPCExecBatchReply(const UniValue& vReq)
+{
+    RPCWorkerDispatcher dispatcher;
+    {
+        LOCK(cs_batchDispatcher);
+        dispatcher = batchDispatcher;
+    }
+    size_t nConcurrency = std::max((long)GetArg("-rpcbatchconcurrency", DEFAULT_RPC_BATCH_CONCURRENCY), 1L);
+
+    // Calls that may change state run alone and in order; each run of
+    // read-only calls between them is spread over up to nConcurrency workers
+    std::vector<UniValue> vResult(vReq.size());
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        if (nConcurrency > 1 && dispatcher) {
+            while (nEnd < vReq.size() && IsParallelBatchCall(vReq[nEnd]))
+                nEnd++;
+        }
+        if (nEnd - reqIdx < 2) {
+            vResult[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+            continue;
+        }
+
+        std::shared_ptr<CBatchRun> run = std::make_shared<CBatchRun>(vReq, vResult, reqIdx, nEnd);
+        size_t nHelpers = std::min(nConcurrency - 1, nEnd - reqIdx - 1);
+        for (size_t i = 0; i < nHelpers; i++) {
+            if (!dispatcher(boost::bind(&ExecBatchRun, run)))
+                break;
+        }
+        ExecBatchRun(run);
+        {
+            boost::unique_lock<boost::mutex> lock(run->cs);
+            while (run->nDone < nEnd - reqIdx)
+                run->cond.wait(lock);
+        }
+        reqIdx = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (size_t i = 0; i < vResult.size(); i++)
+        ret.push_back(vResult[i]);
+
+    return ret;
+}
 
-    return ret.write() + "\n";
+std::string JSONRPCExecBatch(const UniValue& vReq)
+{
+    return JSONRPCExecBatchReply(vReq).write() + "\n";
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -447,9 +591,15 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    // With -asyncwallet, make the wallet catch up with the blocks and
+    // transactions accepted before the call
+    if (pcmd->category == "wallet" && GetBoolArg("-asyncwallet", DEFAULT_ASYNC_WALLET))
+        GetValidationQueue().Sync();
+
     try
     {
         // Execute
+        CPerfStatTimer timer(mapLatencies.find(strMethod)->second);
         return pcmd->actor(params, false);
     }
     catch (const std::exception& e)
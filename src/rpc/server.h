@@ -7,6 +7,7 @@
 #define BITCOIN_RPCSERVER_H
 
 #include "amount.h"
+#include "perfstats.h"
 #include "rpc/protocol.h"
 #include "uint256.h"
 
@@ -16,6 +17,8 @@
 #include <string>
 #include <memory>
 
+#include <functional>
+
 #include <boost/function.hpp>
 
 #include <univalue.h>
@@ -119,6 +122,49 @@ void RPCUnregisterTimerInterface(RPCTimerInterface *iface);
  */
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
+/** Default for -rpcbatchconcurrency */
+static const int DEFAULT_RPC_BATCH_CONCURRENCY = 4;
+
+/** Queue a task on another RPC worker thread; returns false if it could not be queued */
+typedef boost::function<bool(const boost::function<void(void)>&)> RPCWorkerDispatcher;
+
+/**
+ * Set the dispatcher that JSONRPCExecBatch uses to run the read-only calls of
+ * a batch in parallel. With an empty dispatcher batches run sequentially.
+ */
+void RPCSetWorkerDispatcher(const RPCWorkerDispatcher& dispatcher);
+
+class CJSONStreamWriter;
+
+/** Writes the result of a call as a single JSON value */
+typedef std::function<void(CJSONStreamWriter&)> RPCResultWriter;
+
+/**
+ * Whether the call running on this thread may hand its result over as a
+ * writer, with RPCStreamResult, instead of building it as a UniValue.
+ * Only single HTTP requests are streamed, never batch members.
+ */
+bool RPCCanStreamResult();
+
+/**
+ * Hand over the result of the running call as a writer, which is run after
+ * the call returns (its return value is then ignored) and streams the JSON
+ * to the client as it is generated. All checks that can fail must be done
+ * before; the writer must not throw. Requires RPCCanStreamResult().
+ */
+void RPCStreamResult(const RPCResultWriter& writer);
+
+/** Lets the calls made on this thread while in scope stream their results, if fEnable */
+class RPCStreamScope
+{
+public:
+    explicit RPCStreamScope(bool fEnable = true);
+    ~RPCStreamScope();
+
+    /** The writer handed over by the call, empty if it did not stream */
+    RPCResultWriter GetWriter() const;
+};
+
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
 
 class CRPCCommand
@@ -137,6 +183,8 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    //! Execution times per command; like mapCommands, only filled in before the server starts
+    mutable std::map<std::string, CTimingHistogram> mapLatencies;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -158,6 +206,9 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /** How long every command took to execute, in microseconds, whether it succeeded or not */
+    const std::map<std::string, CTimingHistogram>& GetLatencies() const { return mapLatencies; }
 };
 
 extern CRPCTable tableRPC;
@@ -185,8 +236,11 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+UniValue JSONRPCExecBatchReply(const UniValue& vReq);
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::string& enableArg);
+/** Throw RPC_IN_WARMUP while the explorer indexes are still being built in the background */
+extern void EnsureExplorerIndexSynced();
 
 #endif // BITCOIN_RPCSERVER_H
@@ -10,7 +10,7 @@
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nLowPriorityRunning(0), stopRequested(false), stopWhenEmpty(false), nextTaskId(1)
 {
 }
 
@@ -20,6 +20,20 @@ CScheduler::~CScheduler()
 }
 
 
+CScheduler::TaskQueue::iterator CScheduler::pickTask(boost::chrono::system_clock::time_point now)
+{
+    // Leave a thread for the other tasks while low priority ones run
+    bool fLowAllowed = nThreadsServicingQueue <= 1 || nLowPriorityRunning + 1 < nThreadsServicingQueue;
+    TaskQueue::iterator itBest = taskQueue.end();
+    for (TaskQueue::iterator it = taskQueue.begin(); it != taskQueue.end() && it->first <= now; ++it) {
+        if (it->second.priority == PRIORITY_LOW && !fLowAllowed)
+            continue;
+        if (itBest == taskQueue.end() || it->second.priority < itBest->second.priority)
+            itBest = it;
+    }
+    return itBest;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -28,38 +42,71 @@ void CScheduler::serviceQueue()
     // newTaskMutex is locked throughout this loop EXCEPT
     // when the thread is waiting or when the user's function
     // is called.
+    bool fRunningLow = false;
     while (!shouldStop()) {
         try {
             while (!shouldStop() && taskQueue.empty()) {
                 // Wait until there is something to do.
                 newTaskScheduled.wait(lock);
             }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
-            }
+            if (shouldStop())
+                continue;
 
             // If there are multiple threads, the queue can empty while we're waiting (another
             // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+            TaskQueue::iterator it = pickTask(now);
+            if (it == taskQueue.end()) {
+                // Wait until either there is a new task, a low priority task is done,
+                // or the time of the next item on the queue:
+                TaskQueue::iterator itNext = taskQueue.upper_bound(now);
+                if (itNext == taskQueue.end()) {
+                    newTaskScheduled.wait(lock);
+                } else {
+                    // Some boost versions have a conflicting overload of wait_until that returns void.
+                    // Explicitly use a template here to avoid hitting that overload.
+                    newTaskScheduled.wait_until<>(lock, itNext->first);
+                }
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            boost::chrono::system_clock::time_point t = it->first;
+            Task task = it->second;
+            taskQueue.erase(it);
 
+            fRunningLow = task.priority == PRIORITY_LOW;
+            if (fRunningLow)
+                ++nLowPriorityRunning;
+            boost::chrono::system_clock::time_point start = boost::chrono::system_clock::now();
             {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
             }
+            boost::chrono::system_clock::time_point end = boost::chrono::system_clock::now();
+            if (fRunningLow) {
+                --nLowPriorityRunning;
+                fRunningLow = false;
+                newTaskScheduled.notify_all();
+            }
+
+            TaskStats& stats = mapTaskStats[task.strName];
+            boost::chrono::microseconds runTime = boost::chrono::duration_cast<boost::chrono::microseconds>(end - start);
+            boost::chrono::microseconds lateness = start > t ? boost::chrono::duration_cast<boost::chrono::microseconds>(start - t) : boost::chrono::microseconds(0);
+            stats.nRuns++;
+            stats.runTime += runTime;
+            stats.maxRunTime = std::max(stats.maxRunTime, runTime);
+            stats.lateness += lateness;
+            stats.maxLateness = std::max(stats.maxLateness, lateness);
+
+            if (task.nRepeatSeconds > 0 && setRepeating.count(task.id))
+                taskQueue.insert(std::make_pair(end + boost::chrono::seconds(task.nRepeatSeconds), task));
         } catch (...) {
+            if (fRunningLow) {
+                --nLowPriorityRunning;
+                newTaskScheduled.notify_all();
+            }
             --nThreadsServicingQueue;
             throw;
         }
@@ -79,29 +126,56 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+CScheduler::TaskId CScheduler::insertTask(CScheduler::Function f, boost::chrono::system_clock::time_point t, Priority priority,
+                                          const std::string& strName, int64_t nRepeatSeconds)
 {
+    TaskId id;
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        Task task;
+        task.f = f;
+        task.id = id = nextTaskId++;
+        task.priority = priority;
+        task.strName = strName;
+        task.nRepeatSeconds = nRepeatSeconds;
+        taskQueue.insert(std::make_pair(t, task));
+        if (nRepeatSeconds > 0)
+            setRepeating.insert(id);
     }
-    newTaskScheduled.notify_one();
+    // A thread kept from a low priority task may be waiting for this one
+    newTaskScheduled.notify_all();
+    return id;
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                                        Priority priority, const std::string& strName)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    return insertTask(f, t, priority, strName, 0);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                               Priority priority, const std::string& strName)
 {
-    f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    return schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), priority, strName);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                                             Priority priority, const std::string& strName)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    return insertTask(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), priority, strName, std::max<int64_t>(deltaSeconds, 1));
+}
+
+bool CScheduler::unschedule(TaskId id)
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    bool fFound = setRepeating.erase(id) > 0;
+    for (TaskQueue::iterator it = taskQueue.begin(); it != taskQueue.end(); ++it) {
+        if (it->second.id == id) {
+            taskQueue.erase(it);
+            return true;
+        }
+    }
+    return fFound;
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -115,3 +189,9 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+std::map<std::string, CScheduler::TaskStats> CScheduler::getTaskStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return mapTaskStats;
+}
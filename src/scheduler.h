@@ -14,6 +14,14 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+
+/** -schedulerthreads default */
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+/** Maximum value for -schedulerthreads */
+static const int MAX_SCHEDULER_THREADS = 16;
 
 //
 // Simple class for background tasks that should be run
@@ -26,6 +34,10 @@
 // s->scheduleFromNow(boost::bind(Class::func, this, argument), 3);
 // boost::thread* t = new boost::thread(boost::bind(CScheduler::serviceQueue, s));
 //
+// Tasks that are due run highest priority first. Low priority tasks, such as
+// long maintenance jobs, are kept off the last thread servicing the queue
+// when there is more than one, so that they do not hold up the others.
+//
 // ... then at program shutdown, clean up the thread running serviceQueue:
 // t->interrupt();
 // t->join();
@@ -40,21 +52,47 @@ public:
     ~CScheduler();
 
     typedef boost::function<void(void)> Function;
+    // Identifies a task, and every run of a repeating one
+    typedef uint64_t TaskId;
+
+    enum Priority {
+        PRIORITY_HIGH,
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,
+    };
+
+    // The runs of the tasks with a name: how long they took, and how
+    // late after their time they started
+    struct TaskStats {
+        uint64_t nRuns;
+        boost::chrono::microseconds runTime;
+        boost::chrono::microseconds maxRunTime;
+        boost::chrono::microseconds lateness;
+        boost::chrono::microseconds maxLateness;
+
+        TaskStats() : nRuns(0), runTime(0), maxRunTime(0), lateness(0), maxLateness(0) {}
+    };
 
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    TaskId schedule(Function f, boost::chrono::system_clock::time_point t,
+                    Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    TaskId scheduleFromNow(Function f, int64_t deltaSeconds,
+                           Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    TaskId scheduleEvery(Function f, int64_t deltaSeconds,
+                         Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
-    // To keep things as simple as possible, there is no unschedule.
+    // Remove a task from the queue, and keep a repeating one from being
+    // scheduled again. A run that has started is not interrupted. Returns
+    // false if the task already ran or was unscheduled.
+    bool unschedule(TaskId id);
 
     // Services the queue 'forever'. Should be run in a thread,
     // and interrupted using boost::interrupt_thread
@@ -70,14 +108,36 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // The stats of the tasks run so far, by name ("" for the unnamed ones)
+    std::map<std::string, TaskStats> getTaskStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        TaskId id;
+        Priority priority;
+        std::string strName;
+        int64_t nRepeatSeconds; // 0 unless scheduled by scheduleEvery
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    int nLowPriorityRunning;
     bool stopRequested;
     bool stopWhenEmpty;
+    TaskId nextTaskId;
+    // Repeating tasks that have not been unscheduled
+    std::set<TaskId> setRepeating;
+    std::map<std::string, TaskStats> mapTaskStats;
+
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    TaskId insertTask(Function f, boost::chrono::system_clock::time_point t, Priority priority,
+                      const std::string& strName, int64_t nRepeatSeconds);
+    // The due task with the highest priority this thread may run, or end
+    TaskQueue::iterator pickTask(boost::chrono::system_clock::time_point now);
 };
 
 #endif
@@ -1339,6 +1339,89 @@ bool TransactionSignatureChecker::CheckLockTime(const CScriptNum& nLockTime) con
 }
 
 
+/**
+ * The stack a scriptSig of plain data pushes leaves, or false if it holds
+ * anything else or a push EvalScript would reject.
+ */
+static bool GetScriptSigPushes(const CScript& scriptSig, unsigned int flags, vector<valtype>& stack)
+{
+    if (scriptSig.size() > MAX_SCRIPT_SIZE)
+        return false;
+    bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+    CScript::const_iterator pc = scriptSig.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    while (pc < scriptSig.end()) {
+        if (!scriptSig.GetOp(pc, opcode, vchPushValue))
+            return false;
+        if (opcode > OP_PUSHDATA4 || vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if (fRequireMinimal && !CheckMinimalPush(vchPushValue, opcode))
+            return false;
+        stack.push_back(vchPushValue);
+    }
+    return true;
+}
+
+/**
+ * Verify a spend of a pay-to-pubkey-hash or (with SCRIPT_VERIFY_P2SH)
+ * pay-to-script-hash output without interpreting the scriptPubKey. Only
+ * returns true for spends VerifyScript accepts; anything else is left to it,
+ * so that it sets the error.
+ */
+static bool VerifyStandardScript(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId)
+{
+    bool fPayToPubKeyHash = scriptPubKey.IsPayToPublicKeyHash();
+    bool fPayToScriptHash = (flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash();
+    if (!fPayToPubKeyHash && !fPayToScriptHash)
+        return false;
+
+    try {
+        vector<valtype> stack;
+        if (!GetScriptSigPushes(scriptSig, flags, stack))
+            return false;
+
+        if (fPayToPubKeyHash) {
+            // <sig> <pubkey> | OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG
+            if (stack.size() != 2)
+                return false;
+            const valtype& vchSig = stack[0];
+            const valtype& vchPubKey = stack[1];
+            unsigned char vchHash[20];
+            CHash160().Write(begin_ptr(vchPubKey), vchPubKey.size()).Finalize(vchHash);
+            if (memcmp(vchHash, &scriptPubKey[3], 20) != 0)
+                return false;
+            if (!CheckSignatureEncoding(vchSig, flags, NULL) || !CheckPubKeyEncoding(vchPubKey, flags, NULL))
+                return false;
+            return checker.CheckSig(vchSig, vchPubKey, scriptPubKey, consensusBranchId);
+        }
+
+        // <...> <script> | OP_HASH160 <hash> OP_EQUAL, which pushes one more
+        // item than the scriptSig, then the script on the rest of the stack
+        if (stack.empty() || stack.size() >= 1000)
+            return false;
+        const valtype& vchScript = stack.back();
+        unsigned char vchHash[20];
+        CHash160().Write(begin_ptr(vchScript), vchScript.size()).Finalize(vchHash);
+        if (memcmp(vchHash, &scriptPubKey[2], 20) != 0)
+            return false;
+        CScript redeemScript(vchScript.begin(), vchScript.end());
+        popstack(stack);
+        if (!EvalScript(stack, redeemScript, flags, checker, consensusBranchId))
+            return false;
+        if (stack.empty() || !CastToBool(stack.back()))
+            return false;
+        return (flags & SCRIPT_VERIFY_CLEANSTACK) == 0 || stack.size() == 1;
+    } catch (...) {
+        return false;
+    }
+}
+
 bool VerifyScript(
     const CScript& scriptSig,
     const CScript& scriptPubKey,
@@ -1349,6 +1432,9 @@ bool VerifyScript(
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
+    if (VerifyStandardScript(scriptSig, scriptPubKey, flags, checker, consensusBranchId))
+        return set_success(serror);
+
     if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !scriptSig.IsPushOnly()) {
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
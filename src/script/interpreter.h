@@ -94,6 +94,8 @@ struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs, hashJoinSplits, hashShieldedSpends, hashShieldedOutputs;
 
+    //! Placeholder for a transaction that has no signatures to check
+    PrecomputedTransactionData() {}
     PrecomputedTransactionData(const CTransaction& tx);
 };
 
@@ -68,6 +68,25 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
         return true;
     }
 
+    // Shortcuts for the usual encodings of pay-to-pubkey-hash and pay-to-pubkey,
+    // matched byte for byte; the scan below still catches the other pushes the
+    // templates accept
+    if (scriptPubKey.IsPayToPublicKeyHash())
+    {
+        typeRet = TX_PUBKEYHASH;
+        vSolutionsRet.clear();
+        vSolutionsRet.push_back(vector<unsigned char>(scriptPubKey.begin()+3, scriptPubKey.begin()+23));
+        return true;
+    }
+    if ((scriptPubKey.size() == 35 && scriptPubKey[0] == 33 && scriptPubKey[34] == OP_CHECKSIG) ||
+        (scriptPubKey.size() == 67 && scriptPubKey[0] == 65 && scriptPubKey[66] == OP_CHECKSIG))
+    {
+        typeRet = TX_PUBKEY;
+        vSolutionsRet.clear();
+        vSolutionsRet.push_back(vector<unsigned char>(scriptPubKey.begin()+1, scriptPubKey.end()-1));
+        return true;
+    }
+
     // Scan templates
     const CScript& script1 = scriptPubKey;
     BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
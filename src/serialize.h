@@ -517,12 +517,12 @@ template<typename Stream, typename C> void Unserialize(Stream& is, std::basic_st
  * prevector
  * prevectors of unsigned char are a special case and are intended to be serialized as a single opaque blob.
  */
-template<typename Stream, unsigned int N, typename T> void Serialize_impl(Stream& os, const prevector<N, T>& v, const unsigned char&);
-template<typename Stream, unsigned int N, typename T, typename V> void Serialize_impl(Stream& os, const prevector<N, T>& v, const V&);
-template<typename Stream, unsigned int N, typename T> inline void Serialize(Stream& os, const prevector<N, T>& v);
-template<typename Stream, unsigned int N, typename T> void Unserialize_impl(Stream& is, prevector<N, T>& v, const unsigned char&);
-template<typename Stream, unsigned int N, typename T, typename V> void Unserialize_impl(Stream& is, prevector<N, T>& v, const V&);
-template<typename Stream, unsigned int N, typename T> inline void Unserialize(Stream& is, prevector<N, T>& v);
+template<typename Stream, unsigned int N, typename T, typename S, typename D> void Serialize_impl(Stream& os, const prevector<N, T, S, D>& v, const unsigned char&);
+template<typename Stream, unsigned int N, typename T, typename S, typename D, typename V> void Serialize_impl(Stream& os, const prevector<N, T, S, D>& v, const V&);
+template<typename Stream, unsigned int N, typename T, typename S, typename D> inline void Serialize(Stream& os, const prevector<N, T, S, D>& v);
+template<typename Stream, unsigned int N, typename T, typename S, typename D> void Unserialize_impl(Stream& is, prevector<N, T, S, D>& v, const unsigned char&);
+template<typename Stream, unsigned int N, typename T, typename S, typename D, typename V> void Unserialize_impl(Stream& is, prevector<N, T, S, D>& v, const V&);
+template<typename Stream, unsigned int N, typename T, typename S, typename D> inline void Unserialize(Stream& is, prevector<N, T, S, D>& v);
 
 /**
  * vector
@@ -549,9 +549,14 @@ template<typename Stream, typename T> void Unserialize(Stream& is, boost::option
 
 /**
  * array
+ * arrays of unsigned char (ciphertexts, proofs, signatures) are written and read as a single block.
  */
-template<typename Stream, typename T, std::size_t N> void Serialize(Stream& os, const std::array<T, N>& item);
-template<typename Stream, typename T, std::size_t N> void Unserialize(Stream& is, std::array<T, N>& item);
+template<typename Stream, typename T, std::size_t N> void Serialize_impl(Stream& os, const std::array<T, N>& item, const unsigned char&);
+template<typename Stream, typename T, std::size_t N, typename V> void Serialize_impl(Stream& os, const std::array<T, N>& item, const V&);
+template<typename Stream, typename T, std::size_t N> inline void Serialize(Stream& os, const std::array<T, N>& item);
+template<typename Stream, typename T, std::size_t N> void Unserialize_impl(Stream& is, std::array<T, N>& item, const unsigned char&);
+template<typename Stream, typename T, std::size_t N, typename V> void Unserialize_impl(Stream& is, std::array<T, N>& item, const V&);
+template<typename Stream, typename T, std::size_t N> inline void Unserialize(Stream& is, std::array<T, N>& item);
 
 /**
  * pair
@@ -635,31 +640,31 @@ void Unserialize(Stream& is, std::basic_string<C>& str)
 /**
  * prevector
  */
-template<typename Stream, unsigned int N, typename T>
-void Serialize_impl(Stream& os, const prevector<N, T>& v, const unsigned char&)
+template<typename Stream, unsigned int N, typename T, typename S, typename D>
+void Serialize_impl(Stream& os, const prevector<N, T, S, D>& v, const unsigned char&)
 {
     WriteCompactSize(os, v.size());
     if (!v.empty())
         os.write((char*)&v[0], v.size() * sizeof(T));
 }
 
-template<typename Stream, unsigned int N, typename T, typename V>
-void Serialize_impl(Stream& os, const prevector<N, T>& v, const V&)
+template<typename Stream, unsigned int N, typename T, typename S, typename D, typename V>
+void Serialize_impl(Stream& os, const prevector<N, T, S, D>& v, const V&)
 {
     WriteCompactSize(os, v.size());
-    for (typename prevector<N, T>::const_iterator vi = v.begin(); vi != v.end(); ++vi)
+    for (typename prevector<N, T, S, D>::const_iterator vi = v.begin(); vi != v.end(); ++vi)
         ::Serialize(os, (*vi));
 }
 
-template<typename Stream, unsigned int N, typename T>
-inline void Serialize(Stream& os, const prevector<N, T>& v)
+template<typename Stream, unsigned int N, typename T, typename S, typename D>
+inline void Serialize(Stream& os, const prevector<N, T, S, D>& v)
 {
     Serialize_impl(os, v, T());
 }
 
 
-template<typename Stream, unsigned int N, typename T>
-void Unserialize_impl(Stream& is, prevector<N, T>& v, const unsigned char&)
+template<typename Stream, unsigned int N, typename T, typename S, typename D>
+void Unserialize_impl(Stream& is, prevector<N, T, S, D>& v, const unsigned char&)
 {
     // Limit size per read so bogus size value won't cause out of memory
     v.clear();
@@ -674,8 +679,8 @@ void Unserialize_impl(Stream& is, prevector<N, T>& v, const unsigned char&)
     }
 }
 
-template<typename Stream, unsigned int N, typename T, typename V>
-void Unserialize_impl(Stream& is, prevector<N, T>& v, const V&)
+template<typename Stream, unsigned int N, typename T, typename S, typename D, typename V>
+void Unserialize_impl(Stream& is, prevector<N, T, S, D>& v, const V&)
 {
     v.clear();
     unsigned int nSize = ReadCompactSize(is);
@@ -692,8 +697,8 @@ void Unserialize_impl(Stream& is, prevector<N, T>& v, const V&)
     }
 }
 
-template<typename Stream, unsigned int N, typename T>
-inline void Unserialize(Stream& is, prevector<N, T>& v)
+template<typename Stream, unsigned int N, typename T, typename S, typename D>
+inline void Unserialize(Stream& is, prevector<N, T, S, D>& v)
 {
     Unserialize_impl(is, v, T());
 }
@@ -827,7 +832,14 @@ void Unserialize(Stream& is, boost::optional<T>& item)
  * array
  */
 template<typename Stream, typename T, std::size_t N>
-void Serialize(Stream& os, const std::array<T, N>& item)
+void Serialize_impl(Stream& os, const std::array<T, N>& item, const unsigned char&)
+{
+    if (N > 0)
+        os.write((char*)&item[0], N * sizeof(T));
+}
+
+template<typename Stream, typename T, std::size_t N, typename V>
+void Serialize_impl(Stream& os, const std::array<T, N>& item, const V&)
 {
     for (size_t i = 0; i < N; i++) {
         Serialize(os, item[i]);
@@ -835,13 +847,32 @@ void Serialize(Stream& os, const std::array<T, N>& item)
 }
 
 template<typename Stream, typename T, std::size_t N>
-void Unserialize(Stream& is, std::array<T, N>& item)
+inline void Serialize(Stream& os, const std::array<T, N>& item)
+{
+    Serialize_impl(os, item, T());
+}
+
+template<typename Stream, typename T, std::size_t N>
+void Unserialize_impl(Stream& is, std::array<T, N>& item, const unsigned char&)
+{
+    if (N > 0)
+        is.read((char*)&item[0], N * sizeof(T));
+}
+
+template<typename Stream, typename T, std::size_t N, typename V>
+void Unserialize_impl(Stream& is, std::array<T, N>& item, const V&)
 {
     for (size_t i = 0; i < N; i++) {
         Unserialize(is, item[i]);
     }
 }
 
+template<typename Stream, typename T, std::size_t N>
+inline void Unserialize(Stream& is, std::array<T, N>& item)
+{
+    Unserialize_impl(is, item, T());
+}
+
 
 /**
  * pair
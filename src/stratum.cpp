@@ -0,0 +1,561 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "stratum.h"
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "miner.h"
+#include "netbase.h"
+#include "pow.h"
+#include "script/script.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validationinterface.h"
+
+#include <univalue.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/** Longest line accepted from a miner; a submitted solution takes under 3KB */
+static const size_t MAX_STRATUM_LINE = 16384;
+/** Jobs kept on one tip, for shares found on the older ones */
+static const size_t MAX_STRATUM_JOBS = 16;
+/** Leading bytes of the block nonce set by the server, unique per connection */
+static const size_t STRATUM_NONCE1_SIZE = 4;
+
+// Error codes of mining.submit
+static const int STRATUM_ERR_OTHER = 20;
+static const int STRATUM_ERR_JOB_NOT_FOUND = 21;
+static const int STRATUM_ERR_DUPLICATE = 22;
+static const int STRATUM_ERR_LOW_DIFFICULTY = 23;
+static const int STRATUM_ERR_UNAUTHORIZED = 24;
+static const int STRATUM_ERR_NOT_SUBSCRIBED = 25;
+
+/** A block template handed out to the miners */
+struct CStratumJob
+{
+    std::string strId;
+    /** The block with its merkle root set; miners fill in the time, nonce and solution */
+    CBlock block;
+    /** Whether the job replaces all earlier ones, being on a new tip */
+    bool fClean;
+    /** Hashes of the shares submitted, to turn away duplicates (cs_stratum) */
+    std::set<uint256> setShares;
+};
+
+static CCriticalSection cs_stratum;
+static std::map<std::string, std::shared_ptr<CStratumJob> > mapStratumJobs;
+static std::deque<std::string> vStratumJobOrder;
+static std::shared_ptr<CStratumJob> pStratumJob;
+static arith_uint256 stratumShareTarget;
+
+/** Set when a block was found, so the next template pays to a fresh script */
+static std::atomic<bool> fStratumKeepScript(false);
+
+static struct event_base* stratumBase = 0;
+static struct evconnlistener* stratumListener = 0;
+static boost::thread stratumEventThread;
+static boost::thread stratumTemplateThread;
+
+static boost::mutex csStratumTemplate;
+static boost::condition_variable condStratumTemplate;
+static bool fStratumNewTip = false;
+static bool fStratumStopping = false;
+
+/** A connected miner; only touched on the event thread */
+class CStratumClient
+{
+public:
+    struct bufferevent* bev;
+    std::string strAddr;
+    std::vector<unsigned char> vNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+
+    CStratumClient(struct bufferevent* bevIn, const std::string& strAddrIn, uint32_t nId) :
+        bev(bevIn), strAddr(strAddrIn), vNonce1(STRATUM_NONCE1_SIZE), fSubscribed(false), fAuthorized(false)
+    {
+        WriteLE32(vNonce1.data(), nId);
+    }
+
+    ~CStratumClient()
+    {
+        bufferevent_free(bev);
+    }
+};
+
+static std::map<struct bufferevent*, std::unique_ptr<CStratumClient> > mapStratumClients;
+static uint32_t nStratumClientCount = 0;
+
+static std::string HexLE32(uint32_t n)
+{
+    unsigned char buf[4];
+    WriteLE32(buf, n);
+    return HexStr(buf, buf + 4);
+}
+
+static void StratumSend(CStratumClient& client, const UniValue& msg)
+{
+    std::string str = msg.write() + "\n";
+    bufferevent_write(client.bev, str.data(), str.size());
+}
+
+static void StratumReply(CStratumClient& client, const UniValue& id, const UniValue& result)
+{
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", NullUniValue));
+    StratumSend(client, reply);
+}
+
+static void StratumError(CStratumClient& client, const UniValue& id, int nCode, const std::string& strMessage)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(nCode);
+    error.push_back(strMessage);
+    error.push_back(NullUniValue);
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", NullUniValue));
+    reply.push_back(Pair("error", error));
+    StratumSend(client, reply);
+}
+
+static void StratumNotify(CStratumClient& client, const std::string& strMethod, const UniValue& params)
+{
+    UniValue msg(UniValue::VOBJ);
+    msg.push_back(Pair("id", NullUniValue));
+    msg.push_back(Pair("method", strMethod));
+    msg.push_back(Pair("params", params));
+    StratumSend(client, msg);
+}
+
+/** The parameters of mining.notify, with the header fields as serialized */
+static UniValue JobParams(const CStratumJob& job, bool fClean)
+{
+    const CBlock& block = job.block;
+    UniValue params(UniValue::VARR);
+    params.push_back(job.strId);
+    params.push_back(HexLE32(block.nVersion));
+    params.push_back(HexStr(block.hashPrevBlock.begin(), block.hashPrevBlock.end()));
+    params.push_back(HexStr(block.hashMerkleRoot.begin(), block.hashMerkleRoot.end()));
+    params.push_back(HexStr(block.hashFinalSaplingRoot.begin(), block.hashFinalSaplingRoot.end()));
+    params.push_back(HexLE32(block.nTime));
+    params.push_back(HexLE32(block.nBits));
+    params.push_back(fClean);
+    return params;
+}
+
+/** Send the share target and the current job to a miner that just became ready for work */
+static void StratumSendWork(CStratumClient& client)
+{
+    UniValue target(UniValue::VARR);
+    target.push_back(ArithToUint256(stratumShareTarget).GetHex());
+    StratumNotify(client, "mining.set_target", target);
+
+    std::shared_ptr<CStratumJob> job;
+    {
+        LOCK(cs_stratum);
+        job = pStratumJob;
+    }
+    if (job)
+        StratumNotify(client, "mining.notify", JobParams(*job, true));
+}
+
+static void StratumSubmit(CStratumClient& client, const UniValue& id, const UniValue& params)
+{
+    if (!client.fSubscribed)
+        return StratumError(client, id, STRATUM_ERR_NOT_SUBSCRIBED, "Not subscribed");
+    if (!client.fAuthorized)
+        return StratumError(client, id, STRATUM_ERR_UNAUTHORIZED, "Unauthorized worker");
+    if (params.size() < 5 || !params[1].isStr() || !params[2].isStr() || !params[3].isStr() || !params[4].isStr())
+        return StratumError(client, id, STRATUM_ERR_OTHER, "Malformed submission");
+
+    const std::string& strTime = params[2].get_str();
+    const std::string& strNonce2 = params[3].get_str();
+    const std::string& strSolution = params[4].get_str();
+    if (strTime.size() != 8 || !IsHex(strTime) ||
+        strNonce2.size() != 2 * (32 - STRATUM_NONCE1_SIZE) || !IsHex(strNonce2) || !IsHex(strSolution))
+        return StratumError(client, id, STRATUM_ERR_OTHER, "Malformed submission");
+
+    std::shared_ptr<CStratumJob> job;
+    {
+        LOCK(cs_stratum);
+        std::map<std::string, std::shared_ptr<CStratumJob> >::iterator it = mapStratumJobs.find(params[1].get_str());
+        if (it == mapStratumJobs.end())
+            return StratumError(client, id, STRATUM_ERR_JOB_NOT_FOUND, "Job not found");
+        job = it->second;
+    }
+
+    CBlockHeader header = job->block.GetBlockHeader();
+    std::vector<unsigned char> vTime = ParseHex(strTime);
+    header.nTime = ReadLE32(vTime.data());
+    std::vector<unsigned char> vNonce2 = ParseHex(strNonce2);
+    std::copy(client.vNonce1.begin(), client.vNonce1.end(), header.nNonce.begin());
+    std::copy(vNonce2.begin(), vNonce2.end(), header.nNonce.begin() + STRATUM_NONCE1_SIZE);
+    try {
+        CDataStream ss(ParseHex(strSolution), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> header.nSolution;
+        if (!ss.empty())
+            return StratumError(client, id, STRATUM_ERR_OTHER, "Malformed solution");
+    } catch (const std::ios_base::failure&) {
+        return StratumError(client, id, STRATUM_ERR_OTHER, "Malformed solution");
+    }
+
+    // The hash is cheap; only shares that meet the target get their
+    // solution checked
+    uint256 hash = header.GetHash();
+    arith_uint256 hashTarget = arith_uint256().SetCompact(header.nBits);
+    if (UintToArith256(hash) > std::max(stratumShareTarget, hashTarget))
+        return StratumError(client, id, STRATUM_ERR_LOW_DIFFICULTY, "Low difficulty share");
+    const CChainParams& chainparams = Params();
+    if (!CheckEquihashSolution(&header, chainparams.GetConsensus()))
+        return StratumError(client, id, STRATUM_ERR_OTHER, "Invalid solution");
+    {
+        LOCK(cs_stratum);
+        if (!job->setShares.insert(hash).second)
+            return StratumError(client, id, STRATUM_ERR_DUPLICATE, "Duplicate share");
+    }
+    LogPrint("stratum", "stratum: share %s from %s for job %s\n", hash.GetHex(), client.strAddr, job->strId);
+
+    if (UintToArith256(hash) <= hashTarget) {
+        CBlock block = job->block;
+        block.nTime = header.nTime;
+        block.nNonce = header.nNonce;
+        block.nSolution = header.nSolution;
+        LogPrintf("stratum: block %s found by %s\n", hash.GetHex(), client.strAddr);
+        CValidationState state;
+        if (!ProcessNewBlock(state, chainparams, NULL, &block, true, NULL) || !state.IsValid()) {
+            LogPrintf("stratum: block %s rejected: %s\n", hash.GetHex(), state.GetRejectReason());
+            return StratumError(client, id, STRATUM_ERR_OTHER, "Block rejected: " + state.GetRejectReason());
+        }
+        fStratumKeepScript = true;
+    }
+    StratumReply(client, id, true);
+}
+
+/** Handle one request; returns false to drop the connection */
+static bool StratumHandle(CStratumClient& client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject()) {
+        LogPrint("stratum", "stratum: malformed request from %s\n", client.strAddr);
+        return false;
+    }
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr() || !params.isArray()) {
+        StratumError(client, id, STRATUM_ERR_OTHER, "Malformed request");
+        return true;
+    }
+
+    const std::string& strMethod = method.get_str();
+    if (strMethod == "mining.subscribe") {
+        UniValue result(UniValue::VARR);
+        result.push_back(NullUniValue);
+        result.push_back(HexStr(client.vNonce1));
+        StratumReply(client, id, result);
+        bool fReady = !client.fSubscribed && client.fAuthorized;
+        client.fSubscribed = true;
+        if (fReady)
+            StratumSendWork(client);
+    } else if (strMethod == "mining.authorize") {
+        // Blocks pay to the node's mining script, whoever the worker is
+        StratumReply(client, id, true);
+        bool fReady = client.fSubscribed && !client.fAuthorized;
+        client.fAuthorized = true;
+        if (fReady)
+            StratumSendWork(client);
+    } else if (strMethod == "mining.submit") {
+        StratumSubmit(client, id, params);
+    } else if (strMethod == "mining.extranonce.subscribe") {
+        StratumReply(client, id, false);
+    } else {
+        StratumError(client, id, STRATUM_ERR_OTHER, "Method not found");
+    }
+    return true;
+}
+
+static void StratumDisconnect(CStratumClient* client)
+{
+    LogPrint("stratum", "stratum: %s disconnected\n", client->strAddr);
+    mapStratumClients.erase(client->bev);
+}
+
+static void StratumReadCallback(struct bufferevent* bev, void* ctx)
+{
+    CStratumClient* client = (CStratumClient*)ctx;
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t nRead = 0;
+    char* line;
+    while ((line = evbuffer_readln(input, &nRead, EVBUFFER_EOL_CRLF)) != NULL) {
+        std::string strLine(line, nRead);
+        free(line);
+        if (strLine.empty())
+            continue;
+        if (!StratumHandle(*client, strLine)) {
+            StratumDisconnect(client);
+            return;
+        }
+    }
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE) {
+        LogPrint("stratum", "stratum: line too long from %s\n", client->strAddr);
+        StratumDisconnect(client);
+    }
+}
+
+static void StratumEventCallback(struct bufferevent* bev, short what, void* ctx)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        StratumDisconnect((CStratumClient*)ctx);
+}
+
+static void StratumAcceptCallback(struct evconnlistener* listener, evutil_socket_t fd,
+                                  struct sockaddr* addr, int socklen, void* ctx)
+{
+    struct bufferevent* bev = bufferevent_socket_new(stratumBase, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    CService service;
+    service.SetSockAddr(addr);
+    CStratumClient* client = new CStratumClient(bev, service.ToString(), nStratumClientCount++);
+    mapStratumClients[bev].reset(client);
+    bufferevent_setcb(bev, StratumReadCallback, NULL, StratumEventCallback, client);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+    LogPrint("stratum", "stratum: %s connected\n", client->strAddr);
+}
+
+/** Send a new job to the miners; runs on the event thread */
+static void StratumNotifyCallback(evutil_socket_t fd, short what, void* arg)
+{
+    std::unique_ptr<std::shared_ptr<CStratumJob> > job((std::shared_ptr<CStratumJob>*)arg);
+    UniValue params = JobParams(**job, (*job)->fClean);
+    for (auto& entry : mapStratumClients) {
+        CStratumClient& client = *entry.second;
+        if (client.fSubscribed && client.fAuthorized)
+            StratumNotify(client, "mining.notify", params);
+    }
+}
+
+static void StratumPublish(const CBlockTemplate& blocktemplate, bool fClean)
+{
+    static uint32_t nJobCount = 0;
+    std::shared_ptr<CStratumJob> job = std::make_shared<CStratumJob>();
+    job->strId = strprintf("%x", ++nJobCount);
+    job->block = blocktemplate.block;
+    job->block.hashMerkleRoot = job->block.BuildMerkleTree();
+    job->fClean = fClean;
+    {
+        LOCK(cs_stratum);
+        if (fClean) {
+            mapStratumJobs.clear();
+            vStratumJobOrder.clear();
+        }
+        while (vStratumJobOrder.size() >= MAX_STRATUM_JOBS) {
+            mapStratumJobs.erase(vStratumJobOrder.front());
+            vStratumJobOrder.pop_front();
+        }
+        mapStratumJobs[job->strId] = job;
+        vStratumJobOrder.push_back(job->strId);
+        pStratumJob = job;
+    }
+
+    // Hand the job to the event thread, which owns the connections
+    std::shared_ptr<CStratumJob>* arg = new std::shared_ptr<CStratumJob>(job);
+    struct timeval tv = {0, 0};
+    if (event_base_once(stratumBase, -1, EV_TIMEOUT, StratumNotifyCallback, arg, &tv) != 0)
+        delete arg;
+}
+
+/**
+ * Build and publish the jobs. On a new tip a coinbase-only job goes out
+ * first, as getblocktemplate does with -fastblocktemplate, followed at once
+ * by one with the mempool transactions; after that a job is rebuilt every
+ * STRATUM_TEMPLATE_REFRESH seconds while new transactions arrive.
+ */
+static void ThreadStratumTemplates()
+{
+    const CChainParams& chainparams = Params();
+    boost::shared_ptr<CReserveScript> coinbaseScript;
+    const CBlockIndex* pindexLast = NULL;
+    unsigned int nTransactionsUpdatedLast = 0;
+    int64_t nLastBuilt = 0;
+    bool fNoScriptLogged = false;
+
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(csStratumTemplate);
+            if (!fStratumNewTip && !fStratumStopping)
+                condStratumTemplate.timed_wait(lock, boost::posix_time::seconds(STRATUM_TEMPLATE_REFRESH));
+            if (fStratumStopping)
+                return;
+            fStratumNewTip = false;
+        }
+
+        if (fStratumKeepScript.exchange(false) && coinbaseScript) {
+            coinbaseScript->KeepScript();
+            coinbaseScript.reset();
+        }
+        if (!coinbaseScript)
+            GetMainSignals().ScriptForMining(coinbaseScript);
+        if (!coinbaseScript || coinbaseScript->reserveScript.empty()) {
+            if (!fNoScriptLogged)
+                LogPrintf("stratum: No coinbase script available (mining requires a wallet or -mineraddress)\n");
+            fNoScriptLogged = true;
+            continue;
+        }
+
+        LOCK(cs_main);
+        if (IsInitialBlockDownload(chainparams))
+            continue;
+        bool fNewTip = chainActive.Tip() != pindexLast;
+        if (!fNewTip && (mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast ||
+                         GetTime() - nLastBuilt < STRATUM_TEMPLATE_REFRESH))
+            continue;
+        pindexLast = chainActive.Tip();
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        nLastBuilt = GetTime();
+
+        try {
+            bool fFast = fNewTip && GetBoolArg("-fastblocktemplate", DEFAULT_FAST_BLOCK_TEMPLATE) && mempool.size() > 0;
+            if (fFast) {
+                std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, coinbaseScript->reserveScript, false));
+                if (pblocktemplate)
+                    StratumPublish(*pblocktemplate, true);
+            }
+            std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, coinbaseScript->reserveScript));
+            if (pblocktemplate)
+                StratumPublish(*pblocktemplate, fNewTip && !fFast);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("stratum: %s\n", e.what());
+        }
+    }
+}
+
+static void ThreadStratumEvents()
+{
+    event_base_dispatch(stratumBase);
+}
+
+/** Wakes the template thread when the tip changes */
+class CStratumNotifier : public CValidationInterface
+{
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(csStratumTemplate);
+        fStratumNewTip = true;
+        condStratumTemplate.notify_one();
+    }
+};
+
+static CStratumNotifier* pStratumNotifier = NULL;
+
+bool StartStratum()
+{
+    assert(!stratumBase);
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+
+    int64_t nDifficulty = std::max(GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY), (int64_t)1);
+    stratumShareTarget = UintToArith256(Params().GetConsensus().powLimit) / arith_uint256(nDifficulty);
+
+    std::string strBind = GetArg("-stratumbind", "127.0.0.1");
+    CService addrBind;
+    if (!Lookup(strBind.c_str(), addrBind, GetArg("-stratumport", DEFAULT_STRATUM_PORT), false)) {
+        LogPrintf("stratum: Invalid -stratumbind address %s\n", strBind);
+        return false;
+    }
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+        LogPrintf("stratum: Invalid -stratumbind address %s\n", strBind);
+        return false;
+    }
+
+    stratumBase = event_base_new();
+    if (!stratumBase) {
+        LogPrintf("stratum: Unable to create event_base\n");
+        return false;
+    }
+    stratumListener = evconnlistener_new_bind(stratumBase, StratumAcceptCallback, NULL,
+                                              LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1,
+                                              (struct sockaddr*)&sockaddr, len);
+    if (!stratumListener) {
+        LogPrintf("stratum: Unable to bind to %s\n", addrBind.ToString());
+        event_base_free(stratumBase);
+        stratumBase = 0;
+        return false;
+    }
+    LogPrintf("stratum: Listening on %s, share target %s\n", addrBind.ToString(), stratumShareTarget.GetHex());
+
+    pStratumNotifier = new CStratumNotifier();
+    RegisterValidationInterface(pStratumNotifier);
+    fStratumNewTip = true;
+    fStratumStopping = false;
+    stratumTemplateThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratumjobs", &ThreadStratumTemplates));
+    stratumEventThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratum", &ThreadStratumEvents));
+    return true;
+}
+
+void InterruptStratum()
+{
+    if (stratumBase) {
+        {
+            boost::unique_lock<boost::mutex> lock(csStratumTemplate);
+            fStratumStopping = true;
+        }
+        condStratumTemplate.notify_all();
+        event_base_loopbreak(stratumBase);
+    }
+}
+
+void StopStratum()
+{
+    if (stratumBase) {
+        InterruptStratum();
+        stratumTemplateThread.join();
+        stratumEventThread.join();
+        UnregisterValidationInterface(pStratumNotifier);
+        delete pStratumNotifier;
+        pStratumNotifier = NULL;
+        mapStratumClients.clear();
+        evconnlistener_free(stratumListener);
+        stratumListener = 0;
+        event_base_free(stratumBase);
+        stratumBase = 0;
+        LOCK(cs_stratum);
+        mapStratumJobs.clear();
+        vStratumJobOrder.clear();
+        pStratumJob.reset();
+    }
+}
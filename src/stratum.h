@@ -0,0 +1,31 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+/**
+ * Stratum server for Equihash miners, as specified by ZIP 301.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include <stdint.h>
+
+/** Default for -stratum */
+static const bool DEFAULT_STRATUM = false;
+/** Default for -stratumport */
+static const int DEFAULT_STRATUM_PORT = 3333;
+/** Default for -stratumdifficulty: shares meet the proof-of-work limit */
+static const int64_t DEFAULT_STRATUM_DIFFICULTY = 1;
+/** Seconds between new jobs for the transactions that reached the mempool */
+static const int STRATUM_TEMPLATE_REFRESH = 5;
+
+/**
+ * Start serving jobs to Stratum miners. A job is pushed to every miner as
+ * soon as the tip changes, built the way getblocktemplate builds its
+ * templates, and shares are checked and blocks submitted within the node.
+ */
+bool StartStratum();
+void InterruptStratum();
+void StopStratum();
+
+#endif // BITCOIN_STRATUM_H
@@ -172,6 +172,7 @@ public:
     bool empty() const                               { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
+    size_type capacity() const                       { return vch.capacity(); }
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
@@ -251,6 +252,13 @@ public:
         nReadPos = 0;
     }
 
+    //! Exchange the underlying buffer with vchOther, keeping both allocations; the read position is reset
+    void swap(vector_type& vchOther)
+    {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
+
     bool Rewind(size_type n)
     {
         // Rewind by n characters if the buffer hasn't been compacted yet
@@ -498,6 +506,54 @@ public:
     }
 };
 
+/** Read-only stream over memory owned by someone else, such as a mapped
+ * file. The memory must stay valid for the lifetime of the reader.
+ */
+class CMemoryReader
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    const char* pcur;
+    const char* pend;
+
+public:
+    CMemoryReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) :
+        nType(nTypeIn), nVersion(nVersionIn), pcur(pbegin), pend(pendIn) {}
+
+    //
+    // Stream subset
+    //
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+    size_t size() const          { return pend - pcur; }
+    bool empty() const           { return pcur == pend; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read: end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore: end of data");
+        pcur += nSize;
+    }
+
+    template<typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind a given number of bytes.
  *
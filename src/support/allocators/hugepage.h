@@ -0,0 +1,49 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_HUGEPAGE_H
+#define BITCOIN_SUPPORT_ALLOCATORS_HUGEPAGE_H
+
+#include "support/hugepages.h"
+
+#include <cstddef>
+
+/**
+ * Allocator mapping every allocation with AllocateHugePages, for the few
+ * very large vectors (such as the Equihash solver's lists) that are sized
+ * once and walked all over. Each allocation takes at least one huge page,
+ * so it does not suit containers that grow in small steps.
+ */
+template <typename T>
+class CHugePageAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef CHugePageAllocator<U> other;
+    };
+
+    CHugePageAllocator() {}
+    template <typename U>
+    CHugePageAllocator(const CHugePageAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(AllocateHugePages(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        FreeHugePages(p);
+    }
+
+    template <typename U>
+    bool operator==(const CHugePageAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CHugePageAllocator<U>&) const { return false; }
+};
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_HUGEPAGE_H
@@ -0,0 +1,213 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include "support/hugepages.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Memory resource that carves small allocations out of large chunks and
+ * keeps freed blocks on a free list per size, for node based containers
+ * with many entries of the same few sizes. Chunks are only returned to the
+ * system when the resource is destroyed, so a container that is emptied
+ * and destroyed releases its memory in bulk.
+ *
+ * Chunks start small, so that the many short lived containers (such as the
+ * coins views used to check a single transaction) stay cheap, and double
+ * up to MAX_CHUNK_SIZE as the container grows.
+ *
+ * With -hugepages, the chunks after the first few are whole huge pages,
+ * so that a large cache (the coins cache with a big -dbcache) is spread
+ * over few TLB entries.
+ *
+ * Blocks larger than MAX_POOLED_SIZE, such as hash table bucket arrays, are
+ * passed on to operator new. The resource is not thread safe; it belongs to
+ * the containers sharing it.
+ */
+class CPoolResource
+{
+public:
+    static const size_t ALIGN = sizeof(void*) > alignof(uint64_t) ? sizeof(void*) : alignof(uint64_t);
+    static const size_t MAX_POOLED_SIZE = 512;
+    static const size_t MIN_CHUNK_SIZE = 4 * 1024;
+    static const size_t MAX_CHUNK_SIZE = 256 * 1024;
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    //! Free lists indexed by block size / ALIGN
+    FreeBlock* vFree[MAX_POOLED_SIZE / ALIGN + 1];
+    std::vector<void*> vChunks;
+    //! Chunks mapped with AllocateHugePages
+    std::vector<void*> vHugeChunks;
+    char* pAvailable;
+    char* pAvailableEnd;
+    size_t nChunkUsage;
+    size_t nLargeUsage;
+
+    CPoolResource(const CPoolResource&);
+    CPoolResource& operator=(const CPoolResource&);
+
+    static size_t RoundUp(size_t nBytes)
+    {
+        return (std::max(nBytes, sizeof(FreeBlock)) + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    void PushFree(void* p, size_t nBytes)
+    {
+        FreeBlock* block = new (p) FreeBlock;
+        block->next = vFree[nBytes / ALIGN];
+        vFree[nBytes / ALIGN] = block;
+    }
+
+    void NewChunk()
+    {
+        // Keep what is left of the current chunk for blocks that still fit
+        size_t nLeft = pAvailableEnd - pAvailable;
+        if (nLeft >= RoundUp(1))
+            PushFree(pAvailable, nLeft / ALIGN * ALIGN);
+        size_t nChunks = NumChunks();
+        size_t nSize = nChunks < 6 ? MIN_CHUNK_SIZE << nChunks : MAX_CHUNK_SIZE;
+        void* p;
+        if (nChunks >= 6 && GetHugePageMode() != HUGEPAGES_OFF) {
+            nSize = HUGE_PAGE_SIZE;
+            p = AllocateHugePages(nSize);
+            vHugeChunks.push_back(p);
+        } else {
+            p = ::operator new(nSize);
+            vChunks.push_back(p);
+        }
+        nChunkUsage += nSize;
+        pAvailable = static_cast<char*>(p);
+        pAvailableEnd = pAvailable + nSize;
+    }
+
+    static bool IsPooled(size_t nBytes, size_t nAlign)
+    {
+        return nBytes <= MAX_POOLED_SIZE && nAlign <= ALIGN;
+    }
+
+public:
+    CPoolResource() : vChunks(), vHugeChunks(), pAvailable(NULL), pAvailableEnd(NULL), nChunkUsage(0), nLargeUsage(0)
+    {
+        std::fill(vFree, vFree + sizeof(vFree) / sizeof(vFree[0]), (FreeBlock*)NULL);
+    }
+
+    ~CPoolResource()
+    {
+        for (void* p : vChunks)
+            ::operator delete(p);
+        for (void* p : vHugeChunks)
+            FreeHugePages(p);
+    }
+
+    void* Allocate(size_t nBytes, size_t nAlign)
+    {
+        if (!IsPooled(nBytes, nAlign)) {
+            nLargeUsage += nBytes;
+            return ::operator new(nBytes);
+        }
+        nBytes = RoundUp(nBytes);
+        FreeBlock*& free = vFree[nBytes / ALIGN];
+        if (free) {
+            FreeBlock* block = free;
+            free = block->next;
+            block->~FreeBlock();
+            return block;
+        }
+        if ((size_t)(pAvailableEnd - pAvailable) < nBytes)
+            NewChunk();
+        void* p = pAvailable;
+        pAvailable += nBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes, size_t nAlign)
+    {
+        if (!IsPooled(nBytes, nAlign)) {
+            nLargeUsage -= nBytes;
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, RoundUp(nBytes));
+    }
+
+    //! Memory taken from the system: every chunk, whether in use or not, and the large blocks
+    size_t DynamicMemoryUsage() const
+    {
+        return nChunkUsage + nLargeUsage;
+    }
+
+    size_t NumChunks() const { return vChunks.size() + vHugeChunks.size(); }
+};
+
+/**
+ * Allocator drawing from a CPoolResource. A default constructed allocator
+ * creates its own resource, copies share it, and the resource lives as
+ * long as any allocator referring to it. The allocator moves with the
+ * contents of a container when it is swapped or assigned, so each
+ * resource is only ever used by one container (and its rebound node and
+ * bucket allocators) at a time.
+ */
+template <typename T>
+class CPoolAllocator
+{
+private:
+    template <typename U>
+    friend class CPoolAllocator;
+
+    std::shared_ptr<CPoolResource> resource;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef CPoolAllocator<U> other;
+    };
+
+    CPoolAllocator() : resource(std::make_shared<CPoolResource>()) {}
+    CPoolAllocator(const CPoolAllocator& other) : resource(other.resource) {}
+    template <typename U>
+    CPoolAllocator(const CPoolAllocator<U>& other) : resource(other.resource) {}
+
+    //! A copied container gets a resource of its own
+    CPoolAllocator select_on_container_copy_construction() const
+    {
+        return CPoolAllocator();
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    const CPoolResource& Resource() const { return *resource; }
+
+    template <typename U>
+    bool operator==(const CPoolAllocator<U>& other) const { return resource == other.resource; }
+    template <typename U>
+    bool operator!=(const CPoolAllocator<U>& other) const { return resource != other.resource; }
+};
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
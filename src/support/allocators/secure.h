@@ -6,13 +6,14 @@
 #ifndef BITCOIN_SUPPORT_ALLOCATORS_SECURE_H
 #define BITCOIN_SUPPORT_ALLOCATORS_SECURE_H
 
-#include "support/pagelocker.h"
+#include "support/lockedpool.h"
 
 #include <string>
 
 //
 // Allocator that locks its contents from being paged
 // out of memory and clears its contents before deletion.
+// Memory comes from LockedPool, so it is only locked once.
 //
 template <typename T>
 struct secure_allocator : public std::allocator<T> {
@@ -39,20 +40,12 @@ struct secure_allocator : public std::allocator<T> {
 
     T* allocate(std::size_t n, const void* hint = 0)
     {
-        T* p;
-        p = std::allocator<T>::allocate(n, hint);
-        if (p != NULL)
-            LockedPageManager::Instance().LockRange(p, sizeof(T) * n);
-        return p;
+        return static_cast<T*>(LockedPool::Instance().Allocate(sizeof(T) * n));
     }
 
     void deallocate(T* p, std::size_t n)
     {
-        if (p != NULL) {
-            memory_cleanse(p, sizeof(T) * n);
-            LockedPageManager::Instance().UnlockRange(p, sizeof(T) * n);
-        }
-        std::allocator<T>::deallocate(p, n);
+        LockedPool::Instance().Free(p, sizeof(T) * n);
     }
 };
 
@@ -0,0 +1,183 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "support/hugepages.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+enum MappingKind {
+    MAPPING_PLAIN,
+    MAPPING_TRANSPARENT,
+    MAPPING_RESERVED,
+};
+
+struct Mapping {
+    size_t nSize;
+    MappingKind kind;
+};
+
+std::atomic<int> nMode(HUGEPAGES_OFF);
+
+/** The mappings in use and their totals; never destroyed, as arenas may be freed at exit */
+struct MappingTable {
+    std::mutex cs;
+    std::map<void*, Mapping> mapMappings;
+    CHugePageUsage usage;
+
+    MappingTable() : usage() {}
+};
+
+MappingTable& Table()
+{
+    static MappingTable* table = new MappingTable();
+    return *table;
+}
+
+#ifndef WIN32
+/** Map nSize bytes, a multiple of HUGE_PAGE_SIZE, at an address aligned to it */
+void* MapAligned(size_t nSize)
+{
+    size_t nMap = nSize + HUGE_PAGE_SIZE;
+    void* p = mmap(NULL, nMap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    char* pch = static_cast<char*>(p);
+    size_t nHead = (HUGE_PAGE_SIZE - (uintptr_t)pch % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (nHead)
+        munmap(pch, nHead);
+    munmap(pch + nHead + nSize, HUGE_PAGE_SIZE - nHead);
+    return pch + nHead;
+}
+#endif
+
+} // anon namespace
+
+bool ParseHugePageMode(const std::string& str, HugePageMode& mode)
+{
+    if (str == "off" || str == "0")
+        mode = HUGEPAGES_OFF;
+    else if (str == "transparent" || str == "1")
+        mode = HUGEPAGES_TRANSPARENT;
+    else if (str == "reserved")
+        mode = HUGEPAGES_RESERVED;
+    else
+        return false;
+    return true;
+}
+
+std::string HugePageModeName(HugePageMode mode)
+{
+    switch (mode) {
+    case HUGEPAGES_TRANSPARENT: return "transparent";
+    case HUGEPAGES_RESERVED: return "reserved";
+    default: return "off";
+    }
+}
+
+void SetHugePageMode(HugePageMode mode)
+{
+    nMode = mode;
+}
+
+HugePageMode GetHugePageMode()
+{
+    return (HugePageMode)nMode.load();
+}
+
+CHugePageUsage GetHugePageUsage()
+{
+    MappingTable& table = Table();
+    std::lock_guard<std::mutex> lock(table.cs);
+    return table.usage;
+}
+
+void* AllocateHugePages(size_t nSize)
+{
+    size_t nMapSize = (std::max<size_t>(nSize, 1) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    HugePageMode mode = GetHugePageMode();
+    void* p = NULL;
+    MappingKind kind = MAPPING_PLAIN;
+    bool fReservedFailed = false;
+#ifdef WIN32
+    (void)mode;
+    p = calloc(1, nMapSize);
+#else
+#ifdef MAP_HUGETLB
+    if (mode == HUGEPAGES_RESERVED) {
+        p = mmap(NULL, nMapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = NULL;
+            fReservedFailed = true;
+        } else {
+            kind = MAPPING_RESERVED;
+        }
+    }
+#else
+    fReservedFailed = mode == HUGEPAGES_RESERVED;
+#endif
+    if (p == NULL) {
+        p = MapAligned(nMapSize);
+#ifdef MADV_HUGEPAGE
+        if (p != NULL && mode != HUGEPAGES_OFF && madvise(p, nMapSize, MADV_HUGEPAGE) == 0)
+            kind = MAPPING_TRANSPARENT;
+#endif
+    }
+#endif
+    if (p == NULL)
+        throw std::bad_alloc();
+
+    MappingTable& table = Table();
+    std::lock_guard<std::mutex> lock(table.cs);
+    Mapping mapping = {nMapSize, kind};
+    table.mapMappings[p] = mapping;
+    table.usage.nMapped += nMapSize;
+    if (kind == MAPPING_RESERVED)
+        table.usage.nReserved += nMapSize;
+    if (kind == MAPPING_TRANSPARENT)
+        table.usage.nTransparent += nMapSize;
+    if (fReservedFailed)
+        table.usage.nReservedFailures++;
+    return p;
+}
+
+void FreeHugePages(void* p)
+{
+    if (p == NULL)
+        return;
+    Mapping mapping;
+    {
+        MappingTable& table = Table();
+        std::lock_guard<std::mutex> lock(table.cs);
+        std::map<void*, Mapping>::iterator it = table.mapMappings.find(p);
+        if (it == table.mapMappings.end())
+            return;
+        mapping = it->second;
+        table.mapMappings.erase(it);
+        table.usage.nMapped -= mapping.nSize;
+        if (mapping.kind == MAPPING_RESERVED)
+            table.usage.nReserved -= mapping.nSize;
+        if (mapping.kind == MAPPING_TRANSPARENT)
+            table.usage.nTransparent -= mapping.nSize;
+    }
+#ifdef WIN32
+    free(p);
+#else
+    munmap(p, mapping.nSize);
+#endif
+}
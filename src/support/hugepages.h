@@ -0,0 +1,59 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SUPPORT_HUGEPAGES_H
+#define BITCOIN_SUPPORT_HUGEPAGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/** The size of the huge pages asked for, and the granularity of the mappings */
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+enum HugePageMode {
+    //! Large arenas are plain allocations
+    HUGEPAGES_OFF,
+    //! Aligned mappings that the kernel is asked to back with transparent huge pages
+    HUGEPAGES_TRANSPARENT,
+    //! Pages from the reserved pool (vm.nr_hugepages), else as HUGEPAGES_TRANSPARENT
+    HUGEPAGES_RESERVED,
+};
+
+/** Parse the value of -hugepages: off, transparent or reserved */
+bool ParseHugePageMode(const std::string& str, HugePageMode& mode);
+std::string HugePageModeName(HugePageMode mode);
+
+/** Set the mode, at startup before the large arenas are allocated */
+void SetHugePageMode(HugePageMode mode);
+HugePageMode GetHugePageMode();
+
+/** What the mappings made with AllocateHugePages were backed with, in bytes */
+struct CHugePageUsage
+{
+    //! Every mapping still in use
+    size_t nMapped;
+    //! Of those, on reserved huge pages
+    size_t nReserved;
+    //! Of those, advised to be backed by transparent huge pages
+    size_t nTransparent;
+    //! Mappings that asked for reserved pages and did not get them
+    uint64_t nReservedFailures;
+};
+
+CHugePageUsage GetHugePageUsage();
+
+/**
+ * Map zeroed memory for a large arena, rounded up to whole huge pages and
+ * backed by them as far as the mode and the system allow. The kernel may
+ * still back transparent mappings with small pages.
+ *
+ * @throws std::bad_alloc if nothing could be mapped
+ */
+void* AllocateHugePages(size_t nSize);
+
+/** Unmap memory returned by AllocateHugePages */
+void FreeHugePages(void* p);
+
+#endif // BITCOIN_SUPPORT_HUGEPAGES_H
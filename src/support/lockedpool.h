@@ -0,0 +1,209 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SUPPORT_LOCKEDPOOL_H
+#define BITCOIN_SUPPORT_LOCKEDPOOL_H
+
+#include "support/cleanse.h"
+#include "support/pagelocker.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
+
+/**
+ * Pool of locked (ie, non-swappable) memory for small secrets such as keys,
+ * seeds and passphrases.
+ *
+ * Memory is taken from the system in arenas of ARENA_SIZE bytes, which are
+ * locked once when they are created and stay locked for the lifetime of the
+ * pool. Arenas are carved into slots whose sizes are powers of two from
+ * MIN_SLOT_SIZE to MAX_SLOT_SIZE, and freed slots are wiped and kept on a
+ * free list per size, so creating and destroying keys costs no mlock() or
+ * munlock() calls once the pool has warmed up.
+ *
+ * Allocations larger than MAX_SLOT_SIZE are rare; they are taken from the
+ * heap and locked page by page through the given LockedPageManagerBase, as
+ * before.
+ */
+template <class Locker>
+class LockedPoolBase
+{
+public:
+    static const size_t MIN_SLOT_SIZE = 16;
+    static const size_t MAX_SLOT_SIZE = 1024;
+    static const size_t ARENA_SIZE = 64 * 1024;
+
+    struct Stats {
+        size_t nArenas;
+        size_t nArenasLocked;
+        size_t nSlotsUsed;
+        size_t nLarge;
+    };
+
+    LockedPoolBase(size_t page_size, LockedPageManagerBase<Locker>& pagesIn) :
+        page_size(page_size), pages(pagesIn), pAvailable(NULL), pAvailableEnd(NULL), nArenasLocked(0), nSlotsUsed(0), nLarge(0)
+    {
+        assert(!(page_size & (page_size - 1))); // size must be power of two
+        for (size_t i = 0; i < NUM_CLASSES; i++)
+            vFree[i] = NULL;
+    }
+
+    ~LockedPoolBase()
+    {
+        for (size_t i = 0; i < vArenas.size(); i++) {
+            memory_cleanse(vArenas[i].begin, ARENA_SIZE);
+            if (vArenas[i].fLocked)
+                locker.Unlock(vArenas[i].begin, ARENA_SIZE);
+            ::operator delete(vArenas[i].base);
+        }
+    }
+
+    void* Allocate(size_t size)
+    {
+        if (size > MAX_SLOT_SIZE) {
+            void* p = ::operator new(size);
+            pages.LockRange(p, size);
+            boost::mutex::scoped_lock lock(mutex);
+            nLarge++;
+            return p;
+        }
+
+        size_t nClass = SlotClass(size);
+        boost::mutex::scoped_lock lock(mutex);
+        nSlotsUsed++;
+        if (vFree[nClass]) {
+            FreeSlot* slot = vFree[nClass];
+            vFree[nClass] = slot->next;
+            slot->next = NULL;
+            return slot;
+        }
+        size_t nSlotSize = MIN_SLOT_SIZE << nClass;
+        if ((size_t)(pAvailableEnd - pAvailable) < nSlotSize)
+            NewArena();
+        void* p = pAvailable;
+        pAvailable += nSlotSize;
+        return p;
+    }
+
+    /** Wipe and release memory returned by Allocate(size) */
+    void Free(void* p, size_t size)
+    {
+        if (p == NULL)
+            return;
+        memory_cleanse(p, std::max(size, (size_t)1));
+        if (size > MAX_SLOT_SIZE) {
+            pages.UnlockRange(p, size);
+            ::operator delete(p);
+            boost::mutex::scoped_lock lock(mutex);
+            nLarge--;
+            return;
+        }
+
+        size_t nClass = SlotClass(size);
+        boost::mutex::scoped_lock lock(mutex);
+        FreeSlot* slot = static_cast<FreeSlot*>(p);
+        slot->next = vFree[nClass];
+        vFree[nClass] = slot;
+        nSlotsUsed--;
+    }
+
+    Stats GetStats()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        Stats stats;
+        stats.nArenas = vArenas.size();
+        stats.nArenasLocked = nArenasLocked;
+        stats.nSlotsUsed = nSlotsUsed;
+        stats.nLarge = nLarge;
+        return stats;
+    }
+
+private:
+    static const size_t NUM_CLASSES = 7; // MIN_SLOT_SIZE << (NUM_CLASSES - 1) == MAX_SLOT_SIZE
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct Arena {
+        void* base;
+        char* begin;
+        bool fLocked;
+    };
+
+    Locker locker;
+    size_t page_size;
+    LockedPageManagerBase<Locker>& pages;
+    boost::mutex mutex;
+    std::vector<Arena> vArenas;
+    FreeSlot* vFree[NUM_CLASSES];
+    char* pAvailable;
+    char* pAvailableEnd;
+    size_t nArenasLocked;
+    size_t nSlotsUsed;
+    size_t nLarge;
+
+    static size_t SlotClass(size_t size)
+    {
+        size_t nClass = 0;
+        while ((MIN_SLOT_SIZE << nClass) < size)
+            nClass++;
+        return nClass;
+    }
+
+    void NewArena()
+    {
+        // The rest of the current arena is smaller than the slot that did not fit; give it up
+        Arena arena;
+        arena.base = ::operator new(ARENA_SIZE + page_size);
+        arena.begin = reinterpret_cast<char*>((reinterpret_cast<size_t>(arena.base) + page_size - 1) & ~(page_size - 1));
+        arena.fLocked = locker.Lock(arena.begin, ARENA_SIZE);
+        vArenas.push_back(arena);
+        nArenasLocked += arena.fLocked;
+        pAvailable = arena.begin;
+        pAvailableEnd = arena.begin + ARENA_SIZE;
+    }
+};
+
+template <class Locker>
+const size_t LockedPoolBase<Locker>::MIN_SLOT_SIZE;
+template <class Locker>
+const size_t LockedPoolBase<Locker>::MAX_SLOT_SIZE;
+template <class Locker>
+const size_t LockedPoolBase<Locker>::ARENA_SIZE;
+
+/**
+ * Singleton pool of locked memory used by secure_allocator. Like
+ * LockedPageManager it is created on demand, so that it exists before any
+ * statically initialized object using secure_allocator.
+ */
+class LockedPool : public LockedPoolBase<MemoryPageLocker>
+{
+public:
+    static LockedPool& Instance()
+    {
+        boost::call_once(LockedPool::CreateInstance, LockedPool::init_flag);
+        return *LockedPool::_instance;
+    }
+
+private:
+    LockedPool();
+
+    static void CreateInstance()
+    {
+        // Never destroyed: objects with static storage may hold slots until
+        // the very end, and the arenas are released with the process anyway
+        LockedPool::_instance = new LockedPool();
+    }
+
+    static LockedPool* _instance;
+    static boost::once_flag init_flag;
+};
+
+#endif // BITCOIN_SUPPORT_LOCKEDPOOL_H
@@ -3,6 +3,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "support/pagelocker.h"
+#include "support/lockedpool.h"
 
 #if defined(HAVE_CONFIG_H)
 #include "config/bitcoin-config.h"
@@ -30,6 +31,8 @@
 
 LockedPageManager* LockedPageManager::_instance = NULL;
 boost::once_flag LockedPageManager::init_flag = BOOST_ONCE_INIT;
+LockedPool* LockedPool::_instance = NULL;
+boost::once_flag LockedPool::init_flag = BOOST_ONCE_INIT;
 
 /** Determine system page size in bytes */
 static inline size_t GetSystemPageSize()
@@ -68,3 +71,7 @@ bool MemoryPageLocker::Unlock(const void* addr, size_t len)
 LockedPageManager::LockedPageManager() : LockedPageManagerBase<MemoryPageLocker>(GetSystemPageSize())
 {
 }
+
+LockedPool::LockedPool() : LockedPoolBase<MemoryPageLocker>(GetSystemPageSize(), LockedPageManager::Instance())
+{
+}
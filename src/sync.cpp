@@ -7,7 +7,11 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <chrono>
+#include <map>
 #include <stdio.h>
+#include <thread>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
@@ -20,6 +24,138 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+std::atomic<bool> fLockStats(false);
+
+CLockSite::CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) : pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn)
+{
+    Reset();
+}
+
+CLockSite::Shard& CLockSite::ThreadShard()
+{
+    return vShards[std::hash<std::thread::id>()(std::this_thread::get_id()) % NUM_SHARDS];
+}
+
+void CLockSite::RecordAcquired(bool fContended, int64_t nWaitMicros)
+{
+    Shard& shard = ThreadShard();
+    shard.nAcquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (!fContended)
+        return;
+    shard.nContentions.fetch_add(1, std::memory_order_relaxed);
+    shard.nWaitMicros.fetch_add(nWaitMicros, std::memory_order_relaxed);
+    int64_t nMax = shard.nMaxWaitMicros.load(std::memory_order_relaxed);
+    while (nWaitMicros > nMax && !shard.nMaxWaitMicros.compare_exchange_weak(nMax, nWaitMicros, std::memory_order_relaxed)) {
+    }
+}
+
+void CLockSite::RecordReleased(int64_t nHoldMicros)
+{
+    ThreadShard().nHoldMicros.fetch_add(nHoldMicros, std::memory_order_relaxed);
+}
+
+CLockSite::Stats CLockSite::GetStats() const
+{
+    Stats stats;
+    stats.name = pszName;
+    stats.location = strprintf("%s:%d", pszFile, nLine);
+    stats.nAcquisitions = 0;
+    stats.nContentions = 0;
+    stats.nWaitMicros = 0;
+    stats.nMaxWaitMicros = 0;
+    stats.nHoldMicros = 0;
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        const Shard& shard = vShards[i];
+        stats.nAcquisitions += shard.nAcquisitions.load(std::memory_order_relaxed);
+        stats.nContentions += shard.nContentions.load(std::memory_order_relaxed);
+        stats.nWaitMicros += shard.nWaitMicros.load(std::memory_order_relaxed);
+        stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, shard.nMaxWaitMicros.load(std::memory_order_relaxed));
+        stats.nHoldMicros += shard.nHoldMicros.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void CLockSite::Reset()
+{
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        vShards[i].nAcquisitions = 0;
+        vShards[i].nContentions = 0;
+        vShards[i].nWaitMicros = 0;
+        vShards[i].nMaxWaitMicros = 0;
+        vShards[i].nHoldMicros = 0;
+    }
+}
+
+// Sites are looked up without any lock: they go into an open-addressed
+// table of pointers, are never removed, and are only freed at exit. A
+// site that no longer fits is counted with the overflow site.
+static const size_t LOCK_SITE_TABLE_SIZE = 4096;
+static std::atomic<CLockSite*> vLockSites[LOCK_SITE_TABLE_SIZE];
+static CLockSite lockSiteOverflow("(other)", "(other)", 0);
+
+CLockSite* GetLockSite(const char* pszName, const char* pszFile, int nLine)
+{
+    size_t nHash = (reinterpret_cast<size_t>(pszFile) >> 3) * 31 + (size_t)nLine;
+    for (size_t i = 0; i < LOCK_SITE_TABLE_SIZE; i++) {
+        std::atomic<CLockSite*>& slot = vLockSites[(nHash + i) % LOCK_SITE_TABLE_SIZE];
+        CLockSite* pSite = slot.load(std::memory_order_acquire);
+        if (pSite == NULL) {
+            CLockSite* pNew = new CLockSite(pszName, pszFile, nLine);
+            if (slot.compare_exchange_strong(pSite, pNew, std::memory_order_acq_rel))
+                return pNew;
+            delete pNew; // another thread took the slot; pSite is its site
+        }
+        if (pSite->pszFile == pszFile && pSite->nLine == nLine)
+            return pSite;
+    }
+    return &lockSiteOverflow;
+}
+
+std::vector<CLockSite::Stats> GetLockStats()
+{
+    // A header locking at a given line has one copy of its file name per
+    // translation unit, so merge by name rather than by pointer
+    std::map<std::string, CLockSite::Stats> mapStats;
+    for (size_t i = 0; i <= LOCK_SITE_TABLE_SIZE; i++) {
+        const CLockSite* pSite = i < LOCK_SITE_TABLE_SIZE ? vLockSites[i].load(std::memory_order_acquire) : &lockSiteOverflow;
+        if (pSite == NULL)
+            continue;
+        CLockSite::Stats stats = pSite->GetStats();
+        if (stats.nAcquisitions == 0)
+            continue;
+        std::map<std::string, CLockSite::Stats>::iterator it = mapStats.find(stats.location);
+        if (it == mapStats.end()) {
+            mapStats.insert(std::make_pair(stats.location, stats));
+            continue;
+        }
+        it->second.nAcquisitions += stats.nAcquisitions;
+        it->second.nContentions += stats.nContentions;
+        it->second.nWaitMicros += stats.nWaitMicros;
+        it->second.nMaxWaitMicros = std::max(it->second.nMaxWaitMicros, stats.nMaxWaitMicros);
+        it->second.nHoldMicros += stats.nHoldMicros;
+    }
+
+    std::vector<CLockSite::Stats> vStats;
+    for (std::map<std::string, CLockSite::Stats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it)
+        vStats.push_back(it->second);
+    return vStats;
+}
+
+void ResetLockStats()
+{
+    for (size_t i = 0; i < LOCK_SITE_TABLE_SIZE; i++) {
+        CLockSite* pSite = vLockSites[i].load(std::memory_order_acquire);
+        if (pSite)
+            pSite->Reset();
+    }
+    lockSiteOverflow.Reset();
+}
+
+int64_t LockStatsMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
@@ -8,6 +8,11 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -99,16 +104,96 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock contention profiling, in every build but only while enabled (see
+ * -lockstats and getlockstats). Every LOCK and TRY_LOCK site counts its
+ * acquisitions, the ones that had to wait, and the time spent waiting for
+ * and holding the lock. The counters of a site are spread over a few
+ * cache lines picked by thread, so that threads taking the same lock do
+ * not also contend on its counters.
+ */
+class CLockSite
+{
+public:
+    static const int NUM_SHARDS = 8;
+
+    struct Stats {
+        std::string name;
+        std::string location;
+        uint64_t nAcquisitions;
+        uint64_t nContentions;
+        int64_t nWaitMicros;
+        int64_t nMaxWaitMicros;
+        int64_t nHoldMicros;
+    };
+
+    const char* const pszName;
+    const char* const pszFile;
+    const int nLine;
+
+    CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+
+    void RecordAcquired(bool fContended, int64_t nWaitMicros);
+    void RecordReleased(int64_t nHoldMicros);
+    Stats GetStats() const;
+    void Reset();
+
+private:
+    struct Shard {
+        std::atomic<uint64_t> nAcquisitions;
+        std::atomic<uint64_t> nContentions;
+        std::atomic<int64_t> nWaitMicros;
+        std::atomic<int64_t> nMaxWaitMicros;
+        std::atomic<int64_t> nHoldMicros;
+        char padding[64 - 5 * 8];
+    };
+    Shard vShards[NUM_SHARDS];
+
+    Shard& ThreadShard();
+};
+
+extern std::atomic<bool> fLockStats;
+
+/** The counters of a lock site, created the first time it is seen */
+CLockSite* GetLockSite(const char* pszName, const char* pszFile, int nLine);
+/** Every site seen so far, with the sites of one file and line merged */
+std::vector<CLockSite::Stats> GetLockStats();
+void ResetLockStats();
+/** Monotonic clock for the lock statistics */
+int64_t LockStatsMicros();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    //! Where the lock was taken and when, if lock statistics are being collected
+    CLockSite* pSite;
+    int64_t nTimeLocked;
+
+    void EnterProfiled(const char* pszName, const char* pszFile, int nLine)
+    {
+        pSite = GetLockSite(pszName, pszFile, nLine);
+        int64_t nTimeStart = LockStatsMicros();
+        bool fContended = !lock.try_lock();
+        if (fContended) {
+#ifdef DEBUG_LOCKCONTENTION
+            PrintLockContention(pszName, pszFile, nLine);
+#endif
+            lock.lock();
+        }
+        nTimeLocked = LockStatsMicros();
+        pSite->RecordAcquired(fContended, nTimeLocked - nTimeStart);
+    }
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fLockStats.load(std::memory_order_relaxed)) {
+            EnterProfiled(pszName, pszFile, nLine);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -125,11 +210,16 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if (fLockStats.load(std::memory_order_relaxed)) {
+            pSite = GetLockSite(pszName, pszFile, nLine);
+            nTimeLocked = LockStatsMicros();
+            pSite->RecordAcquired(false, 0);
+        }
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), pSite(NULL), nTimeLocked(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -137,7 +227,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : pSite(NULL), nTimeLocked(0)
     {
         if (!pmutexIn) return;
 
@@ -150,8 +240,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (pSite)
+                pSite->RecordReleased(LockStatsMicros() - nTimeLocked);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -0,0 +1,245 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "taskpool.h"
+
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <exception>
+
+static CTaskPool g_taskpool;
+
+// The index of the pool thread running, or -1 on other threads
+static thread_local int nThisWorker = -1;
+
+CTaskPool& GetTaskPool()
+{
+    return g_taskpool;
+}
+
+TaskPoolClient TaskPoolClientFromName(const std::string& strName)
+{
+    static const char* const names[TASKPOOL_CLIENT_COUNT] = {"validation", "index", "wallet", "rpc", "network"};
+    for (int i = 0; i < TASKPOOL_CLIENT_COUNT; i++) {
+        if (strName == names[i])
+            return (TaskPoolClient)i;
+    }
+    return TASKPOOL_CLIENT_COUNT;
+}
+
+CTaskPool::CTaskPool() : nPending(0), nNextWorker(0), nThreadCount(0), fRunning(false), fStopping(false)
+{
+    for (int i = 0; i < TASKPOOL_CLIENT_COUNT; i++) {
+        vQuota[i] = MAX_TASK_POOL_THREADS;
+        vActive[i] = 0;
+    }
+}
+
+CTaskPool::~CTaskPool()
+{
+    Stop();
+}
+
+void CTaskPool::Start(int nThreads)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning || nThreads <= 0)
+        return;
+    fRunning = true;
+    fStopping = false;
+    vWorkers.clear();
+    for (int i = 0; i < nThreads; i++)
+        vWorkers.emplace_back(new Worker());
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&CTaskPool::ThreadMain, this, i));
+    nThreadCount = nThreads;
+}
+
+void CTaskPool::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStopping = true;
+        nThreadCount = 0;
+    }
+    condWork.notify_all();
+    threads.join_all();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    vWorkers.clear();
+    nPending = 0;
+    fRunning = false;
+}
+
+int CTaskPool::GetThreadCount() const
+{
+    return nThreadCount;
+}
+
+void CTaskPool::SetQuota(TaskPoolClient client, int nQuota)
+{
+    vQuota[client] = std::max(0, nQuota);
+}
+
+int CTaskPool::GetQuota(TaskPoolClient client) const
+{
+    return vQuota[client];
+}
+
+bool CTaskPool::Submit(const std::function<void()>& task)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!fRunning || fStopping)
+        return false;
+    // Tasks queued by a pool thread go to its own deque, where it finds them first
+    size_t nWorker = nThisWorker >= 0 ? nThisWorker : nNextWorker++ % vWorkers.size();
+    nPending++;
+    {
+        boost::unique_lock<boost::mutex> lockWorker(vWorkers[nWorker]->mutex);
+        vWorkers[nWorker]->tasks.push_back(task);
+    }
+    condWork.notify_one();
+    return true;
+}
+
+bool CTaskPool::TakeTask(size_t nWorker, std::function<void()>& task)
+{
+    {
+        Worker& worker = *vWorkers[nWorker];
+        boost::unique_lock<boost::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            nPending--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < vWorkers.size(); i++) {
+        Worker& victim = *vWorkers[(nWorker + i) % vWorkers.size()];
+        boost::unique_lock<boost::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            nPending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CTaskPool::ThreadMain(size_t nWorker)
+{
+    RenameThread("zero-taskpool");
+    nThisWorker = nWorker;
+    while (true) {
+        std::function<void()> task;
+        if (!TakeTask(nWorker, task)) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nPending == 0 && !fStopping)
+                condWork.wait(lock);
+            if (fStopping)
+                break;
+            continue;
+        }
+        try {
+            task();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "CTaskPool");
+        } catch (...) {
+            PrintExceptionContinue(NULL, "CTaskPool");
+        }
+    }
+}
+
+namespace {
+
+// What the threads working on one ParallelFor share. Pool threads that
+// start after the caller finished leave without touching func.
+struct ParallelForState {
+    const std::function<void(size_t)>* func;
+    size_t nCount;
+    std::atomic<size_t> nNext;
+    boost::mutex mutex;
+    boost::condition_variable condDone;
+    int nActive;
+    bool fDone;
+    std::exception_ptr error;
+
+    void Work()
+    {
+        try {
+            for (size_t i = nNext++; i < nCount; i = nNext++)
+                (*func)(i);
+        } catch (...) {
+            // Let the other threads run out of items
+            nNext = nCount;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+};
+
+} // anon namespace
+
+void CTaskPool::ParallelFor(TaskPoolClient client, size_t nCount, int nMaxThreads,
+                            const std::function<void(size_t)>& func)
+{
+    if (nCount == 0)
+        return;
+    int nHelpers = std::min<int64_t>(std::min<int64_t>(nMaxThreads - 1, nCount - 1),
+                                     std::min<int64_t>(GetThreadCount(), vQuota[client]));
+    if (nHelpers <= 0) {
+        for (size_t i = 0; i < nCount; i++)
+            func(i);
+        return;
+    }
+
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->func = &func;
+    state->nCount = nCount;
+    state->nNext = 0;
+    state->nActive = 0;
+    state->fDone = false;
+
+    std::atomic<int>* pActive = &vActive[client];
+    std::atomic<int>* pQuota = &vQuota[client];
+    for (int i = 0; i < nHelpers; i++) {
+        bool fQueued = Submit([state, pActive, pQuota]() {
+            if (++*pActive > *pQuota) {
+                --*pActive;
+                return;
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(state->mutex);
+                if (state->fDone) {
+                    --*pActive;
+                    return;
+                }
+                state->nActive++;
+            }
+            state->Work();
+            --*pActive;
+            boost::unique_lock<boost::mutex> lock(state->mutex);
+            if (--state->nActive == 0)
+                state->condDone.notify_all();
+        });
+        if (!fQueued)
+            break;
+    }
+
+    state->Work();
+
+    boost::unique_lock<boost::mutex> lock(state->mutex);
+    state->fDone = true;
+    while (state->nActive > 0)
+        state->condDone.wait(lock);
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
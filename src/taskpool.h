@@ -0,0 +1,95 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_TASKPOOL_H
+#define BITCOIN_TASKPOOL_H
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** -taskpoolthreads default (0 = one per core) */
+static const int DEFAULT_TASK_POOL_THREADS = 0;
+/** Maximum value for -taskpoolthreads */
+static const int MAX_TASK_POOL_THREADS = 64;
+
+/** The subsystems sharing the task pool, each with its own quota of threads */
+enum TaskPoolClient {
+    TASKPOOL_VALIDATION,
+    TASKPOOL_INDEX,
+    TASKPOOL_WALLET,
+    TASKPOOL_RPC,
+    TASKPOOL_NETWORK,
+    TASKPOOL_CLIENT_COUNT
+};
+
+/**
+ * A pool of threads shared by the parallel loops of the node, so that
+ * rescans, index reads, wallet loading and the like do not each start
+ * their own threads and together oversubscribe the cores.
+ *
+ * Every thread has a deque of tasks: it runs the newest of its own, and
+ * takes the oldest of another thread's when it has none. The thread that
+ * calls ParallelFor always works through the items itself and only waits
+ * for pool threads that have started on them, so a busy or stopped pool
+ * (or a nested call) makes a loop slower, never stuck.
+ */
+class CTaskPool
+{
+public:
+    CTaskPool();
+    ~CTaskPool();
+
+    void Start(int nThreads);
+    /** Stop the threads; tasks not yet started are dropped */
+    void Stop();
+    int GetThreadCount() const;
+
+    /** Let the client use at most nQuota pool threads at once */
+    void SetQuota(TaskPoolClient client, int nQuota);
+    int GetQuota(TaskPoolClient client) const;
+
+    /**
+     * Call func(i) for each i in [0, nCount), on the calling thread and up to
+     * nMaxThreads - 1 pool threads within the quota of client. Returns when
+     * all the calls are done; the first exception thrown by func is rethrown.
+     */
+    void ParallelFor(TaskPoolClient client, size_t nCount, int nMaxThreads,
+                     const std::function<void(size_t)>& func);
+
+private:
+    struct Worker {
+        boost::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker> > vWorkers;
+    boost::thread_group threads;
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    std::atomic<size_t> nPending;
+    std::atomic<size_t> nNextWorker;
+    std::atomic<int> nThreadCount;
+    std::atomic<int> vQuota[TASKPOOL_CLIENT_COUNT];
+    std::atomic<int> vActive[TASKPOOL_CLIENT_COUNT];
+    bool fRunning;
+    bool fStopping;
+
+    /** Queue a task; returns false if the pool is not running */
+    bool Submit(const std::function<void()>& task);
+    bool TakeTask(size_t nWorker, std::function<void()>& task);
+    void ThreadMain(size_t nWorker);
+};
+
+CTaskPool& GetTaskPool();
+
+/** The name of a client for -taskpoolquota, or TASKPOOL_CLIENT_COUNT if unknown */
+TaskPoolClient TaskPoolClientFromName(const std::string& strName);
+
+#endif // BITCOIN_TASKPOOL_H
@@ -28,15 +28,27 @@
 #include <boost/test/data/test_case.hpp>
 
 // Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
+extern bool AddOrphanTx(const CTransaction& tx, NodeId peer, size_t nMaxPeerUsage);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxUsage);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    size_t nUsage;
+    size_t nListPos;
 };
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+struct COrphanOutPointHasher
+{
+    CCoinsKeyHasher hasher;
+    size_t operator()(const COutPoint& out) const { return hasher(out.hash) + out.n; }
+};
+extern boost::unordered_map<uint256, COrphanTx, CCoinsKeyHasher> mapOrphanTransactions;
+extern boost::unordered_map<COutPoint, std::vector<uint256>, COrphanOutPointHasher> mapOrphanTransactionsByPrev;
+extern std::vector<uint256> vOrphanList;
+extern std::map<NodeId, size_t> mapOrphanPeerUsage;
+extern size_t nOrphanUsage;
+
+static const size_t NO_LIMIT = std::numeric_limits<size_t>::max();
 
 CService ip(uint32_t i)
 {
@@ -112,11 +124,7 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
 
 CTransaction RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return mapOrphanTransactions[vOrphanList[GetRand(vOrphanList.size())]].tx;
 }
 
 // Parameterized testing over consensus branch ids
@@ -141,7 +149,7 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(tx, i, NO_LIMIT);
     }
 
     // ... and 50 that depend on other orphans:
@@ -158,7 +166,7 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0, SIGHASH_ALL, consensusBranchId);
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(tx, i, NO_LIMIT);
     }
 
     // This really-big orphan should be ignored:
@@ -182,7 +190,7 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!AddOrphanTx(tx, i, NO_LIMIT));
     }
 
     // Test EraseOrphansFor:
@@ -194,13 +202,50 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, NO_LIMIT);
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, NO_LIMIT);
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    BOOST_CHECK_EQUAL(vOrphanList.size(), mapOrphanTransactions.size());
+    size_t nUsage = nOrphanUsage;
+    LimitOrphanTxSize(10, nUsage / 2);
+    BOOST_CHECK(nOrphanUsage <= nUsage / 2);
+    LimitOrphanTxSize(0, NO_LIMIT);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanPeerUsage.empty());
+    BOOST_CHECK_EQUAL(nOrphanUsage, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphans_peer_quota)
+{
+    // Orphans are indexed by the outpoints they spend
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[1].prevout = COutPoint(tx.vin[0].prevout.hash, 1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1*CENT;
+    BOOST_CHECK(AddOrphanTx(tx, 1, NO_LIMIT));
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPrev.size(), 2U);
+    BOOST_CHECK(mapOrphanTransactionsByPrev.count(tx.vin[1].prevout));
+    BOOST_CHECK(!mapOrphanTransactionsByPrev.count(COutPoint(tx.vin[0].prevout.hash, 2)));
+    size_t nUsage = nOrphanUsage;
+    BOOST_CHECK_EQUAL(mapOrphanPeerUsage[1], nUsage);
+
+    // A peer at its quota cannot add more, others still can
+    tx.vin[0].prevout.n = 2;
+    BOOST_CHECK(!AddOrphanTx(tx, 1, nUsage + nUsage / 2));
+    BOOST_CHECK(AddOrphanTx(tx, 2, nUsage + nUsage / 2));
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 2U);
+
+    EraseOrphansFor(1);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 1U);
+    BOOST_CHECK(!mapOrphanPeerUsage.count(1));
+    EraseOrphansFor(2);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK_EQUAL(nOrphanUsage, 0U);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
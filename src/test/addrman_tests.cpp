@@ -6,8 +6,10 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
 #include "random.h"
+#include "streams.h"
 
 using namespace std;
 
@@ -395,6 +397,44 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
     BOOST_CHECK(addrman.size() == 2007);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_serialize)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    for (unsigned int i = 1; i < 512; i++) {
+        string strAddr = boost::to_string(i % 256) + "." + boost::to_string(i / 256) + ".1.23";
+        CAddress addr = CAddress(CService(strAddr));
+        addr.nTime = GetAdjustedTime();
+        addrman.Add(addr, CNetAddr(boost::to_string(i % 7) + ".2.3.4"));
+        if (i % 4 == 0)
+            addrman.Good(addr);
+    }
+
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers << addrman;
+
+    // A version 2 file loads the same tables using its stored positions.
+    CDataStream ssPeers2(ssPeers);
+    CAddrManTest addrman2;
+    ssPeers2 >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+
+    // A version 1 file, which recomputes the positions, loads the same tables.
+    CDataStream ssPeers1(ssPeers);
+    ssPeers1[0] = 1;
+    CAddrManTest addrman1;
+    ssPeers1 >> addrman1;
+    BOOST_CHECK_EQUAL(addrman1.size(), addrman.size());
+
+    CDataStream ssOut1(SER_DISK, CLIENT_VERSION), ssOut2(SER_DISK, CLIENT_VERSION);
+    ssOut1 << addrman1;
+    ssOut2 << addrman2;
+    BOOST_CHECK(ssOut1.str() == ssOut2.str());
+}
+
 
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
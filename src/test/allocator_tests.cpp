@@ -5,6 +5,7 @@
 #include "util.h"
 
 #include "support/allocators/secure.h"
+#include "support/lockedpool.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
@@ -14,6 +15,7 @@ BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
 // Dummy memory page locker for platform independent tests
 static const void *last_lock_addr, *last_unlock_addr;
 static size_t last_lock_len, last_unlock_len;
+static int lock_count, unlock_count;
 class TestLocker
 {
 public:
@@ -21,12 +23,14 @@ public:
     {
         last_lock_addr = addr;
         last_lock_len = len;
+        lock_count++;
         return true;
     }
     bool Unlock(const void *addr, size_t len)
     {
         last_unlock_addr = addr;
         last_unlock_len = len;
+        unlock_count++;
         return true;
     }
 };
@@ -117,4 +121,59 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(test_LockedPoolBase)
+{
+    typedef LockedPoolBase<TestLocker> TestPool;
+    const size_t test_page_size = 4096;
+    LockedPageManagerBase<TestLocker> lpm(test_page_size);
+    lock_count = unlock_count = 0;
+    {
+        TestPool pool(test_page_size, lpm);
+
+        /* Many small objects share one locked arena */
+        std::vector<void*> slots;
+        for (size_t i = 0; i < TestPool::ARENA_SIZE / 32; i++) {
+            slots.push_back(pool.Allocate(32));
+            BOOST_CHECK(reinterpret_cast<size_t>(slots.back()) % TestPool::MIN_SLOT_SIZE == 0);
+            memset(slots.back(), 0xAB, 32);
+        }
+        BOOST_CHECK_EQUAL(lock_count, 1);
+        BOOST_CHECK(reinterpret_cast<size_t>(last_lock_addr) % test_page_size == 0);
+        BOOST_CHECK_EQUAL(last_lock_len, TestPool::ARENA_SIZE);
+        BOOST_CHECK_EQUAL(pool.GetStats().nSlotsUsed, slots.size());
+
+        /* Freed slots are wiped, and reused without locking anything */
+        unsigned char* p = static_cast<unsigned char*>(slots.back());
+        pool.Free(p, 32);
+        for (size_t i = sizeof(void*); i < 32; i++)
+            BOOST_CHECK_EQUAL(p[i], 0);
+        for (int i = 0; i < 1000; i++)
+            pool.Free(pool.Allocate(32), 32);
+        BOOST_CHECK(pool.Allocate(20) == p);
+        BOOST_CHECK_EQUAL(lock_count, 1);
+        BOOST_CHECK_EQUAL(unlock_count, 0);
+
+        /* A full arena makes room for a new one */
+        void* q = pool.Allocate(64);
+        BOOST_CHECK_EQUAL(lock_count, 2);
+        BOOST_CHECK_EQUAL(pool.GetStats().nArenas, 2);
+        BOOST_CHECK_EQUAL(pool.GetStats().nArenasLocked, 2);
+        pool.Free(q, 64);
+
+        /* Large objects are locked page by page */
+        void* large = pool.Allocate(TestPool::MAX_SLOT_SIZE + 1);
+        BOOST_CHECK(lpm.GetLockedPageCount() > 0);
+        BOOST_CHECK_EQUAL(pool.GetStats().nLarge, 1);
+        pool.Free(large, TestPool::MAX_SLOT_SIZE + 1);
+        BOOST_CHECK_EQUAL(lpm.GetLockedPageCount(), 0);
+        BOOST_CHECK_EQUAL(pool.GetStats().nLarge, 0);
+
+        for (size_t i = 0; i < slots.size(); i++)
+            pool.Free(slots[i], 32);
+        BOOST_CHECK_EQUAL(pool.GetStats().nSlotsUsed, 0);
+    }
+    /* Arenas are unlocked with the pool */
+    BOOST_CHECK_EQUAL(unlock_count, lock_count);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,152 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, BasicTestingSetup)
+
+static CBlock BuildBlockTestCase() {
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(3);
+    block.vtx[0] = tx;
+    block.nVersion = 42;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    block.vtx[1] = tx;
+
+    tx.vin.resize(10);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = GetRandHash();
+        tx.vin[i].prevout.n = 0;
+    }
+    block.vtx[2] = tx;
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    // Only the last transaction is in the mempool
+    CMutableTransaction tx2(block.vtx[2]);
+    pool.addUnchecked(block.vtx[2].GetHash(), entry.FromTx(tx2));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+    BOOST_CHECK_EQUAL(shortIDs2.BlockTxCount(), 3);
+    BOOST_CHECK_EQUAL(shortIDs2.GetShortID(block.vtx[1].GetHash()), shortIDs.GetShortID(block.vtx[1].GetHash()));
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(partialBlock.IsTxAvailable(2));
+    BOOST_CHECK_EQUAL(partialBlock.MempoolCount(), 1);
+
+    // The wrong transaction fails the merkle root check
+    {
+        PartiallyDownloadedBlock partialBlockWrong(&pool);
+        BOOST_CHECK(partialBlockWrong.InitData(shortIDs2) == READ_STATUS_OK);
+        CBlock blockWrong;
+        BOOST_CHECK(partialBlockWrong.FillBlock(blockWrong, std::vector<CTransaction>(1, block.vtx[0])) == READ_STATUS_FAILED);
+    }
+
+    // Too few transactions is the peer's fault
+    {
+        PartiallyDownloadedBlock partialBlockShort(&pool);
+        BOOST_CHECK(partialBlockShort.InitData(shortIDs2) == READ_STATUS_OK);
+        CBlock blockShort;
+        BOOST_CHECK(partialBlockShort.FillBlock(blockShort, std::vector<CTransaction>()) == READ_STATUS_INVALID);
+    }
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, std::vector<CTransaction>(1, block.vtx[1])) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    BOOST_CHECK_EQUAL(block2.vtx.size(), 3);
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(block.vtx[i] == block2.vtx[i]);
+}
+
+BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig.resize(10);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 42;
+
+    CBlock block;
+    block.vtx.resize(1);
+    block.vtx[0] = coinbase;
+    block.nVersion = 42;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    // Nothing but the prefilled coinbase: no getblocktxn needed
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, std::vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest)
+{
+    BlockTransactionsRequest req1;
+    req1.blockhash = GetRandHash();
+    req1.indexes.resize(4);
+    req1.indexes[0] = 0;
+    req1.indexes[1] = 1;
+    req1.indexes[2] = 3;
+    req1.indexes[3] = 4;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req1;
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+
+    BOOST_CHECK_EQUAL(req1.blockhash.ToString(), req2.blockhash.ToString());
+    BOOST_CHECK_EQUAL(req1.indexes.size(), req2.indexes.size());
+    for (size_t i = 0; i < req1.indexes.size(); i++)
+        BOOST_CHECK_EQUAL(req1.indexes[i], req2.indexes[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter(GCSFilter::Params(0, 0, 10, 1 << 10), included_elements);
+    for (GCSFilter::ElementSet::const_iterator it = included_elements.begin(); it != included_elements.end(); ++it) {
+        BOOST_CHECK(filter.Match(*it));
+
+        GCSFilter::ElementSet insertion(excluded_elements);
+        insertion.insert(*it);
+        BOOST_CHECK(filter.MatchAny(insertion));
+    }
+
+    // The encoding alone reconstructs the same filter
+    GCSFilter filter2(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), 100);
+    for (GCSFilter::ElementSet::const_iterator it = included_elements.begin(); it != included_elements.end(); ++it)
+        BOOST_CHECK(filter2.Match(*it));
+
+    // Truncated encodings are rejected
+    std::vector<unsigned char> truncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 1);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), truncated), std::ios_base::failure);
+
+    // An empty filter matches nothing
+    GCSFilter empty(GCSFilter::Params(0, 0, 10, 1 << 10), GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(empty.GetN(), 0);
+    BOOST_CHECK(!empty.MatchAny(included_elements));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction.
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on a second transaction.
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction.
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(3, 32);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(4, 40);
+
+    // This script is not related to the block at all.
+    excluded_scripts[1] << std::vector<unsigned char>(5, 33) << OP_CHECKSIG;
+
+    // OP_RETURN is non-standard since it's not followed by a data push, but is still excluded from filter.
+    excluded_scripts[2] << OP_RETURN << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.resize(2);
+    tx_1.vout[0].nValue = 100;
+    tx_1.vout[0].scriptPubKey = included_scripts[0];
+    tx_1.vout[1].nValue = 200;
+    tx_1.vout[1].scriptPubKey = included_scripts[1];
+
+    CMutableTransaction tx_2;
+    tx_2.vout.resize(3);
+    tx_2.vout[0].nValue = 300;
+    tx_2.vout[0].scriptPubKey = included_scripts[2];
+    tx_2.vout[1].nValue = 0;
+    tx_2.vout[1].scriptPubKey = excluded_scripts[0];
+    tx_2.vout[2].nValue = 400;
+    tx_2.vout[2].scriptPubKey = excluded_scripts[2];
+
+    CBlock block;
+    block.vtx.push_back(tx_1);
+    block.vtx.push_back(tx_2);
+    block.hashPrevBlock = GetRandHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.push_back(CTxUndo());
+    block_undo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(500, included_scripts[3])));
+    block_undo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(600, included_scripts[4])));
+    block_undo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(700, CScript())));
+
+    BlockFilter block_filter(BLOCK_FILTER_BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (size_t i = 0; i < 5; ++i)
+        BOOST_CHECK(filter.Match(GCSFilter::Element(included_scripts[i].begin(), included_scripts[i].end())));
+    for (size_t i = 0; i < 3; ++i)
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(excluded_scripts[i].begin(), excluded_scripts[i].end())));
+
+    // Test serialization/unserialization.
+    BlockFilter block_filter2;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK_EQUAL(block_filter.GetFilterType(), block_filter2.GetFilterType());
+    BOOST_CHECK_EQUAL(block_filter.GetBlockHash().ToString(), block_filter2.GetBlockHash().ToString());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+
+    BlockFilter default_ctor_block_filter_1;
+    BlockFilter default_ctor_block_filter_2;
+    BOOST_CHECK_EQUAL(default_ctor_block_filter_1.GetFilterType(), default_ctor_block_filter_2.GetFilterType());
+    BOOST_CHECK_EQUAL(default_ctor_block_filter_1.GetBlockHash().ToString(), default_ctor_block_filter_2.GetBlockHash().ToString());
+    BOOST_CHECK(default_ctor_block_filter_1.GetEncodedFilter() == default_ctor_block_filter_2.GetEncodedFilter());
+
+    // Unknown filter types are rejected
+    BOOST_CHECK_THROW(BlockFilter(static_cast<BlockFilterType>(1), block.GetHash(), block_filter.GetEncodedFilter()),
+                      std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_header_test)
+{
+    CMutableTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+
+    CBlock block;
+    block.vtx.push_back(tx);
+    block.hashPrevBlock = GetRandHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    BlockFilter filter(BLOCK_FILTER_BASIC, block, CBlockUndo());
+
+    // The header commits to the filter hash and the previous header
+    uint256 prev_header = GetRandHash();
+    uint256 filter_hash = filter.GetHash();
+    uint256 expected = Hash(filter_hash.begin(), filter_hash.end(), prev_header.begin(), prev_header.end());
+    BOOST_CHECK_EQUAL(filter.ComputeHeader(prev_header).ToString(), expected.ToString());
+    BOOST_CHECK(filter.ComputeHeader(prev_header) != filter.ComputeHeader(uint256()));
+
+    const std::vector<unsigned char>& encoded = filter.GetEncodedFilter();
+    BOOST_CHECK_EQUAL(filter_hash.ToString(), Hash(encoded.begin(), encoded.end()).ToString());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
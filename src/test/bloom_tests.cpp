@@ -179,6 +179,37 @@ BOOST_AUTO_TEST_CASE(bloom_match)
     BOOST_CHECK_MESSAGE(!filter.IsRelevantAndUpdate(tx), "Simple Bloom filter matched COutPoint for an output we didn't care about");
 }
 
+BOOST_AUTO_TEST_CASE(bloom_match_parsed_elements)
+{
+    // The transaction of bloom_match
+    CTransaction tx;
+    CDataStream stream(ParseHex("01000000010b26e9b7735eb6aabdf358bab62f9816a21ba9ebdb719d5299e88607d722c190000000008b4830450220070aca44506c5cef3a16ed519d7c3c39f8aab192c4e1c90d065f37b8a4af6141022100a8e160b856c2d43d27d8fba71e5aef6405b8643ac4cb7cb3c462aced7f14711a0141046d11fee51b0e60666d5049a9101a72741df480b96ee26488a4d3466b95c9a40ac5eeef87e10a5cd336c19a84565f80fa6c547957b7700ff4dfbdefe76036c339ffffffff021bff3d11000000001976a91404943fdd508053c75000106d3bc6e2754dbcff1988ac2f15de00000000001976a914a266436d2965547608b9e15d9032a7b9d64fa43188ac00000000"), SER_DISK, CLIENT_VERSION);
+    stream >> tx;
+    CTxFilterElements elements(tx);
+
+    vector<vector<unsigned char> > vKeys;
+    vKeys.push_back(ParseHex("04943fdd508053c75000106d3bc6e2754dbcff19"));
+    vKeys.push_back(ParseHex("a266436d2965547608b9e15d9032a7b9d64fa431"));
+    vKeys.push_back(ParseHex("046d11fee51b0e60666d5049a9101a72741df480b96ee26488a4d3466b95c9a40ac5eeef87e10a5cd336c19a84565f80fa6c547957b7700ff4dfbdefe76036c339"));
+    vKeys.push_back(ParseHex("0b26e9b7735eb6aabdf358bab62f9816a21ba9ebdb719d5299e88607d722c19000000000"));
+    vKeys.push_back(ParseHex("0000006d2965547608b9e15d9032a7b9d64fa431"));
+
+    for (unsigned char nFlags = BLOOM_UPDATE_NONE; nFlags < BLOOM_UPDATE_MASK; nFlags++) {
+        BOOST_FOREACH(const vector<unsigned char>& vKey, vKeys) {
+            CBloomFilter filter(10, 0.000001, 0, nFlags);
+            filter.insert(vKey);
+            CBloomFilter filterParsed = filter;
+            BOOST_CHECK_EQUAL(filter.IsRelevantAndUpdate(tx), filterParsed.IsRelevantAndUpdate(tx, elements));
+
+            // Both made the same updates
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION), ssParsed(SER_NETWORK, PROTOCOL_VERSION);
+            ss << filter;
+            ssParsed << filterParsed;
+            BOOST_CHECK(ss.str() == ssParsed.str());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(merkle_block_1)
 {
     // Random real block (0000000000013b8ab2cd513b0261a14096412195a72a0c4827d229dcc7e0f7af)
@@ -0,0 +1,92 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/cbor.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+BOOST_FIXTURE_TEST_SUITE(cbor_tests, BasicTestingSetup)
+
+static std::string FromHex(const std::string& strHex)
+{
+    std::vector<unsigned char> vch = ParseHex(strHex);
+    return std::string(vch.begin(), vch.end());
+}
+
+static UniValue ParseJSON(const std::string& strJSON)
+{
+    UniValue value;
+    BOOST_CHECK(value.read(strJSON));
+    return value;
+}
+
+BOOST_AUTO_TEST_CASE(cbor_encode_vectors)
+{
+    // Examples from RFC 7049, appendix A
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(0))), "00");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(23))), "17");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(24))), "1818");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(1000))), "1903e8");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(1000000))), "1a000f4240");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue((int64_t)1000000000000LL))), "1b000000e8d4a51000");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(-1))), "20");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(-1000))), "3903e7");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(1.1))), "fb3ff199999999999a");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(false))), "f4");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(true))), "f5");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(NullUniValue)), "f6");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue(""))), "60");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(UniValue("IETF"))), "6449455446");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(ParseJSON("[1,[2,3],[4,5]]"))), "8301820203820405");
+    BOOST_CHECK_EQUAL(HexStr(EncodeCBOR(ParseJSON("{\"a\":1,\"b\":[2,3]}"))), "a26161016162820203");
+}
+
+BOOST_AUTO_TEST_CASE(cbor_roundtrip)
+{
+    UniValue value = ParseJSON("{\"txid\":\"ab\\u0000cd\",\"height\":-9223372036854775808,\"amounts\":[0.5,1e-08,123456789],"
+                               "\"flags\":[true,false,null],\"empty\":{},\"nested\":[[[]]]}");
+    UniValue decoded;
+    BOOST_CHECK(DecodeCBOR(EncodeCBOR(value), decoded));
+    BOOST_CHECK_EQUAL(decoded.write(), value.write());
+}
+
+BOOST_AUTO_TEST_CASE(cbor_decode)
+{
+    UniValue value;
+    // Smaller floats than the encoder writes
+    BOOST_CHECK(DecodeCBOR(FromHex("f93c00"), value));
+    BOOST_CHECK_EQUAL(value.get_real(), 1.0);
+    BOOST_CHECK(DecodeCBOR(FromHex("fa47c35000"), value));
+    BOOST_CHECK_EQUAL(value.get_real(), 100000.0);
+
+    // Items without a JSON counterpart
+    BOOST_CHECK(!DecodeCBOR(FromHex("4401020304"), value)); // byte string
+    BOOST_CHECK(!DecodeCBOR(FromHex("c11a514b67b0"), value)); // tag
+    BOOST_CHECK(!DecodeCBOR(FromHex("f7"), value)); // undefined
+    BOOST_CHECK(!DecodeCBOR(FromHex("f97c00"), value)); // infinity
+    BOOST_CHECK(!DecodeCBOR(FromHex("9fff"), value)); // indefinite length
+    BOOST_CHECK(!DecodeCBOR(FromHex("a10102"), value)); // integer key
+    BOOST_CHECK(!DecodeCBOR(FromHex("3bffffffffffffffff"), value)); // below the int64 range
+
+    // Truncated and trailing data
+    BOOST_CHECK(!DecodeCBOR("", value));
+    BOOST_CHECK(!DecodeCBOR(FromHex("83010203").substr(0, 3), value));
+    BOOST_CHECK(!DecodeCBOR(FromHex("6449455446").substr(0, 4), value));
+    BOOST_CHECK(!DecodeCBOR(FromHex("0000"), value));
+    BOOST_CHECK(!DecodeCBOR(FromHex("9b7fffffffffffffff"), value));
+
+    // Nesting is limited
+    BOOST_CHECK(DecodeCBOR(std::string(MAX_CBOR_DEPTH, '\x81') + '\x00', value));
+    BOOST_CHECK(!DecodeCBOR(std::string(MAX_CBOR_DEPTH + 1, '\x81') + '\x00', value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,9 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#include "arith_uint256.h"
 #include "clientversion.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "streams.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
 #include "zcash/Proof.hpp"
@@ -64,4 +66,82 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(unserialize_reusing)
+{
+    CMutableTransaction saplingTx;
+    saplingTx.fOverwintered = true;
+    saplingTx.nVersion = SAPLING_TX_VERSION;
+    saplingTx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    saplingTx.nExpiryHeight = 100;
+    saplingTx.valueBalance = -5;
+    saplingTx.vShieldedOutput.resize(1);
+    saplingTx.vout.resize(2);
+    saplingTx.vout[0].nValue = 5;
+
+    CMutableTransaction sproutTx;
+    sproutTx.nVersion = 1;
+    sproutTx.vin.resize(1);
+    sproutTx.vout.resize(1);
+    sproutTx.vout[0].nValue = 7;
+
+    CBlock first;
+    first.vtx.push_back(saplingTx);
+    first.vtx.push_back(saplingTx);
+    first.hashMerkleRoot = first.BuildMerkleTree();
+
+    CBlock second;
+    second.nVersion = 4;
+    second.vtx.push_back(sproutTx);
+    second.hashMerkleRoot = second.BuildMerkleTree();
+
+    CBlock third;
+    third.vtx.push_back(sproutTx);
+    third.vtx.push_back(saplingTx);
+    third.vtx.push_back(sproutTx);
+    third.hashMerkleRoot = third.BuildMerkleTree();
+
+    // Reading blocks in turn into one CBlock gives what fresh reads give
+    CBlock block;
+    const CBlock* blocks[] = {&first, &second, &third, &first};
+    for (const CBlock* expected : blocks) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << *expected;
+        block.UnserializeReusing(ss);
+        BOOST_CHECK(ss.empty());
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), expected->GetHash().ToString());
+        BOOST_REQUIRE_EQUAL(block.vtx.size(), expected->vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            BOOST_CHECK(block.vtx[i] == expected->vtx[i]);
+            BOOST_CHECK_EQUAL(block.vtx[i].nExpiryHeight, expected->vtx[i].nExpiryHeight);
+            BOOST_CHECK_EQUAL(block.vtx[i].vShieldedOutput.size(), expected->vtx[i].vShieldedOutput.size());
+        }
+        BOOST_CHECK(block.vMerkleTree.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(header_hash_cache)
+{
+    CBlockHeader header;
+    header.nSolution.assign(1344, 1);
+    uint256 hash = header.GetHash();
+    BOOST_CHECK(hash == SerializeHash(header));
+    BOOST_CHECK(hash == header.GetHash());
+
+    // Every change is seen, including one in place inside the solution
+    header.nNonce = ArithToUint256(1);
+    BOOST_CHECK(hash != header.GetHash());
+    BOOST_CHECK(header.GetHash() == SerializeHash(header));
+    header.nSolution[100] = 2;
+    BOOST_CHECK(header.GetHash() == SerializeHash(header));
+    header.nTime++;
+    BOOST_CHECK(header.GetHash() == SerializeHash(header));
+
+    // Copies keep the hash until they are changed
+    CBlock block(header);
+    BOOST_CHECK(block.GetHash() == header.GetHash());
+    block.hashMerkleRoot = ArithToUint256(2);
+    BOOST_CHECK(block.GetHash() == SerializeHash(block.GetBlockHeader()));
+    BOOST_CHECK(block.GetHash() != header.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
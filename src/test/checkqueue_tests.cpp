@@ -0,0 +1,119 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "checkqueue.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<int> nRun(0);
+
+struct FakeCheck {
+    bool fOk;
+
+    FakeCheck() : fOk(true) {}
+    FakeCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nRun++;
+        return fOk;
+    }
+
+    void swap(FakeCheck& check)
+    {
+        std::swap(fOk, check.fOk);
+    }
+};
+
+class QueueThreads
+{
+public:
+    CCheckQueue<FakeCheck> queue;
+    boost::thread_group threads;
+
+    QueueThreads(int nThreads) : queue(16)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CCheckQueue<FakeCheck>::Thread, &queue));
+    }
+
+    ~QueueThreads()
+    {
+        threads.interrupt_all();
+        threads.join_all();
+    }
+};
+
+static void AddChecks(CCheckQueueControl<FakeCheck>& control, int n, int nFail = -1)
+{
+    // In small batches, the way ConnectBlock adds them
+    for (int i = 0; i < n; i += 7) {
+        std::vector<FakeCheck> vChecks;
+        for (int j = i; j < std::min(n, i + 7); j++)
+            vChecks.push_back(FakeCheck(j != nFail));
+        control.Add(vChecks);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_ok)
+{
+    for (int nThreads : {0, 1, 3, 20}) {
+        QueueThreads workers(nThreads);
+        nRun = 0;
+        CCheckQueueControl<FakeCheck> control(&workers.queue);
+        AddChecks(control, 1000);
+        CCheckQueueResult result;
+        BOOST_CHECK(control.Wait(&result));
+        BOOST_CHECK(result.fAllOk);
+        BOOST_CHECK_EQUAL(result.nChecked, 1000U);
+        BOOST_CHECK_EQUAL(result.nSkipped, 0U);
+        BOOST_CHECK_EQUAL(result.nFailed, -1);
+        BOOST_CHECK_EQUAL(nRun, 1000);
+        BOOST_CHECK(workers.queue.IsIdle());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    for (int nThreads : {0, 1, 3, 20}) {
+        QueueThreads workers(nThreads);
+        CCheckQueueControl<FakeCheck> control(&workers.queue);
+        AddChecks(control, 1000, 10);
+        CCheckQueueResult result;
+        BOOST_CHECK(!control.Wait(&result));
+        BOOST_CHECK(!result.fAllOk);
+        BOOST_CHECK_EQUAL(result.nChecked + result.nSkipped, 1000U);
+        BOOST_CHECK_EQUAL(result.nFailed, 10);
+        // The queue is ready for the next block
+        BOOST_CHECK(workers.queue.IsIdle());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_reuse)
+{
+    QueueThreads workers(4);
+    for (int i = 0; i < 50; i++) {
+        CCheckQueueControl<FakeCheck> control(&workers.queue);
+        int nFail = i % 2 ? i * 3 : -1;
+        AddChecks(control, 200, nFail);
+        CCheckQueueResult result;
+        BOOST_CHECK_EQUAL(control.Wait(&result), nFail < 0);
+        BOOST_CHECK_EQUAL(result.nFailed, nFail);
+        BOOST_CHECK_EQUAL(result.nChecked + result.nSkipped, 200U);
+    }
+    // Nothing to check
+    CCheckQueueControl<FakeCheck> control(&workers.queue);
+    BOOST_CHECK(control.Wait());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
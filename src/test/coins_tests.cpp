@@ -10,6 +10,7 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
@@ -1091,4 +1092,495 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(chainstate_snapshot, TestingSetup)
+{
+    CCoinsViewDB source(1 << 20, true);
+
+    CCoinsMap mapCoins;
+    CAnchorsSproutMap mapSproutAnchors;
+    CAnchorsSaplingMap mapSaplingAnchors;
+    CNullifiersMap mapSproutNullifiers;
+    CNullifiersMap mapSaplingNullifiers;
+
+    uint256 txid = GetRandHash();
+    CCoinsCacheEntry& coinsEntry = mapCoins[txid];
+    coinsEntry.coins.nVersion = 1;
+    coinsEntry.coins.nHeight = 7;
+    coinsEntry.coins.vout.resize(2);
+    coinsEntry.coins.vout[1].nValue = 5000;
+    coinsEntry.flags = CCoinsCacheEntry::DIRTY;
+
+    SaplingMerkleTree saplingTree;
+    saplingTree.append(GetRandHash());
+    CAnchorsSaplingCacheEntry& anchorEntry = mapSaplingAnchors[saplingTree.root()];
+    anchorEntry.entered = true;
+    anchorEntry.tree = saplingTree;
+    anchorEntry.flags = CAnchorsSaplingCacheEntry::DIRTY;
+
+    uint256 sproutNullifier = GetRandHash();
+    uint256 saplingNullifier = GetRandHash();
+    mapSproutNullifiers[sproutNullifier].entered = true;
+    mapSproutNullifiers[sproutNullifier].flags = CNullifiersCacheEntry::DIRTY;
+    mapSaplingNullifiers[saplingNullifier].entered = true;
+    mapSaplingNullifiers[saplingNullifier].flags = CNullifiersCacheEntry::DIRTY;
+
+    uint256 hashBlock = GetRandHash();
+    BOOST_CHECK(source.BatchWrite(mapCoins, hashBlock, SproutMerkleTree::empty_root(), saplingTree.root(),
+                                  mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers));
+
+    // GetStats looks up the height of the best block
+    CBlockIndex index;
+    index.nHeight = 7;
+    {
+        LOCK(cs_main);
+        mapBlockIndex[hashBlock] = &index;
+    }
+
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    CChainstateSnapshotHeader header;
+    uint64_t nRecords;
+    uint256 hashSnapshot;
+    BOOST_CHECK(source.WriteSnapshot(file, header, nRecords, hashSnapshot));
+    BOOST_CHECK_EQUAL(nRecords, 4);
+    BOOST_CHECK(header.hashBlock == hashBlock);
+    BOOST_CHECK(header.hashSaplingAnchor == saplingTree.root());
+
+    CCoinsStats stats;
+    BOOST_CHECK(source.GetStats(stats));
+    BOOST_CHECK(header.hashSerialized == stats.hashSerialized);
+
+    // Load it into an empty database
+    rewind(file.Get());
+    CChainstateSnapshotHeader headerRead;
+    file >> headerRead;
+    CCoinsViewDB loaded(1 << 20, true);
+    uint64_t nRecordsLoaded;
+    uint256 hashLoaded;
+    BOOST_CHECK(loaded.LoadSnapshot(file, headerRead, nRecordsLoaded, hashLoaded));
+    BOOST_CHECK_EQUAL(nRecordsLoaded, nRecords);
+    BOOST_CHECK(hashLoaded == hashSnapshot);
+    BOOST_CHECK(loaded.GetBestBlock() == hashBlock);
+    BOOST_CHECK(loaded.GetBestAnchor(SAPLING) == saplingTree.root());
+    CCoins coins;
+    BOOST_CHECK(loaded.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsEntry.coins);
+    SaplingMerkleTree treeLoaded;
+    BOOST_CHECK(loaded.GetSaplingAnchorAt(saplingTree.root(), treeLoaded));
+    BOOST_CHECK(treeLoaded.root() == saplingTree.root());
+    BOOST_CHECK(loaded.GetNullifier(sproutNullifier, SPROUT));
+    BOOST_CHECK(loaded.GetNullifier(saplingNullifier, SAPLING));
+
+    // A database that is no longer empty refuses another snapshot
+    rewind(file.Get());
+    file >> headerRead;
+    BOOST_CHECK(!loaded.LoadSnapshot(file, headerRead, nRecordsLoaded, hashLoaded));
+
+    // A tampered snapshot is rejected and leaves no best block behind
+    rewind(file.Get());
+    file >> headerRead;
+    headerRead.hashSerialized = GetRandHash();
+    CCoinsViewDB tampered(1 << 20, true);
+    BOOST_CHECK(!tampered.LoadSnapshot(file, headerRead, nRecordsLoaded, hashLoaded));
+    BOOST_CHECK(tampered.GetBestBlock().IsNull());
+
+    {
+        LOCK(cs_main);
+        mapBlockIndex.erase(hashBlock);
+    }
+}
+
+namespace {
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins) {
+        db.Write(std::make_pair('c', txid), coins);
+    }
+};
+
+void SpendFlushed(CCoinsView& base, const uint256& txid, uint32_t nPos)
+{
+    CCoinsViewCache cache(&base);
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        BOOST_CHECK(coins->Spend(nPos));
+    }
+    BOOST_CHECK(cache.Flush());
+}
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_stats_hash_types, TestingSetup)
+{
+    CCoinsViewDB all(1 << 20, true), halves(1 << 20, true);
+    uint256 hashBlock = GetRandHash();
+    CBlockIndex index;
+    index.nHeight = 12;
+    {
+        LOCK(cs_main);
+        mapBlockIndex[hashBlock] = &index;
+    }
+
+    // The same coins, written at once to one database and in two batches to the other
+    CCoinsMap mapAll, mapHalves[2];
+    CAmount nTotal = 0;
+    for (int i = 0; i < 300; i++) {
+        CCoinsCacheEntry entry;
+        entry.coins.nVersion = 1;
+        entry.coins.nHeight = i;
+        entry.coins.vout.resize(1 + i % 3);
+        entry.coins.vout.back().nValue = 1000 + i;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        nTotal += 1000 + i;
+        uint256 txid = GetRandHash();
+        mapAll[txid] = entry;
+        mapHalves[i % 2][txid] = entry;
+    }
+    CAnchorsSproutMap mapSproutAnchors;
+    CAnchorsSaplingMap mapSaplingAnchors;
+    CNullifiersMap mapSproutNullifiers, mapSaplingNullifiers;
+    BOOST_CHECK(all.BatchWrite(mapAll, hashBlock, uint256(), uint256(),
+                               mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers));
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK(halves.BatchWrite(mapHalves[i], hashBlock, uint256(), uint256(),
+                                      mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers));
+    }
+
+    CCoinsStats serialized, commitment, none;
+    commitment.hashType = COINSTATS_HASH_COMMITMENT;
+    none.hashType = COINSTATS_HASH_NONE;
+    BOOST_CHECK(all.GetStats(serialized));
+    BOOST_CHECK(all.GetStats(commitment));
+    BOOST_CHECK(all.GetStats(none));
+    for (const CCoinsStats* stats : {&serialized, &commitment, &none}) {
+        BOOST_CHECK_EQUAL(stats->nHeight, 12);
+        BOOST_CHECK(stats->hashBlock == hashBlock);
+        BOOST_CHECK_EQUAL(stats->nTransactions, 300U);
+        BOOST_CHECK_EQUAL(stats->nTransactionOutputs, 300U);
+        BOOST_CHECK_EQUAL(stats->nSerializedSize, serialized.nSerializedSize);
+        BOOST_CHECK_EQUAL(stats->nTotalAmount, nTotal);
+    }
+    BOOST_CHECK(!serialized.hashSerialized.IsNull());
+    BOOST_CHECK(!commitment.hashCommitment.IsNull());
+    BOOST_CHECK(none.hashCommitment.IsNull());
+
+    // The commitment only depends on the set of coins
+    CCoinsStats commitmentHalves;
+    commitmentHalves.hashType = COINSTATS_HASH_COMMITMENT;
+    BOOST_CHECK(halves.GetStats(commitmentHalves));
+    BOOST_CHECK(commitmentHalves.hashCommitment == commitment.hashCommitment);
+    SpendFlushed(halves, mapHalves[0].begin()->first, mapHalves[0].begin()->second.coins.vout.size() - 1);
+    CCoinsStats commitmentSpent;
+    commitmentSpent.hashType = COINSTATS_HASH_COMMITMENT;
+    BOOST_CHECK(halves.GetStats(commitmentSpent));
+    BOOST_CHECK(commitmentSpent.hashCommitment != commitment.hashCommitment);
+    BOOST_CHECK_EQUAL(commitmentSpent.nTransactionOutputs, 299U);
+
+    {
+        LOCK(cs_main);
+        mapBlockIndex.erase(hashBlock);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDBTest base;
+    uint256 txid = GetRandHash();
+    CCoins coinsExpected;
+    coinsExpected.nVersion = 1;
+    coinsExpected.nHeight = 5;
+    coinsExpected.fCoinBase = true;
+    coinsExpected.vout.resize(4);
+    for (size_t i = 0; i < coinsExpected.vout.size(); i++) {
+        coinsExpected.vout[i].nValue = 1000 * (i + 1);
+        coinsExpected.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    {
+        CCoinsViewCache cache(&base);
+        {
+            CCoinsModifier coins = cache.ModifyNewCoins(txid);
+            *coins = coinsExpected;
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+
+    // Spending one output only touches that output
+    SpendFlushed(base, txid, 1);
+    coinsExpected.Spend(1);
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+
+    // A spend through two levels of cache
+    {
+        CCoinsViewCache cacheParent(&base);
+        SpendFlushed(cacheParent, txid, 3);
+        BOOST_CHECK(cacheParent.Flush());
+    }
+    coinsExpected.Spend(3);
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+    BOOST_CHECK_EQUAL(coins.vout.size(), 3);
+
+    // Restoring a spent output, as when disconnecting a block
+    {
+        CCoinsViewCache cache(&base);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            modifier->vout[1].nValue = 2000;
+            modifier->vout[1].scriptPubKey = CScript() << OP_TRUE;
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    coinsExpected.vout[1].nValue = 2000;
+    coinsExpected.vout[1].scriptPubKey = CScript() << OP_TRUE;
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+
+    // No records are left once every output is spent
+    for (uint32_t i = 0; i < 3; i++)
+        SpendFlushed(base, txid, i);
+    BOOST_CHECK(!base.HaveCoins(txid));
+    BOOST_CHECK(!base.GetCoins(txid, coins));
+
+    // Whole-transaction records from older versions are upgraded
+    uint256 txidLegacy = GetRandHash();
+    CCoins coinsLegacy;
+    coinsLegacy.nVersion = 2;
+    coinsLegacy.nHeight = 9;
+    coinsLegacy.vout.resize(3);
+    coinsLegacy.vout[2].nValue = 700;
+    base.WriteLegacyCoins(txidLegacy, coinsLegacy);
+    BOOST_CHECK(!base.HaveCoins(txidLegacy));
+    BOOST_CHECK(base.Upgrade());
+    BOOST_CHECK(base.GetCoins(txidLegacy, coins));
+    BOOST_CHECK(coins == coinsLegacy);
+    BOOST_CHECK(base.Upgrade());
+    BOOST_CHECK(base.GetCoins(txidLegacy, coins));
+    BOOST_CHECK(coins == coinsLegacy);
+}
+
+BOOST_AUTO_TEST_CASE(anchors_db_deltas)
+{
+    CCoinsViewDB base(1 << 20, true);
+    std::vector<SproutMerkleTree> trees;
+    SproutMerkleTree tree;
+    {
+        // Anchors flushed one at a time and many at once, crossing checkpoints
+        CCoinsViewCache cache(&base);
+        for (int i = 0; i < 100; i++) {
+            for (int j = 0; j < i % 5 + 1; j++)
+                appendRandomSproutCommitment(tree);
+            cache.PushAnchor(tree);
+            trees.push_back(tree);
+            if (i < 10 || i % 30 == 0)
+                BOOST_CHECK(cache.Flush());
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(base.GetBestAnchor(SPROUT) == tree.root());
+    for (const SproutMerkleTree& expected : trees) {
+        SproutMerkleTree read;
+        BOOST_CHECK(base.GetSproutAnchorAt(expected.root(), read));
+        BOOST_CHECK(read == expected);
+    }
+
+    // Popped anchors are gone, and pushing again after them still works
+    {
+        CCoinsViewCache cache(&base);
+        for (int i = trees.size() - 1; i >= 90; i--)
+            cache.PopAnchor(trees[i - 1].root(), SPROUT);
+        BOOST_CHECK(cache.Flush());
+    }
+    for (size_t i = 0; i < trees.size(); i++) {
+        SproutMerkleTree read;
+        BOOST_CHECK_EQUAL(base.GetSproutAnchorAt(trees[i].root(), read), i < 90);
+    }
+    {
+        CCoinsViewCache cache(&base);
+        SproutMerkleTree forked = trees[89];
+        appendRandomSproutCommitment(forked);
+        cache.PushAnchor(forked);
+        BOOST_CHECK(cache.Flush());
+        SproutMerkleTree read;
+        BOOST_CHECK(base.GetSproutAnchorAt(forked.root(), read));
+        BOOST_CHECK(read == forked);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(nullifiers_db_filter)
+{
+    CCoinsViewDB base(1 << 20, true);
+    std::vector<uint256> vNullifiers;
+    for (int i = 0; i < 3000; i++)
+        vNullifiers.push_back(GetRandHash());
+    {
+        CCoinsViewCache cache(&base);
+        BOOST_FOREACH(const uint256& nf, vNullifiers) {
+            CMutableTransaction mtx;
+            SpendDescription sd;
+            sd.nullifier = nf;
+            mtx.vShieldedSpend.push_back(sd);
+            cache.SetNullifiers(mtx, true);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_FOREACH(const uint256& nf, vNullifiers) {
+        BOOST_CHECK(base.GetNullifier(nf, SAPLING));
+        BOOST_CHECK(!base.GetNullifier(nf, SPROUT));
+    }
+    BOOST_CHECK(!base.GetNullifier(GetRandHash(), SAPLING));
+
+    // Unspending, as when disconnecting a block, and spending again
+    {
+        CCoinsViewCache cache(&base);
+        CMutableTransaction mtx;
+        SpendDescription sd;
+        sd.nullifier = vNullifiers[0];
+        mtx.vShieldedSpend.push_back(sd);
+        cache.SetNullifiers(mtx, false);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!base.GetNullifier(vNullifiers[0], SAPLING));
+        cache.SetNullifiers(mtx, true);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(base.GetNullifier(vNullifiers[0], SAPLING));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_flusher)
+{
+    CCoinsViewDB base(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 nf = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins coinsExpected;
+    coinsExpected.nVersion = 1;
+    coinsExpected.nHeight = 7;
+    coinsExpected.vout.resize(2);
+    for (size_t i = 0; i < coinsExpected.vout.size(); i++) {
+        coinsExpected.vout[i].nValue = 500 * (i + 1);
+        coinsExpected.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+
+    CCoinsViewFlusher flusher(&base, &base);
+    CCoinsViewCache tip(&flusher);
+    {
+        CCoinsModifier coins = tip.ModifyNewCoins(txid);
+        *coins = coinsExpected;
+    }
+    CMutableTransaction mtx;
+    SpendDescription sd;
+    sd.nullifier = nf;
+    mtx.vShieldedSpend.push_back(sd);
+    tip.SetNullifiers(mtx, true);
+    tip.SetBestBlock(hashBlock);
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 0U);
+
+    // Readable through the flusher whether or not the write is done
+    CCoins coins;
+    BOOST_CHECK(flusher.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+    BOOST_CHECK(flusher.GetNullifier(nf, SAPLING));
+    BOOST_CHECK(flusher.GetBestBlock() == hashBlock);
+    BOOST_CHECK(tip.AccessCoins(txid) != NULL);
+
+    // A second flush waits for the first write
+    SpendFlushed(tip, txid, 0);
+    BOOST_CHECK(tip.Flush());
+    coinsExpected.Spend(0);
+    BOOST_CHECK(flusher.Sync());
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+    BOOST_CHECK(base.GetNullifier(nf, SAPLING));
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+
+    CCoinsStats stats;
+    BOOST_CHECK(flusher.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_pool)
+{
+    CPoolResource resource;
+    void* a = resource.Allocate(40, 8);
+    void* b = resource.Allocate(40, 8);
+    BOOST_CHECK(a != b);
+    resource.Deallocate(a, 40, 8);
+    BOOST_CHECK(resource.Allocate(36, 8) == a);
+    BOOST_CHECK_EQUAL(resource.NumChunks(), 1U);
+    size_t nUsage = resource.DynamicMemoryUsage();
+    void* c = resource.Allocate(CPoolResource::MAX_POOLED_SIZE + 1, 8);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), nUsage + CPoolResource::MAX_POOLED_SIZE + 1);
+    resource.Deallocate(c, CPoolResource::MAX_POOLED_SIZE + 1, 8);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), nUsage);
+
+    // The cache accounts for the pooled nodes, and a flush gives them back
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    size_t nEmpty = cache.DynamicMemoryUsage();
+    for (int i = 0; i < 1000; i++) {
+        CCoinsModifier coins = cache.ModifyNewCoins(GetRandHash());
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i + 1;
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nEmpty + 1000 * sizeof(CCoinsCacheEntry));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nEmpty);
+
+    // Swapping maps takes their pools along
+    CCoinsMap mapA, mapB;
+    mapA[GetRandHash()];
+    size_t nUsageA = memusage::DynamicUsage(mapA);
+    mapA.swap(mapB);
+    BOOST_CHECK(mapA.empty());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(mapB), nUsageA);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_prefetch)
+{
+    CCoinsViewTest base;
+    uint256 txid = GetRandHash();
+    uint256 nf = GetRandHash();
+    {
+        CCoinsViewCache cache(&base);
+        {
+            CCoinsModifier coins = cache.ModifyNewCoins(txid);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 10;
+        }
+        CMutableTransaction mtx;
+        SpendDescription sd;
+        sd.nullifier = nf;
+        mtx.vShieldedSpend.push_back(sd);
+        cache.SetNullifiers(mtx, true);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCache cache(&base);
+    std::vector<uint256> vTxid = {txid, txid, GetRandHash()};
+    std::vector<std::pair<uint256, ShieldedType> > vNullifiers = {{nf, SAPLING}, {nf, SPROUT}};
+    size_t nReads = 0;
+    cache.Prefetch(vTxid, vNullifiers, [&nReads](std::vector<std::function<bool()> >& vReads) {
+        for (std::function<bool()>& fn : vReads)
+            BOOST_CHECK(fn());
+        nReads += vReads.size();
+    });
+    BOOST_CHECK_EQUAL(nReads, 2U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.HaveCoins(txid));
+    BOOST_CHECK(cache.GetNullifier(nf, SAPLING));
+    BOOST_CHECK(!cache.GetNullifier(nf, SPROUT));
+
+    // Nothing is read twice
+    cache.Prefetch(vTxid, vNullifiers, [&nReads](std::vector<std::function<bool()> >& vReads) {
+        nReads += vReads.size();
+    });
+    BOOST_CHECK_EQUAL(nReads, 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -131,6 +131,23 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Batches of every size up to two full 8-way rounds and a remainder
+    for (int i = 1; i <= 34; i++) {
+        std::vector<unsigned char> in(64 * i), out1(32 * i), out2(32 * i);
+        for (size_t j = 0; j < in.size(); j++)
+            in[j] = insecure_rand() & 0xff;
+        for (int j = 0; j < i; j++) {
+            unsigned char tmp[CSHA256::OUTPUT_SIZE];
+            CSHA256().Write(&in[64 * j], 64).Finalize(tmp);
+            CSHA256().Write(tmp, sizeof(tmp)).Finalize(&out1[32 * j]);
+        }
+        SHA256D64(&out2[0], &in[0], i);
+        BOOST_CHECK(out1 == out2);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
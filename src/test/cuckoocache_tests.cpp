@@ -0,0 +1,85 @@
+// Copyright (c) 2012-2016 The Bitcoin Core developers
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+static std::vector<uint256> RandomHashes(size_t n)
+{
+    std::vector<uint256> hashes(n);
+    for (uint256& hash : hashes)
+        hash = GetRandHash();
+    return hashes;
+}
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> TestCache;
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    TestCache cc;
+    cc.setup_bytes(32 << 20);
+    for (const uint256& hash : RandomHashes(100000))
+        cc.insert(hash);
+    for (const uint256& hash : RandomHashes(100000))
+        BOOST_CHECK(!cc.contains(hash, false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    // Inserting half the capacity keeps nearly everything
+    TestCache cc;
+    uint32_t nElems = cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes = RandomHashes(nElems / 2);
+    for (const uint256& hash : hashes)
+        cc.insert(hash);
+    size_t nHits = 0;
+    for (const uint256& hash : hashes)
+        nHits += cc.contains(hash, false);
+    BOOST_CHECK(nHits * 100 >= hashes.size() * 99);
+
+    // Inserting far more than the capacity keeps the recent entries
+    std::vector<uint256> more = RandomHashes(nElems * 4);
+    for (const uint256& hash : more)
+        cc.insert(hash);
+    size_t nRecentHits = 0;
+    for (size_t i = more.size() - nElems / 4; i < more.size(); i++)
+        nRecentHits += cc.contains(more[i], false);
+    BOOST_CHECK(nRecentHits * 100 >= (nElems / 4) * 95);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    TestCache cc;
+    uint32_t nElems = cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes = RandomHashes(nElems / 2);
+    for (const uint256& hash : hashes)
+        cc.insert(hash);
+
+    // Erased entries are only dropped once their slots are needed again
+    for (size_t i = 0; i < hashes.size() / 2; i++)
+        BOOST_CHECK(cc.contains(hashes[i], true));
+    for (size_t i = 0; i < hashes.size() / 2; i++)
+        BOOST_CHECK(cc.contains(hashes[i], false));
+
+    // Refilling the cache reuses the erased slots before the kept ones
+    for (const uint256& hash : RandomHashes(hashes.size() / 2))
+        cc.insert(hash);
+    size_t nKept = 0;
+    for (size_t i = hashes.size() / 2; i < hashes.size(); i++)
+        nKept += cc.contains(hashes[i], false);
+    BOOST_CHECK(nKept * 100 >= (hashes.size() - hashes.size() / 2) * 99);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
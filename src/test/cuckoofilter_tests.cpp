@@ -0,0 +1,70 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoofilter.h"
+
+#include "random.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoofilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoofilter_insert_remove)
+{
+    CCuckooFilter filter(1000);
+    std::vector<uint256> vInserted;
+    for (int i = 0; i < 1000; i++) {
+        vInserted.push_back(GetRandHash());
+        filter.Insert(vInserted.back());
+    }
+    BOOST_CHECK_EQUAL(filter.Size(), 1000);
+    BOOST_CHECK(!filter.NeedsResize());
+    for (const uint256& hash : vInserted)
+        BOOST_CHECK(filter.Contains(hash));
+
+    // Removed elements are gone, the others are still there
+    for (size_t i = 0; i < vInserted.size(); i += 2)
+        filter.Remove(vInserted[i]);
+    BOOST_CHECK_EQUAL(filter.Size(), 500);
+    unsigned int nFalsePositives = 0;
+    for (size_t i = 0; i < vInserted.size(); i++) {
+        if (i % 2)
+            BOOST_CHECK(filter.Contains(vInserted[i]));
+        else if (filter.Contains(vInserted[i]))
+            nFalsePositives++;
+    }
+    for (int i = 0; i < 10000; i++) {
+        if (filter.Contains(GetRandHash()))
+            nFalsePositives++;
+    }
+    BOOST_CHECK(nFalsePositives < 10);
+
+    filter.Reset(10);
+    for (const uint256& hash : vInserted)
+        BOOST_CHECK(!filter.Contains(hash));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoofilter_overfull)
+{
+    // Filling way past the capacity asks for a resize, but nothing inserted
+    // is ever missed
+    CCuckooFilter filter(1);
+    std::vector<uint256> vInserted;
+    for (int i = 0; i < 5000; i++) {
+        vInserted.push_back(GetRandHash());
+        filter.Insert(vInserted.back());
+    }
+    BOOST_CHECK(filter.NeedsResize());
+    for (const uint256& hash : vInserted)
+        BOOST_CHECK(filter.Contains(hash));
+    for (const uint256& hash : vInserted)
+        filter.Remove(hash);
+    BOOST_CHECK_EQUAL(filter.Size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,8 +4,13 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "dbwrapper.h"
+#include "addressindex.h"
+#include "noteindex.h"
+#include "spentindex.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "random.h"
+#include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/assign/std/vector.hpp> // for 'operator+=()'
@@ -43,6 +48,43 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    mapMultiArgs["-dbtune"].clear();
+    CDBOptions opts = CDBOptions::FromArgs("chainstate", 8 << 20);
+    BOOST_CHECK_EQUAL(opts.nBlockCacheSize, 4 << 20);
+    BOOST_CHECK_EQUAL(opts.nWriteBufferSize, 2 << 20);
+    BOOST_CHECK_EQUAL(opts.nMaxOpenFiles, 64);
+    BOOST_CHECK_EQUAL(opts.nBloomBits, 10);
+    BOOST_CHECK(!opts.fCompression);
+
+    mapMultiArgs["-dbtune"].push_back("blockindex.compression=1");
+    mapMultiArgs["-dbtune"].push_back("blockindex.maxopenfiles=1000");
+    mapMultiArgs["-dbtune"].push_back("blockindex.blockcache=32");
+    mapMultiArgs["-dbtune"].push_back("blockindex.bloombits=0");
+    mapMultiArgs["-dbtune"].push_back("chainstate.maxopenfiles=1");
+    mapMultiArgs["-dbtune"].push_back("invalid");
+    opts = CDBOptions::FromArgs("blockindex", 8 << 20);
+    BOOST_CHECK_EQUAL(opts.nBlockCacheSize, 32 << 20);
+    BOOST_CHECK_EQUAL(opts.nWriteBufferSize, 2 << 20);
+    BOOST_CHECK_EQUAL(opts.nMaxOpenFiles, 1000);
+    BOOST_CHECK_EQUAL(opts.nBloomBits, 0);
+    BOOST_CHECK(opts.fCompression);
+    opts = CDBOptions::FromArgs("chainstate", 8 << 20);
+    BOOST_CHECK_EQUAL(opts.nMaxOpenFiles, 16);
+    BOOST_CHECK(!opts.fCompression);
+
+    // A tuned database still works
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, "blockindex");
+    uint256 in = GetRandHash();
+    uint256 res;
+    BOOST_CHECK(dbw.Write('k', in));
+    BOOST_CHECK(dbw.Read('k', res));
+    BOOST_CHECK(res == in);
+    mapMultiArgs["-dbtune"].clear();
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
@@ -231,4 +273,221 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(address_balances)
+{
+    CExplorerIndexDB db(1 << 20, true);
+    uint160 addr = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint256 txid1 = GetRandHash(), txid2 = GetRandHash();
+
+    std::vector<CAddressIndexDbEntry> block1, block2;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addr, 10, 1, txid1, 0, false), 500));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addr, 10, 1, txid1, 1, false), 200));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addr, 20, 1, txid2, 0, true), -500));
+    BOOST_CHECK(db.WriteAddressIndex(block1));
+    BOOST_CHECK(db.WriteAddressIndex(block2));
+
+    CAddressBalanceValue value;
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 200);
+    BOOST_CHECK_EQUAL(value.received, 700);
+
+    // Writing the same entries again does not count them twice
+    BOOST_CHECK(db.WriteAddressIndex(block2));
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 200);
+
+    // Ranges only return the requested heights
+    std::vector<CAddressIndexDbEntry> entries;
+    BOOST_CHECK(db.ReadAddressIndex(addr, 1, entries, 15));
+    BOOST_CHECK_EQUAL(entries.size(), 1);
+    BOOST_CHECK_EQUAL(entries[0].first.blockHeight, 20);
+    entries.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr, 1, entries, 5, 15));
+    BOOST_CHECK_EQUAL(entries.size(), 2);
+
+    // A rebuild from the entries gives the same totals
+    BOOST_CHECK(db.RebuildAddressBalances());
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 200);
+    BOOST_CHECK_EQUAL(value.received, 700);
+
+    // Disconnecting the spend restores the balance
+    BOOST_CHECK(db.EraseAddressIndex(block2));
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 700);
+    BOOST_CHECK_EQUAL(value.received, 700);
+    BOOST_CHECK(db.EraseAddressIndex(block1));
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 0);
+    BOOST_CHECK_EQUAL(value.received, 0);
+}
+
+BOOST_AUTO_TEST_CASE(queued_index_updates)
+{
+    CExplorerIndexDB db(1 << 20, true);
+    uint160 addr = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint256 txid1 = GetRandHash(), txid2 = GetRandHash();
+    uint256 hash1 = GetRandHash(), hash2 = GetRandHash(), hash3 = GetRandHash();
+    CSpentIndexKey spentKey(txid1, 0);
+
+    // Connect two blocks, disconnect the second and connect another instead
+    CExplorerIndexUpdate update1, update2, update3;
+    update1.hashBest = hash1;
+    update1.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addr, 10, 1, txid1, 0, false), 500));
+    update2.hashBest = hash2;
+    update2.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addr, 20, 1, txid2, 0, true), -500));
+    update2.spentIndex.push_back(std::make_pair(spentKey, CSpentIndexValue(txid2, 0, 20, 500, 1, addr)));
+    CExplorerIndexUpdate undo2(update2);
+    undo2.hashBest = hash1;
+    undo2.fDisconnect = true;
+    undo2.spentIndex[0].second.SetNull();
+    update3.hashBest = hash3;
+    update3.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addr, 20, 2, txid1, 1, false), 300));
+    BOOST_CHECK(db.QueueUpdate(update1));
+    BOOST_CHECK(db.QueueUpdate(update2));
+    BOOST_CHECK(db.QueueUpdate(undo2));
+    BOOST_CHECK(db.QueueUpdate(update3));
+
+    // Nothing is written before the commit
+    uint256 hashSynced;
+    BOOST_CHECK(!db.ReadIndexSynced(hashSynced));
+    BOOST_CHECK(db.CommitQueued(true));
+    BOOST_CHECK(db.ReadIndexSynced(hashSynced));
+    BOOST_CHECK(hashSynced == hash3);
+
+    CAddressBalanceValue value;
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 800);
+    BOOST_CHECK_EQUAL(value.received, 800);
+    std::vector<CAddressIndexDbEntry> entries;
+    BOOST_CHECK(db.ReadAddressIndex(addr, 1, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 2);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(!db.ReadSpentIndex(spentKey, spentValue));
+
+    // Reads wait for what is queued, and the entries are not counted twice
+    CExplorerIndexUpdate again;
+    again.hashBest = hash3;
+    again.addressIndex.push_back(std::make_pair(CAddressIndexKey(1, addr, 20, 2, txid1, 1, false), 300));
+    BOOST_CHECK(db.QueueUpdate(again));
+    BOOST_CHECK(again.addressIndex.empty());
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, 800);
+}
+
+BOOST_AUTO_TEST_CASE(note_index)
+{
+    CExplorerIndexDB db(1 << 20, true);
+    uint256 txid = GetRandHash(), nf = GetRandHash(), cm = GetRandHash();
+
+    std::vector<CNullifierIndexDbEntry> nullifiers;
+    std::vector<CCommitmentIndexDbEntry> commitments;
+    nullifiers.push_back(std::make_pair(CNoteIndexKey(1, nf), CNullifierIndexValue(txid, 2, 100)));
+    commitments.push_back(std::make_pair(CNoteIndexKey(1, cm), CCommitmentIndexValue(txid, 3, 100, 12345)));
+    BOOST_CHECK(db.WriteNoteIndex(nullifiers, commitments));
+
+    CNullifierIndexValue nfValue;
+    BOOST_CHECK(db.ReadNullifierIndex(CNoteIndexKey(1, nf), nfValue));
+    BOOST_CHECK(nfValue.txid == txid);
+    BOOST_CHECK_EQUAL(nfValue.index, 2);
+    BOOST_CHECK_EQUAL(nfValue.blockHeight, 100);
+    // The pools are kept apart
+    BOOST_CHECK(!db.ReadNullifierIndex(CNoteIndexKey(0, nf), nfValue));
+
+    CCommitmentIndexValue cmValue;
+    BOOST_CHECK(db.ReadCommitmentIndex(CNoteIndexKey(1, cm), cmValue));
+    BOOST_CHECK_EQUAL(cmValue.position, 12345);
+
+    BOOST_CHECK(db.EraseNoteIndex(nullifiers, commitments));
+    BOOST_CHECK(!db.ReadNullifierIndex(CNoteIndexKey(1, nf), nfValue));
+    BOOST_CHECK(!db.ReadCommitmentIndex(CNoteIndexKey(1, cm), cmValue));
+}
+
+BOOST_AUTO_TEST_CASE(address_batch_reads)
+{
+    CExplorerIndexDB db(1 << 20, true);
+
+    // Enough addresses to be read on several threads
+    std::vector<std::pair<uint160, int> > addresses;
+    std::vector<CAddressIndexDbEntry> index;
+    std::vector<CAddressUnspentDbEntry> unspent;
+    for (int i = 0; i < 3 * (int)ADDRESS_QUERY_RANGE_SIZE; i++) {
+        uint256 hash = GetRandHash();
+        uint160 addr(std::vector<unsigned char>(hash.begin(), hash.begin() + 20));
+        int type = i % 2 ? 1 : 2;
+        addresses.push_back(std::make_pair(addr, type));
+        // Every third address has no entries
+        if (i % 3 == 0)
+            continue;
+        for (int j = 0; j < 2; j++) {
+            index.push_back(std::make_pair(CAddressIndexKey(type, addr, 10 + j, 1, hash, j, false), 100));
+            unspent.push_back(std::make_pair(CAddressUnspentKey(type, addr, hash, j), CAddressUnspentValue(100, CScript(), 10 + j)));
+        }
+    }
+    BOOST_CHECK(db.WriteAddressIndex(index));
+    BOOST_CHECK(db.UpdateAddressUnspentIndex(unspent));
+
+    std::vector<CAddressIndexDbEntry> batchIndex;
+    BOOST_CHECK(db.ReadAddressIndex(addresses, batchIndex));
+    BOOST_CHECK_EQUAL(batchIndex.size(), index.size());
+    std::vector<CAddressUnspentDbEntry> batchUnspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(addresses, batchUnspent));
+    BOOST_CHECK_EQUAL(batchUnspent.size(), unspent.size());
+
+    // Results come grouped by address in key order
+    for (size_t i = 1; i < batchIndex.size(); i++) {
+        const CAddressIndexKey& a = batchIndex[i - 1].first;
+        const CAddressIndexKey& b = batchIndex[i].first;
+        BOOST_CHECK(a.type < b.type || (a.type == b.type && !(b.hashBytes < a.hashBytes)));
+    }
+
+    // The same as reading each address on its own
+    std::vector<CAddressIndexDbEntry> single;
+    BOOST_CHECK(db.ReadAddressIndex(addresses[1].first, addresses[1].second, single));
+    BOOST_CHECK_EQUAL(single.size(), 2);
+
+    // Heights are filtered the same way, and duplicates read once
+    addresses.push_back(addresses[1]);
+    batchIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addresses, batchIndex, 11, 11));
+    BOOST_CHECK_EQUAL(batchIndex.size(), index.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(move_index_records)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    CTxIndexDB txindex(1 << 20, true);
+    CExplorerIndexDB explorer(1 << 20, true);
+
+    // Indexes as kept in the block tree by older versions
+    std::vector<uint256> txids;
+    for (int i = 0; i < 10; i++) {
+        txids.push_back(GetRandHash());
+        BOOST_CHECK(blocktree.Write(std::make_pair('t', txids.back()), CDiskTxPos(CDiskBlockPos(1, i), i)));
+    }
+    uint160 addr = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    CAddressIndexKey key(1, addr, 10, 1, txids[0], 0, false);
+    BOOST_CHECK(blocktree.Write(std::make_pair('d', key), (CAmount)500));
+    BOOST_CHECK(blocktree.WriteFlag("txindex", true));
+
+    BOOST_CHECK_EQUAL(blocktree.MoveRecords(CTxIndexDB::RecordTypes(), txindex), 10);
+    BOOST_CHECK_EQUAL(blocktree.MoveRecords(CExplorerIndexDB::RecordTypes(), explorer), 1);
+    for (int i = 0; i < 10; i++) {
+        CDiskTxPos pos;
+        BOOST_CHECK(txindex.ReadTxIndex(txids[i], pos));
+        BOOST_CHECK_EQUAL(pos.nPos, i);
+        BOOST_CHECK_EQUAL(pos.nTxOffset, i);
+        BOOST_CHECK(!blocktree.Exists(std::make_pair('t', txids[i])));
+    }
+    std::vector<CAddressIndexDbEntry> entries;
+    BOOST_CHECK(explorer.ReadAddressIndex(addr, 1, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 1);
+    BOOST_CHECK_EQUAL(entries[0].second, 500);
+
+    // The rest of the block tree stays, and moving again finds nothing
+    bool fValue = false;
+    BOOST_CHECK(blocktree.ReadFlag("txindex", fValue) && fValue);
+    BOOST_CHECK_EQUAL(blocktree.MoveRecords(CTxIndexDB::RecordTypes(), txindex), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -47,4 +47,28 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Test vectors from the SipHash reference implementation, key 00..0f
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x726fdb47dd0e0e31ull);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x74f839c593dc67fdull);
+    static const unsigned char t1[7] = {1, 2, 3, 4, 5, 6, 7};
+    hasher.Write(t1, 7);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x93f5f5799a932462ull);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x3f2acc7f57c29bdbull);
+
+    // The uint256 shortcut matches hashing the same 32 bytes
+    uint256 val;
+    for (int i = 0; i < 32; i++)
+        *(val.begin() + i) = i;
+    CSipHasher hasher2(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    hasher2.Write(val.begin(), 32);
+    BOOST_CHECK_EQUAL(hasher2.Finalize(), 0x7127512f72f27cceull);
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceull);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
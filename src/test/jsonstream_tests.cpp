@@ -0,0 +1,91 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/jsonstream.h"
+
+#include "test/test_bitcoin.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+BOOST_FIXTURE_TEST_SUITE(jsonstream_tests, BasicTestingSetup)
+
+static UniValue SampleValue()
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("quote\"back\\slash", "tab\tnewline\ncontrol\x01\x7f"));
+    inner.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    inner.push_back(Pair("null", NullUniValue));
+
+    UniValue arr(UniValue::VARR);
+    arr.push_back(1);
+    arr.push_back(UniValue(-2.5));
+    arr.push_back(UniValue(true));
+    arr.push_back(UniValue(false));
+    arr.push_back(inner);
+    arr.push_back(UniValue(UniValue::VOBJ));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("values", arr));
+    obj.push_back(Pair("text", std::string(1000, 'x')));
+    return obj;
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_matches_univalue)
+{
+    UniValue value = SampleValue();
+
+    std::vector<std::string> vChunks;
+    CJSONStreamWriter json([&](const std::string& chunk) { vChunks.push_back(chunk); return true; }, 16);
+    json.Value(value);
+    BOOST_CHECK(json.Flush());
+
+    std::string strOut;
+    for (const std::string& chunk : vChunks) {
+        strOut += chunk;
+        BOOST_CHECK(!chunk.empty());
+    }
+    BOOST_CHECK(vChunks.size() > 1);
+    BOOST_CHECK_EQUAL(strOut, value.write());
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_incremental)
+{
+    // Building a result element by element gives the same text as the whole value
+    UniValue value = SampleValue();
+    const UniValue& arr = find_value(value, "values");
+
+    std::string strOut;
+    CJSONStreamWriter json([&](const std::string& chunk) { strOut += chunk; return true; });
+    json.BeginObject();
+    json.Key("values");
+    json.BeginArray();
+    for (size_t i = 0; i < arr.size(); i++)
+        json.Value(arr[i]);
+    json.EndArray();
+    json.Key("text");
+    json.Value(find_value(value, "text"));
+    json.EndObject();
+    json.Raw("\n");
+    BOOST_CHECK(strOut.empty());
+    BOOST_CHECK(json.Flush());
+    BOOST_CHECK_EQUAL(strOut, value.write() + "\n");
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_sink_failure)
+{
+    int nCalls = 0;
+    CJSONStreamWriter json([&](const std::string&) { nCalls++; return false; }, 16);
+    json.Value(SampleValue());
+    BOOST_CHECK(json.Failed());
+    BOOST_CHECK(!json.Flush());
+    // Nothing is handed to the sink after it failed
+    BOOST_CHECK_EQUAL(nCalls, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
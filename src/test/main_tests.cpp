@@ -2,11 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#include "blockcache.h"
 #include "chainparams.h"
 #include "main.h"
+#include "mappedfile.h"
+#include "random.h"
+#include "streams.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -123,4 +128,192 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(mapped_file_cache)
+{
+    boost::filesystem::path path = pathTemp / "mapped.dat";
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << uint32_t(1) << std::string("first");
+    }
+
+    CMappedFileCache cache;
+    BOOST_CHECK(!cache.Get(0, path, 0));
+    cache.SetMaxFiles(1);
+
+    std::shared_ptr<const CMappedFile> pfile = cache.Get(0, path, 0);
+    if (!pfile) {
+        BOOST_TEST_MESSAGE("memory mapped files are not supported");
+        return;
+    }
+    uint32_t n;
+    std::string str;
+    CMemoryReader reader(pfile->begin(), pfile->end(), SER_DISK, CLIENT_VERSION);
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 1U);
+    BOOST_CHECK_EQUAL(str, "first");
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+    BOOST_CHECK(cache.Get(0, path, pfile->size()) == pfile);
+
+    // Appending to the file remaps it once more data is asked for
+    {
+        CAutoFile file(fopen(path.string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+        file << uint32_t(2);
+    }
+    std::shared_ptr<const CMappedFile> pgrown = cache.Get(0, path, pfile->size() + 4);
+    BOOST_REQUIRE(pgrown);
+    BOOST_CHECK_EQUAL(pgrown->size(), pfile->size() + 4);
+    CMemoryReader tail(pgrown->begin() + pfile->size(), pgrown->end(), SER_DISK, CLIENT_VERSION);
+    tail >> n;
+    BOOST_CHECK_EQUAL(n, 2U);
+    BOOST_CHECK(!cache.Get(0, path, pgrown->size() + 1));
+
+    // The old mapping stays readable while it is held
+    BOOST_CHECK_EQUAL(std::string(pfile->begin() + 5, pfile->end()), "first");
+    cache.Drop(0);
+    boost::filesystem::remove(path);
+    BOOST_CHECK(!cache.Get(0, path, 0));
+}
+
+BOOST_AUTO_TEST_CASE(recent_block_cache)
+{
+    CRecentBlockCache cache;
+    std::vector<std::shared_ptr<const CBlock> > blocks;
+    for (int i = 0; i < 4; i++) {
+        CBlock block;
+        block.nTime = i;
+        block.vtx.resize(1);
+        blocks.push_back(std::make_shared<const CBlock>(block));
+    }
+
+    // Disabled until a size is set
+    cache.Add(blocks[0]);
+    BOOST_CHECK(!cache.IsEnabled());
+    BOOST_CHECK(!cache.Get(blocks[0]->GetHash()));
+
+    cache.SetMaxSize(1 << 20);
+    cache.Add(blocks[0]);
+    std::shared_ptr<const CRecentBlock> pcached = cache.Get(blocks[0]->GetHash());
+    BOOST_REQUIRE(pcached);
+    BOOST_CHECK(pcached->pblock == blocks[0]);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *blocks[0];
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == pcached->vchBlock);
+
+    // Adding a block twice does not count it twice
+    size_t nUsage = cache.DynamicMemoryUsage();
+    cache.Add(blocks[0]);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+
+    // The oldest blocks are dropped first
+    for (int i = 1; i < 4; i++)
+        cache.Add(blocks[i]);
+    BOOST_CHECK_EQUAL(cache.Count(), 4U);
+    cache.SetMaxSize(2 * nUsage);
+    BOOST_CHECK_EQUAL(cache.Count(), 2U);
+    BOOST_CHECK(!cache.Get(blocks[1]->GetHash()));
+    BOOST_CHECK(cache.Get(blocks[3]->GetHash()));
+    // Readers keep their entry after it is dropped
+    BOOST_CHECK(pcached->pblock->GetHash() == blocks[0]->GetHash());
+
+    cache.SetMaxSize(0);
+    BOOST_CHECK_EQUAL(cache.Count(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(header_cache)
+{
+    CHeaderCache cache;
+    CBlockHeader header;
+    header.nTime = 1;
+    header.nSolution.assign(1344, 0x5a);
+    uint256 hash = header.GetHash();
+    std::vector<char> vch;
+
+    // Disabled until a size is set
+    cache.Add(10, hash, header);
+    BOOST_CHECK(!cache.Append(10, hash, vch));
+
+    // Headers are stored as in a "headers" message of CBlocks
+    cache.SetMaxEntries(4);
+    cache.Add(10, hash, header);
+    BOOST_CHECK(cache.Append(10, hash, vch));
+    CBlock block(header);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(vch == std::vector<char>(ss.begin(), ss.end()));
+
+    // Only for the hash and height they were added with
+    BOOST_CHECK(!cache.Append(10, uint256(), vch));
+    BOOST_CHECK(!cache.Append(11, hash, vch));
+
+    // A height sharing its slot replaces the entry
+    CBlockHeader other = header;
+    other.nTime = 2;
+    cache.Add(14, other.GetHash(), other);
+    BOOST_CHECK(!cache.Append(10, hash, vch));
+    BOOST_CHECK(cache.Append(14, other.GetHash(), vch));
+    BOOST_CHECK_EQUAL(vch.size(), 2 * ss.size());
+}
+
+BOOST_AUTO_TEST_CASE(transaction_cache)
+{
+    CTransactionCache cache;
+    std::vector<CTransaction> txs;
+    for (int i = 0; i < 4; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        txs.push_back(mtx);
+    }
+    uint256 hashBlock = uint256S("0x1");
+    uint256 hashFound;
+
+    // Disabled until a size is set
+    cache.Add(txs[0], hashBlock);
+    BOOST_CHECK(!cache.Get(txs[0].GetHash(), hashFound));
+
+    cache.SetMaxEntries(3);
+    for (int i = 0; i < 3; i++)
+        cache.Add(txs[i], hashBlock);
+    std::shared_ptr<const CTransaction> ptx = cache.Get(txs[0].GetHash(), hashFound);
+    BOOST_REQUIRE(ptx);
+    BOOST_CHECK(ptx->GetHash() == txs[0].GetHash());
+    BOOST_CHECK(hashFound == hashBlock);
+
+    // The least recently used entry goes first: txs[0] was just read
+    cache.Add(txs[3], hashBlock);
+    BOOST_CHECK_EQUAL(cache.Count(), 3U);
+    BOOST_CHECK(cache.Get(txs[0].GetHash(), hashFound));
+    BOOST_CHECK(!cache.Get(txs[1].GetHash(), hashFound));
+
+    // Adding a transaction again replaces its block
+    cache.Add(txs[3], uint256S("0x2"));
+    BOOST_CHECK_EQUAL(cache.Count(), 3U);
+    BOOST_CHECK(cache.Get(txs[3].GetHash(), hashFound));
+    BOOST_CHECK(hashFound == uint256S("0x2"));
+
+    cache.Erase(txs[3].GetHash());
+    BOOST_CHECK(!cache.Get(txs[3].GetHash(), hashFound));
+    cache.SetMaxEntries(0);
+    BOOST_CHECK_EQUAL(cache.Count(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(block_index_solution_on_disk)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex);
+    // InitBlockIndex wrote the entry, so the solution comes from the block tree database
+    BOOST_CHECK(pindex->GetSolution() == genesis.nSolution);
+    BOOST_CHECK(pindex->GetBlockHeader().GetHash() == genesis.GetHash());
+
+    // Neither added nor written
+    uint256 hash = GetRandHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    BOOST_CHECK_THROW(index.GetSolution(), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
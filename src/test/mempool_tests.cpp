@@ -157,6 +157,269 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK(it == pool.mapTx.get<1>().end());
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    /* low fee parent */
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+
+    /* mid fee, no dependencies */
+    CMutableTransaction txMid = CMutableTransaction();
+    txMid.vout.resize(1);
+    txMid.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txMid.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(txMid.GetHash(), entry.Fee(10000LL).FromTx(txMid));
+
+    /* high fee child paying for its parent */
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000LL).FromTx(txChild));
+
+    CTxMemPool::txiter itParent = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter itChild = pool.mapTx.find(txChild.GetHash());
+    BOOST_CHECK_EQUAL(itParent->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(itChild->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(itChild->GetFeesWithAncestors(), 51000LL);
+    BOOST_CHECK_EQUAL(itChild->GetSizeWithAncestors(), itParent->GetTxSize() + itChild->GetTxSize());
+
+    // The child's package beats the mid fee transaction, the parent alone does not
+    CTxMemPool::indexed_transaction_set::nth_index<2>::type::iterator it = pool.mapTx.get<2>().begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txChild.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txMid.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txParent.GetHash().ToString());
+    BOOST_CHECK(it == pool.mapTx.get<2>().end());
+
+    // Fee deltas count towards the descendants too
+    pool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0, 2000LL);
+    BOOST_CHECK_EQUAL(itChild->GetFeesWithAncestors(), 53000LL);
+    pool.ClearPrioritisation(txParent.GetHash());
+    BOOST_CHECK_EQUAL(itChild->GetFeesWithAncestors(), 51000LL);
+
+    // Mining the parent leaves the child on its own
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(itChild->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(itChild->GetFeesWithAncestors(), 50000LL);
+    BOOST_CHECK_EQUAL(itChild->GetSizeWithAncestors(), itChild->GetTxSize());
+
+    // Putting it back (as after a reorg) makes it an ancestor again
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    BOOST_CHECK_EQUAL(itChild->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(itChild->GetFeesWithAncestors(), 51000LL);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolDescendantTrackingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A chain of four transactions, each spending the previous one
+    std::vector<CMutableTransaction> chain(4);
+    for (size_t i = 0; i < chain.size(); i++) {
+        if (i > 0) {
+            chain[i].vin.resize(1);
+            chain[i].vin[0].prevout = COutPoint(chain[i - 1].GetHash(), 0);
+            chain[i].vin[0].scriptSig = CScript() << OP_11;
+        }
+        chain[i].vout.resize(1);
+        chain[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        chain[i].vout[0].nValue = (10 - i) * COIN;
+        pool.addUnchecked(chain[i].GetHash(), entry.Fee(1000LL * (i + 1)).FromTx(chain[i]));
+    }
+
+    CTxMemPool::txiter itRoot = pool.mapTx.find(chain[0].GetHash());
+    CTxMemPool::txiter itTip = pool.mapTx.find(chain[3].GetHash());
+    BOOST_CHECK_EQUAL(itRoot->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(itRoot->GetFeesWithDescendants(), 10000LL);
+    BOOST_CHECK_EQUAL(itTip->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(itTip->GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(itRoot).size(), 1);
+    BOOST_CHECK(pool.GetMemPoolParents(itRoot).empty());
+
+    // Fee deltas on the tip reach every ancestor
+    pool.PrioritiseTransaction(chain[3].GetHash(), chain[3].GetHash().ToString(), 0, 500LL);
+    BOOST_CHECK_EQUAL(itRoot->GetFeesWithDescendants(), 10500LL);
+    pool.ClearPrioritisation(chain[3].GetHash());
+    BOOST_CHECK_EQUAL(itRoot->GetFeesWithDescendants(), 10000LL);
+
+    // A fifth link breaks a limit of four ancestors or descendants, but not five
+    CMutableTransaction txNext;
+    txNext.vin.resize(1);
+    txNext.vin[0].prevout = COutPoint(chain[3].GetHash(), 0);
+    txNext.vin[0].scriptSig = CScript() << OP_11;
+    txNext.vout.resize(1);
+    txNext.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txNext.vout[0].nValue = 5 * COIN;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string errString;
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(txNext, 100, setAncestors, 5, nNoLimit, 5, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 4);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(txNext, 100, setAncestors, 4, nNoLimit, nNoLimit, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(txNext, 100, setAncestors, nNoLimit, nNoLimit, 4, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(txNext, 100, setAncestors, nNoLimit, nNoLimit, nNoLimit, itRoot->GetSizeWithDescendants(), errString));
+
+    // Mining the middle of the chain splits the totals
+    std::list<CTransaction> removed;
+    pool.remove(chain[1], removed, false);
+    BOOST_CHECK_EQUAL(itRoot->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(itRoot->GetFeesWithDescendants(), 1000LL);
+    BOOST_CHECK_EQUAL(itTip->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(itTip->GetFeesWithAncestors(), 7000LL);
+
+    // Removing the root recursively leaves the rest of the chain alone
+    removed.clear();
+    pool.remove(chain[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+
+    // Recursive removal reports parents before children
+    removed.clear();
+    pool.remove(chain[2], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK(removed.front().GetHash() == chain[2].GetHash());
+    BOOST_CHECK(removed.back().GetHash() == chain[3].GetHash());
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolChangesSinceTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::vector<CMutableTransaction> vtx(3);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        vtx[i].vout[0].nValue = (i + 1) * COIN;
+    }
+
+    uint64_t nStart = pool.GetSequence();
+    pool.addUnchecked(vtx[0].GetHash(), entry.FromTx(vtx[0]));
+    pool.addUnchecked(vtx[1].GetHash(), entry.FromTx(vtx[1]));
+    uint64_t nMid = pool.GetSequence();
+    BOOST_CHECK_EQUAL(nMid, nStart + 2);
+
+    std::list<CTransaction> removed;
+    pool.remove(vtx[0], removed, false);
+    pool.addUnchecked(vtx[2].GetHash(), entry.FromTx(vtx[2]));
+    pool.remove(vtx[2], removed, false);
+
+    std::vector<uint256> vAdded, vRemoved;
+    uint64_t nCurrent;
+    BOOST_CHECK(pool.GetChangesSince(nMid, vAdded, vRemoved, nCurrent));
+    BOOST_CHECK_EQUAL(nCurrent, nMid + 3);
+    // vtx[2] came and went in between
+    BOOST_CHECK(vAdded.empty());
+    BOOST_CHECK_EQUAL(vRemoved.size(), 1);
+    BOOST_CHECK(vRemoved[0] == vtx[0].GetHash());
+
+    vAdded.clear();
+    vRemoved.clear();
+    BOOST_CHECK(pool.GetChangesSince(nStart, vAdded, vRemoved, nCurrent));
+    BOOST_CHECK_EQUAL(vAdded.size(), 1);
+    BOOST_CHECK(vAdded[0] == vtx[1].GetHash());
+    BOOST_CHECK(vRemoved.empty());
+
+    // Nothing is known past a clear, or in the future
+    BOOST_CHECK(!pool.GetChangesSince(nCurrent + 1, vAdded, vRemoved, nCurrent));
+    pool.clear();
+    BOOST_CHECK(!pool.GetChangesSince(nMid, vAdded, vRemoved, nCurrent));
+    BOOST_CHECK(pool.GetChangesSince(pool.GetSequence(), vAdded, vRemoved, nCurrent));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolStatsTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::vector<CMutableTransaction> vtx(2);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    }
+    vtx[0].vout[0].nValue = COIN;
+    vtx[1].vout[0].nValue = 10000 * COIN;
+
+    pool.addUnchecked(vtx[0].GetHash(), entry.Fee(10000).FromTx(vtx[0]));
+    pool.addUnchecked(vtx[1].GetHash(), entry.Fee(0).FromTx(vtx[1]));
+
+    CMemPoolStats stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats.classes[MEMPOOL_TX_TRANSPARENT].nCount, 1);
+    BOOST_CHECK_EQUAL(stats.classes[MEMPOOL_TX_TRANSPARENT].nFees, 10000);
+    BOOST_CHECK_EQUAL(stats.classes[MEMPOOL_TX_TRANSPARENT].nBytes, ::GetSerializeSize(vtx[0], SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(stats.classes[MEMPOOL_TX_COLLATERAL].nCount, 1);
+    BOOST_CHECK_EQUAL(stats.vFeeRates.size(), stats.vFeeRateBounds.size());
+    BOOST_CHECK_EQUAL(stats.vFeeRates[0].nCount, 1);
+    uint64_t nBucketed = 0;
+    BOOST_FOREACH(const CMemPoolStatsEntry& bucket, stats.vFeeRates)
+        nBucketed += bucket.nCount;
+    BOOST_CHECK_EQUAL(nBucketed, 2);
+
+    // Lock requests move to their own class, and leave it on removal
+    pool.SetLockRequest(vtx[0].GetHash());
+    stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats.classes[MEMPOOL_TX_TRANSPARENT].nCount, 0);
+    BOOST_CHECK_EQUAL(stats.classes[MEMPOOL_TX_LOCKED].nCount, 1);
+
+    std::list<CTransaction> removed;
+    pool.remove(vtx[0], removed, false);
+    pool.remove(vtx[1], removed, false);
+    stats = pool.GetStats();
+    for (int i = 0; i < MEMPOOL_TX_CLASS_COUNT; i++) {
+        BOOST_CHECK_EQUAL(stats.classes[i].nCount, 0);
+        BOOST_CHECK_EQUAL(stats.classes[i].nBytes, 0);
+        BOOST_CHECK_EQUAL(stats.classes[i].nUsage, 0);
+        BOOST_CHECK_EQUAL(stats.classes[i].nCost, 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolMemoryUsageTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CMemPoolUsage usage = pool.GetMemoryUsage();
+    BOOST_CHECK_EQUAL(usage.nTransactions, 0);
+    BOOST_CHECK_EQUAL(usage.nLinks, 0);
+
+    CMutableTransaction txParent;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = COIN;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout = txParent.vout;
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.FromTx(txChild));
+
+    // Everything DynamicMemoryUsage counts, and the parent and child sets
+    usage = pool.GetMemoryUsage();
+    BOOST_CHECK(usage.nTransactions > 0);
+    BOOST_CHECK(usage.nLinks > 0);
+    BOOST_CHECK(usage.nSpends > 0);
+    BOOST_CHECK(usage.Total() > pool.DynamicMemoryUsage());
+
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    usage = pool.GetMemoryUsage();
+    BOOST_CHECK_EQUAL(usage.nTransactions, 0);
+    BOOST_CHECK_EQUAL(usage.nLinks, 0);
+}
+
 BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     CTxMemPool pool(CFeeRate(0));
     TestMemPoolEntryHelper entry;
@@ -212,6 +475,55 @@ BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     BOOST_CHECK_EQUAL(pool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(RemoveWithAnchor) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.nFee = 10000LL;
+    entry.hadNoDependencies = true;
+
+    uint256 anchorA = GetRandHash(), anchorB = GetRandHash(), anchorC = GetRandHash();
+    std::vector<CMutableTransaction> vtx;
+    for (auto i = 0; i < 6; i++) {
+        CMutableTransaction tx;
+        tx.fOverwintered = true;
+        tx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+        tx.nVersion = SAPLING_TX_VERSION;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = (i + 1) * COIN;
+        // Two transactions on each anchor, the last one spending from A and C
+        SpendDescription spend;
+        spend.nullifier = GetRandHash();
+        spend.anchor = i < 2 ? anchorA : (i < 4 ? anchorB : anchorC);
+        tx.vShieldedSpend.push_back(spend);
+        if (i == 5) {
+            spend.nullifier = GetRandHash();
+            spend.anchor = anchorA;
+            tx.vShieldedSpend.push_back(spend);
+        }
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+        vtx.push_back(tx);
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+
+    // Sprout anchors do not touch Sapling spends
+    pool.removeWithAnchor(std::set<uint256>{anchorA}, SPROUT);
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+
+    pool.removeWithAnchor(std::set<uint256>{anchorA}, SAPLING);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(!pool.exists(vtx[0].GetHash()));
+    BOOST_CHECK(!pool.exists(vtx[5].GetHash()));
+    BOOST_CHECK(pool.exists(vtx[4].GetHash()));
+
+    // Removed transactions are gone from the index too
+    pool.removeWithAnchor(std::set<uint256>{anchorA}, SAPLING);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    pool.removeWithAnchor(std::set<uint256>{anchorB, anchorC, GetRandHash()}, SAPLING);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
 // Test that nCheckFrequency is set correctly when calling setSanityCheck().
 // https://github.com/zcash/zcash/issues/3134
 BOOST_AUTO_TEST_CASE(SetSanityCheck) {
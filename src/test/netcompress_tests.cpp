@@ -0,0 +1,91 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "netcompress.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(netcompress_tests, BasicTestingSetup)
+
+static bool RoundTrip(const std::vector<char>& vch)
+{
+    std::vector<char> vchCompressed;
+    if (!CompressPayload(vch.data(), vch.size(), vchCompressed))
+        return false;
+    BOOST_CHECK(vchCompressed.size() < vch.size());
+    CSerializeData vchOut;
+    BOOST_CHECK(DecompressPayload(vchCompressed.data(), vchCompressed.size(), vchOut, vch.size()));
+    BOOST_CHECK(std::vector<char>(vchOut.begin(), vchOut.end()) == vch);
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(netcompress_roundtrip)
+{
+    // Repeats, short and long, and runs that overlap their own match
+    std::vector<char> vch;
+    for (int i = 0; i < 2000; i++) {
+        std::string str = "inv " + std::to_string(i % 37) + " ";
+        vch.insert(vch.end(), str.begin(), str.end());
+    }
+    BOOST_CHECK(RoundTrip(vch));
+    BOOST_CHECK(RoundTrip(std::vector<char>(100000, 'a')));
+
+    // Literals between matches, over the 64 KiB window
+    std::vector<char> vchMixed;
+    for (int i = 0; i < 50; i++) {
+        std::vector<unsigned char> vchRand = ParseHex(GetRandHash().GetHex());
+        vchMixed.insert(vchMixed.end(), vchRand.begin(), vchRand.end());
+        vchMixed.insert(vchMixed.end(), vch.begin(), vch.begin() + 3000);
+    }
+    BOOST_CHECK(RoundTrip(vchMixed));
+}
+
+BOOST_AUTO_TEST_CASE(netcompress_incompressible)
+{
+    std::vector<char> vch(10000);
+    GetRandBytes((unsigned char*)vch.data(), vch.size());
+    std::vector<char> vchCompressed;
+    BOOST_CHECK(!CompressPayload(vch.data(), vch.size(), vchCompressed));
+    BOOST_CHECK(!CompressPayload(vch.data(), 0, vchCompressed));
+}
+
+BOOST_AUTO_TEST_CASE(netcompress_malformed)
+{
+    std::vector<char> vch(5000, 'x');
+    std::vector<char> vchCompressed;
+    BOOST_REQUIRE(CompressPayload(vch.data(), vch.size(), vchCompressed));
+    CSerializeData vchOut;
+
+    // Over the size limit
+    BOOST_CHECK(!DecompressPayload(vchCompressed.data(), vchCompressed.size(), vchOut, vch.size() - 1));
+
+    // Every truncation fails
+    for (size_t n = 0; n < vchCompressed.size(); n++)
+        BOOST_CHECK(!DecompressPayload(vchCompressed.data(), n, vchOut, vch.size()));
+
+    // A stated size that does not match what expands
+    std::vector<char> vchBad(vchCompressed);
+    vchBad[0]++;
+    BOOST_CHECK(!DecompressPayload(vchBad.data(), vchBad.size(), vchOut, vch.size() + 1));
+
+    // An offset before the start of the output
+    const char pchBadOffset[] = {10, 0, 0, 0, 0x10, 'a', 2, 0};
+    BOOST_CHECK(!DecompressPayload(pchBadOffset, sizeof(pchBadOffset), vchOut, 100));
+
+    // Random input never reads or writes out of bounds
+    for (int i = 0; i < 1000; i++) {
+        std::vector<char> vchRand(4 + GetRand(200));
+        GetRandBytes((unsigned char*)vchRand.data(), vchRand.size());
+        DecompressPayload(vchRand.data(), vchRand.size(), vchOut, 1000);
+        BOOST_CHECK(vchOut.size() <= 1000);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
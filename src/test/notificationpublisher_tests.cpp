@@ -0,0 +1,98 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "notificationpublisher.h"
+#include "primitives/transaction.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(notificationpublisher_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(publisher_inline_when_stopped)
+{
+    CNotificationPublisher publisher("test");
+    unsigned int nDropped = 1;
+    BOOST_CHECK(publisher.Push([&nDropped](unsigned int n) { nDropped = n; }));
+    BOOST_CHECK_EQUAL(nDropped, 0U);
+    BOOST_CHECK_EQUAL(publisher.GetDropped(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(publisher_order)
+{
+    CNotificationPublisher publisher("test");
+    publisher.Start(1000);
+
+    std::vector<int> vOrder;
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(publisher.Push([&vOrder, i](unsigned int) { vOrder.push_back(i); }, i % 2 == 0));
+    publisher.Stop();
+    BOOST_REQUIRE_EQUAL(vOrder.size(), 100U);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK_EQUAL(vOrder[i], i);
+    BOOST_CHECK_EQUAL(publisher.Depth(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(publisher_high_water_mark)
+{
+    CNotificationPublisher publisher("test");
+    publisher.Start(2);
+    uint64_t nDroppedBefore = GetNotificationsDropped();
+
+    std::atomic<bool> fStarted(false);
+    std::atomic<bool> fRelease(false);
+    publisher.Push([&fStarted, &fRelease](unsigned int) {
+        fStarted = true;
+        while (!fRelease)
+            MilliSleep(1);
+    }, false);
+    while (!fStarted)
+        MilliSleep(1);
+
+    std::vector<unsigned int> vDropped;
+    BOOST_CHECK(publisher.Push([&vDropped](unsigned int n) { vDropped.push_back(n); }));
+    BOOST_CHECK(publisher.Push([&vDropped](unsigned int n) { vDropped.push_back(n); }));
+    // Over the mark: droppable messages go, the others are still queued
+    BOOST_CHECK(!publisher.Push([&vDropped](unsigned int n) { vDropped.push_back(n); }));
+    BOOST_CHECK(!publisher.Push([&vDropped](unsigned int n) { vDropped.push_back(n); }));
+    BOOST_CHECK(publisher.Push([&vDropped](unsigned int n) { vDropped.push_back(100 + n); }, false));
+    BOOST_CHECK_EQUAL(publisher.Depth(), 3U);
+    BOOST_CHECK_EQUAL(publisher.GetDropped(), 2U);
+    BOOST_CHECK_EQUAL(GetNotificationsDropped() - nDroppedBefore, 2U);
+
+    fRelease = true;
+    while (publisher.Depth() > 0)
+        MilliSleep(1);
+    // The next droppable message is told about the drops
+    BOOST_CHECK(publisher.Push([&vDropped](unsigned int n) { vDropped.push_back(n); }));
+    publisher.Stop();
+
+    std::vector<unsigned int> vExpected = {0, 0, 100, 2};
+    BOOST_CHECK(vDropped == vExpected);
+}
+
+BOOST_AUTO_TEST_CASE(transaction_payload)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 1;
+    CTransaction tx(mtx);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    CNotificationPayload payload = GetTransactionPayload(tx);
+    BOOST_REQUIRE(payload);
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == *payload);
+    // Serialized once for every notifier
+    BOOST_CHECK(GetTransactionPayload(tx) == payload);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
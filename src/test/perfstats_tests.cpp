@@ -0,0 +1,86 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "perfstats.h"
+#include "test/test_bitcoin.h"
+
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(perfstats_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(histogram_summary)
+{
+    CTimingHistogram histogram;
+    CTimingHistogram::Summary summary = histogram.GetSummary();
+    BOOST_CHECK_EQUAL(summary.nCount, 0U);
+    BOOST_CHECK_EQUAL(summary.p50, 0);
+    BOOST_CHECK_EQUAL(summary.p99, 0);
+
+    // 90 fast samples in [64, 128), 10 slow ones in [8192, 16384)
+    for (int i = 0; i < 90; i++)
+        histogram.Add(100);
+    for (int i = 0; i < 10; i++)
+        histogram.Add(10000);
+    summary = histogram.GetSummary();
+    BOOST_CHECK_EQUAL(summary.nCount, 100U);
+    BOOST_CHECK_EQUAL(summary.nSum, 90 * 100 + 10 * 10000);
+    BOOST_CHECK_EQUAL(summary.nMax, 10000);
+    BOOST_CHECK(summary.p50 >= 64 && summary.p50 < 128);
+    BOOST_CHECK(summary.p90 >= 64 && summary.p90 <= 128);
+    BOOST_CHECK(summary.p99 >= 8192 && summary.p99 <= 10000);
+
+    // Negative durations count as zero, huge ones land in the last bucket
+    histogram.Add(-5);
+    histogram.Add(std::numeric_limits<int64_t>::max() / 2);
+    summary = histogram.GetSummary();
+    BOOST_CHECK_EQUAL(summary.nCount, 102U);
+    BOOST_CHECK_EQUAL(summary.nMax, std::numeric_limits<int64_t>::max() / 2);
+
+    histogram.Reset();
+    summary = histogram.GetSummary();
+    BOOST_CHECK_EQUAL(summary.nCount, 0U);
+    BOOST_CHECK_EQUAL(summary.nSum, 0);
+    BOOST_CHECK_EQUAL(summary.nMax, 0);
+}
+
+BOOST_AUTO_TEST_CASE(histogram_concurrent_adds)
+{
+    CTimingHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&histogram, t]() {
+            for (int i = 0; i < 10000; i++)
+                histogram.Add(t * 1000 + i % 100);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    CTimingHistogram::Summary summary = histogram.GetSummary();
+    BOOST_CHECK_EQUAL(summary.nCount, 40000U);
+    BOOST_CHECK_EQUAL(summary.nMax, 3099);
+}
+
+BOOST_AUTO_TEST_CASE(perf_stats)
+{
+    ResetPerfStats();
+    RecordPerfStat(PERF_MEMPOOL_ACCEPT, 50);
+    {
+        CPerfStatTimer timer(PERF_SAPLING_PROOFS);
+    }
+    BOOST_CHECK_EQUAL(GetPerfStat(PERF_MEMPOOL_ACCEPT).GetSummary().nCount, 1U);
+    BOOST_CHECK_EQUAL(GetPerfStat(PERF_SAPLING_PROOFS).GetSummary().nCount, 1U);
+    BOOST_CHECK_EQUAL(GetPerfStat(PERF_CONNECT_TIP).GetSummary().nCount, 0U);
+    BOOST_CHECK_EQUAL(std::string(GetPerfStatName(PERF_MEMPOOL_ACCEPT)), "mempoolaccept");
+    BOOST_CHECK_EQUAL(std::string(GetPerfStatName(PERF_SAPLING_PROOFS)), "saplingproofs");
+
+    ResetPerfStats();
+    BOOST_CHECK_EQUAL(GetPerfStat(PERF_MEMPOOL_ACCEPT).GetSummary().nCount, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
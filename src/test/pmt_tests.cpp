@@ -49,6 +49,7 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
 
         // calculate actual merkle root and height
         uint256 merkleRoot1 = block.BuildMerkleTree();
+        BOOST_CHECK(block.ComputeMerkleRoot() == merkleRoot1);
         std::vector<uint256> vTxid(nTx, uint256());
         for (unsigned int j=0; j<nTx; j++)
             vTxid[j] = block.vtx[j].GetHash();
@@ -123,4 +124,26 @@ BOOST_AUTO_TEST_CASE(pmt_malleability)
     BOOST_CHECK(tree.ExtractMatches(vTxid).IsNull());
 }
 
+BOOST_AUTO_TEST_CASE(block_merkle_mutated)
+{
+    CBlock block;
+    for (unsigned int j = 0; j < 6; j++) {
+        CMutableTransaction tx;
+        tx.nLockTime = j;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    bool mutated = true;
+    uint256 root = block.ComputeMerkleRoot(&mutated);
+    BOOST_CHECK(!mutated);
+
+    // Repeating the last two transactions keeps the root but is detected
+    block.vtx.push_back(block.vtx[4]);
+    block.vtx.push_back(block.vtx[5]);
+    BOOST_CHECK(block.ComputeMerkleRoot(&mutated) == root);
+    BOOST_CHECK(mutated);
+    mutated = false;
+    BOOST_CHECK(block.BuildMerkleTree(&mutated) == root);
+    BOOST_CHECK(mutated);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
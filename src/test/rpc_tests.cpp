@@ -4,6 +4,7 @@
 
 #include "rpc/server.h"
 #include "rpc/client.h"
+#include "rpc/resultcache.h"
 
 #include "key_io.h"
 #include "main.h"
@@ -388,6 +389,12 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     CheckRPCThrows("getblockhashes 0 0",
         "Error: getblockhashes is disabled. "
         "Run './zcash-cli help getblockhashes' for instructions on how to enable this feature.");
+    CheckRPCThrows("getnullifierinfo \"a\"",
+        "Error: getnullifierinfo is disabled. "
+        "Run './zcash-cli help getnullifierinfo' for instructions on how to enable this feature.");
+    CheckRPCThrows("getcommitmentinfo \"a\"",
+        "Error: getcommitmentinfo is disabled. "
+        "Run './zcash-cli help getcommitmentinfo' for instructions on how to enable this feature.");
 
     // During startup of the real system, fInsightExplorer ("-insightexplorer")
     // automatically enables the next three, but not here, must explicitly enable.
@@ -396,6 +403,7 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     fAddressIndex = true;
     fSpentIndex = true;
     fTimestampIndex = true;
+    fNoteIndex = true;
 
     // must be a legal mainnet address
     const string addr = "t1T3G72ToPuCDTiCEytrU1VUBRHsNupEBut";
@@ -454,12 +462,129 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     CheckRPCThrows("getblockhashes 1477641360 1477641360 {\"noOrphans\":True,\"logicalTimes\":false}",
         "Error parsing JSON:{\"noOrphans\":True,\"logicalTimes\":false}");
 
+    // nullifier and commitment do not exist:
+    const string nf = "b4cc287e58f87cdae59417329f710f3ecd75a4ee1d2872b7248f50977c8493f3";
+    CheckRPCThrows("getnullifierinfo \"" + nf + "\"", "Unable to get nullifier info");
+    CheckRPCThrows("getnullifierinfo \"" + nf + "\" \"sprout\"", "Unable to get nullifier info");
+    CheckRPCThrows("getnullifierinfo \"" + nf + "\" \"orchard\"", "Invalid pool, must be \"sapling\" or \"sprout\"");
+    CheckRPCThrows("getcommitmentinfo \"" + nf + "\"", "Unable to get note commitment info");
+    CheckRPCThrows("getcommitmentinfo \"hello\"", "commitment must be hexadecimal string (not 'hello')");
+
+    // indexes enabled on an existing node are not used until they are built
+    fExplorerIndexBuilding = true;
+    CheckRPCThrows("getaddressbalance {\"addresses\":[]}",
+        "The explorer indexes are being built, currently up to height -1 of 0");
+    CheckRPCThrows("getblockhashes 1477641360 1477641360",
+        "The explorer indexes are being built, currently up to height -1 of 0");
+    fExplorerIndexBuilding = false;
+
     // revert
     fExperimentalMode = false;
     fInsightExplorer = false;
     fAddressIndex = false;
     fSpentIndex = false;
     fTimestampIndex = false;
+    fNoteIndex = false;
+}
+
+static UniValue BatchRequest(const std::string& strMethod, const UniValue& params, int id)
+{
+    UniValue request(UniValue::VOBJ);
+    request.push_back(Pair("method", strMethod));
+    request.push_back(Pair("params", params));
+    request.push_back(Pair("id", id));
+    return request;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    SetRPCWarmupFinished();
+
+    // Read-only calls around a call that may change state, which runs alone
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue params(UniValue::VARR);
+        if (i == 10) {
+            batch.push_back(BatchRequest("setmocktime", params, i));
+            continue;
+        }
+        params.push_back(i % 2 ? "51" : "52");
+        batch.push_back(BatchRequest("decodescript", params, i));
+    }
+    batch.push_back(BatchRequest("nosuchmethod", UniValue(UniValue::VARR), 20));
+
+    boost::thread_group helpers;
+    RPCSetWorkerDispatcher([&helpers](const boost::function<void(void)>& func) {
+        helpers.create_thread(func);
+        return true;
+    });
+    UniValue reply;
+    BOOST_CHECK(reply.read(JSONRPCExecBatch(batch)));
+    helpers.join_all();
+    RPCSetWorkerDispatcher(RPCWorkerDispatcher());
+
+    // Replies come back in request order, whichever thread ran them
+    BOOST_CHECK_EQUAL(reply.size(), 21);
+    for (int i = 0; i < 20; i++) {
+        BOOST_CHECK_EQUAL(find_value(reply[i], "id").get_int(), i);
+        if (i == 10) {
+            // setmocktime without arguments fails with its help text
+            BOOST_CHECK(!find_value(reply[i], "error").isNull());
+            continue;
+        }
+        BOOST_CHECK(find_value(reply[i], "error").isNull());
+        BOOST_CHECK_EQUAL(find_value(find_value(reply[i], "result"), "asm").get_str(), i % 2 ? "1" : "2");
+    }
+    BOOST_CHECK_EQUAL(find_value(find_value(reply[20], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_result_cache)
+{
+    RPCResultCacheInit(64 * 1024);
+    UniValue params(UniValue::VARR);
+    params.push_back(UniValue(1));
+    RPCCacheKey key;
+    std::string strResult;
+
+    // Calls with side effects or other inputs than the tip are never cached
+    BOOST_CHECK(!RPCResultCacheLookup("getnewaddress", UniValue(UniValue::VARR), key, strResult));
+    BOOST_CHECK_EQUAL(key.policy, RPC_CACHE_NONE);
+
+    BOOST_CHECK(!RPCResultCacheLookup("getblockhash", params, key, strResult));
+    BOOST_CHECK_EQUAL(key.policy, RPC_CACHE_TIP);
+    RPCResultCacheStore(key, "\"00ff\"");
+    BOOST_CHECK(RPCResultCacheLookup("getblockhash", params, key, strResult));
+    BOOST_CHECK_EQUAL(strResult, "\"00ff\"");
+
+    // Other parameters are another entry
+    UniValue params2(UniValue::VARR);
+    params2.push_back(UniValue(2));
+    BOOST_CHECK(!RPCResultCacheLookup("getblockhash", params2, key, strResult));
+
+    // Results filed under another tip are dropped
+    key.tip = GetRandHash();
+    RPCResultCacheStore(key, "\"00ee\"");
+    BOOST_CHECK(!RPCResultCacheLookup("getblockhash", params2, key, strResult));
+
+    // Results larger than an eighth of the cache are not kept
+    RPCResultCacheStore(key, std::string(10000, '0'));
+    BOOST_CHECK(!RPCResultCacheLookup("getblockhash", params2, key, strResult));
+
+    // The least recently used results make room for new ones
+    for (int i = 0; i < 100; i++) {
+        UniValue p(UniValue::VARR);
+        p.push_back(UniValue(100 + i));
+        RPCResultCacheLookup("getblockhash", p, key, strResult);
+        RPCResultCacheStore(key, std::string(1000, '0'));
+    }
+    RPCResultCacheStats stats = RPCResultCacheGetStats();
+    BOOST_CHECK(stats.nEvictions > 0);
+    BOOST_CHECK(stats.nUsage <= stats.nMaxUsage);
+    BOOST_CHECK(!RPCResultCacheLookup("getblockhash", params, key, strResult));
+
+    RPCResultCacheInit(0);
+    BOOST_CHECK(!RPCResultCacheLookup("getblockhash", params, key, strResult));
+    BOOST_CHECK_EQUAL(key.policy, RPC_CACHE_NONE);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -653,6 +653,46 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_z_importexport)
 }
 
 
+/*
+ * This test covers RPC command z_importkeys
+ */
+BOOST_AUTO_TEST_CASE(rpc_wallet_z_importkeys)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    UniValue retValue;
+
+    BOOST_CHECK_THROW(CallRPC("z_importkeys"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_importkeys [] no false toomany"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_importkeys [] maybe"), runtime_error);
+
+    auto sproutKey = libzcash::SproutSpendingKey::random();
+    auto saplingKey = GetTestMasterSaplingSpendingKey().Derive(7);
+    std::string keys = "[\"" + EncodeSpendingKey(sproutKey) + "\",{\"key\":\"" + EncodeSpendingKey(saplingKey) + "\",\"height\":0}";
+
+    // A bad key or height fails the whole batch before anything is added
+    BOOST_CHECK_THROW(CallRPC("z_importkeys " + keys + ",\"notakey\"] no"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_importkeys " + keys + ",{\"key\":\"" + EncodeSpendingKey(sproutKey) + "\",\"height\":2147483647}] no"), runtime_error);
+    BOOST_CHECK(!pwalletMain->HaveSproutSpendingKey(sproutKey.address()));
+
+    BOOST_CHECK_NO_THROW(retValue = CallRPC("z_importkeys " + keys + "] no"));
+    UniValue arr = find_value(retValue, "keys").get_array();
+    BOOST_CHECK_EQUAL(arr.size(), 2);
+    BOOST_CHECK_EQUAL(find_value(arr[0], "type").get_str(), "zkey");
+    BOOST_CHECK_EQUAL(find_value(arr[0], "address").get_str(), EncodePaymentAddress(sproutKey.address()));
+    BOOST_CHECK(find_value(arr[0], "new").get_bool());
+    BOOST_CHECK_EQUAL(find_value(arr[1], "address").get_str(), EncodePaymentAddress(saplingKey.DefaultAddress()));
+    BOOST_CHECK(find_value(retValue, "rescan_height").isNull());
+    BOOST_CHECK(pwalletMain->HaveSproutSpendingKey(sproutKey.address()));
+    BOOST_CHECK(pwalletMain->HaveSaplingSpendingKey(saplingKey.expsk.full_viewing_key()));
+
+    // Keys already in the wallet are not new and do not trigger a rescan
+    BOOST_CHECK_NO_THROW(retValue = CallRPC("z_importkeys " + keys + "]"));
+    arr = find_value(retValue, "keys").get_array();
+    BOOST_CHECK(!find_value(arr[0], "new").get_bool());
+    BOOST_CHECK(!find_value(arr[1], "new").get_bool());
+    BOOST_CHECK(find_value(retValue, "rescan_height").isNull());
+}
+
 
 /**
  * Test Async RPC operations.
@@ -801,6 +841,54 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_wait)
     BOOST_CHECK_EQUAL(numOperations, gCounter.load());
 }
 
+class BulkSleepOperation : public MockSleepOperation {
+public:
+    BulkSleepOperation(int t) : MockSleepOperation(t) {}
+    virtual ~BulkSleepOperation() {}
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_BULK;
+    }
+};
+
+// This tests that an operation on the bulk lane does not hold up the default lane
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_lanes)
+{
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    q->addWorker(ASYNC_RPC_LANE_DEFAULT);
+
+    // Without a bulk worker, bulk operations run on the default lane
+    std::shared_ptr<AsyncRPCOperation> op1(new BulkSleepOperation(10));
+    q->addOperation(op1);
+    BOOST_CHECK_EQUAL(q->getLaneForId(op1->getId()), ASYNC_RPC_LANE_DEFAULT);
+
+    q->addWorker(ASYNC_RPC_LANE_BULK);
+    BOOST_CHECK(q->getNumberOfWorkers() == 2);
+
+    std::shared_ptr<AsyncRPCOperation> op2(new BulkSleepOperation(3000));
+    std::shared_ptr<AsyncRPCOperation> op3(new MockSleepOperation(10));
+    q->addOperation(op2);
+    q->addOperation(op3);
+    BOOST_CHECK_EQUAL(q->getLaneForId(op2->getId()), ASYNC_RPC_LANE_BULK);
+    BOOST_CHECK_EQUAL(q->getLaneForId(op3->getId()), ASYNC_RPC_LANE_DEFAULT);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    BOOST_CHECK_EQUAL(op1->isSuccess(), true);
+    BOOST_CHECK_EQUAL(op2->isExecuting(), true);
+    BOOST_CHECK_EQUAL(op3->isSuccess(), true);
+
+    AsyncRPCLaneStats stats = q->getLaneStats(ASYNC_RPC_LANE_DEFAULT);
+    BOOST_CHECK_EQUAL(stats.workers, 1);
+    BOOST_CHECK_EQUAL(stats.queued, 0);
+    BOOST_CHECK_EQUAL(stats.completed, 2);
+    stats = q->getLaneStats(ASYNC_RPC_LANE_BULK);
+    BOOST_CHECK_EQUAL(stats.executing, 1);
+    BOOST_CHECK_EQUAL(stats.completed, 0);
+
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(op2->isSuccess(), true);
+    BOOST_CHECK_EQUAL(q->getLaneStats(ASYNC_RPC_LANE_BULK).completed, 1);
+}
+
 // This tests the queue shutting down immediately
 BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
 {
@@ -13,6 +13,8 @@
 #include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <vector>
+
 BOOST_AUTO_TEST_SUITE(scheduler_tests)
 
 static void microTask(CScheduler& s, boost::mutex& mutex, int& counter, int delta, boost::chrono::system_clock::time_point rescheduleTime)
@@ -109,4 +111,37 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void RecordTask(std::vector<int>& order, int n)
+{
+    order.push_back(n);
+}
+
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    CScheduler s;
+    std::vector<int> order;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+
+    // All due at once: run highest priority first, then by time
+    s.schedule(boost::bind(&RecordTask, boost::ref(order), 3), now, CScheduler::PRIORITY_LOW, "low");
+    s.schedule(boost::bind(&RecordTask, boost::ref(order), 2), now, CScheduler::PRIORITY_NORMAL, "normal");
+    s.schedule(boost::bind(&RecordTask, boost::ref(order), 1), now, CScheduler::PRIORITY_HIGH, "high");
+    CScheduler::TaskId id = s.schedule(boost::bind(&RecordTask, boost::ref(order), 4), now, CScheduler::PRIORITY_HIGH, "high");
+    BOOST_CHECK(s.unschedule(id));
+    BOOST_CHECK(!s.unschedule(id));
+
+    s.stop(true);
+    s.serviceQueue();
+
+    BOOST_CHECK_EQUAL(order.size(), 3U);
+    for (size_t i = 0; i < order.size(); i++)
+        BOOST_CHECK_EQUAL(order[i], (int)i + 1);
+
+    std::map<std::string, CScheduler::TaskStats> mapStats = s.getTaskStats();
+    BOOST_CHECK_EQUAL(mapStats.size(), 3U);
+    BOOST_CHECK_EQUAL(mapStats["high"].nRuns, 1U);
+    BOOST_CHECK_EQUAL(mapStats["low"].nRuns, 1U);
+    BOOST_CHECK(mapStats["low"].maxLateness >= mapStats["high"].maxLateness);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
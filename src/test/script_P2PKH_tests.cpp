@@ -2,13 +2,22 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#include "consensus/upgrades.h"
+#include "key.h"
+#include "keystore.h"
+#include "script/interpreter.h"
 #include "script/script.h"
+#include "script/script_error.h"
+#include "script/sign.h"
+#include "script/standard.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
 
+typedef vector<unsigned char> valtype;
+
 BOOST_FIXTURE_TEST_SUITE(script_P2PKH_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(IsPayToPublicKeyHash)
@@ -56,4 +65,89 @@ BOOST_AUTO_TEST_CASE(IsPayToPublicKeyHash)
 
 }
 
+BOOST_AUTO_TEST_CASE(SolverShortcuts)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    valtype vchPubKey = ToByteVector(key.GetPubKey());
+    uint160 hash = key.GetPubKey().GetID();
+    txnouttype type;
+    std::vector<valtype> solutions;
+
+    BOOST_CHECK(Solver(CScript() << vchPubKey << OP_CHECKSIG, type, solutions));
+    BOOST_CHECK_EQUAL(type, TX_PUBKEY);
+    BOOST_CHECK(solutions.size() == 1 && solutions[0] == vchPubKey);
+
+    BOOST_CHECK(Solver(GetScriptForDestination(key.GetPubKey().GetID()), type, solutions));
+    BOOST_CHECK_EQUAL(type, TX_PUBKEYHASH);
+    BOOST_CHECK(solutions.size() == 1 && solutions[0] == ToByteVector(hash));
+
+    // A non-minimal push of the hash is left to the template scan
+    CScript nonminimal = CScript() << OP_DUP << OP_HASH160;
+    nonminimal.insert(nonminimal.end(), OP_PUSHDATA1);
+    nonminimal.insert(nonminimal.end(), 20);
+    nonminimal.insert(nonminimal.end(), hash.begin(), hash.end());
+    nonminimal << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(Solver(nonminimal, type, solutions));
+    BOOST_CHECK_EQUAL(type, TX_PUBKEYHASH);
+    BOOST_CHECK(solutions.size() == 1 && solutions[0] == ToByteVector(hash));
+}
+
+BOOST_AUTO_TEST_CASE(VerifyShortcut)
+{
+    // VerifyScript skips the interpreter for plain P2PKH spends; the results
+    // must be those of the interpreter
+    CBasicKeyStore keystore;
+    CKey key, key2;
+    key.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(1);
+    txFrom.vout[0].scriptPubKey = scriptPubKey;
+    CMutableTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    txTo.vin[0].prevout.n = 0;
+    txTo.vin[0].prevout.hash = txFrom.GetHash();
+    txTo.vout[0].nValue = 1;
+    BOOST_CHECK(SignSignature(keystore, txFrom, txTo, 0, SIGHASH_ALL, SPROUT_BRANCH_ID));
+    MutableTransactionSignatureChecker checker(&txTo, 0, txFrom.vout[0].nValue);
+
+    CScript::const_iterator pc = txTo.vin[0].scriptSig.begin();
+    opcodetype opcode;
+    valtype vchSig, vchPubKey;
+    BOOST_CHECK(txTo.vin[0].scriptSig.GetOp(pc, opcode, vchSig));
+    BOOST_CHECK(txTo.vin[0].scriptSig.GetOp(pc, opcode, vchPubKey));
+
+    ScriptError err;
+    BOOST_CHECK(VerifyScript(CScript() << vchSig << vchPubKey, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, SPROUT_BRANCH_ID, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_OK);
+
+    BOOST_CHECK(!VerifyScript(CScript() << vchSig << ToByteVector(key2.GetPubKey()), scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, SPROUT_BRANCH_ID, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EQUALVERIFY);
+
+    valtype vchBadSig = vchSig;
+    vchBadSig[vchBadSig.size() - 2] ^= 1;
+    BOOST_CHECK(!VerifyScript(CScript() << vchBadSig << vchPubKey, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, SPROUT_BRANCH_ID, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_EVAL_FALSE);
+
+    // An extra item is only rejected under CLEANSTACK
+    CScript extra = CScript() << vchSig << vchSig << vchPubKey;
+    BOOST_CHECK(!VerifyScript(extra, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, SPROUT_BRANCH_ID, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_CLEANSTACK);
+    BOOST_CHECK(VerifyScript(extra, scriptPubKey, SCRIPT_VERIFY_P2SH, checker, SPROUT_BRANCH_ID, &err));
+
+    // A non-minimal push is only rejected under MINIMALDATA
+    CScript nonminimal = CScript() << vchSig;
+    nonminimal.insert(nonminimal.end(), OP_PUSHDATA1);
+    nonminimal.insert(nonminimal.end(), (unsigned char)vchPubKey.size());
+    nonminimal.insert(nonminimal.end(), vchPubKey.begin(), vchPubKey.end());
+    BOOST_CHECK(!VerifyScript(nonminimal, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, SPROUT_BRANCH_ID, &err));
+    BOOST_CHECK_EQUAL(err, SCRIPT_ERR_MINIMALDATA);
+    BOOST_CHECK(VerifyScript(nonminimal, scriptPubKey, SCRIPT_VERIFY_P2SH, checker, SPROUT_BRANCH_ID, &err));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -128,6 +128,18 @@ BOOST_AUTO_TEST_CASE(arrays)
     std::array<int32_t, 2> test = {100, 200};
 
     BOOST_CHECK_EQUAL(GetSerializeSize(test, 0, 0), 8);
+
+    // Byte arrays are written as one block, with the same bytes as one at a time
+    std::array<std::array<unsigned char, 3>, 2> bytes = {{{{1, 2, 3}}, {{4, 5, 6}}}};
+    CDataStream ss3(SER_DISK, 0);
+    ss3 << bytes;
+    BOOST_CHECK_EQUAL(HexStr(ss3.begin(), ss3.end()), "010203040506");
+    BOOST_CHECK_EQUAL(GetSerializeSize(bytes, 0, 0), 6);
+    std::array<std::array<unsigned char, 3>, 2> decoded_bytes;
+    ss3 >> decoded_bytes;
+    BOOST_CHECK(decoded_bytes == bytes);
+    BOOST_CHECK(ss3.empty());
+    BOOST_CHECK_THROW(ss3 >> decoded_bytes, std::ios_base::failure);
 }
 
 BOOST_AUTO_TEST_CASE(sizes)
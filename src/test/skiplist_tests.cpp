@@ -100,4 +100,102 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chainsnapshot_test)
+{
+    // A main chain and a branch that splits off at block 19999
+    std::vector<CBlockIndex> vBlocksMain(30000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+    }
+    std::vector<CBlockIndex> vBlocksSide(15000);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 20000;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[19999];
+    }
+
+    CChainSnapshot empty;
+    BOOST_CHECK_EQUAL(empty.Height(), -1);
+    BOOST_CHECK(empty.Tip() == NULL);
+    BOOST_CHECK(!empty.Contains(&vBlocksMain[0]));
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+    CChainSnapshot snapshot(chain, &empty);
+    BOOST_CHECK_EQUAL(snapshot.Height(), chain.Height());
+    BOOST_CHECK(snapshot.Tip() == chain.Tip());
+    BOOST_CHECK(snapshot.Genesis() == &vBlocksMain[0]);
+    for (int n=0; n<100; n++) {
+        int r = insecure_rand() % vBlocksMain.size();
+        BOOST_CHECK(snapshot[r] == &vBlocksMain[r]);
+        BOOST_CHECK(snapshot.Contains(&vBlocksMain[r]));
+    }
+    BOOST_CHECK(snapshot.Next(&vBlocksMain[100]) == &vBlocksMain[101]);
+    BOOST_CHECK(snapshot.Next(chain.Tip()) == NULL);
+    BOOST_CHECK(snapshot[chain.Height() + 1] == NULL);
+
+    // After a reorg the new snapshot follows the branch, while the old one is unchanged
+    chain.SetTip(&vBlocksSide.back());
+    CChainSnapshot reorged(chain, &snapshot);
+    BOOST_CHECK_EQUAL(reorged.Height(), 34999);
+    BOOST_CHECK(reorged[19999] == &vBlocksMain[19999]);
+    BOOST_CHECK(reorged[20000] == &vBlocksSide[0]);
+    BOOST_CHECK(!reorged.Contains(&vBlocksMain[25000]));
+    BOOST_CHECK(reorged.Contains(&vBlocksSide[12345]));
+    BOOST_CHECK(reorged.Next(&vBlocksMain[19999]) == &vBlocksSide[0]);
+    BOOST_CHECK(snapshot[25000] == &vBlocksMain[25000]);
+    BOOST_CHECK(snapshot.Tip() == &vBlocksMain.back());
+
+    // Rewinding works as well
+    chain.SetTip(&vBlocksMain[5000]);
+    CChainSnapshot rewound(chain, &reorged);
+    BOOST_CHECK_EQUAL(rewound.Height(), 5000);
+    BOOST_CHECK(rewound.Tip() == &vBlocksMain[5000]);
+    BOOST_CHECK(!rewound.Contains(&vBlocksSide[0]));
+}
+
+BOOST_AUTO_TEST_CASE(blockindexarena_test)
+{
+    CBlockIndexArena arena;
+    std::vector<uint256> vHashes(10000);
+    std::vector<CBlockIndex*> vBlocks;
+    for (unsigned int i=0; i<vHashes.size(); i++) {
+        vHashes[i] = GetRandHash();
+        CBlockIndex* pindex = arena.New();
+        pindex->phashBlock = &vHashes[i];
+        vBlocks.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.size(), vHashes.size());
+
+    // Link them in a random order, then lay them out by height
+    std::vector<CBlockIndex*> vShuffled(vBlocks);
+    for (unsigned int i=vShuffled.size() - 1; i>0; i--)
+        std::swap(vShuffled[i], vShuffled[insecure_rand() % (i + 1)]);
+    for (unsigned int i=0; i<vShuffled.size(); i++) {
+        vShuffled[i]->nHeight = i;
+        vShuffled[i]->pprev = i ? vShuffled[i - 1] : NULL;
+        vShuffled[i]->BuildSkip();
+    }
+    std::vector<uint256> vSortedHashes;
+    for (unsigned int i=0; i<vShuffled.size(); i++)
+        vSortedHashes.push_back(vShuffled[i]->GetBlockHash());
+    BOOST_CHECK(arena.Reorder(vShuffled));
+    for (unsigned int i=0; i<arena.size(); i++) {
+        BOOST_CHECK_EQUAL(arena[i]->nHeight, (int)i);
+        BOOST_CHECK(arena[i]->GetBlockHash() == vSortedHashes[i]);
+        BOOST_CHECK(arena[i]->pprev == (i ? arena[i - 1] : NULL));
+    }
+    BOOST_CHECK(arena[9999]->GetAncestor(1234) == arena[1234]);
+
+    // Deleted slots are reused, and a partial order is refused
+    arena.Delete(arena[5000]);
+    BOOST_CHECK_EQUAL(arena.size(), vHashes.size() - 1);
+    CBlockIndex* pindex = arena.New();
+    BOOST_CHECK(pindex == arena[5000]);
+    BOOST_CHECK(!arena.Reorder(std::vector<CBlockIndex*>(1, arena[0])));
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
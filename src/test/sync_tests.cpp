@@ -0,0 +1,117 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "sync.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+// Turns lock statistics on for one test, starting from zero
+struct LockStatsSetup : public BasicTestingSetup {
+    LockStatsSetup()
+    {
+        ResetLockStats();
+        fLockStats = true;
+    }
+    ~LockStatsSetup()
+    {
+        fLockStats = false;
+        ResetLockStats();
+    }
+};
+
+static bool FindLockStats(const std::string& strName, CLockSite::Stats& statsOut)
+{
+    for (const CLockSite::Stats& stats : GetLockStats()) {
+        if (stats.name == strName) {
+            statsOut = stats;
+            return true;
+        }
+    }
+    return false;
+}
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, LockStatsSetup)
+
+BOOST_AUTO_TEST_CASE(lockstats_acquisitions)
+{
+    CCriticalSection csCounted;
+    for (int i = 0; i < 10; i++) {
+        LOCK(csCounted);
+    }
+    {
+        TRY_LOCK(csCounted, lockTry);
+        BOOST_CHECK(static_cast<bool>(lockTry));
+    }
+
+    // The loop and the TRY_LOCK are two sites
+    int nSites = 0;
+    uint64_t nAcquisitions = 0;
+    for (const CLockSite::Stats& stats : GetLockStats()) {
+        if (stats.name != "csCounted")
+            continue;
+        nSites++;
+        nAcquisitions += stats.nAcquisitions;
+        BOOST_CHECK_EQUAL(stats.nContentions, 0U);
+        BOOST_CHECK_EQUAL(stats.nWaitMicros, 0);
+        BOOST_CHECK(stats.location.find("sync_tests.cpp:") != std::string::npos);
+    }
+    BOOST_CHECK_EQUAL(nSites, 2);
+    BOOST_CHECK_EQUAL(nAcquisitions, 11U);
+
+    CLockSite::Stats stats;
+    ResetLockStats();
+    BOOST_CHECK(!FindLockStats("csCounted", stats));
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_disabled)
+{
+    fLockStats = false;
+    CCriticalSection csDisabled;
+    {
+        LOCK(csDisabled);
+    }
+    CLockSite::Stats stats;
+    BOOST_CHECK(!FindLockStats("csDisabled", stats));
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_contention)
+{
+    CCriticalSection csContended;
+    std::atomic<bool> fLocked(false);
+    std::thread holder([&] {
+        LOCK(csContended);
+        fLocked = true;
+        MilliSleep(50);
+    });
+    while (!fLocked)
+        MilliSleep(1);
+    {
+        LOCK(csContended);
+    }
+    holder.join();
+
+    std::vector<CLockSite::Stats> vStats = GetLockStats();
+    uint64_t nAcquisitions = 0, nContentions = 0;
+    int64_t nWait = 0, nMaxWait = 0, nHold = 0;
+    for (const CLockSite::Stats& stats : vStats) {
+        if (stats.name != "csContended")
+            continue;
+        nAcquisitions += stats.nAcquisitions;
+        nContentions += stats.nContentions;
+        nWait += stats.nWaitMicros;
+        nMaxWait = std::max(nMaxWait, stats.nMaxWaitMicros);
+        nHold += stats.nHoldMicros;
+    }
+    BOOST_CHECK_EQUAL(nAcquisitions, 2U);
+    BOOST_CHECK_EQUAL(nContentions, 1U);
+    BOOST_CHECK(nWait > 0);
+    BOOST_CHECK_EQUAL(nWait, nMaxWait);
+    BOOST_CHECK(nHold >= 40000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
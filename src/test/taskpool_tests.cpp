@@ -0,0 +1,73 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "taskpool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(taskpool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(parallel_for)
+{
+    CTaskPool pool;
+
+    // Not started: everything runs on the caller
+    std::vector<int> vCalls(100, 0);
+    pool.ParallelFor(TASKPOOL_WALLET, vCalls.size(), 4, [&](size_t i) { vCalls[i]++; });
+    for (int n : vCalls)
+        BOOST_CHECK_EQUAL(n, 1);
+
+    pool.Start(4);
+    BOOST_CHECK_EQUAL(pool.GetThreadCount(), 4);
+    std::vector<std::atomic<int> > vCounts(10000);
+    for (std::atomic<int>& n : vCounts)
+        n = 0;
+    pool.ParallelFor(TASKPOOL_INDEX, vCounts.size(), 8, [&](size_t i) { vCounts[i]++; });
+    for (std::atomic<int>& n : vCounts)
+        BOOST_CHECK_EQUAL(n, 1);
+
+    // Nested loops on pool threads do not wait on each other
+    std::atomic<int> nInner(0);
+    pool.ParallelFor(TASKPOOL_VALIDATION, 16, 16, [&](size_t) {
+        pool.ParallelFor(TASKPOOL_VALIDATION, 16, 16, [&](size_t) { nInner++; });
+    });
+    BOOST_CHECK_EQUAL(nInner, 256);
+
+    // The first exception reaches the caller
+    BOOST_CHECK_THROW(pool.ParallelFor(TASKPOOL_RPC, 100, 4, [](size_t i) {
+        if (i == 50)
+            throw std::runtime_error("item failed");
+    }), std::runtime_error);
+
+    pool.Stop();
+    BOOST_CHECK_EQUAL(pool.GetThreadCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(quota)
+{
+    CTaskPool pool;
+    pool.Start(4);
+    pool.SetQuota(TASKPOOL_NETWORK, 0);
+    BOOST_CHECK_EQUAL(pool.GetQuota(TASKPOOL_NETWORK), 0);
+
+    // A client without pool threads runs on the caller alone
+    boost::thread::id idCaller = boost::this_thread::get_id();
+    std::atomic<int> nElsewhere(0);
+    pool.ParallelFor(TASKPOOL_NETWORK, 1000, 4, [&](size_t) {
+        if (boost::this_thread::get_id() != idCaller)
+            nElsewhere++;
+    });
+    BOOST_CHECK_EQUAL(nElsewhere, 0);
+
+    BOOST_CHECK_EQUAL(TaskPoolClientFromName("wallet"), TASKPOOL_WALLET);
+    BOOST_CHECK_EQUAL(TaskPoolClientFromName("bogus"), TASKPOOL_CLIENT_COUNT);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
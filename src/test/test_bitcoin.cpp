@@ -7,15 +7,18 @@
 #include "test_bitcoin.h"
 
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 
 #include "key.h"
 #include "main.h"
+#include "proofcache.h"
 #include "random.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
+#include "script/sigcache.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet/db.h"
@@ -71,7 +74,10 @@ JoinSplitTestingSetup::~JoinSplitTestingSetup()
 BasicTestingSetup::BasicTestingSetup()
 {
     assert(init_and_check_sodium() != -1);
+    SHA256AutoDetect();
     ECC_Start();
+    InitSignatureCache();
+    InitProofCache();
     SetupEnvironment();
     SetupNetworking();
     fPrintToDebugLog = false; // don't want to write to debug.log file
@@ -102,6 +108,8 @@ TestingSetup::TestingSetup()
         boost::filesystem::create_directories(pathTemp);
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
+        ptxindexdb = new CTxIndexDB(1 << 20, true);
+        pexplorerdb = new CExplorerIndexDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
         InitBlockIndex(chainparams);
@@ -131,6 +139,10 @@ TestingSetup::~TestingSetup()
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
+        delete ptxindexdb;
+        ptxindexdb = NULL;
+        delete pexplorerdb;
+        pexplorerdb = NULL;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
         bitdb.Reset();
@@ -746,6 +746,45 @@ BOOST_AUTO_TEST_CASE(test_big_overwinter_transaction) {
     threadGroup.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(test_sign_with_precomputed_data) {
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    int sigHashes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, SIGHASH_ALL | SIGHASH_ANYONECANPAY};
+    for (uint32_t i = 0; i < 40; i++) {
+        mtx.vin.push_back(CTxIn(COutPoint(uint256S("0100"), i)));
+        mtx.vout.push_back(CTxOut(1000, CScript() << OP_1));
+    }
+
+    // Signing each input against the shared midstates gives the same
+    // (deterministic) signatures as hashing the transaction afresh
+    const CTransaction txConst(mtx);
+    const PrecomputedTransactionData txdata(txConst);
+    for (uint32_t i = 0; i < mtx.vin.size(); i++) {
+        int nHashType = sigHashes[i % 4];
+        SignatureData sigdata, sigdataCached;
+        BOOST_CHECK(ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mtx, i, 1000, nHashType), scriptPubKey, sigdata, consensusBranchId));
+        BOOST_CHECK(ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, 1000, txdata, nHashType), scriptPubKey, sigdataCached, consensusBranchId));
+        BOOST_CHECK(sigdata.scriptSig == sigdataCached.scriptSig);
+        UpdateTransaction(mtx, i, sigdataCached);
+    }
+
+    const CTransaction txSigned(mtx);
+    for (uint32_t i = 0; i < txSigned.vin.size(); i++) {
+        BOOST_CHECK(VerifyScript(txSigned.vin[i].scriptSig, scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS,
+                                 TransactionSignatureChecker(&txSigned, i, 1000), consensusBranchId));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_IsStandard)
 {
     LOCK(cs_main);
@@ -858,4 +897,43 @@ BOOST_AUTO_TEST_CASE(test_IsStandardV2)
     BOOST_CHECK(!IsStandardTx(t, reason, chainparams));
 }
 
+
+BOOST_AUTO_TEST_CASE(test_inline_inputs_outputs)
+{
+    for (unsigned int n = 0; n <= 5; n++) {
+        CMutableTransaction mtx;
+        for (unsigned int i = 0; i < n; i++) {
+            mtx.vin.emplace_back(COutPoint(GetRandHash(), i));
+            mtx.vin.back().scriptSig << std::vector<unsigned char>(72, i);
+            mtx.vout.push_back(CTxOut(i * CENT, CScript() << OP_TRUE));
+        }
+        // Up to two inputs and outputs need no allocation besides their scripts
+        BOOST_CHECK_EQUAL(mtx.vin.allocated_memory() == 0, n <= 2);
+        BOOST_CHECK_EQUAL(mtx.vout.allocated_memory() == 0, n <= 2);
+
+        CTransaction tx(mtx);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        // The encoding is the one of a std::vector
+        CDataStream ssVector(SER_NETWORK, PROTOCOL_VERSION);
+        ssVector << std::vector<CTxIn>(tx.vin.begin(), tx.vin.end());
+        BOOST_CHECK_EQUAL(ssVector.size(), ::GetSerializeSize(tx.vin, SER_NETWORK, PROTOCOL_VERSION));
+
+        CTransaction txRead;
+        ss >> txRead;
+        BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+        BOOST_CHECK_EQUAL(txRead.vin.size(), n);
+        BOOST_CHECK_EQUAL(txRead.vout.size(), n);
+        for (unsigned int i = 0; i < n; i++) {
+            BOOST_CHECK(txRead.vin[i] == tx.vin[i]);
+            BOOST_CHECK(txRead.vout[i] == tx.vout[i]);
+        }
+
+        // Moving keeps the elements, inline or not
+        CMutableTransaction mtxMoved(std::move(mtx));
+        BOOST_CHECK_EQUAL(mtxMoved.vin.size(), n);
+        BOOST_CHECK(CTransaction(mtxMoved).GetHash() == tx.GetHash());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -316,5 +316,42 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK_EQUAL(strJson1, v.write());
 }
 
+BOOST_AUTO_TEST_CASE(univalue_keyindex)
+{
+    // Enough keys for the object to be indexed, with a repeated key
+    string strJson = "{";
+    for (int i = 0; i < 40; i++)
+        strJson += "\"k" + std::to_string(i) + "\":" + std::to_string(i) + ",";
+    strJson += "\"k7\":\"dup\",\"esc\\u00e9\":\"a\\\"b\"}";
+
+    UniValue obj;
+    BOOST_CHECK(obj.read(strJson));
+    BOOST_CHECK_EQUAL(obj.size(), 42);
+    BOOST_CHECK_EQUAL(obj["k0"].getValStr(), "0");
+    BOOST_CHECK_EQUAL(obj["k39"].getValStr(), "39");
+    BOOST_CHECK_EQUAL(find_value(obj, "k7").getValStr(), "7");
+    BOOST_CHECK_EQUAL(obj["esc\xc3\xa9"].getValStr(), "a\"b");
+    BOOST_CHECK(!obj.exists("k40"));
+    BOOST_CHECK(find_value(obj, "k40").isNull());
+
+    // A copy and the original add keys independently
+    UniValue copy = obj;
+    BOOST_CHECK(copy.pushKV("k40", "copy"));
+    BOOST_CHECK(obj.pushKV("k41", "orig"));
+    BOOST_CHECK_EQUAL(copy["k40"].getValStr(), "copy");
+    BOOST_CHECK(!copy.exists("k41"));
+    BOOST_CHECK_EQUAL(obj["k41"].getValStr(), "orig");
+    BOOST_CHECK(!obj.exists("k40"));
+
+    // Objects built key by key are indexed as they grow
+    UniValue built(UniValue::VOBJ);
+    for (int i = 0; i < 40; i++)
+        built.pushKV("b" + std::to_string(i), i);
+    for (int i = 0; i < 40; i++)
+        BOOST_CHECK_EQUAL(built["b" + std::to_string(i)].get_int(), i);
+    built.setObject();
+    BOOST_CHECK(!built.exists("b0"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -12,10 +12,12 @@
 #include "utilmoneystr.h"
 #include "test/test_bitcoin.h"
 
+#include <atomic>
 #include <stdint.h>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -87,6 +89,47 @@ BOOST_AUTO_TEST_CASE(util_HexStr)
 }
 
 
+BOOST_AUTO_TEST_CASE(util_HexVectorized)
+{
+    // Every byte value, at every length and alignment the vector loops split
+    std::vector<unsigned char> vch(600);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = (unsigned char)(i * 7);
+    for (size_t nStart = 0; nStart < 3; nStart++) {
+        for (size_t nLen = 0; nStart + nLen <= 300; nLen++) {
+            std::string str = HexStr(vch.begin() + nStart, vch.begin() + nStart + nLen);
+            std::string strExpected;
+            for (size_t i = nStart; i < nStart + nLen; i++)
+                strExpected += strprintf("%02x", vch[i]);
+            BOOST_REQUIRE_EQUAL(str, strExpected);
+            BOOST_CHECK(ParseHex(str) == std::vector<unsigned char>(vch.begin() + nStart, vch.begin() + nStart + nLen));
+            BOOST_CHECK_EQUAL(IsHex(str), nLen > 0);
+        }
+    }
+
+    // Upper case, and spaces anywhere between bytes
+    std::string strHex = HexStr(vch);
+    std::string strUpper;
+    for (size_t i = 0; i < strHex.size(); i++) {
+        strUpper += (char)toupper(strHex[i]);
+        if (i % 2 == 1 && i % 22 == 1)
+            strUpper += " \n ";
+    }
+    BOOST_CHECK(ParseHex(strUpper) == vch);
+
+    // A character next to the digit ranges, or above them, stops parsing wherever it is
+    const char chBad[] = {'/', ':', '@', 'G', '`', 'g', 0x10, 0x19, (char)0x80, (char)0xc1, (char)0xe6};
+    for (char ch : chBad) {
+        for (size_t nPos = 0; nPos < 40; nPos++) {
+            std::string str = strHex.substr(0, 40);
+            str[nPos] = ch;
+            BOOST_CHECK(!IsHex(str));
+            std::vector<unsigned char> result = ParseHex(str);
+            BOOST_CHECK(result == std::vector<unsigned char>(vch.begin(), vch.begin() + nPos / 2));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(util_DateTimeStrFormat)
 {
     BOOST_CHECK_EQUAL(DateTimeStrFormat("%Y-%m-%d %H:%M:%S", 0), "1970-01-01 00:00:00");
@@ -487,4 +530,21 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE(util_ZC_WaitForParams)
+{
+    // Nothing loading: returns at once
+    ZC_WaitForParams();
+
+    ZC_SetParamsLoading();
+    std::atomic<bool> fLoaded(false);
+    boost::thread loader([&]() {
+        MilliSleep(50);
+        fLoaded = true;
+        ZC_SetParamsLoaded();
+    });
+    ZC_WaitForParams();
+    BOOST_CHECK(fLoaded);
+    loader.join();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
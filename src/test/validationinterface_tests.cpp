@@ -0,0 +1,123 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(queue_inline_when_stopped)
+{
+    CValidationQueue queue;
+    bool fRun = false;
+    queue.Push([&fRun] { fRun = true; });
+    BOOST_CHECK(fRun);
+    BOOST_CHECK(!queue.IsRunning());
+}
+
+BOOST_AUTO_TEST_CASE(queue_order_and_sync)
+{
+    CValidationQueue queue;
+    queue.Start(10);
+    BOOST_CHECK(queue.IsRunning());
+
+    std::vector<int> vOrder;
+    for (int i = 0; i < 100; i++)
+        queue.Push([&vOrder, i] { vOrder.push_back(i); });
+    queue.Sync();
+    BOOST_REQUIRE_EQUAL(vOrder.size(), 100U);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK_EQUAL(vOrder[i], i);
+    BOOST_CHECK_EQUAL(queue.Depth(), 0U);
+
+    // Stopping runs what is still queued
+    std::atomic<int> nRun(0);
+    for (int i = 0; i < 5; i++)
+        queue.Push([&nRun] { MilliSleep(1); nRun++; });
+    queue.Stop();
+    BOOST_CHECK_EQUAL(nRun, 5);
+    BOOST_CHECK(!queue.IsRunning());
+}
+
+BOOST_AUTO_TEST_CASE(queue_limit)
+{
+    CValidationQueue queue;
+    queue.Start(2);
+
+    std::atomic<bool> fRelease(false);
+    queue.Push([&fRelease] { while (!fRelease) MilliSleep(1); });
+    for (int i = 0; i < 5; i++)
+        queue.Push([] {});
+
+    std::atomic<bool> fLimited(false);
+    std::thread producer([&queue, &fLimited] {
+        queue.Limit();
+        fLimited = true;
+    });
+    MilliSleep(20);
+    BOOST_CHECK(!fLimited);
+    fRelease = true;
+    producer.join();
+    BOOST_CHECK(fLimited);
+    BOOST_CHECK(queue.Depth() <= 2);
+    queue.Stop();
+}
+
+class CTestListener : public CValidationInterface
+{
+public:
+    std::vector<uint256> vTxids;
+    std::vector<uint256> vBlocks;
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+    {
+        vTxids.push_back(tx.GetHash());
+        vBlocks.push_back(pblock ? pblock->GetHash() : uint256());
+    }
+};
+
+BOOST_AUTO_TEST_CASE(background_listener)
+{
+    CTestListener listener;
+    RegisterValidationInterface(&listener, true);
+    GetValidationQueue().Start(100);
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(1);
+    CTransaction tx(mtx);
+    uint256 hashBlock;
+    {
+        // The listener gets the block after it is gone
+        CBlock block;
+        block.nTime = 42;
+        block.vtx.push_back(tx);
+        hashBlock = block.GetHash();
+        SyncWithWallets(tx, &block);
+        SyncWithWallets(tx, &block);
+    }
+    SyncWithWallets(tx, NULL);
+
+    GetValidationQueue().Sync();
+    BOOST_REQUIRE_EQUAL(listener.vTxids.size(), 3U);
+    BOOST_CHECK(listener.vTxids[0] == tx.GetHash());
+    BOOST_CHECK(listener.vBlocks[0] == hashBlock);
+    BOOST_CHECK(listener.vBlocks[1] == hashBlock);
+    BOOST_CHECK(listener.vBlocks[2].IsNull());
+
+    GetValidationQueue().Stop();
+    UnregisterValidationInterface(&listener);
+    SyncWithWallets(tx, NULL);
+    BOOST_CHECK_EQUAL(listener.vTxids.size(), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,49 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_TRACE_H
+#define BITCOIN_TRACE_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+/**
+ * Statically defined tracepoints (USDT), for attaching eBPF and SystemTap
+ * tools to a running node; see doc/tracing.md for the list. A tracepoint is
+ * a single nop in the binary, with its location and arguments described in
+ * an ELF note, until a tracer attaches to it. Builds without sys/sdt.h
+ * (--disable-usdt) have no tracepoints at all.
+ *
+ * TRACEn(context, event, args...): context is the subsystem and event the
+ * tracepoint, for instance validation:block_connected. Hashes are passed as
+ * pointers to their 32 bytes, in the internal byte order, and times in
+ * microseconds. Arguments are evaluated even when nobody is tracing, so only
+ * pass values that are at hand anyway.
+ */
+#ifdef ENABLE_TRACING
+
+#include <sys/sdt.h>
+
+#define TRACE(context, event) DTRACE_PROBE(context, event)
+#define TRACE1(context, event, a) DTRACE_PROBE1(context, event, a)
+#define TRACE2(context, event, a, b) DTRACE_PROBE2(context, event, a, b)
+#define TRACE3(context, event, a, b, c) DTRACE_PROBE3(context, event, a, b, c)
+#define TRACE4(context, event, a, b, c, d) DTRACE_PROBE4(context, event, a, b, c, d)
+#define TRACE5(context, event, a, b, c, d, e) DTRACE_PROBE5(context, event, a, b, c, d, e)
+#define TRACE6(context, event, a, b, c, d, e, f) DTRACE_PROBE6(context, event, a, b, c, d, e, f)
+
+#else
+
+#define TRACE(context, event)
+#define TRACE1(context, event, a)
+#define TRACE2(context, event, a, b)
+#define TRACE3(context, event, a, b, c)
+#define TRACE4(context, event, a, b, c, d)
+#define TRACE5(context, event, a, b, c, d, e)
+#define TRACE6(context, event, a, b, c, d, e, f)
+
+#endif // ENABLE_TRACING
+
+#endif // BITCOIN_TRACE_H
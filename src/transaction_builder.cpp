@@ -8,8 +8,11 @@
 #include "pubkey.h"
 #include "rpc/protocol.h"
 #include "script/sign.h"
+#include "taskpool.h"
 #include "utilmoneystr.h"
 
+#include <atomic>
+
 #include <boost/variant.hpp>
 #include <librustzcash.h>
 
@@ -261,6 +264,7 @@ TransactionBuilderResult TransactionBuilder::Build()
     // Sapling spends and outputs
     //
 
+    ZC_WaitForParams();
     auto ctx = librustzcash_sapling_proving_ctx_init();
 
     // Create Sapling SpendDescriptions
@@ -452,9 +456,10 @@ void TransactionBuilder::CreateJSDescriptions()
     // at the expense of leaking the sums of pairs of output values in vpub_old.
     if (jsInputs.empty()) {
         // Create joinsplits, where each output represents a zaddr recipient.
+        std::vector<std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> > vvjsout;
+        std::vector<uint64_t> vpubOlds;
         while (jsOutputsDeque.size() > 0) {
-            // Default array entries are dummy inputs and outputs
-            std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> vjsin;
+            // Default array entries are dummy outputs
             std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> vjsout;
             uint64_t vpub_old = 0;
 
@@ -465,11 +470,21 @@ void TransactionBuilder::CreateJSDescriptions()
                 // Funds are removed from the value pool and enter the private pool
                 vpub_old += vjsout[n].value;
             }
+            vvjsout.push_back(vjsout);
+            vpubOlds.push_back(vpub_old);
+        }
 
+        // These joinsplits do not depend on each other, so prove them concurrently
+        size_t nFirst = mtx.vJoinSplit.size();
+        std::vector<JSDescription> vjsdesc(vvjsout.size());
+        GetTaskPool().ParallelFor(TASKPOOL_WALLET, vjsdesc.size(), GetNumCores(), [&](size_t i) {
+            // Default array entries are dummy inputs
+            std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> vjsin;
             std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
             std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
-            CreateJSDescription(vpub_old, 0, vjsin, vjsout, inputMap, outputMap);
-        }
+            vjsdesc[i] = ProveJSDescription(nFirst + i, vpubOlds[i], 0, vjsin, vvjsout[i], inputMap, outputMap);
+        });
+        mtx.vJoinSplit.insert(mtx.vJoinSplit.end(), vjsdesc.begin(), vjsdesc.end());
         return;
     }
 
@@ -678,16 +693,17 @@ void TransactionBuilder::CreateJSDescriptions()
     }
 }
 
-void TransactionBuilder::CreateJSDescription(
+JSDescription TransactionBuilder::ProveJSDescription(
+    size_t nIndex,
     uint64_t vpub_old,
     uint64_t vpub_new,
     std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> vjsin,
     std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> vjsout,
     std::array<uint64_t, ZC_NUM_JS_INPUTS>& inputMap,
-    std::array<uint64_t, ZC_NUM_JS_OUTPUTS>& outputMap)
+    std::array<uint64_t, ZC_NUM_JS_OUTPUTS>& outputMap) const
 {
     LogPrint("zrpcunsafe", "CreateJSDescription: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
-        mtx.vJoinSplit.size(),
+        nIndex,
         FormatMoney(vpub_old), FormatMoney(vpub_new),
         FormatMoney(vjsin[0].note.value()), FormatMoney(vjsin[1].note.value()),
         FormatMoney(vjsout[0].value), FormatMoney(vjsout[1].value));
@@ -696,6 +712,7 @@ void TransactionBuilder::CreateJSDescription(
 
     // Generate the proof, this can take over a minute.
     assert(mtx.fOverwintered && (mtx.nVersion >= SAPLING_TX_VERSION));
+    ZC_WaitForParams();
     JSDescription jsdesc = JSDescription::Randomized(
             *sproutParams,
             mtx.joinSplitPubKey,
@@ -716,7 +733,42 @@ void TransactionBuilder::CreateJSDescription(
         }
     }
 
-    mtx.vJoinSplit.push_back(jsdesc);
-
     // TODO: Sprout payment disclosure
+    return jsdesc;
+}
+
+void TransactionBuilder::CreateJSDescription(
+    uint64_t vpub_old,
+    uint64_t vpub_new,
+    std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> vjsin,
+    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> vjsout,
+    std::array<uint64_t, ZC_NUM_JS_INPUTS>& inputMap,
+    std::array<uint64_t, ZC_NUM_JS_OUTPUTS>& outputMap)
+{
+    mtx.vJoinSplit.push_back(ProveJSDescription(mtx.vJoinSplit.size(), vpub_old, vpub_new, vjsin, vjsout, inputMap, outputMap));
+}
+
+std::vector<TransactionBuilderResult> BuildTransactions(std::vector<TransactionBuilder>& builders, int nThreads)
+{
+    std::vector<boost::optional<TransactionBuilderResult>> results(builders.size());
+    std::atomic<size_t> nNext(0);
+    auto worker = [&builders, &results, &nNext]() {
+        for (size_t i = nNext++; i < builders.size(); i = nNext++) {
+            try {
+                results[i] = builders[i].Build();
+            } catch (const std::exception& e) {
+                results[i] = TransactionBuilderResult(std::string(e.what()));
+            }
+        }
+    };
+
+    nThreads = std::max(1, std::min(nThreads, (int)builders.size()));
+    GetTaskPool().ParallelFor(TASKPOOL_WALLET, nThreads, nThreads, [&worker](size_t) { worker(); });
+
+    std::vector<TransactionBuilderResult> ret;
+    ret.reserve(results.size());
+    for (auto& result : results) {
+        ret.push_back(result.get());
+    }
+    return ret;
 }
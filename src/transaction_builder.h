@@ -146,6 +146,17 @@ public:
 private:
     void CreateJSDescriptions();
 
+    // Generates the proof for a joinsplit at index nIndex without adding it,
+    // so that independent joinsplits can be proved concurrently.
+    JSDescription ProveJSDescription(
+        size_t nIndex,
+        uint64_t vpub_old,
+        uint64_t vpub_new,
+        std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> vjsin,
+        std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> vjsout,
+        std::array<uint64_t, ZC_NUM_JS_INPUTS>& inputMap,
+        std::array<uint64_t, ZC_NUM_JS_OUTPUTS>& outputMap) const;
+
     void CreateJSDescription(
         uint64_t vpub_old,
         uint64_t vpub_new,
@@ -155,4 +166,12 @@ private:
         std::array<uint64_t, ZC_NUM_JS_OUTPUTS>& outputMap);
 };
 
+/**
+ * Build independent transactions concurrently on up to nThreads threads.
+ * Each Build() creates its own Sapling proving context, so their proofs can
+ * be generated in parallel. A Build() that throws yields an error result.
+ * Results are in the same order as the builders.
+ */
+std::vector<TransactionBuilderResult> BuildTransactions(std::vector<TransactionBuilder>& builders, int nThreads);
+
 #endif /* TRANSACTION_BUILDER_H */
@@ -9,8 +9,14 @@
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "taskpool.h"
 #include "uint256.h"
 
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -19,10 +25,18 @@ using namespace std;
 
 // NOTE: Per issue #3277, do not use the prefix 'X' or 'x' as they were
 // previously used by DB_SAPLING_ANCHOR and DB_BEST_SAPLING_ANCHOR.
+// Full trees, as written by older versions. Still read as the base of
+// anchor records.
 static const char DB_SPROUT_ANCHOR = 'A';
 static const char DB_SAPLING_ANCHOR = 'Z';
+// Anchors as CAnchorRecord checkpoints or deltas
+static const char DB_SPROUT_ANCHOR_DELTA = 'j';
+static const char DB_SAPLING_ANCHOR_DELTA = 'y';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
+static const char DB_COIN = 'C';
+// Whole-transaction coin records, only read to upgrade older databases and
+// used as the record type of coins in chainstate snapshots
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -38,64 +52,290 @@ static const char DB_LAST_BLOCK = 'l';
 // insightexplorer
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCE = 'e';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
+static const char DB_NULLIFIERINDEX = 'n';
+static const char DB_COMMITMENTINDEX = 'm';
+//! Last block covered by an explorer index build in progress
+static const char DB_EXPLORERINDEX_BEST = 'E';
+//! Last block the queued address, unspent and spent index entries were written up to
+static const char DB_EXPLORERINDEX_SYNCED = 'S';
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+static const char DB_SAPLING_FRONTIER = 'f';
+
+static const char DB_BLOCK_FILTER = 'f';
+
+static const char DB_CHAIN_STATS = 's';
+
+namespace {
+
+/** Key of the chainstate record of a single unspent output */
+struct CCoinKey
+{
+    char chType;
+    uint256 txid;
+    uint32_t n;
+
+    CCoinKey() : chType(DB_COIN), n(0) {}
+    CCoinKey(const uint256& txidIn, uint32_t nIn) : chType(DB_COIN), txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Value of the chainstate record of a single unspent output.
+ *
+ * Serialized format:
+ * - VARINT(nHeight * 2 + fCoinBase)
+ * - VARINT(nVersion)
+ * - the CTxOut (via CTxOutCompressor)
+ */
+struct CCoinValue
+{
+    int nHeight;
+    int nVersion;
+    bool fCoinBase;
+    CTxOut txout;
+
+    CCoinValue() : nHeight(0), nVersion(0), fCoinBase(false) {}
+    CCoinValue(const CCoins& coins, uint32_t n) : nHeight(coins.nHeight), nVersion(coins.nVersion), fCoinBase(coins.fCoinBase), txout(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 2;
+            fCoinBase = nCode & 1;
+        }
+        READWRITE(VARINT(nVersion));
+        READWRITE(REF(CTxOutCompressor(txout)));
+    }
+};
+
+/**
+ * Collect the outputs of the transaction whose records start at the cursor
+ * into coins, leaving the cursor on the next record. Returns false if the
+ * cursor is not on an output record.
+ */
+bool ReadCoinsAtCursor(CDBIterator& cursor, uint256& txid, CCoins& coins, size_t& nSize)
+{
+    CCoinKey key;
+    if (!cursor.Valid() || !cursor.GetKey(key) || key.chType != DB_COIN)
+        return false;
+    txid = key.txid;
+    coins.Clear();
+    nSize = 0;
+    do {
+        CCoinValue value;
+        if (!cursor.GetValue(value))
+            throw std::runtime_error("unable to read output " + txid.ToString() + ":" + std::to_string(key.n));
+        if (coins.vout.size() <= key.n)
+            coins.vout.resize(key.n + 1);
+        coins.vout[key.n] = value.txout;
+        coins.nHeight = value.nHeight;
+        coins.nVersion = value.nVersion;
+        coins.fCoinBase = value.fCoinBase;
+        nSize += cursor.GetKeySize() + cursor.GetValueSize();
+        cursor.Next();
+    } while (cursor.Valid() && cursor.GetKey(key) && key.chType == DB_COIN && key.txid == txid);
+    return true;
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+void WriteCoins(CDBBatch& batch, const uint256& txid, const CCoins& coins)
 {
+    for (uint32_t i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            batch.Write(CCoinKey(txid, i), CCoinValue(coins, i));
+    }
 }
 
+} // anon namespace
+
+//! Maximum number of deltas between an anchor and its full checkpoint
+static const uint32_t ANCHOR_CHECKPOINT_INTERVAL = 32;
+
+/**
+ * Chainstate record of an anchor: either the full tree (a checkpoint), or
+ * the anchor it was appended to and the difference of the frontiers.
+ *
+ * Serialized format:
+ * - hashParent, null for a checkpoint
+ * - for a checkpoint, the tree
+ * - otherwise VARINT(nDeltas), the number of deltas down to the checkpoint,
+ *   and the delta
+ */
+template<typename Tree, typename Delta>
+class CAnchorRecord
+{
+public:
+    uint256 hashParent;
+    uint32_t nDeltas;
+    Tree tree;
+    Delta delta;
 
-bool CCoinsViewDB::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
-    if (rt == SproutMerkleTree::empty_root()) {
-        SproutMerkleTree new_tree;
-        tree = new_tree;
-        return true;
+    CAnchorRecord() : nDeltas(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashParent);
+        if (hashParent.IsNull()) {
+            READWRITE(tree);
+        } else {
+            READWRITE(VARINT(nDeltas));
+            READWRITE(delta);
+        }
     }
+};
 
-    bool read = db.Read(make_pair(DB_SPROUT_ANCHOR, rt), tree);
+typedef CAnchorRecord<SproutMerkleTree, SproutMerkleTreeDelta> CSproutAnchorRecord;
+typedef CAnchorRecord<SaplingMerkleTree, SaplingMerkleTreeDelta> CSaplingAnchorRecord;
 
-    return read;
+template<typename Tree, typename Delta>
+bool CCoinsViewDB::ReadAnchor(char chDelta, char chLegacy, const uint256 &rt, Tree &tree, uint32_t &nDeltas) const
+{
+    std::vector<Delta> vDeltas;
+    uint256 hash = rt;
+    while (true) {
+        if (hash == Tree::empty_root()) {
+            tree = Tree();
+            break;
+        }
+        CAnchorRecord<Tree, Delta> record;
+        if (db.Read(make_pair(chDelta, hash), record)) {
+            if (record.hashParent.IsNull()) {
+                tree = record.tree;
+                break;
+            }
+            if (vDeltas.size() >= ANCHOR_CHECKPOINT_INTERVAL)
+                return error("%s: anchor %s is too far from a checkpoint", __func__, rt.ToString());
+            vDeltas.push_back(record.delta);
+            hash = record.hashParent;
+        } else if (db.Read(make_pair(chLegacy, hash), tree)) {
+            break;
+        } else if (vDeltas.empty()) {
+            return false;
+        } else {
+            return error("%s: anchor %s of %s is missing", __func__, hash.ToString(), rt.ToString());
+        }
+    }
+    try {
+        for (typename std::vector<Delta>::reverse_iterator it = vDeltas.rbegin(); it != vDeltas.rend(); it++)
+            tree = it->apply(tree);
+    } catch (const std::exception& e) {
+        return error("%s: invalid delta for anchor %s - %s", __func__, rt.ToString(), e.what());
+    }
+    nDeltas = vDeltas.size();
+    return true;
 }
 
-bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
-    if (rt == SaplingMerkleTree::empty_root()) {
-        SaplingMerkleTree new_tree;
-        tree = new_tree;
-        return true;
+void CCoinsViewDB::EraseCoins(CDBBatch& batch, const uint256& txid) const
+{
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(CCoinKey(txid, 0));
+    CCoinKey key;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.chType == DB_COIN && key.txid == txid) {
+        batch.Erase(key);
+        pcursor->Next();
     }
+}
 
-    bool read = db.Read(make_pair(DB_SAPLING_ANCHOR, rt), tree);
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+    LoadNullifierFilter(DB_NULLIFIER, sproutNullifierFilter);
+    LoadNullifierFilter(DB_SAPLING_NULLIFIER, saplingNullifierFilter);
+}
 
-    return read;
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+{
+    LoadNullifierFilter(DB_NULLIFIER, sproutNullifierFilter);
+    LoadNullifierFilter(DB_SAPLING_NULLIFIER, saplingNullifierFilter);
+}
+
+void CCoinsViewDB::LoadNullifierFilter(char dbChar, CCuckooFilter& filter)
+{
+    int64_t nStart = GetTimeMillis();
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    std::pair<char, uint256> key;
+
+    // Count first, so the filter is only allocated once
+    size_t nCount = 0;
+    for (pcursor->Seek(dbChar); pcursor->Valid() && pcursor->GetKey(key) && key.first == dbChar; pcursor->Next())
+        nCount++;
+
+    // Fill a new filter and swap it in, so that concurrent lookups never
+    // see a partly filled one
+    CCuckooFilter filterNew(nCount);
+    for (pcursor->Seek(dbChar); pcursor->Valid() && pcursor->GetKey(key) && key.first == dbChar; pcursor->Next())
+        filterNew.Insert(key.second);
+    filter.Swap(filterNew);
+    LogPrint("coindb", "Loaded %u nullifiers of type '%c' into a %u byte filter in %dms\n",
+             (unsigned int)nCount, dbChar, (unsigned int)filter.DynamicMemoryUsage(), GetTimeMillis() - nStart);
+}
+
+
+bool CCoinsViewDB::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    uint32_t nDeltas;
+    return ReadAnchor<SproutMerkleTree, SproutMerkleTreeDelta>(DB_SPROUT_ANCHOR_DELTA, DB_SPROUT_ANCHOR, rt, tree, nDeltas);
+}
+
+bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    uint32_t nDeltas;
+    return ReadAnchor<SaplingMerkleTree, SaplingMerkleTreeDelta>(DB_SAPLING_ANCHOR_DELTA, DB_SAPLING_ANCHOR, rt, tree, nDeltas);
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     bool spent = false;
     char dbChar;
+    const CCuckooFilter* filter;
     switch (type) {
         case SPROUT:
             dbChar = DB_NULLIFIER;
+            filter = &sproutNullifierFilter;
             break;
         case SAPLING:
             dbChar = DB_SAPLING_NULLIFIER;
+            filter = &saplingNullifierFilter;
             break;
         default:
             throw runtime_error("Unknown shielded type");
     }
+    if (!filter->Contains(nf))
+        return false;
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(CCoinKey(txid, 0));
+    uint256 txidFound;
+    size_t nSize;
+    try {
+        if (!ReadCoinsAtCursor(*pcursor, txidFound, coins, nSize) || txidFound != txid)
+            return false;
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    return true;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(CCoinKey(txid, 0));
+    CCoinKey key;
+    return pcursor->Valid() && pcursor->GetKey(key) && key.chType == DB_COIN && key.txid == txid;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -124,37 +364,90 @@ uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void CCoinsViewDB::BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, char dbChar, CCuckooFilter& filter,
+                                        std::vector<uint256>& vRemoved) const
 {
-    for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (CNullifiersMap::const_iterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
-            if (!it->second.entered)
+            // A nullifier may only be removed from the filter if it was
+            // really in the database, and is only added once
+            bool fInDB = filter.Contains(it->first) && db.Exists(make_pair(dbChar, it->first));
+            if (!it->second.entered) {
                 batch.Erase(make_pair(dbChar, it->first));
-            else
+                if (fInDB)
+                    vRemoved.push_back(it->first);
+            } else {
                 batch.Write(make_pair(dbChar, it->first), true);
+                if (!fInDB)
+                    filter.Insert(it->first);
+            }
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        CNullifiersMap::iterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
-template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+template<typename Map, typename MapIterator, typename MapEntry, typename Tree, typename Delta>
+void CCoinsViewDB::BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, char chDelta, char chLegacy) const
 {
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
-        if (it->second.flags & MapEntry::DIRTY) {
-            if (!it->second.entered)
-                batch.Erase(make_pair(dbChar, it->first));
-            else {
-                if (it->first != Tree::empty_root()) {
-                    batch.Write(make_pair(dbChar, it->first), it->second.tree);
+    // Deltas down to the checkpoint of the anchors written so far
+    std::map<uint256, uint32_t> mapDeltas;
+    for (MapIterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
+        if (!(it->second.flags & MapEntry::DIRTY))
+            continue;
+        if (!it->second.entered) {
+            batch.Erase(make_pair(chDelta, it->first));
+            batch.Erase(make_pair(chLegacy, it->first));
+            continue;
+        }
+        if (it->first == Tree::empty_root() || mapDeltas.count(it->first))
+            continue;
+
+        // Parents that are written in this batch go first
+        std::vector<MapIterator> vChain;
+        for (MapIterator itCur = it; ; ) {
+            vChain.push_back(itCur);
+            const uint256& hashParent = itCur->second.hashParent;
+            if (hashParent.IsNull() || mapDeltas.count(hashParent))
+                break;
+            MapIterator itParent = mapToUse.find(hashParent);
+            if (itParent == mapToUse.end() || !(itParent->second.flags & MapEntry::DIRTY) ||
+                !itParent->second.entered || itParent->first == Tree::empty_root())
+                break;
+            itCur = itParent;
+        }
+
+        for (typename std::vector<MapIterator>::reverse_iterator itChain = vChain.rbegin(); itChain != vChain.rend(); itChain++) {
+            const uint256& rt = (*itChain)->first;
+            const MapEntry& entry = (*itChain)->second;
+            CAnchorRecord<Tree, Delta> record;
+            bool fDelta = false;
+            if (!entry.hashParent.IsNull()) {
+                MapIterator itParent = mapToUse.find(entry.hashParent);
+                std::map<uint256, uint32_t>::const_iterator itDeltas = mapDeltas.find(entry.hashParent);
+                Tree base;
+                uint32_t nParentDeltas = 0;
+                if (itDeltas != mapDeltas.end()) {
+                    base = itParent->second.tree;
+                    nParentDeltas = itDeltas->second;
+                    fDelta = true;
+                } else if (itParent != mapToUse.end() && (itParent->second.flags & MapEntry::DIRTY) && !itParent->second.entered) {
+                    // The parent is being removed
+                } else {
+                    fDelta = ReadAnchor<Tree, Delta>(chDelta, chLegacy, entry.hashParent, base, nParentDeltas);
+                }
+                if (fDelta && nParentDeltas + 1 < ANCHOR_CHECKPOINT_INTERVAL) {
+                    record.hashParent = entry.hashParent;
+                    record.nDeltas = nParentDeltas + 1;
+                    record.delta = Delta(base, entry.tree);
+                } else {
+                    fDelta = false;
                 }
             }
-            // TODO: changed++?
+            if (!fDelta)
+                record.tree = entry.tree;
+            batch.Write(make_pair(chDelta, rt), record);
+            mapDeltas[rt] = record.nDeltas;
         }
-        MapIterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
@@ -166,27 +459,65 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
                               CNullifiersMap &mapSaplingNullifiers) {
+    bool fOk = WriteCache(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                          mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers);
+    mapCoins.clear();
+    mapSproutAnchors.clear();
+    mapSaplingAnchors.clear();
+    mapSproutNullifiers.clear();
+    mapSaplingNullifiers.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::WriteCache(const CCoinsMap &mapCoins,
+                              const uint256 &hashBlock,
+                              const uint256 &hashSproutAnchor,
+                              const uint256 &hashSaplingAnchor,
+                              const CAnchorsSproutMap &mapSproutAnchors,
+                              const CAnchorsSaplingMap &mapSaplingAnchors,
+                              const CNullifiersMap &mapSproutNullifiers,
+                              const CNullifiersMap &mapSaplingNullifiers) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    size_t outputs = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+            const CCoins& coins = it->second.coins;
+            if (it->second.flags & CCoinsCacheEntry::FRESH) {
+                // Nothing of this transaction is in the database yet
+                ::WriteCoins(batch, it->first, coins);
+                outputs += coins.vout.size();
+            } else if (it->second.vModified.empty()) {
+                // No record of what changed, so replace the transaction
+                EraseCoins(batch, it->first);
+                ::WriteCoins(batch, it->first, coins);
+                outputs += coins.vout.size();
+            } else {
+                // Only rewrite the outputs that were spent or restored
+                for (uint32_t i = 0; i < it->second.vModified.size(); i++) {
+                    if (!it->second.vModified[i])
+                        continue;
+                    if (coins.IsAvailable(i))
+                        batch.Write(CCoinKey(it->first, i), CCoinValue(coins, i));
+                    else
+                        batch.Erase(CCoinKey(it->first, i));
+                    outputs++;
+                }
+            }
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::const_iterator, CAnchorsSproutCacheEntry, SproutMerkleTree, SproutMerkleTreeDelta>(
+        batch, mapSproutAnchors, DB_SPROUT_ANCHOR_DELTA, DB_SPROUT_ANCHOR);
+    BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::const_iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree, SaplingMerkleTreeDelta>(
+        batch, mapSaplingAnchors, DB_SAPLING_ANCHOR_DELTA, DB_SAPLING_ANCHOR);
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
+    std::vector<uint256> vSproutRemoved, vSaplingRemoved;
+    BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER, sproutNullifierFilter, vSproutRemoved);
+    BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, saplingNullifierFilter, vSaplingRemoved);
 
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -195,11 +526,255 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    LogPrint("coindb", "Committing %u changed transactions (%u outputs, out of %u transactions) to coin database...\n", (unsigned int)changed, (unsigned int)outputs, (unsigned int)count);
+    if (!db.WriteBatch(batch))
+        return false;
+
+    BOOST_FOREACH(const uint256& nf, vSproutRemoved)
+        sproutNullifierFilter.Remove(nf);
+    BOOST_FOREACH(const uint256& nf, vSaplingRemoved)
+        saplingNullifierFilter.Remove(nf);
+    if (sproutNullifierFilter.NeedsResize())
+        LoadNullifierFilter(DB_NULLIFIER, sproutNullifierFilter);
+    if (saplingNullifierFilter.NeedsResize())
+        LoadNullifierFilter(DB_SAPLING_NULLIFIER, saplingNullifierFilter);
+    return true;
+}
+
+CCoinsViewFlusher::CCoinsViewFlusher(CCoinsView *baseIn, CCoinsViewDB *pdbIn) :
+    CCoinsViewBacked(baseIn), pdb(pdbIn), fWriting(false), fFailed(false), fStop(false), cachedInnerUsage(0)
+{
+    threadWriter = boost::thread(&CCoinsViewFlusher::ThreadWriter, this);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewFlusher::~CCoinsViewFlusher()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    // Finishes a write in progress first
+    threadWriter.join();
+}
+
+void CCoinsViewFlusher::ThreadWriter()
+{
+    RenameThread("zcash-coinsflush");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fWriting && !fStop)
+                cond.wait(lock);
+            if (!fWriting)
+                return;
+        }
+
+        size_t nInnerUsage = 0;
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++)
+            nInnerUsage += it->second.coins.DynamicMemoryUsage();
+        for (CAnchorsSproutMap::const_iterator it = cacheSproutAnchors.begin(); it != cacheSproutAnchors.end(); it++)
+            nInnerUsage += it->second.tree.DynamicMemoryUsage();
+        for (CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.begin(); it != cacheSaplingAnchors.end(); it++)
+            nInnerUsage += it->second.tree.DynamicMemoryUsage();
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            cachedInnerUsage = nInnerUsage;
+        }
+
+        int64_t nStart = GetTimeMicros();
+        bool fOk = pdb->WriteCache(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                                   cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers);
+        LogPrint("bench", "    - Background coins write: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+
+        // Free the written entries outside the lock
+        CCoinsMap coinsWritten;
+        CAnchorsSproutMap sproutAnchorsWritten;
+        CAnchorsSaplingMap saplingAnchorsWritten;
+        CNullifiersMap sproutNullifiersWritten;
+        CNullifiersMap saplingNullifiersWritten;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fOk) {
+                coinsWritten.swap(cacheCoins);
+                sproutAnchorsWritten.swap(cacheSproutAnchors);
+                saplingAnchorsWritten.swap(cacheSaplingAnchors);
+                sproutNullifiersWritten.swap(cacheSproutNullifiers);
+                saplingNullifiersWritten.swap(cacheSaplingNullifiers);
+                hashBlock.SetNull();
+                hashSproutAnchor.SetNull();
+                hashSaplingAnchor.SetNull();
+                cachedInnerUsage = 0;
+            } else {
+                // Keep serving the entries; the node is shutting down
+                LogPrintf("%s: failed to write to coin database\n", __func__);
+                fFailed = true;
+            }
+            fWriting = false;
+        }
+        cond.notify_all();
+        if (!fOk)
+            return;
+    }
+}
+
+bool CCoinsViewFlusher::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CAnchorsSproutMap::const_iterator it = cacheSproutAnchors.find(rt);
+        if (it != cacheSproutAnchors.end()) {
+            if (!it->second.entered)
+                return false;
+            tree = it->second.tree;
+            return true;
+        }
+    }
+    return base->GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewFlusher::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.find(rt);
+        if (it != cacheSaplingAnchors.end()) {
+            if (!it->second.entered)
+                return false;
+            tree = it->second.tree;
+            return true;
+        }
+    }
+    return base->GetSaplingAnchorAt(rt, tree);
+}
+
+bool CCoinsViewFlusher::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        const CNullifiersMap* cacheToUse;
+        switch (type) {
+            case SPROUT:
+                cacheToUse = &cacheSproutNullifiers;
+                break;
+            case SAPLING:
+                cacheToUse = &cacheSaplingNullifiers;
+                break;
+            default:
+                throw std::runtime_error("Unknown shielded type");
+        }
+        CNullifiersMap::const_iterator it = cacheToUse->find(nullifier);
+        if (it != cacheToUse->end())
+            return it->second.entered;
+    }
+    return base->GetNullifier(nullifier, type);
+}
+
+bool CCoinsViewFlusher::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = cacheCoins.find(txid);
+        if (it != cacheCoins.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    // Entries that are not here cannot change in the database meanwhile
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewFlusher::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = cacheCoins.find(txid);
+        if (it != cacheCoins.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewFlusher::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!hashBlock.IsNull())
+            return hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+uint256 CCoinsViewFlusher::GetBestAnchor(ShieldedType type) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        switch (type) {
+            case SPROUT:
+                if (!hashSproutAnchor.IsNull())
+                    return hashSproutAnchor;
+                break;
+            case SAPLING:
+                if (!hashSaplingAnchor.IsNull())
+                    return hashSaplingAnchor;
+                break;
+            default:
+                throw std::runtime_error("Unknown shielded type");
+        }
+    }
+    return base->GetBestAnchor(type);
+}
+
+bool CCoinsViewFlusher::BatchWrite(CCoinsMap &mapCoins,
+                                   const uint256 &hashBlockIn,
+                                   const uint256 &hashSproutAnchorIn,
+                                   const uint256 &hashSaplingAnchorIn,
+                                   CAnchorsSproutMap &mapSproutAnchors,
+                                   CAnchorsSaplingMap &mapSaplingAnchors,
+                                   CNullifiersMap &mapSproutNullifiers,
+                                   CNullifiersMap &mapSaplingNullifiers) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        int64_t nStart = GetTimeMicros();
+        while (fWriting)
+            cond.wait(lock);
+        if (fFailed)
+            return false;
+        LogPrint("bench", "    - Wait for previous coins write: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+
+        // The previous write emptied the maps, so the caller's entries can be
+        // taken over whole; the caller sees its maps emptied as if written
+        cacheCoins.swap(mapCoins);
+        cacheSproutAnchors.swap(mapSproutAnchors);
+        cacheSaplingAnchors.swap(mapSaplingAnchors);
+        cacheSproutNullifiers.swap(mapSproutNullifiers);
+        cacheSaplingNullifiers.swap(mapSaplingNullifiers);
+        hashBlock = hashBlockIn;
+        hashSproutAnchor = hashSproutAnchorIn;
+        hashSaplingAnchor = hashSaplingAnchorIn;
+        fWriting = true;
+    }
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewFlusher::GetStats(CCoinsStats &stats) const {
+    if (!Sync())
+        return false;
+    return base->GetStats(stats);
+}
+
+size_t CCoinsViewFlusher::DynamicMemoryUsage() const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return memusage::DynamicUsage(cacheCoins) +
+           memusage::DynamicUsage(cacheSproutAnchors) +
+           memusage::DynamicUsage(cacheSaplingAnchors) +
+           memusage::DynamicUsage(cacheSproutNullifiers) +
+           memusage::DynamicUsage(cacheSaplingNullifiers) +
+           cachedInnerUsage;
+}
+
+bool CCoinsViewFlusher::Sync() const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fWriting)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, "blockindex") {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -222,23 +797,79 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex) const {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), diskindex);
+}
+
+namespace {
+
+/** Statistics of the coins whose txid starts with a byte in a range */
+struct CCoinsStatsShard
+{
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    arith_uint256 commitment;
+
+    CCoinsStatsShard() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+};
+
+bool ReadCoinsStatsShard(CDBIterator& cursor, unsigned int nBegin, unsigned int nEnd, bool fCommitment, CCoinsStatsShard& shard)
+{
+    uint256 txidStart;
+    *txidStart.begin() = (unsigned char)nBegin;
+    cursor.Seek(CCoinKey(txidStart, 0));
+    uint256 txid;
+    CCoins coins;
+    size_t nSize;
+    while (true) {
+        boost::this_thread::interruption_point();
+        CCoinKey key;
+        if (!cursor.Valid() || !cursor.GetKey(key) || key.chType != DB_COIN || *key.txid.begin() >= nEnd)
+            break;
+        if (!::ReadCoinsAtCursor(cursor, txid, coins, nSize))
+            break;
+        shard.nTransactions++;
+        for (unsigned int i=0; i<coins.vout.size(); i++) {
+            const CTxOut &out = coins.vout[i];
+            if (!out.IsNull()) {
+                shard.nTransactionOutputs++;
+                shard.nTotalAmount += out.nValue;
+                if (fCommitment) {
+                    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+                    ss << txid << VARINT(i) << out << coins.nHeight << coins.fCoinBase << coins.nVersion;
+                    shard.commitment += UintToArith256(ss.GetHash());
+                }
+            }
+        }
+        shard.nSerializedSize += nSize;
+    }
+    return true;
+}
+
+} // anon namespace
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    // Every read sees the chainstate as it was at this point, whatever the
+    // flusher writes in the meantime
+    CDBSnapshot snapshot(db);
+    if (!db.Read(DB_BEST_BLOCK, stats.hashBlock, snapshot))
+        stats.hashBlock.SetNull();
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
+    if (stats.hashType == COINSTATS_HASH_SERIALIZED) {
+        boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator(snapshot));
+        pcursor->Seek(DB_COIN);
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << stats.hashBlock;
+        try {
+            uint256 txid;
+            CCoins coins;
+            size_t nSize;
+            while (::ReadCoinsAtCursor(*pcursor, txid, coins, nSize)) {
+                boost::this_thread::interruption_point();
                 stats.nTransactions++;
                 for (unsigned int i=0; i<coins.vout.size(); i++) {
                     const CTxOut &out = coins.vout[i];
@@ -249,25 +880,250 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
                         nTotalAmount += out.nValue;
                     }
                 }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
+                stats.nSerializedSize += nSize;
                 ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
             }
-        } else {
-            break;
+        } catch (const std::exception& e) {
+            return error("CCoinsViewDB::GetStats() : %s", e.what());
         }
-        pcursor->Next();
+        stats.hashSerialized = ss.GetHash();
+    } else {
+        // The outputs of a transaction share the first byte of their key
+        // after the prefix, so ranges of it split the coins between threads
+        int nShards = std::max(1, std::min(GetNumCores(), MAX_COINS_STATS_THREADS));
+        bool fCommitment = stats.hashType == COINSTATS_HASH_COMMITMENT;
+        std::vector<CCoinsStatsShard> vShards(nShards);
+        std::vector<char> vOk(nShards, false);
+        GetTaskPool().ParallelFor(TASKPOOL_RPC, nShards, nShards, [&](size_t n) {
+            unsigned int nBegin = 256 * n / nShards, nEnd = 256 * (n + 1) / nShards;
+            try {
+                boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator(snapshot));
+                vOk[n] = ReadCoinsStatsShard(*pcursor, nBegin, nEnd, fCommitment, vShards[n]);
+            } catch (const std::exception& e) {
+                LogPrintf("CCoinsViewDB::GetStats() : %s\n", e.what());
+            } catch (const boost::thread_interrupted&) {
+            }
+        });
+        boost::this_thread::interruption_point();
+        arith_uint256 commitment;
+        for (int n = 0; n < nShards; n++) {
+            if (!vOk[n])
+                return false;
+            stats.nTransactions += vShards[n].nTransactions;
+            stats.nTransactionOutputs += vShards[n].nTransactionOutputs;
+            stats.nSerializedSize += vShards[n].nSerializedSize;
+            nTotalAmount += vShards[n].nTotalAmount;
+            commitment += vShards[n].commitment;
+        }
+        if (fCommitment)
+            stats.hashCommitment = ArithToUint256(commitment);
     }
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+//! Number of legacy transactions converted per LevelDB batch by Upgrade()
+static const size_t UPGRADE_BATCH_TRANSACTIONS = 100000;
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading the coin database to per-output records...\n");
+    size_t nTransactions = 0, nOutputs = 0;
+    std::unique_ptr<CDBBatch> batch(new CDBBatch(db));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        CCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to read coins of %s", __func__, key.second.ToString());
+        // The conversion of a transaction is atomic, so an interrupted
+        // upgrade resumes where it stopped
+        ::WriteCoins(*batch, key.second, coins);
+        batch->Erase(key);
+        nOutputs += coins.vout.size();
+        if (++nTransactions % UPGRADE_BATCH_TRANSACTIONS == 0) {
+            if (!db.WriteBatch(*batch))
+                return false;
+            batch.reset(new CDBBatch(db));
+            LogPrintf("Upgraded %u transactions\n", (unsigned int)nTransactions);
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(*batch, true))
+        return false;
+    LogPrintf("Upgraded the coins of %u transactions to per-output records\n", (unsigned int)nTransactions);
+    return true;
+}
+
+//! Number of snapshot records loaded per LevelDB batch
+static const uint64_t SNAPSHOT_BATCH_RECORDS = 100000;
+
+template <typename V>
+static bool WriteSnapshotRecords(CDBIterator& cursor, char chType, CAutoFile& file, CHashWriter& hasher, uint64_t& nRecords)
+{
+    cursor.Seek(chType);
+    while (cursor.Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!cursor.GetKey(key) || key.first != chType)
+            break;
+        V value;
+        if (!cursor.GetValue(value))
+            return error("%s: unable to read value for %s", __func__, key.second.ToString());
+        file << chType << key.second << value;
+        hasher << chType << key.second << value;
+        nRecords++;
+        cursor.Next();
+    }
+    return true;
+}
+
+template <typename V>
+static void LoadSnapshotRecord(CAutoFile& file, CDBBatch& batch, CHashWriter& hasher, char chType, const uint256& hash)
+{
+    V value;
+    file >> value;
+    hasher << value;
+    batch.Write(make_pair(chType, hash), value);
+}
+
+bool CCoinsViewDB::WriteSnapshot(CAutoFile& file, CChainstateSnapshotHeader& header, uint64_t& nRecords, uint256& hashSnapshot) const {
+    CCoinsStats stats;
+    if (!GetStats(stats))
+        return false;
+    header = CChainstateSnapshotHeader();
+    header.hashBlock = stats.hashBlock;
+    header.hashSproutAnchor = GetBestAnchor(SPROUT);
+    header.hashSaplingAnchor = GetBestAnchor(SAPLING);
+    header.hashSerialized = stats.hashSerialized;
+
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    nRecords = 0;
+    try {
+        file << header;
+        hasher << header;
+        // In key order, so that loading the snapshot is a sorted bulk insert
+        if (!::WriteSnapshotRecords<SproutMerkleTree>(*pcursor, DB_SPROUT_ANCHOR, file, hasher, nRecords))
+            return false;
+        // The outputs of each transaction are written as one CCoins record
+        pcursor->Seek(DB_COIN);
+        uint256 txid;
+        CCoins coins;
+        size_t nSize;
+        while (::ReadCoinsAtCursor(*pcursor, txid, coins, nSize)) {
+            boost::this_thread::interruption_point();
+            file << DB_COINS << txid << coins;
+            hasher << DB_COINS << txid << coins;
+            nRecords++;
+        }
+        if (!::WriteSnapshotRecords<bool>(*pcursor, DB_SAPLING_NULLIFIER, file, hasher, nRecords) ||
+            !::WriteSnapshotRecords<SaplingMerkleTree>(*pcursor, DB_SAPLING_ANCHOR, file, hasher, nRecords) ||
+            !::WriteSnapshotRecords<CSproutAnchorRecord>(*pcursor, DB_SPROUT_ANCHOR_DELTA, file, hasher, nRecords) ||
+            !::WriteSnapshotRecords<bool>(*pcursor, DB_NULLIFIER, file, hasher, nRecords) ||
+            !::WriteSnapshotRecords<CSaplingAnchorRecord>(*pcursor, DB_SAPLING_ANCHOR_DELTA, file, hasher, nRecords))
+            return false;
+        file << '\0' << nRecords;
+        hasher << nRecords;
+        hashSnapshot = hasher.GetHash();
+        file << hashSnapshot;
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCoinsViewDB::LoadSnapshot(CAutoFile& file, const CChainstateSnapshotHeader& header, uint64_t& nRecords, uint256& hashSnapshot,
+                                const uint256& hashGenesis) {
+    // The genesis coinbase is unspendable, so connecting it adds no coins
+    uint256 hashBest = GetBestBlock();
+    if (!hashBest.IsNull() && (hashGenesis.IsNull() || hashBest != hashGenesis))
+        return error("%s: the coin database is not empty", __func__);
+    if (header.nVersion != CHAINSTATE_SNAPSHOT_VERSION)
+        return error("%s: unsupported snapshot version %d", __func__, header.nVersion);
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << header;
+    nRecords = 0;
+    try {
+        std::unique_ptr<CDBBatch> batch(new CDBBatch(db));
+        while (true) {
+            boost::this_thread::interruption_point();
+            char chType;
+            file >> chType;
+            if (chType == '\0')
+                break;
+            uint256 hash;
+            file >> hash;
+            hasher << chType << hash;
+            switch (chType) {
+                case DB_SPROUT_ANCHOR:
+                    ::LoadSnapshotRecord<SproutMerkleTree>(file, *batch, hasher, chType, hash);
+                    break;
+                case DB_SAPLING_ANCHOR:
+                    ::LoadSnapshotRecord<SaplingMerkleTree>(file, *batch, hasher, chType, hash);
+                    break;
+                case DB_SPROUT_ANCHOR_DELTA:
+                    ::LoadSnapshotRecord<CSproutAnchorRecord>(file, *batch, hasher, chType, hash);
+                    break;
+                case DB_SAPLING_ANCHOR_DELTA:
+                    ::LoadSnapshotRecord<CSaplingAnchorRecord>(file, *batch, hasher, chType, hash);
+                    break;
+                case DB_NULLIFIER:
+                case DB_SAPLING_NULLIFIER:
+                    ::LoadSnapshotRecord<bool>(file, *batch, hasher, chType, hash);
+                    break;
+                case DB_COINS: {
+                    CCoins coins;
+                    file >> coins;
+                    hasher << coins;
+                    ::WriteCoins(*batch, hash, coins);
+                    break;
+                }
+                default:
+                    return error("%s: unknown record type %d", __func__, chType);
+            }
+            if (++nRecords % SNAPSHOT_BATCH_RECORDS == 0) {
+                if (!db.WriteBatch(*batch))
+                    return false;
+                batch.reset(new CDBBatch(db));
+                LogPrintf("Loaded %u snapshot records\n", nRecords);
+            }
+        }
+        if (!db.WriteBatch(*batch))
+            return false;
+        LoadNullifierFilter(DB_NULLIFIER, sproutNullifierFilter);
+        LoadNullifierFilter(DB_SAPLING_NULLIFIER, saplingNullifierFilter);
+
+        uint64_t nRecordsExpected;
+        uint256 hashExpected;
+        file >> nRecordsExpected >> hashExpected;
+        hasher << nRecords;
+        hashSnapshot = hasher.GetHash();
+        if (nRecords != nRecordsExpected || hashSnapshot != hashExpected)
+            return error("%s: snapshot hash mismatch (%u records, hash %s, expected %u records, hash %s)", __func__,
+                         nRecords, hashSnapshot.ToString(), nRecordsExpected, hashExpected.ToString());
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    CDBBatch batch(db);
+    batch.Write(DB_BEST_SPROUT_ANCHOR, header.hashSproutAnchor);
+    batch.Write(DB_BEST_SAPLING_ANCHOR, header.hashSaplingAnchor);
+    batch.Write(DB_BEST_BLOCK, header.hashBlock);
+    return db.WriteBatch(batch, true);
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -275,7 +1131,7 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it, (*it)->GetSolution()));
     }
     return WriteBatch(batch, true);
 }
@@ -288,11 +1144,18 @@ bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockin
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+CTxIndexDB::CTxIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "txindex", nCacheSize, fMemory, fWipe) {
+}
+
+std::vector<char> CTxIndexDB::RecordTypes() {
+    return std::vector<char>(1, DB_TXINDEX);
+}
+
+bool CTxIndexDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+bool CTxIndexDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
@@ -300,9 +1163,184 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
 }
 
 // START insightexplorer
+CExplorerIndexDB::CExplorerIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / "explorerindex", nCacheSize, fMemory, fWipe),
+    fWriting(false), fFailed(false), fStop(false), nQueuedEntries(0)
+{
+    threadWriter = boost::thread(&CExplorerIndexDB::ThreadWriter, this);
+}
+
+CExplorerIndexDB::~CExplorerIndexDB()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CommitQueuedLocked(lock, true);
+        fStop = true;
+    }
+    cond.notify_all();
+    threadWriter.join();
+}
+
+void CExplorerIndexDB::ThreadWriter()
+{
+    RenameThread("zcash-explorerindex");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fWriting && !fStop)
+                cond.wait(lock);
+            if (!fWriting)
+                return;
+        }
+
+        int64_t nStart = GetTimeMicros();
+        bool fOk = WriteUpdates(vWriting);
+        LogPrint("bench", "    - Background explorer index write of %u blocks: %.2fms\n",
+                 vWriting.size(), (GetTimeMicros() - nStart) * 0.001);
+
+        // Free the written entries outside the lock
+        std::vector<CExplorerIndexUpdate> vWritten;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fOk) {
+                vWritten.swap(vWriting);
+            } else {
+                LogPrintf("%s: failed to write to explorer index database\n", __func__);
+                fFailed = true;
+            }
+            fWriting = false;
+        }
+        cond.notify_all();
+        if (!fOk)
+            return;
+    }
+}
+
+/**
+ * Write the address, unspent and spent index entries of a run of blocks in
+ * one batch. The address balances are computed over the whole run, with one
+ * read of each address touched, and the entries added and removed again
+ * within it (as in a reorg) cancel out.
+ */
+bool CExplorerIndexDB::WriteUpdates(const std::vector<CExplorerIndexUpdate> &vUpdates)
+{
+    if (vUpdates.empty())
+        return true;
+    CDBBatch batch(*this);
+    // Whether each address index entry seen so far is in the index, as of the updates applied
+    std::map<std::string, bool> mapPresent;
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> mapDeltas;
+    for (std::vector<CExplorerIndexUpdate>::const_iterator itUpdate = vUpdates.begin(); itUpdate != vUpdates.end(); itUpdate++) {
+        const CExplorerIndexUpdate &update = *itUpdate;
+        for (std::vector<CAddressIndexDbEntry>::const_iterator it = update.addressIndex.begin(); it != update.addressIndex.end(); it++) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << it->first;
+            std::string strKey(ssKey.begin(), ssKey.end());
+            std::map<std::string, bool>::iterator itPresent = mapPresent.find(strKey);
+            if (itPresent == mapPresent.end())
+                itPresent = mapPresent.insert(make_pair(strKey, Exists(make_pair(DB_ADDRESSINDEX, it->first)))).first;
+            if (update.fDisconnect)
+                batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+            else
+                batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+            // Entries already there (or already gone) are not counted twice
+            if (itPresent->second != update.fDisconnect)
+                continue;
+            itPresent->second = !update.fDisconnect;
+            CAddressBalanceValue &delta = mapDeltas[make_pair(it->first.type, it->first.hashBytes)];
+            CAmount nReceived = it->second > 0 ? it->second : 0;
+            if (update.fDisconnect) {
+                delta.balance -= it->second;
+                delta.received -= nReceived;
+            } else {
+                delta.balance += it->second;
+                delta.received += nReceived;
+            }
+        }
+        for (std::vector<CAddressUnspentDbEntry>::const_iterator it = update.addressUnspentIndex.begin(); it != update.addressUnspentIndex.end(); it++) {
+            if (it->second.IsNull())
+                batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+            else
+                batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+        }
+        for (std::vector<CSpentIndexDbEntry>::const_iterator it = update.spentIndex.begin(); it != update.spentIndex.end(); it++) {
+            if (it->second.IsNull())
+                batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+            else
+                batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+        }
+    }
+    WriteAddressBalanceDeltas(batch, mapDeltas);
+    batch.Write(DB_EXPLORERINDEX_SYNCED, vUpdates.back().hashBest);
+    // Synced, so that the marker is never ahead of the entries after a crash
+    return WriteBatch(batch, true);
+}
+
+/** With the lock held, wait for a write in progress and hand the queued updates over */
+bool CExplorerIndexDB::CommitQueuedLocked(boost::unique_lock<boost::mutex> &lock, bool fWait)
+{
+    while (fWriting)
+        cond.wait(lock);
+    if (fFailed)
+        return false;
+    if (!vQueued.empty()) {
+        vWriting.swap(vQueued);
+        vQueued.clear();
+        nQueuedEntries = 0;
+        fWriting = true;
+        cond.notify_all();
+    }
+    while (fWait && fWriting)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+bool CExplorerIndexDB::QueueUpdate(CExplorerIndexUpdate &update)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fFailed)
+        return false;
+    nQueuedEntries += update.addressIndex.size() + update.addressUnspentIndex.size() + update.spentIndex.size();
+    vQueued.push_back(CExplorerIndexUpdate());
+    CExplorerIndexUpdate &queued = vQueued.back();
+    queued.hashBest = update.hashBest;
+    queued.fDisconnect = update.fDisconnect;
+    queued.addressIndex.swap(update.addressIndex);
+    queued.addressUnspentIndex.swap(update.addressUnspentIndex);
+    queued.spentIndex.swap(update.spentIndex);
+    // Past the limit, write without waiting for the next flush; this
+    // waits for the previous write, so the queue cannot outrun the writer
+    if (nQueuedEntries > MAX_EXPLORER_INDEX_QUEUE_ENTRIES)
+        return CommitQueuedLocked(lock, false);
+    return true;
+}
+
+bool CExplorerIndexDB::CommitQueued(bool fWait)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return CommitQueuedLocked(lock, fWait);
+}
+
+bool CExplorerIndexDB::WaitForQueued()
+{
+    return CommitQueued(true);
+}
+
+bool CExplorerIndexDB::ReadIndexSynced(uint256 &hash) {
+    return Read(DB_EXPLORERINDEX_SYNCED, hash);
+}
+
+std::vector<char> CExplorerIndexDB::RecordTypes() {
+    const char types[] = {DB_ADDRESSINDEX, DB_ADDRESSUNSPENTINDEX, DB_ADDRESSBALANCE, DB_SPENTINDEX, DB_TIMESTAMPINDEX,
+                          DB_BLOCKHASHINDEX, DB_NULLIFIERINDEX, DB_COMMITMENTINDEX, DB_EXPLORERINDEX_BEST};
+    return std::vector<char>(types, types + sizeof(types));
+}
+
 // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-81e4f16a1b5d5b7ca25351a63d07cb80R183
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect)
+bool CExplorerIndexDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect)
 {
+    if (!WaitForQueued())
+        return false;
     CDBBatch batch(*this);
     for (std::vector<CAddressUnspentDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
@@ -314,74 +1352,268 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDb
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
+bool CExplorerIndexDB::ReadAddressUnspentEntries(CDBIterator &cursor, const uint160 &addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    cursor.Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
 
-    while (pcursor->Valid()) {
+    while (cursor.Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressUnspentKey> key;
-        if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash))
+        if (!(cursor.GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash))
             break;
         CAddressUnspentValue nValue;
-        if (!pcursor->GetValue(nValue))
+        if (!cursor.GetValue(nValue))
             return error("failed to get address unspent value");
         unspentOutputs.push_back(make_pair(key.second, nValue));
-        pcursor->Next();
+        cursor.Next();
+    }
+    return true;
+}
+
+bool CExplorerIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
+{
+    if (!WaitForQueued())
+        return false;
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    return ReadAddressUnspentEntries(*pcursor, addressHash, type, unspentOutputs);
+}
+
+namespace {
+
+typedef std::pair<unsigned int, uint160> AddressQuery;
+
+/**
+ * Sweep the index for a list of addresses: sort them into key order, so
+ * that one iterator moves forward through the index instead of a fresh
+ * one seeking for each address, and split long lists into contiguous key
+ * ranges read on several threads. The results are concatenated in key
+ * order, grouped by address.
+ */
+template <typename Entry>
+bool ReadAddressesSorted(const std::vector<std::pair<uint160, int> > &addresses, std::vector<Entry> &vect,
+                         const std::function<bool(const std::vector<AddressQuery>&, size_t, size_t, std::vector<Entry>&)> &readRange)
+{
+    std::vector<AddressQuery> vQueries;
+    vQueries.reserve(addresses.size());
+    for (size_t i = 0; i < addresses.size(); i++)
+        vQueries.push_back(make_pair((unsigned int)addresses[i].second, addresses[i].first));
+    std::sort(vQueries.begin(), vQueries.end());
+    vQueries.erase(std::unique(vQueries.begin(), vQueries.end()), vQueries.end());
+
+    size_t nRanges = std::min((size_t)MAX_ADDRESS_QUERY_THREADS, vQueries.size() / ADDRESS_QUERY_RANGE_SIZE);
+    if (nRanges <= 1)
+        return readRange(vQueries, 0, vQueries.size(), vect);
+
+    std::vector<std::vector<Entry> > vResults(nRanges);
+    std::vector<char> vOk(nRanges, false);
+    GetTaskPool().ParallelFor(TASKPOOL_INDEX, nRanges, nRanges, [&](size_t n) {
+        size_t nBegin = vQueries.size() * n / nRanges, nEnd = vQueries.size() * (n + 1) / nRanges;
+        try {
+            vOk[n] = readRange(vQueries, nBegin, nEnd, vResults[n]);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        } catch (const boost::thread_interrupted&) {
+        }
+    });
+    for (size_t n = 0; n < nRanges; n++) {
+        if (!vOk[n])
+            return false;
+        vect.insert(vect.end(), vResults[n].begin(), vResults[n].end());
     }
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+} // anon namespace
+
+bool CExplorerIndexDB::ReadAddressUnspentIndex(const std::vector<std::pair<uint160, int> > &addresses, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
+{
+    if (!WaitForQueued())
+        return false;
+    return ReadAddressesSorted<CAddressUnspentDbEntry>(addresses, unspentOutputs,
+        [this](const std::vector<AddressQuery> &vQueries, size_t nBegin, size_t nEnd, std::vector<CAddressUnspentDbEntry> &vect) {
+            boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+            for (size_t i = nBegin; i < nEnd; i++)
+                if (!ReadAddressUnspentEntries(*pcursor, vQueries[i].second, vQueries[i].first, vect))
+                    return false;
+            return true;
+        });
+}
+
+/**
+ * Apply the address index entries being added (or, with fErase, removed) to
+ * the running balances of their addresses, in the same batch. Entries that
+ * are already there (or already gone) are skipped, so that connecting a
+ * block again does not count it twice.
+ */
+void CExplorerIndexDB::UpdateAddressBalances(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect, bool fErase) {
+    std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> mapDeltas;
+    for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (Exists(make_pair(DB_ADDRESSINDEX, it->first)) != fErase)
+            continue;
+        CAddressBalanceValue &delta = mapDeltas[make_pair(it->first.type, it->first.hashBytes)];
+        CAmount nReceived = it->second > 0 ? it->second : 0;
+        delta.balance += fErase ? -it->second : it->second;
+        delta.received += fErase ? -nReceived : nReceived;
+    }
+    WriteAddressBalanceDeltas(batch, mapDeltas);
+}
+
+/** Add the changes to the running balances of their addresses, in the same batch */
+void CExplorerIndexDB::WriteAddressBalanceDeltas(CDBBatch &batch, const std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> &mapDeltas) {
+    for (std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue>::const_iterator it=mapDeltas.begin(); it!=mapDeltas.end(); it++) {
+        if (it->second.balance == 0 && it->second.received == 0)
+            continue;
+        CAddressIndexIteratorKey key(it->first.first, it->first.second);
+        CAddressBalanceValue value;
+        Read(make_pair(DB_ADDRESSBALANCE, key), value);
+        value.balance += it->second.balance;
+        value.received += it->second.received;
+        if (value.balance == 0 && value.received == 0)
+            batch.Erase(make_pair(DB_ADDRESSBALANCE, key));
+        else
+            batch.Write(make_pair(DB_ADDRESSBALANCE, key), value);
+    }
+}
+
+bool CExplorerIndexDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+    if (!WaitForQueued())
+        return false;
     CDBBatch batch(*this);
+    UpdateAddressBalances(batch, vect, false);
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+bool CExplorerIndexDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+    if (!WaitForQueued())
+        return false;
     CDBBatch batch(*this);
+    UpdateAddressBalances(batch, vect, true);
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(
-        uint160 addressHash, int type,
+bool CExplorerIndexDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    if (!WaitForQueued())
+        return false;
+    value.SetNull();
+    // No record means the address has no activity
+    Read(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+    return true;
+}
+
+/** Compute the running balances of all addresses from the address index, for databases that predate them */
+bool CExplorerIndexDB::RebuildAddressBalances() {
+    if (!WaitForQueued())
+        return false;
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_ADDRESSINDEX);
+
+    CDBBatch batch(*this);
+    CAddressIndexIteratorKey keyCur;
+    CAddressBalanceValue value;
+    bool fHaveCur = false;
+    size_t nAddresses = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX))
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address index value");
+        // Entries are sorted by address, so each address is summed in one run
+        if (!fHaveCur || key.second.type != keyCur.type || key.second.hashBytes != keyCur.hashBytes) {
+            if (fHaveCur)
+                batch.Write(make_pair(DB_ADDRESSBALANCE, keyCur), value);
+            keyCur = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            value.SetNull();
+            fHaveCur = true;
+            if (++nAddresses % 100000 == 0) {
+                if (!WriteBatch(batch))
+                    return false;
+                batch.Clear();
+            }
+        }
+        value.balance += nValue;
+        if (nValue > 0)
+            value.received += nValue;
+        pcursor->Next();
+    }
+    if (fHaveCur)
+        batch.Write(make_pair(DB_ADDRESSBALANCE, keyCur), value);
+    LogPrintf("%s: computed the balances of %u addresses\n", __func__, nAddresses);
+    return WriteBatch(batch);
+}
+
+bool CExplorerIndexDB::ReadAddressIndexEntries(
+        CDBIterator &cursor,
+        const uint160 &addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
         int start, int end)
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-
-    if (start > 0 && end > 0) {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+    // Entries of an address are sorted by height, so a range starts with a seek
+    if (start > 0) {
+        cursor.Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+        cursor.Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
-    while (pcursor->Valid()) {
+    while (cursor.Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
-        if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash))
+        if (!(cursor.GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash))
             break;
         if (end > 0 && key.second.blockHeight > end)
             break;
         CAmount nValue;
-        if (!pcursor->GetValue(nValue))
+        if (!cursor.GetValue(nValue))
             return error("failed to get address index value");
         addressIndex.push_back(make_pair(key.second, nValue));
-        pcursor->Next();
+        cursor.Next();
     }
     return true;
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+bool CExplorerIndexDB::ReadAddressIndex(
+        uint160 addressHash, int type,
+        std::vector<CAddressIndexDbEntry> &addressIndex,
+        int start, int end)
+{
+    if (!WaitForQueued())
+        return false;
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    return ReadAddressIndexEntries(*pcursor, addressHash, type, addressIndex, start, end);
+}
+
+bool CExplorerIndexDB::ReadAddressIndex(
+        const std::vector<std::pair<uint160, int> > &addresses,
+        std::vector<CAddressIndexDbEntry> &addressIndex,
+        int start, int end)
+{
+    if (!WaitForQueued())
+        return false;
+    return ReadAddressesSorted<CAddressIndexDbEntry>(addresses, addressIndex,
+        [this, start, end](const std::vector<AddressQuery> &vQueries, size_t nBegin, size_t nEnd, std::vector<CAddressIndexDbEntry> &vect) {
+            boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+            for (size_t i = nBegin; i < nEnd; i++)
+                if (!ReadAddressIndexEntries(*pcursor, vQueries[i].second, vQueries[i].first, vect, start, end))
+                    return false;
+            return true;
+        });
+}
+
+bool CExplorerIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+    if (!WaitForQueued())
+        return false;
     return Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect) {
+bool CExplorerIndexDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect) {
+    if (!WaitForQueued())
+        return false;
     CDBBatch batch(*this);
     for (std::vector<CSpentIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
@@ -393,13 +1625,51 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect)
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
+bool CExplorerIndexDB::WriteNoteIndex(const std::vector<CNullifierIndexDbEntry> &vNullifiers, const std::vector<CCommitmentIndexDbEntry> &vCommitments) {
+    CDBBatch batch(*this);
+    for (std::vector<CNullifierIndexDbEntry>::const_iterator it=vNullifiers.begin(); it!=vNullifiers.end(); it++)
+        batch.Write(make_pair(DB_NULLIFIERINDEX, it->first), it->second);
+    for (std::vector<CCommitmentIndexDbEntry>::const_iterator it=vCommitments.begin(); it!=vCommitments.end(); it++)
+        batch.Write(make_pair(DB_COMMITMENTINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CExplorerIndexDB::EraseNoteIndex(const std::vector<CNullifierIndexDbEntry> &vNullifiers, const std::vector<CCommitmentIndexDbEntry> &vCommitments) {
+    CDBBatch batch(*this);
+    for (std::vector<CNullifierIndexDbEntry>::const_iterator it=vNullifiers.begin(); it!=vNullifiers.end(); it++)
+        batch.Erase(make_pair(DB_NULLIFIERINDEX, it->first));
+    for (std::vector<CCommitmentIndexDbEntry>::const_iterator it=vCommitments.begin(); it!=vCommitments.end(); it++)
+        batch.Erase(make_pair(DB_COMMITMENTINDEX, it->first));
+    return WriteBatch(batch);
+}
+
+bool CExplorerIndexDB::ReadNullifierIndex(const CNoteIndexKey &key, CNullifierIndexValue &value) {
+    return Read(make_pair(DB_NULLIFIERINDEX, key), value);
+}
+
+bool CExplorerIndexDB::ReadCommitmentIndex(const CNoteIndexKey &key, CCommitmentIndexValue &value) {
+    return Read(make_pair(DB_COMMITMENTINDEX, key), value);
+}
+
+bool CExplorerIndexDB::WriteExplorerIndexBest(const uint256 &hash) {
+    return Write(DB_EXPLORERINDEX_BEST, hash);
+}
+
+bool CExplorerIndexDB::ReadExplorerIndexBest(uint256 &hash) {
+    return Read(DB_EXPLORERINDEX_BEST, hash);
+}
+
+bool CExplorerIndexDB::EraseExplorerIndexBest() {
+    return Erase(DB_EXPLORERINDEX_BEST);
+}
+
+bool CExplorerIndexDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
     CDBBatch batch(*this);
     batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
+bool CExplorerIndexDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -425,7 +1695,7 @@ bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
+bool CExplorerIndexDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
     const CTimestampBlockIndexValue &logicalts)
 {
     CDBBatch batch(*this);
@@ -433,7 +1703,7 @@ bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &block
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp)
+bool CExplorerIndexDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp)
 {
     CTimestampBlockIndexValue(lts);
     if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
@@ -456,56 +1726,233 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+namespace {
+
+/** A database key or value as its serialized bytes */
+struct CRawRecord
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    std::vector<char> vch;
 
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s.write(vch.data(), vch.size());
+    }
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
-
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                       diskindex.ToString(),  pindexNew->ToString());
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        vch.resize(s.size());
+        s.read(vch.data(), vch.size());
+    }
+};
+
+} // anon namespace
+
+//! Bytes of records moved between writes by MoveRecords
+static const size_t MOVE_RECORDS_BATCH_SIZE = 16 << 20;
+
+int64_t CBlockTreeDB::MoveRecords(const std::vector<char> &vTypes, CDBWrapper &dest) {
+    int64_t nMoved = 0;
+    for (char chType : vTypes) {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        CDBBatch batchDest(dest), batchErase(*this);
+        size_t nBatchSize = 0;
+        for (pcursor->Seek(chType); pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            char chKey;
+            CRawRecord key, value;
+            if (!pcursor->GetKey(chKey) || chKey != chType)
+                break;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(value))
+                return -1;
+            batchDest.Write(key, value);
+            batchErase.Erase(key);
+            nBatchSize += key.vch.size() + value.vch.size();
+            nMoved++;
+            // Records are only erased here once they are in dest, so an
+            // interrupted move is picked up again at the next start
+            if (nBatchSize >= MOVE_RECORDS_BATCH_SIZE) {
+                if (!dest.WriteBatch(batchDest, true) || !WriteBatch(batchErase))
+                    return -1;
+                batchDest.Clear();
+                batchErase.Clear();
+                nBatchSize = 0;
+            }
+        }
+        if (!dest.WriteBatch(batchDest, true) || !WriteBatch(batchErase))
+            return -1;
+    }
+    return nMoved;
+}
+
+namespace {
+
+/** Block index entries decoded by a loader thread, inserted together */
+static const size_t BLOCK_INDEX_LOAD_BATCH = 256;
+
+typedef std::pair<uint256, CDiskBlockIndex> BlockIndexDbEntry;
+
+void InsertBlockIndexEntries(const boost::function<CBlockIndex*(const uint256&)>& insertBlockIndex,
+                             const std::vector<BlockIndexDbEntry>& vEntries)
+{
+    for (const BlockIndexDbEntry& entry : vEntries) {
+        const CDiskBlockIndex& diskindex = entry.second;
+        // Construct block index object
+        CBlockIndex* pindexNew = insertBlockIndex(entry.first);
+        pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+        pindexNew->nHeight        = diskindex.nHeight;
+        pindexNew->nFile          = diskindex.nFile;
+        pindexNew->nDataPos       = diskindex.nDataPos;
+        pindexNew->nUndoPos       = diskindex.nUndoPos;
+        pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
+        pindexNew->nVersion       = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
+        pindexNew->nTime          = diskindex.nTime;
+        pindexNew->nBits          = diskindex.nBits;
+        pindexNew->nNonce         = diskindex.nNonce;
+        pindexNew->nStatus        = diskindex.nStatus;
+        pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
+        pindexNew->nTx            = diskindex.nTx;
+        pindexNew->nSproutValue   = diskindex.nSproutValue;
+        pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+    }
+}
+
+} // anon namespace
+
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+                                      unsigned int nHashCheckInterval, int nThreads)
+{
+    // The hashes are uniform, so ranges of their first serialized byte
+    // split the entries evenly between the threads
+    nThreads = std::max(1, std::min(nThreads, 256));
+    boost::mutex csInsert;
+
+    auto loadRange = [&](unsigned int nBegin, unsigned int nEnd) -> bool {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        uint256 hashStart;
+        *hashStart.begin() = (unsigned char)nBegin;
+        pcursor->Seek(make_pair(DB_BLOCK_INDEX, hashStart));
+
+        // Start every thread at a different point of the sampling cycle
+        uint64_t nChecked = nHashCheckInterval > 1 ? GetRand(nHashCheckInterval) : 0;
+        std::vector<BlockIndexDbEntry> vBatch;
+        vBatch.reserve(BLOCK_INDEX_LOAD_BATCH);
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            if (!(pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX && *key.second.begin() < nEnd))
+                break;
+            vBatch.push_back(make_pair(key.second, CDiskBlockIndex()));
+            CDiskBlockIndex& diskindex = vBatch.back().second;
+            if (!pcursor->GetValue(diskindex))
                 return error("LoadBlockIndex() : failed to read value");
+
+            // Consistency checks; the solution stays on disk
+            bool fCheckHash = !diskindex.IsValid(BLOCK_VALID_SCRIPTS) ||
+                (nHashCheckInterval > 0 && nChecked++ % nHashCheckInterval == 0);
+            if (fCheckHash && diskindex.GetBlockHash() != key.second)
+                return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
+                   diskindex.ToString(), key.second.ToString());
+            if (!CheckProofOfWork(key.second, diskindex.nBits, Params().GetConsensus()))
+                return error("LoadBlockIndex(): CheckProofOfWork failed: %s", key.second.ToString());
+            std::vector<unsigned char>().swap(diskindex.nSolution);
+
+            if (vBatch.size() >= BLOCK_INDEX_LOAD_BATCH) {
+                boost::unique_lock<boost::mutex> lock(csInsert);
+                InsertBlockIndexEntries(insertBlockIndex, vBatch);
+                vBatch.clear();
             }
-        } else {
-            break;
+            pcursor->Next();
+        }
+        boost::unique_lock<boost::mutex> lock(csInsert);
+        InsertBlockIndexEntries(insertBlockIndex, vBatch);
+        return true;
+    };
+
+    if (nThreads == 1)
+        return loadRange(0, 256);
+
+    std::vector<char> vOk(nThreads, false);
+    GetTaskPool().ParallelFor(TASKPOOL_VALIDATION, nThreads, nThreads, [&](size_t n) {
+        unsigned int nBegin = 256 * n / nThreads, nEnd = 256 * (n + 1) / nThreads;
+        try {
+            vOk[n] = loadRange(nBegin, nEnd);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        } catch (const boost::thread_interrupted&) {
         }
+    });
+    boost::this_thread::interruption_point();
+    for (int n = 0; n < nThreads; n++) {
+        if (!vOk[n])
+            return false;
     }
+    return true;
+}
+
+CSaplingFrontierDB::CSaplingFrontierDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "saplingfrontiers", nCacheSize, fMemory, fWipe) {
+}
+
+bool CSaplingFrontierDB::WriteFrontier(int nHeight, const uint256 &hashBlock, const SaplingMerkleTree &tree) {
+    return Write(make_pair(DB_SAPLING_FRONTIER, nHeight), make_pair(hashBlock, tree));
+}
 
+bool CSaplingFrontierDB::ReadFrontier(int nHeight, uint256 &hashBlock, SaplingMerkleTree &tree) const {
+    std::pair<uint256, SaplingMerkleTree> entry;
+    if (!Read(make_pair(DB_SAPLING_FRONTIER, nHeight), entry))
+        return false;
+    hashBlock = entry.first;
+    tree = entry.second;
+    return true;
+}
+
+bool CSaplingFrontierDB::EraseFrontier(int nHeight) {
+    return Erase(make_pair(DB_SAPLING_FRONTIER, nHeight));
+}
+
+CBlockFilterDB::CBlockFilterDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blockfilters", nCacheSize, fMemory, fWipe) {
+}
+
+bool CBlockFilterDB::WriteFilter(const uint256 &hashBlock, const std::vector<unsigned char> &vchFilter, const uint256 &hashHeader) {
+    CDBBatch batch(*this);
+    batch.Write(make_pair(DB_BLOCK_FILTER, hashBlock), make_pair(vchFilter, hashHeader));
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CBlockFilterDB::ReadFilter(const uint256 &hashBlock, std::vector<unsigned char> &vchFilter, uint256 &hashHeader) const {
+    std::pair<std::vector<unsigned char>, uint256> entry;
+    if (!Read(make_pair(DB_BLOCK_FILTER, hashBlock), entry))
+        return false;
+    vchFilter.swap(entry.first);
+    hashHeader = entry.second;
     return true;
 }
+
+bool CBlockFilterDB::ReadFilterHeader(const uint256 &hashBlock, uint256 &hashHeader) const {
+    std::vector<unsigned char> vchFilter;
+    return ReadFilter(hashBlock, vchFilter, hashHeader);
+}
+
+bool CBlockFilterDB::ReadBestBlock(uint256 &hashBlock) const {
+    return Read(DB_BEST_BLOCK, hashBlock);
+}
+
+CChainStatsDB::CChainStatsDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "chainstats", nCacheSize, fMemory, fWipe) {
+}
+
+bool CChainStatsDB::WriteStats(const uint256 &hashBlock, const CChainStats &stats) {
+    CDBBatch batch(*this);
+    batch.Write(make_pair(DB_CHAIN_STATS, hashBlock), stats);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CChainStatsDB::ReadStats(const uint256 &hashBlock, CChainStats &stats) const {
+    return Read(make_pair(DB_CHAIN_STATS, hashBlock), stats);
+}
+
+bool CChainStatsDB::ReadBestBlock(uint256 &hashBlock) const {
+    return Read(DB_BEST_BLOCK, hashBlock);
+}
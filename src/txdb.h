@@ -7,6 +7,7 @@
 #define BITCOIN_TXDB_H
 
 #include "coins.h"
+#include "cuckoofilter.h"
 #include "dbwrapper.h"
 #include "chain.h"
 
@@ -16,7 +17,11 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
+class CAutoFile;
 class CBlockIndex;
 
 // START insightexplorer
@@ -25,16 +30,29 @@ struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
 struct CAddressIndexIteratorHeightKey;
+struct CAddressBalanceValue;
 struct CSpentIndexKey;
 struct CSpentIndexValue;
 struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
 struct CTimestampBlockIndexKey;
 struct CTimestampBlockIndexValue;
+struct CNoteIndexKey;
+struct CNullifierIndexValue;
+struct CCommitmentIndexValue;
 
 typedef std::pair<CAddressUnspentKey, CAddressUnspentValue> CAddressUnspentDbEntry;
 typedef std::pair<CAddressIndexKey, CAmount> CAddressIndexDbEntry;
 typedef std::pair<CSpentIndexKey, CSpentIndexValue> CSpentIndexDbEntry;
+
+/** Addresses read by each thread of a batched address query, at least */
+static const size_t ADDRESS_QUERY_RANGE_SIZE = 1000;
+/** Maximum number of threads reading a batched address query */
+static const int MAX_ADDRESS_QUERY_THREADS = 4;
+/** Address, unspent and spent index entries queued before they are written regardless of the next flush */
+static const size_t MAX_EXPLORER_INDEX_QUEUE_ENTRIES = 250000;
+typedef std::pair<CNoteIndexKey, CNullifierIndexValue> CNullifierIndexDbEntry;
+typedef std::pair<CNoteIndexKey, CCommitmentIndexValue> CCommitmentIndexDbEntry;
 // END insightexplorer
 
 class uint256;
@@ -45,6 +63,12 @@ static const int64_t nDefaultDbCache = 800;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -blockindexhashcheck default: rehash one in this many fully validated block index entries
+static const unsigned int DEFAULT_BLOCK_INDEX_HASH_CHECK = 64;
+//! Maximum number of threads decoding the block index at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+//! Maximum number of threads reading the coins for their statistics
+static const int MAX_COINS_STATS_THREADS = 8;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -71,12 +95,70 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+//! Version of the chainstate snapshot format written by dumptxoutset
+static const int CHAINSTATE_SNAPSHOT_VERSION = 1;
+
+/**
+ * Header of a chainstate snapshot: the block the chainstate was taken at,
+ * its best anchors, and the gettxoutsetinfo hash_serialized of its coins so
+ * it can be compared against another node.
+ */
+class CChainstateSnapshotHeader
+{
+public:
+    int nVersion;
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    uint256 hashSerialized;
+
+    CChainstateSnapshotHeader() : nVersion(CHAINSTATE_SNAPSHOT_VERSION) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nVersion);
+        READWRITE(hashBlock);
+        READWRITE(hashSproutAnchor);
+        READWRITE(hashSaplingAnchor);
+        READWRITE(hashSerialized);
+    }
+};
+
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Every nullifier in the database is in these, so that the lookup of
+    //! an unspent nullifier usually does not touch the database
+    CCuckooFilter sproutNullifierFilter;
+    CCuckooFilter saplingNullifierFilter;
+
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! Refill a nullifier filter from the database
+    void LoadNullifierFilter(char dbChar, CCuckooFilter& filter);
+
+    //! Write the dirty nullifiers of mapToUse, keeping the filter in step.
+    //! Nullifiers that must leave the filter once the batch is written are
+    //! added to vRemoved.
+    void BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, char dbChar, CCuckooFilter& filter,
+                              std::vector<uint256>& vRemoved) const;
+
+    //! Erase every output record of txid that is in the database
+    void EraseCoins(CDBBatch& batch, const uint256& txid) const;
+
+    //! Rebuild the tree at rt from its anchor record or a full tree written
+    //! by an older version
+    template<typename Tree, typename Delta>
+    bool ReadAnchor(char chDelta, char chLegacy, const uint256 &rt, Tree &tree, uint32_t &nDeltas) const;
+
+    //! Write the dirty anchors of mapToUse as deltas against the anchor they
+    //! were appended to, with a full checkpoint every few anchors
+    template<typename Map, typename MapIterator, typename MapEntry, typename Tree, typename Delta>
+    void BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, char chDelta, char chLegacy) const;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -87,6 +169,98 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers);
+    /**
+     * Write the dirty entries of the maps like BatchWrite, but leave the maps
+     * untouched, so that other threads can keep reading them meanwhile.
+     */
+    bool WriteCache(const CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    const CAnchorsSproutMap &mapSproutAnchors,
+                    const CAnchorsSaplingMap &mapSaplingAnchors,
+                    const CNullifiersMap &mapSproutNullifiers,
+                    const CNullifiersMap &mapSaplingNullifiers);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Convert whole-transaction coin records from older versions to
+    //! per-output records
+    bool Upgrade();
+
+    /**
+     * Write the header, then every coin, anchor and nullifier record in key
+     * order, then the record count and the hash committing to all of it.
+     * The header is filled in from the database.
+     */
+    bool WriteSnapshot(CAutoFile& file, CChainstateSnapshotHeader& header, uint64_t& nRecords, uint256& hashSnapshot) const;
+
+    /**
+     * Bulk-load the records following an already read header into an empty
+     * database, or one that has only connected hashGenesis when it is set.
+     * The best block and anchors are only written once the whole snapshot
+     * has been read and its hash checked.
+     */
+    bool LoadSnapshot(CAutoFile& file, const CChainstateSnapshotHeader& header, uint64_t& nRecords, uint256& hashSnapshot,
+                      const uint256& hashGenesis = uint256());
+};
+
+/**
+ * Coins view between the tip cache and the coin database that takes the
+ * write of a flush off the validation path. Flushing the tip cache moves
+ * its contents into this layer in one swap; a background thread then
+ * writes them to the database while validation continues on the emptied
+ * tip cache, which reads through to the entries being written until the
+ * write is done. A flush only waits if the previous write is still running.
+ */
+class CCoinsViewFlusher : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB *pdb;
+
+    //! Protects the fields below. The entries themselves are not modified
+    //! while fWriting is set, so the writer reads them without the lock.
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable cond;
+    bool fWriting;
+    bool fFailed;
+    bool fStop;
+
+    CCoinsMap cacheCoins;
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    CAnchorsSproutMap cacheSproutAnchors;
+    CAnchorsSaplingMap cacheSaplingAnchors;
+    CNullifiersMap cacheSproutNullifiers;
+    CNullifiersMap cacheSaplingNullifiers;
+    //! Usage of the coins and trees in the entries, counted by the writer
+    size_t cachedInnerUsage;
+
+    boost::thread threadWriter;
+
+    void ThreadWriter();
+
+public:
+    //! Reads go through base (usually an error catcher around pdbIn), writes go to pdbIn
+    CCoinsViewFlusher(CCoinsView *baseIn, CCoinsViewDB *pdbIn);
+    ~CCoinsViewFlusher();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    //! Hand the entries over to the writer thread; fails if the previous write failed
     bool BatchWrite(CCoinsMap &mapCoins,
                     const uint256 &hashBlock,
                     const uint256 &hashSproutAnchor,
@@ -96,6 +270,12 @@ public:
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Wait until everything handed over is in the database; false if writing it failed
+    bool Sync() const;
+
+    //! Estimated heap usage of the entries being written
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -111,30 +291,238 @@ public:
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
+    //! The stored entry of a block index, which holds its Equihash solution
+    bool ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex) const;
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+    /**
+     * Load every block index entry, decoded on nThreads threads over ranges
+     * of hashes. The header hash is recomputed for every entry not validated
+     * up to BLOCK_VALID_SCRIPTS, and for one in nHashCheckInterval of the
+     * others (0: none of them); the proof of work of every hash is checked.
+     */
+    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+                            unsigned int nHashCheckInterval = 1, int nThreads = 1);
+    /**
+     * Move the records of the given types, as kept here by older versions,
+     * to dest. Returns the number of records moved, or -1 on failure.
+     */
+    int64_t MoveRecords(const std::vector<char> &vTypes, CDBWrapper &dest);
+};
+
+/**
+ * The transaction index (txindex/), kept apart from the block index
+ * so that its writes and compactions do not hold up those of the block index.
+ */
+class CTxIndexDB : public CDBWrapper
+{
+public:
+    CTxIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CTxIndexDB(const CTxIndexDB&);
+    void operator=(const CTxIndexDB&);
+public:
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
 
-    // START insightexplorer
+    //! The types of the records kept here, for MoveRecords
+    static std::vector<char> RecordTypes();
+};
+
+/** The address, unspent and spent index entries of a block connected or disconnected */
+struct CExplorerIndexUpdate
+{
+    //! The tip once the block is applied: the block, or its parent when it is disconnected
+    uint256 hashBest;
+    //! The address index entries are removed rather than added
+    bool fDisconnect;
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+    std::vector<CSpentIndexDbEntry> spentIndex;
+
+    CExplorerIndexUpdate() : fDisconnect(false) {}
+};
+
+/**
+ * The insight explorer indexes (explorerindex/): addresses, their
+ * balances and unspent outputs, spent outputs, notes and block timestamps.
+ *
+ * The address, unspent and spent index entries of connected blocks are
+ * queued, and written by a background thread in one batch per chainstate
+ * flush, along with the block they bring the indexes up to. Reads and
+ * direct writes of those indexes wait for the queue first.
+ */
+class CExplorerIndexDB : public CDBWrapper
+{
+public:
+    CExplorerIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CExplorerIndexDB();
+private:
+    CExplorerIndexDB(const CExplorerIndexDB&);
+    void operator=(const CExplorerIndexDB&);
+
+    //! Protects the fields below. The updates being written are not modified
+    //! while fWriting is set, so the writer reads them without the lock.
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fWriting;
+    bool fFailed;
+    bool fStop;
+    std::vector<CExplorerIndexUpdate> vQueued;
+    size_t nQueuedEntries;
+    std::vector<CExplorerIndexUpdate> vWriting;
+
+    boost::thread threadWriter;
+
+    void ThreadWriter();
+    bool WriteUpdates(const std::vector<CExplorerIndexUpdate> &vUpdates);
+    bool CommitQueuedLocked(boost::unique_lock<boost::mutex> &lock, bool fWait);
+    //! Wait until everything queued is in the database, before reading or writing it directly
+    bool WaitForQueued();
+    void WriteAddressBalanceDeltas(CDBBatch &batch, const std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> &mapDeltas);
+    void UpdateAddressBalances(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect, bool fErase);
+    bool ReadAddressUnspentEntries(CDBIterator &cursor, const uint160 &addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
+    bool ReadAddressIndexEntries(CDBIterator &cursor, const uint160 &addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start, int end);
+public:
+    //! Queue the entries of a block, taking them from update; fails if a previous write failed
+    bool QueueUpdate(CExplorerIndexUpdate &update);
+    //! Hand the queued entries over to the writer thread, and with fWait wait until they are written
+    bool CommitQueued(bool fWait);
+    //! The block the address, unspent and spent indexes were last written up to
+    bool ReadIndexSynced(uint256 &hash);
     bool UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
+    /** Read the unspent outputs of many addresses in one sweep, grouped by address in key order */
+    bool ReadAddressUnspentIndex(const std::vector<std::pair<uint160, int> > &addresses, std::vector<CAddressUnspentDbEntry> &vect);
     bool WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
     bool EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
     bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    /** Read the address index entries of many addresses in one sweep, grouped by address in key order */
+    bool ReadAddressIndex(const std::vector<std::pair<uint160, int> > &addresses, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    bool RebuildAddressBalances();
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect);
+    bool WriteNoteIndex(const std::vector<CNullifierIndexDbEntry> &vNullifiers, const std::vector<CCommitmentIndexDbEntry> &vCommitments);
+    bool EraseNoteIndex(const std::vector<CNullifierIndexDbEntry> &vNullifiers, const std::vector<CCommitmentIndexDbEntry> &vCommitments);
+    bool ReadNullifierIndex(const CNoteIndexKey &key, CNullifierIndexValue &value);
+    bool ReadCommitmentIndex(const CNoteIndexKey &key, CCommitmentIndexValue &value);
+    bool WriteExplorerIndexBest(const uint256 &hash);
+    bool ReadExplorerIndexBest(uint256 &hash);
+    bool EraseExplorerIndexBest();
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(unsigned int high, unsigned int low,
             const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
     bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
             const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
-    // END insightexplorer
 
-    bool WriteFlag(const std::string &name, bool fValue);
-    bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    //! The types of the records kept here, for MoveRecords
+    static std::vector<char> RecordTypes();
+};
+
+/**
+ * Sapling commitment tree frontiers checkpointed every few blocks
+ * (saplingfrontiers/). Each entry is keyed by height and records the hash of
+ * the block it was taken at, so that stale entries left by a reorg are
+ * detected on read.
+ */
+class CSaplingFrontierDB : public CDBWrapper
+{
+public:
+    CSaplingFrontierDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CSaplingFrontierDB(const CSaplingFrontierDB&);
+    void operator=(const CSaplingFrontierDB&);
+public:
+    bool WriteFrontier(int nHeight, const uint256 &hashBlock, const SaplingMerkleTree &tree);
+    bool ReadFrontier(int nHeight, uint256 &hashBlock, SaplingMerkleTree &tree) const;
+    bool EraseFrontier(int nHeight);
+};
+
+/**
+ * Compact block filters (blockfilters/). Each entry is keyed by block hash
+ * and holds the encoded basic filter and its filter header, so entries of
+ * blocks that were reorged out stay valid. The hash of the last block
+ * indexed is kept so that the index can be brought up to date at startup.
+ */
+class CBlockFilterDB : public CDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CBlockFilterDB(const CBlockFilterDB&);
+    void operator=(const CBlockFilterDB&);
+public:
+    bool WriteFilter(const uint256 &hashBlock, const std::vector<unsigned char> &vchFilter, const uint256 &hashHeader);
+    bool ReadFilter(const uint256 &hashBlock, std::vector<unsigned char> &vchFilter, uint256 &hashHeader) const;
+    bool ReadFilterHeader(const uint256 &hashBlock, uint256 &hashHeader) const;
+    bool ReadBestBlock(uint256 &hashBlock) const;
+};
+
+/** Totals of a chain up to and including one of its blocks */
+struct CChainStats
+{
+    int nHeight;
+    uint64_t nTransactions;
+    //! Transactions with JoinSplits or Sapling spends or outputs
+    uint64_t nShieldedTransactions;
+    //! Shielded transactions without transparent inputs or outputs
+    uint64_t nFullyShieldedTransactions;
+    //! Sprout and Sapling nullifiers revealed
+    uint64_t nShieldedSpends;
+    //! Sprout and Sapling note commitments created
+    uint64_t nShieldedOutputs;
+    CAmount nFees;
+    //! Coins issued: the value of the coinbases less the fees they claim
+    CAmount nSupply;
+    CAmount nSproutValue;
+    CAmount nSaplingValue;
+    //! Coinbase outputs paying neither the miner (the first output) nor the founders
+    CAmount nZeronodePayouts;
+
+    CChainStats() : nHeight(-1), nTransactions(0), nShieldedTransactions(0), nFullyShieldedTransactions(0),
+                    nShieldedSpends(0), nShieldedOutputs(0), nFees(0), nSupply(0), nSproutValue(0),
+                    nSaplingValue(0), nZeronodePayouts(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(VARINT(nTransactions));
+        READWRITE(VARINT(nShieldedTransactions));
+        READWRITE(VARINT(nFullyShieldedTransactions));
+        READWRITE(VARINT(nShieldedSpends));
+        READWRITE(VARINT(nShieldedOutputs));
+        READWRITE(nFees);
+        READWRITE(nSupply);
+        READWRITE(nSproutValue);
+        READWRITE(nSaplingValue);
+        READWRITE(nZeronodePayouts);
+    }
+};
+
+/**
+ * Chain statistics index (chainstats/). Each entry is keyed by block hash
+ * and holds the totals of the chain up to that block, so the totals of any
+ * range of blocks are the difference of two entries. As with the block
+ * filters, entries of blocks that were reorged out stay valid, and the
+ * hash of the last block indexed is kept to catch up at startup.
+ */
+class CChainStatsDB : public CDBWrapper
+{
+public:
+    CChainStatsDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CChainStatsDB(const CChainStatsDB&);
+    void operator=(const CChainStatsDB&);
+public:
+    bool WriteStats(const uint256 &hashBlock, const CChainStats &stats);
+    bool ReadStats(const uint256 &hashBlock, CChainStats &stats) const;
+    bool ReadBestBlock(uint256 &hashBlock) const;
 };
 
 #endif // BITCOIN_TXDB_H
@@ -10,20 +10,36 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
 #include "streams.h"
 #include "timedata.h"
+#include "trace.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utilstrencodings.h"
 #include "validationinterface.h"
 #include "version.h"
 
+#include <algorithm>
+#include <limits>
+
 using namespace std;
 
+CMemPoolOutPointHasher::CMemPoolOutPointHasher() : salt(GetRandHash()) {}
+
+CSpentIndexKeyHasher::CSpentIndexKeyHasher() : salt(GetRandHash()) {}
+
 CTxMemPoolEntry::CTxMemPoolEntry():
     nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
     hadNoDependencies(false), spendsCoinbase(false)
 {
     nHeight = MEMPOOL_HEIGHT;
+    nCountWithAncestors = 0;
+    nSizeWithAncestors = 0;
+    nFeesWithAncestors = 0;
+    nCountWithDescendants = 0;
+    nSizeWithDescendants = 0;
+    nFeesWithDescendants = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -38,6 +54,13 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
     feeRate = CFeeRate(nFee, nTxSize);
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nFeesWithAncestors = nFee;
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -54,9 +77,50 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
+void CTxMemPoolEntry::SetAncestorState(uint64_t nSize, CAmount nFees, uint64_t nCount)
+{
+    nSizeWithAncestors = nSize;
+    nFeesWithAncestors = nFees;
+    nCountWithAncestors = nCount;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::SetDescendantState(uint64_t nSize, CAmount nFees, uint64_t nCount)
+{
+    nSizeWithDescendants = nSize;
+    nFeesWithDescendants = nFees;
+    nCountWithDescendants = nCount;
+}
+
+/** Lower bounds of the fee rate histogram buckets, in zatoshis per kB */
+static const CAmount vFeeRateBounds[] = {
+    0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000,
+    50000, 100000, 200000, 500000, 1000000
+};
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     nTransactionsUpdated(0)
 {
+    stats.vFeeRateBounds.assign(vFeeRateBounds, vFeeRateBounds + ARRAYLEN(vFeeRateBounds));
+    stats.vFeeRates.resize(stats.vFeeRateBounds.size());
+
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
@@ -76,13 +140,114 @@ void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 {
     LOCK(cs);
 
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
+    // mapNextTx is hashed, so look up each output of hashTx in turn
+    for (unsigned int n = 0; n < coins.vout.size(); n++) {
+        if (mapNextTx.count(COutPoint(hashTx, n)))
+            coins.Spend(n); // and remove those outputs from coins
+    }
+}
+
+const char* GetMemPoolTxClassName(MemPoolTxClass txClass)
+{
+    switch (txClass) {
+        case MEMPOOL_TX_TRANSPARENT: return "transparent";
+        case MEMPOOL_TX_SPROUT: return "sprout";
+        case MEMPOOL_TX_SAPLING: return "sapling";
+        case MEMPOOL_TX_COLLATERAL: return "collateral";
+        case MEMPOOL_TX_LOCKED: return "locked";
+        default: return "unknown";
+    }
+}
+
+MemPoolTxClass CTxMemPool::GetTxClass(const CTxMemPoolEntry& entry) const
+{
+    const CTransaction& tx = entry.GetTx();
+    if (setLockRequests.count(tx.GetHash()))
+        return MEMPOOL_TX_LOCKED;
+    if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty())
+        return MEMPOOL_TX_SAPLING;
+    if (!tx.vJoinSplit.empty())
+        return MEMPOOL_TX_SPROUT;
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        if (txout.nValue == 10000 * COIN)
+            return MEMPOOL_TX_COLLATERAL;
+    }
+    return MEMPOOL_TX_TRANSPARENT;
+}
+
+static void UpdateStatsEntry(CMemPoolStatsEntry& stats, const CTxMemPoolEntry& entry, int64_t nCost, int64_t nSign)
+{
+    stats.nCount += nSign;
+    stats.nBytes += nSign * (int64_t)entry.GetTxSize();
+    stats.nUsage += nSign * (int64_t)entry.DynamicMemoryUsage();
+    stats.nCost += nSign * nCost;
+    stats.nFees += nSign * entry.GetFee();
+}
+
+void CTxMemPool::UpdateStats(const CTxMemPoolEntry& entry, int64_t nSign)
+{
+    int64_t nCost = WeightedTxInfo::from(entry.GetTx(), entry.GetFee()).txWeight.cost;
+    UpdateStatsEntry(stats.classes[GetTxClass(entry)], entry, nCost, nSign);
+    // The last bucket whose lower bound the fee rate reaches
+    CAmount nFeeRate = entry.GetFeeRate().GetFeePerK();
+    size_t nBucket = std::upper_bound(stats.vFeeRateBounds.begin(), stats.vFeeRateBounds.end(), nFeeRate) - stats.vFeeRateBounds.begin();
+    UpdateStatsEntry(stats.vFeeRates[nBucket > 0 ? nBucket - 1 : 0], entry, nCost, nSign);
+}
+
+CMemPoolStats CTxMemPool::GetStats() const
+{
+    LOCK(cs);
+    return stats;
+}
+
+void CTxMemPool::SetLockRequest(const uint256& hash)
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator it = mapTx.find(hash);
+    if (it == mapTx.end() || setLockRequests.count(hash))
+        return;
+    UpdateStats(*it, -1);
+    setLockRequests.insert(hash);
+    UpdateStats(*it, 1);
+}
+
+void CTxMemPool::RecordChange(const uint256& hash, bool fAdded)
+{
+    nMempoolSequence++;
+    journal.push_back(std::make_pair(hash, fAdded));
+    if (journal.size() > MEMPOOL_JOURNAL_SIZE)
+        journal.pop_front();
+}
+
+uint64_t CTxMemPool::GetSequence() const
+{
+    LOCK(cs);
+    return nMempoolSequence;
+}
+
+bool CTxMemPool::GetChangesSince(uint64_t nSequence, std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved,
+                                 uint64_t& nCurrentSequence) const
+{
+    LOCK(cs);
+    nCurrentSequence = nMempoolSequence;
+    if (nSequence > nMempoolSequence || nSequence < nMempoolSequence - journal.size())
+        return false;
 
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
+    // The first change to a transaction tells whether it was in the pool
+    // then, mapTx whether it is now
+    std::set<uint256> setSeen;
+    for (size_t i = journal.size() - (nMempoolSequence - nSequence); i < journal.size(); i++) {
+        const uint256& hash = journal[i].first;
+        if (!setSeen.insert(hash).second)
+            continue;
+        bool fWasIn = !journal[i].second;
+        bool fIsIn = mapTx.count(hash);
+        if (!fWasIn && fIsIn)
+            vAdded.push_back(hash);
+        else if (fWasIn && !fIsIn)
+            vRemoved.push_back(hash);
     }
+    return true;
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -98,6 +263,136 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolParents(txiter entry) const
+{
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.parents;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolChildren(txiter entry) const
+{
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.children;
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTransaction& tx, uint64_t nTxSize, setEntries& setAncestors,
+                                           uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                           uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                           std::string& errString) const
+{
+    setEntries parentHashes;
+    for (const CTxIn& txin : tx.vin) {
+        txiter piter = mapTx.find(txin.prevout.hash);
+        if (piter != mapTx.end()) {
+            parentHashes.insert(piter);
+            if (parentHashes.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+
+    uint64_t totalSizeWithAncestors = nTxSize;
+    while (!parentHashes.empty()) {
+        txiter stageit = *parentHashes.begin();
+        parentHashes.erase(stageit);
+        setAncestors.insert(stageit);
+        totalSizeWithAncestors += stageit->GetTxSize();
+
+        if (stageit->GetSizeWithDescendants() + nTxSize > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantSize);
+            return false;
+        } else if (stageit->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantCount);
+            return false;
+        } else if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        }
+
+        for (txiter phash : GetMemPoolParents(stageit)) {
+            if (!setAncestors.count(phash))
+                parentHashes.insert(phash);
+            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateAncestors(const CTransaction& tx, setEntries& setAncestors) const
+{
+    std::string dummy;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    CalculateMemPoolAncestors(tx, 0, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+}
+
+void CTxMemPool::CalculateDescendants(txiter entryit, setEntries& setDescendants) const
+{
+    std::vector<txiter> vToVisit;
+    if (setDescendants.insert(entryit).second)
+        vToVisit.push_back(entryit);
+    while (!vToVisit.empty()) {
+        txiter it = vToVisit.back();
+        vToVisit.pop_back();
+        for (txiter child : GetMemPoolChildren(it)) {
+            if (setDescendants.insert(child).second)
+                vToVisit.push_back(child);
+        }
+    }
+}
+
+CAmount CTxMemPool::GetModifiedFee(const CTxMemPoolEntry& entry) const
+{
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(entry.GetTx().GetHash());
+    return entry.GetFee() + (pos == mapDeltas.end() ? 0 : pos->second.second);
+}
+
+void CTxMemPool::UpdateAncestorState(txiter it)
+{
+    setEntries setAncestors;
+    CalculateAncestors(it->GetTx(), setAncestors);
+    uint64_t nSize = it->GetTxSize();
+    CAmount nFees = GetModifiedFee(*it);
+    for (txiter ancestor : setAncestors) {
+        nSize += ancestor->GetTxSize();
+        nFees += GetModifiedFee(*ancestor);
+    }
+    mapTx.modify(it, set_ancestor_state(nSize, nFees, setAncestors.size() + 1));
+}
+
+void CTxMemPool::UpdateDescendantState(txiter it)
+{
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+    uint64_t nSize = 0;
+    CAmount nFees = 0;
+    for (txiter descendant : setDescendants) {
+        nSize += descendant->GetTxSize();
+        nFees += GetModifiedFee(*descendant);
+    }
+    mapTx.modify(it, set_descendant_state(nSize, nFees, setDescendants.size()));
+}
+
+void CTxMemPool::UpdateFeeDelta(const uint256& hash, CAmount nFeeDelta)
+{
+    txiter it = mapTx.find(hash);
+    if (it == mapTx.end() || nFeeDelta == 0)
+        return;
+    setEntries setAncestors, setDescendants;
+    CalculateAncestors(it->GetTx(), setAncestors);
+    CalculateDescendants(it, setDescendants);
+    for (txiter ancestor : setAncestors)
+        mapTx.modify(ancestor, update_descendant_state(0, nFeeDelta, 0));
+    for (txiter descendant : setDescendants)
+        mapTx.modify(descendant, update_ancestor_state(0, nFeeDelta, 0));
+    mapTx.modify(it, update_descendant_state(0, nFeeDelta, 0));
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
     // Add to memory pool without checking anything.
@@ -105,12 +400,47 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     weightedTxTree->add(WeightedTxInfo::from(entry.GetTx(), entry.GetFee()));
-    mapTx.insert(entry);
-    const CTransaction& tx = mapTx.find(hash)->GetTx();
+    txiter newit = mapTx.insert(entry).first;
+    const CTransaction& tx = newit->GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
-    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    RecordChange(hash, true);
+    UpdateStats(*newit, 1);
+    TxLinks& links = mapLinks[newit];
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+        txiter parent = mapTx.find(tx.vin[i].prevout.hash);
+        if (parent != mapTx.end() && links.parents.insert(parent).second)
+            mapLinks[parent].children.insert(newit);
+    }
+    // Transactions put back after a reorg can have children in the pool
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        nexttx_map::iterator itNext = mapNextTx.find(COutPoint(hash, i));
+        if (itNext == mapNextTx.end())
+            continue;
+        txiter child = mapTx.find(itNext->second.ptx->GetHash());
+        if (child != mapTx.end() && links.children.insert(child).second)
+            mapLinks[child].parents.insert(newit);
+    }
+
+    setEntries setAncestors;
+    CalculateAncestors(tx, setAncestors);
+    UpdateAncestorState(newit);
+    if (links.children.empty()) {
+        for (txiter ancestor : setAncestors)
+            mapTx.modify(ancestor, update_descendant_state(newit->GetTxSize(), GetModifiedFee(*newit), 1));
+    } else {
+        // The new entry joins its ancestors to its descendants, so count
+        // both sides again from scratch
+        UpdateDescendantState(newit);
+        for (txiter ancestor : setAncestors)
+            UpdateDescendantState(ancestor);
+        setEntries setDescendants;
+        CalculateDescendants(newit, setDescendants);
+        for (txiter descendant : setDescendants)
+            UpdateAncestorState(descendant);
+    }
+
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vJoinSplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
             mapSproutNullifiers[nf] = &tx;
@@ -119,10 +449,12 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
     }
+    UpdateAnchors(tx, true);
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
+    TRACE4(mempool, added, hash.begin(), entry.GetTxSize(), entry.GetFee(), mapTx.size());
 
     return true;
 }
@@ -211,7 +543,7 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
 bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
 {
     LOCK(cs);
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::iterator it = mapSpent.find(key);
+    auto it = mapSpent.find(key);
     if (it != mapSpent.end()) {
         value = it->second;
         return true;
@@ -234,64 +566,102 @@ void CTxMemPool::removeSpentIndex(const uint256 txhash)
 }
 // END insightexplorer
 
+void CTxMemPool::RemoveStaged(const setEntries& setRemove, std::list<CTransaction>& removed)
+{
+    // Take the staged entries out of the totals of the relatives that stay
+    for (txiter it : setRemove) {
+        const int64_t nSize = it->GetTxSize();
+        const CAmount nModifiedFee = GetModifiedFee(*it);
+        setEntries setAncestors, setDescendants;
+        CalculateAncestors(it->GetTx(), setAncestors);
+        CalculateDescendants(it, setDescendants);
+        for (txiter ancestor : setAncestors)
+            if (!setRemove.count(ancestor))
+                mapTx.modify(ancestor, update_descendant_state(-nSize, -nModifiedFee, -1));
+        for (txiter descendant : setDescendants)
+            if (!setRemove.count(descendant))
+                mapTx.modify(descendant, update_ancestor_state(-nSize, -nModifiedFee, -1));
+    }
+
+    // A parent always has fewer ancestors than its children, so this order
+    // reports parents before the transactions spending them
+    std::vector<txiter> vRemove(setRemove.begin(), setRemove.end());
+    std::sort(vRemove.begin(), vRemove.end(), [](txiter a, txiter b) {
+        return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+    });
+
+    for (txiter it : vRemove) {
+        const uint256 hash = it->GetTx().GetHash();
+        txlinksMap::iterator itLinks = mapLinks.find(it);
+        assert(itLinks != mapLinks.end());
+        for (txiter parent : itLinks->second.parents) {
+            txlinksMap::iterator itParent = mapLinks.find(parent);
+            if (itParent != mapLinks.end())
+                itParent->second.children.erase(it);
+        }
+        for (txiter child : itLinks->second.children)
+            mapLinks[child].parents.erase(it);
+        mapLinks.erase(itLinks);
+
+        const CTransaction& tx = it->GetTx();
+        mapRecentlyAddedTx.erase(hash);
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            mapNextTx.erase(txin.prevout);
+        BOOST_FOREACH(const JSDescription& joinsplit, tx.vJoinSplit) {
+            BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers) {
+                mapSproutNullifiers.erase(nf);
+            }
+        }
+        for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
+            mapSaplingNullifiers.erase(spendDescription.nullifier);
+        }
+        UpdateAnchors(tx, false);
+        removed.push_back(tx);
+        RecordChange(hash, false);
+        UpdateStats(*it, -1);
+        setLockRequests.erase(hash);
+        totalTxSize -= it->GetTxSize();
+        cachedInnerUsage -= it->DynamicMemoryUsage();
+        TRACE4(mempool, removed, hash.begin(), it->GetTxSize(), it->GetFee(), it->GetTime());
+        mapTx.erase(it);
+        nTransactionsUpdated++;
+        minerPolicyEstimator->removeTx(hash);
+
+        // insightexplorer
+        if (fAddressIndex)
+            removeAddressIndex(hash);
+        if (fSpentIndex)
+            removeSpentIndex(hash);
+    }
+}
+
 void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        std::deque<uint256> txToRemove;
-        txToRemove.push_back(origTx.GetHash());
-        if (fRecursive && !mapTx.count(origTx.GetHash())) {
+        setEntries setRemove;
+        txiter origit = mapTx.find(origTx.GetHash());
+        if (origit != mapTx.end()) {
+            if (fRecursive)
+                CalculateDescendants(origit, setRemove);
+            else
+                setRemove.insert(origit);
+        } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
             // happen during chain re-orgs if origTx isn't re-accepted into
             // the mempool for any reason.
             for (unsigned int i = 0; i < origTx.vout.size(); i++) {
-                std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+                nexttx_map::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
-                txToRemove.push_back(it->second.ptx->GetHash());
+                txiter nextit = mapTx.find(it->second.ptx->GetHash());
+                assert(nextit != mapTx.end());
+                CalculateDescendants(nextit, setRemove);
             }
         }
-        while (!txToRemove.empty())
-        {
-            uint256 hash = txToRemove.front();
-            txToRemove.pop_front();
-            if (!mapTx.count(hash))
-                continue;
-            const CTransaction& tx = mapTx.find(hash)->GetTx();
-            if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
-                        continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
-                }
-            }
-            mapRecentlyAddedTx.erase(hash);
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-            BOOST_FOREACH(const JSDescription& joinsplit, tx.vJoinSplit) {
-                BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers) {
-                    mapSproutNullifiers.erase(nf);
-                }
-            }
-            for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-                mapSaplingNullifiers.erase(spendDescription.nullifier);
-            }
-            removed.push_back(tx);
-            totalTxSize -= mapTx.find(hash)->GetTxSize();
-            cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
-            minerPolicyEstimator->removeTx(hash);
-
-            // insightexplorer
-            if (fAddressIndex)
-                removeAddressIndex(hash);
-            if (fSpentIndex)
-                removeSpentIndex(hash);
-        }
+        RemoveStaged(setRemove, removed);
         for (CTransaction tx : removed) {
             weightedTxTree->remove(tx.GetHash());
         }
@@ -328,41 +698,65 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
 }
 
 
-void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot, ShieldedType type)
+void CTxMemPool::UpdateAnchors(const CTransaction& tx, bool fAdd)
+{
+    const uint256& hash = tx.GetHash();
+    BOOST_FOREACH(const JSDescription& joinsplit, tx.vJoinSplit) {
+        if (fAdd) {
+            mapSproutAnchors[joinsplit.anchor].insert(hash);
+        } else {
+            anchors_map::iterator it = mapSproutAnchors.find(joinsplit.anchor);
+            if (it != mapSproutAnchors.end() && it->second.erase(hash) && it->second.empty())
+                mapSproutAnchors.erase(it);
+        }
+    }
+    BOOST_FOREACH(const SpendDescription& spendDescription, tx.vShieldedSpend) {
+        if (fAdd) {
+            mapSaplingAnchors[spendDescription.anchor].insert(hash);
+        } else {
+            anchors_map::iterator it = mapSaplingAnchors.find(spendDescription.anchor);
+            if (it != mapSaplingAnchors.end() && it->second.erase(hash) && it->second.empty())
+                mapSaplingAnchors.erase(it);
+        }
+    }
+}
+
+void CTxMemPool::removeWithAnchor(const std::set<uint256> &invalidRoots, ShieldedType type)
 {
     // If a block is disconnected from the tip, and the root changed,
     // we must invalidate transactions from the mempool which spend
     // from that root -- almost as though they were spending coinbases
     // which are no longer valid to spend due to coinbase maturity.
     LOCK(cs);
-    list<CTransaction> transactionsToRemove;
 
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->GetTx();
-        switch (type) {
-            case SPROUT:
-                BOOST_FOREACH(const JSDescription& joinsplit, tx.vJoinSplit) {
-                    if (joinsplit.anchor == invalidRoot) {
-                        transactionsToRemove.push_back(tx);
-                        break;
-                    }
-                }
-            break;
-            case SAPLING:
-                BOOST_FOREACH(const SpendDescription& spendDescription, tx.vShieldedSpend) {
-                    if (spendDescription.anchor == invalidRoot) {
-                        transactionsToRemove.push_back(tx);
-                        break;
-                    }
-                }
-            break;
-            default:
-                throw runtime_error("Unknown shielded type");
-            break;
-        }
+    const anchors_map* pmapAnchors;
+    switch (type) {
+        case SPROUT:
+            pmapAnchors = &mapSproutAnchors;
+        break;
+        case SAPLING:
+            pmapAnchors = &mapSaplingAnchors;
+        break;
+        default:
+            throw runtime_error("Unknown shielded type");
+        break;
     }
 
-    BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
+    std::set<uint256> setTxidsToRemove;
+    BOOST_FOREACH(const uint256& root, invalidRoots) {
+        anchors_map::const_iterator it = pmapAnchors->find(root);
+        if (it != pmapAnchors->end())
+            setTxidsToRemove.insert(it->second.begin(), it->second.end());
+    }
+
+    // Copy them out first: removing a transaction frees it and updates the index
+    list<CTransaction> txsToRemove;
+    BOOST_FOREACH(const uint256& hash, setTxidsToRemove) {
+        indexed_transaction_set::const_iterator it = mapTx.find(hash);
+        assert(it != mapTx.end());
+        txsToRemove.push_back(it->GetTx());
+    }
+    BOOST_FOREACH(const CTransaction& tx, txsToRemove) {
         list<CTransaction> removed;
         remove(tx, removed, true);
     }
@@ -374,7 +768,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
     list<CTransaction> result;
     LOCK(cs);
     BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        nexttx_map::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
@@ -386,7 +780,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vJoinSplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapSproutNullifiers.find(nf);
+            nullifiers_map::iterator it = mapSproutNullifiers.find(nf);
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
@@ -396,7 +790,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         }
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-        std::map<uint256, const CTransaction*>::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
+        nullifiers_map::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
@@ -479,6 +873,16 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapLinks.clear();
+    stats = CMemPoolStats();
+    stats.vFeeRateBounds.assign(vFeeRateBounds, vFeeRateBounds + ARRAYLEN(vFeeRateBounds));
+    stats.vFeeRates.resize(stats.vFeeRateBounds.size());
+    setLockRequests.clear();
+    mapSproutAnchors.clear();
+    mapSaplingAnchors.clear();
+    // Callers polling for changes have to start over
+    journal.clear();
+    nMempoolSequence++;
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -520,13 +924,55 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(coins && coins->IsAvailable(txin.prevout.n));
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            nexttx_map::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
             i++;
         }
 
+        // Check the ancestor totals used to select transactions for blocks
+        setEntries setAncestors;
+        CalculateAncestors(tx, setAncestors);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = GetModifiedFee(*it);
+        for (txiter ancestor : setAncestors) {
+            nSizeCheck += ancestor->GetTxSize();
+            nFeesCheck += GetModifiedFee(*ancestor);
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetFeesWithAncestors() == nFeesCheck);
+
+        // Check the links to in-pool parents and children, and the descendant totals
+        setEntries setParentCheck, setChildrenCheck;
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            txiter parent = mapTx.find(txin.prevout.hash);
+            if (parent != mapTx.end())
+                setParentCheck.insert(parent);
+        }
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            nexttx_map::const_iterator itNext = mapNextTx.find(COutPoint(tx.GetHash(), n));
+            if (itNext == mapNextTx.end())
+                continue;
+            txiter child = mapTx.find(itNext->second.ptx->GetHash());
+            assert(child != mapTx.end());
+            setChildrenCheck.insert(child);
+        }
+        assert(setParentCheck == GetMemPoolParents(it));
+        assert(setChildrenCheck == GetMemPoolChildren(it));
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        nSizeCheck = 0;
+        nFeesCheck = 0;
+        for (txiter descendant : setDescendants) {
+            nSizeCheck += descendant->GetTxSize();
+            nFeesCheck += GetModifiedFee(*descendant);
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size());
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetFeesWithDescendants() == nFeesCheck);
+
         boost::unordered_map<uint256, SproutMerkleTree, CCoinsKeyHasher> intermediates;
 
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vJoinSplit) {
@@ -582,7 +1028,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
+    for (nexttx_map::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
         indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->GetTx();
@@ -594,6 +1040,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     checkNullifiers(SPROUT);
     checkNullifiers(SAPLING);
+    checkAnchors();
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
@@ -601,7 +1048,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
 void CTxMemPool::checkNullifiers(ShieldedType type) const
 {
-    const std::map<uint256, const CTransaction*>* mapToUse;
+    const nullifiers_map* mapToUse;
     switch (type) {
         case SPROUT:
             mapToUse = &mapSproutNullifiers;
@@ -621,6 +1068,36 @@ void CTxMemPool::checkNullifiers(ShieldedType type) const
     }
 }
 
+void CTxMemPool::checkAnchors() const
+{
+    size_t nSproutEntries = 0, nSaplingEntries = 0;
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
+        std::set<uint256> setSprout, setSapling;
+        BOOST_FOREACH(const JSDescription& joinsplit, tx.vJoinSplit)
+            setSprout.insert(joinsplit.anchor);
+        BOOST_FOREACH(const SpendDescription& spendDescription, tx.vShieldedSpend)
+            setSapling.insert(spendDescription.anchor);
+        BOOST_FOREACH(const uint256& anchor, setSprout) {
+            anchors_map::const_iterator itAnchor = mapSproutAnchors.find(anchor);
+            assert(itAnchor != mapSproutAnchors.end() && itAnchor->second.count(tx.GetHash()));
+        }
+        BOOST_FOREACH(const uint256& anchor, setSapling) {
+            anchors_map::const_iterator itAnchor = mapSaplingAnchors.find(anchor);
+            assert(itAnchor != mapSaplingAnchors.end() && itAnchor->second.count(tx.GetHash()));
+        }
+        nSproutEntries += setSprout.size();
+        nSaplingEntries += setSapling.size();
+    }
+    // No entries left behind by removed transactions
+    for (const auto& entry : mapSproutAnchors)
+        nSproutEntries -= entry.second.size();
+    for (const auto& entry : mapSaplingAnchors)
+        nSaplingEntries -= entry.second.size();
+    assert(nSproutEntries == 0);
+    assert(nSaplingEntries == 0);
+}
+
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 {
     vtxid.clear();
@@ -645,11 +1122,21 @@ CFeeRate CTxMemPool::estimateFee(int nBlocks) const
     LOCK(cs);
     return minerPolicyEstimator->estimateFee(nBlocks);
 }
+CFeeRate CTxMemPool::estimateSmartFee(int nBlocks, int *answerFoundAtBlocks) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->estimateSmartFee(nBlocks, answerFoundAtBlocks);
+}
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
     LOCK(cs);
     return minerPolicyEstimator->estimatePriority(nBlocks);
 }
+double CTxMemPool::estimateSmartPriority(int nBlocks, int *answerFoundAtBlocks) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->estimateSmartPriority(nBlocks, answerFoundAtBlocks);
+}
 
 bool
 CTxMemPool::WriteFeeEstimates(CAutoFile& fileout) const
@@ -693,6 +1180,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        UpdateFeeDelta(hash, nFeeDelta);
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -711,7 +1199,12 @@ void CTxMemPool::ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount
 void CTxMemPool::ClearPrioritisation(const uint256 hash)
 {
     LOCK(cs);
-    mapDeltas.erase(hash);
+    std::map<uint256, std::pair<double, CAmount> >::iterator pos = mapDeltas.find(hash);
+    if (pos == mapDeltas.end())
+        return;
+    CAmount nFeeDelta = pos->second.second;
+    mapDeltas.erase(pos);
+    UpdateFeeDelta(hash, -nFeeDelta);
 }
 
 bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
@@ -777,7 +1270,7 @@ bool CTxMemPool::IsFullyNotified() {
     return nRecentlyAddedSequence == nNotifiedSequence;
 }
 
-std::map<uint256, const CTransaction*> CTxMemPool::getNullifiers() {
+CTxMemPool::nullifiers_map CTxMemPool::getNullifiers() {
     return mapSaplingNullifiers;
 }
 
@@ -807,7 +1300,34 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+}
+
+CMemPoolUsage CTxMemPool::GetMemoryUsage() const {
+    LOCK(cs);
+    CMemPoolUsage usage;
+    usage.nTransactions = memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + cachedInnerUsage;
+    usage.nLinks = memusage::DynamicUsage(mapLinks);
+    for (txlinksMap::const_iterator it = mapLinks.begin(); it != mapLinks.end(); it++)
+        usage.nLinks += memusage::DynamicUsage(it->second.parents) + memusage::DynamicUsage(it->second.children);
+    usage.nSpends = memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapSproutNullifiers) +
+                    memusage::DynamicUsage(mapSaplingNullifiers) +
+                    memusage::DynamicUsage(mapSproutAnchors) + memusage::DynamicUsage(mapSaplingAnchors);
+    for (const auto& entry : mapSproutAnchors)
+        usage.nSpends += memusage::DynamicUsage(entry.second);
+    for (const auto& entry : mapSaplingAnchors)
+        usage.nSpends += memusage::DynamicUsage(entry.second);
+    usage.nAddressIndex = memusage::DynamicUsage(mapAddress) + memusage::DynamicUsage(mapAddressInserted) +
+                          memusage::DynamicUsage(mapSpent) + memusage::DynamicUsage(mapSpentInserted);
+    for (const auto& inserted : mapAddressInserted)
+        usage.nAddressIndex += memusage::DynamicUsage(inserted.second);
+    for (const auto& inserted : mapSpentInserted)
+        usage.nAddressIndex += memusage::DynamicUsage(inserted.second);
+    usage.nOther = memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapRecentlyAddedTx) +
+                   memusage::DynamicUsage(setLockRequests) +
+                   memusage::MallocUsage(journal.size() * sizeof(std::pair<uint256, bool>)) +
+                   recentlyEvicted->DynamicMemoryUsage();
+    return usage;
 }
 
 void CTxMemPool::SetMempoolCostLimit(int64_t totalCostLimit, int64_t evictionMemorySeconds) {
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -14,6 +16,7 @@
 #include "coins.h"
 #include "mempool_limit.h"
 #include "primitives/transaction.h"
+#include "support/allocators/pool.h"
 #include "sync.h"
 #include "addressindex.h"
 #include "spentindex.h"
@@ -22,6 +25,8 @@
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
+#include <boost/unordered_map.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -38,6 +43,51 @@ inline bool AllowFree(double dPriority)
 
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Number of additions and removals kept for GetChangesSince */
+static const size_t MEMPOOL_JOURNAL_SIZE = 50000;
+
+/** The kinds of transactions the mempool statistics are broken out by */
+enum MemPoolTxClass {
+    MEMPOOL_TX_TRANSPARENT,
+    MEMPOOL_TX_SPROUT,
+    MEMPOOL_TX_SAPLING,
+    MEMPOOL_TX_COLLATERAL,  //!< pays a zeronode collateral output
+    MEMPOOL_TX_LOCKED,      //!< a SwiftTX lock request
+    MEMPOOL_TX_CLASS_COUNT
+};
+
+const char* GetMemPoolTxClassName(MemPoolTxClass txClass);
+
+/** Totals over a group of mempool transactions */
+struct CMemPoolStatsEntry
+{
+    uint64_t nCount = 0;
+    uint64_t nBytes = 0;
+    uint64_t nUsage = 0;  //!< dynamic memory usage
+    uint64_t nCost = 0;   //!< cost counted against -mempooltxcostlimit
+    CAmount nFees = 0;
+};
+
+/** The mempool broken out by transaction class and by fee rate */
+struct CMemPoolStats
+{
+    CMemPoolStatsEntry classes[MEMPOOL_TX_CLASS_COUNT];
+    //! Lower bounds of the fee rate buckets, in zatoshis per kB
+    std::vector<CAmount> vFeeRateBounds;
+    std::vector<CMemPoolStatsEntry> vFeeRates;
+};
+
+/** The dynamic memory usage of the mempool broken out by index */
+struct CMemPoolUsage
+{
+    size_t nTransactions = 0; //!< mapTx and the transactions in it
+    size_t nLinks = 0;        //!< mapLinks, with the parent and child sets
+    size_t nSpends = 0;       //!< mapNextTx, the nullifier and the anchor maps
+    size_t nAddressIndex = 0; //!< insightexplorer address and spent indexes
+    size_t nOther = 0;        //!< deltas, recent additions, lock requests, change journal and evictions
+
+    size_t Total() const { return nTransactions + nLinks + nSpends + nAddressIndex + nOther; }
+};
 
 /**
  * CTxMemPool stores these:
@@ -58,6 +108,17 @@ private:
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     uint32_t nBranchId;        //!< Branch ID this transaction is known to commit to, cached for efficiency
 
+    // Totals over this transaction and its unconfirmed ancestors, and over
+    // it and its descendants, in the pool. CTxMemPool keeps them up to date
+    // as transactions come and go. The fees include prioritisetransaction
+    // deltas.
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nFeesWithAncestors;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nFeesWithDescendants;
+
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _dPriority, unsigned int _nHeight,
@@ -77,6 +138,81 @@ public:
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetFeesWithAncestors() const { return nFeesWithAncestors; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetFeesWithDescendants() const { return nFeesWithDescendants; }
+
+    //! Add the given amounts to the ancestor totals (negative to take an ancestor away)
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void SetAncestorState(uint64_t nSize, CAmount nFees, uint64_t nCount);
+    //! Add the given amounts to the descendant totals (negative to take a descendant away)
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void SetDescendantState(uint64_t nSize, CAmount nFees, uint64_t nCount);
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct set_ancestor_state
+{
+    set_ancestor_state(uint64_t _nSize, CAmount _nFees, uint64_t _nCount) :
+        nSize(_nSize), nFees(_nFees), nCount(_nCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.SetAncestorState(nSize, nFees, nCount); }
+
+    private:
+        uint64_t nSize;
+        CAmount nFees;
+        uint64_t nCount;
+};
+
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct set_descendant_state
+{
+    set_descendant_state(uint64_t _nSize, CAmount _nFees, uint64_t _nCount) :
+        nSize(_nSize), nFees(_nFees), nCount(_nCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.SetDescendantState(nSize, nFees, nCount); }
+
+    private:
+        uint64_t nSize;
+        CAmount nFees;
+        uint64_t nCount;
 };
 
 // extracts a TxMemPoolEntry's transaction hash
@@ -92,7 +228,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         if (a.GetFeeRate() == b.GetFeeRate())
             return a.GetTime() < b.GetTime();
@@ -100,6 +236,23 @@ public:
     }
 };
 
+/**
+ * Sort by the fee rate of a transaction together with its unconfirmed
+ * ancestors, which is what a miner earns per byte for including it.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return a.GetTime() < b.GetTime();
+        return f1 > f2;
+    }
+};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -116,6 +269,34 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/** Salted hasher for outpoints, keyed like CCoinsKeyHasher */
+class CMemPoolOutPointHasher
+{
+private:
+    uint256 salt;
+
+public:
+    CMemPoolOutPointHasher();
+
+    size_t operator()(const COutPoint& out) const {
+        return out.hash.GetHash(salt) ^ out.n;
+    }
+};
+
+/** Salted hasher for spent index keys */
+class CSpentIndexKeyHasher
+{
+private:
+    uint256 salt;
+
+public:
+    CSpentIndexKeyHasher();
+
+    size_t operator()(const CSpentIndexKey& key) const {
+        return key.txid.GetHash(salt) ^ key.outputIndex;
+    }
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -138,14 +319,42 @@ private:
 
     std::map<uint256, const CTransaction*> mapRecentlyAddedTx;
     uint64_t nRecentlyAddedSequence = 0;
+
+    //! Statistics kept up to date as transactions come and go
+    CMemPoolStats stats;
+    //! SwiftTX lock requests, counted as MEMPOOL_TX_LOCKED
+    std::set<uint256> setLockRequests;
+    MemPoolTxClass GetTxClass(const CTxMemPoolEntry& entry) const;
+    void UpdateStats(const CTxMemPoolEntry& entry, int64_t nSign);
+
+    //! Bumped on every addition and removal
+    uint64_t nMempoolSequence = 0;
+    //! The latest changes, as txid and whether it was added, ending at nMempoolSequence
+    std::deque<std::pair<uint256, bool> > journal;
+    void RecordChange(const uint256& hash, bool fAdded);
     uint64_t nNotifiedSequence = 0;
 
-    std::map<uint256, const CTransaction*> mapSproutNullifiers;
-    std::map<uint256, const CTransaction*> mapSaplingNullifiers;
+public:
+    // The indexes probed for every input and shielded spend are hashed, with
+    // their nodes on a pool allocator
+    typedef boost::unordered_map<uint256, const CTransaction*, CCoinsKeyHasher, std::equal_to<uint256>,
+                                 CPoolAllocator<std::pair<const uint256, const CTransaction*> > > nullifiers_map;
+    typedef boost::unordered_map<COutPoint, CInPoint, CMemPoolOutPointHasher, std::equal_to<COutPoint>,
+                                 CPoolAllocator<std::pair<const COutPoint, CInPoint> > > nexttx_map;
+
+private:
+    nullifiers_map mapSproutNullifiers;
+    nullifiers_map mapSaplingNullifiers;
+    //! The transactions spending from each anchor, so removeWithAnchor only visits those it evicts
+    typedef std::map<uint256, std::set<uint256> > anchors_map;
+    anchors_map mapSproutAnchors;
+    anchors_map mapSaplingAnchors;
+    void UpdateAnchors(const CTransaction& tx, bool fAdd);
     RecentlyEvictedList* recentlyEvicted = new RecentlyEvictedList(DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES * 60);
     WeightedTxTree* weightedTxTree = new WeightedTxTree(DEFAULT_MEMPOOL_TOTAL_COST_LIMIT);
 
     void checkNullifiers(ShieldedType type) const;
+    void checkAnchors() const;
 
 public:
     typedef boost::multi_index_container<
@@ -157,28 +366,80 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
+            >,
+            // sorted by fee rate including unconfirmed ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
             >
         >
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
     indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+    /**
+     * The unconfirmed ancestors of a transaction, which need not be in the
+     * pool itself. Fails, with a reason in errString, if the transaction
+     * would take a chain past one of the limits. (cs must be held)
+     */
+    bool CalculateMemPoolAncestors(const CTransaction& tx, uint64_t nTxSize, setEntries& setAncestors,
+                                   uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                   uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                   std::string& errString) const;
+    void CalculateAncestors(const CTransaction& tx, setEntries& setAncestors) const;
+    /** Add an entry and its descendants in the pool to setDescendants (cs must be held) */
+    void CalculateDescendants(txiter it, setEntries& setDescendants) const;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    //! The in-pool parents and children of each entry
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    /** The fee of an entry including any prioritisetransaction delta */
+    CAmount GetModifiedFee(const CTxMemPoolEntry& entry) const;
+    /** Recompute the ancestor or descendant totals of an entry from scratch */
+    void UpdateAncestorState(txiter it);
+    void UpdateDescendantState(txiter it);
+    /** Apply a change in the fee delta of a transaction to it and its relatives */
+    void UpdateFeeDelta(const uint256& hash, CAmount nFeeDelta);
+    /** Remove a set of entries, keeping the totals of the relatives left behind right */
+    void RemoveStaged(const setEntries& setRemove, std::list<CTransaction>& removed);
+
+public:
 
 private:
     // insightexplorer
+    // mapAddress stays ordered for the range scans of getAddressIndex
     std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
-    std::map<uint256, std::vector<CMempoolAddressDeltaKey> > mapAddressInserted;
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpent;
-    std::map<uint256, std::vector<CSpentIndexKey>> mapSpentInserted;
+    boost::unordered_map<uint256, std::vector<CMempoolAddressDeltaKey>, CCoinsKeyHasher> mapAddressInserted;
+    boost::unordered_map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyHasher, std::equal_to<CSpentIndexKey>,
+                         CPoolAllocator<std::pair<const CSpentIndexKey, CSpentIndexValue> > > mapSpent;
+    boost::unordered_map<uint256, std::vector<CSpentIndexKey>, CCoinsKeyHasher> mapSpentInserted;
 
 public:
-    std::map<COutPoint, CInPoint> mapNextTx;
+    nexttx_map mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
-    std::map<uint256, const CTransaction*> getNullifiers();
+    nullifiers_map getNullifiers();
     
     /**
      * If sanity-checking is turned on, check makes sure the pool is
@@ -203,7 +464,8 @@ public:
     // END insightexplorer
 
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
-    void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
+    /** Remove the transactions spending from any of the given (no longer valid) anchors */
+    void removeWithAnchor(const std::set<uint256> &invalidRoots, ShieldedType type);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
     void removeExpired(unsigned int nBlockHeight);
@@ -214,6 +476,17 @@ public:
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
+    uint64_t GetSequence() const;
+    CMemPoolStats GetStats() const;
+    /** Count a transaction in the pool as a SwiftTX lock request from now on */
+    void SetLockRequest(const uint256& hash);
+    /**
+     * The transactions added to and removed from the pool since it was at
+     * nSequence, with the current sequence. Returns false if nSequence is
+     * older than the changes kept (or in the future).
+     */
+    bool GetChangesSince(uint64_t nSequence, std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved,
+                         uint64_t& nCurrentSequence) const;
     void AddTransactionsUpdated(unsigned int n);
     /**
      * Check that none of this transactions inputs are in the mempool, and thus
@@ -254,14 +527,30 @@ public:
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
+    /**
+     * Estimate fee rate needed to get into the next nBlocks
+     * If no answer can be given at nBlocks, return an estimate
+     * at the lowest number of blocks where one can be given
+     */
+    CFeeRate estimateSmartFee(int nBlocks, int *answerFoundAtBlocks = NULL) const;
+
     /** Estimate priority needed to get into the next nBlocks */
     double estimatePriority(int nBlocks) const;
 
+    /**
+     * Estimate priority needed to get into the next nBlocks
+     * If no answer can be given at nBlocks, return an estimate
+     * at the lowest number of blocks where one can be given
+     */
+    double estimateSmartPriority(int nBlocks, int *answerFoundAtBlocks = NULL) const;
+
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
 
     size_t DynamicMemoryUsage() const;
+    /** Usage of every index, including the ones DynamicMemoryUsage leaves out */
+    CMemPoolUsage GetMemoryUsage() const;
 
     /** Return nCheckFrequency */
     uint32_t GetCheckFrequency() const {
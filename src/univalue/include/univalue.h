@@ -11,6 +11,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <cassert>
 
 #include <sstream>        // .get_int64()
@@ -143,11 +145,24 @@ public:
     }
 
 private:
+    struct KeyIndex {
+        std::unordered_map<std::string, size_t> mapPos;
+        size_t nKeys;                      // how many of keys are indexed
+        KeyIndex() : nKeys(0) {}
+    };
+
     UniValue::VType typ;
     std::string val;                       // numbers are stored as C++ strings
     std::vector<std::string> keys;
     std::vector<UniValue> values;
+    // Position of the first occurrence of each key, kept only for objects
+    // of at least INDEX_MIN_KEYS keys; shared between copies until one of
+    // them adds a key
+    std::shared_ptr<KeyIndex> keyIndex;
+
+    static const size_t INDEX_MIN_KEYS = 16;
 
+    void indexKeys();
     bool findKey(const std::string& key, size_t& ret) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
@@ -83,6 +83,7 @@ void UniValue::clear()
     val.clear();
     keys.clear();
     values.clear();
+    keyIndex.reset();
 }
 
 bool UniValue::setNull()
@@ -196,6 +197,7 @@ bool UniValue::pushKV(const std::string& key, const UniValue& val_)
 
     keys.push_back(key);
     values.push_back(val_);
+    indexKeys();
     return true;
 }
 
@@ -208,12 +210,38 @@ bool UniValue::pushKVs(const UniValue& obj)
         keys.push_back(obj.keys[i]);
         values.push_back(obj.values.at(i));
     }
+    indexKeys();
 
     return true;
 }
 
+void UniValue::indexKeys()
+{
+    if (keys.size() < INDEX_MIN_KEYS)
+        return;
+
+    if (!keyIndex)
+        keyIndex = std::make_shared<KeyIndex>();
+    else if (keyIndex.use_count() > 1)
+        keyIndex = std::make_shared<KeyIndex>(*keyIndex);
+
+    // A repeated key keeps the position it was first seen at, as the
+    // linear search would find it
+    for (size_t i = keyIndex->nKeys; i < keys.size(); i++)
+        keyIndex->mapPos.insert(std::make_pair(keys[i], i));
+    keyIndex->nKeys = keys.size();
+}
+
 bool UniValue::findKey(const std::string& key, size_t& ret) const
 {
+    if (keyIndex) {
+        std::unordered_map<std::string, size_t>::const_iterator it = keyIndex->mapPos.find(key);
+        if (it == keyIndex->mapPos.end())
+            return false;
+        ret = it->second;
+        return true;
+    }
+
     for (size_t i = 0; i < keys.size(); i++) {
         if (keys[i] == key) {
             ret = i;
@@ -278,9 +306,9 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value(const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-        if (obj.keys[i] == name)
-            return obj.values.at(i);
+    size_t index;
+    if (obj.findKey(name, index))
+        return obj.values.at(index);
 
     return NullUniValue;
 }
@@ -42,10 +42,26 @@ static const char *hatoui(const char *first, const char *last,
     return first;
 }
 
-enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
-                            const char *raw, const char *end)
+// True for the characters a string may hold as they are: printable ASCII
+// other than the quote and the backslash
+static inline bool json_isplain(unsigned char ch)
 {
-    tokenVal.clear();
+    return ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\';
+}
+
+/**
+ * Tokenize the next token from raw, without copying it where it can be
+ * avoided: a number, or a string with no escapes or non-ASCII characters,
+ * is returned as a view [tokenBegin, tokenBegin + tokenLen) of the input.
+ * Any other string is unescaped into tokenBuf, which the view then points
+ * into.
+ */
+static enum jtokentype getJsonTokenView(const char*& tokenBegin, size_t& tokenLen,
+                                        string& tokenBuf, unsigned int& consumed,
+                                        const char *raw, const char *end)
+{
+    tokenBegin = raw;
+    tokenLen = 0;
     consumed = 0;
 
     const char *rawStart = raw;
@@ -87,15 +103,15 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case 'n':
     case 't':
     case 'f':
-        if (!strncmp(raw, "null", 4)) {
+        if (end - raw >= 4 && !memcmp(raw, "null", 4)) {
             raw += 4;
             consumed = (raw - rawStart);
             return JTOK_KW_NULL;
-        } else if (!strncmp(raw, "true", 4)) {
+        } else if (end - raw >= 4 && !memcmp(raw, "true", 4)) {
             raw += 4;
             consumed = (raw - rawStart);
             return JTOK_KW_TRUE;
-        } else if (!strncmp(raw, "false", 5)) {
+        } else if (end - raw >= 5 && !memcmp(raw, "false", 5)) {
             raw += 5;
             consumed = (raw - rawStart);
             return JTOK_KW_FALSE;
@@ -114,59 +130,47 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '8':
     case '9': {
         // part 1: int
-        string numStr;
-
         const char *first = raw;
 
         const char *firstDigit = first;
         if (!json_isdigit(*firstDigit))
             firstDigit++;
-        if ((*firstDigit == '0') && json_isdigit(firstDigit[1]))
+        if (firstDigit + 1 < end && (*firstDigit == '0') && json_isdigit(firstDigit[1]))
             return JTOK_ERR;
 
-        numStr += *raw;                       // copy first char
-        raw++;
+        raw++;                                // first char
 
         if ((*first == '-') && (raw < end) && (!json_isdigit(*raw)))
             return JTOK_ERR;
 
-        while (raw < end && json_isdigit(*raw)) {  // copy digits
-            numStr += *raw;
+        while (raw < end && json_isdigit(*raw))   // digits
             raw++;
-        }
 
         // part 2: frac
         if (raw < end && *raw == '.') {
-            numStr += *raw;                   // copy .
-            raw++;
+            raw++;                            // .
 
             if (raw >= end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while (raw < end && json_isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw)) // digits
                 raw++;
-            }
         }
 
         // part 3: exp
         if (raw < end && (*raw == 'e' || *raw == 'E')) {
-            numStr += *raw;                   // copy E
-            raw++;
+            raw++;                            // E
 
-            if (raw < end && (*raw == '-' || *raw == '+')) { // copy +/-
-                numStr += *raw;
+            if (raw < end && (*raw == '-' || *raw == '+')) // +/-
                 raw++;
-            }
 
             if (raw >= end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while (raw < end && json_isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw)) // digits
                 raw++;
-            }
         }
 
-        tokenVal = numStr;
+        tokenBegin = first;
+        tokenLen = raw - first;
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
@@ -174,8 +178,21 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '"': {
         raw++;                                // skip "
 
-        string valStr;
-        JSONUTF8StringFilter writer(valStr);
+        // Fast path: a run of plain characters up to the closing quote
+        // is the token itself
+        const char *first = raw;
+        while (raw < end && json_isplain(*raw))
+            raw++;
+        if (raw < end && *raw == '"') {
+            tokenBegin = first;
+            tokenLen = raw - first;
+            raw++;                            // skip "
+            consumed = (raw - rawStart);
+            return JTOK_STRING;
+        }
+
+        tokenBuf.assign(first, raw);
+        JSONUTF8StringFilter writer(tokenBuf);
 
         while (raw < end) {
             if ((unsigned char)*raw < 0x20)
@@ -228,7 +245,8 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
 
         if (!writer.finalize())
             return JTOK_ERR;
-        tokenVal = valStr;
+        tokenBegin = tokenBuf.data();
+        tokenLen = tokenBuf.size();
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -238,6 +256,18 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     }
 }
 
+enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
+                            const char *raw, const char *end)
+{
+    const char *tokenBegin;
+    size_t tokenLen;
+    string tokenBuf;
+    enum jtokentype tok = getJsonTokenView(tokenBegin, tokenLen, tokenBuf,
+                                           consumed, raw, end);
+    tokenVal.assign(tokenBegin, tokenLen);
+    return tok;
+}
+
 enum expect_bits {
     EXP_OBJ_NAME = (1U << 0),
     EXP_COLON = (1U << 1),
@@ -257,7 +287,9 @@ bool UniValue::read(const char *raw, size_t size)
     uint32_t expectMask = 0;
     vector<UniValue*> stack;
 
-    string tokenVal;
+    const char *tokenBegin;
+    size_t tokenLen;
+    string tokenBuf;
     unsigned int consumed;
     enum jtokentype tok = JTOK_NONE;
     enum jtokentype last_tok = JTOK_NONE;
@@ -265,7 +297,7 @@ bool UniValue::read(const char *raw, size_t size)
     do {
         last_tok = tok;
 
-        tok = getJsonToken(tokenVal, consumed, raw, end);
+        tok = getJsonTokenView(tokenBegin, tokenLen, tokenBuf, consumed, raw, end);
         if (tok == JTOK_NONE || tok == JTOK_ERR)
             return false;
         raw += consumed;
@@ -342,6 +374,8 @@ bool UniValue::read(const char *raw, size_t size)
             if (utyp != top->getType())
                 return false;
 
+            if (utyp == VOBJ)
+                top->indexKeys();
             stack.pop_back();
             clearExpect(OBJ_NAME);
             setExpect(NOT_VALUE);
@@ -403,14 +437,17 @@ bool UniValue::read(const char *raw, size_t size)
             }
 
         case JTOK_NUMBER: {
-            UniValue tmpVal(VNUM, tokenVal);
             if (!stack.size()) {
-                *this = tmpVal;
+                typ = VNUM;
+                val.assign(tokenBegin, tokenLen);
                 break;
             }
 
+            // Build the value in place, copying the token once
             UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            top->values.push_back(UniValue());
+            top->values.back().typ = VNUM;
+            top->values.back().val.assign(tokenBegin, tokenLen);
 
             setExpect(NOT_VALUE);
             break;
@@ -419,17 +456,19 @@ bool UniValue::read(const char *raw, size_t size)
         case JTOK_STRING: {
             if (expect(OBJ_NAME)) {
                 UniValue *top = stack.back();
-                top->keys.push_back(tokenVal);
+                top->keys.push_back(string(tokenBegin, tokenLen));
                 clearExpect(OBJ_NAME);
                 setExpect(COLON);
             } else {
-                UniValue tmpVal(VSTR, tokenVal);
                 if (!stack.size()) {
-                    *this = tmpVal;
+                    typ = VSTR;
+                    val.assign(tokenBegin, tokenLen);
                     break;
                 }
                 UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
+                top->values.push_back(UniValue());
+                top->values.back().typ = VSTR;
+                top->values.back().val.assign(tokenBegin, tokenLen);
             }
 
             setExpect(NOT_VALUE);
@@ -442,7 +481,7 @@ bool UniValue::read(const char *raw, size_t size)
     } while (!stack.empty ());
 
     /* Check that nothing follows the initial construct (parsed above).  */
-    tok = getJsonToken(tokenVal, consumed, raw, end);
+    tok = getJsonTokenView(tokenBegin, tokenLen, tokenBuf, consumed, raw, end);
     if (tok != JTOK_NONE)
         return false;
 
@@ -18,6 +18,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <atomic>
 
 #if (defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
 #include <pthread.h>
@@ -551,6 +552,34 @@ const boost::filesystem::path &ZC_GetParamsDir()
     return path;
 }
 
+static std::atomic<bool> fParamsLoading(false);
+static boost::mutex csParamsLoading;
+static boost::condition_variable condParamsLoaded;
+
+void ZC_SetParamsLoading()
+{
+    boost::unique_lock<boost::mutex> lock(csParamsLoading);
+    fParamsLoading = true;
+}
+
+void ZC_SetParamsLoaded()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csParamsLoading);
+        fParamsLoading = false;
+    }
+    condParamsLoaded.notify_all();
+}
+
+void ZC_WaitForParams()
+{
+    if (!fParamsLoading)
+        return;
+    boost::unique_lock<boost::mutex> lock(csParamsLoading);
+    while (fParamsLoading)
+        condParamsLoaded.wait(lock);
+}
+
 // Return the user specified export directory.  Create directory if it doesn't exist.
 // If user did not set option, return an empty path.
 // If there is a filesystem problem, throw an exception.
@@ -123,6 +123,14 @@ static inline bool error(const char* format)
 }
 
 const boost::filesystem::path &ZC_GetParamsDir();
+/**
+ * The zk-SNARK parameters are loaded in the background at startup. Code
+ * about to create or verify a proof calls ZC_WaitForParams, which returns
+ * at once unless ZC_SetParamsLoading was called and ZC_SetParamsLoaded not yet.
+ */
+void ZC_SetParamsLoading();
+void ZC_SetParamsLoaded();
+void ZC_WaitForParams();
 
 void PrintExceptionContinue(const std::exception *pex, const char* pszThread);
 void ParseParameters(int argc, const char*const argv[]);
@@ -13,6 +13,10 @@
 #include <iomanip>
 #include <limits>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 static const string CHARS_ALPHA_NUM = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
@@ -87,22 +91,106 @@ signed char HexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
+#ifdef __SSE2__
+/** Convert 16 nibbles, 0 to 15, to their lowercase hex digits */
+static inline __m128i HexDigits16(__m128i nibbles)
+{
+    __m128i above9 = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    __m128i digits = _mm_add_epi8(nibbles, _mm_set1_epi8('0'));
+    return _mm_add_epi8(digits, _mm_and_si128(above9, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+/**
+ * Decode the 16 hex digits at psz into 8 bytes at out, or return false,
+ * writing nothing, if any of them is not a hex digit.
+ */
+static inline bool DecodeHex16(const char* psz, unsigned char* out)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i*)psz);
+    __m128i folded = _mm_or_si128(chars, _mm_set1_epi8(0x20)); // 'A'-'F' to 'a'-'f'
+    // Signed compares, so bytes of 0x80 and over are in neither range
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                                    _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                                    _mm_cmplt_epi8(folded, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xffff)
+        return false;
+    __m128i nibbles = _mm_or_si128(
+        _mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+        _mm_and_si128(isAlpha, _mm_sub_epi8(folded, _mm_set1_epi8('a' - 10))));
+    // Each 16 bit lane holds the high nibble in its low byte and the low nibble in its high byte
+    __m128i bytes = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(nibbles, 4), _mm_set1_epi16(0xf0)),
+                                 _mm_srli_epi16(nibbles, 8));
+    _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(bytes, bytes));
+    return true;
+}
+#else
+static inline bool DecodeHex16(const char* psz, unsigned char* out)
+{
+    unsigned char buf[8];
+    for (int i = 0; i < 8; i++) {
+        signed char hi = HexDigit(psz[2 * i]);
+        signed char lo = HexDigit(psz[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        buf[i] = (hi << 4) | lo;
+    }
+    memcpy(out, buf, 8);
+    return true;
+}
+#endif
+
+void HexEncode(const unsigned char* pch, size_t len, char* out)
+{
+    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(pch + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0f));
+        __m128i lo = _mm_and_si128(bytes, _mm_set1_epi8(0x0f));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), HexDigits16(_mm_unpacklo_epi8(hi, lo)));
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 16), HexDigits16(_mm_unpackhi_epi8(hi, lo)));
+    }
+#endif
+    for (; i < len; i++) {
+        out[2 * i] = hexmap[pch[i] >> 4];
+        out[2 * i + 1] = hexmap[pch[i] & 15];
+    }
+}
+
 bool IsHex(const string& str)
 {
-    for(std::string::const_iterator it(str.begin()); it != str.end(); ++it)
-    {
-        if (HexDigit(*it) < 0)
+    if (str.empty() || str.size() % 2 != 0)
+        return false;
+    size_t i = 0;
+    unsigned char buf[8];
+    for (; i + 16 <= str.size(); i += 16) {
+        if (!DecodeHex16(str.data() + i, buf))
             return false;
     }
-    return (str.size() > 0) && (str.size()%2 == 0);
+    for (; i < str.size(); i++) {
+        if (HexDigit(str[i]) < 0)
+            return false;
+    }
+    return true;
 }
 
-vector<unsigned char> ParseHex(const char* psz)
+/** ParseHex of the len chars at psz, which end at a NUL */
+static vector<unsigned char> ParseHex(const char* psz, size_t len)
 {
     // convert hex dump to vector
-    vector<unsigned char> vch;
+    vector<unsigned char> vch(len / 2);
+    const char* pend = psz + len;
+    size_t nOut = 0;
     while (true)
     {
+        // Runs of digits 16 at a time, then one pair at a time past spaces
+        while (pend - psz >= 16 && DecodeHex16(psz, &vch[nOut])) {
+            psz += 16;
+            nOut += 8;
+        }
         while (isspace(*psz))
             psz++;
         signed char c = HexDigit(*psz++);
@@ -113,11 +201,17 @@ vector<unsigned char> ParseHex(const char* psz)
         if (c == (signed char)-1)
             break;
         n |= c;
-        vch.push_back(n);
+        vch[nOut++] = n;
     }
+    vch.resize(nOut);
     return vch;
 }
 
+vector<unsigned char> ParseHex(const char* psz)
+{
+    return ParseHex(psz, strlen(psz));
+}
+
 vector<unsigned char> ParseHex(const string& str)
 {
     return ParseHex(str.c_str());
@@ -80,10 +80,33 @@ bool ParseInt64(const std::string& str, int64_t *out);
  */
 bool ParseDouble(const std::string& str, double *out);
 
+/**
+ * Write the lowercase hex of the len bytes at pch to out, 2 * len chars
+ * without a terminator. Uses SSE2 where the target has it.
+ */
+void HexEncode(const unsigned char* pch, size_t len, char* out);
+
 template<typename T>
 std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 {
     std::string rv;
+    if (!fSpaces) {
+        // Presize, and encode through a buffer so any iterator gets the fast path
+        if (itbegin < itend)
+            rv.resize((itend-itbegin)*2);
+        unsigned char buf[256];
+        char* out = &rv[0];
+        T it = itbegin;
+        while (it < itend) {
+            size_t n = 0;
+            for (; n < sizeof(buf) && it < itend; ++it)
+                buf[n++] = (unsigned char)(*it);
+            HexEncode(buf, n, out);
+            out += 2 * n;
+        }
+        return rv;
+    }
+
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
     rv.reserve((itend-itbegin)*3);
@@ -5,14 +5,224 @@
 
 #include "validationinterface.h"
 
+#include "primitives/block.h"
+#include "trace.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
 static CMainSignals g_signals;
+static CValidationQueue g_queue;
 
 CMainSignals& GetMainSignals()
 {
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
+CValidationQueue& GetValidationQueue()
+{
+    return g_queue;
+}
+
+CValidationQueue::CValidationQueue() : nMaxDepth(DEFAULT_MAX_NOTIFY_QUEUE), fRunning(false), fStopping(false), nQueued(0), nDone(0)
+{
+}
+
+CValidationQueue::~CValidationQueue()
+{
+    Stop();
+}
+
+void CValidationQueue::Start(size_t nMaxDepthIn)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning)
+        return;
+    nMaxDepth = std::max<size_t>(1, nMaxDepthIn);
+    fRunning = true;
+    fStopping = false;
+    thread = boost::thread(&CValidationQueue::ThreadMain, this);
+}
+
+void CValidationQueue::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStopping = true;
+    }
+    condWork.notify_all();
+    thread.join();
+}
+
+bool CValidationQueue::IsRunning()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fRunning;
+}
+
+bool CValidationQueue::IsQueueThread() const
+{
+    return boost::this_thread::get_id() == thread.get_id();
+}
+
+void CValidationQueue::Push(const std::function<void()>& func)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fRunning) {
+            int64_t nTime = GetTimeMicros();
+            queue.push_back([func, nTime] {
+                int64_t nStart = GetTimeMicros();
+                func();
+                TRACE2(validationinterface, callback_done, nStart - nTime, GetTimeMicros() - nStart);
+            });
+            nQueued++;
+            condWork.notify_one();
+            return;
+        }
+    }
+    func();
+}
+
+void CValidationQueue::Limit()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (IsQueueThread())
+        return;
+    while (fRunning && queue.size() > nMaxDepth)
+        condDone.wait(lock);
+}
+
+void CValidationQueue::Sync()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (IsQueueThread())
+        return;
+    uint64_t nTarget = nQueued;
+    while (fRunning && nDone < nTarget)
+        condDone.wait(lock);
+}
+
+size_t CValidationQueue::Depth()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queue.size();
+}
+
+void CValidationQueue::ThreadMain()
+{
+    RenameThread("zero-notify");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (queue.empty() && !fStopping)
+            condWork.wait(lock);
+        if (queue.empty()) {
+            // Whatever is pushed from now on runs on the pushing thread
+            fRunning = false;
+            condDone.notify_all();
+            break;
+        }
+        std::function<void()> func = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        try {
+            func();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "CValidationQueue");
+        } catch (...) {
+            PrintExceptionContinue(NULL, "CValidationQueue");
+        }
+        lock.lock();
+        nDone++;
+        condDone.notify_all();
+    }
+}
+
+/**
+ * A background listener may look at a block after it is freed, so keep a
+ * copy of it; the transactions of one block share the copy.
+ */
+static std::shared_ptr<const CBlock> PinBlock(const CBlock* pblock)
+{
+    static boost::mutex cs_pinned;
+    static const CBlock* pblockLast = NULL;
+    static std::shared_ptr<const CBlock> pblockPinned;
+
+    if (pblock == NULL)
+        return std::shared_ptr<const CBlock>();
+    uint256 hash = pblock->GetHash();
+    boost::unique_lock<boost::mutex> lock(cs_pinned);
+    if (pblock != pblockLast || pblockPinned->GetHash() != hash) {
+        pblockPinned = std::make_shared<const CBlock>(*pblock);
+        pblockLast = pblock;
+    }
+    return pblockPinned;
+}
+
+static boost::mutex cs_backgroundConnections;
+static std::map<CValidationInterface*, std::vector<boost::signals2::connection> > mapBackgroundConnections;
+
+static void RegisterBackgroundValidationInterface(CValidationInterface* pwalletIn,
+    void (CValidationInterface::*pUpdatedBlockTip)(const CBlockIndex*),
+    void (CValidationInterface::*pSyncTransaction)(const CTransaction&, const CBlock*),
+    void (CValidationInterface::*pEraseFromWallet)(const uint256&),
+    bool (CValidationInterface::*pUpdatedTransaction)(const uint256&),
+    void (CValidationInterface::*pChainTip)(const CBlockIndex*, const CBlock*, SproutMerkleTree, SaplingMerkleTree, bool),
+    void (CValidationInterface::*pSetBestChain)(const CBlockLocator&),
+    void (CValidationInterface::*pInventory)(const uint256&),
+    void (CValidationInterface::*pResendWalletTransactions)(int64_t))
+{
+    std::vector<boost::signals2::connection> vConnections;
+    vConnections.push_back(g_signals.UpdatedBlockTip.connect([=](const CBlockIndex* pindex) {
+        g_queue.Push([=] { (pwalletIn->*pUpdatedBlockTip)(pindex); });
+    }));
+    vConnections.push_back(g_signals.SyncTransaction.connect([=](const CTransaction& tx, const CBlock* pblock) {
+        std::shared_ptr<const CBlock> pblockPinned = PinBlock(pblock);
+        g_queue.Push([=] { (pwalletIn->*pSyncTransaction)(tx, pblockPinned.get()); });
+    }));
+    vConnections.push_back(g_signals.EraseTransaction.connect([=](const uint256& hash) {
+        g_queue.Push([=] { (pwalletIn->*pEraseFromWallet)(hash); });
+    }));
+    vConnections.push_back(g_signals.UpdatedTransaction.connect([=](const uint256& hash) {
+        g_queue.Push([=] { (pwalletIn->*pUpdatedTransaction)(hash); });
+    }));
+    vConnections.push_back(g_signals.ChainTip.connect([=](const CBlockIndex* pindex, const CBlock* pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree, bool added) {
+        std::shared_ptr<const CBlock> pblockPinned = PinBlock(pblock);
+        g_queue.Push([=] { (pwalletIn->*pChainTip)(pindex, pblockPinned.get(), sproutTree, saplingTree, added); });
+    }));
+    vConnections.push_back(g_signals.SetBestChain.connect([=](const CBlockLocator& locator) {
+        g_queue.Push([=] { (pwalletIn->*pSetBestChain)(locator); });
+    }));
+    vConnections.push_back(g_signals.Inventory.connect([=](const uint256& hash) {
+        g_queue.Push([=] { (pwalletIn->*pInventory)(hash); });
+    }));
+    vConnections.push_back(g_signals.Broadcast.connect([=](int64_t nBestBlockTime) {
+        g_queue.Push([=] { (pwalletIn->*pResendWalletTransactions)(nBestBlockTime); });
+    }));
+
+    boost::unique_lock<boost::mutex> lock(cs_backgroundConnections);
+    std::vector<boost::signals2::connection>& vRegistered = mapBackgroundConnections[pwalletIn];
+    vRegistered.insert(vRegistered.end(), vConnections.begin(), vConnections.end());
+}
+
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fBackground) {
+    if (fBackground) {
+        RegisterBackgroundValidationInterface(pwalletIn, &CValidationInterface::UpdatedBlockTip,
+            &CValidationInterface::SyncTransaction, &CValidationInterface::EraseFromWallet,
+            &CValidationInterface::UpdatedTransaction, &CValidationInterface::ChainTip,
+            &CValidationInterface::SetBestChain, &CValidationInterface::Inventory,
+            &CValidationInterface::ResendWalletTransactions);
+        g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+        g_signals.ScriptForMining.connect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
+        g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
+        return;
+    }
     g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
@@ -27,6 +237,15 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_backgroundConnections);
+        std::map<CValidationInterface*, std::vector<boost::signals2::connection> >::iterator it = mapBackgroundConnections.find(pwalletIn);
+        if (it != mapBackgroundConnections.end()) {
+            for (boost::signals2::connection& connection : it->second)
+                connection.disconnect();
+            mapBackgroundConnections.erase(it);
+        }
+    }
     g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
     g_signals.ScriptForMining.disconnect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
@@ -52,8 +271,12 @@ void UnregisterAllValidationInterfaces() {
     g_signals.EraseTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
+    boost::unique_lock<boost::mutex> lock(cs_backgroundConnections);
+    mapBackgroundConnections.clear();
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
+    int64_t nTimeStart = GetTimeMicros();
     g_signals.SyncTransaction(tx, pblock);
+    TRACE3(validationinterface, sync_transaction, tx.GetHash().begin(), pblock != NULL, GetTimeMicros() - nTimeStart);
 }
@@ -6,8 +6,15 @@
 #ifndef BITCOIN_VALIDATIONINTERFACE_H
 #define BITCOIN_VALIDATIONINTERFACE_H
 
+#include <deque>
+#include <functional>
+#include <stdint.h>
+
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "zcash/IncrementalMerkleTree.hpp"
 
@@ -20,10 +27,21 @@ class CValidationInterface;
 class CValidationState;
 class uint256;
 
+/** Default for -maxnotifyqueue, in callbacks */
+static const unsigned int DEFAULT_MAX_NOTIFY_QUEUE = 1000;
+/** Default for -asyncwallet */
+static const bool DEFAULT_ASYNC_WALLET = false;
+
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
+/**
+ * Register a wallet to receive updates from core. With fBackground, the
+ * notifications that return nothing to core are queued (see
+ * CValidationQueue) instead of being delivered while the block or
+ * transaction is being connected; BlockChecked, ScriptForMining and
+ * BlockFound are always delivered at once.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fBackground = false);
 /** Unregister a wallet from core */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
@@ -44,7 +62,7 @@ protected:
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
 };
@@ -76,4 +94,50 @@ struct CMainSignals {
 
 CMainSignals& GetMainSignals();
 
+/**
+ * Ordered queue of the validation callbacks of background listeners, run by
+ * a single thread so that they see blocks and transactions in the order they
+ * were connected, but without cs_main held by the validating thread.
+ *
+ * Pushing never waits, since it happens with cs_main held and the callbacks
+ * may need cs_main themselves. The depth is bounded instead by producers
+ * calling Limit() before they take cs_main, as ProcessNewBlock does. Until
+ * Start() and after Stop(), callbacks run at once on the pushing thread.
+ */
+class CValidationQueue
+{
+public:
+    CValidationQueue();
+    ~CValidationQueue();
+
+    void Start(size_t nMaxDepthIn);
+    /** Run what is queued, then stop the thread */
+    void Stop();
+    bool IsRunning();
+
+    void Push(const std::function<void()>& func);
+    /** Wait while more than the maximum depth is queued; call without cs_main */
+    void Limit();
+    /** Wait until every callback queued before the call has run; call without cs_main */
+    void Sync();
+    size_t Depth();
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<std::function<void()> > queue;
+    boost::thread thread;
+    size_t nMaxDepth;
+    bool fRunning;
+    bool fStopping;
+    uint64_t nQueued;
+    uint64_t nDone;
+
+    void ThreadMain();
+    bool IsQueueThread() const;
+};
+
+CValidationQueue& GetValidationQueue();
+
 #endif // BITCOIN_VALIDATIONINTERFACE_H
@@ -803,6 +803,7 @@ UniValue AsyncRPCOperation_mergetoaddress::perform_joinsplit(
     uint256 esk; // payment disclosure - secret
 
     assert(mtx.fOverwintered && (mtx.nVersion >= SAPLING_TX_VERSION));
+    ZC_WaitForParams();
     JSDescription jsdesc = JSDescription::Randomized(
         *pzcashParams,
         joinSplitPubKey_,
@@ -76,6 +76,10 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_BULK;
+    }
+
     bool testmode = false; // Set to true to disable sending txs and generating proofs
 
     bool paymentDisclosureMode = false; // Set to true to save esk for encrypted notes in payment disclosure database.
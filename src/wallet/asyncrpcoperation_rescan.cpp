@@ -0,0 +1,100 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "asyncrpcoperation_rescan.h"
+
+#include "init.h"
+#include "main.h"
+#include "rpc/protocol.h"
+#include "sync.h"
+#include "tinyformat.h"
+#include "util.h"
+#include "wallet.h"
+
+using namespace std;
+
+AsyncRPCOperation_rescan::AsyncRPCOperation_rescan(int nStartHeight, bool fReaccept) :
+    nStartHeight_(nStartHeight), fReaccept_(fReaccept) {}
+
+AsyncRPCOperation_rescan::~AsyncRPCOperation_rescan() {}
+
+void AsyncRPCOperation_rescan::main() {
+    if (isCancelled())
+        return;
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+    bool success = false;
+
+    try {
+        success = main_impl();
+    } catch (const UniValue& objError) {
+        int code = find_value(objError, "code").get_int();
+        std::string message = find_value(objError, "message").get_str();
+        set_error_code(code);
+        set_error_message(message);
+    } catch (const runtime_error& e) {
+        set_error_code(-1);
+        set_error_message("runtime error: " + string(e.what()));
+    } catch (const logic_error& e) {
+        set_error_code(-1);
+        set_error_message("logic error: " + string(e.what()));
+    } catch (const exception& e) {
+        set_error_code(-1);
+        set_error_message("general exception: " + string(e.what()));
+    } catch (...) {
+        set_error_code(-2);
+        set_error_message("unknown error");
+    }
+
+    stop_execution_clock();
+
+    if (success) {
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        set_state(OperationStatus::FAILED);
+    }
+
+    std::string s = strprintf("%s: Rescan from height %d finished. (status=%s", getId(), nStartHeight_, getStateAsString());
+    if (success) {
+        s += strprintf(", success)\n");
+    } else {
+        s += strprintf(", error=%s)\n", getErrorMessage());
+    }
+
+    LogPrintf("%s", s);
+}
+
+bool AsyncRPCOperation_rescan::main_impl() {
+    CBlockIndex* pindexStart;
+    {
+        LOCK(cs_main);
+        // The chain may have become shorter since the keys were imported
+        pindexStart = chainActive[std::min(nStartHeight_, chainActive.Height())];
+    }
+    int nFound = pwalletMain->ScanForWalletTransactions(pindexStart, true);
+    if (fReaccept_)
+        pwalletMain->ReacceptWalletTransactions();
+
+    UniValue res(UniValue::VOBJ);
+    res.push_back(Pair("start_height", nStartHeight_));
+    res.push_back(Pair("transactions", nFound));
+    set_result(res);
+    return true;
+}
+
+UniValue AsyncRPCOperation_rescan::getStatus() const {
+    UniValue v = AsyncRPCOperation::getStatus();
+    UniValue obj = v.get_obj();
+    obj.push_back(Pair("method", "rescan"));
+    obj.push_back(Pair("start_height", nStartHeight_));
+    if (isExecuting()) {
+        // The percentage reached by the wallet's current rescan
+        int nProgress = nRescanProgress;
+        if (nProgress >= 0)
+            obj.push_back(Pair("progress", nProgress));
+    }
+    return obj;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2019 The Zero developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ASYNCRPCOPERATION_RESCAN_H
+#define ASYNCRPCOPERATION_RESCAN_H
+
+#include "asyncrpcoperation.h"
+#include "univalue.h"
+
+/**
+ * Rescan the chain from a given height for the transactions of keys
+ * imported in a batch, so that z_importkeys can return before it is done.
+ */
+class AsyncRPCOperation_rescan : public AsyncRPCOperation
+{
+public:
+    AsyncRPCOperation_rescan(int nStartHeight, bool fReaccept);
+    virtual ~AsyncRPCOperation_rescan();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_rescan(AsyncRPCOperation_rescan const&) = delete;            // Copy construct
+    AsyncRPCOperation_rescan(AsyncRPCOperation_rescan&&) = delete;                 // Move construct
+    AsyncRPCOperation_rescan& operator=(AsyncRPCOperation_rescan const&) = delete; // Copy assign
+    AsyncRPCOperation_rescan& operator=(AsyncRPCOperation_rescan&&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual UniValue getStatus() const;
+
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_BULK;
+    }
+
+private:
+    int nStartHeight_;
+    //! Whether watch-only scripts were imported, whose transactions go back to the mempool
+    bool fReaccept_;
+
+    bool main_impl();
+};
+
+#endif // ASYNCRPCOPERATION_RESCAN_H
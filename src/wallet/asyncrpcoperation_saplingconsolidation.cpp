@@ -1,6 +1,7 @@
 #include "assert.h"
 #include "boost/variant/static_visitor.hpp"
 #include "asyncrpcoperation_saplingconsolidation.h"
+#include "asyncrpcoperation_saplingnotepool.h"
 #include "init.h"
 #include "key_io.h"
 #include "rpc/protocol.h"
@@ -14,6 +15,8 @@
 
 CAmount fConsolidationTxFee = DEFAULT_CONSOLIDATION_FEE;
 bool fConsolidationMapUsed = false;
+int nConsolidationThreads = 1;
+int nConsolidationMaxProofs = DEFAULT_CONSOLIDATION_MAX_PROOFS;
 const int CONSOLIDATION_EXPIRY_DELTA = 15;
 
 
@@ -51,6 +54,8 @@ void AsyncRPCOperation_saplingconsolidation::main() {
         set_error_message("unknown error");
     }
 
+    unlock_notes();
+
     stop_execution_clock();
 
     if (success) {
@@ -69,6 +74,14 @@ void AsyncRPCOperation_saplingconsolidation::main() {
     LogPrintf("%s", s);
 }
 
+void AsyncRPCOperation_saplingconsolidation::unlock_notes() {
+    LOCK(pwalletMain->cs_wallet);
+    for (const SaplingOutPoint& op : reservedNotes_) {
+        pwalletMain->UnlockNote(op);
+    }
+    reservedNotes_.clear();
+}
+
 bool AsyncRPCOperation_saplingconsolidation::main_impl() {
     LogPrint("zrpcunsafe", "%s: Beginning AsyncRPCOperation_saplingconsolidation.\n", getId());
     auto consensusParams = Params().GetConsensus();
@@ -79,14 +92,24 @@ bool AsyncRPCOperation_saplingconsolidation::main_impl() {
         return true;
     }
 
-    std::vector<SproutNoteEntry> sproutEntries;
-    std::vector<SaplingNoteEntry> saplingEntries;
-    std::set<libzcash::SaplingPaymentAddress> addresses;
+    std::vector<std::string> consolidationTxIds;
+    CAmount amountConsolidated = 0;
+    CCoinsViewCache coinsView(pcoinsTip);
+
+    // Every transaction is planned, and its notes reserved and witnessed, under
+    // a single lock. The transactions are then built together, generating their
+    // proofs in parallel.
+    std::vector<TransactionBuilder> builders;
+    std::vector<CAmount> amountsToSend;
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        std::vector<SproutNoteEntry> sproutEntries;
+        std::vector<SaplingNoteEntry> saplingEntries;
+        std::set<libzcash::SaplingPaymentAddress> addresses;
+
         // We set minDepth to 11 to avoid unconfirmed notes and in anticipation of specifying
         // an anchor at height N-10 for each Sprout JoinSplit description
-        // Consider, should notes be sorted?
         pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, "", 11);
         if (fConsolidationMapUsed) {
             const vector<string>& v = mapMultiArgs["-consolidatesaplingaddress"];
@@ -100,89 +123,102 @@ bool AsyncRPCOperation_saplingconsolidation::main_impl() {
         } else {
             pwalletMain->GetSaplingPaymentAddresses(addresses);
         }
-    }
 
-    int numTxCreated = 0;
-    std::vector<std::string> consolidationTxIds;
-    CAmount amountConsolidated = 0;
-    CCoinsViewCache coinsView(pcoinsTip);
-
-    for (auto addr : addresses) {
-        libzcash::SaplingExtendedSpendingKey extsk;
-        if (pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk)) {
+        // Group the candidate notes by the height their witnesses were last
+        // updated at, as only notes witnessed at the same height share an anchor
+        std::map<libzcash::SaplingIncomingViewingKey, std::map<int, std::vector<SaplingNoteEntry>>> mapCandidates;
+        for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
+            // Leave the pre-split withdrawal notes alone
+            if (IsSaplingNotePoolNote(saplingEntry))
+                continue;
+
+            std::map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(saplingEntry.op.hash);
+            if (mi == pwalletMain->mapWallet.end())
+                continue;
+            mapSaplingNoteData_t::const_iterator nd = mi->second.mapSaplingNoteData.find(saplingEntry.op);
+            if (nd == mi->second.mapSaplingNoteData.end() || nd->second.witnesses.empty())
+                continue;
+
+            libzcash::SaplingIncomingViewingKey ivk;
+            pwalletMain->GetSaplingIncomingViewingKey(saplingEntry.address, ivk);
+            mapCandidates[ivk][nd->second.witnessHeight].push_back(saplingEntry);
+        }
 
-            std::vector<SaplingNoteEntry> fromNotes;
-            CAmount amountToSend = 0;
-            int maxQuantity = rand() % 35 + 10;
-            for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
+        int nProofs = 0;
+        for (auto addr : addresses) {
+            libzcash::SaplingExtendedSpendingKey extsk;
+            if (!pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk))
+                continue;
 
-                libzcash::SaplingIncomingViewingKey ivk;
-                pwalletMain->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(saplingEntry.address), ivk);
+            auto it = mapCandidates.find(extsk.expsk.full_viewing_key().in_viewing_key());
+            if (it == mapCandidates.end() || it->second.empty())
+                continue;
 
-                //Select Notes from that same address we will be sending to.
-                if (ivk == extsk.expsk.full_viewing_key().in_viewing_key()) {
-                  amountToSend += CAmount(saplingEntry.note.value());
-                  fromNotes.push_back(saplingEntry);
-                }
+            // Use the notes with the most recent witnesses, the others catch up
+            // by the next round
+            std::vector<SaplingNoteEntry>& candidates = it->second.rbegin()->second;
 
-                //Only use a randomly determined number of notes between 10 and 45
-                if (fromNotes.size() >= maxQuantity)
-                  break;
-
-            }
+            //Only use a randomly determined number of notes between 10 and 45,
+            //within what is left of the proof budget for this round
+            int maxQuantity = std::min<int>(rand() % 35 + 10, nConsolidationMaxProofs - nProofs - 1);
 
             //random minimum 2 - 12 required
             int minQuantity = rand() % 10 + 2;
-            if (fromNotes.size() < minQuantity)
-              continue;
+            if (maxQuantity < minQuantity || candidates.size() < minQuantity)
+                continue;
 
-            amountConsolidated += amountToSend;
-            auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain, pzcashParams, &coinsView, &cs_main);
-            builder.SetExpiryHeight(targetHeight_ + CONSOLIDATION_EXPIRY_DELTA);
-            LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - fConsolidationTxFee));
-
-            // Select Sapling notes
+            std::vector<SaplingNoteEntry> fromNotes(candidates.begin(), candidates.begin() + std::min<size_t>(candidates.size(), maxQuantity));
+            CAmount amountToSend = 0;
             std::vector<SaplingOutPoint> ops;
-            std::vector<libzcash::SaplingNote> notes;
-            for (auto fromNote : fromNotes) {
+            for (const SaplingNoteEntry& fromNote : fromNotes) {
+                amountToSend += CAmount(fromNote.note.value());
                 ops.push_back(fromNote.op);
-                notes.push_back(fromNote.note);
             }
+            if (amountToSend <= fConsolidationTxFee)
+                continue;
 
-            // Fetch Sapling anchor and witnesses
             uint256 anchor;
             std::vector<boost::optional<SaplingWitness>> witnesses;
-            {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
-            }
+            pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
 
-            // Add Sapling spends
-            for (size_t i = 0; i < notes.size(); i++) {
-                if (!witnesses[i]) {
-                    LogPrint("zrpcunsafe", "%s: Missing Witnesses. Stopping.\n", getId());
-                    break;
-                }
-                builder.AddSaplingSpend(extsk.expsk, notes[i], anchor, witnesses[i].get());
+            for (const SaplingOutPoint& op : ops) {
+                pwalletMain->LockNote(op);
+                reservedNotes_.push_back(op);
             }
 
+            auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain, pzcashParams, &coinsView, &cs_main);
+            builder.SetExpiryHeight(targetHeight_ + CONSOLIDATION_EXPIRY_DELTA);
+            LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - fConsolidationTxFee));
+            for (size_t i = 0; i < fromNotes.size(); i++) {
+                builder.AddSaplingSpend(extsk.expsk, fromNotes[i].note, anchor, witnesses[i].get());
+            }
             builder.SetFee(fConsolidationTxFee);
             builder.AddSaplingOutput(extsk.expsk.ovk, addr, amountToSend - fConsolidationTxFee);
-            CTransaction tx = builder.Build().GetTxOrThrow();
+            builders.push_back(builder);
+            amountsToSend.push_back(amountToSend);
 
-            if (isCancelled()) {
-                LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
-                break;
-            }
+            // A candidate set only funds one transaction per round
+            candidates.clear();
+            nProofs += fromNotes.size() + 1;
+        }
+    }
 
-            pwalletMain->CommitConsolidationTx(tx);
-            LogPrint("zrpcunsafe", "%s: Committed consolidation transaction with txid=%s\n", getId(), tx.GetHash().ToString());
-            amountConsolidated += amountToSend - fConsolidationTxFee;
-            consolidationTxIds.push_back(tx.GetHash().ToString());
+    std::vector<TransactionBuilderResult> results = BuildTransactions(builders, nConsolidationThreads);
+    for (size_t i = 0; i < results.size(); i++) {
+        CTransaction tx = results[i].GetTxOrThrow();
 
+        if (isCancelled()) {
+            LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
+            break;
         }
+
+        pwalletMain->CommitConsolidationTx(tx);
+        LogPrint("zrpcunsafe", "%s: Committed consolidation transaction with txid=%s\n", getId(), tx.GetHash().ToString());
+        amountConsolidated += amountsToSend[i] - fConsolidationTxFee;
+        consolidationTxIds.push_back(tx.GetHash().ToString());
     }
 
+    int numTxCreated = consolidationTxIds.size();
     LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountConsolidated));
     setConsolidationResult(numTxCreated, amountConsolidated, consolidationTxIds);
     return true;
@@ -1,13 +1,21 @@
 #include "amount.h"
 #include "asyncrpcoperation.h"
+#include "primitives/transaction.h"
 #include "univalue.h"
 #include "zcash/Address.hpp"
 #include "zcash/zip32.h"
 
 //Default fee used for consolidation transactions
 static const CAmount DEFAULT_CONSOLIDATION_FEE = 0;
+//Default for -consolidationthreads, leaving a core free for block validation
+static const int DEFAULT_CONSOLIDATION_THREADS = -1;
+static const int MAX_CONSOLIDATION_THREADS = 16;
+//Default for -consolidationmaxproofs, the spend and output proofs generated per round
+static const int DEFAULT_CONSOLIDATION_MAX_PROOFS = 200;
 extern CAmount fConsolidationTxFee;
 extern bool fConsolidationMapUsed;
+extern int nConsolidationThreads;
+extern int nConsolidationMaxProofs;
 
 class AsyncRPCOperation_saplingconsolidation : public AsyncRPCOperation
 {
@@ -27,11 +35,20 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_BULK;
+    }
+
 private:
     int targetHeight_;
 
+    // Notes locked while the operation runs, so that payments on the default lane don't select them
+    std::vector<SaplingOutPoint> reservedNotes_;
+
     bool main_impl();
 
+    void unlock_notes();
+
     void setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds);
 
 };
@@ -102,12 +102,15 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
     libzcash::SaplingPaymentAddress migrationDestAddress = getMigrationDestAddress(seed);
 
 
-    // Up to the limit of 5, as many transactions are sent as are needed to migrate the remaining funds
+    // Up to the limit of 5, as many transactions are sent as are needed to migrate the remaining funds.
+    // They are all set up first, then built together so that their proofs are generated concurrently.
     int numTxCreated = 0;
     CAmount amountMigrated = 0;
     std::vector<std::string> migrationTxIds;
     int noteIndex = 0;
     CCoinsViewCache coinsView(pcoinsTip);
+    std::vector<TransactionBuilder> builders;
+    std::vector<CAmount> amountsToSend;
     do {
         CAmount amountToSend = chooseAmount(availableFunds);
         auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain, pzcashParams, &coinsView, &cs_main);
@@ -146,7 +149,13 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
         // the value of the Sapling output will be 0.0001 ZEC less.
         builder.SetFee(FEE);
         builder.AddSaplingOutput(ovkForShieldingFromTaddr(seed), migrationDestAddress, amountToSend - FEE);
-        CTransaction tx = builder.Build().GetTxOrThrow();
+        builders.push_back(builder);
+        amountsToSend.push_back(amountToSend);
+    } while (builders.size() < 5 && availableFunds > CENT);
+
+    std::vector<TransactionBuilderResult> results = BuildTransactions(builders, GetNumCores());
+    for (size_t i = 0; i < results.size(); i++) {
+        CTransaction tx = results[i].GetTxOrThrow();
         if (isCancelled()) {
             LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
             break;
@@ -154,9 +163,9 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
         pwalletMain->AddPendingSaplingMigrationTx(tx);
         LogPrint("zrpcunsafe", "%s: Added pending migration transaction with txid=%s\n", getId(), tx.GetHash().ToString());
         ++numTxCreated;
-        amountMigrated += amountToSend - FEE;
+        amountMigrated += amountsToSend[i] - FEE;
         migrationTxIds.push_back(tx.GetHash().ToString());
-    } while (numTxCreated < 5 && availableFunds > CENT);
+    }
 
     LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountMigrated));
     setMigrationResult(numTxCreated, amountMigrated, migrationTxIds);
@@ -24,6 +24,10 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_BULK;
+    }
+
 private:
     int targetHeight_;
 
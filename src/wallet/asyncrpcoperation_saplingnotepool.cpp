@@ -0,0 +1,213 @@
+#include "assert.h"
+#include "asyncrpcoperation_saplingnotepool.h"
+#include "init.h"
+#include "key_io.h"
+#include "main.h"
+#include "rpc/protocol.h"
+#include "sync.h"
+#include "tinyformat.h"
+#include "transaction_builder.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "wallet.h"
+
+int nSaplingNotePoolSize = DEFAULT_NOTE_POOL_SIZE;
+CAmount nSaplingNotePoolValue = 0;
+libzcash::SaplingPaymentAddress saplingNotePoolAddress;
+const int NOTE_POOL_EXPIRY_DELTA = 15;
+
+bool IsSaplingNotePoolNote(const SaplingNoteEntry& entry)
+{
+    return nSaplingNotePoolSize > 0 &&
+           entry.address == saplingNotePoolAddress &&
+           CAmount(entry.note.value()) == nSaplingNotePoolValue;
+}
+
+AsyncRPCOperation_saplingnotepool::AsyncRPCOperation_saplingnotepool(int targetHeight) : targetHeight_(targetHeight) {}
+
+AsyncRPCOperation_saplingnotepool::~AsyncRPCOperation_saplingnotepool() {}
+
+void AsyncRPCOperation_saplingnotepool::main() {
+    if (isCancelled())
+        return;
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+    bool success = false;
+
+    try {
+        success = main_impl();
+    } catch (const UniValue& objError) {
+        int code = find_value(objError, "code").get_int();
+        std::string message = find_value(objError, "message").get_str();
+        set_error_code(code);
+        set_error_message(message);
+    } catch (const runtime_error& e) {
+        set_error_code(-1);
+        set_error_message("runtime error: " + string(e.what()));
+    } catch (const logic_error& e) {
+        set_error_code(-1);
+        set_error_message("logic error: " + string(e.what()));
+    } catch (const exception& e) {
+        set_error_code(-1);
+        set_error_message("general exception: " + string(e.what()));
+    } catch (...) {
+        set_error_code(-2);
+        set_error_message("unknown error");
+    }
+
+    unlock_notes();
+
+    stop_execution_clock();
+
+    if (success) {
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        set_state(OperationStatus::FAILED);
+    }
+
+    std::string s = strprintf("%s: Sapling note pool refill finished. (status=%s", getId(), getStateAsString());
+    if (success) {
+        s += strprintf(", success)\n");
+    } else {
+        s += strprintf(", error=%s)\n", getErrorMessage());
+    }
+
+    LogPrintf("%s", s);
+}
+
+void AsyncRPCOperation_saplingnotepool::unlock_notes() {
+    LOCK(pwalletMain->cs_wallet);
+    for (const SaplingOutPoint& op : reservedNotes_) {
+        pwalletMain->UnlockNote(op);
+    }
+    reservedNotes_.clear();
+}
+
+bool AsyncRPCOperation_saplingnotepool::main_impl() {
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    std::vector<SaplingNoteEntry> fromNotes;
+    int poolSize = 0;
+    libzcash::SaplingExtendedSpendingKey extsk;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        if (!pwalletMain->GetSaplingExtendedSpendingKey(saplingNotePoolAddress, extsk)) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "No spending key for the note pool address");
+        }
+
+        // Pool notes still in the mempool count towards the pool, so that a
+        // refill is not repeated while the last one confirms
+        std::set<libzcash::PaymentAddress> filterAddresses;
+        filterAddresses.insert(saplingNotePoolAddress);
+        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, 0);
+
+        for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
+            if (IsSaplingNotePoolNote(saplingEntry)) {
+                poolSize++;
+            } else if (saplingEntry.confirmations >= 1) {
+                fromNotes.push_back(saplingEntry);
+            }
+        }
+        if (poolSize >= nSaplingNotePoolSize) {
+            setNotePoolResult(poolSize, 0, "");
+            return true;
+        }
+
+        // Split the largest notes first, so the refill needs as few spends as possible
+        std::sort(fromNotes.begin(), fromNotes.end(),
+            [](const SaplingNoteEntry& i, const SaplingNoteEntry& j) -> bool {
+                return i.note.value() > j.note.value();
+            });
+
+        CAmount target = std::min(nSaplingNotePoolSize - poolSize, MAX_NOTE_POOL_OUTPUTS_PER_TX) * nSaplingNotePoolValue + DEFAULT_NOTE_POOL_TX_FEE;
+        CAmount sum = 0;
+        size_t nSpends = 0;
+        while (nSpends < fromNotes.size() && nSpends < MAX_NOTE_POOL_SPENDS_PER_TX && sum < target) {
+            sum += fromNotes[nSpends].note.value();
+            pwalletMain->LockNote(fromNotes[nSpends].op);
+            reservedNotes_.push_back(fromNotes[nSpends].op);
+            nSpends++;
+        }
+        fromNotes.resize(nSpends);
+    }
+
+    CAmount available = 0;
+    for (const SaplingNoteEntry& fromNote : fromNotes) {
+        available += fromNote.note.value();
+    }
+    int numNotes = std::min(nSaplingNotePoolSize - poolSize, MAX_NOTE_POOL_OUTPUTS_PER_TX);
+    if (available <= DEFAULT_NOTE_POOL_TX_FEE) {
+        numNotes = 0;
+    } else {
+        numNotes = std::min<CAmount>(numNotes, (available - DEFAULT_NOTE_POOL_TX_FEE) / nSaplingNotePoolValue);
+    }
+    if (numNotes == 0) {
+        LogPrint("zrpcunsafe", "%s: Not enough funds to refill the note pool (have %d of %d notes)\n", getId(), poolSize, nSaplingNotePoolSize);
+        setNotePoolResult(poolSize, 0, "");
+        return true;
+    }
+
+    // Fetch Sapling anchor and witnesses
+    std::vector<SaplingOutPoint> ops;
+    for (const SaplingNoteEntry& fromNote : fromNotes) {
+        ops.push_back(fromNote.op);
+    }
+    uint256 anchor;
+    std::vector<boost::optional<SaplingWitness>> witnesses;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
+    }
+
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CCoinsViewCache coinsView(pcoinsTip);
+    auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain, pzcashParams, &coinsView, &cs_main);
+    builder.SetExpiryHeight(targetHeight_ + NOTE_POOL_EXPIRY_DELTA);
+    builder.SetFee(DEFAULT_NOTE_POOL_TX_FEE);
+    for (size_t i = 0; i < fromNotes.size(); i++) {
+        if (!witnesses[i]) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Missing witness for note pool input");
+        }
+        builder.AddSaplingSpend(extsk.expsk, fromNotes[i].note, anchor, witnesses[i].get());
+    }
+    for (int i = 0; i < numNotes; i++) {
+        builder.AddSaplingOutput(extsk.expsk.ovk, saplingNotePoolAddress, nSaplingNotePoolValue);
+    }
+    // The remainder goes back to the pool address as change
+    CTransaction tx = builder.Build().GetTxOrThrow();
+
+    if (isCancelled()) {
+        LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
+        return false;
+    }
+
+    CWalletTx wtx(pwalletMain, tx);
+    pwalletMain->CommitTransaction(wtx, boost::none);
+    LogPrint("zrpcunsafe", "%s: Committed note pool transaction with txid=%s creating %d notes of %s\n", getId(), tx.GetHash().ToString(), numNotes, FormatMoney(nSaplingNotePoolValue));
+    setNotePoolResult(poolSize, numNotes, tx.GetHash().ToString());
+    return true;
+}
+
+void AsyncRPCOperation_saplingnotepool::setNotePoolResult(int poolSize, int numNotesCreated, const std::string& txId) {
+    UniValue res(UniValue::VOBJ);
+    res.push_back(Pair("pool_size", poolSize));
+    res.push_back(Pair("num_notes_created", numNotesCreated));
+    if (!txId.empty()) {
+        res.push_back(Pair("txid", txId));
+    }
+    set_result(res);
+}
+
+void AsyncRPCOperation_saplingnotepool::cancel() {
+    set_state(OperationStatus::CANCELLED);
+}
+
+UniValue AsyncRPCOperation_saplingnotepool::getStatus() const {
+    UniValue v = AsyncRPCOperation::getStatus();
+    UniValue obj = v.get_obj();
+    obj.push_back(Pair("method", "saplingnotepool"));
+    obj.push_back(Pair("target_height", targetHeight_));
+    return obj;
+}
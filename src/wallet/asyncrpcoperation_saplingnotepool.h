@@ -0,0 +1,64 @@
+#include "amount.h"
+#include "asyncrpcoperation.h"
+#include "primitives/transaction.h"
+#include "univalue.h"
+#include "zcash/Address.hpp"
+#include "zcash/zip32.h"
+
+struct SaplingNoteEntry;
+
+//Default number of notes kept in the withdrawal note pool (0 = disabled)
+static const int DEFAULT_NOTE_POOL_SIZE = 0;
+//Fee used for the transactions that split notes into the pool
+static const CAmount DEFAULT_NOTE_POOL_TX_FEE = 10000;
+//Most pool notes created, and notes spent, by one split transaction
+static const int MAX_NOTE_POOL_OUTPUTS_PER_TX = 50;
+static const int MAX_NOTE_POOL_SPENDS_PER_TX = 50;
+
+extern int nSaplingNotePoolSize;
+extern CAmount nSaplingNotePoolValue;
+extern libzcash::SaplingPaymentAddress saplingNotePoolAddress;
+
+/** Whether a note is one of the pre-split withdrawal notes */
+bool IsSaplingNotePoolNote(const SaplingNoteEntry& entry);
+
+/**
+ * Keeps -notepool notes of exactly -notepoolvalue unspent at -notepooladdress,
+ * splitting the other notes of that address when the pool runs low, so that a
+ * withdrawal can usually be paid with a single spend proof.
+ */
+class AsyncRPCOperation_saplingnotepool : public AsyncRPCOperation
+{
+public:
+    AsyncRPCOperation_saplingnotepool(int targetHeight);
+    virtual ~AsyncRPCOperation_saplingnotepool();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_saplingnotepool(AsyncRPCOperation_saplingnotepool const&) = delete;            // Copy construct
+    AsyncRPCOperation_saplingnotepool(AsyncRPCOperation_saplingnotepool&&) = delete;                 // Move construct
+    AsyncRPCOperation_saplingnotepool& operator=(AsyncRPCOperation_saplingnotepool const&) = delete; // Copy assign
+    AsyncRPCOperation_saplingnotepool& operator=(AsyncRPCOperation_saplingnotepool&&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual void cancel();
+
+    virtual UniValue getStatus() const;
+
+    virtual std::string getLane() const {
+        return ASYNC_RPC_LANE_BULK;
+    }
+
+private:
+    int targetHeight_;
+
+    // Notes locked while the operation runs, so that payments on the default lane don't select them
+    std::vector<SaplingOutPoint> reservedNotes_;
+
+    bool main_impl();
+
+    void unlock_notes();
+
+    void setNotePoolResult(int poolSize, int numNotesCreated, const std::string& txId);
+
+};
@@ -27,6 +27,7 @@
 #include "sodium.h"
 #include "miner.h"
 #include "wallet/paymentdisclosuredb.h"
+#include "taskpool.h"
 
 #include <array>
 #include <iostream>
@@ -157,6 +158,8 @@ void AsyncRPCOperation_sendmany::main() {
         set_error_message("unknown error");
     }
 
+    release_inputs();
+
 #ifdef ENABLE_MINING
     GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
 #endif
@@ -196,7 +199,8 @@ void AsyncRPCOperation_sendmany::main() {
 // Notes:
 // 1. #1159 Currently there is no limit set on the number of joinsplits, so size of tx could be invalid.
 // 2. #1360 Note selection is not optimal
-// 3. #1277 Spendable notes are not locked, so an operation running in parallel could also try to use them
+// 3. #1277 Spendable notes and UTXOs are locked from the moment they are found until the operation
+//    finishes, so an operation running in parallel on another lane does not try to use them
 bool AsyncRPCOperation_sendmany::main_impl() {
 
     assert(isfromtaddr_ != isfromzaddr_);
@@ -312,6 +316,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
 
         t_inputs_ = selectedTInputs;
         t_inputs_total = selectedUTXOAmount;
+        release_unselected_utxos();
 
         // Check mempooltxinputlimit to avoid creating a transaction which the local mempool rejects
         size_t limit = (size_t)GetArg("-mempooltxinputlimit", 0);
@@ -404,18 +409,19 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             builder_.SendChangeTo(changeAddr);
         }
 
-        // Select Sapling notes
+        // Select Sapling notes, preferring a single spend (e.g. a note from
+        // the -notepool), then an exact match that needs no change output
+        std::vector<size_t> selected;
+        if (!SelectSaplingNotes(z_sapling_inputs_, targetAmount, selected)) {
+            throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient shielded funds for the selected notes");
+        }
         std::vector<SaplingOutPoint> ops;
         std::vector<SaplingNote> notes;
-        CAmount sum = 0;
-        for (auto t : z_sapling_inputs_) {
-            ops.push_back(t.op);
-            notes.push_back(t.note);
-            sum += t.note.value();
-            if (sum >= targetAmount) {
-                break;
-            }
+        for (size_t i : selected) {
+            ops.push_back(z_sapling_inputs_[i].op);
+            notes.push_back(z_sapling_inputs_[i].note);
         }
+        release_unselected_sapling_notes(ops);
 
         // Fetch Sapling anchor and witnesses
         uint256 anchor;
@@ -585,7 +591,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Create joinsplits, where each output represents a zaddr recipient.
-        UniValue obj(UniValue::VOBJ);
+        std::vector<AsyncJoinSplitInfo> vInfo;
         while (zOutputsDeque.size() > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -608,7 +614,24 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 // Funds are removed from the value pool and enter the private pool
                 info.vpub_old += value;
             }
-            obj = perform_joinsplit(info);
+            vInfo.push_back(info);
+        }
+
+        // Without input notes the joinsplits do not depend on each other, so
+        // prove them concurrently and add them in order
+        uint256 anchor;
+        {
+            LOCK(cs_main);
+            anchor = pcoinsTip->GetBestAnchor(SPROUT);
+        }
+        size_t nFirst = tx_.vJoinSplit.size();
+        std::vector<ProvedJoinSplit> vProved(vInfo.size());
+        GetTaskPool().ParallelFor(TASKPOOL_WALLET, vInfo.size(), GetNumCores(), [&](size_t i) {
+            vProved[i] = prove_joinsplit(vInfo[i], std::vector<boost::optional<SproutWitness>>(), anchor, nFirst + i);
+        });
+        UniValue obj(UniValue::VOBJ);
+        for (const ProvedJoinSplit& proved : vProved) {
+            obj = add_joinsplit(proved);
         }
 
         auto txAndResult = SignSendRawTransaction(obj, keyChange, testmode);
@@ -936,6 +959,10 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
         CAmount nValue = out.tx->vout[out.i].nValue;
         SendManyInputUTXO utxo(out.tx->GetHash(), out.i, nValue, isCoinbase);
         t_inputs_.push_back(utxo);
+
+        COutPoint outpt(out.tx->GetHash(), out.i);
+        pwalletMain->LockCoin(outpt);
+        reserved_utxos_.push_back(outpt);
     }
 
     // sort in ascending order, so larger utxos appear first
@@ -953,15 +980,25 @@ bool AsyncRPCOperation_sendmany::find_unspent_notes() {
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
         pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress_, mindepth_);
-    }
 
-    // If using the TransactionBuilder, we only want Sapling notes.
-    // If not using it, we only want Sprout notes.
-    // TODO: Refactor `GetFilteredNotes()` so we only fetch what we need.
-    if (isUsingBuilder_) {
-        sproutEntries.clear();
-    } else {
-        saplingEntries.clear();
+        // If using the TransactionBuilder, we only want Sapling notes.
+        // If not using it, we only want Sprout notes.
+        // TODO: Refactor `GetFilteredNotes()` so we only fetch what we need.
+        if (isUsingBuilder_) {
+            sproutEntries.clear();
+        } else {
+            saplingEntries.clear();
+        }
+
+        // Reserve the notes before releasing the wallet lock
+        for (const SproutNoteEntry& entry : sproutEntries) {
+            pwalletMain->LockNote(entry.jsop);
+            reserved_sprout_notes_.push_back(entry.jsop);
+        }
+        for (const SaplingNoteEntry& entry : saplingEntries) {
+            pwalletMain->LockNote(entry.op);
+            reserved_sapling_notes_.push_back(entry.op);
+        }
     }
 
     for (SproutNoteEntry & entry : sproutEntries) {
@@ -1005,6 +1042,64 @@ bool AsyncRPCOperation_sendmany::find_unspent_notes() {
     return true;
 }
 
+/**
+ * Unlock the reserved UTXOs that were not selected as inputs.
+ */
+void AsyncRPCOperation_sendmany::release_unselected_utxos() {
+    std::set<COutPoint> selected;
+    for (const SendManyInputUTXO& t : t_inputs_) {
+        selected.insert(COutPoint(std::get<0>(t), std::get<1>(t)));
+    }
+
+    LOCK(pwalletMain->cs_wallet);
+    std::vector<COutPoint> stillReserved;
+    for (COutPoint& outpt : reserved_utxos_) {
+        if (selected.count(outpt)) {
+            stillReserved.push_back(outpt);
+        } else {
+            pwalletMain->UnlockCoin(outpt);
+        }
+    }
+    reserved_utxos_.swap(stillReserved);
+}
+
+/**
+ * Unlock the reserved Sapling notes that were not selected to be spent.
+ */
+void AsyncRPCOperation_sendmany::release_unselected_sapling_notes(const std::vector<SaplingOutPoint>& selected) {
+    std::set<SaplingOutPoint> selectedSet(selected.begin(), selected.end());
+
+    LOCK(pwalletMain->cs_wallet);
+    std::vector<SaplingOutPoint> stillReserved;
+    for (const SaplingOutPoint& op : reserved_sapling_notes_) {
+        if (selectedSet.count(op)) {
+            stillReserved.push_back(op);
+        } else {
+            pwalletMain->UnlockNote(op);
+        }
+    }
+    reserved_sapling_notes_.swap(stillReserved);
+}
+
+/**
+ * Unlock every input still reserved by the operation.
+ */
+void AsyncRPCOperation_sendmany::release_inputs() {
+    LOCK(pwalletMain->cs_wallet);
+    for (COutPoint& outpt : reserved_utxos_) {
+        pwalletMain->UnlockCoin(outpt);
+    }
+    for (const JSOutPoint& jsop : reserved_sprout_notes_) {
+        pwalletMain->UnlockNote(jsop);
+    }
+    for (const SaplingOutPoint& op : reserved_sapling_notes_) {
+        pwalletMain->UnlockNote(op);
+    }
+    reserved_utxos_.clear();
+    reserved_sprout_notes_.clear();
+    reserved_sapling_notes_.clear();
+}
+
 UniValue AsyncRPCOperation_sendmany::perform_joinsplit(AsyncJoinSplitInfo & info) {
     std::vector<boost::optional < SproutWitness>> witnesses;
     uint256 anchor;
@@ -1030,6 +1125,15 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         AsyncJoinSplitInfo & info,
         std::vector<boost::optional < SproutWitness>> witnesses,
         uint256 anchor)
+{
+    return add_joinsplit(prove_joinsplit(info, witnesses, anchor, tx_.vJoinSplit.size()));
+}
+
+ProvedJoinSplit AsyncRPCOperation_sendmany::prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < SproutWitness>> witnesses,
+        uint256 anchor,
+        size_t nIndex) const
 {
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
@@ -1059,11 +1163,9 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         throw runtime_error("unsupported joinsplit input/output counts");
     }
 
-    CMutableTransaction mtx(tx_);
-
     LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vJoinSplit.size(),
+            nIndex,
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value()), FormatMoney(info.vjsin[1].note.value()),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -1072,33 +1174,41 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     // Generate the proof, this can take over a minute.
     std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> inputs
             {info.vjsin[0], info.vjsin[1]};
-    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs
-            {info.vjsout[0], info.vjsout[1]};
-    std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
-    std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    ProvedJoinSplit proved;
+    proved.outputs = {info.vjsout[0], info.vjsout[1]};
 
-    uint256 esk; // payment disclosure - secret
-
-    assert(mtx.fOverwintered && (mtx.nVersion >= SAPLING_TX_VERSION));
-    JSDescription jsdesc = JSDescription::Randomized(
+    assert(tx_.fOverwintered && (tx_.nVersion >= SAPLING_TX_VERSION));
+    ZC_WaitForParams();
+    proved.jsdesc = JSDescription::Randomized(
             *pzcashParams,
             joinSplitPubKey_,
             anchor,
             inputs,
-            outputs,
-            inputMap,
-            outputMap,
+            proved.outputs,
+            proved.inputMap,
+            proved.outputMap,
             info.vpub_old,
             info.vpub_new,
             !this->testmode,
-            &esk); // parameter expects pointer to esk, so pass in address
+            &proved.esk); // parameter expects pointer to esk, so pass in address
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(proved.jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
+    return proved;
+}
 
+UniValue AsyncRPCOperation_sendmany::add_joinsplit(const ProvedJoinSplit & proved)
+{
+    const JSDescription& jsdesc = proved.jsdesc;
+    const std::array<uint64_t, ZC_NUM_JS_INPUTS>& inputMap = proved.inputMap;
+    const std::array<uint64_t, ZC_NUM_JS_OUTPUTS>& outputMap = proved.outputMap;
+    const std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS>& outputs = proved.outputs;
+    const uint256& esk = proved.esk;
+
+    CMutableTransaction mtx(tx_);
     mtx.vJoinSplit.push_back(jsdesc);
 
     // Empty output script.
@@ -44,6 +44,16 @@ struct AsyncJoinSplitInfo
     CAmount vpub_new = 0;
 };
 
+// A joinsplit whose proof has been generated, waiting to be added to the transaction
+struct ProvedJoinSplit
+{
+    JSDescription jsdesc;
+    std::array<JSOutput, ZC_NUM_JS_OUTPUTS> outputs;
+    std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    uint256 esk; // payment disclosure - secret
+};
+
 // A struct to help us track the witness and anchor for a given JSOutPoint
 struct WitnessAnchorData {
 	boost::optional<SproutWitness> witness;
@@ -105,6 +115,12 @@ private:
     std::vector<SendManyInputJSOP> z_sprout_inputs_;
     std::vector<SaplingNoteEntry> z_sapling_inputs_;
 
+    // Inputs locked in the wallet while the operation runs, so that an operation
+    // running in parallel on another lane does not select them
+    std::vector<COutPoint> reserved_utxos_;
+    std::vector<JSOutPoint> reserved_sprout_notes_;
+    std::vector<SaplingOutPoint> reserved_sapling_notes_;
+
     TransactionBuilder builder_;
     CTransaction tx_;
 
@@ -112,6 +128,9 @@ private:
     void add_taddr_outputs_to_tx();
     bool find_unspent_notes();
     bool find_utxos(bool fAcceptCoinbase);
+    void release_unselected_utxos();
+    void release_unselected_sapling_notes(const std::vector<SaplingOutPoint>& selected);
+    void release_inputs();
     std::array<unsigned char, ZC_MEMO_SIZE> get_memo_from_hex_string(std::string s);
     bool main_impl();
 
@@ -127,6 +146,17 @@ private:
         std::vector<boost::optional < SproutWitness>> witnesses,
         uint256 anchor);
 
+    // Generate the proof of the joinsplit at index nIndex; does not touch tx_,
+    // so independent joinsplits can be proved concurrently
+    ProvedJoinSplit prove_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < SproutWitness>> witnesses,
+        uint256 anchor,
+        size_t nIndex) const;
+
+    // Add a proved joinsplit to tx_ and sign it
+    UniValue add_joinsplit(const ProvedJoinSplit & proved);
+
     // payment disclosure!
     std::vector<PaymentDisclosureKeyInfo> paymentDisclosureData_;
 };
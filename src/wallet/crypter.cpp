@@ -4,11 +4,15 @@
 
 #include "crypter.h"
 
+#include "random.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "streams.h"
+#include "taskpool.h"
 #include "util.h"
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <boost/foreach.hpp>
@@ -23,12 +27,12 @@ bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::v
     int i = 0;
     if (nDerivationMethod == 0)
         i = EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), &chSalt[0],
-                          (unsigned char *)&strKeyData[0], strKeyData.size(), nRounds, chKey, chIV);
+                          (unsigned char *)&strKeyData[0], strKeyData.size(), nRounds, vchKey.data(), vchIV.data());
 
     if (i != (int)WALLET_CRYPTO_KEY_SIZE)
     {
-        memory_cleanse(chKey, sizeof(chKey));
-        memory_cleanse(chIV, sizeof(chIV));
+        memory_cleanse(vchKey.data(), vchKey.size());
+        memory_cleanse(vchIV.data(), vchIV.size());
         return false;
     }
 
@@ -41,8 +45,8 @@ bool CCrypter::SetKey(const CKeyingMaterial& chNewKey, const std::vector<unsigne
     if (chNewKey.size() != WALLET_CRYPTO_KEY_SIZE || chNewIV.size() != WALLET_CRYPTO_KEY_SIZE)
         return false;
 
-    memcpy(&chKey[0], &chNewKey[0], sizeof chKey);
-    memcpy(&chIV[0], &chNewIV[0], sizeof chIV);
+    memcpy(vchKey.data(), &chNewKey[0], vchKey.size());
+    memcpy(vchIV.data(), &chNewIV[0], vchIV.size());
 
     fKeySet = true;
     return true;
@@ -63,7 +67,7 @@ bool CCrypter::Encrypt(const CKeyingMaterial& vchPlaintext, std::vector<unsigned
 
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     assert(ctx);
-    if (fOk) fOk = EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, chKey, chIV) != 0;
+    if (fOk) fOk = EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, vchKey.data(), vchIV.data()) != 0;
     if (fOk) fOk = EVP_EncryptUpdate(ctx, &vchCiphertext[0], &nCLen, &vchPlaintext[0], nLen) != 0;
     if (fOk) fOk = EVP_EncryptFinal_ex(ctx, (&vchCiphertext[0]) + nCLen, &nFLen) != 0;
     EVP_CIPHER_CTX_free(ctx);
@@ -89,7 +93,7 @@ bool CCrypter::Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingM
 
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     assert(ctx);
-    if (fOk) fOk = EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, chKey, chIV) != 0;
+    if (fOk) fOk = EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, vchKey.data(), vchIV.data()) != 0;
     if (fOk) fOk = EVP_DecryptUpdate(ctx, &vchPlaintext[0], &nPLen, &vchCiphertext[0], nLen) != 0;
     if (fOk) fOk = EVP_DecryptFinal_ex(ctx, (&vchPlaintext[0]) + nPLen, &nFLen) != 0;
     EVP_CIPHER_CTX_free(ctx);
@@ -210,6 +214,16 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+/** Keep a random sample of at most UNLOCK_SAMPLE_KEYS of the keys */
+template <typename T>
+static void SampleKeys(std::vector<T>& vKeys)
+{
+    for (size_t i = 0; i < vKeys.size() && i < UNLOCK_SAMPLE_KEYS; i++)
+        std::swap(vKeys[i], vKeys[i + GetRand(vKeys.size() - i)]);
+    if (vKeys.size() > UNLOCK_SAMPLE_KEYS)
+        vKeys.resize(UNLOCK_SAMPLE_KEYS);
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -228,51 +242,51 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
                 keyPass = true;
             }
         }
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        CryptedSproutSpendingKeyMap::const_iterator miSprout = mapCryptedSproutSpendingKeys.begin();
-        for (; miSprout != mapCryptedSproutSpendingKeys.end(); ++miSprout)
-        {
-            const libzcash::SproutPaymentAddress &address = (*miSprout).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSprout).second;
-            libzcash::SproutSpendingKey sk;
-            if (!DecryptSproutSpendingKey(vMasterKeyIn, vchCryptedSecret, address, sk))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+        // The first unlock checks every key; later ones a random sample of
+        // each kind. Every key is checked again when it is decrypted for use.
+        std::vector<CryptedKeyMap::const_iterator> vKeys;
+        for (CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin(); mi != mapCryptedKeys.end(); ++mi)
+            vKeys.push_back(mi);
+        std::vector<CryptedSproutSpendingKeyMap::const_iterator> vSproutKeys;
+        for (CryptedSproutSpendingKeyMap::const_iterator mi = mapCryptedSproutSpendingKeys.begin(); mi != mapCryptedSproutSpendingKeys.end(); ++mi)
+            vSproutKeys.push_back(mi);
+        std::vector<CryptedSaplingSpendingKeyMap::const_iterator> vSaplingKeys;
+        for (CryptedSaplingSpendingKeyMap::const_iterator mi = mapCryptedSaplingSpendingKeys.begin(); mi != mapCryptedSaplingSpendingKeys.end(); ++mi)
+            vSaplingKeys.push_back(mi);
+        if (fDecryptionThoroughlyChecked) {
+            SampleKeys(vKeys);
+            SampleKeys(vSproutKeys);
+            SampleKeys(vSaplingKeys);
         }
-        CryptedSaplingSpendingKeyMap::const_iterator miSapling = mapCryptedSaplingSpendingKeys.begin();
-        for (; miSapling != mapCryptedSaplingSpendingKeys.end(); ++miSapling)
-        {
-            const libzcash::SaplingExtendedFullViewingKey &extfvk = (*miSapling).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSapling).second;
-            libzcash::SaplingExtendedSpendingKey sk;
-            if (!DecryptSaplingSpendingKey(vMasterKeyIn, vchCryptedSecret, extfvk, sk))
-            {
-                keyFail = true;
-                break;
+
+        // AES and the key derivations dominate, so the checks are spread over the task pool
+        std::atomic<bool> fPass(false), fFail(false);
+        size_t nKeys = vKeys.size() + vSproutKeys.size() + vSaplingKeys.size();
+        size_t nBatches = (nKeys + UNLOCK_CHECK_BATCH_SIZE - 1) / UNLOCK_CHECK_BATCH_SIZE;
+        GetTaskPool().ParallelFor(TASKPOOL_WALLET, nBatches, GetNumCores(), [&](size_t nBatch) {
+            size_t nEnd = std::min(nKeys, (nBatch + 1) * UNLOCK_CHECK_BATCH_SIZE);
+            for (size_t i = nBatch * UNLOCK_CHECK_BATCH_SIZE; i < nEnd && !fFail; i++) {
+                bool fOk;
+                if (i < vKeys.size()) {
+                    CKey key;
+                    fOk = DecryptKey(vMasterKeyIn, vKeys[i]->second.second, vKeys[i]->second.first, key);
+                } else if (i < vKeys.size() + vSproutKeys.size()) {
+                    CryptedSproutSpendingKeyMap::const_iterator mi = vSproutKeys[i - vKeys.size()];
+                    libzcash::SproutSpendingKey sk;
+                    fOk = DecryptSproutSpendingKey(vMasterKeyIn, mi->second, mi->first, sk);
+                } else {
+                    CryptedSaplingSpendingKeyMap::const_iterator mi = vSaplingKeys[i - vKeys.size() - vSproutKeys.size()];
+                    libzcash::SaplingExtendedSpendingKey sk;
+                    fOk = DecryptSaplingSpendingKey(vMasterKeyIn, mi->second, mi->first, sk);
+                }
+                if (fOk)
+                    fPass = true;
+                else
+                    fFail = true;
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
+        });
+        keyPass = keyPass || fPass;
+        keyFail = keyFail || fFail;
         if (keyPass && keyFail)
         {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
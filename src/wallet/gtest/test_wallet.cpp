@@ -10,12 +10,14 @@
 #include "random.h"
 #include "transaction_builder.h"
 #include "utiltest.h"
+#include "wallet/asyncrpcoperation_saplingnotepool.h"
 #include "wallet/wallet.h"
 #include "zcash/JoinSplit.hpp"
 #include "zcash/Note.hpp"
 #include "zcash/NoteEncryption.hpp"
 
 #include <boost/filesystem.hpp>
+#include <univalue.h>
 
 using ::testing::Return;
 
@@ -36,7 +38,7 @@ public:
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
 };
 
-template void CWallet::SetBestChainINTERNAL<MockWalletDB>(
+template bool CWallet::SetBestChainINTERNAL<MockWalletDB>(
         MockWalletDB& walletdb, const CBlockLocator& loc);
 
 class TestWallet : public CWallet {
@@ -57,8 +59,8 @@ public:
     void DecrementNoteWitnesses(const CBlockIndex* pindex) {
         CWallet::DecrementNoteWitnesses(pindex);
     }
-    void SetBestChain(MockWalletDB& walletdb, const CBlockLocator& loc) {
-        CWallet::SetBestChainINTERNAL(walletdb, loc);
+    bool SetBestChain(MockWalletDB& walletdb, const CBlockLocator& loc) {
+        return CWallet::SetBestChainINTERNAL(walletdb, loc);
     }
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx) {
         return CWallet::UpdatedNoteData(wtxIn, wtx);
@@ -66,6 +68,11 @@ public:
     void MarkAffectedTransactionsDirty(const CTransaction& tx) {
         CWallet::MarkAffectedTransactionsDirty(tx);
     }
+    std::vector<CWalletNoteEvent> GetNoteEvents(const CWalletTx& wtx, bool fInsertedNew, const uint256& hashBlockKnown,
+                                                const std::set<JSOutPoint>& setSproutKnown,
+                                                const std::set<SaplingOutPoint>& setSaplingKnown) {
+        return CWallet::GetNoteEvents(wtx, fInsertedNew, hashBlockKnown, setSproutKnown, setSaplingKnown);
+    }
 };
 
 CWalletTx GetValidSproutReceive(
@@ -541,6 +548,48 @@ TEST(WalletTests, FindMySaplingNotes) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, FindMySaplingNotesWithKeySnapshot) {
+    auto consensusParams = RegtestActivateSapling();
+
+    TestWallet wallet;
+
+    // Generate dummy Sapling address
+    auto sk = GetTestMasterSaplingSpendingKey();
+    auto expsk = sk.expsk;
+    auto fvk = expsk.full_viewing_key();
+    auto ivk = fvk.in_viewing_key();
+    auto pa = sk.DefaultAddress();
+
+    auto testNote = GetTestSaplingNote(pa, 50000);
+
+    // Generate transaction
+    auto builder = TransactionBuilder(consensusParams, 1);
+    builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+    builder.AddSaplingOutput(fvk.ovk, pa, 25000, {});
+    auto tx = builder.Build().GetTxOrThrow();
+    CWalletTx wtx {&wallet, tx};
+
+    // An empty snapshot finds nothing
+    SaplingFullViewingKeyMap fvks;
+    EXPECT_EQ(0, wallet.FindMySaplingNotes(wtx, fvks).first.size());
+
+    // The snapshot is used even though the wallet itself has no keys
+    fvks[ivk] = fvk;
+    auto result = wallet.FindMySaplingNotes(wtx, fvks);
+    EXPECT_EQ(2, result.first.size());
+    EXPECT_EQ(1, result.second.count(pa));
+
+    // Once the wallet knows the address, the locked variant no longer reports it
+    ASSERT_TRUE(wallet.AddSaplingZKey(sk, pa));
+    auto walletResult = wallet.FindMySaplingNotes(wtx);
+    EXPECT_EQ(result.first.size(), walletResult.first.size());
+    EXPECT_EQ(0, walletResult.second.count(pa));
+    EXPECT_EQ(1, wallet.FindMySaplingNotes(wtx, fvks).second.count(pa));
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(WalletTests, FindMySproutNotes) {
     CWallet wallet;
 
@@ -868,6 +917,66 @@ TEST(WalletTests, NavigateFromSproutNullifierToNote) {
     EXPECT_EQ(1, wallet.mapSproutNullifiersToNotes[nullifier].n);
 }
 
+TEST(WalletTests, SproutNoteEvents) {
+    TestWallet wallet;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto note = GetSproutNote(sk, wtx, 0, 1);
+    auto nullifier = note.nullifier(sk);
+
+    mapSproutNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    SproutNoteData nd {sk.address(), nullifier};
+    noteData[jsoutpt] = nd;
+    wtx.SetSproutNoteData(noteData);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    LOCK(wallet.cs_wallet);
+
+    // A new note is received
+    auto events = wallet.GetNoteEvents(wtx, true, uint256(), {}, {});
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(CWalletNoteEvent::RECEIVED, events[0].type);
+    EXPECT_FALSE(events[0].fSapling);
+    EXPECT_EQ(wtx.GetHash(), events[0].txid);
+    EXPECT_EQ(0, events[0].nJoinSplit);
+    EXPECT_EQ(1, events[0].nOutput);
+    EXPECT_EQ(EncodePaymentAddress(sk.address()), events[0].strAddress);
+    EXPECT_EQ(10, events[0].nValue);
+    EXPECT_TRUE(events[0].hashBlock.IsNull());
+
+    // Nothing happened to a known note still in the mempool
+    std::set<JSOutPoint> known {jsoutpt};
+    EXPECT_TRUE(wallet.GetNoteEvents(wtx, false, uint256(), known, {}).empty());
+
+    // It is confirmed when its transaction gets a block
+    CWalletTx wtxMined = wtx;
+    wtxMined.hashBlock = GetRandHash();
+    events = wallet.GetNoteEvents(wtxMined, false, uint256(), known, {});
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(CWalletNoteEvent::CONFIRMED, events[0].type);
+    EXPECT_EQ(wtxMined.hashBlock, events[0].hashBlock);
+
+    // And spent by a transaction with its nullifier
+    auto wtx2 = GetValidSproutSpend(sk, note, 5);
+    events = wallet.GetNoteEvents(wtx2, true, uint256(), {}, {});
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(CWalletNoteEvent::SPENT, events[0].type);
+    EXPECT_EQ(wtx.GetHash(), events[0].txid);
+    EXPECT_EQ(wtx2.GetHash(), events[0].spendTxid);
+    EXPECT_EQ(10, events[0].nValue);
+
+    UniValue obj;
+    ASSERT_TRUE(obj.read(events[0].ToJSON()));
+    EXPECT_EQ("spent", obj["event"].get_str());
+    EXPECT_EQ(wtx2.GetHash().GetHex(), obj["spendtxid"].get_str());
+    EXPECT_EQ(10, obj["amountZat"].get_int64());
+    EXPECT_TRUE(obj["blockhash"].isNull());
+}
+
 TEST(WalletTests, NavigateFromSaplingNullifierToNote) {
     auto consensusParams = RegtestActivateSapling();
 
@@ -1537,7 +1646,7 @@ TEST(WalletTests, WriteWitnessCache) {
     // TxnBegin fails
     EXPECT_CALL(walletdb, TxnBegin())
         .WillOnce(Return(false));
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
     EXPECT_CALL(walletdb, TxnBegin())
         .WillRepeatedly(Return(true));
 
@@ -1546,14 +1655,14 @@ TEST(WalletTests, WriteWitnessCache) {
         .WillOnce(Return(false));
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
 
     // WriteTx throws
     EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
         .WillOnce(ThrowLogicError());
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
     EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
         .WillRepeatedly(Return(true));
 
@@ -1562,14 +1671,14 @@ TEST(WalletTests, WriteWitnessCache) {
         .WillOnce(Return(false));
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
 
     // WriteWitnessCacheSize throws
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
         .WillOnce(ThrowLogicError());
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
         .WillRepeatedly(Return(true));
 
@@ -1578,26 +1687,26 @@ TEST(WalletTests, WriteWitnessCache) {
         .WillOnce(Return(false));
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
 
     // WriteBestBlock throws
     EXPECT_CALL(walletdb, WriteBestBlock(loc))
         .WillOnce(ThrowLogicError());
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
     EXPECT_CALL(walletdb, WriteBestBlock(loc))
         .WillRepeatedly(Return(true));
 
     // TxCommit fails
     EXPECT_CALL(walletdb, TxnCommit())
         .WillOnce(Return(false));
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_FALSE(wallet.SetBestChain(walletdb, loc));
     EXPECT_CALL(walletdb, TxnCommit())
         .WillRepeatedly(Return(true));
 
     // Everything succeeds
-    wallet.SetBestChain(walletdb, loc);
+    EXPECT_TRUE(wallet.SetBestChain(walletdb, loc));
 }
 
 TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
@@ -1681,6 +1790,52 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     wallet.SetBestChain(walletdb, loc);
 }
 
+TEST(WalletTests, SetBestChainSkipsUnchangedTxs) {
+    TestWallet wallet;
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto note = GetSproutNote(sk, wtx, 0, 1);
+    auto nullifier = note.nullifier(sk);
+
+    mapSproutNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    SproutNoteData nd {sk.address(), nullifier};
+    noteData[jsoutpt] = nd;
+    wtx.SetSproutNoteData(noteData);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+
+    // A failed commit does not count as written
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+        .Times(2).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillOnce(Return(false))
+        .WillRepeatedly(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+    wallet.SetBestChain(walletdb, loc);
+
+    // Unchanged since the last commit, so it is not written again
+    wallet.SetBestChain(walletdb, loc);
+
+    // Changing the note data makes it dirty
+    wallet.mapWallet[wtx.GetHash()].mapSproutNoteData[jsoutpt].witnessHeight = 1;
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wallet.mapWallet[wtx.GetHash()]))
+        .Times(1).WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+    wallet.SetBestChain(walletdb, loc);
+}
+
 TEST(WalletTests, UpdateSproutNullifierNoteMap) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
@@ -2079,3 +2234,323 @@ TEST(WalletTests, SaplingNoteLocking) {
     EXPECT_FALSE(wallet.IsLockedNote(sop1));
     EXPECT_FALSE(wallet.IsLockedNote(sop2));
 }
+
+TEST(WalletTests, BalanceSnapshotInvalidation) {
+    TestWallet wallet;
+    EXPECT_FALSE(wallet.GetBalanceSnapshot());
+
+    wallet.UpdateBalanceSnapshot();
+    auto snapshot = wallet.GetBalanceSnapshot();
+    ASSERT_TRUE(snapshot);
+    EXPECT_EQ(0, snapshot->GetTransparentBalance({}, 0, false));
+    EXPECT_EQ(0, snapshot->GetShieldedBalance({}, 0, false));
+
+    // Locking a note changes the spendable balance, so the snapshot is dropped
+    SaplingOutPoint sop {uint256(), 1};
+    wallet.LockNote(sop);
+    EXPECT_FALSE(wallet.GetBalanceSnapshot());
+
+    // Readers holding the old snapshot keep a consistent view
+    EXPECT_EQ(0, snapshot->GetShieldedBalance({}, 0, false));
+
+    wallet.UpdateBalanceSnapshot();
+    EXPECT_TRUE(wallet.GetBalanceSnapshot());
+    wallet.UnlockAllSaplingNotes();
+    EXPECT_FALSE(wallet.GetBalanceSnapshot());
+}
+
+TEST(WalletTests, BalanceAggregateByDepth) {
+    CBalanceAggregate aggregate;
+    aggregate.Add(10, 5, true);
+    aggregate.Add(0, 1, true);
+    aggregate.Add(3, 20, false);
+    aggregate.Add(10, 7, false);
+    aggregate.Finalize();
+
+    EXPECT_EQ(33, aggregate.Get(0, false));
+    EXPECT_EQ(6, aggregate.Get(0, true));
+    EXPECT_EQ(32, aggregate.Get(1, false));
+    EXPECT_EQ(32, aggregate.Get(3, false));
+    EXPECT_EQ(12, aggregate.Get(4, false));
+    EXPECT_EQ(5, aggregate.Get(10, true));
+    EXPECT_EQ(0, aggregate.Get(11, false));
+}
+
+TEST(WalletTests, NullifierSpendCache) {
+    CNullifierSpendCache cache;
+    CBlockIndex tip1, tip2;
+    int nDepth;
+
+    std::vector<uint256> nullifiers;
+    for (int i = 0; i < 200; i++) {
+        nullifiers.push_back(GetRandHash());
+        cache.Insert(nullifiers.back(), &tip1, i - 1);
+    }
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(cache.Lookup(nullifiers[i], &tip1, nDepth));
+        EXPECT_EQ(i - 1, nDepth);
+    }
+    EXPECT_FALSE(cache.Lookup(GetRandHash(), &tip1, nDepth));
+
+    // Entries are dropped when the tip changes
+    EXPECT_FALSE(cache.Lookup(nullifiers[0], &tip2, nDepth));
+    cache.Insert(nullifiers[1], &tip2, 5);
+    EXPECT_FALSE(cache.Lookup(nullifiers[0], &tip2, nDepth));
+    ASSERT_TRUE(cache.Lookup(nullifiers[1], &tip2, nDepth));
+    EXPECT_EQ(5, nDepth);
+
+    cache.Clear();
+    EXPECT_FALSE(cache.Lookup(nullifiers[1], &tip2, nDepth));
+}
+
+TEST(WalletTests, ShieldedOnlyScanSkipsTransparent) {
+    TestWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    ASSERT_TRUE(wallet.AddKey(key));
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction tx(mtx);
+
+    LOCK(wallet.cs_wallet);
+    fShieldedOnlyScan = true;
+    EXPECT_FALSE(wallet.AddToWalletIfInvolvingMe(tx, NULL, false));
+    EXPECT_EQ(0, wallet.mapWallet.count(tx.GetHash()));
+
+    fShieldedOnlyScan = false;
+    EXPECT_TRUE(wallet.AddToWalletIfInvolvingMe(tx, NULL, false));
+    EXPECT_EQ(1, wallet.mapWallet.count(tx.GetHash()));
+}
+
+TEST(WalletTests, SaplingNotePoolNote) {
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto address = sk.default_address();
+    auto other = libzcash::SaplingSpendingKey::random().default_address();
+
+    SaplingNoteEntry entry;
+    entry.address = address;
+    entry.note = libzcash::SaplingNote(address, 5000);
+
+    // The pool is disabled by default
+    EXPECT_FALSE(IsSaplingNotePoolNote(entry));
+
+    nSaplingNotePoolSize = 10;
+    nSaplingNotePoolValue = 5000;
+    saplingNotePoolAddress = address;
+    EXPECT_TRUE(IsSaplingNotePoolNote(entry));
+
+    entry.note = libzcash::SaplingNote(address, 5001);
+    EXPECT_FALSE(IsSaplingNotePoolNote(entry));
+
+    entry.address = other;
+    entry.note = libzcash::SaplingNote(other, 5000);
+    EXPECT_FALSE(IsSaplingNotePoolNote(entry));
+
+    nSaplingNotePoolSize = DEFAULT_NOTE_POOL_SIZE;
+    nSaplingNotePoolValue = 0;
+}
+
+TEST(WalletTests, WalletTxPositionIndex) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1;
+    CWalletTx wtx(&wallet, CTransaction(mtx));
+    ASSERT_TRUE(wallet.AddToWallet(wtx, true, NULL));
+
+    // Not in a block, so it sorts after every block
+    ASSERT_EQ(1, wallet.setWalletTxByHeight.size());
+    CWalletTxPosition pos = *wallet.setWalletTxByHeight.begin();
+    EXPECT_EQ(std::numeric_limits<int>::max(), pos.nHeight);
+    EXPECT_EQ(wtx.GetHash(), pos.hash);
+    EXPECT_TRUE(CWalletTxPosition(100, 2, uint256()) < pos);
+
+    wallet.EraseWalletTxPosition(wtx.GetHash());
+    EXPECT_EQ(0, wallet.setWalletTxByHeight.size());
+    EXPECT_EQ(0, wallet.mapWalletTxPosition.size());
+
+    // Cursors round trip and reject anything else
+    CWalletTxPosition decoded;
+    ASSERT_TRUE(CWalletTxPosition::FromCursor(pos.ToCursor(), decoded));
+    EXPECT_EQ(pos, decoded);
+    EXPECT_FALSE(CWalletTxPosition::FromCursor("zz", decoded));
+    EXPECT_FALSE(CWalletTxPosition::FromCursor(pos.ToCursor() + "00", decoded));
+}
+
+TEST(WalletTests, SelectSaplingNotes) {
+    auto address = libzcash::SaplingSpendingKey::random().default_address();
+    std::vector<SaplingNoteEntry> candidates;
+    for (CAmount value : {50, 30, 20, 7, 5}) {
+        SaplingNoteEntry entry;
+        entry.address = address;
+        entry.note = libzcash::SaplingNote(address, value);
+        candidates.push_back(entry);
+    }
+    std::vector<size_t> selected;
+
+    // Smallest single note covering the target
+    ASSERT_TRUE(SelectSaplingNotes(candidates, 25, selected));
+    EXPECT_EQ(std::vector<size_t>({1}), selected);
+    ASSERT_TRUE(SelectSaplingNotes(candidates, 50, selected));
+    EXPECT_EQ(std::vector<size_t>({0}), selected);
+
+    // Exact match with no more notes than the largest first selection
+    ASSERT_TRUE(SelectSaplingNotes(candidates, 57, selected));
+    EXPECT_EQ(std::vector<size_t>({0, 3}), selected);
+
+    // 50 + 7 + 5 would need more notes than 50 + 30, so the largest notes
+    // are taken, as they are when there is no exact match at all
+    ASSERT_TRUE(SelectSaplingNotes(candidates, 62, selected));
+    EXPECT_EQ(std::vector<size_t>({0, 1}), selected);
+    ASSERT_TRUE(SelectSaplingNotes(candidates, 99, selected));
+    EXPECT_EQ(std::vector<size_t>({0, 1, 2}), selected);
+
+    // Not enough funds
+    EXPECT_FALSE(SelectSaplingNotes(candidates, 113, selected));
+    EXPECT_TRUE(selected.empty());
+}
+
+TEST(WalletTests, SaplingNoteIndex) {
+    auto address = libzcash::SaplingSpendingKey::random().default_address();
+    uint256 hash1 = GetRandHash();
+    uint256 hash2 = GetRandHash();
+
+    CSaplingNoteIndex index;
+    CSaplingNoteIndex::Entry entry;
+    entry.address = address;
+    entry.note = libzcash::SaplingNote(address, 20);
+    index.Add(SaplingOutPoint(hash1, 0), entry);
+    entry.note = libzcash::SaplingNote(address, 10);
+    index.Add(SaplingOutPoint(hash1, 1), entry);
+    entry.note = libzcash::SaplingNote(address, 30);
+    index.Add(SaplingOutPoint(hash2, 0), entry);
+    EXPECT_EQ(3, index.Size());
+
+    ASSERT_NE(nullptr, index.Find(SaplingOutPoint(hash1, 1)));
+    EXPECT_EQ(10, index.Find(SaplingOutPoint(hash1, 1))->note.value());
+    EXPECT_EQ(nullptr, index.Find(SaplingOutPoint(hash1, 2)));
+
+    // Ordered by value
+    const CSaplingNoteIndex::ValueSet* notes = index.GetNotesByValue(address);
+    ASSERT_NE(nullptr, notes);
+    ASSERT_EQ(3, notes->size());
+    EXPECT_EQ(10, notes->begin()->first);
+    EXPECT_EQ(30, notes->rbegin()->first);
+
+    index.EraseTx(hash1);
+    EXPECT_EQ(1, index.Size());
+    notes = index.GetNotesByValue(address);
+    ASSERT_NE(nullptr, notes);
+    EXPECT_EQ(SaplingOutPoint(hash2, 0), notes->begin()->second);
+
+    index.EraseTx(hash2);
+    EXPECT_EQ(nullptr, index.GetNotesByValue(address));
+}
+
+TEST(WalletTests, UnspentOutputIndex) {
+    CKey key;
+    key.MakeNewKey(true);
+    CTxDestination dest1 = key.GetPubKey().GetID();
+    key.MakeNewKey(true);
+    CTxDestination dest2 = key.GetPubKey().GetID();
+    uint256 hash1 = GetRandHash();
+    uint256 hash2 = GetRandHash();
+
+    CUnspentOutputIndex index;
+    index.Add(COutPoint(hash1, 0), dest1);
+    index.Add(COutPoint(hash1, 1), dest2);
+    index.Add(COutPoint(hash2, 0), dest1);
+    index.Add(COutPoint(hash2, 1), CNoDestination());
+    EXPECT_EQ(4, index.Size());
+
+    const std::set<COutPoint>* outputs = index.GetOutputsByAddress(dest1);
+    ASSERT_NE(nullptr, outputs);
+    EXPECT_EQ(2, outputs->size());
+    EXPECT_EQ(1, outputs->count(COutPoint(hash2, 0)));
+
+    index.Erase(COutPoint(hash2, 0));
+    EXPECT_EQ(3, index.Size());
+    EXPECT_EQ(1, index.GetOutputsByAddress(dest1)->size());
+
+    index.EraseTx(hash1);
+    EXPECT_EQ(1, index.Size());
+    EXPECT_EQ(nullptr, index.GetOutputsByAddress(dest1));
+    EXPECT_EQ(nullptr, index.GetOutputsByAddress(dest2));
+    EXPECT_EQ(COutPoint(hash2, 1), index.GetOutputs().begin()->first);
+}
+
+TEST(WalletTests, AddressTxIndex) {
+    uint256 hash1 = GetRandHash();
+    uint256 hash2 = GetRandHash();
+
+    CAddressTxIndex index;
+    index.Add("a", hash1);
+    index.Add("b", hash1);
+    index.Add("a", hash2);
+    index.Add("a", hash2);
+    EXPECT_EQ(2, index.Size());
+    ASSERT_NE(nullptr, index.GetTxs("a"));
+    EXPECT_EQ(2, index.GetTxs("a")->size());
+    EXPECT_EQ(nullptr, index.GetTxs("c"));
+
+    index.EraseTx(hash1);
+    EXPECT_EQ(1, index.Size());
+    EXPECT_EQ(nullptr, index.GetTxs("b"));
+    EXPECT_EQ(1, index.GetTxs("a")->count(hash2));
+
+    index.Clear();
+    EXPECT_EQ(0, index.Size());
+    EXPECT_EQ(nullptr, index.GetTxs("a"));
+}
+
+TEST(WalletTests, GetAddressTxs) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+    CTxDestination dest1 = key.GetPubKey().GetID();
+    key.MakeNewKey(true);
+    CTxDestination dest2 = key.GetPubKey().GetID();
+
+    CMutableTransaction mtx1;
+    mtx1.vout.resize(1);
+    mtx1.vout[0].nValue = 10;
+    mtx1.vout[0].scriptPubKey = GetScriptForDestination(dest1);
+    CWalletTx wtx1(&wallet, CTransaction(mtx1));
+    ASSERT_TRUE(wallet.AddToWallet(wtx1, true, NULL));
+
+    CMutableTransaction mtx2;
+    mtx2.vin.resize(1);
+    mtx2.vin[0].prevout = COutPoint(wtx1.GetHash(), 0);
+    mtx2.vout.resize(1);
+    mtx2.vout[0].nValue = 9;
+    mtx2.vout[0].scriptPubKey = GetScriptForDestination(dest2);
+    CWalletTx wtx2(&wallet, CTransaction(mtx2));
+    ASSERT_TRUE(wallet.AddToWallet(wtx2, true, NULL));
+
+    std::set<uint256> setTxs;
+    wallet.GetAddressTxs(EncodeDestination(dest1), false, setTxs);
+    EXPECT_EQ(std::set<uint256>({wtx1.GetHash()}), setTxs);
+
+    // What spends the address's outputs, not what pays it
+    setTxs.clear();
+    wallet.GetAddressTxs(EncodeDestination(dest1), true, setTxs);
+    EXPECT_EQ(std::set<uint256>({wtx2.GetHash()}), setTxs);
+
+    setTxs.clear();
+    wallet.GetAddressTxs(EncodeDestination(dest2), false, setTxs);
+    EXPECT_EQ(std::set<uint256>({wtx2.GetHash()}), setTxs);
+
+    setTxs.clear();
+    wallet.GetAddressTxs("not an address", false, setTxs);
+    EXPECT_TRUE(setTxs.empty());
+}
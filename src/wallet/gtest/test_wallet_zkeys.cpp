@@ -103,6 +103,52 @@ TEST(wallet_zkeys_tests, StoreAndLoadSaplingZkeys) {
     EXPECT_TRUE(wallet.HaveSaplingIncomingViewingKey(dpa2));
 }
 
+/**
+ * This test covers the Sapling key pool on CWallet
+ * TopUpSaplingKeyPool()
+ * GenerateNewSaplingZKeys()
+ */
+TEST(wallet_zkeys_tests, SaplingKeyPool) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CKeyingMaterial rawSeed(32, 0);
+    HDSeed seed(rawSeed);
+
+    // Addresses generated one at a time, without a pool
+    CWallet walletRef;
+    walletRef.LoadHDSeed(seed);
+    std::vector<libzcash::SaplingPaymentAddress> vExpected;
+    for (int i = 0; i < 5; i++)
+        vExpected.push_back(walletRef.GenerateNewSaplingZKey());
+
+    CWallet wallet;
+    wallet.LoadHDSeed(seed);
+    LOCK(wallet.cs_wallet);
+    EXPECT_TRUE(wallet.TopUpSaplingKeyPool(3));
+    EXPECT_EQ(3, wallet.GetSaplingKeyPoolSize());
+
+    // Pooled keys are handed out in account order
+    EXPECT_EQ(vExpected[0], wallet.GenerateNewSaplingZKey());
+    EXPECT_EQ(2, wallet.GetSaplingKeyPoolSize());
+
+    // A batch empties the pool, then derives the rest
+    std::vector<libzcash::SaplingPaymentAddress> vBatch = wallet.GenerateNewSaplingZKeys(4);
+    EXPECT_EQ(std::vector<libzcash::SaplingPaymentAddress>(vExpected.begin() + 1, vExpected.end()), vBatch);
+    EXPECT_EQ(0, wallet.GetSaplingKeyPoolSize());
+    std::set<libzcash::SaplingPaymentAddress> addrs;
+    wallet.GetSaplingPaymentAddresses(addrs);
+    EXPECT_EQ(5, addrs.size());
+
+    // Resetting the counter skips known keys and drops the pool
+    EXPECT_TRUE(wallet.TopUpSaplingKeyPool(2));
+    EXPECT_EQ(walletRef.GenerateNewSaplingZKey(), wallet.GenerateNewSaplingZKey(true));
+    EXPECT_EQ(1, wallet.GetSaplingKeyPoolSize());
+
+    // Locking drops the pooled spending keys
+    wallet.Lock();
+    EXPECT_EQ(0, wallet.GetSaplingKeyPoolSize());
+}
+
 /**
  * This test covers methods on CWallet
  * GenerateNewSproutZKey()
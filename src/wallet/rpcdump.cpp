@@ -10,14 +10,19 @@
 #include "script/script.h"
 #include "script/standard.h"
 #include "sync.h"
+#include "taskpool.h"
 #include "util.h"
 #include "utiltime.h"
 #include "wallet.h"
+#include "asyncrpcqueue.h"
+#include "wallet/asyncrpcoperation_rescan.h"
 
 #include <fstream>
+#include <functional>
 #include <stdint.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/assign/list_of.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <univalue.h>
@@ -30,6 +35,11 @@ bool EnsureWalletIsAvailable(bool avoidException);
 UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys);
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys);
 
+//! Number of lines of a wallet dump decoded, and added to the wallet in one database transaction, at a time
+static const size_t IMPORT_WALLET_BATCH_SIZE = 1000;
+//! Number of keys of a wallet dump encoded at a time before being written out
+static const size_t DUMP_WALLET_BATCH_SIZE = 1000;
+
 
 std::string static EncodeDumpTime(int64_t nTime) {
     return DateTimeStrFormat("%Y-%m-%dT%H:%M:%SZ", nTime);
@@ -120,7 +130,7 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
     {
-        pwalletMain->MarkDirty();
+        pwalletMain->MarkDirty(std::set<CScript>{GetScriptForDestination(vchAddress)});
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
         // Don't throw error in case a key is already there
@@ -202,7 +212,7 @@ UniValue importaddress(const UniValue& params, bool fHelp)
         if (pwalletMain->HaveWatchOnly(script))
             return NullUniValue;
 
-        pwalletMain->MarkDirty();
+        pwalletMain->MarkDirty(std::set<CScript>{script});
 
         if (!pwalletMain->AddWatchOnly(script))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
@@ -263,6 +273,85 @@ UniValue importwallet(const UniValue& params, bool fHelp)
 	return importwallet_impl(params, fHelp, false);
 }
 
+namespace {
+
+/** A key line of a wallet dump, decoded before the wallet is touched */
+struct DumpedKey
+{
+    enum Type { NONE, TRANSPARENT, SHIELDED };
+
+    Type type;
+    int64_t nTime;
+    CKey key;
+    CPubKey pubkey;
+    std::string strLabel;
+    bool fLabel;
+    libzcash::SpendingKey spendingkey;
+    boost::optional<std::string> hdKeypath;
+    boost::optional<std::string> seedFpStr;
+    //! A Sapling key found in the wallet already
+    bool fHaveSapling;
+
+    DumpedKey() : type(NONE), nTime(0), fLabel(true), fHaveSapling(false) {}
+};
+
+} // anon namespace
+
+// Decode a line and derive what adding its key needs; run on the task pool
+static void DecodeDumpedKey(const std::string& line, bool fImportZKeys, DumpedKey& dumped)
+{
+    if (line.empty() || line[0] == '#')
+        return;
+
+    std::vector<std::string> vstr;
+    boost::split(vstr, line, boost::is_any_of(" "));
+    if (vstr.size() < 2)
+        return;
+
+    // Let's see if the address is a valid Zcash spending key
+    if (fImportZKeys) {
+        auto spendingkey = DecodeSpendingKey(vstr[0]);
+        if (IsValidSpendingKey(spendingkey)) {
+            dumped.type = DumpedKey::SHIELDED;
+            dumped.spendingkey = spendingkey;
+            dumped.nTime = DecodeDumpTime(vstr[1]);
+            // Only include hdKeypath and seedFpStr if we have both
+            if (vstr.size() > 3) {
+                dumped.hdKeypath = vstr[2];
+                dumped.seedFpStr = vstr[3];
+            }
+            // Re-imports skip the costly viewing key derivation on the wallet lock
+            const libzcash::SaplingExtendedSpendingKey* sk = boost::get<libzcash::SaplingExtendedSpendingKey>(&spendingkey);
+            if (sk)
+                dumped.fHaveSapling = pwalletMain->HaveSaplingSpendingKey(sk->expsk.full_viewing_key());
+            return;
+        }
+        LogPrint("zrpc", "Importing detected an error: invalid spending key. Trying as a transparent key...\n");
+        // Not a valid spending key, so carry on and see if it's a Zcash style t-address.
+    }
+
+    CKey key = DecodeSecret(vstr[0]);
+    if (!key.IsValid())
+        return;
+    dumped.type = DumpedKey::TRANSPARENT;
+    dumped.key = key;
+    dumped.pubkey = key.GetPubKey();
+    assert(key.VerifyPubKey(dumped.pubkey));
+    dumped.nTime = DecodeDumpTime(vstr[1]);
+    for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+        if (boost::algorithm::starts_with(vstr[nStr], "#"))
+            break;
+        if (vstr[nStr] == "change=1")
+            dumped.fLabel = false;
+        if (vstr[nStr] == "reserve=1")
+            dumped.fLabel = false;
+        if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+            dumped.strLabel = DecodeDumpString(vstr[nStr].substr(6));
+            dumped.fLabel = true;
+        }
+    }
+}
+
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys)
 {
     LOCK2(cs_main, pwalletMain->cs_wallet);
@@ -275,82 +364,87 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
 
     int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
+    std::set<CScript> setImportedScripts;
 
     bool fGood = true;
 
-    int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
-    file.seekg(0, file.beg);
-
-    pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
-    while (file.good()) {
-        pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-
-        // Let's see if the address is a valid Zcash spending key
-        if (fImportZKeys) {
-            auto spendingkey = DecodeSpendingKey(vstr[0]);
-            int64_t nTime = DecodeDumpTime(vstr[1]);
-            // Only include hdKeypath and seedFpStr if we have both
-            boost::optional<std::string> hdKeypath = (vstr.size() > 3) ? boost::optional<std::string>(vstr[2]) : boost::none;
-            boost::optional<std::string> seedFpStr = (vstr.size() > 3) ? boost::optional<std::string>(vstr[3]) : boost::none;
-            if (IsValidSpendingKey(spendingkey)) {
-                auto addResult = boost::apply_visitor(
-                    AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus(), nTime, hdKeypath, seedFpStr, true), spendingkey);
-                if (addResult == KeyAlreadyExists){
-                    LogPrint("zrpc", "Skipping import of zaddr (key already present)\n");
-                } else if (addResult == KeyNotAdded) {
-                    // Something went wrong
-                    fGood = false;
-                }
-                continue;
-            } else {
-                LogPrint("zrpc", "Importing detected an error: invalid spending key. Trying as a transparent key...\n");
-                // Not a valid spending key, so carry on and see if it's a Zcash style t-address.
+    // Add a decoded key to the wallet, writing through pwalletdb if given
+    auto addDumpedKey = [&](const DumpedKey& dumped, CWalletDB* pwalletdb) {
+        if (dumped.type == DumpedKey::SHIELDED) {
+            if (dumped.fHaveSapling) {
+                LogPrint("zrpc", "Skipping import of zaddr (key already present)\n");
+                return;
             }
+            auto addResult = boost::apply_visitor(
+                AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus(), dumped.nTime, dumped.hdKeypath, dumped.seedFpStr, true, pwalletdb), dumped.spendingkey);
+            if (addResult == KeyAlreadyExists){
+                LogPrint("zrpc", "Skipping import of zaddr (key already present)\n");
+            } else if (addResult == KeyNotAdded) {
+                // Something went wrong
+                fGood = false;
+            }
+            return;
         }
 
-        CKey key = DecodeSecret(vstr[0]);
-        if (!key.IsValid())
-            continue;
-        CPubKey pubkey = key.GetPubKey();
-        assert(key.VerifyPubKey(pubkey));
-        CKeyID keyid = pubkey.GetID();
+        CKeyID keyid = dumped.pubkey.GetID();
         if (pwalletMain->HaveKey(keyid)) {
             LogPrintf("Skipping import of %s (key already present)\n", EncodeDestination(keyid));
-            continue;
-        }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel = true;
-            }
+            return;
         }
         LogPrintf("Importing %s...\n", EncodeDestination(keyid));
-        if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
+        pwalletMain->mapKeyMetadata[keyid] = CKeyMetadata(dumped.nTime);
+        bool fAdded = pwalletdb ? pwalletMain->AddKeyPubKeyWithDB(*pwalletdb, dumped.key, dumped.pubkey)
+                                : pwalletMain->AddKeyPubKey(dumped.key, dumped.pubkey);
+        if (!fAdded) {
             fGood = false;
-            continue;
+            return;
+        }
+        if (dumped.fLabel)
+            pwalletMain->SetAddressBook(keyid, dumped.strLabel, "receive", pwalletdb);
+        setImportedScripts.insert(GetScriptForDestination(keyid));
+        nTimeBegin = std::min(nTimeBegin, dumped.nTime);
+    };
+
+    int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
+    file.seekg(0, file.beg);
+
+    pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+    std::vector<std::string> vLines;
+    std::vector<DumpedKey> vDumped;
+    while (file.good()) {
+        pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
+
+        // Decode a batch of lines, deriving the public keys, on the task pool
+        vLines.clear();
+        std::string line;
+        while (vLines.size() < IMPORT_WALLET_BATCH_SIZE && std::getline(file, line))
+            vLines.push_back(line);
+        vDumped.assign(vLines.size(), DumpedKey());
+        GetTaskPool().ParallelFor(TASKPOOL_RPC, vLines.size(), GetNumCores(), [&](size_t i) {
+            DecodeDumpedKey(vLines[i], fImportZKeys, vDumped[i]);
+        });
+
+        // Then add the batch in one database transaction. Sprout keys and keys
+        // watched already are written by handles of their own, so they are
+        // added once it is committed.
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        bool fBatch = pwalletMain->fFileBacked && walletdb.TxnBegin();
+        std::vector<const DumpedKey*> vDeferred;
+        for (const DumpedKey& dumped : vDumped) {
+            if (dumped.type == DumpedKey::NONE)
+                continue;
+            bool fOwnHandle = dumped.type == DumpedKey::SHIELDED ?
+                boost::get<libzcash::SproutSpendingKey>(&dumped.spendingkey) != NULL :
+                pwalletMain->HaveWatchOnly(GetScriptForDestination(dumped.pubkey.GetID()));
+            if (fBatch && fOwnHandle)
+                vDeferred.push_back(&dumped);
+            else
+                addDumpedKey(dumped, fBatch ? &walletdb : NULL);
         }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBook(keyid, strLabel, "receive");
-        nTimeBegin = std::min(nTimeBegin, nTime);
+        if (fBatch && !walletdb.TxnCommit())
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error writing keys to the wallet");
+        for (const DumpedKey* pdumped : vDeferred)
+            addDumpedKey(*pdumped, NULL);
     }
     file.close();
     pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
@@ -364,7 +458,7 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
     pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->MarkDirty();
+    pwalletMain->MarkDirty(setImportedScripts);
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
@@ -456,6 +550,22 @@ UniValue dumpwallet(const UniValue& params, bool fHelp)
 	return dumpwallet_impl(params, fHelp, false);
 }
 
+// Format the lines of nCount keys a batch at a time on the task pool, writing
+// each batch out in order, so the keys are encoded in parallel without the
+// whole dump being held in memory
+static void WriteDumpLines(std::ofstream& file, size_t nCount, const std::function<std::string(size_t)>& formatLine)
+{
+    std::vector<std::string> vLines;
+    for (size_t nStart = 0; nStart < nCount; nStart += DUMP_WALLET_BATCH_SIZE) {
+        vLines.assign(std::min(DUMP_WALLET_BATCH_SIZE, nCount - nStart), std::string());
+        GetTaskPool().ParallelFor(TASKPOOL_RPC, vLines.size(), GetNumCores(), [&](size_t i) {
+            vLines[i] = formatLine(nStart + i);
+        });
+        for (const std::string& line : vLines)
+            file << line;
+    }
+}
+
 UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 {
     LOCK2(cs_main, pwalletMain->cs_wallet);
@@ -513,55 +623,64 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
         file << "\n";
     }
     file << "\n";
-    for (std::vector<std::pair<int64_t, CKeyID> >::const_iterator it = vKeyBirth.begin(); it != vKeyBirth.end(); it++) {
-        const CKeyID &keyid = it->second;
-        std::string strTime = EncodeDumpTime(it->first);
+    WriteDumpLines(file, vKeyBirth.size(), [&](size_t i) {
+        const CKeyID &keyid = vKeyBirth[i].second;
+        std::string strTime = EncodeDumpTime(vKeyBirth[i].first);
         std::string strAddr = EncodeDestination(keyid);
         CKey key;
-        if (pwalletMain->GetKey(keyid, key)) {
-            if (pwalletMain->mapAddressBook.count(keyid)) {
-                file << strprintf("%s %s label=%s # addr=%s\n", EncodeSecret(key), strTime, EncodeDumpString(pwalletMain->mapAddressBook[keyid].name), strAddr);
-            } else if (setKeyPool.count(keyid)) {
-                file << strprintf("%s %s reserve=1 # addr=%s\n", EncodeSecret(key), strTime, strAddr);
-            } else {
-                file << strprintf("%s %s change=1 # addr=%s\n", EncodeSecret(key), strTime, strAddr);
-            }
+        if (!pwalletMain->GetKey(keyid, key))
+            return std::string();
+        std::map<CTxDestination, CAddressBookData>::const_iterator mi = pwalletMain->mapAddressBook.find(keyid);
+        if (mi != pwalletMain->mapAddressBook.end()) {
+            return strprintf("%s %s label=%s # addr=%s\n", EncodeSecret(key), strTime, EncodeDumpString(mi->second.name), strAddr);
+        } else if (setKeyPool.count(keyid)) {
+            return strprintf("%s %s reserve=1 # addr=%s\n", EncodeSecret(key), strTime, strAddr);
+        } else {
+            return strprintf("%s %s change=1 # addr=%s\n", EncodeSecret(key), strTime, strAddr);
         }
-    }
+    });
     file << "\n";
 
     if (fDumpZKeys) {
-        std::set<libzcash::SproutPaymentAddress> sproutAddresses;
-        pwalletMain->GetSproutPaymentAddresses(sproutAddresses);
+        std::set<libzcash::SproutPaymentAddress> setSproutAddresses;
+        pwalletMain->GetSproutPaymentAddresses(setSproutAddresses);
+        std::vector<libzcash::SproutPaymentAddress> sproutAddresses(setSproutAddresses.begin(), setSproutAddresses.end());
         file << "\n";
         file << "# Zkeys\n";
         file << "\n";
-        for (auto addr : sproutAddresses) {
+        WriteDumpLines(file, sproutAddresses.size(), [&](size_t i) {
+            const libzcash::SproutPaymentAddress& addr = sproutAddresses[i];
             libzcash::SproutSpendingKey key;
-            if (pwalletMain->GetSproutSpendingKey(addr, key)) {
-                std::string strTime = EncodeDumpTime(pwalletMain->mapSproutZKeyMetadata[addr].nCreateTime);
-                file << strprintf("%s %s # zaddr=%s\n", EncodeSpendingKey(key), strTime, EncodePaymentAddress(addr));
-            }
-        }
-        std::set<libzcash::SaplingPaymentAddress> saplingAddresses;
-        pwalletMain->GetSaplingPaymentAddresses(saplingAddresses);
+            if (!pwalletMain->GetSproutSpendingKey(addr, key))
+                return std::string();
+            std::map<libzcash::SproutPaymentAddress, CKeyMetadata>::const_iterator mi = pwalletMain->mapSproutZKeyMetadata.find(addr);
+            std::string strTime = EncodeDumpTime(mi != pwalletMain->mapSproutZKeyMetadata.end() ? mi->second.nCreateTime : 0);
+            return strprintf("%s %s # zaddr=%s\n", EncodeSpendingKey(key), strTime, EncodePaymentAddress(addr));
+        });
+        std::set<libzcash::SaplingPaymentAddress> setSaplingAddresses;
+        pwalletMain->GetSaplingPaymentAddresses(setSaplingAddresses);
+        std::vector<libzcash::SaplingPaymentAddress> saplingAddresses(setSaplingAddresses.begin(), setSaplingAddresses.end());
         file << "\n";
         file << "# Sapling keys\n";
         file << "\n";
-        for (auto addr : saplingAddresses) {
+        WriteDumpLines(file, saplingAddresses.size(), [&](size_t i) {
+            const libzcash::SaplingPaymentAddress& addr = saplingAddresses[i];
             libzcash::SaplingExtendedSpendingKey extsk;
-            if (pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk)) {
-                auto ivk = extsk.expsk.full_viewing_key().in_viewing_key();
-                CKeyMetadata keyMeta = pwalletMain->mapSaplingZKeyMetadata[ivk];
-                std::string strTime = EncodeDumpTime(keyMeta.nCreateTime);
-                // Keys imported with z_importkey do not have zip32 metadata
-                if (keyMeta.hdKeypath.empty() || keyMeta.seedFp.IsNull()) {
-                    file << strprintf("%s %s # zaddr=%s\n", EncodeSpendingKey(extsk), strTime, EncodePaymentAddress(addr));
-                } else {
-                    file << strprintf("%s %s %s %s # zaddr=%s\n", EncodeSpendingKey(extsk), strTime, keyMeta.hdKeypath, keyMeta.seedFp.GetHex(), EncodePaymentAddress(addr));
-                }
+            if (!pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk))
+                return std::string();
+            auto ivk = extsk.expsk.full_viewing_key().in_viewing_key();
+            CKeyMetadata keyMeta;
+            std::map<libzcash::SaplingIncomingViewingKey, CKeyMetadata>::const_iterator mi = pwalletMain->mapSaplingZKeyMetadata.find(ivk);
+            if (mi != pwalletMain->mapSaplingZKeyMetadata.end())
+                keyMeta = mi->second;
+            std::string strTime = EncodeDumpTime(keyMeta.nCreateTime);
+            // Keys imported with z_importkey do not have zip32 metadata
+            if (keyMeta.hdKeypath.empty() || keyMeta.seedFp.IsNull()) {
+                return strprintf("%s %s # zaddr=%s\n", EncodeSpendingKey(extsk), strTime, EncodePaymentAddress(addr));
+            } else {
+                return strprintf("%s %s %s %s # zaddr=%s\n", EncodeSpendingKey(extsk), strTime, keyMeta.hdKeypath, keyMeta.seedFp.GetHex(), EncodePaymentAddress(addr));
             }
-        }
+        });
         file << "\n";
     }
 
@@ -647,7 +766,6 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
         return NullUniValue;
     }
-    pwalletMain->MarkDirty();
     if (addResult == KeyNotAdded) {
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
     }
@@ -743,8 +861,6 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
                 return NullUniValue;
             }
         } else {
-            pwalletMain->MarkDirty();
-
             if (!pwalletMain->AddSproutViewingKey(vkey)) {
                 throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
             }
@@ -759,6 +875,243 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue z_importkeys(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "z_importkeys [{\"key\":\"key\", \"label\":\"label\", \"height\":n},...] ( rescan async )\n"
+            "\nAdds a batch of keys and addresses to your wallet, then rescans once for all of them.\n"
+            "\nArguments:\n"
+            "1. \"keys\"             (array, required) The keys to import, each a string or an object with\n"
+            "    {\n"
+            "      \"key\":\"key\",      (string, required) A private key (see dumpprivkey), zkey (see z_exportkey),\n"
+            "                         viewing key (see z_exportviewingkey), or address or script to watch (see importaddress)\n"
+            "      \"label\":\"label\",  (string, optional, default=\"\") A label for a private key or address\n"
+            "      \"height\":n        (numeric, optional, default=0) The height of the first transaction of the key\n"
+            "    }\n"
+            "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
+            "3. async              (boolean, optional, default=false) Return before the rescan is done, with an operation id (see z_getoperationstatus)\n"
+            "\nThe rescan starts at the lowest height of the keys it is done for.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"keys\": [           (array) One entry per key, in order\n"
+            "    {\n"
+            "      \"type\": \"type\",   (string) \"privkey\", \"zkey\", \"viewingkey\" or \"address\"\n"
+            "      \"address\": \"addr\", (string) The address of the key, or the watched address or script\n"
+            "      \"new\": true|false (boolean) Whether the key was not in the wallet yet\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"rescan_height\": n,  (numeric, optional) The height the rescan started at, if one was done\n"
+            "  \"transactions\": n,   (numeric, optional) The transactions of the wallet the rescan found, unless async\n"
+            "  \"opid\": \"opid\"      (string, optional) The operation id of the rescan, if async\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_importkeys", "'[\"mykey1\", {\"key\":\"mykey2\", \"height\":30000}]'") +
+            "\nImport without waiting for the rescan\n"
+            + HelpExampleCli("z_importkeys", "'[\"mykey1\", \"mykey2\"]' whenkeyisnew true") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("z_importkeys", "[\"mykey1\", \"mykey2\"], \"yes\"")
+        );
+
+    const UniValue& keys = params[0].get_array();
+
+    // Whether to perform rescan after import
+    bool fRescan = true;
+    bool fIgnoreExistingKey = true;
+    if (params.size() > 1) {
+        auto rescan = params[1].get_str();
+        if (rescan.compare("whenkeyisnew") != 0) {
+            fIgnoreExistingKey = false;
+            if (rescan.compare("no") == 0) {
+                fRescan = false;
+            } else if (rescan.compare("yes") != 0) {
+                throw JSONRPCError(
+                    RPC_INVALID_PARAMETER,
+                    "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+            }
+        }
+    }
+
+    bool fAsync = false;
+    if (params.size() > 2)
+        fAsync = params[2].get_bool();
+
+    UniValue results(UniValue::VARR);
+    int nRescanHeight = -1;
+    bool fReaccept = false;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        // Decode every key before adding any, so a bad one leaves the wallet unchanged
+        enum KeyType { PRIVKEY, ZKEY, VIEWINGKEY, ADDRESS };
+        struct ImportEntry {
+            KeyType type;
+            std::string strLabel;
+            int nHeight;
+            CKey key;
+            libzcash::SpendingKey spendingkey;
+            libzcash::SproutViewingKey viewingkey;
+            CTxDestination dest;
+            CScript script;
+        };
+        std::vector<ImportEntry> entries(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            ImportEntry& entry = entries[i];
+            std::string strKey;
+            entry.nHeight = 0;
+            if (keys[i].isStr()) {
+                strKey = keys[i].get_str();
+            } else {
+                const UniValue& obj = keys[i].get_obj();
+                RPCTypeCheckObj(obj, boost::assign::map_list_of("key", UniValue::VSTR));
+                strKey = find_value(obj, "key").get_str();
+                const UniValue& label = find_value(obj, "label");
+                if (!label.isNull())
+                    entry.strLabel = label.get_str();
+                const UniValue& height = find_value(obj, "height");
+                if (!height.isNull())
+                    entry.nHeight = height.get_int();
+            }
+            if (entry.nHeight < 0 || entry.nHeight > chainActive.Height()) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block height out of range for key %u", i));
+            }
+
+            entry.key = DecodeSecret(strKey);
+            entry.spendingkey = DecodeSpendingKey(strKey);
+            auto viewingkey = DecodeViewingKey(strKey);
+            entry.dest = DecodeDestination(strKey);
+            if (entry.key.IsValid()) {
+                entry.type = PRIVKEY;
+            } else if (IsValidSpendingKey(entry.spendingkey)) {
+                entry.type = ZKEY;
+            } else if (IsValidViewingKey(viewingkey)) {
+                // TODO: Add Sapling support, as in z_importviewingkey
+                if (boost::get<libzcash::SproutViewingKey>(&viewingkey) == nullptr) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Key %u: currently, only Sprout viewing keys are supported", i));
+                }
+                entry.viewingkey = boost::get<libzcash::SproutViewingKey>(viewingkey);
+                if (pwalletMain->HaveSproutSpendingKey(entry.viewingkey.address())) {
+                    throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Key %u: the wallet already contains the private key for this viewing key", i));
+                }
+                entry.type = VIEWINGKEY;
+            } else if (IsValidDestination(entry.dest) || IsHex(strKey)) {
+                if (IsValidDestination(entry.dest)) {
+                    entry.script = GetScriptForDestination(entry.dest);
+                } else {
+                    std::vector<unsigned char> data(ParseHex(strKey));
+                    entry.script = CScript(data.begin(), data.end());
+                }
+                if (::IsMine(*pwalletMain, entry.script) == ISMINE_SPENDABLE) {
+                    throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Key %u: the wallet already contains the private key for this address or script", i));
+                }
+                entry.type = ADDRESS;
+            } else {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Key %u is not a valid key, address or script", i));
+            }
+        }
+
+        std::set<CScript> setScripts;
+        for (ImportEntry& entry : entries) {
+            UniValue result(UniValue::VOBJ);
+            bool fNew = false;
+            switch (entry.type) {
+            case PRIVKEY: {
+                CPubKey pubkey = entry.key.GetPubKey();
+                assert(entry.key.VerifyPubKey(pubkey));
+                CKeyID vchAddress = pubkey.GetID();
+                pwalletMain->SetAddressBook(vchAddress, entry.strLabel, "receive");
+                setScripts.insert(GetScriptForDestination(vchAddress));
+                if (!pwalletMain->HaveKey(vchAddress)) {
+                    pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
+                    if (!pwalletMain->AddKeyPubKey(entry.key, pubkey))
+                        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+                    fNew = true;
+                }
+                result.push_back(Pair("type", "privkey"));
+                result.push_back(Pair("address", EncodeDestination(vchAddress)));
+                break;
+            }
+            case ZKEY: {
+                auto addResult = boost::apply_visitor(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), entry.spendingkey);
+                if (addResult == KeyNotAdded) {
+                    throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
+                }
+                fNew = addResult != KeyAlreadyExists;
+                result.push_back(Pair("type", "zkey"));
+                if (boost::get<libzcash::SproutSpendingKey>(&entry.spendingkey) != nullptr) {
+                    result.push_back(Pair("address", EncodePaymentAddress(boost::get<libzcash::SproutSpendingKey>(entry.spendingkey).address())));
+                } else {
+                    result.push_back(Pair("address", EncodePaymentAddress(boost::get<libzcash::SaplingExtendedSpendingKey>(entry.spendingkey).DefaultAddress())));
+                }
+                break;
+            }
+            case VIEWINGKEY: {
+                if (!pwalletMain->HaveSproutViewingKey(entry.viewingkey.address())) {
+                    if (!pwalletMain->AddSproutViewingKey(entry.viewingkey))
+                        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+                    fNew = true;
+                }
+                result.push_back(Pair("type", "viewingkey"));
+                result.push_back(Pair("address", EncodePaymentAddress(entry.viewingkey.address())));
+                break;
+            }
+            case ADDRESS: {
+                if (IsValidDestination(entry.dest))
+                    pwalletMain->SetAddressBook(entry.dest, entry.strLabel, "receive");
+                setScripts.insert(entry.script);
+                if (!pwalletMain->HaveWatchOnly(entry.script)) {
+                    if (!pwalletMain->AddWatchOnly(entry.script))
+                        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
+                    fNew = true;
+                }
+                fReaccept = true;
+                result.push_back(Pair("type", "address"));
+                result.push_back(Pair("address", IsValidDestination(entry.dest) ? EncodeDestination(entry.dest) : HexStr(entry.script.begin(), entry.script.end())));
+                break;
+            }
+            }
+            result.push_back(Pair("new", fNew));
+            results.push_back(result);
+
+            if (fRescan && (fNew || !fIgnoreExistingKey)) {
+                if (nRescanHeight < 0 || entry.nHeight < nRescanHeight)
+                    nRescanHeight = entry.nHeight;
+            }
+        }
+
+        pwalletMain->MarkDirty(setScripts);
+        // whenever a key is imported, we need to scan the whole chain
+        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("keys", results));
+    if (nRescanHeight < 0)
+        return ret;
+
+    ret.push_back(Pair("rescan_height", nRescanHeight));
+    std::shared_ptr<AsyncRPCOperation> operation(new AsyncRPCOperation_rescan(nRescanHeight, fReaccept));
+    if (fAsync) {
+        std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+        q->addOperation(operation);
+        ret.push_back(Pair("opid", operation->getId()));
+        return ret;
+    }
+
+    // A single rescan for the whole batch, outside the locks like any other
+    operation->main();
+    UniValue result = operation->getResult();
+    if (!result.isObject())
+        throw JSONRPCError(operation->getErrorCode(), operation->getErrorMessage());
+    ret.push_back(Pair("transactions", find_value(result, "transactions")));
+    return ret;
+}
+
 UniValue z_exportkey(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -2280,9 +2280,15 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"txcount\": xxxxxxx,         (numeric) the total number of transactions in the wallet\n"
             "  \"keypoololdest\": xxxxxx,    (numeric) the timestamp (seconds since GMT epoch) of the oldest pre-generated key in the key pool\n"
             "  \"keypoolsize\": xxxx,        (numeric) how many new keys are pre-generated\n"
+            "  \"saplingkeypoolsize\": xxxx, (numeric) how many Sapling keys are derived ahead (-saplingkeypool)\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"seedfp\": \"uint256\",        (string) the BLAKE2b-256 hash of the HD seed\n"
+            "  \"deletetx\": {                (object) background deletion of old transactions (-deletetx)\n"
+            "    \"requested\": true|false,    (boolean) whether a deletion pass is waiting to start\n"
+            "    \"pending\": xxxx,            (numeric) transactions queued and not yet deleted\n"
+            "    \"deleted\": xxxx             (numeric) transactions deleted since startup\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2299,12 +2305,24 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("txcount",       (int)pwalletMain->mapWallet.size()));
     obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
     obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
+    obj.push_back(Pair("saplingkeypoolsize", (int)pwalletMain->GetSaplingKeyPoolSize()));
     if (pwalletMain->IsCrypted())
         obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
     uint256 seedFp = pwalletMain->GetHDChain().seedFp;
     if (!seedFp.IsNull())
          obj.push_back(Pair("seedfp", seedFp.GetHex()));
+    if (fTxDeleteEnabled) {
+        size_t nPending;
+        uint64_t nDeleted;
+        bool fRequested;
+        pwalletMain->GetTransactionDeletionProgress(nPending, nDeleted, fRequested);
+        UniValue deletetx(UniValue::VOBJ);
+        deletetx.push_back(Pair("requested", fRequested));
+        deletetx.push_back(Pair("pending", (uint64_t)nPending));
+        deletetx.push_back(Pair("deleted", nDeleted));
+        obj.push_back(Pair("deletetx", deletetx));
+    }
     return obj;
 }
 
@@ -2406,7 +2424,7 @@ UniValue listunspent(const UniValue& params, bool fHelp)
     vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
     LOCK2(cs_main, pwalletMain->cs_wallet);
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true, true, ALL_COINS, false, destinations.empty() ? NULL : &destinations);
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
             continue;
@@ -2711,6 +2729,12 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             "Runs a benchmark of the selected type samplecount times,\n"
             "returning the running times of each sample.\n"
             "\n"
+            "connectblockreplay [nblocks] replays the last nblocks (default 100) blocks\n"
+            "of the active chain on a rewound in-memory view of the chainstate, and\n"
+            "also returns blocks/sec and the seconds spent in each phase. Blocks below\n"
+            "the last checkpoint or -assumevalid skip their script and proof checks,\n"
+            "as when connecting them; run with -checkpoints=0 -assumevalid=0 to time them.\n"
+            "\n"
             "Output: [\n"
             "  {\n"
             "    \"runningtime\": runningtime\n"
@@ -2723,6 +2747,9 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             );
     }
 
+    // Not timed as part of the first sample
+    ZC_WaitForParams();
+
     LOCK(cs_main);
 
     std::string benchmarktype = params[0].get_str();
@@ -2733,6 +2760,7 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
     }
 
     std::vector<double> sample_times;
+    std::vector<CConnectBlockTimings> sample_timings;
 
     JSDescription samplejoinsplit;
 
@@ -2767,9 +2795,19 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 std::vector<double> vals = benchmark_solve_equihash_threaded(nThreads);
                 sample_times.insert(sample_times.end(), vals.begin(), vals.end());
             }
+        } else if (benchmarktype == "solveequihashtromp") {
+            // One solve shared between the threads, to set against
+            // solveequihash running one independent solve per thread
+            int nThreads = 1;
+            if (params.size() >= 3) {
+                nThreads = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_solve_equihash_tromp(nThreads));
 #endif
         } else if (benchmarktype == "verifyequihash") {
             sample_times.push_back(benchmark_verify_equihash());
+        } else if (benchmarktype == "verifyinvalidequihash") {
+            sample_times.push_back(benchmark_verify_equihash(false));
         } else if (benchmarktype == "validatelargetx") {
             // Number of inputs in the spending transaction that we will simulate
             int nInputs = 11130;
@@ -2779,10 +2817,18 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_large_tx(nInputs));
         } else if (benchmarktype == "trydecryptnotes") {
             int nKeys = params[2].get_int();
-            sample_times.push_back(benchmark_try_decrypt_sprout_notes(nKeys));
+            int nThreads = 1;
+            if (params.size() >= 4) {
+                nThreads = params[3].get_int();
+            }
+            sample_times.push_back(benchmark_try_decrypt_sprout_notes(nKeys, nThreads));
         } else if (benchmarktype == "trydecryptsaplingnotes") {
             int nKeys = params[2].get_int();
-            sample_times.push_back(benchmark_try_decrypt_sapling_notes(nKeys));
+            int nThreads = 1;
+            if (params.size() >= 4) {
+                nThreads = params[3].get_int();
+            }
+            sample_times.push_back(benchmark_try_decrypt_sapling_notes(nKeys, nThreads));
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
             sample_times.push_back(benchmark_increment_sprout_note_witnesses(nTxs));
@@ -2794,6 +2840,18 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
             }
             sample_times.push_back(benchmark_connectblock_slow());
+        } else if (benchmarktype == "connectblockreplay") {
+            int nBlocks = 100;
+            if (params.size() >= 3) {
+                nBlocks = params[2].get_int();
+            }
+            CConnectBlockTimings timings;
+            try {
+                sample_times.push_back(benchmark_connectblock_replay(nBlocks, timings));
+            } catch (const std::runtime_error& e) {
+                throw JSONRPCError(RPC_MISC_ERROR, e.what());
+            }
+            sample_timings.push_back(timings);
         } else if (benchmarktype == "sendtoaddress") {
             if (Params().NetworkIDString() != "regtest") {
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
@@ -2808,22 +2866,53 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
         } else if (benchmarktype == "createsaplingspend") {
-            sample_times.push_back(benchmark_create_sapling_spend());
+            if (params.size() < 3) {
+                sample_times.push_back(benchmark_create_sapling_spend());
+            } else {
+                int nThreads = params[2].get_int();
+                std::vector<double> vals = benchmark_create_sapling_spend_threaded(nThreads);
+                sample_times.push_back(std::accumulate(vals.begin(), vals.end(), 0.0) / (nThreads*nThreads));
+            }
         } else if (benchmarktype == "createsaplingoutput") {
-            sample_times.push_back(benchmark_create_sapling_output());
+            if (params.size() < 3) {
+                sample_times.push_back(benchmark_create_sapling_output());
+            } else {
+                int nThreads = params[2].get_int();
+                std::vector<double> vals = benchmark_create_sapling_output_threaded(nThreads);
+                sample_times.push_back(std::accumulate(vals.begin(), vals.end(), 0.0) / (nThreads*nThreads));
+            }
         } else if (benchmarktype == "verifysaplingspend") {
             sample_times.push_back(benchmark_verify_sapling_spend());
         } else if (benchmarktype == "verifysaplingoutput") {
             sample_times.push_back(benchmark_verify_sapling_output());
+        } else if (benchmarktype == "sha256d64") {
+            sample_times.push_back(benchmark_sha256d64(100000));
+        } else if (benchmarktype == "merkleroot") {
+            sample_times.push_back(benchmark_merkle_root(10000));
         } else {
             throw JSONRPCError(RPC_TYPE_ERROR, "Invalid benchmarktype");
         }
     }
 
     UniValue results(UniValue::VARR);
-    for (auto time : sample_times) {
+    for (size_t i = 0; i < sample_times.size(); i++) {
         UniValue result(UniValue::VOBJ);
-        result.push_back(Pair("runningtime", time));
+        result.push_back(Pair("runningtime", sample_times[i]));
+        if (i < sample_timings.size()) {
+            const CConnectBlockTimings& timings = sample_timings[i];
+            result.push_back(Pair("blocks", timings.nBlocks));
+            result.push_back(Pair("transactions", timings.nTransactions));
+            result.push_back(Pair("blockspersec", sample_times[i] > 0 ? timings.nBlocks / sample_times[i] : 0.0));
+            UniValue phases(UniValue::VOBJ);
+            phases.push_back(Pair("sproutproofs", timings.nTimeSproutProofs * 0.000001));
+            phases.push_back(Pair("saplingproofs", timings.nTimeSaplingProofs * 0.000001));
+            phases.push_back(Pair("inputs", timings.nTimeInputs * 0.000001));
+            phases.push_back(Pair("scripts", timings.nTimeScripts * 0.000001));
+            phases.push_back(Pair("trees", timings.nTimeTrees * 0.000001));
+            phases.push_back(Pair("undo", timings.nTimeUndo * 0.000001));
+            phases.push_back(Pair("index", timings.nTimeIndex * 0.000001));
+            result.push_back(Pair("phases", phases));
+        }
         results.push_back(result);
     }
 
@@ -3050,6 +3139,7 @@ UniValue zc_raw_joinsplit(const UniValue& params, bool fHelp)
     mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
     mtx.joinSplitPubKey = joinSplitPubKey;
 
+    ZC_WaitForParams();
     JSDescription jsdesc(*pzcashParams,
                          joinSplitPubKey,
                          anchor,
@@ -3172,6 +3262,43 @@ UniValue z_getnewaddress(const UniValue& params, bool fHelp)
 }
 
 
+UniValue z_getnewaddresses(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_getnewaddresses count\n"
+            "\nReturns count new shielded addresses for receiving payments, saved to the wallet together.\n"
+            "Keys derived ahead with -saplingkeypool are used first.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, required) The number of addresses (1 to " + std::to_string(MAX_SAPLING_ADDRESS_BATCH) + ")\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"zcashaddress\"    (string) A new shielded address\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getnewaddresses", "100")
+            + HelpExampleRpc("z_getnewaddresses", "100")
+        );
+
+    int nCount = params[0].get_int();
+    if (nCount < 1 || nCount > (int)MAX_SAPLING_ADDRESS_BATCH)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, count must be between 1 and %u", MAX_SAPLING_ADDRESS_BATCH));
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
+    UniValue result(UniValue::VARR);
+    for (const auto& addr : pwalletMain->GenerateNewSaplingZKeys(nCount))
+        result.push_back(EncodePaymentAddress(addr));
+    return result;
+}
+
+
 UniValue z_listaddresses(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -3241,6 +3368,13 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth, bool ignor
         destinations.insert(taddr);
     }
 
+    // Answer from the wallet's balance snapshot when there is one, so that
+    // balance queries do not contend with block processing for cs_main
+    std::shared_ptr<const CWalletBalanceSnapshot> snapshot = pwalletMain->GetBalanceSnapshot();
+    if (snapshot) {
+        return snapshot->GetTransparentBalance(destinations, minDepth, ignoreUnspendable);
+    }
+
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
@@ -3272,6 +3406,15 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth, bool ignor
 }
 
 CAmount getBalanceZaddr(std::string address, int minDepth, bool ignoreUnspendable) {
+    std::shared_ptr<const CWalletBalanceSnapshot> snapshot = pwalletMain->GetBalanceSnapshot();
+    if (snapshot) {
+        std::set<PaymentAddress> addresses;
+        if (address.length() > 0) {
+            addresses.insert(DecodePaymentAddress(address));
+        }
+        return snapshot->GetShieldedBalance(addresses, minDepth, ignoreUnspendable);
+    }
+
     CAmount balance = 0;
     std::vector<SproutNoteEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
@@ -3403,8 +3546,6 @@ UniValue z_getbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_getbalance", "\"myaddress\", 5")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     int nMinDepth = 1;
     if (params.size() > 1) {
         nMinDepth = params[1].get_int();
@@ -3469,8 +3610,6 @@ UniValue z_gettotalbalance(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_gettotalbalance", "5")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     int nMinDepth = 1;
     if (params.size() > 0) {
         nMinDepth = params[0].get_int();
@@ -3754,7 +3893,10 @@ UniValue z_getoperationstatus(const UniValue& params, bool fHelp)
             "\nArguments:\n"
             "1. \"operationid\"         (array, optional) A list of operation ids we are interested in.  If not provided, examine all operations known to the node.\n"
             "\nResult:\n"
-            "\"    [object, ...]\"      (array) A list of JSON objects\n"
+            "\"    [object, ...]\"      (array) A list of JSON objects, each with a \"lane\" object describing\n"
+            "                           the queue lane the operation runs on: its name, number of workers,\n"
+            "                           queued and executing operations, and the average seconds completed\n"
+            "                           operations spent queued and executing\n"
             "\nExamples:\n"
             + HelpExampleCli("z_getoperationstatus", "'[\"operationid\", ... ]'")
             + HelpExampleRpc("z_getoperationstatus", "'[\"operationid\", ... ]'")
@@ -3794,6 +3936,20 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 
         UniValue obj = operation->getStatus();
         std::string s = obj["status"].get_str();
+
+        std::string lane = q->getLaneForId(id);
+        if (!lane.empty()) {
+            AsyncRPCLaneStats stats = q->getLaneStats(lane);
+            UniValue laneObj(UniValue::VOBJ);
+            laneObj.push_back(Pair("name", lane));
+            laneObj.push_back(Pair("workers", (uint64_t)stats.workers));
+            laneObj.push_back(Pair("queued", (uint64_t)stats.queued));
+            laneObj.push_back(Pair("executing", (uint64_t)stats.executing));
+            laneObj.push_back(Pair("completed", stats.completed));
+            laneObj.push_back(Pair("avg_wait_secs", stats.completed > 0 ? stats.total_wait_secs / stats.completed : 0.0));
+            laneObj.push_back(Pair("avg_execution_secs", stats.completed > 0 ? stats.total_execution_secs / stats.completed : 0.0));
+            obj.push_back(Pair("lane", laneObj));
+        }
         if (fRemoveFinishedOperations) {
             // Caller is only interested in retrieving finished results
             if ("success"==s || "failed"==s || "cancelled"==s) {
@@ -4970,6 +5126,7 @@ extern UniValue dumpwallet(const UniValue& params, bool fHelp);
 extern UniValue importwallet(const UniValue& params, bool fHelp);
 extern UniValue z_exportkey(const UniValue& params, bool fHelp);
 extern UniValue z_importkey(const UniValue& params, bool fHelp);
+extern UniValue z_importkeys(const UniValue& params, bool fHelp);
 extern UniValue z_exportviewingkey(const UniValue& params, bool fHelp);
 extern UniValue z_importviewingkey(const UniValue& params, bool fHelp);
 extern UniValue z_exportwallet(const UniValue& params, bool fHelp);
@@ -5040,9 +5197,11 @@ static const CRPCCommand commands[] =
     { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
     { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
     { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
+    { "wallet",             "z_getnewaddresses",        &z_getnewaddresses,        true  },
     { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
     { "wallet",             "z_exportkey",              &z_exportkey,              true  },
     { "wallet",             "z_importkey",              &z_importkey,              true  },
+    { "wallet",             "z_importkeys",             &z_importkeys,             true  },
     { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true  },
     { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true  },
     { "wallet",             "z_exportwallet",           &z_exportwallet,           true  },
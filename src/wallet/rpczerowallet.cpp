@@ -609,7 +609,7 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp)
   if (!EnsureWalletIsAvailable(fHelp))
       return NullUniValue;
 
-  if (fHelp || params.size() > 4 || params.size() == 2)
+  if (fHelp || params.size() > 5 || params.size() == 2)
       throw runtime_error(
         "zs_listtransactions\n"
         "\nReturns an array of decrypted Zero transactions.\n"
@@ -632,6 +632,13 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp)
         "4. \"Count:\"                 (numeric, optional, default=9999999) \n"
         "                               Last n number of transactions returned\n"
         "\n"
+        "5. \"Cursor:\"                (string, optional) \n"
+        "                               Page through the wallet in block order, newest first, returning at most\n"
+        "                               Count transactions per page. Use \"\" for the first page and the returned\n"
+        "                               nextcursor for the following ones. The result is then an object\n"
+        "                               {\"transactions\": [...], \"nextcursor\": \"cursor\"}, with an empty\n"
+        "                               nextcursor after the last page.\n"
+        "\n"
         "Default Parameters:\n"
         "1. 0 - O confimations required\n"
         "2. 0 - Returns all transactions\n"
@@ -731,6 +738,7 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp)
         + HelpExampleCli("zs_listtransactions", "")
         + HelpExampleCli("zs_listtransactions", "1")
         + HelpExampleCli("zs_listtransactions", "1 1 30 200")
+        + HelpExampleCli("zs_listtransactions", "0 0 0 100 \"\"")
         + HelpExampleRpc("zs_listtransactions", "")
         + HelpExampleRpc("zs_listtransactions", "1")
         + HelpExampleRpc("zs_listtransactions", "1 1 30 200")
@@ -754,10 +762,23 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp)
       nFilter = params[2].get_int64();
     }
 
-    if (params.size() == 4) {
+    if (params.size() >= 4) {
       nCount = params[3].get_int64();
     }
 
+    bool fPaged = false;
+    CWalletTxPosition cursor;
+    bool fCursorSet = false;
+    if (params.size() == 5) {
+      fPaged = true;
+      std::string strCursor = params[4].get_str();
+      if (!strCursor.empty()) {
+        if (!CWalletTxPosition::FromCursor(strCursor, cursor))
+          throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        fCursorSet = true;
+      }
+    }
+
     if (nMinConfirms < 0)
       throw runtime_error("Minimum confimations must be greater that 0");
 
@@ -767,39 +788,73 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp)
     if (nFilter < 0)
         throw runtime_error("Filter must be greater that 0.");
 
-    //Created Ordered Transaction Map
-    map<int64_t,CWalletTx> orderedTxs;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      const CWalletTx& wtx = (*it).second;
-      orderedTxs.insert(std::pair<int64_t,CWalletTx>(wtx.nOrderPos, wtx));
-    }
-
-
     uint64_t t = GetTime();
-    //Reverse Iterate thru transactions
-    for (map<int64_t,CWalletTx>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
-
+    auto fInclude = [&](const CWalletTx& wtx) -> bool {
         if (!CheckFinalTx(wtx))
-            continue;
+            return false;
 
-        if (wtx.GetDepthInMainChain() < 0)
-            continue;
+        int nDepth = wtx.GetDepthInMainChain();
+        if (nDepth < 0)
+            return false;
 
         if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-            continue;
+            return false;
 
         //Excude transactions with less confirmations than required
-        if (wtx.GetDepthInMainChain() < nMinConfirms)
-            continue;
+        if (nDepth < nMinConfirms)
+            return false;
 
         //Exclude Transactions older that max days old
-        if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-            continue;
+        if (nDepth > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
+            return false;
 
         //Exclude transactions with greater than max confirmations
-        if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
+        if (nFilterType == 2 && nDepth > nFilter)
+            return false;
+
+        return true;
+    };
+
+    if (fPaged) {
+      // Walk the height index backwards from the cursor, so a page only
+      // touches the transactions it returns (plus any filtered out)
+      std::set<CWalletTxPosition>::const_iterator itEnd = pwalletMain->setWalletTxByHeight.end();
+      if (fCursorSet)
+        itEnd = pwalletMain->setWalletTxByHeight.lower_bound(cursor);
+
+      std::string strNext;
+      std::set<CWalletTxPosition>::const_iterator it = itEnd;
+      while (it != pwalletMain->setWalletTxByHeight.begin()) {
+        if (ret.size() >= nCount) {
+          strNext = it->ToCursor();
+          break;
+        }
+        --it;
+        std::map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(it->hash);
+        if (mi == pwalletMain->mapWallet.end() || !fInclude(mi->second))
+          continue;
+        zsWalletTxJSON(mi->second, ret, "*", false, 0);
+      }
+
+      UniValue page(UniValue::VOBJ);
+      page.push_back(Pair("transactions", ret));
+      page.push_back(Pair("nextcursor", strNext));
+      return page;
+    }
+
+    //Created Ordered Transaction Map
+    map<int64_t, const CWalletTx*> orderedTxs;
+    for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
+      const CWalletTx& wtx = (*it).second;
+      orderedTxs.insert(std::make_pair(wtx.nOrderPos, &wtx));
+    }
+
+    //Reverse Iterate thru transactions
+    for (map<int64_t, const CWalletTx*>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it)
+    {
+        const CWalletTx& wtx = *(*it).second;
+
+        if (!fInclude(wtx))
             continue;
 
         zsWalletTxJSON(wtx, ret, "*", false, 0);
@@ -941,11 +996,157 @@ UniValue zs_gettransaction(const UniValue& params, bool fHelp)
     return ret;
 }
 
+/**
+ * The body of the zs_list*byaddress calls: the wallet's address index
+ * narrows mapWallet down to the transactions that may involve the address,
+ * which are then filtered and decrypted as zs_listtransactions does.
+ */
+static UniValue zsListByAddress(const UniValue& params, const int returnType)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    UniValue ret(UniValue::VARR);
+    const std::string strAddress = params[0].get_str();
+
+    //param values`
+    int64_t nMinConfirms = 0;
+    int64_t nFilterType = 0;
+    int64_t nFilter = 9999999;
+    int64_t nCount = 9999999;
+
+    if (params.size() >= 2)
+      nMinConfirms = params[1].get_int64();
+
+    if (params.size() >= 4) {
+      nFilterType = params[2].get_int64();
+      nFilter = params[3].get_int64();
+    }
+
+    if (params.size() >= 5) {
+      nCount = params[4].get_int64();
+    }
+
+    bool fPaged = false;
+    CWalletTxPosition cursor;
+    bool fCursorSet = false;
+    if (params.size() == 6) {
+      fPaged = true;
+      std::string strCursor = params[5].get_str();
+      if (!strCursor.empty()) {
+        if (!CWalletTxPosition::FromCursor(strCursor, cursor))
+          throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        fCursorSet = true;
+      }
+    }
+
+    if (nMinConfirms < 0)
+      throw runtime_error("Minimum confimations must be greater that 0");
+
+    if (nFilterType < 0 || nFilterType > 2)
+        throw runtime_error("Filter type must be 0, 1 or 2.");
+
+    if (nFilter < 0)
+        throw runtime_error("Filter must be greater that 0.");
+
+    uint64_t t = GetTime();
+    auto fInclude = [&](const CWalletTx& wtx) -> bool {
+        if (!CheckFinalTx(wtx))
+            return false;
+
+        int nDepth = wtx.GetDepthInMainChain();
+        if (nDepth < 0)
+            return false;
+
+        if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
+            return false;
+
+        //Excude transactions with less confirmations than required
+        if (nDepth < nMinConfirms)
+            return false;
+
+        //Exclude Transactions older that max days old
+        if (nDepth > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
+            return false;
+
+        //Exclude transactions with greater than max confirmations
+        if (nFilterType == 2 && nDepth > nFilter)
+            return false;
+
+        return true;
+    };
+
+    // Spends are looked for in the transactions spending what the address received
+    std::set<uint256> setTxs;
+    pwalletMain->GetAddressTxs(strAddress, returnType == 1, setTxs);
+
+    if (fPaged) {
+      std::set<CWalletTxPosition> setPositions;
+      for (const uint256& hash : setTxs) {
+        std::map<uint256, CWalletTxPosition>::const_iterator mi = pwalletMain->mapWalletTxPosition.find(hash);
+        if (mi != pwalletMain->mapWalletTxPosition.end())
+          setPositions.insert(mi->second);
+      }
+
+      std::set<CWalletTxPosition>::const_iterator itEnd = setPositions.end();
+      if (fCursorSet)
+        itEnd = setPositions.lower_bound(cursor);
+
+      std::string strNext;
+      std::set<CWalletTxPosition>::const_iterator it = itEnd;
+      while (it != setPositions.begin()) {
+        if (ret.size() >= nCount) {
+          strNext = it->ToCursor();
+          break;
+        }
+        --it;
+        std::map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(it->hash);
+        if (mi == pwalletMain->mapWallet.end() || !fInclude(mi->second))
+          continue;
+        zsWalletTxJSON(mi->second, ret, strAddress, true, returnType);
+      }
+
+      UniValue page(UniValue::VOBJ);
+      page.push_back(Pair("transactions", ret));
+      page.push_back(Pair("nextcursor", strNext));
+      return page;
+    }
+
+    //Created Ordered Transaction Map
+    map<int64_t, const CWalletTx*> orderedTxs;
+    for (const uint256& hash : setTxs) {
+      map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(hash);
+      if (mi != pwalletMain->mapWallet.end())
+        orderedTxs.insert(std::make_pair(mi->second.nOrderPos, &mi->second));
+    }
+
+    //Reverse Iterate thru transactions
+    for (map<int64_t, const CWalletTx*>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it) {
+      const CWalletTx& wtx = *(*it).second;
+
+      if (!fInclude(wtx))
+          continue;
+
+      zsWalletTxJSON(wtx, ret, strAddress, true, returnType);
+
+      if (ret.size() >= nCount) break;
+    }
+
+    vector<UniValue> arrTmp = ret.getValues();
+
+    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
+
+    ret.clear();
+    ret.setArray();
+    ret.push_backV(arrTmp);
+
+    return ret;
+}
+
 UniValue zs_listspentbyaddress(const UniValue& params, bool fHelp) {
   if (!EnsureWalletIsAvailable(fHelp))
       return NullUniValue;
 
-  if (fHelp || params.size() > 5 || params.size() == 3)
+  if (fHelp || params.size() > 6 || params.size() == 3)
       throw runtime_error(
         "zs_listspentbyaddress\n"
         "\nReturns decrypted Zero spent inputs for a single address.\n"
@@ -970,6 +1171,11 @@ UniValue zs_listspentbyaddress(const UniValue& params, bool fHelp) {
         "5. \"Count:\"                 (numeric, optional, default=9999999) \n"
         "                               Last n number of transactions returned\n"
         "\n"
+        "6. \"Cursor:\"                (string, optional) \n"
+        "                               Page through the address's transactions in block order, newest first,\n"
+        "                               as zs_listtransactions does. The result is then an object\n"
+        "                               {\"transactions\": [...], \"nextcursor\": \"cursor\"}.\n"
+        "\n"
         "Default Parameters:\n"
         "1. Zero Address\n"
         "2. 0 - O confimations required\n"
@@ -1018,92 +1224,14 @@ UniValue zs_listspentbyaddress(const UniValue& params, bool fHelp) {
         + HelpExampleRpc("zs_listspentbyaddress", "t1KzZ5n2TPEGYXTZ3WYGL1AYEumEQaRoHaL")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    UniValue ret(UniValue::VARR);
-
-    //param values`
-    int64_t nMinConfirms = 0;
-    int64_t nFilterType = 0;
-    int64_t nFilter = 9999999;
-    int64_t nCount = 9999999;
-
-    if (params.size() >= 2)
-      nMinConfirms = params[1].get_int64();
-
-    if (params.size() >= 4) {
-      nFilterType = params[2].get_int64();
-      nFilter = params[3].get_int64();
-    }
-
-    if (params.size() == 5) {
-      nCount = params[4].get_int64();
-    }
-
-    if (nMinConfirms < 0)
-      throw runtime_error("Minimum confimations must be greater that 0");
-
-    if (nFilterType < 0 || nFilterType > 2)
-        throw runtime_error("Filter type must be 0, 1 or 2.");
-
-    if (nFilter < 0)
-        throw runtime_error("Filter must be greater that 0.");
-
-      //Created Ordered Transaction Map
-      map<int64_t,CWalletTx> orderedTxs;
-      for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-        const CWalletTx& wtx = (*it).second;
-        orderedTxs.insert(std::pair<int64_t,CWalletTx>(wtx.nOrderPos, wtx));
-      }
-
-
-      uint64_t t = GetTime();
-      //Reverse Iterate thru transactions
-      for (map<int64_t,CWalletTx>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it) {
-        const CWalletTx& wtx = (*it).second;
-
-        if (!CheckFinalTx(wtx))
-            continue;
-
-        if (wtx.GetDepthInMainChain() < 0)
-            continue;
-
-        if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-            continue;
-
-        //Excude transactions with less confirmations than required
-        if (wtx.GetDepthInMainChain() < nMinConfirms)
-            continue;
-
-        //Exclude Transactions older that max days old
-        if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-            continue;
-
-        //Exclude transactions with greater than max confirmations
-        if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-            continue;
-
-        zsWalletTxJSON(wtx, ret, params[0].get_str() , true, 1);
-
-        if (ret.size() >= nCount) break;
-    }
-
-    vector<UniValue> arrTmp = ret.getValues();
-
-    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
-
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
-
-    return ret;
+    return zsListByAddress(params, 1);
 }
 
 UniValue zs_listreceivedbyaddress(const UniValue& params, bool fHelp) {
   if (!EnsureWalletIsAvailable(fHelp))
       return NullUniValue;
 
-  if (fHelp || params.size() > 5 || params.size() == 3)
+  if (fHelp || params.size() > 6 || params.size() == 3)
       throw runtime_error(
         "zs_listreceivedbyaddress\n"
         "\nReturns decrypted Zero received outputs for a single address.\n"
@@ -1128,6 +1256,11 @@ UniValue zs_listreceivedbyaddress(const UniValue& params, bool fHelp) {
         "5. \"Count:\"                 (numeric, optional, default=9999999) \n"
         "                               Last n number of transactions returned\n"
         "\n"
+        "6. \"Cursor:\"                (string, optional) \n"
+        "                               Page through the address's transactions in block order, newest first,\n"
+        "                               as zs_listtransactions does. The result is then an object\n"
+        "                               {\"transactions\": [...], \"nextcursor\": \"cursor\"}.\n"
+        "\n"
         "Default Parameters:\n"
         "2. 0 - O confimations required\n"
         "3. 0 - Returns all transactions\n"
@@ -1178,92 +1311,14 @@ UniValue zs_listreceivedbyaddress(const UniValue& params, bool fHelp) {
         + HelpExampleRpc("zs_listreceivedbyaddress", "t1KzZ5n2TPEGYXTZ3WYGL1AYEumEQaRoHaL")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    UniValue ret(UniValue::VARR);
-
-    //param values`
-    int64_t nMinConfirms = 0;
-    int64_t nFilterType = 0;
-    int64_t nFilter = 9999999;
-    int64_t nCount = 9999999;
-
-    if (params.size() >= 2)
-      nMinConfirms = params[1].get_int64();
-
-    if (params.size() >= 4) {
-      nFilterType = params[2].get_int64();
-      nFilter = params[3].get_int64();
-    }
-
-    if (params.size() == 5) {
-      nCount = params[4].get_int64();
-    }
-
-    if (nMinConfirms < 0)
-      throw runtime_error("Minimum confimations must be greater that 0");
-
-    if (nFilterType < 0 || nFilterType > 2)
-        throw runtime_error("Filter type must be 0, 1 or 2.");
-
-    if (nFilter < 0)
-        throw runtime_error("Filter must be greater that 0.");
-
-    //Created Ordered Transaction Map
-    map<int64_t,CWalletTx> orderedTxs;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      const CWalletTx& wtx = (*it).second;
-      orderedTxs.insert(std::pair<int64_t,CWalletTx>(wtx.nOrderPos, wtx));
-    }
-
-
-    uint64_t t = GetTime();
-    //Reverse Iterate thru transactions
-    for (map<int64_t,CWalletTx>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it) {
-      const CWalletTx& wtx = (*it).second;
-
-      if (!CheckFinalTx(wtx))
-          continue;
-
-      if (wtx.GetDepthInMainChain() < 0)
-          continue;
-
-      if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-          continue;
-
-      //Excude transactions with less confirmations than required
-      if (wtx.GetDepthInMainChain() < nMinConfirms)
-          continue;
-
-      //Exclude Transactions older that max days old
-      if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-          continue;
-
-      //Exclude transactions with greater than max confirmations
-      if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-          continue;
-
-        zsWalletTxJSON(wtx, ret, params[0].get_str() , true, 2);
-
-        if (ret.size() >= nCount) break;
-    }
-
-    vector<UniValue> arrTmp = ret.getValues();
-
-    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
-
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
-
-    return ret;
+    return zsListByAddress(params, 2);
 }
 
 UniValue zs_listsentbyaddress(const UniValue& params, bool fHelp) {
   if (!EnsureWalletIsAvailable(fHelp))
       return NullUniValue;
 
-  if (fHelp || params.size() > 5 || params.size() == 3)
+  if (fHelp || params.size() > 6 || params.size() == 3)
       throw runtime_error(
         "zs_listsentbyaddress\n"
         "\nReturns decrypted Zero outputs sent to a single address.\n"
@@ -1288,6 +1343,11 @@ UniValue zs_listsentbyaddress(const UniValue& params, bool fHelp) {
         "5. \"Count:\"                 (numeric, optional, default=9999999) \n"
         "                               Last n number of transactions returned\n"
         "\n"
+        "6. \"Cursor:\"                (string, optional) \n"
+        "                               Page through the address's transactions in block order, newest first,\n"
+        "                               as zs_listtransactions does. The result is then an object\n"
+        "                               {\"transactions\": [...], \"nextcursor\": \"cursor\"}.\n"
+        "\n"
         "Default Parameters:\n"
         "2. 0 - O confimations required\n"
         "3. 0 - Returns all transactions\n"
@@ -1335,86 +1395,7 @@ UniValue zs_listsentbyaddress(const UniValue& params, bool fHelp) {
         + HelpExampleRpc("zs_listsentbyaddress", "t1KzZ5n2TPEGYXTZ3WYGL1AYEumEQaRoHaL")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    UniValue ret(UniValue::VARR);
-
-    //param values`
-    int64_t nMinConfirms = 0;
-    int64_t nFilterType = 0;
-    int64_t nFilter = 9999999;
-    int64_t nCount = 9999999;
-
-    if (params.size() >= 2)
-      nMinConfirms = params[1].get_int64();
-
-    if (params.size() >= 4) {
-      nFilterType = params[2].get_int64();
-      nFilter = params[3].get_int64();
-    }
-
-    if (params.size() == 5) {
-      nCount = params[4].get_int64();
-    }
-
-    if (nMinConfirms < 0)
-      throw runtime_error("Minimum confimations must be greater that 0");
-
-    if (nFilterType < 0 || nFilterType > 2)
-        throw runtime_error("Filter type must be 0, 1 or 2.");
-
-    if (nFilter < 0)
-        throw runtime_error("Filter must be greater that 0.");
-
-    //Created Ordered Transaction Map
-    map<int64_t,CWalletTx> orderedTxs;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      const CWalletTx& wtx = (*it).second;
-      orderedTxs.insert(std::pair<int64_t,CWalletTx>(wtx.nOrderPos, wtx));
-    }
-
-
-    uint64_t t = GetTime();
-    //Reverse Iterate thru transactions
-    for (map<int64_t,CWalletTx>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it) {
-      const CWalletTx& wtx = (*it).second;
-
-      if (!CheckFinalTx(wtx))
-          continue;
-
-      if (wtx.GetDepthInMainChain() < 0)
-          continue;
-
-      if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-          continue;
-
-      //Excude transactions with less confirmations than required
-      if (wtx.GetDepthInMainChain() < nMinConfirms)
-          continue;
-
-      //Exclude Transactions older that max days old
-      if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-          continue;
-
-      //Exclude transactions with greater than max confirmations
-      if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-          continue;
-
-      zsWalletTxJSON(wtx, ret, params[0].get_str() , true, 3);
-
-
-      if (ret.size() >= nCount) break;
-    }
-
-    vector<UniValue> arrTmp = ret.getValues();
-
-    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
-
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
-
-    return ret;
+    return zsListByAddress(params, 3);
 }
 
 
@@ -1506,11 +1487,11 @@ UniValue getalldata(const UniValue& params, bool fHelp)
 
 
     //Create Ordered List
-    map<int64_t,CWalletTx> orderedTxs;
+    map<int64_t, const CWalletTx*> orderedTxs;
     for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
       const uint256& wtxid = it->first;
       const CWalletTx& wtx = (*it).second;
-      orderedTxs.insert(std::pair<int64_t,CWalletTx>(wtx.nOrderPos, wtx));
+      orderedTxs.insert(std::make_pair(wtx.nOrderPos, &wtx));
 
       unsigned int txType = 0;
       // 0 Unassigend
@@ -1753,9 +1734,9 @@ UniValue getalldata(const UniValue& params, bool fHelp)
 
 
         uint64_t t = GetTime();
-        for (map<int64_t,CWalletTx>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it)
+        for (map<int64_t, const CWalletTx*>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it)
         {
-            const CWalletTx& wtx = (*it).second;
+            const CWalletTx& wtx = *(*it).second;
 
             if (!CheckFinalTx(wtx))
                 continue;
@@ -307,4 +307,33 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_exact_match)
+{
+    std::vector<size_t> vSelected;
+    std::vector<CAmount> vValues = {30 * CENT, 20 * CENT, 8 * CENT, 7 * CENT, 6 * CENT, 5 * CENT};
+
+    BOOST_CHECK(SelectCoinsExactMatch(vValues, 33 * CENT, vSelected));
+    CAmount nSum = 0;
+    BOOST_FOREACH(size_t i, vSelected)
+        nSum += vValues[i];
+    BOOST_CHECK_EQUAL(nSum, 33 * CENT);
+
+    // No subset adds up to 16 cents, or to more than there is
+    BOOST_CHECK(!SelectCoinsExactMatch(vValues, 16 * CENT, vSelected));
+    BOOST_CHECK(!SelectCoinsExactMatch(vValues, 77 * CENT, vSelected));
+
+    // Equal coins are not tried in every combination
+    std::vector<CAmount> vEqual(40, 3 * CENT);
+    BOOST_CHECK(!SelectCoinsExactMatch(vEqual, 61 * CENT, vSelected, 1000));
+    BOOST_CHECK(SelectCoinsExactMatch(vEqual, 60 * CENT, vSelected, 1000));
+    BOOST_CHECK_EQUAL(vSelected.size(), 20U);
+
+    // The search gives up when its budget runs out, even if a subset exists
+    std::vector<CAmount> vEven;
+    for (int i = 40; i > 0; i--)
+        vEven.push_back(2 * i * CENT + 1);
+    BOOST_CHECK(!SelectCoinsExactMatch(vEven, 3 + 12 * CENT, vSelected, 10));
+    BOOST_CHECK(SelectCoinsExactMatch(vEven, 3 + 12 * CENT, vSelected));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
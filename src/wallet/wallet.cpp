@@ -23,15 +23,20 @@
 #include "script/sign.h"
 #include "zeronode/spork.h"
 #include "zeronode/swifttx.h"
+#include "taskpool.h"
 #include "timedata.h"
+#include "trace.h"
 #include "utilmoneystr.h"
 #include "zcash/Note.hpp"
 #include "crypter.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
 #include "wallet/asyncrpcoperation_saplingconsolidation.h"
+#include "wallet/asyncrpcoperation_saplingnotepool.h"
 #include "zcash/zip32.h"
 
 #include <assert.h>
+#include <atomic>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -58,6 +63,13 @@ bool fTxConflictDeleteEnabled = false;
 int fDeleteInterval = DEFAULT_TX_DELETE_INTERVAL;
 unsigned int fDeleteTransactionsAfterNBlocks = DEFAULT_TX_RETENTION_BLOCKS;
 unsigned int fKeepLastNTransactions = DEFAULT_TX_RETENTION_LASTTX;
+int nRescanThreads = 1;
+int nRescanCheckpointInterval = DEFAULT_RESCAN_CHECKPOINT_INTERVAL;
+std::atomic<int> nRescanProgress(-1);
+int nNoteDecryptionThreads = 1;
+int nWalletLoadThreads = 1;
+bool fShieldedOnlyScan = DEFAULT_SHIELDED_ONLY_SCAN;
+int nProvingThreads = 1;
 
 /**
  * Fees smaller than this (in satoshi) are considered zero fee (for transaction creation)
@@ -119,70 +131,204 @@ libzcash::SproutPaymentAddress CWallet::GenerateNewSproutZKey()
     return addr;
 }
 
+// Derive m/32'/coin_type', the parent of the Sapling account keys
+static libzcash::SaplingExtendedSpendingKey DeriveSaplingAccountParent(const HDSeed& seed)
+{
+    auto m = libzcash::SaplingExtendedSpendingKey::Master(seed);
+    uint32_t bip44CoinType = Params().BIP44CoinType();
+
+    // We use a fixed keypath scheme of m/32'/coin_type'/account'
+    // Derive m/32'
+    auto m_32h = m.Derive(32 | ZIP32_HARDENED_KEY_LIMIT);
+    // Derive m/32'/coin_type'
+    return m_32h.Derive(bip44CoinType | ZIP32_HARDENED_KEY_LIMIT);
+}
+
+// Derive the account keys nFirst' to nFirst + nCount - 1' on the task pool
+static std::vector<libzcash::SaplingExtendedSpendingKey> DeriveSaplingAccountKeys(
+    const libzcash::SaplingExtendedSpendingKey& m_32h_cth, uint32_t nFirst, size_t nCount)
+{
+    std::vector<libzcash::SaplingExtendedSpendingKey> vKeys(nCount);
+    GetTaskPool().ParallelFor(TASKPOOL_WALLET, nCount, GetNumCores(), [&](size_t i) {
+        vKeys[i] = m_32h_cth.Derive((nFirst + i) | ZIP32_HARDENED_KEY_LIMIT);
+    });
+    return vKeys;
+}
+
 // Generate a new Sapling spending key and return its public payment address
 SaplingPaymentAddress CWallet::GenerateNewSaplingZKey(bool resetCounter)
 {
-    AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
+    return GenerateNewSaplingZKeys(1, resetCounter)[0];
+}
+
+std::vector<SaplingPaymentAddress> CWallet::GenerateNewSaplingZKeys(unsigned int nCount, bool resetCounter)
+{
+    AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata, saplingKeyPool
 
     // Create new metadata
     int64_t nCreationTime = GetTime();
-    CKeyMetadata metadata(nCreationTime);
+    uint32_t bip44CoinType = Params().BIP44CoinType();
 
     // Try to get the seed
     HDSeed seed;
     if (!GetHDSeed(seed))
         throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): HD seed not found");
 
-    auto m = libzcash::SaplingExtendedSpendingKey::Master(seed);
-    uint32_t bip44CoinType = Params().BIP44CoinType();
-
-    // We use a fixed keypath scheme of m/32'/coin_type'/account'
-    // Derive m/32'
-    auto m_32h = m.Derive(32 | ZIP32_HARDENED_KEY_LIMIT);
-    // Derive m/32'/coin_type'
-    auto m_32h_cth = m_32h.Derive(bip44CoinType | ZIP32_HARDENED_KEY_LIMIT);
-
-    // Derive account key at next index, skip keys already known to the wallet
-    libzcash::SaplingExtendedSpendingKey xsk;
-
     //reset saplingAccountCounter
     if (resetCounter)
       hdChain.saplingAccountCounter = 0;
-      
-    do
-    {
-        xsk = m_32h_cth.Derive(hdChain.saplingAccountCounter | ZIP32_HARDENED_KEY_LIMIT);
-        metadata.hdKeypath = "m/32'/" + std::to_string(bip44CoinType) + "'/" + std::to_string(hdChain.saplingAccountCounter) + "'";
-        metadata.seedFp = hdChain.seedFp;
+
+    // Pooled keys of another seed are of no use
+    if (saplingKeyPoolSeedFp != seed.Fingerprint()) {
+        saplingKeyPool.clear();
+        saplingKeyPoolSeedFp = seed.Fingerprint();
+    }
+
+    // Derive account keys at the next indices, skip keys already known to the wallet
+    std::vector<std::pair<libzcash::SaplingExtendedSpendingKey, CKeyMetadata> > vNewKeys;
+    boost::optional<libzcash::SaplingExtendedSpendingKey> m_32h_cth;
+    while (vNewKeys.size() < nCount) {
+        while (!saplingKeyPool.empty() && saplingKeyPool.front().first < hdChain.saplingAccountCounter)
+            saplingKeyPool.pop_front();
+        if (saplingKeyPool.empty() || saplingKeyPool.front().first != hdChain.saplingAccountCounter) {
+            // Derive what the batch still needs in one go, up to the next pooled key
+            if (!m_32h_cth)
+                m_32h_cth = DeriveSaplingAccountParent(seed);
+            uint32_t nFirst = hdChain.saplingAccountCounter;
+            size_t nDerive = nCount - vNewKeys.size();
+            if (!saplingKeyPool.empty())
+                nDerive = std::min<size_t>(nDerive, saplingKeyPool.front().first - nFirst);
+            std::vector<libzcash::SaplingExtendedSpendingKey> vKeys = DeriveSaplingAccountKeys(*m_32h_cth, nFirst, nDerive);
+            for (size_t i = vKeys.size(); i > 0; i--)
+                saplingKeyPool.push_front(std::make_pair(nFirst + (uint32_t)(i - 1), vKeys[i - 1]));
+        }
+
+        uint32_t nIndex = saplingKeyPool.front().first;
+        libzcash::SaplingExtendedSpendingKey xsk = saplingKeyPool.front().second;
+        saplingKeyPool.pop_front();
         // Increment childkey index
-        hdChain.saplingAccountCounter++;
-    } while (HaveSaplingSpendingKey(xsk.expsk.full_viewing_key()));
+        hdChain.saplingAccountCounter = nIndex + 1;
+        if (HaveSaplingSpendingKey(xsk.expsk.full_viewing_key()))
+            continue;
+
+        CKeyMetadata metadata(nCreationTime);
+        metadata.hdKeypath = "m/32'/" + std::to_string(bip44CoinType) + "'/" + std::to_string(nIndex) + "'";
+        metadata.seedFp = hdChain.seedFp;
+        vNewKeys.push_back(std::make_pair(xsk, metadata));
+    }
+
+    // Write the chain model and the keys in one database transaction
+    CWalletDB walletdb(strWalletFile);
+    bool fBatch = fFileBacked && vNewKeys.size() > 1 && walletdb.TxnBegin();
 
     // Update the chain model in the database
-    if (fFileBacked && !CWalletDB(strWalletFile).WriteHDChain(hdChain))
+    if (fFileBacked && !walletdb.WriteHDChain(hdChain)) {
+        if (fBatch)
+            walletdb.TxnAbort();
         throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): Writing HD chain model failed");
+    }
 
-    auto ivk = xsk.expsk.full_viewing_key().in_viewing_key();
-    mapSaplingZKeyMetadata[ivk] = metadata;
+    // Keys that were just made have sent nothing to index
+    bool fIndexComplete = fAddressTxIndexComplete;
+    std::vector<SaplingPaymentAddress> vAddresses;
+    for (const auto& newKey : vNewKeys) {
+        auto ivk = newKey.first.expsk.full_viewing_key().in_viewing_key();
+        mapSaplingZKeyMetadata[ivk] = newKey.second;
 
-    auto addr = xsk.DefaultAddress();
-    if (!AddSaplingZKey(xsk, addr)) {
-        throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): AddSaplingZKey failed");
+        auto addr = newKey.first.DefaultAddress();
+        if (!AddSaplingZKey(newKey.first, addr, fBatch ? &walletdb : NULL)) {
+            if (fBatch)
+                walletdb.TxnAbort();
+            throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): AddSaplingZKey failed");
+        }
+        // return default sapling payment address.
+        vAddresses.push_back(addr);
     }
-    // return default sapling payment address.
-    return addr;
+    fAddressTxIndexComplete = fIndexComplete;
+    if (fBatch && !walletdb.TxnCommit())
+        throw std::runtime_error("CWallet::GenerateNewSaplingZKey(): Writing keys failed");
+    return vAddresses;
+}
+
+bool CWallet::TopUpSaplingKeyPool(unsigned int kpSize)
+{
+    unsigned int nTargetSize;
+    if (kpSize > 0)
+        nTargetSize = kpSize;
+    else
+        nTargetSize = std::max(GetArg("-saplingkeypool", DEFAULT_SAPLING_KEYPOOL_SIZE), (int64_t) 0);
+
+    HDSeed seed;
+    uint32_t nFirst;
+    size_t nMissing;
+    {
+        LOCK(cs_wallet);
+        if (IsLocked() || !GetHDSeed(seed))
+            return false;
+
+        if (saplingKeyPoolSeedFp != seed.Fingerprint()) {
+            saplingKeyPool.clear();
+            saplingKeyPoolSeedFp = seed.Fingerprint();
+        }
+        while (!saplingKeyPool.empty() && saplingKeyPool.front().first < hdChain.saplingAccountCounter)
+            saplingKeyPool.pop_front();
+        if (saplingKeyPool.size() >= nTargetSize)
+            return true;
+        nFirst = saplingKeyPool.empty() ? hdChain.saplingAccountCounter : saplingKeyPool.back().first + 1;
+        nMissing = nTargetSize - saplingKeyPool.size();
+    }
+
+    // Derive outside the lock, which z_getnewaddress and the rest of the wallet need meanwhile
+    std::vector<libzcash::SaplingExtendedSpendingKey> vKeys =
+        DeriveSaplingAccountKeys(DeriveSaplingAccountParent(seed), nFirst, nMissing);
+
+    LOCK(cs_wallet);
+    if (IsLocked() || saplingKeyPoolSeedFp != seed.Fingerprint())
+        return false;
+    // Keys were taken from the pool meanwhile: keep those still ahead of it
+    uint32_t nNext = saplingKeyPool.empty() ? hdChain.saplingAccountCounter : saplingKeyPool.back().first + 1;
+    size_t nAdded = 0;
+    for (size_t i = 0; i < vKeys.size(); i++) {
+        if (nFirst + i == nNext) {
+            saplingKeyPool.push_back(std::make_pair(nNext++, vKeys[i]));
+            nAdded++;
+        }
+    }
+    LogPrint("wallet", "Sapling keypool added %u keys, size=%u\n", nAdded, saplingKeyPool.size());
+    return true;
+}
+
+bool CWallet::Lock()
+{
+    {
+        LOCK(cs_wallet);
+        // The pool holds spending keys in the clear
+        saplingKeyPool.clear();
+    }
+    return CCryptoKeyStore::Lock();
 }
 
 // Add spending key to keystore
 bool CWallet::AddSaplingZKey(
     const libzcash::SaplingExtendedSpendingKey &sk,
-    const libzcash::SaplingPaymentAddress &defaultAddr)
+    const libzcash::SaplingPaymentAddress &defaultAddr,
+    CWalletDB* pwalletdb)
 {
     AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
 
-    if (!CCryptoKeyStore::AddSaplingSpendingKey(sk, defaultAddr)) {
+    // Encrypted keys are written by AddCryptedSaplingSpendingKey, through
+    // pwalletdbEncryption when set; tunnel pwalletdb to it
+    bool fTunnel = pwalletdb && !pwalletdbEncryption;
+    if (fTunnel)
+        pwalletdbEncryption = pwalletdb;
+    bool fAdded = CCryptoKeyStore::AddSaplingSpendingKey(sk, defaultAddr);
+    if (fTunnel)
+        pwalletdbEncryption = NULL;
+    if (!fAdded) {
         return false;
     }
+    InvalidateBalanceSnapshot();
+    fAddressTxIndexComplete = false;
 
     if (!fFileBacked) {
         return true;
@@ -190,6 +336,8 @@ bool CWallet::AddSaplingZKey(
 
     if (!IsCrypted()) {
         auto ivk = sk.expsk.full_viewing_key().in_viewing_key();
+        if (pwalletdb)
+            return pwalletdb->WriteSaplingZKey(ivk, sk, mapSaplingZKeyMetadata[ivk]);
         return CWalletDB(strWalletFile).WriteSaplingZKey(ivk, sk, mapSaplingZKeyMetadata[ivk]);
     }
 
@@ -227,6 +375,7 @@ bool CWallet::AddSproutZKey(const libzcash::SproutSpendingKey &key)
 
     if (!CCryptoKeyStore::AddSproutSpendingKey(key))
         return false;
+    InvalidateBalanceSnapshot();
 
     // check if we need to remove from viewing keys
     if (HaveSproutViewingKey(addr))
@@ -264,16 +413,36 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
+    // A key that was just made has no outputs to index
+    bool fIndexComplete = fUnspentOutputIndexComplete;
     if (!AddKeyPubKey(secret, pubkey))
         throw std::runtime_error("CWallet::GenerateNewKey(): AddKey failed");
+    fUnspentOutputIndexComplete = fIndexComplete;
     return pubkey;
 }
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+{
+    CWalletDB walletdb(strWalletFile);
+    return AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+}
+
+bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const CPubKey &pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+
+    // CCryptoKeyStore calls AddCryptedKey, which writes through
+    // pwalletdbEncryption when set; tunnel walletdb to it
+    bool fTunnel = !pwalletdbEncryption;
+    if (fTunnel)
+        pwalletdbEncryption = &walletdb;
+    bool fAdded = CCryptoKeyStore::AddKeyPubKey(secret, pubkey);
+    if (fTunnel)
+        pwalletdbEncryption = NULL;
+    if (!fAdded)
         return false;
+    InvalidateBalanceSnapshot();
+    fUnspentOutputIndexComplete = false;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -284,9 +453,9 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
+        return walletdb.WriteKey(pubkey,
+                                 secret.GetPrivKey(),
+                                 mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
 }
@@ -426,6 +595,7 @@ bool CWallet::AddSproutViewingKey(const libzcash::SproutViewingKey &vk)
     if (!CCryptoKeyStore::AddSproutViewingKey(vk)) {
         return false;
     }
+    InvalidateBalanceSnapshot();
     nTimeFirstKey = 1; // No birthday information for viewing keys.
     if (!fFileBacked) {
         return true;
@@ -457,6 +627,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    InvalidateBalanceSnapshot();
+    fUnspentOutputIndexComplete = false;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -482,6 +654,8 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    InvalidateBalanceSnapshot();
+    fUnspentOutputIndexComplete = false;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -494,6 +668,8 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    InvalidateBalanceSnapshot();
+    fUnspentOutputIndexComplete = false;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -586,6 +762,9 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        SaplingMerkleTree saplingTree,
                        bool added)
 {
+    // Write out the transactions added while connecting this block
+    FlushDeferredTxWrites();
+
     if (added) {
         // Prevent witness cache building as well as migration && consolidation transactions
         // from being created when node is syncing after launch,
@@ -597,7 +776,8 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
             BuildWitnessCache(pindex, false);
             RunSaplingMigration(pindex->nHeight);
             RunSaplingConsolidation(pindex->nHeight);
-            DeleteWalletTransactions(pindex);
+            RunSaplingNotePool(pindex->nHeight);
+            RequestWalletTransactionDeletion();
         } else {
             //Build intial witnesses on every block
             BuildWitnessCache(pindex, true);
@@ -610,6 +790,13 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
         DecrementNoteWitnesses(pindex);
         UpdateNullifierNoteMapForBlock(pblock);
     }
+
+    // Rebuilding the snapshot on every block would slow down the initial sync
+    if (!IsInitialBlockDownload(Params())) {
+        UpdateBalanceSnapshot();
+    } else {
+        InvalidateBalanceSnapshot();
+    }
 }
 
 void CWallet::RunSaplingMigration(int blockHeight) {
@@ -679,6 +866,30 @@ void CWallet::RunSaplingConsolidation(int blockHeight) {
     }
 }
 
+void CWallet::RunSaplingNotePool(int blockHeight) {
+    if (nSaplingNotePoolSize <= 0) {
+        return;
+    }
+    if (!Params().GetConsensus().NetworkUpgradeActive(blockHeight, Consensus::UPGRADE_SAPLING)) {
+        return;
+    }
+    LOCK(cs_wallet);
+
+    // Only one refill at a time, the next block checks the pool again
+    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+    std::shared_ptr<AsyncRPCOperation> lastOperation = q->getOperationForId(saplingNotePoolOperationId);
+    if (lastOperation != nullptr) {
+        if (lastOperation->isReady() || lastOperation->isExecuting()) {
+            return;
+        }
+        // A check runs on every block, so don't keep the finished ones around
+        q->popOperationForId(saplingNotePoolOperationId);
+    }
+    std::shared_ptr<AsyncRPCOperation> operation(new AsyncRPCOperation_saplingnotepool(blockHeight + 1));
+    saplingNotePoolOperationId = operation->getId();
+    q->addOperation(operation);
+}
+
 void CWallet::CommitConsolidationTx(const CTransaction& tx) {
   CWalletTx wtx(this, tx);
   CommitTransaction(wtx, boost::none);
@@ -686,6 +897,7 @@ void CWallet::CommitConsolidationTx(const CTransaction& tx) {
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    FlushDeferredTxWrites();
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
@@ -990,64 +1202,172 @@ unsigned int CWallet::GetSpendDepth(const uint256& hash, unsigned int n) const
     return 0;
 }
 
-/**
- * Note is spent if any non-conflicted transaction
- * spends it:
- */
-bool CWallet::IsSproutSpent(const uint256& nullifier) const {
-    pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range;
-    range = mapTxSproutNullifiers.equal_range(nullifier);
+size_t CNullifierSpendCache::Slot(const uint256& nullifier) const
+{
+    return nullifier.GetCheapHash() & (vEntries.size() - 1);
+}
 
-    for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
-        const uint256& wtxid = it->second;
-        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
-        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
-            return true; // Spent
+bool CNullifierSpendCache::Lookup(const uint256& nullifier, const CBlockIndex* pindex, int& nDepth) const
+{
+    if (pindex != pindexTip || vEntries.empty())
+        return false;
+    for (size_t i = Slot(nullifier); vEntries[i].fUsed; i = (i + 1) & (vEntries.size() - 1)) {
+        if (vEntries[i].nullifier == nullifier) {
+            nDepth = vEntries[i].nDepth;
+            return true;
         }
     }
     return false;
 }
 
-unsigned int CWallet::GetSproutSpendDepth(const uint256& nullifier) const {
-    pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range;
-    range = mapTxSproutNullifiers.equal_range(nullifier);
+void CNullifierSpendCache::Insert(const uint256& nullifier, const CBlockIndex* pindex, int nDepth)
+{
+    if (pindex != pindexTip) {
+        Clear();
+        pindexTip = pindex;
+    }
 
-    for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
-        const uint256& wtxid = it->second;
-        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
-        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
-            return mit->second.GetDepthInMainChain(); // Spent
+    // Keep the table at most half full, doubling it as needed
+    if (2 * (nUsed + 1) > vEntries.size()) {
+        std::vector<Entry> vOld;
+        vOld.swap(vEntries);
+        vEntries.resize(std::max<size_t>(64, 2 * vOld.size()));
+        nUsed = 0;
+        for (const Entry& entry : vOld) {
+            if (entry.fUsed)
+                Insert(entry.nullifier, pindex, entry.nDepth);
         }
     }
-    return 0;
+
+    size_t i = Slot(nullifier);
+    while (vEntries[i].fUsed && vEntries[i].nullifier != nullifier)
+        i = (i + 1) & (vEntries.size() - 1);
+    if (!vEntries[i].fUsed) {
+        vEntries[i].fUsed = true;
+        vEntries[i].nullifier = nullifier;
+        nUsed++;
+    }
+    vEntries[i].nDepth = nDepth;
 }
 
-bool CWallet::IsSaplingSpent(const uint256& nullifier) const {
+size_t CNullifierSpendCache::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vEntries);
+}
+
+void CNullifierSpendCache::Clear()
+{
+    if (vEntries.empty() && pindexTip == NULL)
+        return;
+    std::vector<Entry>().swap(vEntries);
+    nUsed = 0;
+    pindexTip = NULL;
+}
+
+/**
+ * Depth of the first non-conflicted transaction spending the nullifier, or
+ * -1 if it is unspent.
+ */
+int CWallet::GetNullifierSpendDepth(const TxNullifiers& mapNullifiers, CNullifierSpendCache& cache, const uint256& nullifier) const
+{
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    int nDepth;
+    {
+        LOCK(cs_nullifierSpendCache);
+        if (cache.Lookup(nullifier, pindexTip, nDepth))
+            return nDepth;
+    }
+
+    // The depth of an unconfirmed spend depends on the mempool rather than
+    // the tip, so results that involve one are not cached
+    nDepth = -1;
+    bool fCacheable = true;
     pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range;
-    range = mapTxSaplingNullifiers.equal_range(nullifier);
+    range = mapNullifiers.equal_range(nullifier);
 
     for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
         const uint256& wtxid = it->second;
         std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
-        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
-            return true; // Spent
+        if (mit != mapWallet.end()) {
+            int nTxDepth = mit->second.GetDepthInMainChain();
+            if (nTxDepth <= 0)
+                fCacheable = false;
+            if (nTxDepth >= 0) {
+                nDepth = nTxDepth;
+                break;
+            }
         }
     }
-    return false;
+
+    if (fCacheable) {
+        LOCK(cs_nullifierSpendCache);
+        cache.Insert(nullifier, pindexTip, nDepth);
+    }
+    return nDepth;
 }
 
-unsigned int CWallet::GetSaplingSpendDepth(const uint256& nullifier) const {
-    pair<TxNullifiers::const_iterator, TxNullifiers::const_iterator> range;
-    range = mapTxSaplingNullifiers.equal_range(nullifier);
+void CWallet::ClearNullifierSpendCaches()
+{
+    LOCK(cs_nullifierSpendCache);
+    sproutSpendCache.Clear();
+    saplingSpendCache.Clear();
+}
 
-    for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
-        const uint256& wtxid = it->second;
-        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
-        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
-            return mit->second.GetDepthInMainChain(); // Spent
-        }
+CWalletMemoryUsage CWallet::GetMemoryUsage() const
+{
+    LOCK(cs_wallet);
+    CWalletMemoryUsage usage;
+    usage.nTransactions = memusage::DynamicUsage(mapWallet);
+    for (const auto& item : mapWallet) {
+        const CWalletTx& wtx = item.second;
+        usage.nTransactions += RecursiveDynamicUsage(wtx) + memusage::DynamicUsage(wtx.vJoinSplit) +
+                               memusage::DynamicUsage(wtx.vShieldedSpend) + memusage::DynamicUsage(wtx.vShieldedOutput) +
+                               memusage::DynamicUsage(wtx.vMerkleBranch) + memusage::DynamicUsage(wtx.mapValue) +
+                               memusage::DynamicUsage(wtx.vOrderForm) + memusage::DynamicUsage(wtx.mapSproutNoteData) +
+                               memusage::DynamicUsage(wtx.mapSaplingNoteData);
+        for (const auto& nd : wtx.mapSproutNoteData) {
+            usage.nWitnesses += memusage::DynamicUsage(nd.second.witnesses);
+            for (const SproutWitness& witness : nd.second.witnesses)
+                usage.nWitnesses += witness.DynamicMemoryUsage();
+        }
+        for (const auto& nd : wtx.mapSaplingNoteData) {
+            usage.nWitnesses += memusage::DynamicUsage(nd.second.witnesses);
+            for (const SaplingWitness& witness : nd.second.witnesses)
+                usage.nWitnesses += witness.DynamicMemoryUsage();
+        }
+    }
+    usage.nIndexes = memusage::DynamicUsage(mapTxSpends) + memusage::DynamicUsage(mapTxSproutNullifiers) +
+                     memusage::DynamicUsage(mapTxSaplingNullifiers) + memusage::DynamicUsage(mapSproutNullifiersToNotes) +
+                     memusage::DynamicUsage(mapSaplingNullifiersToNotes) + memusage::DynamicUsage(setWalletTxByHeight) +
+                     memusage::DynamicUsage(mapWalletTxPosition) + memusage::DynamicUsage(mapTxWrittenHash) +
+                     memusage::DynamicUsage(setDeferredTxWrites) + memusage::DynamicUsage(mapRequestCount) +
+                     memusage::DynamicUsage(mapAddressBook) + saplingNoteIndex.DynamicMemoryUsage() +
+                     unspentOutputIndex.DynamicMemoryUsage() + addressTxIndex.DynamicMemoryUsage();
+    {
+        LOCK(cs_nullifierSpendCache);
+        usage.nIndexes += sproutSpendCache.DynamicMemoryUsage() + saplingSpendCache.DynamicMemoryUsage();
     }
-    return 0;
+    return usage;
+}
+
+/**
+ * Note is spent if any non-conflicted transaction
+ * spends it:
+ */
+bool CWallet::IsSproutSpent(const uint256& nullifier) const {
+    return GetNullifierSpendDepth(mapTxSproutNullifiers, sproutSpendCache, nullifier) >= 0;
+}
+
+unsigned int CWallet::GetSproutSpendDepth(const uint256& nullifier) const {
+    return std::max(0, GetNullifierSpendDepth(mapTxSproutNullifiers, sproutSpendCache, nullifier));
+}
+
+bool CWallet::IsSaplingSpent(const uint256& nullifier) const {
+    return GetNullifierSpendDepth(mapTxSaplingNullifiers, saplingSpendCache, nullifier) >= 0;
+}
+
+unsigned int CWallet::GetSaplingSpendDepth(const uint256& nullifier) const {
+    return std::max(0, GetNullifierSpendDepth(mapTxSaplingNullifiers, saplingSpendCache, nullifier));
 }
 
 void CWallet::AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid)
@@ -1062,6 +1382,7 @@ void CWallet::AddToTransparentSpends(const COutPoint& outpoint, const uint256& w
 void CWallet::AddToSproutSpends(const uint256& nullifier, const uint256& wtxid)
 {
     mapTxSproutNullifiers.insert(make_pair(nullifier, wtxid));
+    ClearNullifierSpendCaches();
 
     pair<TxNullifiers::iterator, TxNullifiers::iterator> range;
     range = mapTxSproutNullifiers.equal_range(nullifier);
@@ -1071,6 +1392,7 @@ void CWallet::AddToSproutSpends(const uint256& nullifier, const uint256& wtxid)
 void CWallet::AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid)
 {
     mapTxSaplingNullifiers.insert(make_pair(nullifier, wtxid));
+    ClearNullifierSpendCaches();
 
     pair<TxNullifiers::iterator, TxNullifiers::iterator> range;
     range = mapTxSaplingNullifiers.equal_range(nullifier);
@@ -1217,7 +1539,7 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
         //Sprout
         for (auto& item : wtxItem.second.mapSproutNoteData) {
             auto* nd = &(item.second);
-            if (nd->nullifier && pwalletMain->GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
+            if (nd->nullifier && GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
               // Only decrement witnesses that are not above the current height
                 if (nd->witnessHeight <= pindex->nHeight) {
                     if (nd->witnesses.size() > 1) {
@@ -1232,7 +1554,7 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
         //Sapling
         for (auto& item : wtxItem.second.mapSaplingNoteData) {
             auto* nd = &(item.second);
-            if (nd->nullifier && pwalletMain->GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
+            if (nd->nullifier && GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
                 // Only decrement witnesses that are not above the current height
                 if (nd->witnessHeight <= pindex->nHeight) {
                     if (nd->witnesses.size() > 1) {
@@ -1428,21 +1750,19 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
         LogPrintf("Setting Inital Sapling Witness for tx %s, %i of %i\n", wtxHash.ToString(), nWitnessTxIncrement, nWitnessTotalTxCount);
 
         SaplingMerkleTree saplingTree;
-        blockRoot = pblockindex->pprev->hashFinalSaplingRoot;
-        pcoinsTip->GetSaplingAnchorAt(blockRoot, saplingTree);
+        GetSaplingTreeAt(pblockindex->pprev, saplingTree);
 
         //Cycle through blocks and transactions building sapling tree until the commitment needed is reached
-        const CBlock* pblock;
-        CBlock block;
-        ReadBlockFromDisk(block, pblockindex, Params().GetConsensus());
-        pblock = &block;
+        //(from the compact block once the block has been pruned)
+        CCompactBlock block;
+        ReadCompactBlock(block, pblockindex, Params().GetConsensus());
 
-        for (const CTransaction& tx : block.vtx) {
-          auto hash = tx.GetHash();
+        for (const CCompactTx& tx : block.vtx) {
+          const uint256& hash = tx.hash;
 
           // Sapling
-          for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-            const uint256& note_commitment = tx.vShieldedOutput[i].cm;
+          for (uint32_t i = 0; i < tx.vOutputs.size(); i++) {
+            const uint256& note_commitment = tx.vOutputs[i].cmu;
 
             // Increment existing witness until the end of the block
             if (!nd->witnesses.empty()) {
@@ -1476,6 +1796,45 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
   return nMinimumHeight;
 }
 
+/**
+ * Notes whose witnesses are advanced by BuildWitnessCache, bucketed by the
+ * height their witness cache is currently valid for.
+ */
+template<typename NoteData>
+using WitnessIndex = std::map<int, std::vector<NoteData*>>;
+
+/**
+ * Advance every note in the bucket for nHeight - 1 by one block, appending
+ * the block's commitments, and move them to the bucket for nHeight. The
+ * witnesses all end at the same tree position, so the subtrees of the
+ * block's commitments are hashed once for all of them.
+ */
+template<typename NoteData>
+static void AdvanceNoteWitnesses(WitnessIndex<NoteData>& index,
+                                 const std::vector<uint256>& commitments,
+                                 int nHeight)
+{
+    auto it = index.find(nHeight - 1);
+    if (it == index.end() || it->second.empty()) {
+        return;
+    }
+
+    typedef typename decltype(NoteData::witnesses)::value_type Witness;
+    typename Witness::AppendBatch batch(it->second.front()->witnesses.front().next_position(), commitments);
+
+    std::vector<NoteData*>& advanced = index[nHeight];
+    for (NoteData* nd : it->second) {
+        nd->witnesses.push_front(nd->witnesses.front());
+        while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
+            nd->witnesses.pop_back();
+        }
+        nd->witnesses.front().append_many(batch);
+        nd->witnessHeight = nHeight;
+        advanced.push_back(nd);
+    }
+    index.erase(it);
+}
+
 void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
 {
 
@@ -1487,89 +1846,93 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
     return;
   }
 
-  uint256 sproutRoot;
-  uint256 saplingRoot;
-  CBlockIndex* pblockindex = chainActive[startHeight];
-  int height = chainActive.Height();
-
-  while (pblockindex) {
-
-    if (pblockindex->nHeight % 100 == 0 && pblockindex->nHeight < height - 5) {
-      LogPrintf("Building Witnesses for block %i %.4f complete\n", pblockindex->nHeight, pblockindex->nHeight / double(height));
-    }
-
-    SproutMerkleTree sproutTree;
-    sproutRoot = pblockindex->pprev->hashFinalSproutRoot;
-    pcoinsTip->GetSproutAnchorAt(sproutRoot, sproutTree);
+  // Collect the notes that need their witnesses advanced once, so that the
+  // per-block work below scales with the number of tracked notes rather than
+  // with the size of mapWallet.
+  WitnessIndex<SproutNoteData> sproutIndex;
+  WitnessIndex<SaplingNoteData> saplingIndex;
+  for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
 
-    SaplingMerkleTree saplingTree;
-    saplingRoot = pblockindex->pprev->hashFinalSaplingRoot;
-    pcoinsTip->GetSaplingAnchorAt(saplingRoot, saplingTree);
+    if (wtxItem.second.mapSproutNoteData.empty() && wtxItem.second.mapSaplingNoteData.empty())
+      continue;
 
-    //Cycle through blocks and transactions building sapling tree until the commitment needed is reached
-    CBlock block;
-    ReadBlockFromDisk(block, pblockindex, Params().GetConsensus());
+    if (wtxItem.second.GetDepthInMainChain() > 0) {
 
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+      //Sprout
+      for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+        auto* nd = &(item.second);
+        if (nd->nullifier && nd->witnessHeight >= startHeight - 1 && nd->witnessHeight < pindex->nHeight
+            && !nd->witnesses.empty() && GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
+          sproutIndex[nd->witnessHeight].push_back(nd);
+        }
+      }
 
-      if (wtxItem.second.mapSproutNoteData.empty() && wtxItem.second.mapSaplingNoteData.empty())
-        continue;
+      //Sapling
+      for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+        auto* nd = &(item.second);
+        if (nd->nullifier && nd->witnessHeight >= startHeight - 1 && nd->witnessHeight < pindex->nHeight
+            && !nd->witnesses.empty() && GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
+          saplingIndex[nd->witnessHeight].push_back(nd);
+        }
+      }
+    }
+  }
 
-      if (wtxItem.second.GetDepthInMainChain() > 0) {
+  int height = chainActive.Height();
+  int nHeight = startHeight;
+  // Read every block into the same CBlock, reusing its storage
+  CBlock block;
+
+  while (nHeight <= pindex->nHeight) {
+
+    // Skip ahead past heights where no tracked note's witness is due
+    int nNextHeight = pindex->nHeight + 1;
+    if (!sproutIndex.empty())
+      nNextHeight = std::min(nNextHeight, sproutIndex.begin()->first + 1);
+    if (!saplingIndex.empty())
+      nNextHeight = std::min(nNextHeight, saplingIndex.begin()->first + 1);
+    nHeight = std::max(nHeight, nNextHeight);
+    if (nHeight > pindex->nHeight)
+      break;
 
-        //Sprout
-        for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
-          auto* nd = &(item.second);
-          if (nd->nullifier && nd->witnessHeight == pblockindex->nHeight - 1
-              && GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
+    CBlockIndex* pblockindex = chainActive[nHeight];
 
+    if (pblockindex->nHeight % 100 == 0 && pblockindex->nHeight < height - 5) {
+      LogPrintf("Building Witnesses for block %i %.4f complete\n", pblockindex->nHeight, pblockindex->nHeight / double(height));
+    }
 
-            nd->witnesses.push_front(nd->witnesses.front());
-            while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
-            }
+    //Extract the block's commitments once, and append them to every note due at this height
+    std::vector<uint256> sproutCommitments;
+    std::vector<uint256> saplingCommitments;
+    if (pblockindex->nStatus & BLOCK_HAVE_DATA) {
+      ReadBlockFromDisk(block, pblockindex, Params().GetConsensus());
 
-            for (const CTransaction& tx : block.vtx) {
-              for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
-                const JSDescription& jsdesc = tx.vJoinSplit[i];
-                for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
-                  const uint256& note_commitment = jsdesc.commitments[j];
-                  nd->witnesses.front().append(note_commitment);
-                }
-              }
-            }
-            nd->witnessHeight = pblockindex->nHeight;
+      for (const CTransaction& tx : block.vtx) {
+        for (const JSDescription& jsdesc : tx.vJoinSplit) {
+          for (const uint256& note_commitment : jsdesc.commitments) {
+            sproutCommitments.push_back(note_commitment);
           }
         }
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+          saplingCommitments.push_back(output.cm);
+        }
+      }
+    } else {
+      //Pruned: the compact block store only keeps the Sapling commitments
+      CCompactBlock compact;
+      ReadCompactBlock(compact, pblockindex, Params().GetConsensus());
 
-        //Sapling
-        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
-          auto* nd = &(item.second);
-          if (nd->nullifier && nd->witnessHeight == pblockindex->nHeight - 1
-              && GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
-
-            nd->witnesses.push_front(nd->witnesses.front());
-            while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
-            }
-
-            for (const CTransaction& tx : block.vtx) {
-              for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-                const uint256& note_commitment = tx.vShieldedOutput[i].cm;
-                nd->witnesses.front().append(note_commitment);
-              }
-            }
-            nd->witnessHeight = pblockindex->nHeight;
-          }
+      for (const CCompactTx& tx : compact.vtx) {
+        for (const CCompactSaplingOutput& output : tx.vOutputs) {
+          saplingCommitments.push_back(output.cmu);
         }
       }
     }
 
-    if (pblockindex == pindex)
-      break;
-
-    pblockindex = chainActive.Next(pblockindex);
+    AdvanceNoteWitnesses(sproutIndex, sproutCommitments, nHeight);
+    AdvanceNoteWitnesses(saplingIndex, saplingCommitments, nHeight);
 
+    nHeight++;
   }
 
   //Set witnessBuilt to true to allow zsendmany to run
@@ -1713,6 +2076,35 @@ void CWallet::MarkDirty()
     }
 }
 
+void CWallet::MarkDirty(const std::set<CScript>& setScripts)
+{
+    LOCK(cs_wallet);
+    int nMarked = 0;
+    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
+        CWalletTx& wtx = item.second;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            // Whether a pay-to-pubkey, multisig or nonstandard output is ours
+            // may hinge on a key added for another script, and so may a P2SH
+            // output once the wallet holds redeem scripts
+            const CScript& script = wtx.vout[i].scriptPubKey;
+            if (!setScripts.count(script) && script.IsPayToPublicKeyHash())
+                continue;
+            if (!setScripts.count(script) && script.IsPayToScriptHash() && mapScripts.empty())
+                continue;
+            wtx.MarkDirty();
+            nMarked++;
+            // Their debits count the outputs they spend
+            std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(item.first, i));
+            for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+                std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(it->second);
+                if (mi != mapWallet.end())
+                    mi->second.MarkDirty();
+            }
+        }
+    }
+    LogPrint("wallet", "%s: %d outputs for %u scripts marked dirty\n", __func__, nMarked, setScripts.size());
+}
+
 /**
  * Ensure that every note in the wallet (for which we possess a spending key)
  * has a cached nullifier.
@@ -1879,12 +2271,18 @@ void CWallet::UpdateNullifierNoteMapForBlock(const CBlock *pblock) {
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
+    InvalidateBalanceSnapshot();
+    ClearNullifierSpendCaches();
 
     if (fFromLoadWallet)
     {
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        UpdateWalletTxPosition(mapWallet[hash]);
+        fSaplingNoteIndexComplete = false;
+        fUnspentOutputIndexComplete = false;
+        fAddressTxIndexComplete = false;
         AddToSpends(hash);
     }
     else
@@ -1949,6 +2347,19 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             AddToSpends(hash);
         }
 
+        // What a note event is relative to; only worked out when it is listened to
+        bool fNoteEvents = !NotifyNoteChanged.empty();
+        uint256 hashBlockKnown;
+        std::set<JSOutPoint> setSproutKnown;
+        std::set<SaplingOutPoint> setSaplingKnown;
+        if (fNoteEvents && !fInsertedNew) {
+            hashBlockKnown = wtx.hashBlock;
+            for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData)
+                setSproutKnown.insert(item.first);
+            for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData)
+                setSaplingKnown.insert(item.first);
+        }
+
         bool fUpdated = false;
         if (!fInsertedNew)
         {
@@ -1974,13 +2385,30 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        if (fInsertedNew || fUpdated) {
+            UpdateWalletTxPosition(wtx);
+            if (fSaplingNoteIndexComplete)
+                IndexSaplingNotes(wtx);
+            if (fUnspentOutputIndexComplete)
+                IndexUnspentOutputs(wtx);
+            if (fAddressTxIndexComplete)
+                IndexAddressTxs(wtx);
+        }
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
+        TRACE4(wallet, transaction_added, hash.begin(), fInsertedNew, fUpdated, wtx.hashBlock.begin());
 
-        // Write to disk
-        if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk(pwalletdb))
-                return false;
+        // Write to disk, or leave it to the block's group commit
+        if (fInsertedNew || fUpdated) {
+            if (fDeferTxWrites) {
+                setDeferredTxWrites.insert(hash);
+            } else {
+                mapTxWrittenHash.erase(hash);
+                if (!wtx.WriteToDisk(pwalletdb))
+                    return false;
+            }
+        }
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
@@ -1988,6 +2416,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
+        if (fNoteEvents && (fInsertedNew || fUpdated)) {
+            for (const CWalletNoteEvent& event : GetNoteEvents(wtx, fInsertedNew, hashBlockKnown, setSproutKnown, setSaplingKnown))
+                NotifyNoteChanged(this, event);
+        }
+
         // notify an external script when a wallet transaction comes in or is updated
         std::string strCmd = GetArg("-walletnotify", "");
 
@@ -2001,6 +2434,63 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
     return true;
 }
 
+std::string CWalletTxPosition::ToCursor() const
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nHeight << nIndex << hash;
+    return HexStr(ss.begin(), ss.end());
+}
+
+bool CWalletTxPosition::FromCursor(const std::string& strCursor, CWalletTxPosition& pos)
+{
+    if (!IsHex(strCursor))
+        return false;
+    std::vector<unsigned char> data = ParseHex(strCursor);
+    CDataStream ss(data, SER_NETWORK, PROTOCOL_VERSION);
+    try {
+        ss >> pos.nHeight >> pos.nIndex >> pos.hash;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return ss.empty();
+}
+
+/**
+ * Index wtx by its current block height and position in the block, replacing
+ * any previous entry for it. Transactions not in a known block are indexed
+ * after every block.
+ */
+void CWallet::UpdateWalletTxPosition(const CWalletTx& wtx)
+{
+    int nHeight = std::numeric_limits<int>::max();
+    if (!wtx.hashBlock.IsNull()) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end() && mi->second)
+            nHeight = mi->second->nHeight;
+    }
+    CWalletTxPosition pos(nHeight, wtx.nIndex, wtx.GetHash());
+
+    std::map<uint256, CWalletTxPosition>::iterator it = mapWalletTxPosition.find(pos.hash);
+    if (it != mapWalletTxPosition.end()) {
+        if (it->second == pos)
+            return;
+        setWalletTxByHeight.erase(it->second);
+        it->second = pos;
+    } else {
+        mapWalletTxPosition.insert(std::make_pair(pos.hash, pos));
+    }
+    setWalletTxByHeight.insert(pos);
+}
+
+void CWallet::EraseWalletTxPosition(const uint256& hash)
+{
+    std::map<uint256, CWalletTxPosition>::iterator it = mapWalletTxPosition.find(hash);
+    if (it != mapWalletTxPosition.end()) {
+        setWalletTxByHeight.erase(it->second);
+        mapWalletTxPosition.erase(it);
+    }
+}
+
 bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
 {
     bool unchangedSproutFlag = (wtxIn.mapSproutNoteData.empty() || wtxIn.mapSproutNoteData == wtx.mapSproutNoteData);
@@ -2038,6 +2528,140 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
     return !unchangedSproutFlag || !unchangedSaplingFlag;
 }
 
+const char* CWalletNoteEvent::TypeName(Type type)
+{
+    switch (type) {
+    case RECEIVED: return "received";
+    case CONFIRMED: return "confirmed";
+    case SPENT: return "spent";
+    }
+    return "";
+}
+
+std::string CWalletNoteEvent::ToJSON() const
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("event", TypeName(type)));
+    obj.push_back(Pair("pool", fSapling ? "sapling" : "sprout"));
+    obj.push_back(Pair("txid", txid.GetHex()));
+    if (!fSapling)
+        obj.push_back(Pair("jsindex", nJoinSplit));
+    obj.push_back(Pair(fSapling ? "outindex" : "jsoutindex", nOutput));
+    obj.push_back(Pair("address", strAddress));
+    if (nValue >= 0) {
+        obj.push_back(Pair("amount", ValueFromAmount(nValue)));
+        obj.push_back(Pair("amountZat", nValue));
+    }
+    if (type == SPENT)
+        obj.push_back(Pair("spendtxid", spendTxid.GetHex()));
+    obj.push_back(Pair("blockhash", hashBlock.IsNull() ? UniValue() : UniValue(hashBlock.GetHex())));
+    return obj.write();
+}
+
+void CWallet::DescribeNote(const CWalletTx& wtx, const JSOutPoint& jsop, const SproutNoteData& nd, CWalletNoteEvent& event)
+{
+    event.fSapling = false;
+    event.txid = jsop.hash;
+    event.nJoinSplit = jsop.js;
+    event.nOutput = jsop.n;
+    event.strAddress = EncodePaymentAddress(nd.address);
+
+    ZCNoteDecryption decryptor;
+    if (!GetNoteDecryptor(nd.address, decryptor))
+        return;
+    try {
+        const JSDescription& jsdesc = wtx.vJoinSplit[jsop.js];
+        uint256 hSig = jsdesc.h_sig(*pzcashParams, wtx.joinSplitPubKey);
+        SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                decryptor, jsdesc.ciphertexts[jsop.n], jsdesc.ephemeralKey, hSig, (unsigned char) jsop.n);
+        event.nValue = plaintext.value();
+    } catch (const std::exception&) {
+        // The value is left out
+    }
+}
+
+void CWallet::DescribeNote(const CWalletTx& wtx, const SaplingOutPoint& op, CWalletNoteEvent& event)
+{
+    event.fSapling = true;
+    event.txid = op.hash;
+    event.nOutput = op.n;
+
+    const CSaplingNoteIndex::Entry* entry = GetIndexedSaplingNote(wtx, op);
+    if (entry) {
+        event.strAddress = EncodePaymentAddress(entry->address);
+        event.nValue = entry->note.value();
+    }
+}
+
+std::vector<CWalletNoteEvent> CWallet::GetNoteEvents(const CWalletTx& wtx, bool fInsertedNew, const uint256& hashBlockKnown,
+                                                     const std::set<JSOutPoint>& setSproutKnown,
+                                                     const std::set<SaplingOutPoint>& setSaplingKnown)
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<CWalletNoteEvent> vEvents;
+    bool fConfirmed = !wtx.hashBlock.IsNull() && wtx.hashBlock != hashBlockKnown;
+
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        CWalletNoteEvent event;
+        if (!setSproutKnown.count(item.first))
+            event.type = CWalletNoteEvent::RECEIVED;
+        else if (fConfirmed)
+            event.type = CWalletNoteEvent::CONFIRMED;
+        else
+            continue;
+        DescribeNote(wtx, item.first, item.second, event);
+        event.hashBlock = wtx.hashBlock;
+        vEvents.push_back(event);
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        CWalletNoteEvent event;
+        if (!setSaplingKnown.count(item.first))
+            event.type = CWalletNoteEvent::RECEIVED;
+        else if (fConfirmed)
+            event.type = CWalletNoteEvent::CONFIRMED;
+        else
+            continue;
+        DescribeNote(wtx, item.first, event);
+        event.hashBlock = wtx.hashBlock;
+        vEvents.push_back(event);
+    }
+
+    if (!fInsertedNew && !fConfirmed)
+        return vEvents;
+
+    for (const JSDescription& jsdesc : wtx.vJoinSplit) {
+        for (const uint256& nullifier : jsdesc.nullifiers) {
+            std::map<uint256, JSOutPoint>::const_iterator it = mapSproutNullifiersToNotes.find(nullifier);
+            if (it == mapSproutNullifiersToNotes.end())
+                continue;
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second.hash);
+            if (mi == mapWallet.end() || !mi->second.mapSproutNoteData.count(it->second))
+                continue;
+            CWalletNoteEvent event;
+            event.type = CWalletNoteEvent::SPENT;
+            DescribeNote(mi->second, it->second, mi->second.mapSproutNoteData.at(it->second), event);
+            event.spendTxid = wtx.GetHash();
+            event.hashBlock = wtx.hashBlock;
+            vEvents.push_back(event);
+        }
+    }
+    for (const SpendDescription& spend : wtx.vShieldedSpend) {
+        std::map<uint256, SaplingOutPoint>::const_iterator it = mapSaplingNullifiersToNotes.find(spend.nullifier);
+        if (it == mapSaplingNullifiersToNotes.end())
+            continue;
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second.hash);
+        if (mi == mapWallet.end())
+            continue;
+        CWalletNoteEvent event;
+        event.type = CWalletNoteEvent::SPENT;
+        DescribeNote(mi->second, it->second, event);
+        event.spendTxid = wtx.GetHash();
+        event.hashBlock = wtx.hashBlock;
+        vEvents.push_back(event);
+    }
+    return vEvents;
+}
+
 /**
  * Add a transaction to the wallet, or update it.
  * pblock is optional, but should be provided if the transaction is known to be in a block.
@@ -2051,26 +2675,52 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * the fly in CMerkleTx::GetDepthInMainChain().
  */
 bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+    bool fExisted = mapWallet.count(tx.GetHash()) != 0;
+    if (fExisted && !fUpdate) return false;
+    auto sproutNoteData = FindMySproutNotes(tx);
+    auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
+    return AddToWalletIfInvolvingMe(tx, pblock, fUpdate, sproutNoteData, saplingNoteDataAndAddressesToAdd);
+}
+
+/**
+ * As above, but with the results of FindMySproutNotes and FindMySaplingNotes
+ * already computed by the caller (e.g. by the rescan prefetch threads).
+ */
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                       const mapSproutNoteData_t& sproutNoteData,
+                                       const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : addressesToAdd) {
+            if (HaveSaplingIncomingViewingKey(addressToAdd.first)) {
+                continue;
+            }
             if (!AddSaplingIncomingViewingKey(addressToAdd.second, addressToAdd.first)) {
                 return false;
             }
         }
-        if (fExisted || IsMine(tx) || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0)
+        // In shielded-only mode transparent scripts are never matched, so
+        // transactions without shielded parts can be dismissed up front
+        bool fInvolvesMe;
+        if (fShieldedOnlyScan) {
+            fInvolvesMe = sproutNoteData.size() > 0 || saplingNoteData.size() > 0 || IsShieldedFromMe(tx);
+        } else {
+            fInvolvesMe = IsMine(tx) || IsFromMe(tx) || sproutNoteData.size() > 0 || saplingNoteData.size() > 0;
+        }
+        if (fExisted || fInvolvesMe)
         {
             CWalletTx wtx(this,tx);
 
             if (sproutNoteData.size() > 0) {
-                wtx.SetSproutNoteData(sproutNoteData);
+                auto noteData = sproutNoteData;
+                wtx.SetSproutNoteData(noteData);
             }
 
             if (saplingNoteData.size() > 0) {
@@ -2093,11 +2743,22 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
-    LOCK(cs_wallet);
-    if (!AddToWalletIfInvolvingMe(tx, pblock, true))
-        return; // Not one of ours
+    {
+        LOCK(cs_wallet);
+        // Transactions in a block are written together once it is connected
+        fDeferTxWrites = (pblock != NULL);
+        bool fMine = AddToWalletIfInvolvingMe(tx, pblock, true);
+        fDeferTxWrites = false;
+        if (!fMine)
+            return; // Not one of ours
+
+        MarkAffectedTransactionsDirty(tx);
+    }
 
-    MarkAffectedTransactionsDirty(tx);
+    // Transactions in a block are picked up by ChainTip once the whole
+    // block has been connected
+    if (!pblock)
+        UpdateBalanceSnapshot();
 }
 
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
@@ -2134,6 +2795,15 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
+        InvalidateBalanceSnapshot();
+        ClearNullifierSpendCaches();
+        EraseWalletTxPosition(hash);
+        mapTxWrittenHash.erase(hash);
+        setDeferredTxWrites.erase(hash);
+        saplingNoteIndex.EraseTx(hash);
+        unspentOutputIndex.EraseTx(hash);
+        addressTxIndex.EraseTx(hash);
+        setAddressTxsLocked.erase(hash);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -2186,42 +2856,84 @@ boost::optional<uint256> CWallet::GetSproutNoteNullifier(const JSDescription &js
 mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 {
     LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
-
-    mapSproutNoteData_t noteData;
-    for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
-        auto hSig = tx.vJoinSplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
-        for (uint8_t j = 0; j < tx.vJoinSplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
-                try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetSproutNoteNullifier(
-                        tx.vJoinSplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        SproutNoteData nd {address, *nullifier};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    } else {
-                        SproutNoteData nd {address};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
-                } catch (const std::exception &exc) {
-                    // Unexpected failure
-                    LogPrintf("FindMySproutNotes(): Unexpected error while testing decrypt:\n");
-                    LogPrintf("%s\n", exc.what());
-                }
+    return FindMySproutNotes(tx, mapNoteDecryptors);
+}
+
+/**
+ * Trial decrypts the Sprout outputs of the given transaction with the given set
+ * of note decryptors. This does not take cs_SpendingKeyStore while decrypting,
+ * so it can be called concurrently against a snapshot of mapNoteDecryptors.
+ */
+mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx, const NoteDecryptorMap &decryptors) const
+{
+    std::vector<const CTransaction*> vtx {&tx};
+    return FindMySproutNotes(vtx, decryptors, nNoteDecryptionThreads).front();
+}
+
+/**
+ * Trial decrypts the Sprout outputs of a batch of transactions with the given
+ * set of note decryptors, spreading the decryption work over nThreads threads.
+ * Returns the note data for each transaction, in the same order as vtx.
+ */
+std::vector<mapSproutNoteData_t> CWallet::FindMySproutNotes(const std::vector<const CTransaction*> &vtx,
+                                                            const NoteDecryptorMap &decryptors,
+                                                            int nThreads) const
+{
+    std::vector<mapSproutNoteData_t> vNoteData(vtx.size());
+
+    std::vector<libzcash::SproutPaymentAddress> addresses;
+    std::vector<ZCNoteDecryption> vDecryptors;
+    addresses.reserve(decryptors.size());
+    vDecryptors.reserve(decryptors.size());
+    for (const NoteDecryptorMap::value_type& item : decryptors) {
+        addresses.push_back(item.first);
+        vDecryptors.push_back(item.second);
+    }
+
+    // Flatten the outputs of the whole batch, remembering where each came from
+    std::vector<libzcash::SproutEncryptedNote> notes;
+    std::vector<std::pair<size_t, JSOutPoint>> positions;
+    for (size_t t = 0; t < vtx.size(); t++) {
+        const CTransaction& tx = *vtx[t];
+        if (tx.vJoinSplit.empty() || vDecryptors.empty()) {
+            continue;
+        }
+        uint256 hash = tx.GetHash();
+        for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
+            const JSDescription& jsdesc = tx.vJoinSplit[i];
+            auto hSig = jsdesc.h_sig(*pzcashParams, tx.joinSplitPubKey);
+            for (uint8_t j = 0; j < jsdesc.ciphertexts.size(); j++) {
+                notes.emplace_back(jsdesc.ciphertexts[j], jsdesc.ephemeralKey, hSig, (unsigned char) j);
+                positions.emplace_back(t, JSOutPoint {hash, i, j});
             }
         }
     }
-    return noteData;
-}
 
+    auto matches = libzcash::TrialDecryptSproutNotes(notes, vDecryptors, std::max(nThreads, 1));
+    for (const auto& match : matches) {
+        const auto& position = positions[match.note];
+        const JSOutPoint& jsoutpt = position.second;
+        const JSDescription& jsdesc = vtx[position.first]->vJoinSplit[jsoutpt.js];
+        const libzcash::SproutPaymentAddress& address = addresses[match.key];
+        auto note = match.plaintext.note(address);
+
+        // Check note plaintext against note commitment
+        if (note.cm() != jsdesc.commitments[jsoutpt.n]) {
+            continue;
+        }
+
+        // SpendingKeys are only available if:
+        // - We have them (this isn't a viewing key)
+        // - The wallet is unlocked
+        SproutNoteData nd {address};
+        libzcash::SproutSpendingKey key;
+        if (GetSproutSpendingKey(address, key)) {
+            nd.nullifier = note.nullifier(key);
+        }
+        vNoteData[position.first].insert(std::make_pair(jsoutpt, nd));
+    }
+    return vNoteData;
+}
 
 /**
  * Finds all output notes in the given transaction that have been sent to
@@ -2234,35 +2946,82 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx) const
 {
     LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
+    auto result = FindMySaplingNotes(tx, mapSaplingFullViewingKeys);
+
+    // Only report the addresses that still need an incoming viewing key entry
+    SaplingIncomingViewingKeyMap& viewingKeysToAdd = result.second;
+    for (auto it = viewingKeysToAdd.begin(); it != viewingKeysToAdd.end(); ) {
+        if (mapSaplingIncomingViewingKeys.count(it->first)) {
+            it = viewingKeysToAdd.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return result;
+}
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+/**
+ * Trial decrypts the Sapling outputs of the given transaction with the given set
+ * of full viewing keys. This does not take cs_SpendingKeyStore, so it can be called
+ * concurrently against a snapshot of mapSaplingFullViewingKeys. The returned address
+ * map contains every decrypted address, whether or not the wallet already knows it.
+ */
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx, const SaplingFullViewingKeyMap &fvks) const
+{
+    std::vector<const CTransaction*> vtx {&tx};
+    return FindMySaplingNotes(vtx, fvks, nNoteDecryptionThreads).front();
+}
+
+/**
+ * Trial decrypts the Sapling outputs of a batch of transactions with the given
+ * set of full viewing keys, spreading the decryption work over nThreads threads.
+ * Returns the note data and decrypted addresses for each transaction, in the
+ * same order as vtx.
+ */
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(
+    const std::vector<const CTransaction*> &vtx,
+    const SaplingFullViewingKeyMap &fvks,
+    int nThreads) const
+{
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vNoteData(vtx.size());
+
+    std::vector<SaplingIncomingViewingKey> ivks;
+    ivks.reserve(fvks.size());
+    for (const SaplingFullViewingKeyMap::value_type& item : fvks) {
+        ivks.push_back(item.first);
+    }
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
-            auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-            if (!result) {
-                continue;
-            }
-            auto address = ivk.address(result.get().d);
-            if (address && mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                viewingKeysToAdd[address.get()] = ivk;
-            }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
+    std::vector<libzcash::SaplingEncryptedNote> notes;
+    std::vector<std::pair<size_t, SaplingOutPoint>> positions;
+    for (size_t t = 0; t < vtx.size(); t++) {
+        const CTransaction& tx = *vtx[t];
+        if (tx.vShieldedOutput.empty() || ivks.empty()) {
+            continue;
+        }
+        uint256 hash = tx.GetHash();
+        for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
+            const OutputDescription& output = tx.vShieldedOutput[i];
+            notes.emplace_back(output.encCiphertext, output.ephemeralKey, output.cm);
+            positions.emplace_back(t, SaplingOutPoint {hash, i});
         }
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    auto matches = libzcash::TrialDecryptSaplingNotes(notes, ivks, std::max(nThreads, 1));
+    for (const auto& match : matches) {
+        const auto& position = positions[match.note];
+        const SaplingIncomingViewingKey& ivk = ivks[match.key];
+        auto address = ivk.address(match.plaintext.d);
+        if (address) {
+            vNoteData[position.first].second[address.get()] = ivk;
+        }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        vNoteData[position.first].first.insert(std::make_pair(position.second, nd));
+    }
+    return vNoteData;
 }
 
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
@@ -2301,11 +3060,15 @@ void CWallet::GetSproutNoteWitnesses(std::vector<JSOutPoint> notes,
         if (mapWallet.count(note.hash) &&
                 mapWallet[note.hash].mapSproutNoteData.count(note) &&
                 mapWallet[note.hash].mapSproutNoteData[note].witnesses.size() > 0) {
-            witnesses[i] = mapWallet[note.hash].mapSproutNoteData[note].witnesses.front();
+            // Work out the root on the wallet's own witness, so that it
+            // stays cached there for the next caller
+            const SproutWitness& witness = mapWallet[note.hash].mapSproutNoteData[note].witnesses.front();
+            uint256 root = witness.root();
+            witnesses[i] = witness;
             if (!rt) {
-                rt = witnesses[i]->root();
+                rt = root;
             } else {
-                assert(*rt == witnesses[i]->root());
+                assert(*rt == root);
             }
         }
         i++;
@@ -2328,11 +3091,15 @@ void CWallet::GetSaplingNoteWitnesses(std::vector<SaplingOutPoint> notes,
         if (mapWallet.count(note.hash) &&
                 mapWallet[note.hash].mapSaplingNoteData.count(note) &&
                 mapWallet[note.hash].mapSaplingNoteData[note].witnesses.size() > 0) {
-            witnesses[i] = mapWallet[note.hash].mapSaplingNoteData[note].witnesses.front();
+            // Work out the root on the wallet's own witness, so that it
+            // stays cached there for the next caller
+            const SaplingWitness& witness = mapWallet[note.hash].mapSaplingNoteData[note].witnesses.front();
+            uint256 root = witness.root();
+            witnesses[i] = witness;
             if (!rt) {
-                rt = witnesses[i]->root();
+                rt = root;
             } else {
-                assert(*rt == witnesses[i]->root());
+                assert(*rt == root);
             }
         }
         i++;
@@ -2585,6 +3352,11 @@ bool CWallet::IsFromMe(const CTransaction& tx) const
     if (GetDebit(tx, ISMINE_ALL) > 0) {
         return true;
     }
+    return IsShieldedFromMe(tx);
+}
+
+bool CWallet::IsShieldedFromMe(const CTransaction& tx) const
+{
     for (const JSDescription& jsdesc : tx.vJoinSplit) {
         for (const uint256& nullifier : jsdesc.nullifiers) {
             if (IsSproutNullifierFromMe(nullifier)) {
@@ -2705,7 +3477,7 @@ bool CWallet::SetCryptedHDSeed(const uint256& seedFp, const std::vector<unsigned
 
 HDSeed CWallet::GetHDSeedForRPC() const {
     HDSeed seed;
-    if (!pwalletMain->GetHDSeed(seed)) {
+    if (!GetHDSeed(seed)) {
         throw JSONRPCError(RPC_WALLET_ERROR, "HD seed not found");
     }
     return seed;
@@ -3061,6 +3833,32 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return pwalletdb->WriteTx(GetHash(), *this);
 }
 
+bool CWallet::FlushDeferredTxWrites()
+{
+    LOCK(cs_wallet);
+    if (setDeferredTxWrites.empty())
+        return true;
+
+    std::vector<std::pair<uint256, const CWalletTx*>> vtx;
+    vtx.reserve(setDeferredTxWrites.size());
+    for (const uint256& hash : setDeferredTxWrites) {
+        auto it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        mapTxWrittenHash.erase(hash);
+        vtx.push_back(std::make_pair(hash, &it->second));
+    }
+
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.WriteTxBatch(vtx)) {
+        // Keep the queue so the next flush retries
+        LogPrintf("%s: failed to write %u wallet transactions\n", __func__, vtx.size());
+        return false;
+    }
+    setDeferredTxWrites.clear();
+    return true;
+}
+
 void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
                                     std::vector<boost::optional<SproutWitness>>& witnesses,
                                     uint256 &final_anchor)
@@ -3069,8 +3867,9 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     CBlockIndex* pindex = chainActive.Genesis();
     SproutMerkleTree tree;
 
+    // One block read into again and again, reusing its storage
+    CBlock block;
     while (pindex) {
-        CBlock block;
         ReadBlockFromDisk(block, pindex, Params().GetConsensus());
 
         BOOST_FOREACH(const CTransaction& tx, block.vtx)
@@ -3175,6 +3974,7 @@ void CWallet::UpdateWalletTransactionOrder(std::map<std::pair<int,int>, CWalletT
   for (map<const uint256, CWalletTx*>::iterator it = mapUpdatedTxs.begin(); it != mapUpdatedTxs.end(); ++it) {
     CWalletTx* pwtx = it->second;
     LogPrint("deletetx","Reorder Tx - Updating Positon to %i for Tx %s\n ", pwtx->nOrderPos, pwtx->GetHash().ToString());
+    mapTxWrittenHash.erase(pwtx->GetHash());
     pwtx->WriteToDisk(&walletdb);
     mapWallet[pwtx->GetHash()].nOrderPos = pwtx->nOrderPos;
   }
@@ -3191,17 +3991,34 @@ void CWallet::UpdateWalletTransactionOrder(std::map<std::pair<int,int>, CWalletT
  */
 void CWallet::DeleteTransactions(std::vector<uint256> &removeTxs) {
     LOCK(cs_wallet);
+    InvalidateBalanceSnapshot();
+    ClearNullifierSpendCaches();
 
     CWalletDB walletdb(strWalletFile, "r+", false);
 
-    for (int i = 0; i< removeTxs.size(); i++) {
-        if (mapWallet.erase(removeTxs[i])) {
-            walletdb.EraseTx(removeTxs[i]);
-            LogPrint("deletetx","Delete Tx - Deleting tx %s, %i.\n", removeTxs[i].ToString(),i);
-        } else {
-            LogPrint("deletetx","Delete Tx - Deleting tx %failed.\n", removeTxs[i].ToString());
-            return;
+    // Erase in chunks, one database transaction per chunk
+    bool fFailed = false;
+    for (size_t nStart = 0; nStart < removeTxs.size() && !fFailed; nStart += WALLET_DELETE_CHUNK_SIZE) {
+        size_t nEnd = std::min(removeTxs.size(), nStart + WALLET_DELETE_CHUNK_SIZE);
+        walletdb.TxnBegin();
+        for (size_t i = nStart; i < nEnd; i++) {
+            EraseWalletTxPosition(removeTxs[i]);
+            mapTxWrittenHash.erase(removeTxs[i]);
+            setDeferredTxWrites.erase(removeTxs[i]);
+            saplingNoteIndex.EraseTx(removeTxs[i]);
+            unspentOutputIndex.EraseTx(removeTxs[i]);
+            addressTxIndex.EraseTx(removeTxs[i]);
+            setAddressTxsLocked.erase(removeTxs[i]);
+            if (mapWallet.erase(removeTxs[i])) {
+                walletdb.EraseTx(removeTxs[i]);
+                LogPrint("deletetx","Delete Tx - Deleting tx %s, %i.\n", removeTxs[i].ToString(),i);
+            } else {
+                LogPrint("deletetx","Delete Tx - Deleting tx %s failed.\n", removeTxs[i].ToString());
+                fFailed = true;
+                break;
+            }
         }
+        walletdb.TxnCommit();
     }
 
     // Miodrag: release memory back to the OS, only works on linux
@@ -3214,10 +4031,76 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
 
       LOCK2(cs_main, cs_wallet);
 
+      std::vector<uint256> removeTxs;
+      if (pindex && SelectWalletTransactionsToDelete(removeTxs)) {
+        //Delete Transactions from wallet
+        DeleteTransactions(removeTxs);
+        LogPrintf("Delete Tx - Transactions Deleted %i\n", int(removeTxs.size()));
+
+        //Compress Wallet
+        if (!removeTxs.empty())
+          CWalletDB::Compact(bitdb,strWalletFile);
+      }
+}
+
+void CWallet::RequestWalletTransactionDeletion() {
+    LOCK(cs_wallet);
+    fDeleteTxRequested = true;
+}
+
+void CWallet::RunPendingTransactionDeletion() {
+    bool fFinished = false;
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        // Pick the transactions to delete once per request, against the
+        // current tip, then erase them a chunk per call
+        if (vPendingDeleteTxs.empty()) {
+            if (!fDeleteTxRequested)
+                return;
+            fDeleteTxRequested = false;
+            std::vector<uint256> removeTxs;
+            if (!SelectWalletTransactionsToDelete(removeTxs) || removeTxs.empty())
+                return;
+            vPendingDeleteTxs.assign(removeTxs.begin(), removeTxs.end());
+            LogPrint("deletetx", "Delete Tx - Queued %i transactions for deletion\n", int(vPendingDeleteTxs.size()));
+        }
+
+        // Transactions may have been removed or have gained new spends
+        // since they were queued; only erase those still in the wallet
+        std::vector<uint256> chunk;
+        while (!vPendingDeleteTxs.empty() && chunk.size() < WALLET_DELETE_CHUNK_SIZE) {
+            if (mapWallet.count(vPendingDeleteTxs.front()))
+                chunk.push_back(vPendingDeleteTxs.front());
+            vPendingDeleteTxs.pop_front();
+        }
+        DeleteTransactions(chunk);
+        nDeletedTxCount += chunk.size();
+        fFinished = vPendingDeleteTxs.empty();
+        if (fFinished)
+            LogPrintf("Delete Tx - Transactions Deleted %u\n", nDeletedTxCount);
+    }
+
+    //Compress Wallet
+    if (fFinished)
+        CWalletDB::Compact(bitdb, strWalletFile);
+}
+
+void CWallet::GetTransactionDeletionProgress(size_t& nPending, uint64_t& nDeleted, bool& fRequested) const {
+    LOCK(cs_wallet);
+    nPending = vPendingDeleteTxs.size();
+    nDeleted = nDeletedTxCount;
+    fRequested = fDeleteTxRequested;
+}
+
+bool CWallet::SelectWalletTransactionsToDelete(std::vector<uint256>& removeTxs) {
+
+      AssertLockHeld(cs_main);
+      AssertLockHeld(cs_wallet);
+
       int nDeleteAfter = (int)fDeleteTransactionsAfterNBlocks;
-      bool runCompact = false;
 
-      if (pindex && fTxDeleteEnabled) {
+      if (fTxDeleteEnabled) {
 
         //Check for acentries - exit function if found
         {
@@ -3226,7 +4109,7 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
             walletdb.ListAccountCreditDebit("*", acentries);
             if (acentries.size() > 0) {
                 LogPrintf("deletetx not compatible to account entries\n");
-                return;
+                return false;
             }
         }
         //delete transactions
@@ -3250,7 +4133,6 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
         int txUnConfirmed = 0;
         int txCount = 0;
         int txSaveCount = 0;
-        std::vector<uint256> removeTxs;
 
         for (auto & item : mapSorted)
         {
@@ -3285,7 +4167,7 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
             //Check for unspent inputs or spend less than N Blocks ago. (Sapling)
             for (auto & pair : pwtx->mapSaplingNoteData) {
               SaplingNoteData nd = pair.second;
-              if (!nd.nullifier || pwalletMain->GetSaplingSpendDepth(*nd.nullifier) <= fDeleteTransactionsAfterNBlocks) {
+              if (!nd.nullifier || GetSaplingSpendDepth(*nd.nullifier) <= fDeleteTransactionsAfterNBlocks) {
                 LogPrint("deletetx","DeleteTx - Unspent sapling input tx %s\n", pwtx->GetHash().ToString());
                 deleteTx = false;
                 continue;
@@ -3300,9 +4182,9 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
             //Check for outputs that no longer have parents in the wallet. Exclude parents that are in the same transaction. (Sapling)
             for (int i = 0; i < pwtx->vShieldedSpend.size(); i++) {
               const SpendDescription& spendDesc = pwtx->vShieldedSpend[i];
-              if (pwalletMain->IsSaplingNullifierFromMe(spendDesc.nullifier)) {
-                const uint256& parentHash = pwalletMain->mapSaplingNullifiersToNotes[spendDesc.nullifier].hash;
-                const CWalletTx* parent = pwalletMain->GetWalletTx(parentHash);
+              if (IsSaplingNullifierFromMe(spendDesc.nullifier)) {
+                const uint256& parentHash = mapSaplingNullifiersToNotes[spendDesc.nullifier].hash;
+                const CWalletTx* parent = GetWalletTx(parentHash);
                 if (parent != NULL && parentHash != wtxid) {
                   LogPrint("deletetx","DeleteTx - Parent of sapling tx %s found\n", pwtx->GetHash().ToString());
                   deleteTx = false;
@@ -3319,7 +4201,7 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
             //Check for unspent inputs or spend less than N Blocks ago. (Sprout)
             for (auto & pair : pwtx->mapSproutNoteData) {
               SproutNoteData nd = pair.second;
-              if (!nd.nullifier || pwalletMain->GetSproutSpendDepth(*nd.nullifier) <= fDeleteTransactionsAfterNBlocks) {
+              if (!nd.nullifier || GetSproutSpendDepth(*nd.nullifier) <= fDeleteTransactionsAfterNBlocks) {
                 LogPrint("deletetx","DeleteTx - Unspent sprout input tx %s\n", pwtx->GetHash().ToString());
                 deleteTx = false;
                 continue;
@@ -3335,10 +4217,10 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
             for (int i = 0; i < pwtx->vJoinSplit.size(); i++) {
               const JSDescription& jsdesc = pwtx->vJoinSplit[i];
               for (const uint256 &nullifier : jsdesc.nullifiers) {
-                // JSOutPoint op = pwalletMain->mapSproutNullifiersToNotes[nullifier];
-                if (pwalletMain->IsSproutNullifierFromMe(nullifier)) {
-                  const uint256& parentHash = pwalletMain->mapSproutNullifiersToNotes[nullifier].hash;
-                  const CWalletTx* parent = pwalletMain->GetWalletTx(parentHash);
+                // JSOutPoint op = mapSproutNullifiersToNotes[nullifier];
+                if (IsSproutNullifierFromMe(nullifier)) {
+                  const uint256& parentHash = mapSproutNullifiersToNotes[nullifier].hash;
+                  const CWalletTx* parent = GetWalletTx(parentHash);
                   if (parent != NULL && parentHash != wtxid) {
                     LogPrint("deletetx","DeleteTx - Parent of sprout tx %s found\n", pwtx->GetHash().ToString());
                     deleteTx = false;
@@ -3358,7 +4240,7 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
               CTxDestination address;
               ExtractDestination(pwtx->vout[i].scriptPubKey, address);
               if(IsMine(pwtx->vout[i])) {
-                if (pwalletMain->GetSpendDepth(pwtx->GetHash(), i) <= fDeleteTransactionsAfterNBlocks) {
+                if (GetSpendDepth(pwtx->GetHash(), i) <= fDeleteTransactionsAfterNBlocks) {
                   LogPrint("deletetx","DeleteTx - Unspent transparent input tx %s\n", pwtx->GetHash().ToString());
                   deleteTx = false;
                   continue;
@@ -3375,7 +4257,7 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
             for (int i = 0; i < pwtx->vin.size(); i++) {
               const CTxIn& txin = pwtx->vin[i];
               const uint256& parentHash = txin.prevout.hash;
-              const CWalletTx* parent = pwalletMain->GetWalletTx(txin.prevout.hash);
+              const CWalletTx* parent = GetWalletTx(txin.prevout.hash);
               if (parent != NULL && parentHash != wtxid) {
                 LogPrint("deletetx","DeleteTx - Parent of transparent tx %s found\n", pwtx->GetHash().ToString());
                 deleteTx = false;
@@ -3400,25 +4282,128 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
           //Collect everything else for deletion
           if (deleteTx && int(removeTxs.size()) < MAX_DELETE_TX_SIZE) {
             removeTxs.push_back(wtxid);
-            runCompact = true;
           }
         }
 
-        //Delete Transactions from wallet
-        DeleteTransactions(removeTxs);
-        LogPrintf("Delete Tx - Total Transaction Count %i, Transactions Deleted %i\n ", txCount, int(removeTxs.size()));
-
-        //Compress Wallet
-        if (runCompact)
-          CWalletDB::Compact(bitdb,strWalletFile);
+        LogPrintf("Delete Tx - Total Transaction Count %i, Transactions To Delete %i\n", txCount, int(removeTxs.size()));
+        return true;
       }
+      return false;
+}
+
+
+/**
+ * Fill vBatch with up to RESCAN_BATCH_SIZE blocks of the active chain,
+ * starting at pindex. The entries already in vBatch are reused, so their
+ * blocks are read into the storage of the previous batch.
+ */
+void CWallet::GetRescanBatch(CBlockIndex* pindex, std::vector<CRescanBlock>& vBatch) const
+{
+    AssertLockHeld(cs_main);
+    size_t n = 0;
+    while (pindex && n < RESCAN_BATCH_SIZE) {
+        if (n < vBatch.size())
+            vBatch[n].Reset(pindex);
+        else
+            vBatch.emplace_back(pindex);
+        n++;
+        pindex = chainActive.Next(pindex);
+    }
+    vBatch.erase(vBatch.begin() + n, vBatch.end());
 }
 
+/**
+ * Read the blocks of a rescan batch from disk, then trial decrypt all of
+ * their transactions against the given key snapshot in one pass. Both steps
+ * are spread over nRescanThreads threads. No wallet or chain locks are taken here, so this can run while
+ * the previous batch is being committed.
+ *
+ * Pruned blocks are read from the compact block store, and their compact
+ * outputs are trial decrypted as they are read.
+ */
+void CWallet::PrefetchRescanBatch(std::vector<CRescanBlock>& vBatch,
+                                  const NoteDecryptorMap& decryptors,
+                                  const SaplingFullViewingKeyMap& fvks) const
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    std::atomic<size_t> nNext(0);
+
+    std::vector<SaplingIncomingViewingKey> ivks;
+    ivks.reserve(fvks.size());
+    for (const SaplingFullViewingKeyMap::value_type& item : fvks) {
+        ivks.push_back(item.first);
+    }
+
+    auto worker = [&]() {
+        size_t i;
+        while ((i = nNext++) < vBatch.size()) {
+            CRescanBlock& entry = vBatch[i];
+            if (entry.fPruned) {
+                entry.fRead = ReadCompactBlock(entry.compact, entry.pindex, consensusParams);
+                entry.setCompactMatches.clear();
+                for (const CCompactTx& ctx : entry.compact.vtx) {
+                    for (const CCompactSaplingOutput& output : ctx.vOutputs) {
+                        for (const SaplingIncomingViewingKey& ivk : ivks) {
+                            if (SaplingNotePlaintext::decrypt_compact(output.ciphertext, ivk, output.epk, output.cmu)) {
+                                entry.setCompactMatches.insert(ctx.hash);
+                                break;
+                            }
+                        }
+                    }
+                }
+                entry.block.SetNull();
+                continue;
+            }
+            entry.fRead = ReadBlockFromDisk(entry.block, entry.pos, consensusParams);
+            if (entry.fRead && entry.block.GetHash() != entry.pindex->GetBlockHash()) {
+                LogPrintf("PrefetchRescanBatch(): block at %s does not match index for %s\n",
+                          entry.pos.ToString(), entry.pindex->ToString());
+                entry.fRead = false;
+            }
+            if (!entry.fRead) {
+                entry.block.SetNull();
+            }
+        }
+    };
+
+    int nThreads = std::min<int>(nRescanThreads, vBatch.size());
+    GetTaskPool().ParallelFor(TASKPOOL_WALLET, nThreads, nThreads, [&worker](size_t) { worker(); });
+
+    // Trial decrypt the whole batch at once, so that the work is spread
+    // evenly over the threads regardless of how outputs are distributed
+    // between blocks.
+    std::vector<const CTransaction*> vtx;
+    for (const CRescanBlock& entry : vBatch) {
+        for (const CTransaction& tx : entry.block.vtx) {
+            vtx.push_back(&tx);
+        }
+    }
+    auto vSproutNoteData = FindMySproutNotes(vtx, decryptors, nRescanThreads);
+    auto vSaplingNoteData = FindMySaplingNotes(vtx, fvks, nRescanThreads);
+
+    size_t nTx = 0;
+    for (CRescanBlock& entry : vBatch) {
+        size_t nBlockTx = entry.block.vtx.size();
+        entry.vSproutNoteData.assign(
+            std::make_move_iterator(vSproutNoteData.begin() + nTx),
+            std::make_move_iterator(vSproutNoteData.begin() + nTx + nBlockTx));
+        entry.vSaplingNoteData.assign(
+            std::make_move_iterator(vSaplingNoteData.begin() + nTx),
+            std::make_move_iterator(vSaplingNoteData.begin() + nTx + nBlockTx));
+        nTx += nBlockTx;
+    }
+}
 
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * The scan is pipelined: while one batch of blocks is committed to the
+ * wallet, the next batch is read from disk and trial decrypted in the
+ * background. cs_main and cs_wallet are only held while a batch is being
+ * committed, so block relay is not stalled for the whole rescan (unless the
+ * caller already holds those locks).
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -3427,6 +4412,14 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart;
+    double dProgressTip;
+    std::vector<CRescanBlock> vBatch;
+    std::vector<CRescanBlock> vNext;
+    //! Pruned blocks that could not be scanned, and transactions of ours in pruned blocks
+    int nPrunedMissed = 0;
+    int nNextCheckpoint = 0;
+    bool fInterrupted = false;
 
     {
         LOCK2(cs_main, cs_wallet);
@@ -3437,57 +4430,196 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+        nRescanProgress = 0;
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        GetRescanBatch(pindex, vBatch);
+        if (pindex)
+            nNextCheckpoint = pindex->nHeight + nRescanCheckpointInterval;
+    }
+
+    // Keys can be added while we are not holding the wallet lock, so the
+    // snapshot used for trial decryption is refreshed for every batch.
+    auto snapshotKeys = [this](NoteDecryptorMap& decryptors, SaplingFullViewingKeyMap& fvks) {
+        LOCK(cs_SpendingKeyStore);
+        decryptors = mapNoteDecryptors;
+        fvks = mapSaplingFullViewingKeys;
+    };
+
+    NoteDecryptorMap decryptors;
+    SaplingFullViewingKeyMap fvks;
+    snapshotKeys(decryptors, fvks);
+    PrefetchRescanBatch(vBatch, decryptors, fvks);
 
-        while (pindex)
+    while (!vBatch.empty())
+    {
+        // Start reading the following batch while this one is committed
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK(cs_main);
+            GetRescanBatch(chainActive.Next(vBatch.back().pindex), vNext);
+        }
+        NoteDecryptorMap nextDecryptors;
+        SaplingFullViewingKeyMap nextFvks;
+        snapshotKeys(nextDecryptors, nextFvks);
+        std::thread prefetch(&CWallet::PrefetchRescanBatch, this, std::ref(vNext), std::cref(nextDecryptors), std::cref(nextFvks));
+
+        CBlockIndex* pindexLast = NULL;
+        const CBlockIndex* pindexFork = NULL;
+        try {
+            LOCK2(cs_main, cs_wallet);
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            for (CRescanBlock& entry : vBatch)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
-                    ret++;
+                pindex = entry.pindex;
+
+                // The chain reorganized since this batch was read; resume from the fork point
+                if (!chainActive.Contains(pindex)) {
+                    pindexFork = chainActive.FindFork(pindex);
+                    break;
                 }
-            }
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (Params().GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
+                    int nProgress = std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100)));
+                    ShowProgress(_("Rescanning..."), nProgress);
+                    nRescanProgress = nProgress;
                 }
-            }
 
-            // Build inital witness caches
-            BuildWitnessCache(pindex, true);
+                // A pruned block only tells us whether it holds anything of
+                // ours: the transactions themselves are gone
+                if (entry.fPruned) {
+                    if (!entry.fRead) {
+                        LogPrintf("ScanForWalletTransactions(): pruned block %s is not in the compact block store, it was not scanned\n", pindex->GetBlockHash().ToString());
+                        nPrunedMissed++;
+                    }
+                    for (const CCompactTx& ctx : entry.compact.vtx) {
+                        if (mapWallet.count(ctx.hash))
+                            continue;
+                        bool fMine = entry.setCompactMatches.count(ctx.hash);
+                        for (const uint256& nullifier : ctx.vNullifiers) {
+                            fMine = fMine || mapSaplingNullifiersToNotes.count(nullifier);
+                        }
+                        if (fMine) {
+                            LogPrintf("ScanForWalletTransactions(): transaction %s in pruned block %s involves this wallet\n",
+                                      ctx.hash.ToString(), pindex->GetBlockHash().ToString());
+                            nPrunedMissed++;
+                        }
+                    }
+                }
+
+                for (size_t i = 0; i < entry.block.vtx.size(); i++)
+                {
+                    if (AddToWalletIfInvolvingMe(entry.block.vtx[i], &entry.block, fUpdate, entry.vSproutNoteData[i], entry.vSaplingNoteData[i])) {
+                        ret++;
+                    }
+                }
+
+                SproutMerkleTree sproutTree;
+                SaplingMerkleTree saplingTree;
+                // This should never fail: we should always be able to get the tree
+                // state on the path to the tip of our chain
+                assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                if (pindex->pprev) {
+                    if (Params().GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
+                        assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                    }
+                }
+
+                // Build inital witness caches
+                BuildWitnessCache(pindex, true);
 
-            //Delete Transactions
-            if (pindex->nHeight % fDeleteInterval == 0)
-              DeleteWalletTransactions(pindex);
+                //Delete Transactions
+                if (pindex->nHeight % fDeleteInterval == 0)
+                  DeleteWalletTransactions(pindex);
 
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                }
+                pindexLast = pindex;
             }
-            pindex = chainActive.Next(pindex);
+
+            // Checkpoint between batches, so everything up to pindexLast
+            // has been processed; and stop here on shutdown
+            fInterrupted = ShutdownRequested();
+            if (pindexLast && nRescanCheckpointInterval > 0 &&
+                (pindexLast->nHeight >= nNextCheckpoint || fInterrupted)) {
+                CheckpointRescan(pindexLast);
+                nNextCheckpoint = pindexLast->nHeight + nRescanCheckpointInterval;
+            }
+        } catch (...) {
+            prefetch.join();
+            throw;
         }
-        //Update all witness caches
-        BuildWitnessCache(chainActive.Tip(), false);
 
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
-    }
-    return ret;
-}
+        prefetch.join();
 
-void CWallet::ReacceptWalletTransactions()
-{
+        if (fInterrupted) {
+            LogPrintf("ScanForWalletTransactions(): interrupted at block %d\n", pindexLast ? pindexLast->nHeight : -1);
+            break;
+        }
+
+        // The batch read ahead no longer follows on from what we committed
+        // (reorg, or new blocks arrived after it was queued): read it again.
+        bool fRefetch = pindexFork != NULL;
+        {
+            LOCK(cs_main);
+            CBlockIndex* pindexResume = chainActive.Next(pindexFork ? pindexFork : pindexLast);
+            if (vNext.empty() ? pindexResume != NULL : (fRefetch || vNext.front().pindex != pindexResume)) {
+                GetRescanBatch(pindexResume, vNext);
+                fRefetch = true;
+            }
+        }
+        if (fRefetch) {
+            snapshotKeys(decryptors, fvks);
+            PrefetchRescanBatch(vNext, decryptors, fvks);
+        }
+        vBatch.swap(vNext);
+    }
+
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        if (!fInterrupted) {
+            //Update all witness caches
+            BuildWitnessCache(chainActive.Tip(), false);
+
+            // Nothing left to resume
+            if (fFileBacked)
+                CWalletDB(strWalletFile).EraseRescanProgress();
+        }
+
+        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        nRescanProgress = -1;
+    }
+    if (nPrunedMissed > 0) {
+        LogPrintf("ScanForWalletTransactions(): missed %d transactions or blocks that have been pruned, "
+                  "restart with -reindex to recover them\n", nPrunedMissed);
+    }
+    return ret;
+}
+
+bool CWallet::CheckpointRescan(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (!fFileBacked)
+        return false;
+
+    if (!FlushDeferredTxWrites())
+        return false;
+    CBlockLocator loc = chainActive.GetLocator(pindex);
+    CWalletDB walletdb(strWalletFile);
+    if (!SetBestChainINTERNAL(walletdb, loc) || !walletdb.WriteRescanProgress(loc)) {
+        LogPrintf("CheckpointRescan(): failed to record rescan progress at block %d\n", pindex->nHeight);
+        return false;
+    }
+    LogPrint("db", "Rescan checkpoint at block %d\n", pindex->nHeight);
+    return true;
+}
+
+void CWallet::ReacceptWalletTransactions()
+{
     // If transactions aren't being broadcasted, don't let them into local mempool either
     if (!fBroadcastTransactions)
         return;
@@ -3521,8 +4653,8 @@ void CWallet::ReacceptWalletTransactions()
 bool CWalletTx::RelayWalletTransaction(std::string strCommand)
 {
     {
-        LOCK(pwalletMain->cs_wallet);
-        assert(pwalletMain->GetBroadcastTransactions());
+        LOCK(pwallet->cs_wallet);
+        assert(pwallet->GetBroadcastTransactions());
     }
     if (!IsCoinBase())
     {
@@ -3531,6 +4663,7 @@ bool CWalletTx::RelayWalletTransaction(std::string strCommand)
             LogPrintf("Relaying wtx %s\n", hash.ToString());
             if(strCommand == "ix"){
                 mapTxLockReq.insert(make_pair(hash, (CTransaction)*this));
+                mempool.SetLockRequest(hash);
                 CreateNewLock(((CTransaction)*this));
                 RelayTransactionLockReq((CTransaction)*this, true);
             } else {
@@ -3950,84 +5083,108 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
 /**
  * populate vCoins with vector of available COutputs.
  */
- void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, bool fIncludeCoinBase, AvailableCoinsType coin_type, bool useIX) const
- {
-     vCoins.clear();
-
-     {
-         LOCK2(cs_main, cs_wallet);
-         int count = 1;
-         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-         {
-             const uint256& wtxid = it->first;
-             const CWalletTx* pcoin = &(*it).second;
-
-             if (!CheckFinalTx(*pcoin))
-                 continue;
-
-             if (fOnlyConfirmed && !pcoin->IsTrusted())
-                 continue;
-
-             if (pcoin->IsCoinBase() && !fIncludeCoinBase)
-                 continue;
-
-             if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                 continue;
-
-             int nDepth = pcoin->GetDepthInMainChain(false);
-             if (useIX && nDepth < 6)
-             {
-                 continue;
-             }
-
-             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                 bool found = false;
-                 if (coin_type == ONLY_DENOMINATED) {
-                     found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                 } else if (coin_type == ONLY_NOT10000IFMN) {
-                     found = !(fZeroNode && pcoin->vout[i].nValue == 10000 * COIN);
-                 } else if (coin_type == ONLY_NONDENOMINATED_NOT10000IFMN) {
-                     //if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                     found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                     if (found && fZeroNode) found = pcoin->vout[i].nValue != 10000 * COIN; // do not use Hot MN funds
-                 } else if (coin_type == ONLY_10000) {
-                     found = pcoin->vout[i].nValue == 10000 * COIN;
-                 } else {
-                     found = true;
-                 }
-
-                 if(!found) continue;
-
-                 isminetype mine = IsMine(pcoin->vout[i]);
-
-                 if (IsSpent(wtxid, i))
-                 {
-                     continue;
-                 }
-                 if (mine == ISMINE_NO)
-                 {
-                     continue;
-                 }
-                 if (IsLockedCoin((*it).first, i) && coin_type != ONLY_10000)
-                 {
-                     continue;
-                 }
-                 if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
-                 {
-                     continue;
-                 }
-
-                 bool fIsSpendable = false;
-                 if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
-                     fIsSpendable = true;
-
-                 vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
-             }
-         }
-     }
- }
-
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, bool fIncludeCoinBase, AvailableCoinsType coin_type, bool useIX,
+                             const std::set<CTxDestination>* pDestinations) const
+{
+    vCoins.clear();
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        EnsureUnspentOutputIndex();
+
+        // Visit our outputs in outpoint order, like a walk of mapWallet would
+        std::vector<COutPoint> vOutputs;
+        if (pDestinations) {
+            for (const CTxDestination& dest : *pDestinations) {
+                const std::set<COutPoint>* outputs = unspentOutputIndex.GetOutputsByAddress(dest);
+                if (outputs)
+                    vOutputs.insert(vOutputs.end(), outputs->begin(), outputs->end());
+            }
+            std::sort(vOutputs.begin(), vOutputs.end());
+        } else {
+            vOutputs.reserve(unspentOutputIndex.Size());
+            for (const CUnspentOutputIndex::OutputMap::value_type& item : unspentOutputIndex.GetOutputs())
+                vOutputs.push_back(item.first);
+        }
+
+        std::vector<COutPoint> vBuried;
+        const CWalletTx* pcoin = NULL;
+        bool fSkipTx = true;
+        int nDepth = 0;
+        for (const COutPoint& out : vOutputs)
+        {
+            const uint256& wtxid = out.hash;
+            unsigned int i = out.n;
+
+            if (!pcoin || pcoin->GetHash() != wtxid) {
+                std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+                pcoin = it == mapWallet.end() ? NULL : &it->second;
+                fSkipTx = !pcoin || !CheckFinalTx(*pcoin) ||
+                          (fOnlyConfirmed && !pcoin->IsTrusted()) ||
+                          (pcoin->IsCoinBase() && !fIncludeCoinBase) ||
+                          (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0);
+                if (!fSkipTx) {
+                    nDepth = pcoin->GetDepthInMainChain(false);
+                    if (useIX && nDepth < 6)
+                        fSkipTx = true;
+                }
+            }
+            if (fSkipTx || i >= pcoin->vout.size())
+                continue;
+
+            if (IsSpent(wtxid, i))
+            {
+                // No reorganization can unspend it any more
+                if (GetSpendDepth(wtxid, i) > MAX_REORG_LENGTH)
+                    vBuried.push_back(out);
+                continue;
+            }
+
+            bool found = false;
+            if (coin_type == ONLY_DENOMINATED) {
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if (coin_type == ONLY_NOT10000IFMN) {
+                found = !(fZeroNode && pcoin->vout[i].nValue == 10000 * COIN);
+            } else if (coin_type == ONLY_NONDENOMINATED_NOT10000IFMN) {
+                //if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if (found && fZeroNode) found = pcoin->vout[i].nValue != 10000 * COIN; // do not use Hot MN funds
+            } else if (coin_type == ONLY_10000) {
+                found = pcoin->vout[i].nValue == 10000 * COIN;
+            } else {
+                found = true;
+            }
+
+            if(!found) continue;
+
+            isminetype mine = IsMine(pcoin->vout[i]);
+
+            if (mine == ISMINE_NO)
+            {
+                continue;
+            }
+            if (IsLockedCoin(wtxid, i) && coin_type != ONLY_10000)
+            {
+                continue;
+            }
+            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
+            {
+                continue;
+            }
+
+            bool fIsSpendable = false;
+            if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
+                fIsSpendable = true;
+
+            vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
+        }
+
+        for (const COutPoint& out : vBuried)
+            unspentOutputIndex.Erase(out);
+    }
+}
+
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -4073,7 +5230,50 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+bool SelectCoinsExactMatch(const std::vector<CAmount>& vValues, CAmount nTarget,
+                           std::vector<size_t>& vSelected, size_t nMaxTries)
+{
+    vSelected.clear();
+    size_t n = vValues.size();
+
+    // vRemaining[i] is the value of candidates i and later
+    std::vector<CAmount> vRemaining(n + 1, 0);
+    for (size_t i = n; i-- > 0; ) {
+        vRemaining[i] = vRemaining[i + 1] + vValues[i];
+    }
+    if (vRemaining[0] < nTarget)
+        return false;
+
+    // Depth first search, including before excluding each candidate
+    std::vector<size_t> vStack;
+    CAmount nSum = 0;
+    size_t i = 0;
+    for (size_t nTries = 0; nTries < nMaxTries; nTries++) {
+        if (nSum == nTarget) {
+            vSelected = vStack;
+            return true;
+        }
+        if (nSum > nTarget || nSum + vRemaining[i] < nTarget) {
+            if (vStack.empty())
+                break;
+            // Exclude the last included candidate, and any equal to it
+            size_t nLast = vStack.back();
+            vStack.pop_back();
+            nSum -= vValues[nLast];
+            i = nLast + 1;
+            while (i < n && vValues[i] == vValues[nLast]) {
+                i++;
+            }
+            continue;
+        }
+        vStack.push_back(i);
+        nSum += vValues[i];
+        i++;
+    }
+    return false;
+}
+
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
@@ -4086,10 +5286,11 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-    BOOST_FOREACH(const COutput &output, vCoins)
+    // Start at a random coin, so that which of equal coins is picked varies
+    size_t nStart = vCoins.empty() ? 0 : GetRand(vCoins.size());
+    for (size_t nCoin = 0; nCoin < vCoins.size(); nCoin++)
     {
+        const COutput& output = vCoins[(nStart + nCoin) % vCoins.size()];
         if (!output.fSpendable)
             continue;
 
@@ -4139,8 +5340,26 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    // Equal values are kept in random order by the sort
+    random_shuffle(vValue.begin(), vValue.end(), GetRandInt);
+    stable_sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+
+    // A subset matching the target exactly needs no change
+    std::vector<CAmount> vValues;
+    vValues.reserve(vValue.size());
+    for (const pair<CAmount, pair<const CWalletTx*,unsigned int> >& coin : vValue)
+        vValues.push_back(coin.first);
+    std::vector<size_t> vExact;
+    if (SelectCoinsExactMatch(vValues, nTargetValue, vExact)) {
+        for (size_t i : vExact) {
+            setCoinsRet.insert(vValue[i].second);
+            nValueRet += vValue[i].first;
+        }
+        LogPrint("selectcoins", "SelectCoins() exact match of %u coins\n", vExact.size());
+        return true;
+    }
+
+    // Otherwise solve subset sum by stochastic approximation
     vector<char> vfBest;
     CAmount nBest;
 
@@ -4305,7 +5524,7 @@ bool CWallet::GetBudgetSystemCollateralTX(CTransaction& tx, uint256 hash, bool u
 bool CWallet::GetBudgetSystemCollateralTX(CWalletTx& tx, uint256 hash, bool useIX)
 {
     // make our change address
-    CReserveKey reservekey(pwalletMain);
+    CReserveKey reservekey(this);
 
     CScript scriptChange;
     scriptChange << OP_RETURN << ToByteVector(hash);
@@ -4617,7 +5836,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     {
                         // Insert change txn at random position:
                         nChangePosRet = GetRandInt(txNew.vout.size()+1);
-                        vector<CTxOut>::iterator position = txNew.vout.begin()+nChangePosRet;
+                        CTxOutVector::iterator position = txNew.vout.begin()+nChangePosRet;
                         txNew.vout.insert(position, newTxOut);
                     }
                 }
@@ -4651,29 +5870,35 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Grab the current consensus branch ID
                 auto consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, Params().GetConsensus());
 
-                // Sign
-                int nIn = 0;
+                // Sign. The inputs are in the order of setCoins, and do not
+                // depend on each other's scriptSigs, so they are signed on the
+                // task pool with the signature hash midstates computed once.
                 CTransaction txNewConst(txNew);
-                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                {
-                    bool signSuccess;
-                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
-                    SignatureData sigdata;
-                    if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata, consensusBranchId);
-                    else
-                        signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, sigdata, consensusBranchId);
-
-                    if (!signSuccess)
-                    {
-                        strFailReason = _("Signing transaction failed");
-                        return false;
-                    } else {
-                        UpdateTransaction(txNew, nIn, sigdata);
+                std::vector<PAIRTYPE(const CWalletTx*,unsigned int)> vCoins(setCoins.begin(), setCoins.end());
+                std::vector<SignatureData> vSigData(vCoins.size());
+                std::atomic<bool> fSignFailed(false);
+                if (sign) {
+                    const PrecomputedTransactionData txdata(txNewConst);
+                    GetTaskPool().ParallelFor(TASKPOOL_WALLET, vCoins.size(), GetNumCores(), [&](size_t nIn) {
+                        const CTxOut& txout = vCoins[nIn].first->vout[vCoins[nIn].second];
+                        if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, txout.nValue, txdata, SIGHASH_ALL), txout.scriptPubKey, vSigData[nIn], consensusBranchId))
+                            fSignFailed = true;
+                    });
+                } else {
+                    for (size_t nIn = 0; nIn < vCoins.size(); nIn++) {
+                        const CScript& scriptPubKey = vCoins[nIn].first->vout[vCoins[nIn].second].scriptPubKey;
+                        if (!ProduceSignature(DummySignatureCreator(this), scriptPubKey, vSigData[nIn], consensusBranchId))
+                            fSignFailed = true;
                     }
+                }
 
-                    nIn++;
+                if (fSignFailed)
+                {
+                    strFailReason = _("Signing transaction failed");
+                    return false;
                 }
+                for (size_t nIn = 0; nIn < vCoins.size(); nIn++)
+                    UpdateTransaction(txNew, nIn, vSigData[nIn]);
 
                 unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
 
@@ -4875,7 +6100,7 @@ DBErrors CWallet::ZapWalletTx(std::vector<CWalletTx>& vWtx)
 }
 
 
-bool CWallet::SetAddressBook(const CTxDestination& address, const string& strName, const string& strPurpose)
+bool CWallet::SetAddressBook(const CTxDestination& address, const string& strName, const string& strPurpose, CWalletDB* pwalletdb)
 {
     bool fUpdated = false;
     {
@@ -4890,6 +6115,11 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
     if (!fFileBacked)
         return false;
+    if (pwalletdb) {
+        if (!strPurpose.empty() && !pwalletdb->WritePurpose(EncodeDestination(address), strPurpose))
+            return false;
+        return pwalletdb->WriteName(EncodeDestination(address), strName);
+    }
     if (!strPurpose.empty() && !CWalletDB(strWalletFile).WritePurpose(EncodeDestination(address), strPurpose))
         return false;
     return CWalletDB(strWalletFile).WriteName(EncodeDestination(address), strName);
@@ -5302,18 +6532,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    InvalidateBalanceSnapshot();
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    InvalidateBalanceSnapshot();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    InvalidateBalanceSnapshot();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -5341,18 +6574,21 @@ void CWallet::LockNote(const JSOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.insert(output);
+    InvalidateBalanceSnapshot();
 }
 
 void CWallet::UnlockNote(const JSOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.erase(output);
+    InvalidateBalanceSnapshot();
 }
 
 void CWallet::UnlockAllSproutNotes()
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.clear();
+    InvalidateBalanceSnapshot();
 }
 
 bool CWallet::IsLockedNote(const JSOutPoint& outpt) const
@@ -5373,18 +6609,21 @@ void CWallet::LockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.insert(output);
+    InvalidateBalanceSnapshot();
 }
 
 void CWallet::UnlockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.erase(output);
+    InvalidateBalanceSnapshot();
 }
 
 void CWallet::UnlockAllSaplingNotes()
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.clear();
+    InvalidateBalanceSnapshot();
 }
 
 bool CWallet::IsLockedNote(const SaplingOutPoint& output) const
@@ -5573,12 +6812,20 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(const CBlockIndex* &pindexRet) const
         return 0;
     AssertLockHeld(cs_main);
 
-    // Find the block it claims to be in
-    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi == mapBlockIndex.end())
-        return 0;
-    CBlockIndex* pindex = (*mi).second;
-    if (!pindex || !chainActive.Contains(pindex))
+    // Find the block it claims to be in. The entry found last time holds
+    // until mapBlockIndex frees or moves entries, and whether it is in the
+    // active chain is checked by height.
+    const CBlockIndex* pindex = pindexBlock;
+    if (!pindex || hashBlockIndexed != hashBlock || nGenerationIndexed != nBlockIndexGeneration) {
+        pindexBlock = NULL;
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end() || !mi->second)
+            return 0;
+        pindex = pindexBlock = mi->second;
+        hashBlockIndexed = hashBlock;
+        nGenerationIndexed = nBlockIndexGeneration;
+    }
+    if (!chainActive.Contains(pindex))
         return 0;
 
     // Make sure the merkle branch connects to this block
@@ -5654,6 +6901,487 @@ bool CMerkleTx::IsTransactionLockTimedOut() const
     return false;
 }
 
+const CSaplingNoteIndex::Entry* CSaplingNoteIndex::Find(const SaplingOutPoint& op) const
+{
+    std::map<SaplingOutPoint, Entry>::const_iterator it = mapNotes.find(op);
+    return it == mapNotes.end() ? NULL : &it->second;
+}
+
+void CSaplingNoteIndex::Add(const SaplingOutPoint& op, const Entry& entry)
+{
+    if (!mapNotes.insert(std::make_pair(op, entry)).second)
+        return;
+    mapByAddress[entry.address].insert(std::make_pair(CAmount(entry.note.value()), op));
+}
+
+void CSaplingNoteIndex::EraseTx(const uint256& hash)
+{
+    std::map<SaplingOutPoint, Entry>::iterator it = mapNotes.lower_bound(SaplingOutPoint(hash, 0));
+    while (it != mapNotes.end() && it->first.hash == hash) {
+        auto itAddr = mapByAddress.find(it->second.address);
+        if (itAddr != mapByAddress.end()) {
+            itAddr->second.erase(std::make_pair(CAmount(it->second.note.value()), it->first));
+            if (itAddr->second.empty())
+                mapByAddress.erase(itAddr);
+        }
+        mapNotes.erase(it++);
+    }
+}
+
+size_t CSaplingNoteIndex::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(mapNotes) + memusage::DynamicUsage(mapByAddress);
+    for (const auto& item : mapByAddress)
+        nUsage += memusage::DynamicUsage(item.second);
+    return nUsage;
+}
+
+void CSaplingNoteIndex::Clear()
+{
+    mapNotes.clear();
+    mapByAddress.clear();
+}
+
+const CSaplingNoteIndex::ValueSet* CSaplingNoteIndex::GetNotesByValue(const libzcash::SaplingPaymentAddress& address) const
+{
+    auto it = mapByAddress.find(address);
+    return it == mapByAddress.end() ? NULL : &it->second;
+}
+
+static bool DecryptSaplingNote(const CWalletTx& wtx, const SaplingOutPoint& op, const SaplingNoteData& nd, CSaplingNoteIndex::Entry& entry)
+{
+    if (op.n >= wtx.vShieldedOutput.size())
+        return false;
+    auto maybe_pt = SaplingNotePlaintext::decrypt(
+        wtx.vShieldedOutput[op.n].encCiphertext,
+        nd.ivk,
+        wtx.vShieldedOutput[op.n].ephemeralKey,
+        wtx.vShieldedOutput[op.n].cm);
+    if (!maybe_pt)
+        return false;
+    auto notePt = maybe_pt.get();
+
+    auto maybe_pa = nd.ivk.address(notePt.d);
+    auto maybe_note = notePt.note(nd.ivk);
+    if (!maybe_pa || !maybe_note)
+        return false;
+
+    entry.address = maybe_pa.get();
+    entry.note = maybe_note.get();
+    entry.memo = notePt.memo();
+    return true;
+}
+
+/**
+ * Decrypt and index the Sapling notes of wtx that are not indexed yet.
+ */
+void CWallet::IndexSaplingNotes(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    for (const std::pair<const SaplingOutPoint, SaplingNoteData>& pair : wtx.mapSaplingNoteData) {
+        if (saplingNoteIndex.Find(pair.first))
+            continue;
+        CSaplingNoteIndex::Entry entry;
+        if (DecryptSaplingNote(wtx, pair.first, pair.second, entry))
+            saplingNoteIndex.Add(pair.first, entry);
+    }
+}
+
+/**
+ * Index the notes of every transaction in the wallet, once after loading.
+ */
+void CWallet::EnsureSaplingNoteIndex()
+{
+    AssertLockHeld(cs_wallet);
+    if (fSaplingNoteIndexComplete)
+        return;
+    for (const std::pair<const uint256, CWalletTx>& p : mapWallet) {
+        IndexSaplingNotes(p.second);
+    }
+    fSaplingNoteIndexComplete = true;
+    LogPrint("zrpc", "Indexed %u Sapling notes\n", saplingNoteIndex.Size());
+}
+
+/**
+ * The decrypted note at op, decrypting and indexing it if necessary.
+ */
+const CSaplingNoteIndex::Entry* CWallet::GetIndexedSaplingNote(const CWalletTx& wtx, const SaplingOutPoint& op)
+{
+    AssertLockHeld(cs_wallet);
+    const CSaplingNoteIndex::Entry* entry = saplingNoteIndex.Find(op);
+    if (entry)
+        return entry;
+    auto it = wtx.mapSaplingNoteData.find(op);
+    if (it == wtx.mapSaplingNoteData.end())
+        return NULL;
+    CSaplingNoteIndex::Entry newEntry;
+    if (!DecryptSaplingNote(wtx, op, it->second, newEntry))
+        return NULL;
+    saplingNoteIndex.Add(op, newEntry);
+    return saplingNoteIndex.Find(op);
+}
+
+void CUnspentOutputIndex::Add(const COutPoint& out, const CTxDestination& dest)
+{
+    if (!mapOutputs.insert(std::make_pair(out, dest)).second)
+        return;
+    mapByAddress[dest].insert(out);
+}
+
+void CUnspentOutputIndex::Erase(const COutPoint& out)
+{
+    OutputMap::iterator it = mapOutputs.find(out);
+    if (it == mapOutputs.end())
+        return;
+    auto itAddr = mapByAddress.find(it->second);
+    if (itAddr != mapByAddress.end()) {
+        itAddr->second.erase(out);
+        if (itAddr->second.empty())
+            mapByAddress.erase(itAddr);
+    }
+    mapOutputs.erase(it);
+}
+
+void CUnspentOutputIndex::EraseTx(const uint256& hash)
+{
+    OutputMap::iterator it = mapOutputs.lower_bound(COutPoint(hash, 0));
+    while (it != mapOutputs.end() && it->first.hash == hash)
+        Erase((it++)->first);
+}
+
+void CUnspentOutputIndex::Clear()
+{
+    mapOutputs.clear();
+    mapByAddress.clear();
+}
+
+const std::set<COutPoint>* CUnspentOutputIndex::GetOutputsByAddress(const CTxDestination& dest) const
+{
+    auto it = mapByAddress.find(dest);
+    return it == mapByAddress.end() ? NULL : &it->second;
+}
+
+size_t CUnspentOutputIndex::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(mapOutputs) + memusage::DynamicUsage(mapByAddress);
+    for (const auto& item : mapByAddress)
+        nUsage += memusage::DynamicUsage(item.second);
+    return nUsage;
+}
+
+/**
+ * Index the transparent outputs of wtx that are ours.
+ */
+void CWallet::IndexUnspentOutputs(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) == ISMINE_NO)
+            continue;
+        CTxDestination dest;
+        if (!ExtractDestination(wtx.vout[i].scriptPubKey, dest))
+            dest = CNoDestination();
+        unspentOutputIndex.Add(COutPoint(wtx.GetHash(), i), dest);
+    }
+}
+
+/**
+ * Index the outputs of every transaction in the wallet, after loading or
+ * after keys or scripts were added.
+ */
+void CWallet::EnsureUnspentOutputIndex() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentOutputIndexComplete)
+        return;
+    unspentOutputIndex.Clear();
+    for (const std::pair<const uint256, CWalletTx>& p : mapWallet) {
+        IndexUnspentOutputs(p.second);
+    }
+    fUnspentOutputIndexComplete = true;
+    LogPrint("selectcoins", "Indexed %u transparent wallet outputs\n", unspentOutputIndex.Size());
+}
+
+void CAddressTxIndex::Add(const std::string& strAddress, const uint256& hash)
+{
+    if (!mapAddressesByTx[hash].insert(strAddress).second)
+        return;
+    mapTxsByAddress[strAddress].insert(hash);
+}
+
+void CAddressTxIndex::EraseTx(const uint256& hash)
+{
+    auto it = mapAddressesByTx.find(hash);
+    if (it == mapAddressesByTx.end())
+        return;
+    for (const std::string& strAddress : it->second) {
+        auto itAddr = mapTxsByAddress.find(strAddress);
+        if (itAddr != mapTxsByAddress.end()) {
+            itAddr->second.erase(hash);
+            if (itAddr->second.empty())
+                mapTxsByAddress.erase(itAddr);
+        }
+    }
+    mapAddressesByTx.erase(it);
+}
+
+void CAddressTxIndex::Clear()
+{
+    mapTxsByAddress.clear();
+    mapAddressesByTx.clear();
+}
+
+const std::set<uint256>* CAddressTxIndex::GetTxs(const std::string& strAddress) const
+{
+    auto it = mapTxsByAddress.find(strAddress);
+    return it == mapTxsByAddress.end() ? NULL : &it->second;
+}
+
+size_t CAddressTxIndex::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(mapTxsByAddress) + memusage::DynamicUsage(mapAddressesByTx);
+    for (const auto& item : mapTxsByAddress)
+        nUsage += memusage::DynamicUsage(item.second);
+    for (const auto& item : mapAddressesByTx)
+        nUsage += memusage::DynamicUsage(item.second);
+    return nUsage;
+}
+
+/**
+ * The outgoing viewing keys zsTxSendsToJSON decrypts with: the HD seed's,
+ * for shielding transactions, unless the wallet is locked, and those of the
+ * wallet's Sapling keys for the others.
+ */
+void CWallet::GetIndexOutgoingViewingKeys(std::vector<uint256>& vSeedOvks, std::vector<uint256>& vKeyOvks)
+{
+    HDSeed seed;
+    if (GetHDSeed(seed))
+        vSeedOvks.push_back(ovkForShieldingFromTaddr(seed));
+
+    std::set<uint256> setOvks;
+    {
+        LOCK(cs_SpendingKeyStore);
+        for (const auto& item : mapSaplingFullViewingKeys)
+            setOvks.insert(item.second.ovk);
+    }
+    vKeyOvks.assign(setOvks.begin(), setOvks.end());
+}
+
+void CWallet::IndexAddressTxs(const CWalletTx& wtx)
+{
+    std::vector<uint256> vSeedOvks, vKeyOvks;
+    if (!wtx.vShieldedOutput.empty())
+        GetIndexOutgoingViewingKeys(vSeedOvks, vKeyOvks);
+    IndexAddressTxs(wtx, vSeedOvks, vKeyOvks);
+}
+
+/**
+ * Index wtx under the addresses it pays: its transparent outputs, its notes
+ * and the Sapling outputs the given outgoing viewing keys decrypt.
+ */
+void CWallet::IndexAddressTxs(const CWalletTx& wtx, const std::vector<uint256>& vSeedOvks, const std::vector<uint256>& vKeyOvks)
+{
+    AssertLockHeld(cs_wallet);
+    const uint256 hash = wtx.GetHash();
+
+    for (const CTxOut& txout : wtx.vout) {
+        CTxDestination dest;
+        if (ExtractDestination(txout.scriptPubKey, dest))
+            addressTxIndex.Add(EncodeDestination(dest), hash);
+    }
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        addressTxIndex.Add(EncodePaymentAddress(item.second.address), hash);
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        const CSaplingNoteIndex::Entry* entry = GetIndexedSaplingNote(wtx, item.first);
+        if (entry)
+            addressTxIndex.Add(EncodePaymentAddress(entry->address), hash);
+    }
+
+    // Our own outputs are indexed above from the notes
+    const std::vector<uint256>& vOvks = wtx.vShieldedSpend.empty() ? vSeedOvks : vKeyOvks;
+    for (unsigned int i = 0; i < wtx.vShieldedOutput.size() && !vOvks.empty(); i++) {
+        if (wtx.mapSaplingNoteData.count(SaplingOutPoint(hash, i)))
+            continue;
+        const OutputDescription& output = wtx.vShieldedOutput[i];
+        for (const uint256& ovk : vOvks) {
+            auto opt = libzcash::SaplingOutgoingPlaintext::decrypt(
+                    output.outCiphertext, ovk, output.cv, output.cm, output.ephemeralKey);
+            if (!opt)
+                continue;
+            auto pt = libzcash::SaplingNotePlaintext::decrypt(
+                    output.encCiphertext, output.ephemeralKey, opt->esk, opt->pk_d, output.cm);
+            if (pt)
+                addressTxIndex.Add(EncodePaymentAddress(libzcash::SaplingPaymentAddress(pt->d, opt->pk_d)), hash);
+            break;
+        }
+    }
+
+    if (wtx.vShieldedSpend.empty() && !wtx.vShieldedOutput.empty() && vSeedOvks.empty() && IsLocked())
+        setAddressTxsLocked.insert(hash);
+}
+
+/**
+ * Index every transaction in the wallet by address, on first use after
+ * loading or after Sapling spending keys were imported.
+ */
+void CWallet::EnsureAddressTxIndex()
+{
+    AssertLockHeld(cs_wallet);
+    if (fAddressTxIndexComplete)
+        return;
+    addressTxIndex.Clear();
+    setAddressTxsLocked.clear();
+    std::vector<uint256> vSeedOvks, vKeyOvks;
+    GetIndexOutgoingViewingKeys(vSeedOvks, vKeyOvks);
+    for (const std::pair<const uint256, CWalletTx>& p : mapWallet) {
+        IndexAddressTxs(p.second, vSeedOvks, vKeyOvks);
+    }
+    fAddressTxIndexComplete = true;
+    LogPrint("zrpc", "Indexed %u wallet transactions by address\n", addressTxIndex.Size());
+}
+
+void CWallet::GetAddressTxs(const std::string& strAddress, bool fSpends, std::set<uint256>& setTxs)
+{
+    AssertLockHeld(cs_wallet);
+    EnsureAddressTxIndex();
+
+    // Shielding transactions indexed while the wallet was locked
+    if (!setAddressTxsLocked.empty() && !IsLocked()) {
+        std::vector<uint256> vSeedOvks, vKeyOvks;
+        GetIndexOutgoingViewingKeys(vSeedOvks, vKeyOvks);
+        std::set<uint256> setLocked;
+        setLocked.swap(setAddressTxsLocked);
+        for (const uint256& hash : setLocked) {
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+            if (mi != mapWallet.end())
+                IndexAddressTxs(mi->second, vSeedOvks, vKeyOvks);
+        }
+    }
+
+    // The index holds addresses as they are encoded. The calls report a
+    // Sapling note under every address of its incoming viewing key.
+    std::set<std::string> setAddresses;
+    CTxDestination dest = DecodeDestination(strAddress);
+    libzcash::PaymentAddress zaddr = DecodePaymentAddress(strAddress);
+    if (IsValidDestination(dest)) {
+        setAddresses.insert(EncodeDestination(dest));
+    } else if (IsValidPaymentAddress(zaddr)) {
+        setAddresses.insert(EncodePaymentAddress(zaddr));
+        const libzcash::SaplingPaymentAddress* saplingAddr = boost::get<libzcash::SaplingPaymentAddress>(&zaddr);
+        libzcash::SaplingIncomingViewingKey ivk;
+        if (saplingAddr && GetSaplingIncomingViewingKey(*saplingAddr, ivk)) {
+            LOCK(cs_SpendingKeyStore);
+            for (const auto& item : mapSaplingIncomingViewingKeys) {
+                if (item.second == ivk)
+                    setAddresses.insert(EncodePaymentAddress(item.first));
+            }
+        }
+    }
+
+    std::set<uint256> setPaying;
+    for (const std::string& str : setAddresses) {
+        const std::set<uint256>* txs = addressTxIndex.GetTxs(str);
+        if (txs)
+            setPaying.insert(txs->begin(), txs->end());
+    }
+    if (!fSpends) {
+        setTxs.insert(setPaying.begin(), setPaying.end());
+        return;
+    }
+
+    // Whatever spends the outputs and notes of the transactions paying it
+    for (const uint256& hash : setPaying) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = mi->second;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            auto range = mapTxSpends.equal_range(COutPoint(hash, i));
+            for (auto it = range.first; it != range.second; ++it)
+                setTxs.insert(it->second);
+        }
+        for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+            if (!item.second.nullifier)
+                continue;
+            auto range = mapTxSproutNullifiers.equal_range(*item.second.nullifier);
+            for (auto it = range.first; it != range.second; ++it)
+                setTxs.insert(it->second);
+        }
+        for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+            if (!item.second.nullifier)
+                continue;
+            auto range = mapTxSaplingNullifiers.equal_range(*item.second.nullifier);
+            for (auto it = range.first; it != range.second; ++it)
+                setTxs.insert(it->second);
+        }
+    }
+}
+
+bool SelectSaplingNotes(const std::vector<SaplingNoteEntry>& vCandidates, CAmount nTarget,
+                        std::vector<size_t>& vSelected, size_t nMaxTries)
+{
+    vSelected.clear();
+    size_t n = vCandidates.size();
+
+    // vRemaining[i] is the value of candidates i and later
+    std::vector<CAmount> vRemaining(n + 1, 0);
+    for (size_t i = n; i-- > 0; ) {
+        vRemaining[i] = vRemaining[i + 1] + CAmount(vCandidates[i].note.value());
+    }
+    if (vRemaining[0] < nTarget)
+        return false;
+
+    // The smallest note covering the target needs a single spend
+    size_t nCovering = std::partition_point(vCandidates.begin(), vCandidates.end(),
+        [nTarget](const SaplingNoteEntry& entry) -> bool {
+            return CAmount(entry.note.value()) >= nTarget;
+        }) - vCandidates.begin();
+    if (nCovering > 0) {
+        vSelected.push_back(nCovering - 1);
+        return true;
+    }
+
+    // Largest first, used as the fallback and to bound the search below
+    std::vector<size_t> vLargest;
+    CAmount nSum = 0;
+    for (size_t i = 0; i < n && nSum < nTarget; i++) {
+        vLargest.push_back(i);
+        nSum += vCandidates[i].note.value();
+    }
+
+    // Depth first search for an exact match, including before excluding
+    // each candidate
+    std::vector<size_t> vStack;
+    nSum = 0;
+    size_t i = 0;
+    for (size_t nTries = 0; nTries < nMaxTries; nTries++) {
+        if (nSum == nTarget) {
+            vSelected = vStack;
+            return true;
+        }
+        if (nSum > nTarget || nSum + vRemaining[i] < nTarget || vStack.size() >= vLargest.size()) {
+            if (vStack.empty())
+                break;
+            // Exclude the last included candidate, and any equal to it
+            size_t nLast = vStack.back();
+            vStack.pop_back();
+            nSum -= vCandidates[nLast].note.value();
+            i = nLast + 1;
+            while (i < n && vCandidates[i].note.value() == vCandidates[nLast].note.value()) {
+                i++;
+            }
+            continue;
+        }
+        vStack.push_back(i);
+        nSum += vCandidates[i].note.value();
+        i++;
+    }
+
+    vSelected = vLargest;
+    return true;
+}
+
 /**
  * Find notes in the wallet filtered by payment address, min depth and ability to spend.
  * These notes are decrypted and added to the output parameter vector, outEntries.
@@ -5692,8 +7420,75 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
+    // When only Sapling addresses are asked for, visit just their indexed
+    // notes instead of every wallet transaction
+    bool fSaplingOnly = !filterAddresses.empty();
+    for (const PaymentAddress& addr : filterAddresses) {
+        if (boost::get<libzcash::SaplingPaymentAddress>(&addr) == nullptr) {
+            fSaplingOnly = false;
+            break;
+        }
+    }
+    if (fSaplingOnly) {
+        EnsureSaplingNoteIndex();
+        for (const PaymentAddress& addr : filterAddresses) {
+            const libzcash::SaplingPaymentAddress& pa = boost::get<libzcash::SaplingPaymentAddress>(addr);
+            const CSaplingNoteIndex::ValueSet* notes = saplingNoteIndex.GetNotesByValue(pa);
+            if (!notes) {
+                continue;
+            }
+
+            // skip notes which cannot be spent
+            if (requireSpendingKey) {
+                libzcash::SaplingIncomingViewingKey ivk;
+                libzcash::SaplingFullViewingKey fvk;
+                if (!(GetSaplingIncomingViewingKey(pa, ivk) &&
+                    GetSaplingFullViewingKey(ivk, fvk) &&
+                    HaveSaplingSpendingKey(fvk))) {
+                    continue;
+                }
+            }
+
+            for (const std::pair<CAmount, SaplingOutPoint>& item : *notes) {
+                const SaplingOutPoint& op = item.second;
+                auto itTx = mapWallet.find(op.hash);
+                if (itTx == mapWallet.end()) {
+                    continue;
+                }
+                const CWalletTx& wtx = itTx->second;
+                auto itNote = wtx.mapSaplingNoteData.find(op);
+                if (itNote == wtx.mapSaplingNoteData.end()) {
+                    continue;
+                }
+                const SaplingNoteData& nd = itNote->second;
+
+                int nDepth = wtx.GetDepthInMainChain();
+                if (!CheckFinalTx(wtx) ||
+                    wtx.GetBlocksToMaturity() > 0 ||
+                    nDepth < minDepth ||
+                    nDepth > maxDepth) {
+                    continue;
+                }
+
+                if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+                    continue;
+                }
+
+                // skip locked notes
+                if (ignoreLocked && IsLockedNote(op)) {
+                    continue;
+                }
+
+                const CSaplingNoteIndex::Entry* entry = saplingNoteIndex.Find(op);
+                saplingEntries.push_back(SaplingNoteEntry {
+                    op, pa, entry->note, entry->memo, nDepth });
+            }
+        }
+        return;
+    }
+
     for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+        const CWalletTx& wtx = p.second;
 
         // Filter the transactions before checking for notes
         if (!CheckFinalTx(wtx) ||
@@ -5761,20 +7556,13 @@ void CWallet::GetFilteredNotes(
         }
 
         for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
-
-            auto maybe_pt = SaplingNotePlaintext::decrypt(
-                wtx.vShieldedOutput[op.n].encCiphertext,
-                nd.ivk,
-                wtx.vShieldedOutput[op.n].ephemeralKey,
-                wtx.vShieldedOutput[op.n].cm);
-            assert(static_cast<bool>(maybe_pt));
-            auto notePt = maybe_pt.get();
+            const SaplingOutPoint& op = pair.first;
+            const SaplingNoteData& nd = pair.second;
 
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.get();
+            // Decrypted once and then served from the index
+            const CSaplingNoteIndex::Entry* entry = GetIndexedSaplingNote(wtx, op);
+            assert(entry != NULL);
+            const libzcash::SaplingPaymentAddress& pa = entry->address;
 
             // skip notes which belong to a different payment address in the wallet
             if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
@@ -5801,13 +7589,151 @@ void CWallet::GetFilteredNotes(
                 continue;
             }
 
-            auto note = notePt.note(nd.ivk).get();
             saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+                op, pa, entry->note, entry->memo, wtx.GetDepthInMainChain() });
+        }
+    }
+}
+
+
+void CBalanceAggregate::Add(int nDepth, CAmount nValue, bool fSpendable)
+{
+    vDepths.push_back(nDepth);
+    vTotal.push_back(nValue);
+    vSpendable.push_back(fSpendable ? nValue : 0);
+}
+
+void CBalanceAggregate::Finalize()
+{
+    std::vector<size_t> vOrder(vDepths.size());
+    for (size_t i = 0; i < vOrder.size(); i++)
+        vOrder[i] = i;
+    std::sort(vOrder.begin(), vOrder.end(), [this](size_t a, size_t b) { return vDepths[a] < vDepths[b]; });
+
+    // Merge equal depths, then turn the buckets into sums over each depth
+    // and everything deeper
+    std::vector<int> vNewDepths;
+    std::vector<CAmount> vNewTotal, vNewSpendable;
+    for (size_t i : vOrder) {
+        if (vNewDepths.empty() || vNewDepths.back() != vDepths[i]) {
+            vNewDepths.push_back(vDepths[i]);
+            vNewTotal.push_back(0);
+            vNewSpendable.push_back(0);
         }
+        vNewTotal.back() += vTotal[i];
+        vNewSpendable.back() += vSpendable[i];
+    }
+    for (size_t i = vNewDepths.size(); i-- > 1; ) {
+        vNewTotal[i - 1] += vNewTotal[i];
+        vNewSpendable[i - 1] += vNewSpendable[i];
+    }
+    vDepths.swap(vNewDepths);
+    vTotal.swap(vNewTotal);
+    vSpendable.swap(vNewSpendable);
+}
+
+CAmount CBalanceAggregate::Get(int minDepth, bool ignoreUnspendable) const
+{
+    size_t nPos = std::lower_bound(vDepths.begin(), vDepths.end(), minDepth) - vDepths.begin();
+    if (nPos == vDepths.size())
+        return 0;
+    return ignoreUnspendable ? vSpendable[nPos] : vTotal[nPos];
+}
+
+void CWalletBalanceSnapshot::Finalize()
+{
+    transparentTotal.Finalize();
+    shieldedTotal.Finalize();
+    for (auto& entry : mapTransparent)
+        entry.second.Finalize();
+    for (auto& entry : mapShielded)
+        entry.second.Finalize();
+}
+
+CAmount CWalletBalanceSnapshot::GetTransparentBalance(const std::set<CTxDestination>& destinations, int minDepth, bool ignoreUnspendable) const
+{
+    if (destinations.empty())
+        return transparentTotal.Get(minDepth, ignoreUnspendable);
+
+    CAmount balance = 0;
+    for (const CTxDestination& dest : destinations) {
+        auto it = mapTransparent.find(dest);
+        if (it != mapTransparent.end())
+            balance += it->second.Get(minDepth, ignoreUnspendable);
+    }
+    return balance;
+}
+
+CAmount CWalletBalanceSnapshot::GetShieldedBalance(const std::set<PaymentAddress>& addresses, int minDepth, bool ignoreUnspendable) const
+{
+    if (addresses.empty())
+        return shieldedTotal.Get(minDepth, ignoreUnspendable);
+
+    CAmount balance = 0;
+    for (const PaymentAddress& address : addresses) {
+        auto it = mapShielded.find(address);
+        if (it != mapShielded.end())
+            balance += it->second.Get(minDepth, ignoreUnspendable);
     }
+    return balance;
 }
 
+void CWallet::UpdateBalanceSnapshot()
+{
+    LOCK2(cs_main, cs_wallet);
+
+    std::shared_ptr<CWalletBalanceSnapshot> snapshot = std::make_shared<CWalletBalanceSnapshot>();
+    snapshot->nHeight = chainActive.Height();
+
+    std::vector<COutput> vecOutputs;
+    AvailableCoins(vecOutputs, false, NULL, true);
+    for (const COutput& out : vecOutputs) {
+        CAmount nValue = out.tx->vout[out.i].nValue;
+        snapshot->transparentTotal.Add(out.nDepth, nValue, out.fSpendable);
+        CTxDestination dest;
+        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, dest))
+            snapshot->mapTransparent[dest].Add(out.nDepth, nValue, out.fSpendable);
+    }
+
+    // Locked notes are left out, as they are by getBalanceZaddr()
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    std::set<PaymentAddress> noFilter;
+    GetFilteredNotes(sproutEntries, saplingEntries, noFilter, 0, INT_MAX, true, false, true);
+
+    for (const SproutNoteEntry& entry : sproutEntries) {
+        bool fSpendable = HaveSproutSpendingKey(entry.address);
+        CAmount nValue = entry.note.value();
+        snapshot->shieldedTotal.Add(entry.confirmations, nValue, fSpendable);
+        snapshot->mapShielded[entry.address].Add(entry.confirmations, nValue, fSpendable);
+    }
+    for (const SaplingNoteEntry& entry : saplingEntries) {
+        libzcash::SaplingIncomingViewingKey ivk;
+        libzcash::SaplingFullViewingKey fvk;
+        bool fSpendable = GetSaplingIncomingViewingKey(entry.address, ivk) &&
+            GetSaplingFullViewingKey(ivk, fvk) &&
+            HaveSaplingSpendingKey(fvk);
+        CAmount nValue = entry.note.value();
+        snapshot->shieldedTotal.Add(entry.confirmations, nValue, fSpendable);
+        snapshot->mapShielded[entry.address].Add(entry.confirmations, nValue, fSpendable);
+    }
+    snapshot->Finalize();
+
+    LOCK(cs_balanceSnapshot);
+    balanceSnapshot = snapshot;
+}
+
+void CWallet::InvalidateBalanceSnapshot()
+{
+    LOCK(cs_balanceSnapshot);
+    balanceSnapshot.reset();
+}
+
+std::shared_ptr<const CWalletBalanceSnapshot> CWallet::GetBalanceSnapshot() const
+{
+    LOCK(cs_balanceSnapshot);
+    return balanceSnapshot;
+}
 
 //
 // Shielded key and address generalizations
@@ -5909,10 +7835,6 @@ SpendingKeyAddResult AddSpendingKeyToWallet::operator()(const libzcash::SaplingE
         if (m_wallet->HaveSaplingSpendingKey(fvk)) {
             return KeyAlreadyExists;
         } else {
-            if (!m_wallet-> AddSaplingZKey(sk, addr)) {
-                return KeyNotAdded;
-            }
-
             // Sapling addresses can't have been used in transactions prior to activation.
             if (params.vUpgrades[Consensus::UPGRADE_SAPLING].nActivationHeight == Consensus::NetworkUpgrade::ALWAYS_ACTIVE) {
                 m_wallet->mapSaplingZKeyMetadata[ivk].nCreateTime = nTime;
@@ -5928,6 +7850,11 @@ SpendingKeyAddResult AddSpendingKeyToWallet::operator()(const libzcash::SaplingE
                 seedFp.SetHex(seedFpStr.get());
                 m_wallet->mapSaplingZKeyMetadata[ivk].seedFp = seedFp;
             }
+
+            // Added once the metadata is set, which is written with the key
+            if (!m_wallet->AddSaplingZKey(sk, addr, pwalletdb)) {
+                return KeyNotAdded;
+            }
             return KeyAdded;
         }
     }
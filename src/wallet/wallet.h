@@ -8,7 +8,10 @@
 
 #include "amount.h"
 #include "asyncrpcoperation.h"
+#include "clientversion.h"
 #include "coins.h"
+#include "compactblocks.h"
+#include "hash.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -29,11 +32,15 @@
 
 #include <univalue.h>
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -53,6 +60,14 @@ extern bool fTxConflictDeleteEnabled;
 extern int fDeleteInterval;
 extern unsigned int fDeleteTransactionsAfterNBlocks;
 extern unsigned int fKeepLastNTransactions;
+extern int nRescanThreads;
+extern int nRescanCheckpointInterval;
+//! Percentage done of the rescan in progress, or -1 when no wallet is rescanning
+extern std::atomic<int> nRescanProgress;
+extern int nNoteDecryptionThreads;
+extern int nWalletLoadThreads;
+extern bool fShieldedOnlyScan;
+extern int nProvingThreads;
 
 
 //! -paytxfee default
@@ -78,6 +93,9 @@ static const size_t HD_WALLET_SEED_LENGTH = 32;
 //Default Transaction Rentention N-BLOCKS
 static const int DEFAULT_TX_DELETE_INTERVAL = 1000;
 
+//! -rescancheckpoint default
+static const int DEFAULT_RESCAN_CHECKPOINT_INTERVAL = 1000;
+
 //Default Transaction Rentention N-BLOCKS
 static const unsigned int DEFAULT_TX_RETENTION_BLOCKS = 10000;
 
@@ -86,6 +104,33 @@ static const unsigned int DEFAULT_TX_RETENTION_LASTTX = 200;
 
 //Amount of transactions to delete per run while syncing
 static const int MAX_DELETE_TX_SIZE = 50000;
+//! Number of transactions erased per wallet database transaction when deleting
+static const size_t WALLET_DELETE_CHUNK_SIZE = 1000;
+
+//! -rescanthreads default (0 = one thread per core)
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Maximum number of threads reading and trial-decrypting blocks during a rescan
+static const int MAX_RESCAN_THREADS = 16;
+//! Number of blocks read ahead, and committed to the wallet under a single lock, during a rescan
+static const unsigned int RESCAN_BATCH_SIZE = 100;
+//! -notedecryptthreads default (0 = one thread per core)
+static const int DEFAULT_NOTE_DECRYPTION_THREADS = 0;
+//! Maximum number of threads used to trial decrypt notes outside of a rescan
+static const int MAX_NOTE_DECRYPTION_THREADS = 16;
+//! -provingthreads default (0 = one thread per core)
+static const int DEFAULT_PROVING_THREADS = 0;
+//! Maximum number of transactions built concurrently by wallet operations that create several
+static const int MAX_PROVING_THREADS = 16;
+//! -shieldedonlyscan default
+static const bool DEFAULT_SHIELDED_ONLY_SCAN = false;
+//! -walletloadthreads default (0 = one thread per core)
+static const int DEFAULT_WALLET_LOAD_THREADS = 0;
+//! Maximum number of threads decoding transaction records while loading the wallet
+static const int MAX_WALLET_LOAD_THREADS = 16;
+//! -saplingkeypool default: Sapling keys derived ahead of z_getnewaddress (0 = derive on demand)
+static const unsigned int DEFAULT_SAPLING_KEYPOOL_SIZE = 0;
+//! Maximum number of addresses z_getnewaddresses returns in one call
+static const unsigned int MAX_SAPLING_ADDRESS_BATCH = 10000;
 
 class CBlockIndex;
 class CCoinControl;
@@ -305,6 +350,12 @@ public:
     }
 };
 
+/**
+ * Set in the version SaplingNoteData is stored with when its witnesses are
+ * written as a CompactWitnessList. Records without it are read as before.
+ */
+static const int SAPLING_NOTE_DATA_COMPACT_WITNESSES = 0x40000000;
+
 class SaplingNoteData
 {
 public:
@@ -330,11 +381,18 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action) {
         int nVersion = s.GetVersion();
         if (!(s.GetType() & SER_GETHASH)) {
+            if (!ser_action.ForRead()) {
+                nVersion |= SAPLING_NOTE_DATA_COMPACT_WITNESSES;
+            }
             READWRITE(nVersion);
         }
         READWRITE(ivk);
         READWRITE(nullifier);
-        READWRITE(witnesses);
+        if (nVersion & SAPLING_NOTE_DATA_COMPACT_WITNESSES) {
+            READWRITE(REF(libzcash::CompactWitnessList<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash>(witnesses)));
+        } else {
+            READWRITE(witnesses);
+        }
         READWRITE(witnessHeight);
     }
 
@@ -350,6 +408,32 @@ public:
 typedef std::map<JSOutPoint, SproutNoteData> mapSproutNoteData_t;
 typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
 
+/** A shielded note of the wallet was received, confirmed or spent. */
+struct CWalletNoteEvent
+{
+    enum Type { RECEIVED, CONFIRMED, SPENT };
+
+    Type type;
+    bool fSapling;
+    //! The note: output nOutput of the transaction, or of its joinsplit nJoinSplit for Sprout
+    uint256 txid;
+    int nJoinSplit;
+    int nOutput;
+    std::string strAddress;
+    //! -1 if the note could not be decrypted
+    CAmount nValue;
+    //! The transaction spending the note, for SPENT
+    uint256 spendTxid;
+    //! Block of the transaction the event is about, null while it is unconfirmed
+    uint256 hashBlock;
+
+    CWalletNoteEvent() : type(RECEIVED), fSapling(false), nJoinSplit(-1), nOutput(-1), nValue(-1) {}
+
+    static const char* TypeName(Type type);
+    /** The event as a JSON object, as published by -zmqpubwalletnote */
+    std::string ToJSON() const;
+};
+
 /** Sprout note, its location in a transaction, and number of confirmations. */
 struct SproutNoteEntry
 {
@@ -360,6 +444,35 @@ struct SproutNoteEntry
     int confirmations;
 };
 
+/**
+ * Position of a wallet transaction in the chain, used to page through the
+ * wallet in block order. Unconfirmed transactions sort after every block.
+ */
+struct CWalletTxPosition
+{
+    int nHeight;
+    int nIndex;
+    uint256 hash;
+
+    CWalletTxPosition() : nHeight(0), nIndex(0) {}
+    CWalletTxPosition(int nHeightIn, int nIndexIn, const uint256& hashIn) :
+        nHeight(nHeightIn), nIndex(nIndexIn), hash(hashIn) {}
+
+    friend bool operator<(const CWalletTxPosition& a, const CWalletTxPosition& b)
+    {
+        return std::tie(a.nHeight, a.nIndex, a.hash) < std::tie(b.nHeight, b.nIndex, b.hash);
+    }
+
+    friend bool operator==(const CWalletTxPosition& a, const CWalletTxPosition& b)
+    {
+        return a.nHeight == b.nHeight && a.nIndex == b.nIndex && a.hash == b.hash;
+    }
+
+    //! Opaque pagination token: hex of height, index and txid
+    std::string ToCursor() const;
+    static bool FromCursor(const std::string& strCursor, CWalletTxPosition& pos);
+};
+
 /** Sapling note, its location in a transaction, and number of confirmations. */
 struct SaplingNoteEntry
 {
@@ -370,6 +483,253 @@ struct SaplingNoteEntry
     int confirmations;
 };
 
+/**
+ * Decrypted Sapling notes held by the wallet, indexed by outpoint and, for
+ * each address, ordered by value. A note is decrypted once when it is added,
+ * so listing and selecting notes does not decrypt them again. Spent, depth
+ * and lock state change over time and are checked by the caller.
+ */
+class CSaplingNoteIndex
+{
+public:
+    struct Entry
+    {
+        libzcash::SaplingPaymentAddress address;
+        libzcash::SaplingNote note;
+        std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    };
+
+    typedef std::set<std::pair<CAmount, SaplingOutPoint>> ValueSet;
+
+private:
+    std::map<SaplingOutPoint, Entry> mapNotes;
+    std::map<libzcash::SaplingPaymentAddress, ValueSet> mapByAddress;
+
+public:
+    const Entry* Find(const SaplingOutPoint& op) const;
+    void Add(const SaplingOutPoint& op, const Entry& entry);
+    //! Drop every note of the given transaction
+    void EraseTx(const uint256& hash);
+    void Clear();
+
+    //! The address's notes in ascending order of value, or NULL if it has none
+    const ValueSet* GetNotesByValue(const libzcash::SaplingPaymentAddress& address) const;
+
+    size_t Size() const { return mapNotes.size(); }
+    size_t DynamicMemoryUsage() const;
+};
+
+/**
+ * Transparent outputs of mapWallet that are ours, indexed by outpoint and by
+ * address, so that AvailableCoins visits them instead of every output the
+ * wallet has seen. An output stays until it is found spent deeper than
+ * MAX_REORG_LENGTH; depth, spent and lock state are checked by the caller.
+ */
+class CUnspentOutputIndex
+{
+public:
+    typedef std::map<COutPoint, CTxDestination> OutputMap;
+
+private:
+    OutputMap mapOutputs;
+    std::map<CTxDestination, std::set<COutPoint>> mapByAddress;
+
+public:
+    //! dest is CNoDestination for scripts without an address
+    void Add(const COutPoint& out, const CTxDestination& dest);
+    void Erase(const COutPoint& out);
+    //! Drop every output of the given transaction
+    void EraseTx(const uint256& hash);
+    void Clear();
+
+    const OutputMap& GetOutputs() const { return mapOutputs; }
+    //! The address's outputs, or NULL if it has none
+    const std::set<COutPoint>* GetOutputsByAddress(const CTxDestination& dest) const;
+
+    size_t Size() const { return mapOutputs.size(); }
+    size_t DynamicMemoryUsage() const;
+};
+
+/**
+ * The transactions of mapWallet each encoded address appears in: the
+ * addresses of every transparent output, of the wallet's notes and of the
+ * Sapling outputs the wallet's outgoing viewing keys decrypt. Lets the
+ * zs_list*byaddress calls decrypt a handful of transactions rather than all
+ * of them; what they report is still worked out from the transactions.
+ */
+class CAddressTxIndex
+{
+private:
+    std::map<std::string, std::set<uint256>> mapTxsByAddress;
+    std::map<uint256, std::set<std::string>> mapAddressesByTx;
+
+public:
+    void Add(const std::string& strAddress, const uint256& hash);
+    //! Drop the given transaction from every address
+    void EraseTx(const uint256& hash);
+    void Clear();
+
+    //! The transactions strAddress appears in, or NULL if there are none
+    const std::set<uint256>* GetTxs(const std::string& strAddress) const;
+
+    size_t Size() const { return mapAddressesByTx.size(); }
+    size_t DynamicMemoryUsage() const;
+};
+
+/** Default for the number of branch and bound tries in SelectSaplingNotes */
+static const size_t DEFAULT_SAPLING_NOTE_SELECTION_TRIES = 100000;
+
+/**
+ * Choose notes from vCandidates, which must be sorted by descending value,
+ * that add up to at least nTarget, returning their indices. In order of
+ * preference: the smallest single note covering nTarget; a subset summing to
+ * exactly nTarget, so no change output is needed, found by a bounded branch
+ * and bound search that uses no more notes than the next option; the largest
+ * notes until nTarget is reached. Returns false if the candidates do not
+ * cover nTarget.
+ */
+bool SelectSaplingNotes(const std::vector<SaplingNoteEntry>& vCandidates, CAmount nTarget,
+                        std::vector<size_t>& vSelected, size_t nMaxTries = DEFAULT_SAPLING_NOTE_SELECTION_TRIES);
+
+/** Default for the number of branch and bound tries in SelectCoinsMinConf */
+static const size_t DEFAULT_COIN_SELECTION_TRIES = 100000;
+
+/**
+ * Find a subset of vValues, which must be sorted by descending value, adding
+ * up to exactly nTarget, so that no change output is needed. The depth first
+ * search takes at most nMaxTries steps. Returns false if no subset was found
+ * within them.
+ */
+bool SelectCoinsExactMatch(const std::vector<CAmount>& vValues, CAmount nTarget,
+                           std::vector<size_t>& vSelected, size_t nMaxTries = DEFAULT_COIN_SELECTION_TRIES);
+
+/**
+ * Running totals of the value held by one address, bucketed by depth so that
+ * the balance at any confirmation threshold is a binary search.
+ */
+class CBalanceAggregate
+{
+private:
+    //! Distinct depths in ascending order
+    std::vector<int> vDepths;
+    //! Value at vDepths[i] or deeper, in total and spendable only
+    std::vector<CAmount> vTotal;
+    std::vector<CAmount> vSpendable;
+
+public:
+    /** Record an output or note; Finalize() must be called before Get(). */
+    void Add(int nDepth, CAmount nValue, bool fSpendable);
+    void Finalize();
+
+    CAmount Get(int minDepth, bool ignoreUnspendable) const;
+};
+
+/**
+ * Per-address balances of the wallet's unspent outputs and notes, taken while
+ * cs_main and cs_wallet were held. Read-only balance RPCs answer from the
+ * latest snapshot without taking either lock. Depths are as of nHeight.
+ */
+class CWalletBalanceSnapshot
+{
+public:
+    int nHeight;
+    CBalanceAggregate transparentTotal;
+    CBalanceAggregate shieldedTotal;
+    std::map<CTxDestination, CBalanceAggregate> mapTransparent;
+    std::map<libzcash::PaymentAddress, CBalanceAggregate> mapShielded;
+
+    CWalletBalanceSnapshot() : nHeight(-1) {}
+
+    void Finalize();
+
+    /** Same result as getBalanceTaddr() (an empty set means every address) */
+    CAmount GetTransparentBalance(const std::set<CTxDestination>& destinations, int minDepth, bool ignoreUnspendable) const;
+
+    /** Same result as getBalanceZaddr() (an empty set means every address); locked notes are skipped */
+    CAmount GetShieldedBalance(const std::set<libzcash::PaymentAddress>& addresses, int minDepth, bool ignoreUnspendable) const;
+};
+
+/**
+ * Open addressing hash table caching the spend depth of shielded nullifiers:
+ * the depth of the first non-conflicted wallet transaction spending each one,
+ * or -1 if none does. Nullifiers are already uniformly random, so their low
+ * bytes are used as the hash directly. Entries are only valid for the tip
+ * they were computed at and until the wallet's transactions change.
+ */
+class CNullifierSpendCache
+{
+private:
+    struct Entry {
+        uint256 nullifier;
+        int nDepth;
+        bool fUsed;
+
+        Entry() : nDepth(-1), fUsed(false) {}
+    };
+
+    std::vector<Entry> vEntries;
+    size_t nUsed;
+    const CBlockIndex* pindexTip;
+
+    size_t Slot(const uint256& nullifier) const;
+
+public:
+    CNullifierSpendCache() : nUsed(0), pindexTip(NULL) {}
+
+    /** Return true and set nDepth if the nullifier is cached for this tip */
+    bool Lookup(const uint256& nullifier, const CBlockIndex* pindex, int& nDepth) const;
+    void Insert(const uint256& nullifier, const CBlockIndex* pindex, int nDepth);
+    void Clear();
+    size_t DynamicMemoryUsage() const;
+};
+
+/** The estimated heap usage of a wallet, by what holds it */
+struct CWalletMemoryUsage
+{
+    size_t nTransactions = 0; //!< mapWallet, with the transactions and their note data
+    size_t nWitnesses = 0;    //!< the cached witnesses of the notes
+    size_t nIndexes = 0;      //!< spends, nullifiers, positions, the Sapling note index and the spend caches
+
+    size_t Total() const { return nTransactions + nWitnesses + nIndexes; }
+};
+
+/**
+ * A block read ahead of the wallet during a rescan, with the trial decryption
+ * results of its transactions. Blocks that have been pruned are read from the
+ * compact block store instead, which is only enough to tell whether they
+ * hold Sapling notes for the wallet.
+ */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    CBlock block;
+    bool fRead;
+    bool fPruned;
+    CCompactBlock compact;
+    //! Transactions of a pruned block with a compact output that decrypts with one of our keys
+    std::set<uint256> setCompactMatches;
+    //! Notes found in each transaction, in the same order as block.vtx
+    std::vector<mapSproutNoteData_t> vSproutNoteData;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vSaplingNoteData;
+
+    CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), pos(pindexIn->GetBlockPos()), fRead(false),
+        fPruned(!(pindexIn->nStatus & BLOCK_HAVE_DATA)) { }
+
+    /** Point the entry at another block, keeping block's storage to read it into */
+    void Reset(CBlockIndex* pindexIn)
+    {
+        pindex = pindexIn;
+        pos = pindexIn->GetBlockPos();
+        fRead = false;
+        fPruned = !(pindexIn->nStatus & BLOCK_HAVE_DATA);
+        compact = CCompactBlock();
+        setCompactMatches.clear();
+        vSproutNoteData.clear();
+        vSaplingNoteData.clear();
+    }
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -383,6 +743,12 @@ public:
 
     // memory only
     mutable bool fMerkleVerified;
+    //! The block index entry of hashBlockIndexed as of nBlockIndexGeneration
+    //! nGenerationIndexed, so that the depth is found without looking
+    //! hashBlock up in mapBlockIndex again
+    mutable const CBlockIndex* pindexBlock;
+    mutable uint256 hashBlockIndexed;
+    mutable uint64_t nGenerationIndexed;
 
 
     CMerkleTx()
@@ -400,6 +766,7 @@ public:
         hashBlock = uint256();
         nIndex = -1;
         fMerkleVerified = false;
+        pindexBlock = NULL;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -855,12 +1222,22 @@ private:
     TxNullifiers mapTxSproutNullifiers;
     TxNullifiers mapTxSaplingNullifiers;
 
+    /* Spend depths looked up from the maps above (protected by cs_nullifierSpendCache) */
+    mutable CCriticalSection cs_nullifierSpendCache;
+    mutable CNullifierSpendCache sproutSpendCache;
+    mutable CNullifierSpendCache saplingSpendCache;
+
+    int GetNullifierSpendDepth(const TxNullifiers& mapNullifiers, CNullifierSpendCache& cache, const uint256& nullifier) const;
+    void ClearNullifierSpendCaches();
+
     std::vector<CTransaction> pendingSaplingMigrationTxs;
     AsyncRPCOperationId saplingMigrationOperationId;
 
     std::vector<CTransaction> pendingSaplingConsolidationTxs;
     AsyncRPCOperationId saplingConsolidationOperationId;
 
+    AsyncRPCOperationId saplingNotePoolOperationId;
+
     void AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSproutSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
@@ -904,49 +1281,63 @@ protected:
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
 
     template <typename WalletDB>
-    void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
+    bool SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
         if (!walletdb.TxnBegin()) {
             // This needs to be done atomically, so don't do it at all
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
-            return;
+            return false;
         }
+        // Hashes of the transactions written in this attempt, only recorded
+        // once the whole batch has been committed
+        std::vector<std::pair<uint256, uint256>> vWritten;
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
+            for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+                const CWalletTx& wtx = wtxItem.second;
                 // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
                 // are empty. This covers transactions that have no Sprout or Sapling data
                 // (i.e. are purely transparent), as well as shielding and unshielding
                 // transactions in which we only have transparent addresses involved.
                 if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
+                    // Skip transactions whose witnesses and note data have not
+                    // changed since they were last written here
+                    uint256 hashData = SerializeHash(wtx, SER_DISK, CLIENT_VERSION);
+                    auto it = mapTxWrittenHash.find(wtxItem.first);
+                    if (it != mapTxWrittenHash.end() && it->second == hashData)
+                        continue;
                     if (!walletdb.WriteTx(wtxItem.first, wtx)) {
                         LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
                         walletdb.TxnAbort();
-                        return;
+                        return false;
                     }
+                    vWritten.push_back(std::make_pair(wtxItem.first, hashData));
                 }
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
                 LogPrintf("SetBestChain(): Failed to write nWitnessCacheSize, aborting atomic write\n");
                 walletdb.TxnAbort();
-                return;
+                return false;
             }
             if (!walletdb.WriteBestBlock(loc)) {
                 LogPrintf("SetBestChain(): Failed to write best block, aborting atomic write\n");
                 walletdb.TxnAbort();
-                return;
+                return false;
             }
         } catch (const std::exception &exc) {
             // Unexpected failure
             LogPrintf("SetBestChain(): Unexpected error during atomic write:\n");
             LogPrintf("%s\n", exc.what());
             walletdb.TxnAbort();
-            return;
+            return false;
         }
         if (!walletdb.TxnCommit()) {
             // Couldn't commit all to db, but in-memory state is fine
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
-            return;
+            return false;
+        }
+        for (const std::pair<uint256, uint256>& written : vWritten) {
+            mapTxWrittenHash[written.first] = written.second;
         }
+        return true;
     }
 
 private:
@@ -957,9 +1348,35 @@ protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
     void MarkAffectedTransactionsDirty(const CTransaction& tx);
 
+    /**
+     * The note events of an added or updated transaction: its notes not in
+     * the known sets were received, the others were confirmed if it got a
+     * new block, and the notes of the wallet it spends were spent when it is
+     * new or newly confirmed.
+     */
+    std::vector<CWalletNoteEvent> GetNoteEvents(const CWalletTx& wtx, bool fInsertedNew, const uint256& hashBlockKnown,
+                                                const std::set<JSOutPoint>& setSproutKnown,
+                                                const std::set<SaplingOutPoint>& setSaplingKnown);
+    void DescribeNote(const CWalletTx& wtx, const JSOutPoint& jsop, const SproutNoteData& nd, CWalletNoteEvent& event);
+    void DescribeNote(const CWalletTx& wtx, const SaplingOutPoint& op, CWalletNoteEvent& event);
+
     /* the hd chain data model (chain counters) */
     CHDChain hdChain;
 
+    /* Sapling account keys derived ahead, from the account index of hdChain
+       on, and not yet in the keystore (protected by cs_wallet) */
+    std::deque<std::pair<uint32_t, libzcash::SaplingExtendedSpendingKey> > saplingKeyPool;
+    uint256 saplingKeyPoolSeedFp;
+
+    /* Latest balance snapshot, NULL while stale (protected by cs_balanceSnapshot) */
+    mutable CCriticalSection cs_balanceSnapshot;
+    std::shared_ptr<const CWalletBalanceSnapshot> balanceSnapshot;
+
+    /* Background transaction deletion state (protected by cs_wallet) */
+    bool fDeleteTxRequested;
+    std::deque<uint256> vPendingDeleteTxs;
+    uint64_t nDeletedTxCount;
+
 public:
     /*
      * Main wallet lock.
@@ -1014,6 +1431,12 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fDeleteTxRequested = false;
+        nDeletedTxCount = 0;
+        fDeferTxWrites = false;
+        fSaplingNoteIndexComplete = true;
+        fUnspentOutputIndexComplete = true;
+        fAddressTxIndexComplete = false;
     }
 
     /**
@@ -1070,6 +1493,81 @@ public:
 
     std::map<uint256, CWalletTx> mapWallet;
 
+    /** Estimated heap usage of mapWallet and the indexes built over it */
+    CWalletMemoryUsage GetMemoryUsage() const;
+
+    /**
+     * mapWallet ordered by block height and position in the block, kept up
+     * to date as transactions are added, confirmed and erased. (cs_wallet)
+     */
+    std::set<CWalletTxPosition> setWalletTxByHeight;
+    std::map<uint256, CWalletTxPosition> mapWalletTxPosition;
+    void UpdateWalletTxPosition(const CWalletTx& wtx);
+    void EraseWalletTxPosition(const uint256& hash);
+
+    /**
+     * Serialized hash of each shielded transaction as of its last committed
+     * write in SetBestChain, so unchanged transactions are not rewritten on
+     * every flush. Dropped whenever the transaction is written elsewhere.
+     * (cs_wallet)
+     */
+    std::map<uint256, uint256> mapTxWrittenHash;
+
+    /**
+     * While a block is being connected, AddToWallet queues its writes in
+     * setDeferredTxWrites instead of issuing one BDB write per transaction.
+     * FlushDeferredTxWrites then writes them in a single BDB transaction.
+     * (cs_wallet)
+     */
+    bool fDeferTxWrites;
+    std::set<uint256> setDeferredTxWrites;
+    bool FlushDeferredTxWrites();
+
+    /**
+     * Decrypted Sapling notes of mapWallet. Kept current by AddToWallet once
+     * fSaplingNoteIndexComplete is set; transactions loaded from disk are
+     * indexed by the first call to EnsureSaplingNoteIndex(). (cs_wallet)
+     */
+    CSaplingNoteIndex saplingNoteIndex;
+    bool fSaplingNoteIndexComplete;
+    void IndexSaplingNotes(const CWalletTx& wtx);
+    void EnsureSaplingNoteIndex();
+    const CSaplingNoteIndex::Entry* GetIndexedSaplingNote(const CWalletTx& wtx, const SaplingOutPoint& op);
+
+    /**
+     * Our transparent outputs in mapWallet. Kept current by AddToWallet once
+     * fUnspentOutputIndexComplete is set; transactions loaded from disk, and
+     * the outputs of keys and scripts added later, are indexed by the next
+     * call to EnsureUnspentOutputIndex(). (cs_wallet)
+     */
+    mutable CUnspentOutputIndex unspentOutputIndex;
+    mutable bool fUnspentOutputIndexComplete;
+    void IndexUnspentOutputs(const CWalletTx& wtx) const;
+    void EnsureUnspentOutputIndex() const;
+
+    /**
+     * mapWallet by address. Kept current by AddToWallet once
+     * fAddressTxIndexComplete is set; transactions loaded from disk, and the
+     * sends of Sapling keys imported later, are indexed by the next call to
+     * EnsureAddressTxIndex(). Shielding transactions indexed while the wallet
+     * was locked, when the HD seed's outgoing viewing key is unavailable, are
+     * kept in setAddressTxsLocked and indexed again once it is unlocked.
+     * (cs_wallet)
+     */
+    CAddressTxIndex addressTxIndex;
+    bool fAddressTxIndexComplete;
+    std::set<uint256> setAddressTxsLocked;
+    void GetIndexOutgoingViewingKeys(std::vector<uint256>& vSeedOvks, std::vector<uint256>& vKeyOvks);
+    void IndexAddressTxs(const CWalletTx& wtx);
+    void IndexAddressTxs(const CWalletTx& wtx, const std::vector<uint256>& vSeedOvks, const std::vector<uint256>& vKeyOvks);
+    void EnsureAddressTxIndex();
+    /**
+     * The wallet transactions that may pay strAddress and, with fSpends, those
+     * that may spend what it received: a superset of the transactions the
+     * zs_list*byaddress calls report for it.
+     */
+    void GetAddressTxs(const std::string& strAddress, bool fSpends, std::set<uint256>& setTxs);
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -1088,8 +1586,10 @@ public:
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
-    void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false) const;
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    //! pDestinations, if given, limits the coins to those sent to these addresses
+    void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false,
+                        const std::set<CTxDestination>* pDestinations = NULL) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
     unsigned int GetSpendDepth(const uint256& hash, unsigned int n) const;
@@ -1128,6 +1628,8 @@ public:
     CPubKey GenerateNewKey();
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    //! Adds a key to the store, and saves it to disk through walletdb
+    bool AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
     bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
     //! Load metadata (used by LoadWallet)
@@ -1158,6 +1660,8 @@ public:
     bool LoadWatchOnly(const CScript &dest);
 
     bool Unlock(const SecureString& strWalletPassphrase);
+    //! Locks the wallet, dropping the Sapling keys derived ahead
+    bool Lock();
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
     bool EncryptWallet(const SecureString& strWalletPassphrase);
 
@@ -1193,10 +1697,20 @@ public:
       */
     //! Generates new Sapling key
     libzcash::SaplingPaymentAddress GenerateNewSaplingZKey(bool resetCounter = false);
-    //! Adds Sapling spending key to the store, and saves it to disk
+    //! Generates nCount new Sapling keys, taken from the key pool first, and saves them in one database transaction
+    std::vector<libzcash::SaplingPaymentAddress> GenerateNewSaplingZKeys(unsigned int nCount, bool resetCounter = false);
+    //! Derives Sapling keys ahead, in parallel and mostly outside cs_wallet, until kpSize (default -saplingkeypool) are pooled
+    bool TopUpSaplingKeyPool(unsigned int kpSize = 0);
+    unsigned int GetSaplingKeyPoolSize()
+    {
+        AssertLockHeld(cs_wallet); // saplingKeyPool
+        return saplingKeyPool.size();
+    }
+    //! Adds Sapling spending key to the store, and saves it to disk (through pwalletdb if given)
     bool AddSaplingZKey(
         const libzcash::SaplingExtendedSpendingKey &key,
-        const libzcash::SaplingPaymentAddress &defaultAddr);
+        const libzcash::SaplingPaymentAddress &defaultAddr,
+        CWalletDB* pwalletdb = NULL);
     bool AddSaplingIncomingViewingKey(
         const libzcash::SaplingIncomingViewingKey &ivk,
         const libzcash::SaplingPaymentAddress &addr);
@@ -1247,6 +1761,14 @@ public:
     TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
 
     void MarkDirty();
+    /**
+     * Reset the cached amounts of only the transactions whose outputs may
+     * have become ours because keys or watched scripts for setScripts were
+     * added, and of the transactions spending those outputs. The cached
+     * amounts only count transparent outputs, so adding shielded keys does
+     * not call for either.
+     */
+    void MarkDirty(const std::set<CScript>& setScripts);
     bool UpdateNullifierNoteMap();
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
     void UpdateSproutNullifierNoteMapWithTx(CWalletTx& wtx);
@@ -1255,6 +1777,9 @@ public:
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                  const mapSproutNoteData_t& sproutNoteData,
+                                  const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
@@ -1263,8 +1788,24 @@ public:
     void ReorderWalletTransactions(std::map<std::pair<int,int>, CWalletTx*> &mapSorted, int64_t &maxOrderPos);
     void UpdateWalletTransactionOrder(std::map<std::pair<int,int>, CWalletTx*> &mapSorted, bool resetOrder);
     void DeleteTransactions(std::vector<uint256> &removeTxs);
+    bool SelectWalletTransactionsToDelete(std::vector<uint256>& removeTxs);
     void DeleteWalletTransactions(const CBlockIndex* pindex);
+    /** Ask the scheduler to prune -keeptxnum/-keeptxfornblocks old transactions in the background */
+    void RequestWalletTransactionDeletion();
+    /** Erase the next chunk of transactions queued for deletion; called from the scheduler */
+    void RunPendingTransactionDeletion();
+    void GetTransactionDeletionProgress(size_t& nPending, uint64_t& nDeleted, bool& fRequested) const;
+    void GetRescanBatch(CBlockIndex* pindex, std::vector<CRescanBlock>& vBatch) const;
+    void PrefetchRescanBatch(std::vector<CRescanBlock>& vBatch,
+                             const NoteDecryptorMap& decryptors,
+                             const SaplingFullViewingKeyMap& fvks) const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    /**
+     * Write the transactions and witnesses as of pindex, the last block a
+     * rescan has fully processed, and record it as where that rescan resumes
+     * if it is interrupted. (cs_main, cs_wallet)
+     */
+    bool CheckpointRescan(const CBlockIndex* pindex);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -1318,7 +1859,16 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
+    mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx, const SaplingFullViewingKeyMap& fvks) const;
+    std::vector<mapSproutNoteData_t> FindMySproutNotes(const std::vector<const CTransaction*>& vtx,
+                                                       const NoteDecryptorMap& decryptors,
+                                                       int nThreads) const;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(
+        const std::vector<const CTransaction*>& vtx,
+        const SaplingFullViewingKeyMap& fvks,
+        int nThreads) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -1340,6 +1890,8 @@ public:
     bool IsMine(const CTransaction& tx) const;
     /** should probably be renamed to IsRelevantToMe */
     bool IsFromMe(const CTransaction& tx) const;
+    /** Whether tx spends one of the wallet's shielded notes, without looking at transparent inputs */
+    bool IsShieldedFromMe(const CTransaction& tx) const;
     CAmount GetDebit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetCredit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetChange(const CTransaction& tx) const;
@@ -1347,17 +1899,28 @@ public:
     void RunSaplingMigration(int blockHeight);
     void AddPendingSaplingMigrationTx(const CTransaction& tx);
     void RunSaplingConsolidation(int blockHeight);
+    void RunSaplingNotePool(int blockHeight);
     void CommitConsolidationTx(const CTransaction& tx);
     /** Saves witness caches and best block locator to disk. */
     void SetBestChain(const CBlockLocator& loc);
     std::set<std::pair<libzcash::PaymentAddress, uint256>> GetNullifiersForAddresses(const std::set<libzcash::PaymentAddress> & addresses);
+
+    /**
+     * Rebuild the balance snapshot from the current wallet state. Must not be
+     * called with cs_wallet held unless cs_main is held too.
+     */
+    void UpdateBalanceSnapshot();
+    /** Drop the balance snapshot, so readers fall back to the locked path until the next update */
+    void InvalidateBalanceSnapshot();
+    /** The latest balance snapshot, or NULL if the wallet changed since it was taken */
+    std::shared_ptr<const CWalletBalanceSnapshot> GetBalanceSnapshot() const;
     bool IsNoteSproutChange(const std::set<std::pair<libzcash::PaymentAddress, uint256>> & nullifierSet, const libzcash::PaymentAddress & address, const JSOutPoint & entry);
     bool IsNoteSaplingChange(const std::set<std::pair<libzcash::PaymentAddress, uint256>> & nullifierSet, const libzcash::PaymentAddress & address, const SaplingOutPoint & entry);
 
     DBErrors LoadWallet(bool& fFirstRunRet);
     DBErrors ZapWalletTx(std::vector<CWalletTx>& vWtx);
 
-    bool SetAddressBook(const CTxDestination& address, const std::string& strName, const std::string& purpose);
+    bool SetAddressBook(const CTxDestination& address, const std::string& strName, const std::string& purpose, CWalletDB* pwalletdb = NULL);
 
     bool DelAddressBook(const CTxDestination& address);
 
@@ -1422,6 +1985,13 @@ public:
     boost::signals2::signal<void (CWallet *wallet, const uint256 &hashTx,
             ChangeType status)> NotifyTransactionChanged;
 
+    /**
+     * Shielded note received, confirmed or spent; only worked out while
+     * something is connected.
+     * @note called with lock cs_wallet held.
+     */
+    boost::signals2::signal<void (CWallet *wallet, const CWalletNoteEvent &event)> NotifyNoteChanged;
+
     /** Show progress e.g. for rescan */
     boost::signals2::signal<void (const std::string &title, int nProgress)> ShowProgress;
 
@@ -1588,17 +2158,19 @@ private:
     boost::optional<std::string> hdKeypath; // currently sapling only
     boost::optional<std::string> seedFpStr; // currently sapling only
     bool log;
+    CWalletDB *pwalletdb; // currently sapling only
 public:
     AddSpendingKeyToWallet(CWallet *wallet, const Consensus::Params &params) :
-        m_wallet(wallet), params(params), nTime(1), hdKeypath(boost::none), seedFpStr(boost::none), log(false) {}
+        m_wallet(wallet), params(params), nTime(1), hdKeypath(boost::none), seedFpStr(boost::none), log(false), pwalletdb(NULL) {}
     AddSpendingKeyToWallet(
         CWallet *wallet,
         const Consensus::Params &params,
         int64_t _nTime,
         boost::optional<std::string> _hdKeypath,
         boost::optional<std::string> _seedFp,
-        bool _log
-    ) : m_wallet(wallet), params(params), nTime(_nTime), hdKeypath(_hdKeypath), seedFpStr(_seedFp), log(_log) {}
+        bool _log,
+        CWalletDB *_pwalletdb = NULL
+    ) : m_wallet(wallet), params(params), nTime(_nTime), hdKeypath(_hdKeypath), seedFpStr(_seedFp), log(_log), pwalletdb(_pwalletdb) {}
 
 
     SpendingKeyAddResult operator()(const libzcash::SproutSpendingKey &sk) const;
@@ -11,6 +11,7 @@
 #include "protocol.h"
 #include "serialize.h"
 #include "sync.h"
+#include "taskpool.h"
 #include "util.h"
 #include "utiltime.h"
 #include "wallet/wallet.h"
@@ -21,6 +22,8 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <atomic>
+
 using namespace std;
 
 static uint64_t nAccountingEntryNumber = 0;
@@ -61,6 +64,21 @@ bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
     return Write(std::make_pair(std::string("tx"), hash), wtx);
 }
 
+bool CWalletDB::WriteTxBatch(const std::vector<std::pair<uint256, const CWalletTx*>>& vtx)
+{
+    if (vtx.empty())
+        return true;
+    if (!TxnBegin())
+        return false;
+    for (const std::pair<uint256, const CWalletTx*>& item : vtx) {
+        if (!WriteTx(item.first, *item.second)) {
+            TxnAbort();
+            return false;
+        }
+    }
+    return TxnCommit();
+}
+
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdated++;
@@ -225,6 +243,23 @@ bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
     return Read(std::string("bestblock"), locator);
 }
 
+bool CWalletDB::WriteRescanProgress(const CBlockLocator& locator)
+{
+    nWalletDBUpdated++;
+    return Write(std::string("rescanprogress"), locator);
+}
+
+bool CWalletDB::ReadRescanProgress(CBlockLocator& locator)
+{
+    return Read(std::string("rescanprogress"), locator);
+}
+
+bool CWalletDB::EraseRescanProgress()
+{
+    nWalletDBUpdated++;
+    return Erase(std::string("rescanprogress"));
+}
+
 bool CWalletDB::WriteOrderPosNext(int64_t nOrderPosNext)
 {
     nWalletDBUpdated++;
@@ -439,6 +474,55 @@ public:
     }
 };
 
+/**
+ * Decode and check a "tx" record whose type has already been read from ssKey.
+ * This touches no wallet state, so records can be decoded in parallel.
+ */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash,
+                         CWalletTx& wtx, bool& fUpgraded, string& strErr)
+{
+    fUpgraded = false;
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void AddLoadedWalletTx(CWallet* pwallet, CWalletScanState& wss, const uint256& hash,
+                              const CWalletTx& wtx, bool fUpgraded)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -463,38 +547,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = libzcash::ProofVerifier::Strict();
-            if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            AddLoadedWalletTx(pwallet, wss, hash, wtx, fUpgraded);
         }
         else if (strType == "acentry")
         {
@@ -867,6 +924,59 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+/** A "tx" record read from the cursor, decoded off the loading thread. */
+struct CWalletTxRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fOK;
+    bool fUpgraded;
+    string strErr;
+
+    CWalletTxRecord(const CDataStream& ssKeyIn, const CDataStream& ssValueIn) :
+        ssKey(ssKeyIn), ssValue(ssValueIn), fOK(false), fUpgraded(false) {}
+};
+
+//! Number of "tx" records decoded together while loading a wallet
+static const size_t WALLET_LOAD_BATCH_SIZE = 4096;
+
+/**
+ * Decode a batch of "tx" records on up to nThreads threads, then add them to
+ * the wallet in cursor order. Returns false if any record was bad.
+ */
+static bool LoadWalletTxBatch(CWallet* pwallet, CWalletScanState& wss,
+                              std::vector<CWalletTxRecord>& vRecords, int nThreads)
+{
+    std::atomic<size_t> nNext(0);
+    auto worker = [&vRecords, &nNext]() {
+        for (size_t i = nNext++; i < vRecords.size(); i = nNext++) {
+            CWalletTxRecord& record = vRecords[i];
+            try {
+                record.fOK = ReadWalletTx(record.ssKey, record.ssValue, record.hash, record.wtx, record.fUpgraded, record.strErr);
+            } catch (...) {
+                record.fOK = false;
+            }
+        }
+    };
+
+    nThreads = std::max(1, std::min(nThreads, (int)vRecords.size()));
+    GetTaskPool().ParallelFor(TASKPOOL_WALLET, nThreads, nThreads, [&worker](size_t) { worker(); });
+
+    bool fAllOK = true;
+    for (CWalletTxRecord& record : vRecords) {
+        if (record.fOK)
+            AddLoadedWalletTx(pwallet, wss, record.hash, record.wtx, record.fUpgraded);
+        else
+            fAllOK = false;
+        if (!record.strErr.empty())
+            LogPrintf("%s\n", record.strErr);
+    }
+    vRecords.clear();
+    return fAllOK;
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -892,6 +1002,13 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Transaction records are the bulk of a large wallet. They are
+        // decoded in batches on several threads while the remaining records
+        // are read inline; transactions only depend on each other's order,
+        // which the batches keep.
+        std::vector<CWalletTxRecord> vTxRecords;
+        vTxRecords.reserve(WALLET_LOAD_BATCH_SIZE);
+
         while (true)
         {
             // Read next record
@@ -906,8 +1023,27 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
-            // Try to be tolerant of single corrupt records:
             string strType, strErr;
+            if (nWalletLoadThreads > 1) {
+                CDataStream ssType(ssKey);
+                try {
+                    ssType >> strType;
+                } catch (...) {
+                    strType.clear();
+                }
+                if (strType == "tx") {
+                    vTxRecords.emplace_back(ssType, ssValue);
+                    if (vTxRecords.size() >= WALLET_LOAD_BATCH_SIZE &&
+                        !LoadWalletTxBatch(pwallet, wss, vTxRecords, nWalletLoadThreads)) {
+                        // Rescan if there is a bad transaction record:
+                        fNoncriticalErrors = true;
+                        SoftSetBoolArg("-rescan", true);
+                    }
+                    continue;
+                }
+            }
+
+            // Try to be tolerant of single corrupt records:
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
             {
                 // losing keys is considered a catastrophic error, anything else
@@ -927,6 +1063,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        if (!vTxRecords.empty() && !LoadWalletTxBatch(pwallet, wss, vTxRecords, nWalletLoadThreads)) {
+            fNoncriticalErrors = true;
+            SoftSetBoolArg("-rescan", true);
+        }
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -132,6 +132,8 @@ public:
     bool ErasePurpose(const std::string& strAddress);
 
     bool WriteTx(uint256 hash, const CWalletTx& wtx);
+    //! Write several transactions in one database transaction
+    bool WriteTxBatch(const std::vector<std::pair<uint256, const CWalletTx*>>& vtx);
     bool EraseTx(uint256 hash);
 
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
@@ -146,6 +148,11 @@ public:
     bool WriteBestBlock(const CBlockLocator& locator);
     bool ReadBestBlock(CBlockLocator& locator);
 
+    //! The last block an unfinished rescan processed, see CWallet::CheckpointRescan
+    bool WriteRescanProgress(const CBlockLocator& locator);
+    bool ReadRescanProgress(CBlockLocator& locator);
+    bool EraseRescanProgress();
+
     bool WriteOrderPosNext(int64_t nOrderPosNext);
 
     bool WriteDefaultKey(const CPubKey& vchPubKey);
@@ -9,6 +9,7 @@
 #include "witness.h"
 #include "utilmoneystr.h"
 #include "coins.h"
+#include "compactblocks.h"
 
 using namespace std;
 using namespace libzcash;
@@ -70,7 +71,7 @@ UniValue getsaplingwitness(const UniValue& params, bool fHelp) {
 
   //Get the sapling tree as of the previous block
   SaplingMerkleTree saplingTree;
-  pcoinsTip->GetSaplingAnchorAt(pblockindex->pprev->hashFinalSaplingRoot, saplingTree);
+  GetSaplingTreeAt(pblockindex->pprev, saplingTree);
 
   //Cycle through block and transactions build sapling tree until the commitment needed is reached
   CBlock pblock;
@@ -158,7 +159,7 @@ UniValue getsaplingwitnessatheight(const UniValue& params, bool fHelp) {
   //Get the sapling tree as of the previous block
   SaplingMerkleTree saplingTree;
   auto witness = saplingTree.witness();
-  pcoinsTip->GetSaplingAnchorAt(pblockindex->pprev->hashFinalSaplingRoot, saplingTree);
+  GetSaplingTreeAt(pblockindex->pprev, saplingTree);
 
   //Cycle through block and transactions build sapling tree until the commitment needed is reached
   CBlock pblock;
@@ -183,13 +184,13 @@ UniValue getsaplingwitnessatheight(const UniValue& params, bool fHelp) {
   }
 
 
+  CBlock block;
   for (int64_t j = nHeight + 1; j <= toHeight; j++) {
     UniValue jsonblock(UniValue::VOBJ);
     std::string strHash = chainActive[j]->GetBlockHash().GetHex();
 
     uint256 hash(uint256S(strHash));
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
@@ -235,7 +236,7 @@ UniValue getsaplingblocks(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getsaplingblocks", "12800 1")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK(cs_main);
 
    int64_t nHeight = params[0].get_int64();
    int64_t nBlocks = params[1].get_int64();
@@ -259,13 +260,13 @@ UniValue getsaplingblocks(const UniValue& params, bool fHelp)
     }
 
     UniValue result(UniValue::VARR);
+    CBlock block;
     for (int64_t i = 0; i < nBlocks; i++) {
       UniValue jsonblock(UniValue::VOBJ);
       std::string strHash = chainActive[nHeight + i]->GetBlockHash().GetHex();
 
       uint256 hash(uint256S(strHash));
 
-      CBlock block;
       CBlockIndex* pblockindex = mapBlockIndex[hash];
 
       if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
@@ -321,6 +322,48 @@ UniValue getsaplingblocks(const UniValue& params, bool fHelp)
 }
 
 
+UniValue getcompactsaplingblocks(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getcompactsaplingblocks startheight blocksqty\n"
+            "\nReturns the serialized compact form of blocksqty blocks starting at startheight.\n"
+            "Each compact block holds, for every transaction with Sapling data, the spend\n"
+            "nullifiers and the cmu, epk and first 52 bytes of the ciphertext of each output.\n"
+            "Requires -compactblockindex.\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"data\",     (string) hex-encoded compact block\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcompactsaplingblocks", "12800 100")
+            + HelpExampleRpc("getcompactsaplingblocks", "12800 100")
+        );
+
+    // Records are read straight from the flat file, so neither cs_main nor
+    // the wallet lock is needed
+    if (!pcompactblocks)
+        throw JSONRPCError(RPC_MISC_ERROR, "Compact block store is not enabled, restart with -compactblockindex");
+
+    int nHeight = params[0].get_int();
+    int nBlocks = params[1].get_int();
+    if (nHeight < 0 || nHeight > pcompactblocks->Height())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    if (nBlocks < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "blocksqty must be at least 1");
+
+    int nEnd = std::min(nHeight + nBlocks - 1, pcompactblocks->Height());
+    UniValue result(UniValue::VARR);
+    std::vector<unsigned char> data;
+    for (int i = nHeight; i <= nEnd; i++) {
+        if (!pcompactblocks->ReadRaw(i, data))
+            break;
+        result.push_back(HexStr(data.begin(), data.end()));
+    }
+
+    return result;
+}
 
 static const CRPCCommand commands[] =
 {   //  category              name                            actor (function)              okSafeMode
@@ -328,6 +371,7 @@ static const CRPCCommand commands[] =
     {   "zero Experimental",     "getsaplingwitness",         &getsaplingwitness,           true },
     {   "zero Experimental",     "getsaplingwitnessatheight", &getsaplingwitnessatheight,   true },
     {   "zero Experimental",     "getsaplingblocks",          &getsaplingblocks,            true },
+    {   "zero Experimental",     "getcompactsaplingblocks",   &getcompactsaplingblocks,     true },
 
 };
 
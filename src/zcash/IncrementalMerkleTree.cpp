@@ -1113,6 +1113,8 @@ std::deque<Hash> IncrementalWitness<Depth, Hash>::partial_path() const {
 
 template<size_t Depth, typename Hash>
 void IncrementalWitness<Depth, Hash>::append(Hash obj) {
+    invalidate();
+
     if (cursor) {
         cursor->append(obj);
 
@@ -1136,6 +1138,130 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+uint64_t IncrementalWitness<Depth, Hash>::next_position() const {
+    uint64_t pos = tree.size();
+    // Each filled uncle is a complete subtree at the depth of the slot it took
+    for (size_t i = 0; i < filled.size(); i++) {
+        pos += uint64_t(1) << tree.next_depth(i);
+    }
+    if (cursor) {
+        pos += cursor->size();
+    }
+    return pos;
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append_many(const MerkleAppendBatch<Depth, Hash>& batch) {
+    const std::vector<Hash>& leaves = batch.leaves();
+    uint64_t pos = next_position();
+    size_t i = 0;
+    invalidate();
+
+    if (pos != batch.start()) {
+        BOOST_FOREACH(const Hash& leaf, leaves) {
+            append(leaf);
+        }
+        return;
+    }
+
+    while (i < leaves.size()) {
+        if (!cursor) {
+            cursor_depth = tree.next_depth(filled.size());
+
+            if (cursor_depth >= Depth) {
+                throw std::runtime_error("tree is full");
+            }
+
+            // The next uncle starts here and is aligned to its depth, so it
+            // is in the batch whenever the batch covers all its leaves
+            const Hash* subtree = batch.subtree(cursor_depth, pos);
+            if (subtree) {
+                filled.push_back(*subtree);
+                i += size_t(1) << cursor_depth;
+                pos += uint64_t(1) << cursor_depth;
+                continue;
+            }
+        }
+
+        append(leaves[i]);
+        i++;
+        pos++;
+    }
+}
+
+template<size_t Depth, typename Hash>
+MerkleAppendBatch<Depth, Hash>::MerkleAppendBatch(uint64_t nStart, const std::vector<uint256>& leaves) :
+    nStart(nStart)
+{
+    levels.push_back(std::vector<Hash>(leaves.begin(), leaves.end()));
+    first.push_back(nStart);
+
+    for (size_t d = 0; d + 1 < Depth; d++) {
+        const std::vector<Hash>& level = levels[d];
+        // Parents whose two children are both complete
+        uint64_t begin = (first[d] + 1) / 2;
+        uint64_t end = (first[d] + level.size()) / 2;
+        if (end <= begin) {
+            break;
+        }
+
+        std::vector<Hash> parents;
+        parents.reserve(end - begin);
+        for (uint64_t k = begin; k < end; k++) {
+            size_t left = 2 * k - first[d];
+            parents.push_back(Hash::combine(level[left], level[left + 1], d));
+        }
+        levels.push_back(parents);
+        first.push_back(begin);
+    }
+}
+
+template<size_t Depth, typename Hash>
+const Hash* MerkleAppendBatch<Depth, Hash>::subtree(size_t depth, uint64_t pos) const {
+    if (depth >= levels.size() || (pos & ((uint64_t(1) << depth) - 1)) != 0) {
+        return NULL;
+    }
+    uint64_t k = pos >> depth;
+    if (k < first[depth] || k - first[depth] >= levels[depth].size()) {
+        return NULL;
+    }
+    return &levels[depth][k - first[depth]];
+}
+
+template<size_t Depth, typename Hash>
+IncrementalMerkleTreeDelta<Depth, Hash>::IncrementalMerkleTreeDelta(
+    const IncrementalMerkleTree<Depth, Hash>& base,
+    const IncrementalMerkleTree<Depth, Hash>& tree
+) : left(tree.left), right(tree.right), nParents(tree.parents.size())
+{
+    for (size_t i = 0; i < tree.parents.size(); i++) {
+        if (i >= base.parents.size() || tree.parents[i] != base.parents[i]) {
+            changed.push_back(std::make_pair(i, tree.parents[i]));
+        }
+    }
+}
+
+template<size_t Depth, typename Hash>
+IncrementalMerkleTree<Depth, Hash> IncrementalMerkleTreeDelta<Depth, Hash>::apply(
+    const IncrementalMerkleTree<Depth, Hash>& base
+) const
+{
+    IncrementalMerkleTree<Depth, Hash> tree;
+    tree.left = left;
+    tree.right = right;
+    tree.parents = base.parents;
+    tree.parents.resize(nParents);
+    for (const auto& parent : changed) {
+        if (parent.first >= nParents) {
+            throw std::ios_base::failure("tree delta changes a parent out of range");
+        }
+        tree.parents[parent.first] = parent.second;
+    }
+    tree.wfcheck();
+    return tree;
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -1148,4 +1274,12 @@ template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, Pede
 template class IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
+template class MerkleAppendBatch<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class MerkleAppendBatch<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
+template class MerkleAppendBatch<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
+template class MerkleAppendBatch<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
+
+template class IncrementalMerkleTreeDelta<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class IncrementalMerkleTreeDelta<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
+
 } // end namespace `libzcash`
@@ -3,6 +3,7 @@
 
 #include <array>
 #include <deque>
+#include <list>
 #include <boost/optional.hpp>
 #include <boost/static_assert.hpp>
 
@@ -77,10 +78,43 @@ bool operator==(const EmptyMerkleRoots<Depth, Hash>& a,
 template<size_t Depth, typename Hash>
 class IncrementalWitness;
 
+template<size_t Depth, typename Hash>
+class CompactWitnessList;
+
+template<size_t Depth, typename Hash>
+class IncrementalMerkleTreeDelta;
+
+/**
+ * A run of leaves appended to a tree at a known position, with every complete
+ * aligned subtree among them hashed once, level by level. Witnesses that all
+ * advance over the same leaves (one block's commitments) take whole subtrees
+ * from it instead of hashing them again each.
+ */
+template<size_t Depth, typename Hash>
+class MerkleAppendBatch {
+public:
+    MerkleAppendBatch(uint64_t nStart, const std::vector<uint256>& leaves);
+
+    uint64_t start() const { return nStart; }
+    const std::vector<Hash>& leaves() const { return levels[0]; }
+
+    // The root of the subtree of the given depth whose first leaf is at
+    // position pos, or NULL unless all its leaves are in the batch.
+    const Hash* subtree(size_t depth, uint64_t pos) const;
+
+private:
+    uint64_t nStart;
+    // Complete nodes of each level, and the index of the first of them
+    std::vector<std::vector<Hash>> levels;
+    std::vector<uint64_t> first;
+};
+
 template<size_t Depth, typename Hash>
 class IncrementalMerkleTree {
 
 friend class IncrementalWitness<Depth, Hash>;
+friend class CompactWitnessList<Depth, Hash>;
+friend class IncrementalMerkleTreeDelta<Depth, Hash>;
 
 public:
     BOOST_STATIC_ASSERT(Depth >= 1);
@@ -150,13 +184,28 @@ bool operator==(const IncrementalMerkleTree<Depth, Hash>& a,
 template <size_t Depth, typename Hash>
 class IncrementalWitness {
 friend class IncrementalMerkleTree<Depth, Hash>;
+friend class CompactWitnessList<Depth, Hash>;
 
 public:
+    typedef MerkleAppendBatch<Depth, Hash> AppendBatch;
+
     // Required for Unserialize()
     IncrementalWitness() {}
 
+    size_t DynamicMemoryUsage() const {
+        return tree.DynamicMemoryUsage() +
+               filled.size() * 32 + // filled
+               (cursor ? cursor->DynamicMemoryUsage() : 0) +
+               (cachedPath ? Depth * (32 + 1) : 0); // path bits and index
+    }
+
+    // The path and root only change on append, so both are kept once
+    // computed; senders and witness RPCs ask for them repeatedly.
     MerklePath path() const {
-        return tree.path(partial_path());
+        if (!cachedPath) {
+            cachedPath = tree.path(partial_path());
+        }
+        return *cachedPath;
     }
 
     // Return the element being witnessed (should be a note
@@ -170,11 +219,21 @@ public:
     }
 
     Hash root() const {
-        return tree.root(Depth, partial_path());
+        if (!cachedRoot) {
+            cachedRoot = tree.root(Depth, partial_path());
+        }
+        return *cachedRoot;
     }
 
     void append(Hash obj);
 
+    // Append all leaves of the batch, taking complete subtrees from it when
+    // the witness is at the batch's start position.
+    void append_many(const MerkleAppendBatch<Depth, Hash>& batch);
+
+    // Position of the next leaf the witness will absorb
+    uint64_t next_position() const;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -184,6 +243,9 @@ public:
         READWRITE(cursor);
 
         cursor_depth = tree.next_depth(filled.size());
+        if (ser_action.ForRead()) {
+            invalidate();
+        }
     }
 
     template <size_t D, typename H>
@@ -195,7 +257,13 @@ private:
     std::vector<Hash> filled;
     boost::optional<IncrementalMerkleTree<Depth, Hash>> cursor;
     size_t cursor_depth = 0;
+    mutable boost::optional<Hash> cachedRoot;
+    mutable boost::optional<MerklePath> cachedPath;
     std::deque<Hash> partial_path() const;
+    void invalidate() {
+        cachedRoot = boost::none;
+        cachedPath = boost::none;
+    }
     IncrementalWitness(IncrementalMerkleTree<Depth, Hash> tree) : tree(tree) {}
 };
 
@@ -208,6 +276,73 @@ bool operator==(const IncrementalWitness<Depth, Hash>& a,
             a.cursor_depth == b.cursor_depth);
 }
 
+/**
+ * Serializes a note's witness cache (newest witness first) without repeating
+ * what the witnesses share. Every witness of a note has the same tree and
+ * witnesses only ever add to filled, so after the oldest witness each newer
+ * one is written as the filled hashes it adds plus its cursor. A witness that
+ * does not extend the one before it is written in full.
+ */
+template <size_t Depth, typename Hash>
+class CompactWitnessList {
+public:
+    CompactWitnessList(std::list<IncrementalWitness<Depth, Hash>>& witnessesIn) : witnesses(witnessesIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        WriteCompactSize(s, witnesses.size());
+        const IncrementalWitness<Depth, Hash>* prev = nullptr;
+        for (auto it = witnesses.rbegin(); it != witnesses.rend(); ++it) {
+            const IncrementalWitness<Depth, Hash>& w = *it;
+            bool fDelta = prev && Extends(w, *prev);
+            ::Serialize(s, fDelta);
+            if (fDelta) {
+                std::vector<Hash> added(w.filled.begin() + prev->filled.size(), w.filled.end());
+                ::Serialize(s, added);
+                ::Serialize(s, w.cursor);
+            } else {
+                ::Serialize(s, w);
+            }
+            prev = &w;
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        witnesses.clear();
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nSize; i++) {
+            bool fDelta;
+            ::Unserialize(s, fDelta);
+            if (fDelta) {
+                if (witnesses.empty())
+                    throw std::ios_base::failure("CompactWitnessList: delta without a base witness");
+                IncrementalWitness<Depth, Hash> w = witnesses.front();
+                std::vector<Hash> added;
+                ::Unserialize(s, added);
+                w.filled.insert(w.filled.end(), added.begin(), added.end());
+                ::Unserialize(s, w.cursor);
+                w.cursor_depth = w.tree.next_depth(w.filled.size());
+                w.invalidate();
+                witnesses.push_front(w);
+            } else {
+                IncrementalWitness<Depth, Hash> w;
+                ::Unserialize(s, w);
+                witnesses.push_front(w);
+            }
+        }
+    }
+
+private:
+    std::list<IncrementalWitness<Depth, Hash>>& witnesses;
+
+    static bool Extends(const IncrementalWitness<Depth, Hash>& w, const IncrementalWitness<Depth, Hash>& prev) {
+        return w.tree == prev.tree &&
+            w.filled.size() >= prev.filled.size() &&
+            std::equal(prev.filled.begin(), prev.filled.end(), w.filled.begin());
+    }
+};
+
 class SHA256Compress : public uint256 {
 public:
     SHA256Compress() : uint256() {}
@@ -240,6 +375,39 @@ public:
     static PedersenHash EmptyRoot(size_t);
 };
 
+/**
+ * The frontier of a tree relative to an earlier frontier of the same tree:
+ * its left and right leaves and the parents that differ. Appending a few
+ * leaves only changes the lowest parents, so this is much smaller than the
+ * frontier itself.
+ */
+template<size_t Depth, typename Hash>
+class IncrementalMerkleTreeDelta {
+public:
+    IncrementalMerkleTreeDelta() : nParents(0) { }
+    IncrementalMerkleTreeDelta(const IncrementalMerkleTree<Depth, Hash>& base,
+                               const IncrementalMerkleTree<Depth, Hash>& tree);
+
+    //! Rebuild the frontier this delta was made from out of its base
+    IncrementalMerkleTree<Depth, Hash> apply(const IncrementalMerkleTree<Depth, Hash>& base) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(left);
+        READWRITE(right);
+        READWRITE(VARINT(nParents));
+        READWRITE(changed);
+    }
+
+private:
+    boost::optional<Hash> left;
+    boost::optional<Hash> right;
+    uint32_t nParents;
+    std::vector<std::pair<uint32_t, boost::optional<Hash>>> changed;
+};
+
 template<size_t Depth, typename Hash>
 EmptyMerkleRoots<Depth, Hash> IncrementalMerkleTree<Depth, Hash>::emptyroots;
 
@@ -248,12 +416,16 @@ EmptyMerkleRoots<Depth, Hash> IncrementalMerkleTree<Depth, Hash>::emptyroots;
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutMerkleTree;
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingMerkleTree;
 
+typedef libzcash::IncrementalMerkleTreeDelta<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutMerkleTreeDelta;
+
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitness;
 
 typedef libzcash::IncrementalMerkleTree<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingMerkleTree;
 typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingMerkleTree;
 
+typedef libzcash::IncrementalMerkleTreeDelta<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingMerkleTreeDelta;
+
 typedef libzcash::IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitness;
 
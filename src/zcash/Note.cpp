@@ -1,5 +1,6 @@
 #include "Note.hpp"
 #include "prf.h"
+#include "crypto/common.h"
 #include "crypto/sha256.h"
 
 #include "random.h"
@@ -9,8 +10,25 @@
 #include "zcash/util.h"
 #include "librustzcash.h"
 
+#include <atomic>
+#include <memory>
+#include <thread>
+
 using namespace libzcash;
 
+static SproutNotePlaintext ParseSproutPlaintext(const ZCNoteDecryption::Plaintext& plaintext)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << plaintext;
+
+    SproutNotePlaintext ret;
+    ss >> ret;
+
+    assert(ss.size() == 0);
+
+    return ret;
+}
+
 SproutNote::SproutNote() {
     a_pk = random_uint256();
     rho = random_uint256();
@@ -108,17 +126,7 @@ SproutNotePlaintext SproutNotePlaintext::decrypt(const ZCNoteDecryption& decrypt
                                      unsigned char nonce
                                     )
 {
-    auto plaintext = decryptor.decrypt(ciphertext, ephemeralKey, h_sig, nonce);
-
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << plaintext;
-
-    SproutNotePlaintext ret;
-    ss >> ret;
-
-    assert(ss.size() == 0);
-
-    return ret;
+    return ParseSproutPlaintext(decryptor.decrypt(ciphertext, ephemeralKey, h_sig, nonce));
 }
 
 ZCNoteEncryption::Ciphertext SproutNotePlaintext::encrypt(ZCNoteEncryption& encryptor,
@@ -239,6 +247,55 @@ boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     return ret;
 }
 
+boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt_compact(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    auto pt = AttemptSaplingCompactDecryption(ciphertext, ivk, epk);
+    if (!pt) {
+        return boost::none;
+    }
+
+    // The plaintext is the serialized note without its memo
+    SaplingNotePlaintext ret;
+    const unsigned char* p = pt->begin();
+    if (*p++ != 0x01) {
+        return boost::none;
+    }
+    std::copy(p, p + ZC_DIVERSIFIER_SIZE, ret.d.begin());
+    p += ZC_DIVERSIFIER_SIZE;
+    ret.value_ = ReadLE64(p);
+    p += ZC_V_SIZE;
+    std::copy(p, p + ZC_R_SIZE, ret.rcm.begin());
+    ret.memo_.fill(0);
+
+    uint256 pk_d;
+    if (!librustzcash_ivk_to_pkd(ivk.begin(), ret.d.data(), pk_d.begin())) {
+        return boost::none;
+    }
+
+    uint256 cmu_expected;
+    if (!librustzcash_sapling_compute_cm(
+        ret.d.data(),
+        pk_d.begin(),
+        ret.value(),
+        ret.rcm.begin(),
+        cmu_expected.begin()
+    ))
+    {
+        return boost::none;
+    }
+
+    if (cmu_expected != cmu) {
+        return boost::none;
+    }
+
+    return ret;
+}
+
 boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
@@ -325,3 +382,170 @@ SaplingOutCiphertext SaplingOutgoingPlaintext::encrypt(
 
     return enc.encrypt_to_ourselves(ovk, cv, cm, pt);
 }
+
+namespace {
+
+// Number of keys tried against a single group of notes in one unit of work.
+static const size_t TRIAL_DECRYPTION_CHUNK_SIZE = 64;
+
+// Below this many (note, key) pairs the work is done on the calling thread.
+static const size_t TRIAL_DECRYPTION_MIN_PARALLEL_WORK = 256;
+
+/**
+ * Splits the (note, key) matrix into chunks of consecutive keys for a single
+ * group of notes and hands them out to worker threads. Group g holds notes
+ * [vGroupEnd[g-1], vGroupEnd[g]); prepare(group, key) is called once per
+ * group and key, and its result handed to tryDecrypt(note, key, state) for
+ * every note of the group still being searched at that key. Once a note has
+ * been decrypted its higher-indexed keys are skipped, so the result matches
+ * a sequential scan that stops at the first matching key.
+ */
+template<typename Plaintext, typename Prepare, typename TryDecrypt>
+std::vector<TrialDecryptionResult<Plaintext>> TrialDecrypt(
+    const std::vector<size_t>& vGroupEnd,
+    size_t nKeys,
+    size_t nThreads,
+    Prepare prepare,
+    TryDecrypt tryDecrypt)
+{
+    std::vector<TrialDecryptionResult<Plaintext>> results;
+    const size_t nNotes = vGroupEnd.empty() ? 0 : vGroupEnd.back();
+    if (nNotes == 0 || nKeys == 0) {
+        return results;
+    }
+
+    const size_t nChunksPerGroup = (nKeys + TRIAL_DECRYPTION_CHUNK_SIZE - 1) / TRIAL_DECRYPTION_CHUNK_SIZE;
+    const size_t nChunks = vGroupEnd.size() * nChunksPerGroup;
+
+    // Lowest matching key found so far for each note (nKeys if none).
+    std::unique_ptr<std::atomic<size_t>[]> firstMatch(new std::atomic<size_t>[nNotes]);
+    for (size_t i = 0; i < nNotes; i++) {
+        firstMatch[i] = nKeys;
+    }
+    // Indexed by note and chunk within the note's group; each slot is only
+    // written by the worker holding that chunk, at most once.
+    std::vector<boost::optional<Plaintext>> plaintexts(nNotes * nChunksPerGroup);
+    std::vector<size_t> matchedKeys(nNotes * nChunksPerGroup, nKeys);
+    std::atomic<size_t> nextChunk(0);
+
+    auto worker = [&]() {
+        size_t chunk;
+        while ((chunk = nextChunk++) < nChunks) {
+            size_t group = chunk / nChunksPerGroup;
+            size_t chunkInGroup = chunk % nChunksPerGroup;
+            size_t noteBegin = group == 0 ? 0 : vGroupEnd[group - 1];
+            size_t noteEnd = vGroupEnd[group];
+            size_t keyBegin = chunkInGroup * TRIAL_DECRYPTION_CHUNK_SIZE;
+            size_t keyEnd = std::min(keyBegin + TRIAL_DECRYPTION_CHUNK_SIZE, nKeys);
+            for (size_t key = keyBegin; key < keyEnd; key++) {
+                bool fPending = false;
+                for (size_t note = noteBegin; note < noteEnd && !fPending; note++) {
+                    fPending = key < firstMatch[note];
+                }
+                if (!fPending) {
+                    break;
+                }
+                auto state = prepare(group, key);
+                if (!state) {
+                    continue;
+                }
+                for (size_t note = noteBegin; note < noteEnd; note++) {
+                    if (key >= firstMatch[note]) {
+                        continue;
+                    }
+                    auto plaintext = tryDecrypt(note, key, *state);
+                    if (plaintext) {
+                        size_t slot = note * nChunksPerGroup + chunkInGroup;
+                        plaintexts[slot] = plaintext;
+                        matchedKeys[slot] = key;
+                        size_t current = firstMatch[note];
+                        while (key < current && !firstMatch[note].compare_exchange_weak(current, key)) {}
+                    }
+                }
+            }
+        }
+    };
+
+    size_t nWorkers = std::min(nThreads, nChunks);
+    if (nWorkers <= 1 || nNotes * nKeys < TRIAL_DECRYPTION_MIN_PARALLEL_WORK) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(nWorkers - 1);
+        for (size_t i = 1; i < nWorkers; i++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    for (size_t note = 0; note < nNotes; note++) {
+        size_t key = firstMatch[note];
+        if (key == nKeys) {
+            continue;
+        }
+        size_t slot = note * nChunksPerGroup + key / TRIAL_DECRYPTION_CHUNK_SIZE;
+        assert(matchedKeys[slot] == key);
+        results.emplace_back(note, key, *plaintexts[slot]);
+    }
+    return results;
+}
+
+}
+
+std::vector<TrialDecryptionResult<SaplingNotePlaintext>> libzcash::TrialDecryptSaplingNotes(
+    const std::vector<SaplingEncryptedNote>& notes,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    size_t nThreads)
+{
+    // Sapling key agreement happens inside decrypt, so every note is its own group
+    std::vector<size_t> vGroupEnd(notes.size());
+    for (size_t i = 0; i < notes.size(); i++) {
+        vGroupEnd[i] = i + 1;
+    }
+    return TrialDecrypt<SaplingNotePlaintext>(vGroupEnd, ivks.size(), nThreads,
+        [](size_t group, size_t key) { return boost::optional<bool>(true); },
+        [&](size_t note, size_t key, bool) {
+            return SaplingNotePlaintext::decrypt(
+                notes[note].encCiphertext, ivks[key], notes[note].epk, notes[note].cmu);
+        });
+}
+
+std::vector<TrialDecryptionResult<SproutNotePlaintext>> libzcash::TrialDecryptSproutNotes(
+    const std::vector<SproutEncryptedNote>& notes,
+    const std::vector<ZCNoteDecryption>& decryptors,
+    size_t nThreads)
+{
+    // Consecutive ciphertexts under the same ephemeral key (the outputs of one
+    // JoinSplit) share the DH secret with each key, computed once per group.
+    std::vector<size_t> vGroupEnd;
+    for (size_t i = 0; i < notes.size(); i++) {
+        if (i > 0 && notes[i].ephemeralKey == notes[i - 1].ephemeralKey) {
+            vGroupEnd.back() = i + 1;
+        } else {
+            vGroupEnd.push_back(i + 1);
+        }
+    }
+    return TrialDecrypt<SproutNotePlaintext>(vGroupEnd, decryptors.size(), nThreads,
+        [&](size_t group, size_t key) -> boost::optional<uint256> {
+            const uint256& epk = notes[group == 0 ? 0 : vGroupEnd[group - 1]].ephemeralKey;
+            try {
+                return decryptors[key].dh_secret(epk);
+            } catch (const std::logic_error&) {
+                return boost::none;
+            }
+        },
+        [&](size_t note, size_t key, const uint256& dhsecret) -> boost::optional<SproutNotePlaintext> {
+            try {
+                return ParseSproutPlaintext(decryptors[key].decrypt_with_dh_secret(
+                    notes[note].ciphertext, dhsecret, notes[note].ephemeralKey,
+                    notes[note].h_sig, notes[note].nonce));
+            } catch (const std::exception&) {
+                // Either the key doesn't match (note_decryption_failed) or the
+                // plaintext is malformed; in both cases this pair is not a match.
+                return boost::none;
+            }
+        });
+}
@@ -7,6 +7,7 @@
 #include "NoteEncryption.hpp"
 
 #include <array>
+#include <vector>
 #include <boost/optional.hpp>
 
 namespace libzcash {
@@ -142,6 +143,15 @@ public:
         const uint256 &cmu
     );
 
+    // Recovers the note, without its memo, from the leading bytes of the
+    // ciphertext kept in a compact block
+    static boost::optional<SaplingNotePlaintext> decrypt_compact(
+        const SaplingCompactCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &epk,
+        const uint256 &cmu
+    );
+
     boost::optional<SaplingNote> note(const SaplingIncomingViewingKey& ivk) const;
 
     virtual ~SaplingNotePlaintext() {}
@@ -201,6 +211,59 @@ public:
 };
 
 
+// A Sapling output's encrypted note, as needed for trial decryption.
+struct SaplingEncryptedNote {
+    SaplingEncCiphertext encCiphertext;
+    uint256 epk;
+    uint256 cmu;
+
+    SaplingEncryptedNote(const SaplingEncCiphertext& encCiphertext,
+                         const uint256& epk,
+                         const uint256& cmu)
+        : encCiphertext(encCiphertext), epk(epk), cmu(cmu) {}
+};
+
+// A Sprout JoinSplit ciphertext, as needed for trial decryption.
+struct SproutEncryptedNote {
+    ZCNoteDecryption::Ciphertext ciphertext;
+    uint256 ephemeralKey;
+    uint256 h_sig;
+    unsigned char nonce;
+
+    SproutEncryptedNote(const ZCNoteDecryption::Ciphertext& ciphertext,
+                        const uint256& ephemeralKey,
+                        const uint256& h_sig,
+                        unsigned char nonce)
+        : ciphertext(ciphertext), ephemeralKey(ephemeralKey), h_sig(h_sig), nonce(nonce) {}
+};
+
+// A successful trial decryption: the index of the note in the input batch,
+// the index of the key that decrypted it, and the recovered plaintext.
+template<typename Plaintext>
+struct TrialDecryptionResult {
+    size_t note;
+    size_t key;
+    Plaintext plaintext;
+
+    TrialDecryptionResult(size_t note, size_t key, const Plaintext& plaintext)
+        : note(note), key(key), plaintext(plaintext) {}
+};
+
+// Trial-decrypt every note in the batch against every key, spreading the
+// work over up to nThreads threads (the calling thread included). Each note
+// is reported at most once, against the lowest-indexed key that decrypts
+// it, and results are ordered by note index. For Sprout, consecutive notes
+// with the same ephemeral key share one DH computation per key.
+std::vector<TrialDecryptionResult<SaplingNotePlaintext>> TrialDecryptSaplingNotes(
+    const std::vector<SaplingEncryptedNote>& notes,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    size_t nThreads);
+
+std::vector<TrialDecryptionResult<SproutNotePlaintext>> TrialDecryptSproutNotes(
+    const std::vector<SproutEncryptedNote>& notes,
+    const std::vector<ZCNoteDecryption>& decryptors,
+    size_t nThreads);
+
 }
 
 #endif // ZC_NOTE_H_
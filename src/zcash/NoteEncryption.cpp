@@ -187,6 +187,36 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     return plaintext;
 }
 
+boost::optional<SaplingCompactPlaintext> AttemptSaplingCompactDecryption(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk
+)
+{
+    uint256 dhsecret;
+
+    if (!librustzcash_sapling_ka_agree(epk.begin(), ivk.begin(), dhsecret.begin())) {
+        return boost::none;
+    }
+
+    // Construct the symmetric key
+    unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
+    KDF_Sapling(K, dhsecret, epk);
+
+    // The nonce is zero because we never reuse keys
+    unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
+
+    // The AEAD uses the first ChaCha20 block for its Poly1305 key, so the
+    // message keystream starts at block 1
+    SaplingCompactPlaintext plaintext;
+    crypto_stream_chacha20_ietf_xor_ic(
+        plaintext.begin(),
+        ciphertext.begin(), ZC_SAPLING_COMPACT_PLAINTEXT_SIZE,
+        cipher_nonce, 1, K);
+
+    return plaintext;
+}
+
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
@@ -345,6 +375,12 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
                                           const uint256 &hSig,
                                           unsigned char nonce
                                          ) const
+{
+    return decrypt_with_dh_secret(ciphertext, dh_secret(epk), epk, hSig, nonce);
+}
+
+template<size_t MLEN>
+uint256 NoteDecryption<MLEN>::dh_secret(const uint256 &epk) const
 {
     uint256 dhsecret;
 
@@ -352,6 +388,18 @@ typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt
         throw std::logic_error("Could not create DH secret");
     }
 
+    return dhsecret;
+}
+
+template<size_t MLEN>
+typename NoteDecryption<MLEN>::Plaintext NoteDecryption<MLEN>::decrypt_with_dh_secret
+                                         (const NoteDecryption<MLEN>::Ciphertext &ciphertext,
+                                          const uint256 &dhsecret,
+                                          const uint256 &epk,
+                                          const uint256 &hSig,
+                                          unsigned char nonce
+                                         ) const
+{
     unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
     KDF(K, dhsecret, epk, pk_enc, hSig, nonce);
 
@@ -24,6 +24,10 @@ typedef std::array<unsigned char, ZC_SAPLING_ENCPLAINTEXT_SIZE> SaplingEncPlaint
 typedef std::array<unsigned char, ZC_SAPLING_OUTCIPHERTEXT_SIZE> SaplingOutCiphertext;
 typedef std::array<unsigned char, ZC_SAPLING_OUTPLAINTEXT_SIZE> SaplingOutPlaintext;
 
+// Leading bytes of a recipient ciphertext, up to the end of the note itself
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_PLAINTEXT_SIZE> SaplingCompactCiphertext;
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_PLAINTEXT_SIZE> SaplingCompactPlaintext;
+
 //! This is not a thread-safe API.
 class SaplingNoteEncryption {
 protected:
@@ -73,6 +77,15 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Decrypts the leading bytes of a Sapling note ciphertext (ZIP 307). The
+// authentication tag covers the whole ciphertext and so cannot be checked;
+// the caller must check the note against its commitment instead.
+boost::optional<SaplingCompactPlaintext> AttemptSaplingCompactDecryption(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
@@ -151,6 +164,18 @@ public:
                       unsigned char nonce
                      ) const;
 
+    // The DH secret shared with the sender of every ciphertext under epk.
+    // The ciphertexts of a JoinSplit share one ephemeral key, so computing
+    // this once saves a scalar multiplication per additional ciphertext.
+    uint256 dh_secret(const uint256 &epk) const;
+
+    Plaintext decrypt_with_dh_secret(const Ciphertext &ciphertext,
+                                     const uint256 &dhsecret,
+                                     const uint256 &epk,
+                                     const uint256 &hSig,
+                                     unsigned char nonce
+                                    ) const;
+
     friend inline bool operator==(const NoteDecryption& a, const NoteDecryption& b) {
         return a.sk_enc == b.sk_enc && a.pk_enc == b.pk_enc;
     }
@@ -224,6 +224,9 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Whether proofs are actually verified
+    bool Enabled() const { return perform_verification; }
+
     template <typename VerificationKey,
               typename ProcessedVerificationKey,
               typename PrimaryInput,
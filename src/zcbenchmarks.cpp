@@ -11,6 +11,7 @@
 #include "primitives/transaction.h"
 #include "base58.h"
 #include "crypto/equihash.h"
+#include "crypto/sha256.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "consensus/upgrades.h"
@@ -18,7 +19,10 @@
 #include "main.h"
 #include "miner.h"
 #include "pow.h"
+#include "proofcache.h"
+#include "random.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
 #include "sodium.h"
 #include "streams.h"
@@ -146,17 +150,13 @@ double benchmark_verify_joinsplit(const JSDescription &joinsplit)
 }
 
 #ifdef ENABLE_MINING
-double benchmark_solve_equihash()
+static void init_solve_equihash_state(unsigned int n, unsigned int k, crypto_generichash_blake2b_state& eh_state)
 {
     CBlock pblock;
     CEquihashInput I{pblock};
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << I;
 
-    auto params = Params(CBaseChainParams::MAIN).GetConsensus();
-    unsigned int n = params.nEquihashN;
-    unsigned int k = params.nEquihashK;
-    crypto_generichash_blake2b_state eh_state;
     EhInitialiseState(n, k, eh_state);
     crypto_generichash_blake2b_update(&eh_state, (unsigned char*)&ss[0], ss.size());
 
@@ -165,6 +165,15 @@ double benchmark_solve_equihash()
     crypto_generichash_blake2b_update(&eh_state,
                                     nonce.begin(),
                                     nonce.size());
+}
+
+double benchmark_solve_equihash()
+{
+    auto params = Params(CBaseChainParams::MAIN).GetConsensus();
+    unsigned int n = params.nEquihashN;
+    unsigned int k = params.nEquihashK;
+    crypto_generichash_blake2b_state eh_state;
+    init_solve_equihash_state(n, k, eh_state);
 
     struct timeval tv_start;
     timer_start(tv_start);
@@ -194,13 +203,29 @@ std::vector<double> benchmark_solve_equihash_threaded(int nThreads)
     }
     return ret;
 }
+
+double benchmark_solve_equihash_tromp(int nThreads)
+{
+    auto params = Params(CBaseChainParams::MAIN).GetConsensus();
+    crypto_generichash_blake2b_state eh_state;
+    init_solve_equihash_state(params.nEquihashN, params.nEquihashK, eh_state);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    TrompSolve(eh_state, nThreads, [](std::vector<unsigned char> soln) { return false; });
+    return timer_stop(tv_start);
+}
 #endif // ENABLE_MINING
 
-double benchmark_verify_equihash()
+double benchmark_verify_equihash(bool fValid)
 {
     CChainParams params = Params(CBaseChainParams::MAIN);
     CBlock genesis = params.GenesisBlock();
     CBlockHeader genesis_header = genesis.GetBlockHeader();
+    if (!fValid) {
+        // Corrupt the first index, as a peer sending bad headers would
+        genesis_header.nSolution[0] ^= 0x80;
+    }
     struct timeval tv_start;
     timer_start(tv_start);
     CheckEquihashSolution(&genesis_header, params.GetConsensus());
@@ -267,26 +292,29 @@ double benchmark_large_tx(size_t nInputs)
 // create a transaction using a key not in our original list of n, and then
 // check that the transaction is not associated with any of the keys in our 
 // wallet. We call assert(...) to ensure that this is true.
-double benchmark_try_decrypt_sprout_notes(size_t nKeys)
+double benchmark_try_decrypt_sprout_notes(size_t nKeys, size_t nThreads)
 {
     CWallet wallet;
+    NoteDecryptorMap decryptors;
     for (int i = 0; i < nKeys; i++) {
         auto sk = libzcash::SproutSpendingKey::random();
         wallet.AddSproutSpendingKey(sk);
+        decryptors.insert(std::make_pair(sk.address(), ZCNoteDecryption(sk.receiving_key())));
     }
 
     auto sk = libzcash::SproutSpendingKey::random();
     auto tx = GetValidSproutReceive(*pzcashParams, sk, 10, true);
+    std::vector<const CTransaction*> vtx {&tx};
 
     struct timeval tv_start;
     timer_start(tv_start);
-    auto noteDataMap = wallet.FindMySproutNotes(tx);
+    auto noteDataMap = wallet.FindMySproutNotes(vtx, decryptors, nThreads).front();
 
     assert(noteDataMap.empty());
     return timer_stop(tv_start);
 }
 
-double benchmark_try_decrypt_sapling_notes(size_t nKeys)
+double benchmark_try_decrypt_sapling_notes(size_t nKeys, size_t nThreads)
 {
     // Set params
     auto consensusParams = Params().GetConsensus();
@@ -294,19 +322,23 @@ double benchmark_try_decrypt_sapling_notes(size_t nKeys)
     auto masterKey = GetTestMasterSaplingSpendingKey();
 
     CWallet wallet;
+    SaplingFullViewingKeyMap fvks;
 
     for (int i = 0; i < nKeys; i++) {
         auto sk = masterKey.Derive(i);
         wallet.AddSaplingSpendingKey(sk, sk.DefaultAddress());
+        auto fvk = sk.expsk.full_viewing_key();
+        fvks.insert(std::make_pair(fvk.in_viewing_key(), fvk));
     }
 
     // Generate a key that has not been added to the wallet
     auto sk = masterKey.Derive(nKeys);
     auto tx = GetValidSaplingReceive(consensusParams, wallet, sk, 10);
+    std::vector<const CTransaction*> vtx {&tx};
 
     struct timeval tv_start;
     timer_start(tv_start);
-    auto noteDataMapAndAddressesToAdd = wallet.FindMySaplingNotes(tx);
+    auto noteDataMapAndAddressesToAdd = wallet.FindMySaplingNotes(vtx, fvks, nThreads).front();
     assert(noteDataMapAndAddressesToAdd.first.empty());
     return timer_stop(tv_start);
 }
@@ -547,6 +579,62 @@ double benchmark_connectblock_slow()
     return duration;
 }
 
+/** Verify every signature and proof while in scope, whatever the caches hold */
+class ValidationCacheBypass
+{
+public:
+    ValidationCacheBypass()
+    {
+        SetSignatureCacheBypass(true);
+        SetProofCacheBypass(true);
+    }
+    ~ValidationCacheBypass()
+    {
+        SetSignatureCacheBypass(false);
+        SetProofCacheBypass(false);
+    }
+};
+
+double benchmark_connectblock_replay(int nBlocks, CConnectBlockTimings& timings)
+{
+    AssertLockHeld(cs_main);
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (nBlocks <= 0 || pindexTip == NULL || nBlocks > pindexTip->nHeight)
+        throw std::runtime_error(strprintf("Can only replay between 1 and %d blocks", pindexTip ? pindexTip->nHeight : 0));
+
+    // Rewind a view of the chainstate to before the first block with the
+    // undo data, like -checklevel=3 does. The blocks are kept in memory so
+    // that the replay reads nothing from disk, and nothing is flushed.
+    std::vector<CBlock> vBlocks(nBlocks);
+    CCoinsViewCache viewStart(pcoinsTip);
+    CValidationState state;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex* pindex = chainActive[pindexTip->nHeight - i];
+        CBlock& block = vBlocks[nBlocks - 1 - i];
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            throw std::runtime_error(strprintf("Failed to read block %d", pindex->nHeight));
+        if (DisconnectBlock(block, state, pindex, viewStart, chainparams, false) != DISCONNECT_OK)
+            throw std::runtime_error(strprintf("Failed to disconnect block %d", pindex->nHeight));
+    }
+
+    ValidationCacheBypass bypass;
+    CCoinsViewCache view(&viewStart);
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex* pindex = chainActive[pindexTip->nHeight - nBlocks + 1 + i];
+        int64_t nTimeStart = GetTimeMicros();
+        if (!ContextualCheckBlock(vBlocks[i], state, chainparams, pindex->pprev))
+            throw std::runtime_error(strprintf("Block %d failed its contextual checks", pindex->nHeight));
+        timings.nTimeSaplingProofs += GetTimeMicros() - nTimeStart;
+        if (!ConnectBlock(vBlocks[i], state, pindex, view, chainparams, true, &timings))
+            throw std::runtime_error(strprintf("Failed to connect block %d", pindex->nHeight));
+        view.SetBestBlock(pindex->GetBlockHash());
+    }
+    return timer_stop(tv_start);
+}
+
 extern UniValue getnewaddress(const UniValue& params, bool fHelp); // in rpcwallet.cpp
 extern UniValue sendtoaddress(const UniValue& params, bool fHelp);
 
@@ -683,6 +771,36 @@ double benchmark_create_sapling_output()
 // Verify Sapling spend from testnet
 // txid: abbd823cbd3d4e3b52023599d81a96b74817e95ce5bb58354f979156bd22ecc8
 // position: 0
+static std::vector<double> benchmark_sapling_proof_threaded(double (*benchmark)(), int nThreads)
+{
+    std::vector<double> ret;
+    std::vector<std::future<double>> tasks;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        std::packaged_task<double(void)> task(benchmark);
+        tasks.emplace_back(task.get_future());
+        threads.emplace_back(std::move(task));
+    }
+    for (auto it = tasks.begin(); it != tasks.end(); it++) {
+        it->wait();
+        ret.push_back(it->get());
+    }
+    for (auto it = threads.begin(); it != threads.end(); it++) {
+        it->join();
+    }
+    return ret;
+}
+
+std::vector<double> benchmark_create_sapling_spend_threaded(int nThreads)
+{
+    return benchmark_sapling_proof_threaded(&benchmark_create_sapling_spend, nThreads);
+}
+
+std::vector<double> benchmark_create_sapling_output_threaded(int nThreads)
+{
+    return benchmark_sapling_proof_threaded(&benchmark_create_sapling_output, nThreads);
+}
+
 double benchmark_verify_sapling_spend()
 {
     SpendDescription spend;
@@ -743,3 +861,30 @@ double benchmark_verify_sapling_output()
     }
     return timer_stop(tv_start);
 }
+
+double benchmark_sha256d64(size_t nBlocks)
+{
+    std::vector<unsigned char> in(64 * nBlocks), out(32 * nBlocks);
+    GetRandBytes(in.data(), in.size());
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    SHA256D64(out.data(), in.data(), nBlocks);
+    return timer_stop(tv_start);
+}
+
+double benchmark_merkle_root(size_t nTxs)
+{
+    CBlock block;
+    block.vtx.reserve(nTxs);
+    for (size_t i = 0; i < nTxs; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        block.vtx.push_back(mtx);
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    block.BuildMerkleTree();
+    return timer_stop(tv_start);
+}
@@ -98,29 +98,22 @@ bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, s
     }
 }
 
-void CBudgetManager::CheckOrphanVotes()
+void CBudgetManager::CheckOrphanVotes(const uint256& nHash)
 {
     LOCK(cs);
 
-
+    // the orphan maps are keyed by the hash of the missing proposal or budget,
+    // so only the entries for the item that just arrived need a look
     std::string strError = "";
-    std::map<uint256, CBudgetVote>::iterator it1 = mapOrphanZeronodeBudgetVotes.begin();
-    while (it1 != mapOrphanZeronodeBudgetVotes.end()) {
-        if (budget.UpdateProposal(((*it1).second), NULL, strError)) {
-            LogPrint("zeronode","CBudgetManager::CheckOrphanVotes - Proposal/Budget is known, activating and removing orphan vote\n");
-            mapOrphanZeronodeBudgetVotes.erase(it1++);
-        } else {
-            ++it1;
-        }
+    std::map<uint256, CBudgetVote>::iterator it1 = mapOrphanZeronodeBudgetVotes.find(nHash);
+    if (it1 != mapOrphanZeronodeBudgetVotes.end() && UpdateProposal((*it1).second, NULL, strError)) {
+        LogPrint("zeronode","CBudgetManager::CheckOrphanVotes - Proposal/Budget is known, activating and removing orphan vote\n");
+        mapOrphanZeronodeBudgetVotes.erase(it1);
     }
-    std::map<uint256, CFinalizedBudgetVote>::iterator it2 = mapOrphanFinalizedBudgetVotes.begin();
-    while (it2 != mapOrphanFinalizedBudgetVotes.end()) {
-        if (budget.UpdateFinalizedBudget(((*it2).second), NULL, strError)) {
-            LogPrint("zeronode","CBudgetManager::CheckOrphanVotes - Proposal/Budget is known, activating and removing orphan vote\n");
-            mapOrphanFinalizedBudgetVotes.erase(it2++);
-        } else {
-            ++it2;
-        }
+    std::map<uint256, CFinalizedBudgetVote>::iterator it2 = mapOrphanFinalizedBudgetVotes.find(nHash);
+    if (it2 != mapOrphanFinalizedBudgetVotes.end() && UpdateFinalizedBudget((*it2).second, NULL, strError)) {
+        LogPrint("zeronode","CBudgetManager::CheckOrphanVotes - Proposal/Budget is known, activating and removing orphan vote\n");
+        mapOrphanFinalizedBudgetVotes.erase(it2);
     }
     LogPrint("zeronode","CBudgetManager::CheckOrphanVotes - Done\n");
 }
@@ -306,13 +299,14 @@ CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    // read the data straight into the stream it is deserialized from
+    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+    ssObj.resize(dataSize);
     uint256 hashIn;
 
     // read data and checksum from file
     try {
-        filein.read((char*)&vchData[0], dataSize);
+        filein.read((char*)&ssObj[0], dataSize);
         filein >> hashIn;
     } catch (std::exception& e) {
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -320,8 +314,6 @@ CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
     }
     filein.fclose();
 
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
     uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
     if (hashIn != hashTmp) {
@@ -409,6 +401,7 @@ bool CBudgetManager::AddFinalizedBudget(CFinalizedBudget& finalizedBudget)
     }
 
     mapFinalizedBudgets.insert(make_pair(finalizedBudget.GetHash(), finalizedBudget));
+    mapHighestVoteCount.clear();
     return true;
 }
 
@@ -585,11 +578,17 @@ CBudgetProposal* CBudgetManager::FindProposal(uint256 nHash)
     return NULL;
 }
 
-bool CBudgetManager::IsBudgetPaymentBlock(int nBlockHeight)
+int CBudgetManager::GetHighestVoteCount(int nBlockHeight)
 {
-    int nHighestCount = -1;
-    int nFivePercent = znodeman.CountEnabled(ActiveProtocol()) / 20;
+    LOCK(cs);
 
+    // block templates and block validation ask for the same few heights over
+    // and over, while the budgets only change when one of them is relayed
+    std::map<int, int>::iterator mi = mapHighestVoteCount.find(nBlockHeight);
+    if (mi != mapHighestVoteCount.end())
+        return (*mi).second;
+
+    int nHighestCount = -1;
     std::map<uint256, CFinalizedBudget>::iterator it = mapFinalizedBudgets.begin();
     while (it != mapFinalizedBudgets.end()) {
         CFinalizedBudget* pfinalizedBudget = &((*it).second);
@@ -602,6 +601,15 @@ bool CBudgetManager::IsBudgetPaymentBlock(int nBlockHeight)
         ++it;
     }
 
+    mapHighestVoteCount[nBlockHeight] = nHighestCount;
+    return nHighestCount;
+}
+
+bool CBudgetManager::IsBudgetPaymentBlock(int nBlockHeight)
+{
+    int nHighestCount = GetHighestVoteCount(nBlockHeight);
+    int nFivePercent = znodeman.CountEnabled(ActiveProtocol()) / 20;
+
     LogPrint("zeronode","CBudgetManager::IsBudgetPaymentBlock() - nHighestCount: %lli, 5%% of Zeronodes: %lli. Number of budgets: %lli\n",
               nHighestCount, nFivePercent, mapFinalizedBudgets.size());
 
@@ -615,23 +623,8 @@ bool CBudgetManager::IsTransactionValid(const CTransaction& txNew, int nBlockHei
 {
     LOCK(cs);
 
-    int nHighestCount = 0;
+    int nHighestCount = std::max(GetHighestVoteCount(nBlockHeight), 0);
     int nFivePercent = znodeman.CountEnabled(ActiveProtocol()) / 20;
-    std::vector<CFinalizedBudget*> ret;
-
-    // ------- Grab The Highest Count
-
-    std::map<uint256, CFinalizedBudget>::iterator it = mapFinalizedBudgets.begin();
-    while (it != mapFinalizedBudgets.end()) {
-        CFinalizedBudget* pfinalizedBudget = &((*it).second);
-        if (pfinalizedBudget->GetVoteCount() > nHighestCount &&
-            nBlockHeight >= pfinalizedBudget->GetBlockStart() &&
-            nBlockHeight <= pfinalizedBudget->GetBlockEnd()) {
-            nHighestCount = pfinalizedBudget->GetVoteCount();
-        }
-
-        ++it;
-    }
 
     LogPrint("zeronode","CBudgetManager::IsTransactionValid() - nHighestCount: %lli, 5%% of Zeronodes: %lli mapFinalizedBudgets.size(): %ld\n",
               nHighestCount, nFivePercent, mapFinalizedBudgets.size());
@@ -642,7 +635,7 @@ bool CBudgetManager::IsTransactionValid(const CTransaction& txNew, int nBlockHei
 
     // check the highest finalized budgets (+/- 10% to assist in consensus)
 
-    it = mapFinalizedBudgets.begin();
+    std::map<uint256, CFinalizedBudget>::iterator it = mapFinalizedBudgets.begin();
     while (it != mapFinalizedBudgets.end()) {
         CFinalizedBudget* pfinalizedBudget = &((*it).second);
 
@@ -843,6 +836,9 @@ void CBudgetManager::NewBlock()
     TRY_LOCK(cs, fBudgetNewBlock);
     if (!fBudgetNewBlock) return;
 
+    // the heights of interest move on with the tip
+    mapHighestVoteCount.clear();
+
     if (zeronodeSync.RequestedZeronodeAssets <= ZERONODE_SYNC_BUDGET) return;
 
     if (strBudgetMode == "suggest") { //suggest the budget we see
@@ -1010,7 +1006,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         LogPrint("zeronode","zprop - new budget - %s\n", budgetProposalBroadcast.GetHash().ToString());
 
         //We might have active votes for this proposal that are valid now
-        CheckOrphanVotes();
+        CheckOrphanVotes(budgetProposalBroadcast.GetHash());
     }
 
     if (strCommand == "mvote") { //Zeronode Vote
@@ -1086,7 +1082,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         zeronodeSync.AddedBudgetItem(finalizedBudgetBroadcast.GetHash());
 
         //we might have active votes for this budget that are now valid
-        CheckOrphanVotes();
+        CheckOrphanVotes(finalizedBudgetBroadcast.GetHash());
     }
 
     if (strCommand == "fbvote") { //Finalized Budget Vote
@@ -1213,8 +1209,6 @@ void CBudgetManager::MarkSynced()
 
 void CBudgetManager::Sync(CNode* pfrom, uint256 nProp, bool fPartial)
 {
-    LOCK(cs);
-
     /*
         Sync with a client on the network
 
@@ -1223,62 +1217,64 @@ void CBudgetManager::Sync(CNode* pfrom, uint256 nProp, bool fPartial)
         This code checks each of the hash maps for all known budget proposals and finalized budget proposals, then checks them against the
         budget object to see if they're OK. If all checks pass, we'll send it to the peer.
 
+        The inventory is collected under cs and pushed to the peer afterwards.
     */
 
-    int nInvCount = 0;
-
-    std::map<uint256, CBudgetProposalBroadcast>::iterator it1 = mapSeenZeronodeBudgetProposals.begin();
-    while (it1 != mapSeenZeronodeBudgetProposals.end()) {
-        CBudgetProposal* pbudgetProposal = FindProposal((*it1).first);
-        if (pbudgetProposal && pbudgetProposal->fValid && (nProp == uint256() || (*it1).first == nProp)) {
-            pfrom->PushInventory(CInv(MSG_BUDGET_PROPOSAL, (*it1).second.GetHash()));
-            nInvCount++;
-
-            //send votes
-            std::map<uint256, CBudgetVote>::iterator it2 = pbudgetProposal->mapVotes.begin();
-            while (it2 != pbudgetProposal->mapVotes.end()) {
-                if ((*it2).second.fValid) {
-                    if ((fPartial && !(*it2).second.fSynced) || !fPartial) {
-                        pfrom->PushInventory(CInv(MSG_BUDGET_VOTE, (*it2).second.GetHash()));
-                        nInvCount++;
+    std::vector<CInv> vInvProposals;
+    std::vector<CInv> vInvFinalized;
+    {
+        LOCK(cs);
+
+        std::map<uint256, CBudgetProposalBroadcast>::iterator it1 = mapSeenZeronodeBudgetProposals.begin();
+        while (it1 != mapSeenZeronodeBudgetProposals.end()) {
+            CBudgetProposal* pbudgetProposal = FindProposal((*it1).first);
+            if (pbudgetProposal && pbudgetProposal->fValid && (nProp == uint256() || (*it1).first == nProp)) {
+                vInvProposals.push_back(CInv(MSG_BUDGET_PROPOSAL, (*it1).second.GetHash()));
+
+                //send votes
+                std::map<uint256, CBudgetVote>::iterator it2 = pbudgetProposal->mapVotes.begin();
+                while (it2 != pbudgetProposal->mapVotes.end()) {
+                    if ((*it2).second.fValid) {
+                        if ((fPartial && !(*it2).second.fSynced) || !fPartial) {
+                            vInvProposals.push_back(CInv(MSG_BUDGET_VOTE, (*it2).second.GetHash()));
+                        }
                     }
+                    ++it2;
                 }
-                ++it2;
             }
+            ++it1;
         }
-        ++it1;
-    }
-
-    pfrom->PushMessage("ssc", ZERONODE_SYNC_BUDGET_PROP, nInvCount);
-
-    LogPrint("znbudget", "CBudgetManager::Sync - sent %d items\n", nInvCount);
 
-    nInvCount = 0;
+        std::map<uint256, CFinalizedBudgetBroadcast>::iterator it3 = mapSeenFinalizedBudgets.begin();
+        while (it3 != mapSeenFinalizedBudgets.end()) {
+            CFinalizedBudget* pfinalizedBudget = FindFinalizedBudget((*it3).first);
+            if (pfinalizedBudget && pfinalizedBudget->fValid && (nProp == uint256() || (*it3).first == nProp)) {
+                vInvFinalized.push_back(CInv(MSG_BUDGET_FINALIZED, (*it3).second.GetHash()));
 
-    std::map<uint256, CFinalizedBudgetBroadcast>::iterator it3 = mapSeenFinalizedBudgets.begin();
-    while (it3 != mapSeenFinalizedBudgets.end()) {
-        CFinalizedBudget* pfinalizedBudget = FindFinalizedBudget((*it3).first);
-        if (pfinalizedBudget && pfinalizedBudget->fValid && (nProp == uint256() || (*it3).first == nProp)) {
-            pfrom->PushInventory(CInv(MSG_BUDGET_FINALIZED, (*it3).second.GetHash()));
-            nInvCount++;
-
-            //send votes
-            std::map<uint256, CFinalizedBudgetVote>::iterator it4 = pfinalizedBudget->mapVotes.begin();
-            while (it4 != pfinalizedBudget->mapVotes.end()) {
-                if ((*it4).second.fValid) {
-                    if ((fPartial && !(*it4).second.fSynced) || !fPartial) {
-                        pfrom->PushInventory(CInv(MSG_BUDGET_FINALIZED_VOTE, (*it4).second.GetHash()));
-                        nInvCount++;
+                //send votes
+                std::map<uint256, CFinalizedBudgetVote>::iterator it4 = pfinalizedBudget->mapVotes.begin();
+                while (it4 != pfinalizedBudget->mapVotes.end()) {
+                    if ((*it4).second.fValid) {
+                        if ((fPartial && !(*it4).second.fSynced) || !fPartial) {
+                            vInvFinalized.push_back(CInv(MSG_BUDGET_FINALIZED_VOTE, (*it4).second.GetHash()));
+                        }
                     }
+                    ++it4;
                 }
-                ++it4;
             }
+            ++it3;
         }
-        ++it3;
     }
 
-    pfrom->PushMessage("ssc", ZERONODE_SYNC_BUDGET_FIN, nInvCount);
-    LogPrint("znbudget", "CBudgetManager::Sync - sent %d items\n", nInvCount);
+    BOOST_FOREACH (const CInv& inv, vInvProposals)
+        pfrom->PushInventory(inv);
+    pfrom->PushMessage("ssc", ZERONODE_SYNC_BUDGET_PROP, (int)vInvProposals.size());
+    LogPrint("znbudget", "CBudgetManager::Sync - sent %d items\n", vInvProposals.size());
+
+    BOOST_FOREACH (const CInv& inv, vInvFinalized)
+        pfrom->PushInventory(inv);
+    pfrom->PushMessage("ssc", ZERONODE_SYNC_BUDGET_FIN, (int)vInvFinalized.size());
+    LogPrint("znbudget", "CBudgetManager::Sync - sent %d items\n", vInvFinalized.size());
 }
 
 bool CBudgetManager::UpdateProposal(CBudgetVote& vote, CNode* pfrom, std::string& strError)
@@ -1331,7 +1327,11 @@ bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pf
         return false;
     }
     LogPrint("zeronode","CBudgetManager::UpdateFinalizedBudget - Finalized Proposal %s added\n", vote.nBudgetHash.ToString());
-    return mapFinalizedBudgets[vote.nBudgetHash].AddOrUpdateVote(vote, strError);
+    if (!mapFinalizedBudgets[vote.nBudgetHash].AddOrUpdateVote(vote, strError))
+        return false;
+
+    mapHighestVoteCount.clear();
+    return true;
 }
 
 CBudgetProposal::CBudgetProposal()
@@ -1342,6 +1342,8 @@ CBudgetProposal::CBudgetProposal()
     nAmount = 0;
     nTime = 0;
     fValid = true;
+    nYeas = nNays = nAbstains = 0;
+    nRatioYeas = nRatioNays = 0;
 }
 
 CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strURLIn, int nBlockStartIn, int nBlockEndIn, CScript addressIn, CAmount nAmountIn, uint256 nFeeTXHashIn)
@@ -1354,6 +1356,8 @@ CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strU
     nAmount = nAmountIn;
     nFeeTXHash = nFeeTXHashIn;
     fValid = true;
+    nYeas = nNays = nAbstains = 0;
+    nRatioYeas = nRatioNays = 0;
 }
 
 CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
@@ -1368,6 +1372,11 @@ CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
     nFeeTXHash = other.nFeeTXHash;
     mapVotes = other.mapVotes;
     fValid = true;
+    nYeas = other.nYeas;
+    nNays = other.nNays;
+    nAbstains = other.nAbstains;
+    nRatioYeas = other.nRatioYeas;
+    nRatioNays = other.nRatioNays;
 }
 
 bool CBudgetProposal::IsValid(std::string& strError, bool fCheckCollateral)
@@ -1454,14 +1463,15 @@ bool CBudgetProposal::AddOrUpdateVote(CBudgetVote& vote, std::string& strError)
 
     uint256 hash = vote.vin.prevout.GetHash();
 
-    if (mapVotes.count(hash)) {
-        if (mapVotes[hash].nTime > vote.nTime) {
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.find(hash);
+    if (it != mapVotes.end()) {
+        if ((*it).second.nTime > vote.nTime) {
             strError = strprintf("new vote older than existing vote - %s\n", vote.GetHash().ToString());
             LogPrint("znbudget", "CBudgetProposal::AddOrUpdateVote - %s\n", strError);
             return false;
         }
-        if (vote.nTime - mapVotes[hash].nTime < BUDGET_VOTE_UPDATE_MIN) {
-            strError = strprintf("time between votes is too soon - %s - %lli sec < %lli sec\n", vote.GetHash().ToString(), vote.nTime - mapVotes[hash].nTime,BUDGET_VOTE_UPDATE_MIN);
+        if (vote.nTime - (*it).second.nTime < BUDGET_VOTE_UPDATE_MIN) {
+            strError = strprintf("time between votes is too soon - %s - %lli sec < %lli sec\n", vote.GetHash().ToString(), vote.nTime - (*it).second.nTime,BUDGET_VOTE_UPDATE_MIN);
             LogPrint("znbudget", "CBudgetProposal::AddOrUpdateVote - %s\n", strError);
             return false;
         }
@@ -1474,7 +1484,13 @@ bool CBudgetProposal::AddOrUpdateVote(CBudgetVote& vote, std::string& strError)
         return false;
     }
 
-    mapVotes[hash] = vote;
+    if (it != mapVotes.end()) {
+        CountVote((*it).second, -1);
+        (*it).second = vote;
+    } else {
+        mapVotes[hash] = vote;
+    }
+    CountVote(vote, 1);
     LogPrint("znbudget", "CBudgetProposal::AddOrUpdateVote - %s %s\n", strAction.c_str(), vote.GetHash().ToString().c_str());
 
     return true;
@@ -1485,67 +1501,81 @@ void CBudgetProposal::CleanAndRemove(bool fSignatureCheck)
 {
     std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
 
+    if (!fSignatureCheck) {
+        while (it != mapVotes.end()) {
+            (*it).second.fValid = (*it).second.SignatureValid(false);
+            ++it;
+        }
+        RecountVotes();
+        return;
+    }
+
+    // check the signatures of all the votes together
+    std::vector<CSignedMessage> vMessages;
+    std::vector<CBudgetVote*> vVotes;
     while (it != mapVotes.end()) {
-        (*it).second.fValid = (*it).second.SignatureValid(fSignatureCheck);
+        CSignedMessage msg;
+        (*it).second.fValid = (*it).second.GetSignedMessage(msg);
+        if ((*it).second.fValid) {
+            vMessages.push_back(msg);
+            vVotes.push_back(&(*it).second);
+        }
         ++it;
     }
+
+    std::vector<bool> vValid = obfuScationSigner.VerifyMessages(vMessages);
+    for (size_t i = 0; i < vVotes.size(); i++)
+        vVotes[i]->fValid = vValid[i];
+    RecountVotes();
+}
+
+void CBudgetProposal::CountVote(const CBudgetVote& vote, int nDelta)
+{
+    if (vote.nVote == VOTE_YES) {
+        nRatioYeas += nDelta;
+        if (vote.fValid) nYeas += nDelta;
+    } else if (vote.nVote == VOTE_NO) {
+        nRatioNays += nDelta;
+        if (vote.fValid) nNays += nDelta;
+    } else if (vote.nVote == VOTE_ABSTAIN) {
+        if (vote.fValid) nAbstains += nDelta;
+    }
 }
 
-double CBudgetProposal::GetRatio()
+void CBudgetProposal::RecountVotes()
 {
-    int yeas = 0;
-    int nays = 0;
+    LOCK(cs);
 
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
+    nYeas = nNays = nAbstains = 0;
+    nRatioYeas = nRatioNays = 0;
 
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
     while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES) yeas++;
-        if ((*it).second.nVote == VOTE_NO) nays++;
+        CountVote((*it).second, 1);
         ++it;
     }
+}
 
-    if (yeas + nays == 0) return 0.0f;
+double CBudgetProposal::GetRatio()
+{
+    if (nRatioYeas + nRatioNays == 0) return 0.0f;
 
-    return ((double)(yeas) / (double)(yeas + nays));
+    return ((double)(nRatioYeas) / (double)(nRatioYeas + nRatioNays));
 }
 
 int CBudgetProposal::GetYeas()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nYeas;
 }
 
 int CBudgetProposal::GetNays()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_NO && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nNays;
 }
 
 int CBudgetProposal::GetAbstains()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_ABSTAIN && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nAbstains;
 }
 
 int CBudgetProposal::GetBlockStartCycle()
@@ -1667,14 +1697,23 @@ bool CBudgetVote::Sign(CKey& keyZeronode, CPubKey& pubKeyZeronode)
     return true;
 }
 
+bool CBudgetVote::GetSignedMessage(CSignedMessage& msg)
+{
+    CZeronode* pzn = znodeman.Find(vin);
+    if (pzn == NULL) return false;
+
+    msg.pubkey = pzn->pubKeyZeronode;
+    msg.vchSig = vchSig;
+    msg.strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    return true;
+}
+
 bool CBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
-
-    CZeronode* pzn = znodeman.Find(vin);
+    CSignedMessage msg;
 
-    if (pzn == NULL) {
+    if (!GetSignedMessage(msg)) {
         if (fDebug){
             LogPrint("zeronode","CBudgetVote::SignatureValid() - Unknown Zeronode - %s\n", vin.prevout.hash.ToString());
         }
@@ -1683,7 +1722,7 @@ bool CBudgetVote::SignatureValid(bool fSignatureCheck)
 
     if (!fSignatureCheck) return true;
 
-    if (!obfuScationSigner.VerifyMessage(pzn->pubKeyZeronode, vchSig, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyMessage(msg.pubkey, msg.vchSig, msg.strMessage, errorMessage)) {
         LogPrint("zeronode","CBudgetVote::SignatureValid() - Verify message failed\n");
         return false;
     }
@@ -1830,10 +1869,30 @@ void CFinalizedBudget::CleanAndRemove(bool fSignatureCheck)
 {
     std::map<uint256, CFinalizedBudgetVote>::iterator it = mapVotes.begin();
 
+    if (!fSignatureCheck) {
+        while (it != mapVotes.end()) {
+            (*it).second.fValid = (*it).second.SignatureValid(false);
+            ++it;
+        }
+        return;
+    }
+
+    // check the signatures of all the votes together
+    std::vector<CSignedMessage> vMessages;
+    std::vector<CFinalizedBudgetVote*> vVotes;
     while (it != mapVotes.end()) {
-        (*it).second.fValid = (*it).second.SignatureValid(fSignatureCheck);
+        CSignedMessage msg;
+        (*it).second.fValid = (*it).second.GetSignedMessage(msg);
+        if ((*it).second.fValid) {
+            vMessages.push_back(msg);
+            vVotes.push_back(&(*it).second);
+        }
         ++it;
     }
+
+    std::vector<bool> vValid = obfuScationSigner.VerifyMessages(vMessages);
+    for (size_t i = 0; i < vVotes.size(); i++)
+        vVotes[i]->fValid = vValid[i];
 }
 
 
@@ -2110,23 +2169,31 @@ bool CFinalizedBudgetVote::Sign(CKey& keyZeronode, CPubKey& pubKeyZeronode)
     return true;
 }
 
-bool CFinalizedBudgetVote::SignatureValid(bool fSignatureCheck)
+bool CFinalizedBudgetVote::GetSignedMessage(CSignedMessage& msg)
 {
-    std::string errorMessage;
+    CZeronode* pzn = znodeman.Find(vin);
+    if (pzn == NULL) return false;
 
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    msg.pubkey = pzn->pubKeyZeronode;
+    msg.vchSig = vchSig;
+    msg.strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    return true;
+}
 
-    CZeronode* pzn = znodeman.Find(vin);
+bool CFinalizedBudgetVote::SignatureValid(bool fSignatureCheck)
+{
+    std::string errorMessage;
+    CSignedMessage msg;
 
-    if (pzn == NULL) {
-        LogPrint("zeronode","CFinalizedBudgetVote::SignatureValid() - Unknown Zeronode %s\n", strMessage);
+    if (!GetSignedMessage(msg)) {
+        LogPrint("zeronode","CFinalizedBudgetVote::SignatureValid() - Unknown Zeronode %s\n", vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime));
         return false;
     }
 
     if (!fSignatureCheck) return true;
 
-    if (!obfuScationSigner.VerifyMessage(pzn->pubKeyZeronode, vchSig, strMessage, errorMessage)) {
-        LogPrint("zeronode","CFinalizedBudgetVote::SignatureValid() - Verify message failed %s %s\n", strMessage, errorMessage);
+    if (!obfuScationSigner.VerifyMessage(msg.pubkey, msg.vchSig, msg.strMessage, errorMessage)) {
+        LogPrint("zeronode","CFinalizedBudgetVote::SignatureValid() - Verify message failed %s %s\n", msg.strMessage, errorMessage);
         return false;
     }
 
@@ -2141,3 +2208,18 @@ std::string CBudgetManager::ToString() const
 
     return info.str();
 }
+
+size_t CBudgetManager::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    size_t nUsage = memusage::DynamicUsage(mapProposals) + memusage::DynamicUsage(mapFinalizedBudgets);
+    for (const auto& proposal : mapProposals)
+        nUsage += memusage::DynamicUsage(proposal.second.mapVotes);
+    for (const auto& budget : mapFinalizedBudgets)
+        nUsage += memusage::DynamicUsage(budget.second.mapVotes) + memusage::DynamicUsage(budget.second.vecBudgetPayments);
+    nUsage += memusage::DynamicUsage(mapSeenZeronodeBudgetProposals) + memusage::DynamicUsage(mapSeenZeronodeBudgetVotes) +
+              memusage::DynamicUsage(mapOrphanZeronodeBudgetVotes) + memusage::DynamicUsage(mapSeenFinalizedBudgets) +
+              memusage::DynamicUsage(mapSeenFinalizedBudgetVotes) + memusage::DynamicUsage(mapOrphanFinalizedBudgetVotes) +
+              memusage::DynamicUsage(mapCollateralTxids) + memusage::DynamicUsage(mapHighestVoteCount);
+    return nUsage;
+}
@@ -27,6 +27,7 @@ class CFinalizedBudget;
 class CBudgetProposal;
 class CBudgetProposalBroadcast;
 class CTxBudgetPayment;
+struct CSignedMessage;
 
 #define VOTE_ABSTAIN 0
 #define VOTE_YES 1
@@ -67,6 +68,8 @@ public:
     CBudgetVote(CTxIn vin, uint256 nProposalHash, int nVoteIn);
 
     bool Sign(CKey& keyZeronode, CPubKey& pubKeyZeronode);
+    /// The signed message of this vote, false if its Zeronode is unknown
+    bool GetSignedMessage(CSignedMessage& msg);
     bool SignatureValid(bool fSignatureCheck);
     void Relay();
 
@@ -119,6 +122,8 @@ public:
     CFinalizedBudgetVote(CTxIn vinIn, uint256 nBudgetHashIn);
 
     bool Sign(CKey& keyZeronode, CPubKey& pubKeyZeronode);
+    /// The signed message of this vote, false if its Zeronode is unknown
+    bool GetSignedMessage(CSignedMessage& msg);
     bool SignatureValid(bool fSignatureCheck);
     void Relay();
 
@@ -178,6 +183,12 @@ private:
     // XX42    map<uint256, CTransaction> mapCollateral;
     map<uint256, uint256> mapCollateralTxids;
 
+    //! Highest vote count of the finalized budgets covering a block height,
+    //! -1 if there is none; cleared whenever a budget or budget vote arrives
+    std::map<int, int> mapHighestVoteCount;
+
+    int GetHighestVoteCount(int nBlockHeight);
+
 public:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -238,7 +249,8 @@ public:
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, CAmount nFees, CTxOut& txFounders, CTxOut& txZeronodes);
 
-    void CheckOrphanVotes();
+    /** Apply the orphan votes waiting for the proposal or finalized budget nHash */
+    void CheckOrphanVotes(const uint256& nHash);
     void Clear()
     {
         LOCK(cs);
@@ -252,10 +264,14 @@ public:
         mapSeenFinalizedBudgetVotes.clear();
         mapOrphanZeronodeBudgetVotes.clear();
         mapOrphanFinalizedBudgetVotes.clear();
+        mapHighestVoteCount.clear();
     }
     void CheckAndRemove();
     std::string ToString() const;
 
+    //! Estimated heap usage of the budgets, proposals and their votes, not counting signatures and names
+    size_t DynamicMemoryUsage() const;
+
 
     ADD_SERIALIZE_METHODS;
 
@@ -271,6 +287,8 @@ public:
 
         READWRITE(mapProposals);
         READWRITE(mapFinalizedBudgets);
+        if (ser_action.ForRead())
+            mapHighestVoteCount.clear();
     }
 };
 
@@ -457,6 +475,16 @@ private:
     mutable CCriticalSection cs;
     CAmount nAlloted;
 
+protected:
+    // running tallies of mapVotes: valid votes, and all votes for GetRatio()
+    int nYeas;
+    int nNays;
+    int nAbstains;
+    int nRatioYeas;
+    int nRatioNays;
+
+    void CountVote(const CBudgetVote& vote, int nDelta);
+
 public:
     bool fValid;
     std::string strProposalName;
@@ -515,6 +543,8 @@ public:
     CAmount GetAllotted() { return nAlloted; }
 
     void CleanAndRemove(bool fSignatureCheck);
+    /** Recompute the tallies from mapVotes */
+    void RecountVotes();
 
     uint256 GetHash()
     {
@@ -548,6 +578,8 @@ public:
 
         //for saving to the serialized db
         READWRITE(mapVotes);
+        if (ser_action.ForRead())
+            RecountVotes();
     }
 };
 
@@ -576,6 +608,11 @@ public:
         swap(first.nTime, second.nTime);
         swap(first.nFeeTXHash, second.nFeeTXHash);
         first.mapVotes.swap(second.mapVotes);
+        swap(first.nYeas, second.nYeas);
+        swap(first.nNays, second.nNays);
+        swap(first.nAbstains, second.nAbstains);
+        swap(first.nRatioYeas, second.nRatioYeas);
+        swap(first.nRatioNays, second.nRatioNays);
     }
 
     CBudgetProposalBroadcast& operator=(CBudgetProposalBroadcast from)
@@ -16,10 +16,15 @@
 #include "util.h"
 #include "key_io.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
+#include "random.h"
+#include "taskpool.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
 
 #include <algorithm>
 #include <boost/assign/list_of.hpp>
@@ -33,6 +38,90 @@ CObfuScationSigner obfuScationSigner;
 // Keep track of the active Zeronode
 CActiveZeronode activeZeronode;
 
+namespace {
+
+class CMessageSigCacheHasher
+{
+public:
+    size_t operator()(const uint256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Zeronode message signatures already found valid, so that a message checked
+ * again (a vote re-checked with its transaction lock, a budget vote recounted)
+ * does not need another key recovery
+ */
+class CMessageSigCache
+{
+private:
+    //! Entries are SHA256(nonce || message hash || key ID || signature):
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CMessageSigCacheHasher> set_type;
+    set_type setValid;
+    CCriticalSection cs;
+
+public:
+    CMessageSigCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    uint256 ComputeEntry(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig) const
+    {
+        uint256 entry;
+        CKeyID keyID = pubkey.GetID();
+        CSHA256 sha;
+        sha.Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(keyID.begin(), keyID.size());
+        if (!vchSig.empty())
+            sha.Write(&vchSig[0], vchSig.size());
+        sha.Finalize(entry.begin());
+        return entry;
+    }
+
+    bool Get(const uint256& entry)
+    {
+        LOCK(cs);
+        return setValid.count(entry);
+    }
+
+    void Set(const uint256& entry)
+    {
+        LOCK(cs);
+        while (setValid.size() >= OBFUSCATION_SIG_CACHE_SIZE) {
+            set_type::size_type s = GetRand(setValid.bucket_count());
+            set_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s)) {
+                setValid.erase(*it);
+            }
+        }
+        setValid.insert(entry);
+    }
+};
+
+CMessageSigCache& MessageSigCache()
+{
+    static CMessageSigCache cache;
+    return cache;
+}
+
+uint256 GetMessageHash(const std::string& strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strMessage;
+    return ss.GetHash();
+}
+
+bool IsSignedBy(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig)
+{
+    CPubKey pubkey2;
+    return pubkey2.RecoverCompact(hash, vchSig) && pubkey2.GetID() == pubkey.GetID();
+}
+
+} // anon namespace
+
 bool GetTestingCollateralScript(std::string strAddress, CScript& script)
 {
     if (!IsValidDestinationString(strAddress)) {
@@ -106,12 +195,13 @@ bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorM
 
 bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
 {
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << strMessageMagic;
-    ss << strMessage;
+    uint256 hash = GetMessageHash(strMessage);
+    uint256 entry = MessageSigCache().ComputeEntry(hash, pubkey, vchSig);
+    if (MessageSigCache().Get(entry))
+        return true;
 
     CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!pubkey2.RecoverCompact(hash, vchSig)) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
@@ -119,7 +209,57 @@ bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vc
     if (fDebug && pubkey2.GetID() != pubkey.GetID())
         LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
 
-    return (pubkey2.GetID() == pubkey.GetID());
+    if (pubkey2.GetID() != pubkey.GetID())
+        return false;
+
+    MessageSigCache().Set(entry);
+    return true;
+}
+
+std::vector<bool> CObfuScationSigner::VerifyMessages(const std::vector<CSignedMessage>& vMessages)
+{
+    CMessageSigCache& cache = MessageSigCache();
+    std::vector<bool> vValid(vMessages.size(), false);
+
+    // Signatures that are not known to be valid yet, each once
+    std::vector<uint256> vHashes(vMessages.size());
+    std::vector<uint256> vEntries(vMessages.size());
+    std::map<uint256, size_t> mapToCheck;
+    std::vector<size_t> vToCheck;
+    for (size_t i = 0; i < vMessages.size(); i++) {
+        vHashes[i] = GetMessageHash(vMessages[i].strMessage);
+        vEntries[i] = cache.ComputeEntry(vHashes[i], vMessages[i].pubkey, vMessages[i].vchSig);
+        if (cache.Get(vEntries[i])) {
+            vValid[i] = true;
+            continue;
+        }
+        if (mapToCheck.insert(std::make_pair(vEntries[i], vToCheck.size())).second)
+            vToCheck.push_back(i);
+    }
+
+    // Key recovery is the expensive part, so it is spread over a few threads
+    std::vector<char> vCheckValid(vToCheck.size(), 0);
+    auto checkRange = [&](size_t nBegin, size_t nEnd) {
+        for (size_t j = nBegin; j < nEnd; j++) {
+            size_t i = vToCheck[j];
+            vCheckValid[j] = IsSignedBy(vHashes[i], vMessages[i].pubkey, vMessages[i].vchSig);
+        }
+    };
+    size_t nBatches = (vToCheck.size() + OBFUSCATION_VERIFY_BATCH_SIZE - 1) / OBFUSCATION_VERIFY_BATCH_SIZE;
+    GetTaskPool().ParallelFor(TASKPOOL_NETWORK, nBatches, OBFUSCATION_VERIFY_MAX_THREADS, [&](size_t n) {
+        checkRange(n * OBFUSCATION_VERIFY_BATCH_SIZE, std::min((n + 1) * OBFUSCATION_VERIFY_BATCH_SIZE, vToCheck.size()));
+    });
+
+    for (size_t j = 0; j < vToCheck.size(); j++) {
+        if (vCheckValid[j])
+            cache.Set(vEntries[vToCheck[j]]);
+    }
+    for (size_t i = 0; i < vMessages.size(); i++) {
+        if (!vValid[i])
+            vValid[i] = vCheckValid[mapToCheck[vEntries[i]]];
+    }
+
+    return vValid;
 }
 
 //TODO: Rename/move to core
@@ -150,9 +290,6 @@ void ThreadCheckObfuScationPool()
                 zeronodePayments.CleanPaymentList();
                 CleanTransactionLocksList();
             }
-
-            if(c % ZERONODES_DUMP_SECONDS == 0) DumpZeronodes();
-
         }
     }
 }
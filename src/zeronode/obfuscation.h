@@ -24,12 +24,26 @@ class CActiveZeronode;
 #define ZERONODE_REJECTED 0
 #define ZERONODE_RESET -1
 
+// message signatures remembered as valid
+#define OBFUSCATION_SIG_CACHE_SIZE 50000
+// signatures verified by one thread of a batch, and the most threads of a batch
+#define OBFUSCATION_VERIFY_BATCH_SIZE 64
+#define OBFUSCATION_VERIFY_MAX_THREADS 4
+
 extern CObfuScationSigner obfuScationSigner;
 extern std::string strZeroNodePrivKey;
 extern CActiveZeronode activeZeronode;
 
 bool GetTestingCollateralScript(std::string strAddress, CScript& script);
 
+/** A signed Zeronode message, for checking several signatures at once
+ */
+struct CSignedMessage {
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+};
+
 /** Helper object for signing and checking signatures
  */
 class CObfuScationSigner
@@ -45,6 +59,8 @@ public:
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
     /// Verify the message, returns true if succcessful
     bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
+    /// Verify a batch of messages on several threads, each distinct signature once; returns whether each one is valid
+    std::vector<bool> VerifyMessages(const std::vector<CSignedMessage>& vMessages);
 };
 
 void ThreadCheckObfuScationPool();
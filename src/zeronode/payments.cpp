@@ -22,7 +22,7 @@
 /** Object for who's going to get paid on which blocks */
 CZeronodePayments zeronodePayments;
 
-CCriticalSection cs_vecPayments;
+boost::shared_mutex cs_vecPayments;
 CCriticalSection cs_mapZeronodeBlocks;
 CCriticalSection cs_mapZeronodePayeeVotes;
 
@@ -84,13 +84,14 @@ CZeronodePaymentDB::ReadResult CZeronodePaymentDB::Read(CZeronodePayments& objTo
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    // read the data straight into the stream it is deserialized from
+    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+    ssObj.resize(dataSize);
     uint256 hashIn;
 
     // read data and checksum from file
     try {
-        filein.read((char*)&vchData[0], dataSize);
+        filein.read((char*)&ssObj[0], dataSize);
         filein >> hashIn;
     } catch (std::exception& e) {
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -98,8 +99,6 @@ CZeronodePaymentDB::ReadResult CZeronodePaymentDB::Read(CZeronodePayments& objTo
     }
     filein.fclose();
 
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
     uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
     if (hashIn != hashTmp) {
@@ -290,10 +289,7 @@ void CZeronodePayments::FillBlockPayee(CMutableTransaction& txNew, int64_t nFees
     //spork
     if(!zeronodePayments.GetBlockPayee(nHeight, payee)){
         //no zeronode detected
-        CZeronode* winningNode = znodeman.GetCurrentZeroNode(1);
-        if (winningNode) {
-            payee = GetScriptForDestination(winningNode->pubKeyCollateralAddress.GetID());
-        } else {
+        if (!GetFallbackPayee(nHeight, payee)) {
             LogPrint("zeronode","CreateNewBlock: Failed to detect zeronode to pay\n");
             hasPayment = false;
         }
@@ -337,6 +333,37 @@ void CZeronodePayments::FillBlockPayee(CMutableTransaction& txNew, int64_t nFees
     LogPrint("zeronode","Total Coinbase to %s\n", FormatMoney(txNew.vout[0].nValue+txFounders.nValue+txZeronodes.nValue).c_str());
 }
 
+bool CZeronodePayments::GetFallbackPayee(int nBlockHeight, CScript& payee)
+{
+    AssertLockHeld(cs_main);
+
+    // Ranking the zeronodes is the slow part of filling in a template, and
+    // the answer only changes with the tip
+    if (nFallbackPayeeHeight != nBlockHeight) {
+        CZeronode* winningNode = znodeman.GetCurrentZeroNode(1);
+        fHasFallbackPayee = winningNode != NULL;
+        if (winningNode)
+            fallbackPayee = GetScriptForDestination(winningNode->pubKeyCollateralAddress.GetID());
+        nFallbackPayeeHeight = nBlockHeight;
+    }
+
+    if (fHasFallbackPayee)
+        payee = fallbackPayee;
+    return fHasFallbackPayee;
+}
+
+void CZeronodePayments::PrecomputeBlockPayee()
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (!pindexPrev) return;
+
+    CScript payee;
+    int nHeight = pindexPrev->nHeight + 1;
+    if (!GetBlockPayee(nHeight, payee))
+        GetFallbackPayee(nHeight, payee);
+}
+
 int CZeronodePayments::GetMinZeronodePaymentsProto()
 {
         return MIN_PEER_PROTO_VERSION_ENFORCEMENT; // Also allow old peers as long as they are allowed to run
@@ -448,13 +475,24 @@ bool CZeronodePaymentWinner::Sign(CKey& keyZeronode, CPubKey& pubKeyZeronode)
 
 bool CZeronodePayments::GetBlockPayee(int nBlockHeight, CScript& payee)
 {
-    if (mapZeronodeBlocks.count(nBlockHeight)) {
-        return mapZeronodeBlocks[nBlockHeight].GetPayee(payee);
+    LOCK(cs_mapZeronodeBlocks);
+
+    std::map<int, CZeronodeBlockPayees>::iterator it = mapZeronodeBlocks.find(nBlockHeight);
+    if (it != mapZeronodeBlocks.end()) {
+        return (*it).second.GetPayee(payee);
     }
 
     return false;
 }
 
+bool CZeronodePayments::HasPayeeWithVotes(int nBlockHeight, const CScript& payee, int nVotesReq)
+{
+    LOCK(cs_mapZeronodeBlocks);
+
+    std::map<int, CZeronodeBlockPayees>::iterator it = mapZeronodeBlocks.find(nBlockHeight);
+    return it != mapZeronodeBlocks.end() && (*it).second.HasPayeeWithVotes(payee, nVotesReq);
+}
+
 // Is this zeronode scheduled to get paid soon?
 // -- Only look ahead up to 8 blocks to allow for propagation of the latest 2 winners
 bool CZeronodePayments::IsScheduled(CZeronode& zn, int nNotBlockHeight)
@@ -507,17 +545,15 @@ bool CZeronodePayments::AddWinningZeronode(CZeronodePaymentWinner& winnerIn)
             CZeronodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapZeronodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
-    }
 
-    mapZeronodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        mapZeronodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+    }
 
     return true;
 }
 
 bool CZeronodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
-    LOCK(cs_vecPayments);
-
 	int nMaxSignatures = 0;
     int nZeronode_Drift_Count = 0;
 
@@ -538,13 +574,13 @@ bool CZeronodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 
     CAmount requiredZeronodePayment = GetZeronodePayment(nBlockHeight, nReward, nZeronode_Drift_Count);
 
+    // the zeronode counts above take znodeman.cs, which comes before cs_vecPayments
+    boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
+
 	//require at least 6 signatures
-	BOOST_FOREACH (CZeronodePayee& payee, vecPayments)
-    {
-        LogPrint("zeronode","Zeronode payment nVotes=%d nMaxSignatures=%d\n", payee.nVotes, nMaxSignatures);
-		if (payee.nVotes >= nMaxSignatures && payee.nVotes >= ZNPAYMENTS_SIGNATURES_REQUIRED)
-			nMaxSignatures = payee.nVotes;
-    }
+	if (nLeader >= 0 && vecPayments[nLeader].nVotes >= ZNPAYMENTS_SIGNATURES_REQUIRED)
+		nMaxSignatures = vecPayments[nLeader].nVotes;
+	LogPrint("zeronode","Zeronode payment nMaxSignatures=%d\n", nMaxSignatures);
 
 	//if we don't have at least 6 signatures on a payee, approve whichever is the longest chain
 	if (nMaxSignatures < ZNPAYMENTS_SIGNATURES_REQUIRED) return true;
@@ -582,7 +618,7 @@ bool CZeronodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 
 std::string CZeronodeBlockPayees::GetRequiredPaymentsString()
 {
-    LOCK(cs_vecPayments);
+    boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
 
     std::string ret = "Unknown";
 
@@ -613,15 +649,23 @@ std::string CZeronodePayments::GetRequiredPaymentsString(int nBlockHeight)
 
 bool CZeronodePayments::IsTransactionValid(const CTransaction& txNew, int nBlockHeight)
 {
-    LOCK(cs_mapZeronodeBlocks);
+    // validate a copy, the check counts the zeronodes and must not hold
+    // cs_mapZeronodeBlocks meanwhile
+    CZeronodeBlockPayees blockPayees;
+    {
+        LOCK(cs_mapZeronodeBlocks);
 
-    LogPrint("zeronode", "mapZeronodeBlocks size = %d, nBlockHeight = %d", mapZeronodeBlocks.size(), nBlockHeight);
-    if (mapZeronodeBlocks.count(nBlockHeight)) {
-        LogPrint("zeronode", "mapZeronodeBlocks check transaction");
-        return mapZeronodeBlocks[nBlockHeight].IsTransactionValid(txNew);
+        LogPrint("zeronode", "mapZeronodeBlocks size = %d, nBlockHeight = %d", mapZeronodeBlocks.size(), nBlockHeight);
+        std::map<int, CZeronodeBlockPayees>::iterator it = mapZeronodeBlocks.find(nBlockHeight);
+        if (it == mapZeronodeBlocks.end())
+            return true;
+
+        boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
+        blockPayees = (*it).second;
     }
 
-    return true;
+    LogPrint("zeronode", "mapZeronodeBlocks check transaction");
+    return blockPayees.IsTransactionValid(txNew);
 }
 
 void CZeronodePayments::CleanPaymentList()
@@ -785,8 +829,6 @@ bool CZeronodePaymentWinner::SignatureValid()
 
 void CZeronodePayments::Sync(CNode* node, int nCountNeeded)
 {
-    LOCK(cs_mapZeronodePayeeVotes);
-
     int nHeight;
     {
         TRY_LOCK(cs_main, locked);
@@ -797,17 +839,23 @@ void CZeronodePayments::Sync(CNode* node, int nCountNeeded)
     int nCount = (znodeman.CountEnabled() * 1.25);
     if (nCountNeeded > nCount) nCountNeeded = nCount;
 
-    int nInvCount = 0;
-    std::map<uint256, CZeronodePaymentWinner>::iterator it = mapZeronodePayeeVotes.begin();
-    while (it != mapZeronodePayeeVotes.end()) {
-        CZeronodePaymentWinner winner = (*it).second;
-        if (winner.nBlockHeight >= nHeight - nCountNeeded && winner.nBlockHeight <= nHeight + 20) {
-            node->PushInventory(CInv(MSG_ZERONODE_WINNER, winner.GetHash()));
-            nInvCount++;
+    // collect the inventory first and push it without holding the votes
+    std::vector<CInv> vInv;
+    {
+        LOCK(cs_mapZeronodePayeeVotes);
+
+        std::map<uint256, CZeronodePaymentWinner>::iterator it = mapZeronodePayeeVotes.begin();
+        while (it != mapZeronodePayeeVotes.end()) {
+            const CZeronodePaymentWinner& winner = (*it).second;
+            if (winner.nBlockHeight >= nHeight - nCountNeeded && winner.nBlockHeight <= nHeight + 20)
+                vInv.push_back(CInv(MSG_ZERONODE_WINNER, (*it).first));
+            ++it;
         }
-        ++it;
     }
-    node->PushMessage("ssc", ZERONODE_SYNC_ZNW, nInvCount);
+
+    BOOST_FOREACH (const CInv& inv, vInv)
+        node->PushInventory(inv);
+    node->PushMessage("ssc", ZERONODE_SYNC_ZNW, (int)vInv.size());
 }
 
 std::string CZeronodePayments::ToString() const
@@ -819,6 +867,19 @@ std::string CZeronodePayments::ToString() const
     return info.str();
 }
 
+size_t CZeronodePayments::DynamicMemoryUsage() const
+{
+    LOCK2(cs_mapZeronodePayeeVotes, cs_mapZeronodeBlocks);
+    size_t nUsage = memusage::DynamicUsage(mapZeronodePayeeVotes) + memusage::DynamicUsage(mapZeronodeBlocks) +
+                    memusage::DynamicUsage(mapZeronodesLastVote);
+    for (const auto& vote : mapZeronodePayeeVotes)
+        nUsage += RecursiveDynamicUsage(vote.second.payee) + memusage::DynamicUsage(vote.second.vchSig);
+    boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
+    for (const auto& block : mapZeronodeBlocks)
+        nUsage += memusage::DynamicUsage(block.second.vecPayments);
+    return nUsage;
+}
+
 
 int CZeronodePayments::GetOldestBlock()
 {
@@ -12,10 +12,18 @@
 #include "main.h"
 #include "zeronode/zeronode.h"
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 using namespace std;
 
-extern CCriticalSection cs_vecPayments;
+/*
+ * Lock order: znodeman.cs, then cs_mapZeronodePayeeVotes, then
+ * cs_mapZeronodeBlocks, then cs_vecPayments. cs_main is only tried while
+ * holding any of them. cs_vecPayments guards the payee lists of all the
+ * CZeronodeBlockPayees; it is shared by the readers and not recursive, so
+ * nothing may take it again or call out of this file while holding it.
+ */
+extern boost::shared_mutex cs_vecPayments;
 extern CCriticalSection cs_mapZeronodeBlocks;
 extern CCriticalSection cs_mapZeronodePayeeVotes;
 
@@ -91,6 +99,19 @@ public:
 // Keep track of votes for payees from zeronodes
 class CZeronodeBlockPayees
 {
+private:
+    //! Index in vecPayments of the first payee with the most votes, -1 if none
+    int nLeader;
+
+    void FindLeader()
+    {
+        nLeader = -1;
+        for (size_t i = 0; i < vecPayments.size(); i++) {
+            if (nLeader < 0 || vecPayments[i].nVotes > vecPayments[nLeader].nVotes)
+                nLeader = i;
+        }
+    }
+
 public:
     int nBlockHeight;
     std::vector<CZeronodePayee> vecPayments;
@@ -98,47 +119,59 @@ public:
     CZeronodeBlockPayees()
     {
         nBlockHeight = 0;
+        nLeader = -1;
         vecPayments.clear();
     }
     CZeronodeBlockPayees(int nBlockHeightIn)
     {
         nBlockHeight = nBlockHeightIn;
+        nLeader = -1;
         vecPayments.clear();
     }
 
     void AddPayee(CScript payeeIn, int nIncrement)
     {
-        LOCK(cs_vecPayments);
-
-        BOOST_FOREACH (CZeronodePayee& payee, vecPayments) {
-            if (payee.scriptPubKey == payeeIn) {
-                payee.nVotes += nIncrement;
+        boost::unique_lock<boost::shared_mutex> lock(cs_vecPayments);
+
+        for (size_t i = 0; i < vecPayments.size(); i++) {
+            if (vecPayments[i].scriptPubKey == payeeIn) {
+                vecPayments[i].nVotes += nIncrement;
+                if (nIncrement < 0)
+                    FindLeader();
+                else if ((int)i < nLeader ? vecPayments[i].nVotes >= vecPayments[nLeader].nVotes : vecPayments[i].nVotes > vecPayments[nLeader].nVotes)
+                    nLeader = i;
                 return;
             }
         }
 
         CZeronodePayee c(payeeIn, nIncrement);
         vecPayments.push_back(c);
+        if (nLeader < 0 || c.nVotes > vecPayments[nLeader].nVotes)
+            nLeader = vecPayments.size() - 1;
     }
 
     bool GetPayee(CScript& payee)
     {
-        LOCK(cs_vecPayments);
+        boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
 
-        int nVotes = -1;
-        BOOST_FOREACH (CZeronodePayee& p, vecPayments) {
-            if (p.nVotes > nVotes) {
-                payee = p.scriptPubKey;
-                nVotes = p.nVotes;
-            }
-        }
+        if (nLeader < 0 || vecPayments[nLeader].nVotes < 0)
+            return false;
 
-        return (nVotes > -1);
+        payee = vecPayments[nLeader].scriptPubKey;
+        return true;
     }
 
-    bool HasPayeeWithVotes(CScript payee, int nVotesReq)
+    /** Votes of the leading payee, -1 without payees */
+    int GetMaxVotes()
     {
-        LOCK(cs_vecPayments);
+        boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
+
+        return nLeader < 0 ? -1 : vecPayments[nLeader].nVotes;
+    }
+
+    bool HasPayeeWithVotes(const CScript& payee, int nVotesReq)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_vecPayments);
 
         BOOST_FOREACH (CZeronodePayee& p, vecPayments) {
             if (p.nVotes >= nVotesReq && p.scriptPubKey == payee) return true;
@@ -157,6 +190,8 @@ public:
     {
         READWRITE(nBlockHeight);
         READWRITE(vecPayments);
+        if (ser_action.ForRead())
+            FindLeader();
     }
 };
 
@@ -238,6 +273,14 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    //! Zeronode to pay at nFallbackPayeeHeight when no winner has been
+    //! voted, protected by cs_main
+    int nFallbackPayeeHeight;
+    bool fHasFallbackPayee;
+    CScript fallbackPayee;
+
+    bool GetFallbackPayee(int nBlockHeight, CScript& payee);
+
 public:
     std::map<uint256, CZeronodePaymentWinner> mapZeronodePayeeVotes;
     std::map<int, CZeronodeBlockPayees> mapZeronodeBlocks;
@@ -247,11 +290,13 @@ public:
     {
         nSyncedFromPeer = 0;
         nLastBlockHeight = 0;
+        nFallbackPayeeHeight = -1;
+        fHasFallbackPayee = false;
     }
 
     void Clear()
     {
-        LOCK2(cs_mapZeronodeBlocks, cs_mapZeronodePayeeVotes);
+        LOCK2(cs_mapZeronodePayeeVotes, cs_mapZeronodeBlocks);
         mapZeronodeBlocks.clear();
         mapZeronodePayeeVotes.clear();
     }
@@ -264,6 +309,7 @@ public:
     int LastPayment(CZeronode& zn);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
+    bool HasPayeeWithVotes(int nBlockHeight, const CScript& payee, int nVotesReq);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CZeronode& zn, int nNotBlockHeight);
 
@@ -286,7 +332,11 @@ public:
     void ProcessMessageZeronodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, int64_t nFees, CTxOut& txFounders, CTxOut& txZeronodes);
+    /** Work out the fallback payee of the block after the tip ahead of the first template */
+    void PrecomputeBlockPayee();
     std::string ToString() const;
+    //! Estimated heap usage of the payee votes and block payees
+    size_t DynamicMemoryUsage() const;
     int GetOldestBlock();
     int GetNewestBlock();
 
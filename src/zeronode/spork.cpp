@@ -16,6 +16,8 @@
 #include "consensus/validation.h"
 #include <boost/lexical_cast.hpp>
 
+#include <atomic>
+
 using namespace std;
 using namespace boost;
 
@@ -27,6 +29,48 @@ CSporkManager sporkManager;
 std::map<uint256, CSporkMessage> mapSporks;
 std::map<int, CSporkMessage> mapSporksActive;
 
+namespace {
+
+/*
+ * The current value of every spork, readable from any thread without a lock.
+ * mapSporksActive is only touched by the message handler, while the sporks
+ * are asked for by block validation, the miner and the RPC threads.
+ */
+std::atomic<int64_t> vSporkValues[SPORK_END - SPORK_START + 1];
+std::atomic<uint64_t> nSporkVersion(0);
+
+int64_t GetSporkDefault(int nSporkID)
+{
+    if (nSporkID == SPORK_2_SWIFTTX) return SPORK_2_SWIFTTX_DEFAULT;
+    if (nSporkID == SPORK_3_SWIFTTX_BLOCK_FILTERING) return SPORK_3_SWIFTTX_BLOCK_FILTERING_DEFAULT;
+    if (nSporkID == SPORK_6_ZERONODE_FULL_PAYMENT_ENABLED) return SPORK_6_ZERONODE_FULL_PAYMENT_ENABLED_DEFAULT;
+    if (nSporkID == SPORK_7_ZERONODE_PAYMENT_ENABLED) return SPORK_7_ZERONODE_PAYMENT_ENABLED_DEFAULT;
+    if (nSporkID == SPORK_8_ZERONODE_PAYMENT_ENFORCEMENT) return SPORK_8_ZERONODE_PAYMENT_ENFORCEMENT_DEFAULT;
+    if (nSporkID == SPORK_9_ZERONODE_BUDGET_ENFORCEMENT) return SPORK_9_ZERONODE_BUDGET_ENFORCEMENT_DEFAULT;
+    if (nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) return SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
+    return -1;
+}
+
+struct CSporkValuesInit
+{
+    CSporkValuesInit()
+    {
+        for (int i = SPORK_START; i <= SPORK_END; ++i)
+            vSporkValues[i - SPORK_START] = GetSporkDefault(i);
+    }
+} sporkValuesInit;
+
+void SetActiveSpork(const CSporkMessage& spork)
+{
+    mapSporksActive[spork.nSporkID] = spork;
+    if (spork.nSporkID >= SPORK_START && spork.nSporkID <= SPORK_END) {
+        vSporkValues[spork.nSporkID - SPORK_START] = spork.nValue;
+        ++nSporkVersion;
+    }
+}
+
+} // anon namespace
+
 // Zero: on startup load spork values from previous session if they exist in the sporkDB
 void LoadSporksFromDB()
 {
@@ -44,7 +88,7 @@ void LoadSporksFromDB()
 
         // add spork to memory
         mapSporks[spork.GetHash()] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        SetActiveSpork(spork);
         std::time_t result = spork.nValue;
         // If SPORK Value is greater than 1,000,000 assume it's actually a Date and then convert to a more readable format
         if (spork.nValue > 1000000) {
@@ -93,7 +137,7 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
         }
 
         mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        SetActiveSpork(spork);
         sporkManager.Relay(spork);
 
         // Zero: add to spork database.
@@ -115,23 +159,19 @@ int64_t GetSporkValue(int nSporkID)
 {
     int64_t r = -1;
 
-    if (mapSporksActive.count(nSporkID)) {
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        if (nSporkID == SPORK_2_SWIFTTX) r = SPORK_2_SWIFTTX_DEFAULT;
-        if (nSporkID == SPORK_3_SWIFTTX_BLOCK_FILTERING) r = SPORK_3_SWIFTTX_BLOCK_FILTERING_DEFAULT;
-        if (nSporkID == SPORK_6_ZERONODE_FULL_PAYMENT_ENABLED) r = SPORK_6_ZERONODE_FULL_PAYMENT_ENABLED_DEFAULT;
-        if (nSporkID == SPORK_7_ZERONODE_PAYMENT_ENABLED) r = SPORK_7_ZERONODE_PAYMENT_ENABLED_DEFAULT;
-        if (nSporkID == SPORK_8_ZERONODE_PAYMENT_ENFORCEMENT) r = SPORK_8_ZERONODE_PAYMENT_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_9_ZERONODE_BUDGET_ENFORCEMENT) r = SPORK_9_ZERONODE_BUDGET_ENFORCEMENT_DEFAULT;
-        if (nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) r = SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
-
-        if (r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
-    }
+    if (nSporkID >= SPORK_START && nSporkID <= SPORK_END)
+        r = vSporkValues[nSporkID - SPORK_START];
+
+    if (r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
 
     return r;
 }
 
+uint64_t GetSporkVersion()
+{
+    return nSporkVersion;
+}
+
 // grab the spork value, and see if it's off
 bool IsSporkActive(int nSporkID)
 {
@@ -221,7 +261,7 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
     if (Sign(msg)) {
         Relay(msg);
         mapSporks[msg.GetHash()] = msg;
-        mapSporksActive[nSporkID] = msg;
+        SetActiveSpork(msg);
         return true;
     }
 
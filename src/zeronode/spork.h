@@ -56,6 +56,8 @@ void LoadSporksFromDB();
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 int64_t GetSporkValue(int nSporkID);
 bool IsSporkActive(int nSporkID);
+/** Bumped whenever a spork value changes, for callers that cache what they derive from sporks */
+uint64_t GetSporkVersion();
 void ReprocessBlocks(int nBlocks);
 
 //
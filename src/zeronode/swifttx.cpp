@@ -24,6 +24,7 @@ std::map<uint256, CTransaction> mapTxLockReq;
 std::map<uint256, CTransaction> mapTxLockReqRejected;
 std::map<uint256, CConsensusVote> mapTxLockVote;
 std::map<uint256, CTransactionLock> mapTxLocks;
+std::map<uint256, CTxLockCertificate> mapTxLockCert;
 std::map<COutPoint, uint256> mapLockedInputs;
 std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
 int nCompleteTXLocks;
@@ -83,6 +84,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             DoConsensusVote(tx, nBlockHeight);
 
             mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            mempool.SetLockRequest(tx.GetHash());
 
             LogPrintf("ProcessMessageSwiftTX::ix - Transaction Lock Request: %s %s : accepted %s\n",
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
@@ -161,6 +163,39 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             RelayInv(inv);
         }
 
+        return;
+    } else if (strCommand == "txlcert") // SwiftX Lock Certificate
+    {
+        CTxLockCertificate cert;
+        vRecv >> cert;
+
+        CInv inv(MSG_TXLOCK_CERT, cert.txHash);
+        pfrom->AddInventoryKnown(inv);
+
+        if (mapTxLockCert.count(cert.txHash)) {
+            return;
+        }
+
+        std::vector<CConsensusVote> vVotes;
+        if (!cert.IsValid(vVotes)) {
+            // can be caused by a different view of the zeronode list, leave it to the votes
+            LogPrint("swiftx", "ProcessMessageSwiftTX::txlcert - Invalid certificate %s\n", cert.txHash.ToString());
+            return;
+        }
+
+        mapTxLockCert.insert(make_pair(cert.txHash, cert));
+
+        BOOST_FOREACH (CConsensusVote& ctx, vVotes) {
+            if (mapTxLockVote.count(ctx.GetHash())) continue;
+
+            // the votes are known from now on and will not be requested one by one
+            mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
+            pfrom->AddInventoryKnown(CInv(MSG_TXLOCK_VOTE, ctx.GetHash()));
+            AddConsensusVote(ctx);
+        }
+
+        LogPrint("swiftx", "ProcessMessageSwiftTX::txlcert - Transaction Lock Certificate %s with %d votes\n", cert.txHash.ToString(), vVotes.size());
+        RelayInv(inv);
         return;
     }
 }
@@ -318,6 +353,12 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         return false;
     }
 
+    return AddConsensusVote(ctx);
+}
+
+//add a checked consensus vote to its transaction lock
+bool AddConsensusVote(CConsensusVote& ctx)
+{
     if (!mapTxLocks.count(ctx.txHash)) {
         LogPrintf("SwiftX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
 
@@ -348,6 +389,16 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         if ((*i).second.CountSignatures() >= SWIFTTX_SIGNATURES_REQUIRED) {
             LogPrint("swiftx", "SwiftX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
 
+            // offer the complete lock to peers that did not see all of its votes yet
+            if (!mapTxLockCert.count(ctx.txHash)) {
+                CTxLockCertificate cert;
+                if (cert.FromLock((*i).second)) {
+                    mapTxLockCert.insert(make_pair(ctx.txHash, cert));
+                    CInv inv(MSG_TXLOCK_CERT, ctx.txHash);
+                    RelayInv(inv);
+                }
+            }
+
             CTransaction& tx = mapTxLockReq[ctx.txHash];
             if (!CheckForConflictingLocks(tx)) {
 #ifdef ENABLE_WALLET
@@ -443,6 +494,7 @@ void CleanTransactionLocksList()
                     mapTxLockVote.erase(v.GetHash());
             }
 
+            mapTxLockCert.erase(it->second.txHash);
             mapTxLocks.erase(it++);
         } else {
             it++;
@@ -457,20 +509,28 @@ uint256 CConsensusVote::GetHash() const
 }
 
 
+bool CConsensusVote::GetSignedMessage(CSignedMessage& msg)
+{
+    CZeronode* pzn = znodeman.Find(vinZeronode);
+    if (pzn == NULL) return false;
+
+    msg.pubkey = pzn->pubKeyZeronode;
+    msg.vchSig = vchZeroNodeSignature;
+    msg.strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
+    return true;
+}
+
 bool CConsensusVote::SignatureValid()
 {
     std::string errorMessage;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
-    //LogPrintf("verify strMessage %s \n", strMessage.c_str());
-
-    CZeronode* pzn = znodeman.Find(vinZeronode);
+    CSignedMessage msg;
 
-    if (pzn == NULL) {
+    if (!GetSignedMessage(msg)) {
         LogPrintf("SwiftX::CConsensusVote::SignatureValid() - Unknown Zeronode\n");
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pzn->pubKeyZeronode, vchZeroNodeSignature, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyMessage(msg.pubkey, msg.vchSig, msg.strMessage, errorMessage)) {
         LogPrintf("SwiftX::CConsensusVote::SignatureValid() - Verify message failed\n");
         return false;
     }
@@ -509,6 +569,7 @@ bool CConsensusVote::Sign()
 
 bool CTransactionLock::SignaturesValid()
 {
+    std::vector<CSignedMessage> vMessages;
     BOOST_FOREACH (CConsensusVote vote, vecConsensusVotes) {
         int n = znodeman.GetZeronodeRank(vote.vinZeronode, vote.nBlockHeight, MIN_SWIFTTX_PROTO_VERSION);
 
@@ -522,10 +583,18 @@ bool CTransactionLock::SignaturesValid()
             return false;
         }
 
-        if (!vote.SignatureValid()) {
-            LogPrintf("CTransactionLock::SignaturesValid() - Signature not valid\n");
+        CSignedMessage msg;
+        if (!vote.GetSignedMessage(msg)) {
+            LogPrintf("CTransactionLock::SignaturesValid() - Unknown Zeronode\n");
             return false;
         }
+        vMessages.push_back(msg);
+    }
+
+    std::vector<bool> vValid = obfuScationSigner.VerifyMessages(vMessages);
+    if (std::find(vValid.begin(), vValid.end(), false) != vValid.end()) {
+        LogPrintf("CTransactionLock::SignaturesValid() - Signature not valid\n");
+        return false;
     }
 
     return true;
@@ -553,3 +622,80 @@ int CTransactionLock::CountSignatures()
     }
     return n;
 }
+
+bool CTxLockCertificate::FromLock(CTransactionLock& lock)
+{
+    std::vector<std::vector<unsigned char> > vvchByRank(SWIFTTX_SIGNATURES_TOTAL);
+
+    txHash = lock.txHash;
+    nBlockHeight = lock.nBlockHeight;
+    nSigners = 0;
+    vvchSigs.clear();
+
+    BOOST_FOREACH (CConsensusVote& vote, lock.vecConsensusVotes) {
+        if (vote.nBlockHeight != nBlockHeight) continue;
+
+        int n = znodeman.GetZeronodeRank(vote.vinZeronode, nBlockHeight, MIN_SWIFTTX_PROTO_VERSION);
+        if (n < 1 || n > SWIFTTX_SIGNATURES_TOTAL) continue;
+
+        nSigners |= 1 << (n - 1);
+        vvchByRank[n - 1] = vote.vchZeroNodeSignature;
+    }
+
+    for (int i = 0; i < SWIFTTX_SIGNATURES_TOTAL; i++) {
+        if (nSigners & (1 << i))
+            vvchSigs.push_back(vvchByRank[i]);
+    }
+
+    return CountSigners() >= SWIFTTX_SIGNATURES_REQUIRED;
+}
+
+int CTxLockCertificate::CountSigners() const
+{
+    int n = 0;
+    for (int i = 0; i < SWIFTTX_SIGNATURES_TOTAL; i++) {
+        if (nSigners & (1 << i))
+            n++;
+    }
+    return n;
+}
+
+bool CTxLockCertificate::GetVotes(std::vector<CConsensusVote>& vVotes) const
+{
+    vVotes.clear();
+
+    if (nSigners >> SWIFTTX_SIGNATURES_TOTAL) return false;
+    if ((int)vvchSigs.size() != CountSigners()) return false;
+
+    for (int i = 0; i < SWIFTTX_SIGNATURES_TOTAL; i++) {
+        if (!(nSigners & (1 << i))) continue;
+
+        CZeronode* pzn = znodeman.GetZeronodeByRank(i + 1, nBlockHeight, MIN_SWIFTTX_PROTO_VERSION);
+        if (pzn == NULL) return false;
+
+        CConsensusVote vote;
+        vote.vinZeronode = pzn->vin;
+        vote.txHash = txHash;
+        vote.nBlockHeight = nBlockHeight;
+        vote.vchZeroNodeSignature = vvchSigs[vVotes.size()];
+        vVotes.push_back(vote);
+    }
+
+    return true;
+}
+
+bool CTxLockCertificate::IsValid(std::vector<CConsensusVote>& vVotes) const
+{
+    if (CountSigners() < SWIFTTX_SIGNATURES_REQUIRED) return false;
+    if (!GetVotes(vVotes)) return false;
+
+    std::vector<CSignedMessage> vMessages;
+    BOOST_FOREACH (CConsensusVote& vote, vVotes) {
+        CSignedMessage msg;
+        if (!vote.GetSignedMessage(msg)) return false;
+        vMessages.push_back(msg);
+    }
+
+    std::vector<bool> vValid = obfuScationSigner.VerifyMessages(vMessages);
+    return std::find(vValid.begin(), vValid.end(), false) == vValid.end();
+}
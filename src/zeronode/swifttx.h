@@ -33,6 +33,8 @@ using namespace boost;
 class CConsensusVote;
 class CTransaction;
 class CTransactionLock;
+class CTxLockCertificate;
+struct CSignedMessage;
 
 static const int MIN_SWIFTTX_PROTO_VERSION = 70103;
 
@@ -40,6 +42,7 @@ extern map<uint256, CTransaction> mapTxLockReq;
 extern map<uint256, CTransaction> mapTxLockReqRejected;
 extern map<uint256, CConsensusVote> mapTxLockVote;
 extern map<uint256, CTransactionLock> mapTxLocks;
+extern map<uint256, CTxLockCertificate> mapTxLockCert;
 extern std::map<COutPoint, uint256> mapLockedInputs;
 extern int nCompleteTXLocks;
 
@@ -59,6 +62,9 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight);
 //process consensus vote message
 bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx);
 
+//add a consensus vote whose rank and signature were checked
+bool AddConsensusVote(CConsensusVote& ctx);
+
 // keep transaction locks in memory for an hour
 void CleanTransactionLocksList();
 
@@ -74,6 +80,8 @@ public:
 
     uint256 GetHash() const;
 
+    /// The signed message of this vote, false if its Zeronode is unknown
+    bool GetSignedMessage(CSignedMessage& msg);
     bool SignatureValid();
     bool Sign();
 
@@ -108,5 +116,43 @@ public:
     }
 };
 
+/**
+ * The votes of a complete transaction lock in one message. The signers are
+ * given by their rank at nBlockHeight instead of their vin, so that the
+ * certificate is checked against the cached ranking and all of its
+ * signatures are verified together.
+ */
+class CTxLockCertificate
+{
+public:
+    uint256 txHash;
+    int nBlockHeight;
+    //! Bit i is set when the zeronode of rank i + 1 signed
+    uint16_t nSigners;
+    //! Signatures of the signers, lowest rank first
+    std::vector<std::vector<unsigned char> > vvchSigs;
+
+    CTxLockCertificate() : nBlockHeight(0), nSigners(0) {}
+
+    /** Collect the votes of the lock that are at its block height and in the top ranks */
+    bool FromLock(CTransactionLock& lock);
+    int CountSigners() const;
+    /** The votes the certificate stands for; false if a signer is unknown */
+    bool GetVotes(std::vector<CConsensusVote>& vVotes) const;
+    /** Check the votes of GetVotes() and all their signatures */
+    bool IsValid(std::vector<CConsensusVote>& vVotes) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(txHash);
+        READWRITE(nBlockHeight);
+        READWRITE(nSigners);
+        READWRITE(vvchSigs);
+    }
+};
+
 
 #endif
@@ -136,6 +136,7 @@ CZeronode::CZeronode(const CZeronodeBroadcast& znb)
 bool CZeronode::UpdateFromNewBroadcast(CZeronodeBroadcast& znb)
 {
     if (znb.sigTime > sigTime) {
+        znodeman.ZeronodeUpdated(vin, pubKeyZeronode != znb.pubKeyZeronode || pubKeyCollateralAddress != znb.pubKeyCollateralAddress);
         pubKeyZeronode = znb.pubKeyZeronode;
         pubKeyCollateralAddress = znb.pubKeyCollateralAddress;
         sigTime = znb.sigTime;
@@ -196,27 +197,23 @@ void CZeronode::Check(bool forceCheck)
         return;
     }
 
+    // Spends arriving in the mempool or in blocks flag the collateral through
+    // CZeronodeMan::SyncTransaction; this only looks the outpoint up to catch
+    // spends from before the Zeronode was known
     if (!unitTest) {
-        CValidationState state;
-        CMutableTransaction tx = CMutableTransaction();
-        CScript scriptPubKey;
-        if (!GetTestingCollateralScript(Params().ZeronodeDummyAddress(), scriptPubKey)){
-            LogPrintf("%s: Failed to get a valid scriptPubkey\n", __func__);
+        TRY_LOCK(cs_main, lockMain);
+        if (!lockMain) return;
+
+        const CCoins* coins = pcoinsTip->AccessCoins(vin.prevout.hash);
+        if (coins == NULL || !coins->IsAvailable(vin.prevout.n)) {
+            activeState = ZERONODE_VIN_SPENT;
             return;
         }
 
-        CTxOut vout = CTxOut(9999.99 * COIN, scriptPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-
-        {
-            TRY_LOCK(cs_main, lockMain);
-            if (!lockMain) return;
-
-            if (!AcceptableInputs(mempool, state, CTransaction(tx), false, NULL)) {
-                activeState = ZERONODE_VIN_SPENT;
-                return;
-            }
+        LOCK(mempool.cs);
+        if (mempool.mapNextTx.count(vin.prevout)) {
+            activeState = ZERONODE_VIN_SPENT;
+            return;
         }
     }
 
@@ -269,14 +266,12 @@ int64_t CZeronode::GetLastPaid()
         }
         n++;
 
-        if (zeronodePayments.mapZeronodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if (zeronodePayments.mapZeronodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(znpayee, 2)) {
-                return BlockReading->nTime + nOffset;
-            }
+        /*
+            Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
+            to converge on the same payees quickly, then keep the same schedule.
+        */
+        if (zeronodePayments.HasPayeeWithVotes(BlockReading->nHeight, znpayee, 2)) {
+            return BlockReading->nTime + nOffset;
         }
 
         if (BlockReading->pprev == NULL) {
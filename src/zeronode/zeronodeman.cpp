@@ -28,19 +28,13 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-        const pair<int64_t, CTxIn>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
-struct CompareScoreMN {
-    bool operator()(const pair<int64_t, CZeronode>& t1,
-        const pair<int64_t, CZeronode>& t2) const
+struct CompareScoreDesc {
+    bool operator()(const pair<arith_uint256, size_t>& t1,
+        const pair<arith_uint256, size_t>& t2) const
     {
-        return t1.first < t2.first;
+        if (t1.first != t2.first)
+            return t1.first > t2.first;
+        return t1.second < t2.second;
     }
 };
 
@@ -104,13 +98,14 @@ CZeronodeDB::ReadResult CZeronodeDB::Read(CZeronodeMan& znodemanToLoad, bool fDr
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    // read the data straight into the stream it is deserialized from
+    CDataStream ssZeronodes(SER_DISK, CLIENT_VERSION);
+    ssZeronodes.resize(dataSize);
     uint256 hashIn;
 
     // read data and checksum from file
     try {
-        filein.read((char*)&vchData[0], dataSize);
+        filein.read((char*)&ssZeronodes[0], dataSize);
         filein >> hashIn;
     } catch (std::exception& e) {
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -118,8 +113,6 @@ CZeronodeDB::ReadResult CZeronodeDB::Read(CZeronodeMan& znodemanToLoad, bool fDr
     }
     filein.fclose();
 
-    CDataStream ssZeronodes(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
     uint256 hashTmp = Hash(ssZeronodes.begin(), ssZeronodes.end());
     if (hashIn != hashTmp) {
@@ -195,9 +188,123 @@ void DumpZeronodes()
     LogPrint("zeronode","Zeronode dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
+CZeronodeKeyIDHasher::CZeronodeKeyIDHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CZeronodeKeyIDHasher::operator()(const CKeyID& id) const
+{
+    return CSipHasher(k0, k1).Write(id.begin(), id.size()).Finalize();
+}
+
 CZeronodeMan::CZeronodeMan()
 {
     nDsqCount = 0;
+    fIndexesDirty = false;
+    nListId = GetRand(std::numeric_limits<uint64_t>::max());
+    nListVersion = 0;
+}
+
+void CZeronodeMan::IndexZeronode(size_t i)
+{
+    const CZeronode& zn = vZeronodes[i];
+    mapOutPointIndex.insert(std::make_pair(zn.vin.prevout, i));
+    mapPayeeIndex.insert(std::make_pair(zn.pubKeyCollateralAddress.GetID(), i));
+    mapPubKeyIndex.insert(std::make_pair(zn.pubKeyZeronode.GetID(), i));
+}
+
+void CZeronodeMan::EnsureIndexes()
+{
+    AssertLockHeld(cs);
+    if (!fIndexesDirty)
+        return;
+
+    mapOutPointIndex.clear();
+    mapPayeeIndex.clear();
+    mapPubKeyIndex.clear();
+    for (size_t i = 0; i < vZeronodes.size(); i++)
+        IndexZeronode(i);
+    fIndexesDirty = false;
+}
+
+const CZeronodeMan::CZeronodeScores& CZeronodeMan::GetScores(const uint256& blockHash)
+{
+    AssertLockHeld(cs);
+
+    std::map<uint256, CZeronodeScores>::const_iterator it = mapScoreCache.find(blockHash);
+    if (it != mapScoreCache.end())
+        return it->second;
+
+    while (dequeScoreCache.size() >= ZERONODES_SCORE_CACHE_SIZE) {
+        mapScoreCache.erase(dequeScoreCache.front());
+        dequeScoreCache.pop_front();
+    }
+
+    CZeronodeScores& scores = mapScoreCache[blockHash];
+    dequeScoreCache.push_back(blockHash);
+
+    scores.vecOrdered.reserve(vZeronodes.size());
+    for (size_t i = 0; i < vZeronodes.size(); i++)
+        scores.vecOrdered.push_back(make_pair(vZeronodes[i].CalculateScore(blockHash), i));
+    sort(scores.vecOrdered.begin(), scores.vecOrdered.end(), CompareScoreDesc());
+
+    scores.vecPlace.resize(vZeronodes.size());
+    for (size_t i = 0; i < scores.vecOrdered.size(); i++)
+        scores.vecPlace[scores.vecOrdered[i].second] = i;
+
+    return scores;
+}
+
+void CZeronodeMan::ClearScoreCache()
+{
+    mapScoreCache.clear();
+    dequeScoreCache.clear();
+}
+
+void CZeronodeMan::ZeronodeUpdated(const CTxIn& vin, bool fKeysChanged)
+{
+    LOCK(cs);
+    if (fKeysChanged)
+        fIndexesDirty = true;
+    SetEntryChanged(vin.prevout);
+}
+
+void CZeronodeMan::SetEntryChanged(const COutPoint& outpoint)
+{
+    mapEntryVersion[outpoint] = ++nListVersion;
+}
+
+uint256 CZeronodeMan::GetListHash()
+{
+    LOCK(cs);
+
+    std::vector<uint256> vHashes;
+    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
+        if (zn.addr.IsRFC1918() || !zn.IsEnabled()) continue;
+        vHashes.push_back(CZeronodeBroadcast(zn).GetHash());
+    }
+    sort(vHashes.begin(), vHashes.end());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << vHashes;
+    return ss.GetHash();
+}
+
+void CZeronodeMan::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    if (fLiteMode || tx.IsCoinBase()) return;
+
+    LOCK(cs);
+    if (vZeronodes.empty()) return;
+
+    EnsureIndexes();
+    BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+        OutPointIndex::const_iterator it = mapOutPointIndex.find(txin.prevout);
+        if (it == mapOutPointIndex.end()) continue;
+
+        CZeronode& zn = vZeronodes[it->second];
+        if (zn.activeState == CZeronode::ZERONODE_VIN_SPENT) continue;
+        LogPrint("zeronode", "CZeronodeMan: Zeronode %s collateral spent by %s\n", zn.vin.prevout.ToStringShort(), tx.GetHash().ToString());
+        zn.activeState = CZeronode::ZERONODE_VIN_SPENT;
+    }
 }
 
 bool CZeronodeMan::Add(CZeronode& zn)
@@ -211,6 +318,9 @@ bool CZeronodeMan::Add(CZeronode& zn)
     if (pzn == NULL) {
         LogPrint("zeronode", "CZeronodeMan: Adding new Zeronode %s - %i now\n", zn.vin.prevout.hash.ToString(), size() + 1);
         vZeronodes.push_back(zn);
+        IndexZeronode(vZeronodes.size() - 1);
+        ClearScoreCache();
+        SetEntryChanged(zn.vin.prevout);
         return true;
     }
 
@@ -280,7 +390,10 @@ void CZeronodeMan::CheckAndRemove(bool forceExpiredRemoval)
                 }
             }
 
+            mapEntryVersion.erase((*it).vin.prevout);
             it = vZeronodes.erase(it);
+            fIndexesDirty = true;
+            ClearScoreCache();
         } else {
             ++it;
         }
@@ -342,6 +455,15 @@ void CZeronodeMan::Clear()
 {
     LOCK(cs);
     vZeronodes.clear();
+    mapOutPointIndex.clear();
+    mapPayeeIndex.clear();
+    mapPubKeyIndex.clear();
+    fIndexesDirty = false;
+    ClearScoreCache();
+    nListId = GetRand(std::numeric_limits<uint64_t>::max());
+    nListVersion = 0;
+    mapEntryVersion.clear();
+    mapPeerListVersion.clear();
     mAskedUsForZeronodeList.clear();
     mWeAskedForZeronodeList.clear();
     mWeAskedForZeronodeListEntry.clear();
@@ -432,7 +554,12 @@ void CZeronodeMan::DsegUpdate(CNode* pnode)
         }
     }
 
-    pnode->PushMessage("dseg", CTxIn());
+    // peers we synced with before only need to send what changed since
+    std::map<CNetAddr, std::pair<uint64_t, uint64_t> >::iterator itVersion = mapPeerListVersion.find(pnode->addr);
+    if (itVersion != mapPeerListVersion.end())
+        pnode->PushMessage("dsegv", itVersion->second.first, itVersion->second.second, GetListHash());
+    else
+        pnode->PushMessage("dseg", CTxIn());
     int64_t askAgain = GetTime() + ZERONODES_DSEG_SECONDS;
     mWeAskedForZeronodeList[pnode->addr] = askAgain;
 }
@@ -440,25 +567,28 @@ void CZeronodeMan::DsegUpdate(CNode* pnode)
 CZeronode* CZeronodeMan::Find(const CScript& payee)
 {
     LOCK(cs);
-    CScript payee2;
 
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
-        payee2 = GetScriptForDestination(zn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &zn;
-    }
-    return NULL;
+    // Zeronodes are paid to the P2PKH script of their collateral key
+    if (!payee.IsPayToPublicKeyHash())
+        return NULL;
+    CKeyID keyID(uint160(std::vector<unsigned char>(payee.begin() + 3, payee.begin() + 23)));
+
+    EnsureIndexes();
+    KeyIDIndex::const_iterator it = mapPayeeIndex.find(keyID);
+    if (it == mapPayeeIndex.end())
+        return NULL;
+    return &vZeronodes[it->second];
 }
 
 CZeronode* CZeronodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
-        if (zn.vin.prevout == vin.prevout)
-            return &zn;
-    }
-    return NULL;
+    EnsureIndexes();
+    OutPointIndex::const_iterator it = mapOutPointIndex.find(vin.prevout);
+    if (it == mapOutPointIndex.end())
+        return NULL;
+    return &vZeronodes[it->second];
 }
 
 
@@ -466,11 +596,11 @@ CZeronode* CZeronodeMan::Find(const CPubKey& pubKeyZeronode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
-        if (zn.pubKeyZeronode == pubKeyZeronode)
-            return &zn;
-    }
-    return NULL;
+    EnsureIndexes();
+    KeyIDIndex::const_iterator it = mapPubKeyIndex.find(pubKeyZeronode.GetID());
+    if (it == mapPubKeyIndex.end() || vZeronodes[it->second].pubKeyZeronode != pubKeyZeronode)
+        return NULL;
+    return &vZeronodes[it->second];
 }
 
 //
@@ -530,13 +660,14 @@ CZeronode* CZeronodeMan::GetNextZeronodeInQueueForPayment(int nBlockHeight, bool
     int nTenthNetwork = nMnCount / 10;
     if (nMinMnCount > nTenthNetwork) nTenthNetwork = nMinMnCount;
 
+    const CZeronodeScores& scores = GetScores(blockHash);
     int nCountTenth = 0;
     arith_uint256 nHighest = 0;
     BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecZeronodeLastPaid) {
         CZeronode* pzn = Find(s.second);
         if (!pzn) break;
 
-        arith_uint256 n = pzn->CalculateScore(blockHash);
+        const arith_uint256& n = scores.vecOrdered[scores.vecPlace[pzn - &vZeronodes[0]]].first;
         if (n > nHighest) {
             nHighest = n;
             pBestZeronode = pzn;
@@ -581,6 +712,8 @@ CZeronode* CZeronodeMan::FindRandomNotInVec(std::vector<CTxIn>& vecToExclude, in
 
 CZeronode* CZeronodeMan::GetCurrentZeroNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
+    LOCK(cs);
+
     int64_t score = 0;
     CZeronode* winner = NULL;
 
@@ -588,17 +721,17 @@ CZeronode* CZeronodeMan::GetCurrentZeroNode(int mod, int64_t nBlockHeight, int m
     uint256 blockHash = uint256();
     if(!GetBlockHash(blockHash, nBlockHeight)) return NULL;
 
-    // scan for winner
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
+    // the winner is the first enabled Zeronode in the list with the highest compact score
+    const CZeronodeScores& scores = GetScores(blockHash);
+    for (size_t i = 0; i < scores.vecOrdered.size(); i++) {
+        int64_t n2 = scores.vecOrdered[i].first.GetCompact(false);
+        if (n2 <= 0 || (winner != NULL && n2 < score)) break;
+
+        CZeronode& zn = vZeronodes[scores.vecOrdered[i].second];
         zn.Check();
         if (zn.protocolVersion < minProtocol || !zn.IsEnabled()) continue;
 
-        // calculate the score for each Zeronode
-        arith_uint256 n = zn.CalculateScore(blockHash);
-        int64_t n2 = n.GetCompact(false);
-
-        // determine the winner
-        if (n2 > score) {
+        if (winner == NULL || &zn < winner) {
             score = n2;
             winner = &zn;
         }
@@ -609,91 +742,76 @@ CZeronode* CZeronodeMan::GetCurrentZeroNode(int mod, int64_t nBlockHeight, int m
 
 int CZeronodeMan::GetZeronodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecZeronodeScores;
+    LOCK(cs);
+
     int64_t nZeronode_Min_Age = MN_WINNER_MINIMUM_AGE;
-    int64_t nZeronode_Age = 0;
+    bool fCheckAge = IsSporkActive(SPORK_8_ZERONODE_PAYMENT_ENFORCEMENT);
 
     //make sure we know about this block
     uint256 blockHash = uint256();
     if (!GetBlockHash(blockHash, nBlockHeight)) return -1;
 
-    // scan for winner
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
-        if (zn.protocolVersion < minProtocol) {
-            LogPrint("zeronode","Skipping Zeronode with obsolete version %d\n", zn.protocolVersion);
-            continue;                                                       // Skip obsolete versions
-        }
-
-        if (IsSporkActive(SPORK_8_ZERONODE_PAYMENT_ENFORCEMENT)) {
-            nZeronode_Age = GetAdjustedTime() - zn.sigTime;
-            if ((nZeronode_Age) < nZeronode_Min_Age) {
-                if (fDebug) LogPrint("zeronode","Skipping just activated Zeronode. Age: %ld\n", nZeronode_Age);
-                continue;                                                   // Skip zeronodes younger than (default) 1 hour
-            }
-        }
-        if (fOnlyActive) {
-            zn.Check();
-            if (!zn.IsEnabled()) continue;
-        }
-        arith_uint256 n = zn.CalculateScore(blockHash);
-        int64_t n2 = n.GetCompact(false);
-
-        vecZeronodeScores.push_back(make_pair(n2, zn.vin));
-    }
+    CZeronode* pzn = Find(vin);
+    if (pzn == NULL) return -1;
 
-    sort(vecZeronodeScores.rbegin(), vecZeronodeScores.rend(), CompareScoreTxIn());
+    // only the Zeronodes scoring above this one can come before it
+    const CZeronodeScores& scores = GetScores(blockHash);
+    size_t nPlace = scores.vecPlace[pzn - &vZeronodes[0]];
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecZeronodeScores) {
-        rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
+    for (size_t i = 0; i <= nPlace; i++) {
+        CZeronode& zn = vZeronodes[scores.vecOrdered[i].second];
+        bool fRanked = zn.protocolVersion >= minProtocol;                   // Skip obsolete versions
+        if (fRanked && fCheckAge && GetAdjustedTime() - zn.sigTime < nZeronode_Min_Age)
+            fRanked = false;                                                // Skip zeronodes younger than (default) 1 hour
+        if (fRanked && fOnlyActive) {
+            zn.Check();
+            fRanked = zn.IsEnabled();
         }
+        if (fRanked)
+            rank++;
+        else if (i == nPlace)
+            return -1;
     }
 
-    return -1;
+    return rank;
 }
 
 std::vector<pair<int, CZeronode> > CZeronodeMan::GetZeronodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<int64_t, CZeronode> > vecZeronodeScores;
+    LOCK(cs);
+
     std::vector<pair<int, CZeronode> > vecZeronodeRanks;
 
     //make sure we know about this block
     uint256 blockHash = uint256();
     if (!GetBlockHash(blockHash, nBlockHeight)) return vecZeronodeRanks;
 
-    // scan for winner
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
+    // enabled Zeronodes by score, then the ones not enabled
+    const CZeronodeScores& scores = GetScores(blockHash);
+    std::vector<size_t> vecNotEnabled;
+    for (size_t i = 0; i < scores.vecOrdered.size(); i++) {
+        size_t nPos = scores.vecOrdered[i].second;
+        CZeronode& zn = vZeronodes[nPos];
         zn.Check();
 
         if (zn.protocolVersion < minProtocol) continue;
 
         if (!zn.IsEnabled()) {
-            vecZeronodeScores.push_back(make_pair(9999, zn));
+            vecNotEnabled.push_back(nPos);
             continue;
         }
-
-        arith_uint256 n = zn.CalculateScore(blockHash);
-        int64_t n2 = n.GetCompact(false);
-
-        vecZeronodeScores.push_back(make_pair(n2, zn));
-    }
-
-    sort(vecZeronodeScores.rbegin(), vecZeronodeScores.rend(), CompareScoreMN());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CZeronode) & s, vecZeronodeScores) {
-        rank++;
-        vecZeronodeRanks.push_back(make_pair(rank, s.second));
+        vecZeronodeRanks.push_back(make_pair((int)vecZeronodeRanks.size() + 1, zn));
     }
+    for (size_t i = 0; i < vecNotEnabled.size(); i++)
+        vecZeronodeRanks.push_back(make_pair((int)vecZeronodeRanks.size() + 1, vZeronodes[vecNotEnabled[i]]));
 
     return vecZeronodeRanks;
 }
 
 CZeronode* CZeronodeMan::GetZeronodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecZeronodeScores;
+    LOCK(cs);
 
     uint256 blockHash;
     if(!GetBlockHash(blockHash, nBlockHeight)) {
@@ -701,27 +819,19 @@ CZeronode* CZeronodeMan::GetZeronodeByRank(int nRank, int64_t nBlockHeight, int
         return NULL;
     }
 
-    // scan for winner
-    BOOST_FOREACH (CZeronode& zn, vZeronodes) {
+    const CZeronodeScores& scores = GetScores(blockHash);
+    int rank = 0;
+    for (size_t i = 0; i < scores.vecOrdered.size(); i++) {
+        CZeronode& zn = vZeronodes[scores.vecOrdered[i].second];
         if (zn.protocolVersion < minProtocol) continue;
         if (fOnlyActive) {
             zn.Check();
             if (!zn.IsEnabled()) continue;
         }
 
-        arith_uint256 n = zn.CalculateScore(blockHash);
-        int64_t n2 = n.GetCompact(false);
-
-        vecZeronodeScores.push_back(make_pair(n2, zn.vin));
-    }
-
-    sort(vecZeronodeScores.rbegin(), vecZeronodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecZeronodeScores) {
         rank++;
         if (rank == nRank) {
-            return Find(s.second);
+            return &zn;
         }
     }
 
@@ -828,22 +938,7 @@ void CZeronodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
         vRecv >> vin;
 
         if (vin == CTxIn()) { //only should ask for this once
-            //local network
-            bool isLocal = (pfrom->addr.IsRFC1918() || pfrom->addr.IsLocal());
-
-            if (!isLocal && NetworkIdFromCommandLine() == CBaseChainParams::MAIN) {
-                std::map<CNetAddr, int64_t>::iterator i = mAskedUsForZeronodeList.find(pfrom->addr);
-                if (i != mAskedUsForZeronodeList.end()) {
-                    int64_t t = (*i).second;
-                    if (GetTime() < t) {
-                        Misbehaving(pfrom->GetId(), 34);
-                        LogPrint("zeronode","dseg - peer already asked me for the list\n");
-                        return;
-                    }
-                }
-                int64_t askAgain = GetTime() + ZERONODES_DSEG_SECONDS;
-                mAskedUsForZeronodeList[pfrom->addr] = askAgain;
-            }
+            if (!AllowListRequest(pfrom)) return;
         } //else, asking for a specific node which is ok
 
 
@@ -855,13 +950,9 @@ void CZeronodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
             if (zn.IsEnabled()) {
                 LogPrint("zeronode", "dseg - Sending Zeronode entry - %s \n", zn.vin.prevout.hash.ToString());
                 if (vin == CTxIn() || vin == zn.vin) {
-                    CZeronodeBroadcast znb = CZeronodeBroadcast(zn);
-                    uint256 hash = znb.GetHash();
-                    pfrom->PushInventory(CInv(MSG_ZERONODE_ANNOUNCE, hash));
+                    PushZeronodeInventory(pfrom, zn);
                     nInvCount++;
 
-                    if (!mapSeenZeronodeBroadcast.count(hash)) mapSeenZeronodeBroadcast.insert(make_pair(hash, znb));
-
                     if (vin == zn.vin) {
                         LogPrint("zeronode", "dseg - Sent 1 Zeronode entry to peer %i\n", pfrom->GetId());
                         return;
@@ -871,10 +962,89 @@ void CZeronodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
         }
 
         if (vin == CTxIn()) {
+            pfrom->PushMessage("znlv", nListId, nListVersion, GetListHash());
             pfrom->PushMessage("ssc", ZERONODE_SYNC_LIST, nInvCount);
             LogPrint("zeronode", "dseg - Sent %d Zeronode entries to peer %i\n", nInvCount, pfrom->GetId());
         }
+
+    } else if (strCommand == "dsegv") { //Get the changes to the Zeronode list since a version of it
+
+        uint64_t nPeerListId;
+        uint64_t nSinceVersion;
+        uint256 hashPeerList;
+        vRecv >> nPeerListId >> nSinceVersion >> hashPeerList;
+
+        if (!AllowListRequest(pfrom)) return;
+
+        // nothing to send when the peer's list commits to the same broadcasts as ours,
+        // only the changes when it last synced with this same list, and everything otherwise
+        uint256 hashList = GetListHash();
+        bool fChangesOnly = (nPeerListId == nListId && nSinceVersion <= nListVersion);
+        int nInvCount = 0;
+
+        if (hashPeerList != hashList) {
+            BOOST_FOREACH (CZeronode& zn, vZeronodes) {
+                if (zn.addr.IsRFC1918()) continue; //local network
+                if (!zn.IsEnabled()) continue;
+                if (fChangesOnly && mapEntryVersion[zn.vin.prevout] <= nSinceVersion) continue;
+
+                PushZeronodeInventory(pfrom, zn);
+                nInvCount++;
+            }
+        }
+
+        pfrom->PushMessage("znlv", nListId, nListVersion, hashList);
+        pfrom->PushMessage("ssc", ZERONODE_SYNC_LIST, nInvCount);
+        LogPrint("zeronode", "dsegv - Sent %d Zeronode entries changed since version %d to peer %i\n", nInvCount, fChangesOnly ? nSinceVersion : 0, pfrom->GetId());
+
+    } else if (strCommand == "znlv") { //Version of the Zeronode list a peer just sent us
+
+        uint64_t nPeerListId;
+        uint64_t nPeerListVersion;
+        uint256 hashPeerList;
+        vRecv >> nPeerListId >> nPeerListVersion >> hashPeerList;
+
+        // only from peers we asked for the list
+        if (!mWeAskedForZeronodeList.count(pfrom->addr)) return;
+
+        if (!mapPeerListVersion.count(pfrom->addr) && mapPeerListVersion.size() >= ZERONODES_MAX_PEER_LIST_VERSIONS)
+            mapPeerListVersion.erase(mapPeerListVersion.begin());
+        mapPeerListVersion[pfrom->addr] = std::make_pair(nPeerListId, nPeerListVersion);
+
+        // our list is complete as far as this peer knows, count that as sync progress
+        if (hashPeerList == GetListHash())
+            zeronodeSync.lastZeronodeList = GetTime();
+    }
+}
+
+bool CZeronodeMan::AllowListRequest(CNode* pfrom)
+{
+    //local network
+    bool isLocal = (pfrom->addr.IsRFC1918() || pfrom->addr.IsLocal());
+
+    if (!isLocal && NetworkIdFromCommandLine() == CBaseChainParams::MAIN) {
+        std::map<CNetAddr, int64_t>::iterator i = mAskedUsForZeronodeList.find(pfrom->addr);
+        if (i != mAskedUsForZeronodeList.end()) {
+            int64_t t = (*i).second;
+            if (GetTime() < t) {
+                Misbehaving(pfrom->GetId(), 34);
+                LogPrint("zeronode","dseg - peer already asked me for the list\n");
+                return false;
+            }
+        }
+        int64_t askAgain = GetTime() + ZERONODES_DSEG_SECONDS;
+        mAskedUsForZeronodeList[pfrom->addr] = askAgain;
     }
+    return true;
+}
+
+void CZeronodeMan::PushZeronodeInventory(CNode* pfrom, CZeronode& zn)
+{
+    CZeronodeBroadcast znb = CZeronodeBroadcast(zn);
+    uint256 hash = znb.GetHash();
+    pfrom->PushInventory(CInv(MSG_ZERONODE_ANNOUNCE, hash));
+
+    if (!mapSeenZeronodeBroadcast.count(hash)) mapSeenZeronodeBroadcast.insert(make_pair(hash, znb));
 }
 
 void CZeronodeMan::Remove(CTxIn vin)
@@ -885,7 +1055,10 @@ void CZeronodeMan::Remove(CTxIn vin)
     while (it != vZeronodes.end()) {
         if ((*it).vin == vin) {
             LogPrint("zeronode", "CZeronodeMan: Removing Zeronode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
+            mapEntryVersion.erase((*it).vin.prevout);
             vZeronodes.erase(it);
+            fIndexesDirty = true;
+            ClearScoreCache();
             break;
         }
         ++it;
@@ -919,3 +1092,20 @@ std::string CZeronodeMan::ToString() const
 
     return info.str();
 }
+
+size_t CZeronodeMan::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    size_t nUsage = memusage::DynamicUsage(vZeronodes);
+    for (const CZeronode& zn : vZeronodes)
+        nUsage += memusage::DynamicUsage(zn.sig) + memusage::DynamicUsage(zn.lastPing.vchSig);
+    nUsage += memusage::DynamicUsage(mapOutPointIndex) + memusage::DynamicUsage(mapPayeeIndex) +
+              memusage::DynamicUsage(mapPubKeyIndex);
+    nUsage += memusage::DynamicUsage(mapScoreCache);
+    for (const auto& scores : mapScoreCache)
+        nUsage += memusage::DynamicUsage(scores.second.vecOrdered) + memusage::DynamicUsage(scores.second.vecPlace);
+    nUsage += memusage::DynamicUsage(mAskedUsForZeronodeList) + memusage::DynamicUsage(mWeAskedForZeronodeList) +
+              memusage::DynamicUsage(mWeAskedForZeronodeListEntry) + memusage::DynamicUsage(mapEntryVersion) +
+              memusage::DynamicUsage(mapPeerListVersion);
+    return nUsage;
+}
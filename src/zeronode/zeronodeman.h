@@ -14,10 +14,15 @@
 #include "net.h"
 #include "sync.h"
 #include "util.h"
+#include "validationinterface.h"
+
+#include <deque>
 
 #define ZERONODES_DUMP_SECONDS (15 * 60)
 #define ZERONODES_DSEG_SECONDS (3 * 60 * 60)
 #define ZERONODES_MIN_PAYMENT_COUNT 10
+#define ZERONODES_SCORE_CACHE_SIZE 16
+#define ZERONODES_MAX_PEER_LIST_VERSIONS 256
 
 using namespace std;
 
@@ -50,7 +55,19 @@ public:
     ReadResult Read(CZeronodeMan& znodemanToLoad, bool fDryRun = false);
 };
 
-class CZeronodeMan
+/** Salted hasher for the key IDs in the zeronode indexes */
+class CZeronodeKeyIDHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CZeronodeKeyIDHasher();
+
+    size_t operator()(const CKeyID& id) const;
+};
+
+class CZeronodeMan : public CValidationInterface
 {
 private:
     // critical section to protect the inner data structures
@@ -61,6 +78,25 @@ private:
 
     // map to hold all MNs
     std::vector<CZeronode> vZeronodes;
+    // positions in vZeronodes by collateral outpoint, collateral key ID (the payee) and zeronode key ID;
+    // where several entries share a key the first one is indexed, as the linear scans used to find it
+    typedef boost::unordered_map<COutPoint, size_t, CMemPoolOutPointHasher> OutPointIndex;
+    typedef boost::unordered_map<CKeyID, size_t, CZeronodeKeyIDHasher> KeyIDIndex;
+    OutPointIndex mapOutPointIndex;
+    KeyIDIndex mapPayeeIndex;
+    KeyIDIndex mapPubKeyIndex;
+    // the indexes have to be rebuilt before the next lookup
+    bool fIndexesDirty;
+
+    // the scores of all entries for one block, from the highest down (ties by position),
+    // and for every position in vZeronodes its place in that order
+    struct CZeronodeScores {
+        std::vector<std::pair<arith_uint256, size_t> > vecOrdered;
+        std::vector<size_t> vecPlace;
+    };
+    // scores of the last ZERONODES_SCORE_CACHE_SIZE blocks asked for, dropped whenever vZeronodes changes
+    std::map<uint256, CZeronodeScores> mapScoreCache;
+    std::deque<uint256> dequeScoreCache;
     // who's asked for the Zeronode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForZeronodeList;
     // who we asked for the Zeronode list and the last time
@@ -68,6 +104,33 @@ private:
     // which Zeronodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForZeronodeListEntry;
 
+    // the list version, bumped whenever an entry is added or updated from a newer broadcast,
+    // and the version at which each entry last changed; the random list id tells the version
+    // counters of different nodes apart
+    uint64_t nListId;
+    uint64_t nListVersion;
+    std::map<COutPoint, uint64_t> mapEntryVersion;
+    // id and version of the list of each peer we last synced with incrementally
+    std::map<CNetAddr, std::pair<uint64_t, uint64_t> > mapPeerListVersion;
+
+    /// Record that an entry changed
+    void SetEntryChanged(const COutPoint& outpoint);
+    /// Whether a peer may ask for the whole list (or the changes to it) now
+    bool AllowListRequest(CNode* pfrom);
+    void PushZeronodeInventory(CNode* pfrom, CZeronode& zn);
+
+    /// Add the entry at position i to the indexes
+    void IndexZeronode(size_t i);
+    /// Rebuild the indexes if the vector changed under them
+    void EnsureIndexes();
+    /// Scores of all entries for a block, from the cache when possible
+    const CZeronodeScores& GetScores(const uint256& blockHash);
+    void ClearScoreCache();
+
+protected:
+    /// Flag the Zeronodes whose collateral a transaction spends, as it enters the mempool or a block
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CZeronodeBroadcast> mapSeenZeronodeBroadcast;
@@ -91,6 +154,15 @@ public:
 
         READWRITE(mapSeenZeronodeBroadcast);
         READWRITE(mapSeenZeronodePing);
+
+        READWRITE(nListId);
+        READWRITE(nListVersion);
+        READWRITE(mapEntryVersion);
+        READWRITE(mapPeerListVersion);
+        if (ser_action.ForRead()) {
+            fIndexesDirty = true;
+            ClearScoreCache();
+        }
     }
 
     CZeronodeMan();
@@ -153,8 +225,17 @@ public:
 
     std::string ToString() const;
 
+    /// Estimated heap usage of the list, its indexes and the request maps
+    size_t DynamicMemoryUsage() const;
+
     void Remove(CTxIn vin);
 
+    /// Note that an entry was updated from a newer broadcast through a pointer returned by Find
+    void ZeronodeUpdated(const CTxIn& vin, bool fKeysChanged);
+
+    /// Hash committing to the broadcasts of the entries a "dseg" request would be sent
+    uint256 GetListHash();
+
     /// Update zeronode list and maps using provided CZeronodeBroadcast
     void UpdateZeronodeList(CZeronodeBroadcast znb);
 };
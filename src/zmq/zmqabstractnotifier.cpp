@@ -16,7 +16,7 @@ bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
     return true;
 }
 
-bool CZMQAbstractNotifier::NotifyBlock(const CBlock &)
+bool CZMQAbstractNotifier::NotifyCheckedBlock(const uint256 &/*hash*/, const CNotificationPayload &/*payload*/)
 {
     return true;
 }
@@ -25,3 +25,17 @@ bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &transaction, bool /*fInBlock*/)
+{
+    return NotifyTransaction(transaction);
+}
+
+void CZMQAbstractNotifier::NotifyTransactionsDropped(unsigned int /*nCount*/)
+{
+}
+
+bool CZMQAbstractNotifier::NotifyWalletNote(const std::string &/*strEvent*/)
+{
+    return true;
+}
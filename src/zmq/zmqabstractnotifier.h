@@ -6,6 +6,7 @@
 #define BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
 
 #include "zmqconfig.h"
+#include "notificationpublisher.h"
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
@@ -15,7 +16,7 @@ typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 class CZMQAbstractNotifier
 {
 public:
-    CZMQAbstractNotifier() : psocket(0) { }
+    CZMQAbstractNotifier() : psocket(0), nHighWaterMark(DEFAULT_NOTIFICATION_HWM) { }
     virtual ~CZMQAbstractNotifier();
 
     template <typename T>
@@ -28,18 +29,26 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    void SetHighWaterMark(int n) { nHighWaterMark = n; }
 
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyBlock(const CBlock& pblock);
+    virtual bool NotifyCheckedBlock(const uint256 &hash, const CNotificationPayload &payload);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    //! Defaults to the call above; fInBlock is false for transactions entering the mempool
+    virtual bool NotifyTransaction(const CTransaction &transaction, bool fInBlock);
+    //! nCount transaction notifications were dropped over the high-water mark
+    virtual void NotifyTransactionsDropped(unsigned int nCount);
+    //! strEvent is a wallet note event as JSON
+    virtual bool NotifyWalletNote(const std::string &strEvent);
 
 protected:
     void *psocket;
     std::string type;
     std::string address;
+    int nHighWaterMark;
 };
 
 #endif // BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
@@ -9,13 +9,18 @@
 #include "main.h"
 #include "streams.h"
 #include "util.h"
+#include "utilstrencodings.h"
+
+#include <memory>
 
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() :
+    pcontext(NULL), publisher("zmq"), nHighWaterMark(DEFAULT_NOTIFICATION_HWM),
+    fCheckedBlocks(false), fTransactions(false), fWalletNotes(false)
 {
 }
 
@@ -34,12 +39,22 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     CZMQNotificationInterface* notificationInterface = NULL;
     std::map<std::string, CZMQNotifierFactory> factories;
     std::list<CZMQAbstractNotifier*> notifiers;
+    size_t nHighWaterMark = DEFAULT_NOTIFICATION_HWM;
+    bool fCheckedBlocks = false;
+    bool fTransactions = false;
+    bool fWalletNotes = false;
+
+    std::map<std::string, std::string>::const_iterator hwm = args.find("-notificationhwm");
+    if (hwm != args.end())
+        nHighWaterMark = std::max<int64_t>(1, atoi64(hwm->second));
 
     factories["pubhashblock"] = CZMQAbstractNotifier::Create<CZMQPublishHashBlockNotifier>;
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubrawtxbatch"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionBatchNotifier>;
     factories["pubcheckedblock"] = CZMQAbstractNotifier::Create<CZMQPublishCheckedBlockNotifier>;
+    factories["pubwalletnote"] = CZMQAbstractNotifier::Create<CZMQPublishWalletNoteNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -51,7 +66,15 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
             CZMQAbstractNotifier *notifier = factory();
             notifier->SetType(i->first);
             notifier->SetAddress(address);
+            notifier->SetHighWaterMark(nHighWaterMark);
             notifiers.push_back(notifier);
+
+            if (i->first == "pubcheckedblock")
+                fCheckedBlocks = true;
+            if (i->first == "pubhashtx" || i->first == "pubrawtx" || i->first == "pubrawtxbatch")
+                fTransactions = true;
+            if (i->first == "pubwalletnote")
+                fWalletNotes = true;
         }
     }
 
@@ -59,6 +82,10 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     {
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
+        notificationInterface->nHighWaterMark = nHighWaterMark;
+        notificationInterface->fCheckedBlocks = fCheckedBlocks;
+        notificationInterface->fTransactions = fTransactions;
+        notificationInterface->fWalletNotes = fWalletNotes;
 
         if (!notificationInterface->Initialize())
         {
@@ -104,6 +131,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    publisher.Start(nHighWaterMark);
     return true;
 }
 
@@ -111,6 +139,7 @@ bool CZMQNotificationInterface::Initialize()
 void CZMQNotificationInterface::Shutdown()
 {
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
+    publisher.Stop();
     if (pcontext)
     {
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
@@ -125,12 +154,13 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+template <typename F>
+void CZMQNotificationInterface::ForEachNotifier(F f)
 {
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex))
+        if (f(notifier))
         {
             i++;
         }
@@ -142,40 +172,58 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
     }
 }
 
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    publisher.Push([this, pindex](unsigned int) {
+        ForEachNotifier([pindex](CZMQAbstractNotifier *notifier) {
+            return notifier->NotifyBlock(pindex);
+        });
+    }, false);
+}
+
 void CZMQNotificationInterface::BlockChecked(const CBlock& block, const CValidationState& state)
 {
-    if (state.IsInvalid()) {
+    if (state.IsInvalid() || !fCheckedBlocks) {
         return;
     }
 
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(block))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    // The block is only valid for the duration of the call
+    uint256 hash = block.GetHash();
+    CNotificationPayload payload = GetBlockPayload(block);
+    publisher.Push([this, hash, payload](unsigned int) {
+        ForEachNotifier([&hash, &payload](CZMQAbstractNotifier *notifier) {
+            return notifier->NotifyCheckedBlock(hash, payload);
+        });
+    }, false);
 }
 
 void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
+    if (!fTransactions) {
+        return;
     }
+
+    // Transactions of blocks are not dropped, those coming into the mempool may be
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    bool fInBlock = pblock != NULL;
+    publisher.Push([this, ptx, fInBlock](unsigned int nDropped) {
+        ForEachNotifier([&ptx, fInBlock, nDropped](CZMQAbstractNotifier *notifier) {
+            if (nDropped)
+                notifier->NotifyTransactionsDropped(nDropped);
+            return notifier->NotifyTransaction(*ptx, fInBlock);
+        });
+    }, !fInBlock);
+}
+
+void CZMQNotificationInterface::NotifyWalletNote(const std::string &strEvent)
+{
+    if (!fWalletNotes) {
+        return;
+    }
+
+    publisher.Push([this, strEvent](unsigned int) {
+        ForEachNotifier([&strEvent](CZMQAbstractNotifier *notifier) {
+            return notifier->NotifyWalletNote(strEvent);
+        });
+    }, false);
 }
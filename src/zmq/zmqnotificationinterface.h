@@ -7,6 +7,7 @@
 
 #include "validationinterface.h"
 #include "consensus/validation.h"
+#include "notificationpublisher.h"
 #include <string>
 #include <map>
 
@@ -20,6 +21,11 @@ public:
 
     static CZMQNotificationInterface* CreateWithArguments(const std::map<std::string, std::string> &args);
 
+    //! Whether NotifyWalletNote publishes anything
+    bool WantsWalletNotes() const { return fWalletNotes; }
+    //! Publish a wallet note event, as JSON; never dropped
+    void NotifyWalletNote(const std::string &strEvent);
+
 protected:
     bool Initialize();
     void Shutdown();
@@ -32,8 +38,19 @@ protected:
 private:
     CZMQNotificationInterface();
 
+    //! Call f for every notifier, and shut down the ones it fails for
+    template <typename F>
+    void ForEachNotifier(F f);
+
     void *pcontext;
+    //! Only used from the publisher thread once it is started
     std::list<CZMQAbstractNotifier*> notifiers;
+    CNotificationPublisher publisher;
+    size_t nHighWaterMark;
+    //! Whether any notifier publishes checked blocks, or transactions
+    bool fCheckedBlocks;
+    bool fTransactions;
+    bool fWalletNotes;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
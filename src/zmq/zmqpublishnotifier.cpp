@@ -2,10 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
-#include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "serialize.h"
+#include "streams.h"
 #include "util.h"
+#include "utiltime.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
@@ -14,6 +16,14 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_RAWTXBATCH = "rawtxbatch";
+static const char *MSG_WALLETNOTE = "walletnote";
+
+//! Most transactions and bytes in one rawtxbatch message
+static const size_t MAX_BATCH_TRANSACTIONS = 100;
+static const size_t MAX_BATCH_SIZE = 1000000;
+//! Microseconds a transaction waits in a batch before the next one sends it
+static const int64_t MAX_BATCH_DELAY = 1000000;
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -71,7 +81,16 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        // Let zmq drop messages for slow subscribers rather than queue them without bound
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &nHighWaterMark, sizeof(nHighWaterMark));
+        if (rc!=0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            zmq_close(psocket);
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
@@ -165,41 +184,81 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CNotificationPayload payload = GetBlockPayload(pindex);
+    if (!payload)
     {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+        zmqError("Can't read block from disk");
+        return false;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, payload->data(), payload->size());
 }
 
-bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block)
+bool CZMQPublishCheckedBlockNotifier::NotifyCheckedBlock(const uint256 &hash, const CNotificationPayload &payload)
 {
-    LogPrint("zmq", "zmq: Publish checkedblock %s\n", block.GetHash().GetHex());
-
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        ss << block;
-    }
-
-    return SendMessage(MSG_CHECKEDBLOCK, &(*ss.begin()), ss.size());
+    LogPrint("zmq", "zmq: Publish checkedblock %s\n", hash.GetHex());
+    return SendMessage(MSG_CHECKEDBLOCK, payload->data(), payload->size());
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
+    CNotificationPayload payload = GetTransactionPayload(transaction);
+    return SendMessage(MSG_RAWTX, payload->data(), payload->size());
+}
+
+bool CZMQPublishWalletNoteNotifier::NotifyWalletNote(const std::string &strEvent)
+{
+    LogPrint("zmq", "zmq: Publish walletnote %s\n", strEvent);
+    return SendMessage(MSG_WALLETNOTE, strEvent.data(), strEvent.size());
+}
+
+bool CZMQPublishRawTransactionBatchNotifier::SendBatch()
+{
+    if (vBatch.empty())
+        return true;
+
+    LogPrint("zmq", "zmq: Publish rawtxbatch of %u transactions\n", vBatch.size());
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    WriteCompactSize(ss, vBatch.size());
+    std::vector<char> data(ss.begin(), ss.end());
+    data.reserve(data.size() + nBatchSize);
+    for (const CNotificationPayload& payload : vBatch)
+        data.insert(data.end(), payload->begin(), payload->end());
+    vBatch.clear();
+    nBatchSize = 0;
+
+    return SendMessage(MSG_RAWTXBATCH, data.data(), data.size());
+}
+
+bool CZMQPublishRawTransactionBatchNotifier::NotifyTransaction(const CTransaction &transaction, bool fInBlock)
+{
+    if (fInBlock)
+        return true;
+
+    int64_t nNow = GetTimeMicros();
+    if (!vBatch.empty() && nNow - nBatchStart >= MAX_BATCH_DELAY && !SendBatch())
+        return false;
+
+    CNotificationPayload payload = GetTransactionPayload(transaction);
+    if (vBatch.empty())
+        nBatchStart = nNow;
+    vBatch.push_back(payload);
+    nBatchSize += payload->size();
+
+    if (vBatch.size() >= MAX_BATCH_TRANSACTIONS || nBatchSize >= MAX_BATCH_SIZE)
+        return SendBatch();
+    return true;
+}
+
+bool CZMQPublishRawTransactionBatchNotifier::NotifyBlock(const CBlockIndex * /*pindex*/)
+{
+    return SendBatch();
+}
+
+void CZMQPublishRawTransactionBatchNotifier::Shutdown()
+{
+    SendBatch();
+    CZMQAbstractPublishNotifier::Shutdown();
 }
@@ -7,6 +7,8 @@
 
 #include "zmqabstractnotifier.h"
 
+#include <vector>
+
 class CBlockIndex;
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
@@ -15,6 +17,7 @@ private:
     uint32_t nSequence; //! upcounting per message sequence number
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0) { }
 
     /* send zmq multipart message
        parts:
@@ -23,6 +26,8 @@ public:
           * message sequence number
     */
     bool SendMessage(const char *command, const void* data, size_t size);
+    //! Leave a gap in the sequence numbers for messages that were not sent
+    void SkipSequence(unsigned int nCount) { nSequence += nCount; }
 
     bool Initialize(void *pcontext);
     void Shutdown();
@@ -37,7 +42,9 @@ public:
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    using CZMQAbstractNotifier::NotifyTransaction;
     bool NotifyTransaction(const CTransaction &transaction);
+    void NotifyTransactionsDropped(unsigned int nCount) { SkipSequence(nCount); }
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
@@ -49,13 +56,45 @@ public:
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    using CZMQAbstractNotifier::NotifyTransaction;
     bool NotifyTransaction(const CTransaction &transaction);
+    void NotifyTransactionsDropped(unsigned int nCount) { SkipSequence(nCount); }
+};
+
+/**
+ * Publishes the transactions entering the mempool in batches: a compact
+ * size count followed by the raw transactions. A batch is sent when it is
+ * full, when a new transaction comes after the batch is a second old, and
+ * when a block is connected.
+ */
+class CZMQPublishRawTransactionBatchNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    std::vector<CNotificationPayload> vBatch;
+    size_t nBatchSize;
+    int64_t nBatchStart;
+
+    bool SendBatch();
+
+public:
+    CZMQPublishRawTransactionBatchNotifier() : nBatchSize(0), nBatchStart(0) { }
+
+    using CZMQAbstractNotifier::NotifyTransaction;
+    bool NotifyTransaction(const CTransaction &transaction, bool fInBlock);
+    bool NotifyBlock(const CBlockIndex *pindex);
+    void Shutdown();
+};
+
+class CZMQPublishWalletNoteNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyWalletNote(const std::string &strEvent);
 };
 
 class CZMQPublishCheckedBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlock &block);
+    bool NotifyCheckedBlock(const uint256 &hash, const CNotificationPayload &payload);
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H